@@ -26,23 +26,30 @@
 #include "log_udp.h"
 
 #include "ccd_buffer.h"
+#include "ccd_clock_model.h"
 #include "ccd_command.h"
 #include "ccd_exposure.h"
 #include "ccd_fits_filename.h"
 #include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
 #include "ccd_setup.h"
 #include "ccd_temperature.h"
 
+#include "moptop_calibrate.h"
 #include "moptop_config.h"
 #include "moptop_fits_header.h"
 #include "moptop_general.h"
+#include "moptop_master.h"
 #include "moptop_multrun.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
 
 /* hash defines */
 /**
  * Length of FITS filename string.
+ * @see moptop_writer.html#MOPTOP_WRITER_FILENAME_LENGTH
  */
-#define BIAS_DARK_FITS_FILENAME_LENGTH  (256)
+#define BIAS_DARK_FITS_FILENAME_LENGTH  (MOPTOP_WRITER_FILENAME_LENGTH)
 
 /* data types */
 /**
@@ -54,6 +61,7 @@
  *                                            taken at the start of a multrun. Used to populate FITS headers.</dd>
  * <dt>Requested_Exposure_Length</dt> <dd>A copy of the requested exposure length (in seconds) 
  *                                        used to configure the CCD camera. Used to populate FITS headers.</dd>
+ * <dt>Exposure_Type</dt> <dd>The type of frames being acquired (bias or dark). Used to populate FITS headers.</dd>
  * <dt>Image_Index</dt> <dd>Which frame in the multrun we are currently working on.</dd>
  * <dt>Image_Count</dt> <dd>The number of FITS images we are expecting to generate in the current multrun.</dd>
  * <dt>Multrun_Start_Time</dt> <dd>A timestamp taken the first time an exposure was started in the multrun 
@@ -64,6 +72,10 @@
  *                              the timestamp is only approximate).</dd>
  * <dt>Flip_X</dt> <dd>A boolean, if TRUE flip the image data in the X (horizontal) direction.</dd>
  * <dt>Flip_Y</dt> <dd>A boolean, if TRUE flip the image data in the Y (vertical) direction.</dd>
+ * <dt>Native_Fits_Writer</dt> <dd>A boolean, if TRUE write FITS images using the native FITS writer 
+ *                                 (CCD_Fits_Image_Write), otherwise use CFITSIO.</dd>
+ * <dt>Master_Run_Number</dt> <dd>The run number of the last frame of the bias/dark, used in the filename of
+ *                                the master frame combined from it's frames.</dd>
  * </dl>
  */
 struct Bias_Dark_Struct
@@ -71,12 +83,31 @@ struct Bias_Dark_Struct
 	double CCD_Temperature;
 	char CCD_Temperature_Status_String[64];
 	double Requested_Exposure_Length;
+	enum CCD_FITS_FILENAME_EXPOSURE_TYPE Exposure_Type;
 	int Image_Index;
 	int Image_Count;
 	struct timespec Multrun_Start_Time;
 	struct timespec Exposure_Start_Time;
 	int Flip_X;
 	int Flip_Y;
+	int Native_Fits_Writer;
+	int Master_Run_Number;
+};
+
+/**
+ * Enumeration of the FITS header keywords whose values change every frame of a bias or dark. These are the slots
+ * in the bias/dark FITS header template that are overwritten for each frame. The order must match
+ * Bias_Dark_Header_Slot_Keyword_List.
+ * @see #Bias_Dark_Header_Slot_Keyword_List
+ * @see #Bias_Dark_Header_Template
+ */
+enum BIAS_DARK_HEADER_SLOT
+{
+	BIAS_DARK_HEADER_SLOT_DATE=0,BIAS_DARK_HEADER_SLOT_DATE_OBS,BIAS_DARK_HEADER_SLOT_UTSTART,
+	BIAS_DARK_HEADER_SLOT_MJD,BIAS_DARK_HEADER_SLOT_DATE_END,BIAS_DARK_HEADER_SLOT_UTEND,
+	BIAS_DARK_HEADER_SLOT_TELAPSE,BIAS_DARK_HEADER_SLOT_RUNNUM,BIAS_DARK_HEADER_SLOT_EXPNUM,
+	BIAS_DARK_HEADER_SLOT_PICNUM,BIAS_DARK_HEADER_SLOT_CAMTIME,BIAS_DARK_HEADER_SLOT_CAMUTC,
+	BIAS_DARK_HEADER_SLOT_CLKUNCER,BIAS_DARK_HEADER_SLOT_COUNT
 };
 	
 /* internal data */
@@ -90,20 +121,39 @@ static char rcsid[] = "$Id$";
  * <dt>CCD_Temperature</dt>               <dd>0.0</dd>
  * <dt>CCD_Temperature_Status_String</dt> <dd>""</dd>
  * <dt>Requested_Exposure_Length</dt>     <dd>0.0</dd>
+ * <dt>Exposure_Type</dt>                 <dd>CCD_FITS_FILENAME_EXPOSURE_TYPE_BIAS</dd>
  * <dt>Image_Index</dt>                   <dd>0</dd>
  * <dt>Image_Count</dt>                   <dd>0</dd>
  * <dt>Multrun_Start_Time</dt>            <dd>{0,0}</dd>
  * <dt>Exposure_Start_Time</dt>           <dd>{0,0}</dd>
  * <dt>Flip_X</dt>                        <dd>FALSE</dd>
  * <dt>Flip_Y</dt>                        <dd>FALSE</dd>
+ * <dt>Native_Fits_Writer</dt>            <dd>FALSE</dd>
+ * <dt>Master_Run_Number</dt>             <dd>0</dd>
  * </dl>
  * @see #Bias_Dark_Struct
  */
 static struct Bias_Dark_Struct Bias_Dark_Data =
 {
-	0.0,"",0.0,-1,0,{0,0},{0,0},FALSE,FALSE
+	0.0,"",0.0,CCD_FITS_FILENAME_EXPOSURE_TYPE_BIAS,-1,0,{0,0},{0,0},FALSE,FALSE,FALSE,0
 };
 
+/**
+ * The keywords of the per-frame slots in the bias/dark FITS header template, in BIAS_DARK_HEADER_SLOT order.
+ * @see #BIAS_DARK_HEADER_SLOT
+ */
+static char *Bias_Dark_Header_Slot_Keyword_List[BIAS_DARK_HEADER_SLOT_COUNT] =
+{
+	"DATE","DATE-OBS","UTSTART","MJD","DATE-END","UTEND","TELAPSE","RUNNUM","EXPNUM","PICNUM","CAMTIME",
+	"CAMUTC","CLKUNCER"
+};
+/**
+ * The bias/dark FITS header template. This is created once per bias/dark (by Bias_Dark_Fits_Header_Template_Create),
+ * and is then read-only whilst the writer threads copy it into each frame's FITS header.
+ * @see #Bias_Dark_Fits_Header_Template_Create
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Struct
+ */
+static struct Moptop_Fits_Header_Template_Struct Bias_Dark_Header_Template;
 /**
  * Is a bias or dark in progress.
  */
@@ -119,11 +169,13 @@ static int Bias_Dark_Acquire_Images(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposur
 				    char ***filename_list,int *filename_count);
 static int Bias_Dark_Get_Fits_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,
 				       char *filename,int filename_length);
-static int Bias_Dark_Write_Fits_Image(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,double pco_exposure_length_s,
-				      struct timespec exposure_end_time,int camera_image_number,
-				      struct timespec camera_timestamp,
-				      unsigned char *image_buffer,
-				      int image_buffer_length,char *filename);
+static int Bias_Dark_Fits_Headers_Set(struct Moptop_Writer_Frame_Struct *frame);
+static int Bias_Dark_Fits_Header_Template_Create(double exposure_length);
+static int Bias_Dark_Fits_Headers_Patch(struct Moptop_Writer_Frame_Struct *frame,char *card_image_list);
+static int Bias_Dark_Write_Fits_Image(struct Moptop_Writer_Frame_Struct *frame);
+static void Bias_Dark_Master_Frame(struct Moptop_Writer_Frame_Struct *frame);
+static int Bias_Dark_Write_Fits_Image_Cfitsio(struct Moptop_Writer_Frame_Struct *frame,char *filename,
+					      char *card_image_list,int ncols_binned,int nrows_binned);
 
 /* ----------------------------------------------------------------------------
 ** 		external functions 
@@ -499,6 +551,8 @@ int Moptop_Bias_Dark_Run_Get(void)
  *     (for later inclusion in the FITS headers).
  * <li>Set the image data flipping (Moptop_Bias_Dark_Flip_Set) from the relevant config 
  *     ("moptop.multrun.image.flip.x|y").
+ * <li>Set whether to use the native FITS writer (Bias_Dark_Data.Native_Fits_Writer) from the relevant config 
+ *     ("moptop.multrun.writer.native.enable").
  * </ul>
  * @return The routine returns TRUE on success, and FALSE if an error occurs.
  * @see #Bias_Dark_Data
@@ -536,6 +590,9 @@ static int Bias_Dark_Setup(void)
 	if(!Moptop_Config_Get_Boolean("moptop.multrun.image.flip.y",&flip_y))
 		return FALSE;		
 	Moptop_Bias_Dark_Flip_Set(flip_x,flip_y);
+	/* configure which FITS writer to use. Use same config as multruns. */
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.writer.native.enable",&(Bias_Dark_Data.Native_Fits_Writer)))
+		return FALSE;
 	return TRUE;
 }
 
@@ -548,24 +605,43 @@ static int Bias_Dark_Setup(void)
  * <li>We call CCD_Command_Arm_Camera to update the cameras internal settings.
  * <li>We call CCD_Command_Grabber_Post_Arm to update the grabber's internal settings to match the camera.
  * <li>We call CCD_Exposure_Length_Get to get the (potentially modified) exposure length actually used by the PCO camera.
+ * <li>We create the bias/dark FITS header template using Bias_Dark_Fits_Header_Template_Create.
+ * <li>We setup the combination of the frames into a master bias/dark (if configured) using Moptop_Master_Start,
+ *     and work out the run number of the last frame (used in the master frame's filename).
+ * <li>We reset the bias/dark timing histograms using Moptop_Timing_Reset.
+ * <li>We start the writer threads by calling Moptop_Writer_Start, with Bias_Dark_Write_Fits_Image as the
+ *     write function. There are no rotations, so the frames are not grouped, and a writer durability policy of
+ *     "rotation" publishes all the frames when the writer is stopped (as "multrun" does).
  * <li>We loop over the Bias_Dark_Data.Image_Count, using Bias_Dark_Data.Image_Index as an index counter 
  *     (for status reporting):
  *     <ul>
+ *     <li>We get a free frame to read the image into by calling Moptop_Writer_Frame_Get. This blocks if all the 
+ *         frames are waiting to be written.
  *     <li>We call CCD_Command_Set_Recording_State to start the camera recording data.
- *     <li>We take a timestamp and store it in Bias_Dark_Data.Exposure_Start_Time.
+ *     <li>We take a timestamp and store it in Bias_Dark_Data.Exposure_Start_Time and the frame.
  *     <li>If this is the first exposure in the multrun we set Bias_Dark_Data.Multrun_Start_Time to the same timestamp.
- *     <li>We wait for a readout by calling CCD_Command_Grabber_Acquire_Image_Async_Wait, using the previously allocated
- *         image buffer returned by CCD_Buffer_Get_Image_Buffer.
+ *     <li>We wait for a readout by calling CCD_Command_Grabber_Acquire_Image_Async_Wait, using the frame's
+ *         image buffer.
+ *     <li>We get an exposure end timestamp and store it in the frame.
  *     <li>We get the camera image number from the image metadata using CCD_Command_Get_Image_Number_From_Metadata.
  *     <li>We get the camera image timestamp from the image metadata using CCD_Command_Get_Timestamp_From_Metadata.
- *     <li>We get an exposure end timestamp and store it in exposure_end_time.
+ *     <li>We add the camera timestamp and the exposure end timestamp (taken an exposure length after the camera 
+ *         timestamp) to the camera clock model using CCD_Clock_Model_Sample_Add.
+ *     <li>We convert the camera timestamp to a drift corrected UTC time and uncertainty using 
+ *         CCD_Clock_Model_Camera_To_UTC, and store them in the frame.
  *     <li>We call Bias_Dark_Get_Fits_Filename to generate a new FITS filename.
- *     <li>We call Bias_Dark_Write_Fits_Image to write the image data to the generated FTYS filename.
  *     <li>We add the generated filename to the filename list using CCD_Fits_Filename_List_Add.
+ *     <li>We queue the frame to be written to disk by one of the writer threads using Moptop_Writer_Frame_Queue.
  *     <li>We stop the camera recording data by calling CCD_Command_Set_Recording_State.
  *     <li>We check whether the bias/dark has been aborted (Bias_Dark_Abort).
  *     </ul>
+ * <li>We call Moptop_Writer_Stop to wait for the writer threads to finish writing the queued frames.
+ * <li>We call Moptop_Timing_Summary_Write to write a summary of the bias/dark timing histograms (if configured). 
+ *     A failure to do so is logged, but does not fail the bias/dark.
  * </ul>
+ * The time spent in the frame get, grabber wait and metadata decode, and the interval between frames,
+ * are added to the bias/dark timing histograms (Moptop_Timing_Add), so they can be retrieved using 
+ * "status timing biasdark".
  * @param exposure_type A CCD_FITS_FILENAME_EXPOSURE_TYPE enum, one of:
  *        CCD_FITS_FILENAME_EXPOSURE_TYPE_BIAS or CCD_FITS_FILENAME_EXPOSURE_TYPE_DARK.
  * @param exposure_length_s The exposure length in decimal seconds. For bias frames this is set to the minimum allowed
@@ -581,7 +657,17 @@ static int Bias_Dark_Setup(void)
  * @see moptop_general.html#Moptop_General_Log_Format
  * @see moptop_general.html#Moptop_General_Error_Number
  * @see moptop_general.html#Moptop_General_Error_String
- * @see ../ccd/cdocs/ccd_buffer.html#CCD_Buffer_Get_Image_Buffer
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_writer.html#Moptop_Writer_Start
+ * @see moptop_writer.html#Moptop_Writer_Frame_Get
+ * @see moptop_writer.html#Moptop_Writer_Frame_Put
+ * @see moptop_writer.html#Moptop_Writer_Frame_Queue
+ * @see moptop_writer.html#Moptop_Writer_Stop
+ * @see #Bias_Dark_Fits_Header_Template_Create
+ * @see moptop_master.html#Moptop_Master_Start
+ * @see moptop_timing.html#Moptop_Timing_Reset
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_timing.html#Moptop_Timing_Summary_Write
  * @see ../ccd/cdocs/ccd_command.html#CCD_COMMAND_TRIGGER_MODE
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Set_Trigger_Mode
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Arm_Camera
@@ -590,6 +676,8 @@ static int Bias_Dark_Setup(void)
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Grabber_Acquire_Image_Async_Wait
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Get_Image_Number_From_Metadata
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Get_Timestamp_From_Metadata
+ * @see ../ccd/cdocs/ccd_clock_model.html#CCD_Clock_Model_Sample_Add
+ * @see ../ccd/cdocs/ccd_clock_model.html#CCD_Clock_Model_Camera_To_UTC
  * @see ../ccd/cdocs/ccd_exposure.html#CCD_Exposure_Length_Set
  * @see ../ccd/cdocs/ccd_exposure.html#CCD_Exposure_Length_Get
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_EXPOSURE_TYPE
@@ -601,12 +689,10 @@ static int Bias_Dark_Setup(void)
 static int Bias_Dark_Acquire_Images(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,double exposure_length_s,
 				    char ***filename_list,int *filename_count)
 {
-	struct timespec camera_timestamp;
-	struct timespec exposure_end_time;
-	char filename[BIAS_DARK_FITS_FILENAME_LENGTH];
-	unsigned char *image_buffer = NULL;
+	struct Moptop_Writer_Frame_Struct *frame = NULL;
+	struct timespec start_time,end_time,last_readout_time;
+	enum MOPTOP_CALIBRATE_MASTER master_type;
 	double pco_exposure_length_s;
-	int image_buffer_length,camera_image_number;
 	
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log_Format("biasdark","moptop_bias_dark.c","Bias_Dark_Acquire_Images",
@@ -638,6 +724,7 @@ static int Bias_Dark_Acquire_Images(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposur
 		return FALSE;
 	}
 	Bias_Dark_Data.Requested_Exposure_Length = exposure_length_s;
+	Bias_Dark_Data.Exposure_Type = exposure_type;
 	/* turn on camera internal triggering */
 	if(!CCD_Command_Set_Trigger_Mode(CCD_COMMAND_TRIGGER_MODE_INTERNAL))
 	{
@@ -668,76 +755,161 @@ static int Bias_Dark_Acquire_Images(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposur
 			"Bias_Dark_Acquire_Images: Failed to get exposure length from the camera.");
 		return FALSE;
 	}
+	/* pre-format the FITS headers that don't change during this bias/dark */
+	if(!Bias_Dark_Fits_Header_Template_Create(pco_exposure_length_s))
+		return FALSE;
+	/* setup the combination of the frames into a master frame, if configured.
+	** Each frame increments the run number, so the last frame's run number is known now. */
+	if(exposure_type == CCD_FITS_FILENAME_EXPOSURE_TYPE_DARK)
+		master_type = MOPTOP_CALIBRATE_MASTER_DARK;
+	else
+		master_type = MOPTOP_CALIBRATE_MASTER_BIAS;
+	if(!Moptop_Master_Start(master_type,Bias_Dark_Data.Image_Count,
+				CCD_Setup_Get_Sensor_Width()/CCD_Setup_Get_Binning(),
+				CCD_Setup_Get_Sensor_Height()/CCD_Setup_Get_Binning(),pco_exposure_length_s))
+		return FALSE;
+	Bias_Dark_Data.Master_Run_Number = CCD_Fits_Filename_Run_Get()+Bias_Dark_Data.Image_Count;
+	/* reset the per-frame timing histograms for this bias/dark */
+	if(!Moptop_Timing_Reset(MOPTOP_TIMING_SET_BIAS_DARK))
+		return FALSE;
+	/* start the writer threads */
+	if(!Moptop_Writer_Start(Bias_Dark_Write_Fits_Image,MOPTOP_TIMING_SET_BIAS_DARK,0))
+		return FALSE;
 	/* acquire frames */
 	for(Bias_Dark_Data.Image_Index=0;Bias_Dark_Data.Image_Index < Bias_Dark_Data.Image_Count;
 	    Bias_Dark_Data.Image_Index++)
 	{
+		/* get a free frame to read the image into. This blocks if all the frames are waiting to be written */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!Moptop_Writer_Frame_Get(&frame))
+		{
+			/* report the writer threads' error, if one has failed */
+			Moptop_Writer_Stop(TRUE);
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_FRAME_GET,start_time,end_time);
+		frame->Image_Index = Bias_Dark_Data.Image_Index;
+		frame->Exposure_Length = pco_exposure_length_s;
 		/* start taking data */
 		if(!CCD_Command_Set_Recording_State(TRUE))
 		{
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 716;
 			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:Failed to start camera recording.");
 			return FALSE;
 		}
 		/* get exposure start timestamp */
 		clock_gettime(CLOCK_REALTIME,&(Bias_Dark_Data.Exposure_Start_Time));
+		frame->Exposure_Start_Time = Bias_Dark_Data.Exposure_Start_Time;
 		/* If this is the first exposure in the multrun, 
 		** the exposure start time is also the multrun start time. */
 		if(Bias_Dark_Data.Image_Index == 0)
 			Bias_Dark_Data.Multrun_Start_Time = Bias_Dark_Data.Exposure_Start_Time;
 		/* get an acquired image buffer */
-		if(!CCD_Command_Grabber_Acquire_Image_Async_Wait(CCD_Buffer_Get_Image_Buffer()))
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Command_Grabber_Acquire_Image_Async_Wait(frame->Image_Buffer))
 		{
 			CCD_Command_Set_Recording_State(FALSE);
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 735;
 			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:Failed to grab an image.");
 			return FALSE;
 		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_GRABBER_WAIT,start_time,end_time);
+		/* time between successive readouts */
+		if(Bias_Dark_Data.Image_Index > 0)
+		{
+			Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_FRAME_INTERVAL,last_readout_time,
+					  end_time);
+		}
+		last_readout_time = end_time;
 		/* get exposure end timestamp */
-		clock_gettime(CLOCK_REALTIME,&exposure_end_time);
+		clock_gettime(CLOCK_REALTIME,&(frame->Exposure_End_Time));
+		frame->Image_Buffer_Length = CCD_Setup_Get_Image_Size_Bytes();
 		/* get camera image number */
-		if(!CCD_Command_Get_Image_Number_From_Metadata(CCD_Buffer_Get_Image_Buffer(),
-							       CCD_Setup_Get_Image_Size_Bytes(),&camera_image_number))
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Command_Get_Image_Number_From_Metadata(frame->Image_Buffer,frame->Image_Buffer_Length,
+							       &(frame->Camera_Image_Number)))
 		{
 			CCD_Command_Set_Recording_State(FALSE);
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 708;
 			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:"
 				"Failed to get image number from metadata.");
 			return FALSE;
 		}
 		/* get camera timestamp */
-		if(!CCD_Command_Get_Timestamp_From_Metadata(CCD_Buffer_Get_Image_Buffer(),
-							    CCD_Setup_Get_Image_Size_Bytes(),&camera_timestamp))
+		if(!CCD_Command_Get_Timestamp_From_Metadata(frame->Image_Buffer,frame->Image_Buffer_Length,
+							    &(frame->Camera_Timestamp)))
 		{
 			CCD_Command_Set_Recording_State(FALSE);
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 736;
 			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:"
 				"Failed to get timestamp from metadata.");
 			return FALSE;
 		}
+		/* update the camera clock model, and use it to correct the camera timestamp for clock drift */
+		if(!CCD_Clock_Model_Sample_Add(frame->Camera_Timestamp,frame->Exposure_End_Time,frame->Exposure_Length))
+		{
+			CCD_Command_Set_Recording_State(FALSE);
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
+			Moptop_General_Error_Number = 759;
+			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:"
+				"Failed to add camera timestamp to the camera clock model.");
+			return FALSE;
+		}
+		if(!CCD_Clock_Model_Camera_To_UTC(frame->Camera_Timestamp,&(frame->Camera_UTC_Time),
+						  &(frame->Camera_UTC_Uncertainty)))
+		{
+			CCD_Command_Set_Recording_State(FALSE);
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
+			Moptop_General_Error_Number = 760;
+			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:"
+				"Failed to convert camera timestamp to UTC.");
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_METADATA_DECODE,start_time,end_time);
 		/* generate a new filename for this FITS image */
-		Bias_Dark_Get_Fits_Filename(exposure_type,filename,BIAS_DARK_FITS_FILENAME_LENGTH);
-		/* write fits image */
-		if(!Bias_Dark_Write_Fits_Image(exposure_type,pco_exposure_length_s,exposure_end_time,
-					       camera_image_number,camera_timestamp,
-					       CCD_Buffer_Get_Image_Buffer(),CCD_Setup_Get_Image_Size_Bytes(),filename))
+		if(!Bias_Dark_Get_Fits_Filename(exposure_type,frame->Filename,BIAS_DARK_FITS_FILENAME_LENGTH))
 		{
 			CCD_Command_Set_Recording_State(FALSE);
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
 			return FALSE;
 		}
 		/* add fits image to list */
-		if(!CCD_Fits_Filename_List_Add(filename,filename_list,filename_count))
+		if(!CCD_Fits_Filename_List_Add(frame->Filename,filename_list,filename_count))
 		{
 			CCD_Command_Set_Recording_State(FALSE);
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 737;
 			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:"
 				"Failed to add filename '%s' to list of filenames (count = %d).",
-				filename,(*filename_count));
+				frame->Filename,(*filename_count));
+			return FALSE;
+		}
+		/* pass the frame to the writer threads, to write the fits image */
+		if(!Moptop_Writer_Frame_Queue(frame))
+		{
+			CCD_Command_Set_Recording_State(FALSE);
+			Moptop_Writer_Stop(FALSE);
 			return FALSE;
 		}
 		/* stop CCD acquisition */
 		if(!CCD_Command_Set_Recording_State(FALSE))
 		{
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 727;
 			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:Failed to stop camera recording.");
 			return FALSE;
@@ -745,11 +917,22 @@ static int Bias_Dark_Acquire_Images(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposur
 		/* check for abort */
 		if(Bias_Dark_Abort)
 		{
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 738;
 			sprintf(Moptop_General_Error_String,"Bias_Dark_Acquire_Images:Bias/Dark Aborted.");
 			return FALSE;
 		}
 	}/* end for on Bias_Dark_Data.Image_Index / Bias_Dark_Data.Image_Count */
+	/* wait for the writer threads to write the remaining queued frames */
+	if(!Moptop_Writer_Stop(TRUE))
+		return FALSE;
+	/* write a per-bias/dark timing summary, if configured. Failing to do so should not fail the bias/dark. */
+	if((*filename_count) > 0)
+	{
+		if(!Moptop_Timing_Summary_Write(MOPTOP_TIMING_SET_BIAS_DARK,(*filename_list)[0]))
+			Moptop_General_Error("biasdark","moptop_bias_dark.c","Bias_Dark_Acquire_Images",
+					     LOG_VERBOSITY_TERSE,"BIASDARK");
+	}
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log("biasdark","moptop_bias_dark.c","Bias_Dark_Acquire_Images",LOG_VERBOSITY_INTERMEDIATE,
 			   "BIASDARK","finished.");
@@ -798,60 +981,44 @@ static int Bias_Dark_Get_Fits_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE expo
 }
 
 /**
- * Write the FITS image to disk.
+ * Update the bias/dark FITS keywords in the FITS header list, ready for the bias/dark FITS header template to be
+ * created from the list. This is called once per bias/dark by Bias_Dark_Fits_Header_Template_Create, with a 
+ * prototype frame: the per-frame keywords are added to the list with prototype values, and are overwritten 
+ * for each frame by Bias_Dark_Fits_Headers_Patch.
+ * The caller must hold the FITS header list lock (Moptop_Fits_Header_Lock).
  * <ul>
- * <li>We set the "OBSTYPE" FITS keyword value based on the value of exposure_type.
+ * <li>We set the "OBSTYPE" FITS keyword value based on the value of Bias_Dark_Data.Exposure_Type.
  * <li>We set the "DATE"/"DATE-OBS"/"UTSTART" and "MJD" keyword values based on the value of 
- *     Multrun_Data.Exposure_Start_Time.
- * <li>We set the "DATE-END" and "UTEND" keyword values based on the value of exposure_end_time.
+ *     frame->Exposure_Start_Time.
+ * <li>We set the "DATE-END" and "UTEND" keyword values based on the value of frame->Exposure_End_Time.
  * <li>We set the "TELAPSE" keyword value based on the time elapsed between 
- *     Multrun_Data.Multrun_Start_Time and exposure_end_time.
- * <li>We set the "RUNNUM" keyword value to Multrun_Data.Image_Index.
- * <li>We set the "EXPNUM" keyword value to Multrun_Data.Image_Index.
- * <li>We set the "EXPTOTAL" keyword value to Multrun_Data.Image_Count.
+ *     Bias_Dark_Data.Multrun_Start_Time and frame->Exposure_End_Time.
+ * <li>We set the "RUNNUM" keyword value to frame->Image_Index.
+ * <li>We set the "EXPNUM" keyword value to frame->Image_Index.
+ * <li>We set the "EXPTOTAL" keyword value to Bias_Dark_Data.Image_Count.
  * <li>We set the "CCDXBIN"/"CCDYBIN" FITS keyword values based on CCD_Setup_Get_Binning. 
  * <li>We set the "CCDATEMP" FITS keyword value based on the cached CCD temperature stored in 
- *     Multrun_Data.CCD_Temperature.
+ *     Bias_Dark_Data.CCD_Temperature.
  * <li>We set the "TEMPSTAT" FITS keyword value based on the cached CCD temperature status stored in
- *     Multrun_Data.CCD_Temperature_Status_String.
- * <li>We set the "EXPTIME" and "XPOSURE" FITS keyword value to the pco_exposure_length_s in seconds.
- * <li>We set the "EXPREQST" FITS keyword value to the Multrun_Data.Requested_Exposure_Length.
+ *     Bias_Dark_Data.CCD_Temperature_Status_String.
+ * <li>We set the "EXPTIME" and "XPOSURE" FITS keyword value to frame->Exposure_Length in seconds.
+ * <li>We set the "EXPREQST" FITS keyword value to the Bias_Dark_Data.Requested_Exposure_Length.
  * <li>We set the "CCDXPIXE" FITS keyword value to CCD_Setup_Get_Pixel_Width in m.
  * <li>We set the "CCDYPIXE" FITS keyword value to CCD_Setup_Get_Pixel_Height in m.
- * <li>We set the "PICNUM" FITS keyword value to the camera_image_number.
- * <li>We set the "CAMTIME" FITS keyword value to the camera_timestamp.
- * <li>We create a file lock on the filename to write to using CCD_Fits_Filename_Lock.
- * <li>We create the FITS filename using fits_create_file.
- * <li>We calculate the binned image dimensions using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
- *     CCD_Setup_Get_Binning.
- * <li>We create an empty image of the correct dimensions using fits_create_img.
- * <li>We write the FITS headers to the FITS image using CCD_Fits_Header_Write_To_Fits.
- * <li>We check the computed binned image size is not larger than the image_buffer_length.
- * <li>If Bias_Dark_Data.Flip_X is TRUE, we call Moptop_Multrun_Flip_X to flip the image data in the X direction.
- * <li>If Bias_Dark_Data.Flip_Y is TRUE, we call Moptop_Multrun_Flip_Y to flip the image data in the Y direction.
- * <li>We write the image data to the FITS image using fits_write_img.
- * <li>If the binning value is not 1, we retrieve the current CCDSCALE value, scale it by the binning, 
- *     and update the FITS keyword value.
- * <li>We close the FITS image using fits_close_file.
- * <li>We remove the file lock on the FITS image using CCD_Fits_Filename_UnLock.
+ * <li>We set the "PICNUM" FITS keyword value to frame->Camera_Image_Number.
+ * <li>We set the "CAMTIME" FITS keyword value to frame->Camera_Timestamp.
+ * <li>We set the "CAMUTC" FITS keyword value to frame->Camera_UTC_Time.
+ * <li>We set the "CLKUNCER" FITS keyword value to frame->Camera_UTC_Uncertainty.
  * </ul>
- * @param exposure_type An CCD_FITS_FILENAME_EXPOSURE_TYPE, one of:
- *        CCD_FITS_FILENAME_EXPOSURE_TYPE_BIAS or CCD_FITS_FILENAME_EXPOSURE_TYPE_DARK.
- * @param pco_exposure_length_s The exposure length as retrieved from the camera, in seconds.
- * @param exposure_end_time A timestamp representing the end time of the exposure being saved. Actually a timestamp
- *        taken just after the camera has signalled a buffer is available.
- * @param camera_image_number The camera image number extracted from the read-out image's meta-data.
- * @param camera_timestamp A timestamp recorded by the camera and extracted from the read-out image's meta-data.
- * @param image_buffer The image buffer containing the data to write to disk.
- * @param image_buffer_length The length of data in the image buffer.
- * @param filename A string containing the FITS filename to write the data into.
+ * @param frame A prototype frame, containing the data that is the same for every frame in the bias/dark.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see #Bias_Dark_Data
- * @see #Moptop_Multrun_Flip_X
- * @see #Moptop_Multrun_Flip_Y
+ * @see #Bias_Dark_Fits_Header_Template_Create
+ * @see #Bias_Dark_Fits_Headers_Patch
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Lock
  * @see moptop_fits_header.html#Moptop_Fits_Header_String_Add
  * @see moptop_fits_header.html#Moptop_Fits_Header_Integer_Add
- * @see moptop_fits_header.html#Moptop_Fits_Header_Long_Long_Integer_Add
  * @see moptop_fits_header.html#Moptop_Fits_Header_Float_Add
  * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Date_String
  * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Date_Obs_String
@@ -859,48 +1026,28 @@ static int Bias_Dark_Get_Fits_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE expo
  * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Mjd
  * @see moptop_general.html#fdifftime
  * @see moptop_general.html#MOPTOP_GENERAL_ONE_METRE_MICROMETRE
- * @see moptop_general.html#Moptop_General_Log
- * @see moptop_general.html#Moptop_General_Log_Format
  * @see moptop_general.html#Moptop_General_Error_Number
  * @see moptop_general.html#Moptop_General_Error_String
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_EXPOSURE_TYPE
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_EXPOSURE_TYPE_BIAS
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_EXPOSURE_TYPE_DARK
- * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Lock
- * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_UnLock
- * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
- * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
  * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
  * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Pixel_Width
  * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Pixel_Height
  */
-static int Bias_Dark_Write_Fits_Image(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,double pco_exposure_length_s,
-				      struct timespec exposure_end_time,int camera_image_number,
-				      struct timespec camera_timestamp,
-				      unsigned char *image_buffer,
-				      int image_buffer_length,char *filename)
+static int Bias_Dark_Fits_Headers_Set(struct Moptop_Writer_Frame_Struct *frame)
 {
-	fitsfile *fp = NULL;
 	char exposure_time_string[64];
-	double mjd,ccdscale,dvalue;
-	long axes[2];
-	int retval=0,status=0;
-	int ncols_unbinned,nrows_unbinned,binning,ncols_binned,nrows_binned,ivalue;
-	char buff[32]; /* fits_get_errstatus returns 30 chars max */
-	
-#if MOPTOP_DEBUG > 5
-	Moptop_General_Log_Format("biasdark","moptop_bias_dark.c","Bias_Dark_Write_Fits_Image",
-				  LOG_VERBOSITY_INTERMEDIATE,
-				  "BIASDARK","Started saving FITS filename '%s'.",filename);
-#endif
-	/* sort out some FITS headers for later */
+	double mjd,dvalue;
+	int ivalue;
+
 	/* OBSTYPE */
-	if(exposure_type == CCD_FITS_FILENAME_EXPOSURE_TYPE_BIAS)
+	if(Bias_Dark_Data.Exposure_Type == CCD_FITS_FILENAME_EXPOSURE_TYPE_BIAS)
 	{
 		if(!Moptop_Fits_Header_String_Add("OBSTYPE","BIAS",NULL))
 			return FALSE;
 	}
-	else if(exposure_type == CCD_FITS_FILENAME_EXPOSURE_TYPE_DARK)
+	else if(Bias_Dark_Data.Exposure_Type == CCD_FITS_FILENAME_EXPOSURE_TYPE_DARK)
 	{
 		if(!Moptop_Fits_Header_String_Add("OBSTYPE","DARK",NULL))
 			return FALSE;
@@ -908,8 +1055,8 @@ static int Bias_Dark_Write_Fits_Image(enum CCD_FITS_FILENAME_EXPOSURE_TYPE expos
 	else
 	{
 		Moptop_General_Error_Number = 740;
-		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:Illegal exposure type %d.",
-			exposure_type);
+		sprintf(Moptop_General_Error_String,"Bias_Dark_Fits_Headers_Set:Illegal exposure type %d.",
+			Bias_Dark_Data.Exposure_Type);
 		return FALSE;
 	}
 	/* FILTER1 */
@@ -922,43 +1069,43 @@ static int Bias_Dark_Write_Fits_Image(enum CCD_FITS_FILENAME_EXPOSURE_TYPE expos
 	if(!Moptop_Fits_Header_String_Add("FILTERI1",Bias_Dark_Data.Filter_Id,NULL))
 		return FALSE;
 	*/
-	/* update DATE keyword from Multrun_Data.Exposure_Start_Time */
-	Moptop_Fits_Header_TimeSpec_To_Date_String(Bias_Dark_Data.Exposure_Start_Time,exposure_time_string);
+	/* update DATE keyword from frame->Exposure_Start_Time */
+	Moptop_Fits_Header_TimeSpec_To_Date_String(frame->Exposure_Start_Time,exposure_time_string);
 	if(!Moptop_Fits_Header_String_Add("DATE",exposure_time_string,"[UTC] Start date of obs."))
 		return FALSE;
-	/* update DATE-OBS keyword from Multrun_Data.Exposure_Start_Time */
-	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(Bias_Dark_Data.Exposure_Start_Time,exposure_time_string);
+	/* update DATE-OBS keyword from frame->Exposure_Start_Time */
+	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(frame->Exposure_Start_Time,exposure_time_string);
 	if(!Moptop_Fits_Header_String_Add("DATE-OBS",exposure_time_string,"[UTC] Start of obs."))
 		return FALSE;
-	/* update UTSTART keyword from Multrun_Data.Exposure_Start_Time */
-	Moptop_Fits_Header_TimeSpec_To_UtStart_String(Bias_Dark_Data.Exposure_Start_Time,exposure_time_string);
+	/* update UTSTART keyword from frame->Exposure_Start_Time */
+	Moptop_Fits_Header_TimeSpec_To_UtStart_String(frame->Exposure_Start_Time,exposure_time_string);
 	if(!Moptop_Fits_Header_String_Add("UTSTART",exposure_time_string,"[UTC] Start time of obs."))
 		return FALSE;
-	/* update MJD keyword from Bias_Dark_Data.Exposure_Start_Time */
+	/* update MJD keyword from frame->Exposure_Start_Time */
 	/* note leap second correction not implemented yet (always FALSE). */
-	if(!Moptop_Fits_Header_TimeSpec_To_Mjd(Bias_Dark_Data.Exposure_Start_Time,FALSE,&mjd))
+	if(!Moptop_Fits_Header_TimeSpec_To_Mjd(frame->Exposure_Start_Time,FALSE,&mjd))
 		return FALSE;
 	if(!Moptop_Fits_Header_Float_Add("MJD",mjd,NULL))
 		return FALSE;
-	/* update DATE-END keyword from exposure_end_time */
-	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(exposure_end_time,exposure_time_string);
+	/* update DATE-END keyword from frame->Exposure_End_Time */
+	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(frame->Exposure_End_Time,exposure_time_string);
 	if(!Moptop_Fits_Header_String_Add("DATE-END",exposure_time_string,"[UTC] End of obs."))
 		return FALSE;
-	/* update UTENDT keyword from exposure_end_time */
-	Moptop_Fits_Header_TimeSpec_To_UtStart_String(exposure_end_time,exposure_time_string);
+	/* update UTENDT keyword from frame->Exposure_End_Time */
+	Moptop_Fits_Header_TimeSpec_To_UtStart_String(frame->Exposure_End_Time,exposure_time_string);
 	if(!Moptop_Fits_Header_String_Add("UTEND",exposure_time_string,"[UTC] End time of obs."))
 		return FALSE;
 	/* update TELAPSE keyword with difference between the multrun start timestamp and the 
 	** end timestamp of the current exposure. This means TELAPSE is increasing in each frame of the multrun. */
-	dvalue = fdifftime(exposure_end_time,Bias_Dark_Data.Multrun_Start_Time);
+	dvalue = fdifftime(frame->Exposure_End_Time,Bias_Dark_Data.Multrun_Start_Time);
 	if(!Moptop_Fits_Header_Float_Add("TELAPSE",dvalue,"[sec] Total obs. duration"))
 		return FALSE;
-	/* update RUNNUM keyword value with the Bias_Dark_Data.Image_Index */
-	if(!Moptop_Fits_Header_Integer_Add("RUNNUM",Bias_Dark_Data.Image_Index,
+	/* update RUNNUM keyword value with the frame->Image_Index */
+	if(!Moptop_Fits_Header_Integer_Add("RUNNUM",frame->Image_Index,
 					   "Which image in the multrun we are on."))
 		return FALSE;
-	/* update EXPNUM keyword value with the Bias_Dark_Data.Image_Index */
-	if(!Moptop_Fits_Header_Integer_Add("EXPNUM",Bias_Dark_Data.Image_Index,
+	/* update EXPNUM keyword value with the frame->Image_Index */
+	if(!Moptop_Fits_Header_Integer_Add("EXPNUM",frame->Image_Index,
 					   "Which image in the current multrun we are on."))
 		return FALSE;
 	/* update EXPTOTAL keyword value with Bias_Dark_Data.Image_Count */
@@ -980,10 +1127,10 @@ static int Bias_Dark_Write_Fits_Image(enum CCD_FITS_FILENAME_EXPOSURE_TYPE expos
 	if(!Moptop_Fits_Header_String_Add("TEMPSTAT",Bias_Dark_Data.CCD_Temperature_Status_String,NULL))
 		return FALSE;
 	/* EXPTIME is the actual exposure length returned from the camera, in seconds */
-	if(!Moptop_Fits_Header_Float_Add("EXPTIME",pco_exposure_length_s,"[sec] Actual exposure"))
+	if(!Moptop_Fits_Header_Float_Add("EXPTIME",frame->Exposure_Length,"[sec] Actual exposure"))
 		return FALSE;
 	/* XPOSURE is the actual exposure length returned from the camera, in seconds */
-	if(!Moptop_Fits_Header_Float_Add("XPOSURE",pco_exposure_length_s,"[sec] Actual exposure"))
+	if(!Moptop_Fits_Header_Float_Add("XPOSURE",frame->Exposure_Length,"[sec] Actual exposure"))
 		return FALSE;
 	/* EXPREQST is the requested exposure length in seconds (from Bias_Dark_Data.Requested_Exposure_Length) */
 	if(!Moptop_Fits_Header_Float_Add("EXPREQST",Bias_Dark_Data.Requested_Exposure_Length,
@@ -1000,45 +1147,476 @@ static int Bias_Dark_Write_Fits_Image(enum CCD_FITS_FILENAME_EXPOSURE_TYPE expos
 					 "[m] Detector pixel height"))
 		return FALSE;
 	/* PICNUM is the camera image number retrieved from the camera read out's metadata. */
-	if(!Moptop_Fits_Header_Integer_Add("PICNUM",camera_image_number,"Camera meta-data image number"))
+	if(!Moptop_Fits_Header_Integer_Add("PICNUM",frame->Camera_Image_Number,"Camera meta-data image number"))
 		return FALSE;
 	/* CAMTIME is the camera clock timestamp the when this exposure started, from the camera's meta-data */
-	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(camera_timestamp,exposure_time_string);
+	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(frame->Camera_Timestamp,exposure_time_string);
 	if(!Moptop_Fits_Header_String_Add("CAMTIME",exposure_time_string,"[UTC] Cameras timestamp."))
 		return FALSE;
-	/* create lock file */
+	/* CAMUTC is the camera timestamp corrected for the camera clock's drift by the camera clock model */
+	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(frame->Camera_UTC_Time,exposure_time_string);
+	if(!Moptop_Fits_Header_String_Add("CAMUTC",exposure_time_string,"[UTC] Drift corrected camera timestamp."))
+		return FALSE;
+	/* CLKUNCER is the clock model's statistical uncertainty, which excludes the residual (late) bias of CAMUTC
+	** due to an error in the configured readout delay */
+	if(!Moptop_Fits_Header_Float_Add("CLKUNCER",frame->Camera_UTC_Uncertainty,
+					 "[sec] CAMUTC fit error, excl. readout delay bias"))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Create the bias/dark FITS header template, which contains the FITS headers pre-formatted into card images.
+ * <ul>
+ * <li>We setup a prototype frame containing the per-bias/dark frame data (exposure_length).
+ * <li>We lock the FITS header list using Moptop_Fits_Header_Lock, as it can be updated by other commands.
+ * <li>We call Bias_Dark_Fits_Headers_Set to update the bias/dark FITS keywords in the FITS header list.
+ * <li>We call Moptop_Fits_Header_Template_Create to format the FITS header list into Bias_Dark_Header_Template, 
+ *     with the keywords in Bias_Dark_Header_Slot_Keyword_List as the per-frame slots.
+ * <li>We unlock the FITS header list using Moptop_Fits_Header_Unlock.
+ * <li>If the binning (CCD_Setup_Get_Binning) is not 1, we scale the template's CCDSCALE value
+ *     (configured for binning 1 in the Java layer) by the binning, using Moptop_Fits_Header_Template_Float_Scale.
+ * </ul>
+ * @param exposure_length The exposure length as retrieved from the camera, in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #BIAS_DARK_HEADER_SLOT_COUNT
+ * @see #Bias_Dark_Header_Slot_Keyword_List
+ * @see #Bias_Dark_Header_Template
+ * @see #Bias_Dark_Fits_Headers_Set
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Lock
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Unlock
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Create
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Float_Scale
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static int Bias_Dark_Fits_Header_Template_Create(double exposure_length)
+{
+	struct Moptop_Writer_Frame_Struct prototype_frame;
+	int binning;
+
+	memset(&prototype_frame,0,sizeof(struct Moptop_Writer_Frame_Struct));
+	prototype_frame.Exposure_Length = exposure_length;
+	if(!Moptop_Fits_Header_Lock())
+		return FALSE;
+	if(!Bias_Dark_Fits_Headers_Set(&prototype_frame))
+	{
+		Moptop_Fits_Header_Unlock();
+		return FALSE;
+	}
+	if(!Moptop_Fits_Header_Template_Create(&Bias_Dark_Header_Template,Bias_Dark_Header_Slot_Keyword_List,
+					       BIAS_DARK_HEADER_SLOT_COUNT))
+	{
+		Moptop_Fits_Header_Unlock();
+		return FALSE;
+	}
+	if(!Moptop_Fits_Header_Unlock())
+		return FALSE;
+	/* CCDSCALE is configured for binning 1 in the Java layer. Adjust for binning (assume xbin and ybin are equal) */
+	binning = CCD_Setup_Get_Binning();
+	if(binning != 1)
+	{
+		if(!Moptop_Fits_Header_Template_Float_Scale(&Bias_Dark_Header_Template,"CCDSCALE",(double)binning))
+			return FALSE;
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("biasdark","moptop_bias_dark.c","Bias_Dark_Fits_Header_Template_Create",
+				  LOG_VERBOSITY_VERBOSE,"BIASDARK","Created FITS header template of %d cards.",
+				  Bias_Dark_Header_Template.Card_Count);
+#endif
+	return TRUE;
+}
+
+/**
+ * Overwrite the per-frame slots in a copy of the bias/dark FITS header template with the values for this frame.
+ * <ul>
+ * <li>We format the "DATE"/"DATE-OBS"/"UTSTART" keyword values from frame->Exposure_Start_Time, 
+ *     and "DATE-END"/"UTEND" from frame->Exposure_End_Time, using Moptop_Fits_Header_TimeSpec_To_Strings.
+ * <li>We set the "MJD" keyword value based on the value of frame->Exposure_Start_Time.
+ * <li>We set the "TELAPSE" keyword value based on the time elapsed between 
+ *     Bias_Dark_Data.Multrun_Start_Time and frame->Exposure_End_Time.
+ * <li>We set the "RUNNUM" and "EXPNUM" keyword values to frame->Image_Index.
+ * <li>We set the "PICNUM" keyword value to frame->Camera_Image_Number.
+ * <li>We set the "CAMTIME" keyword value to frame->Camera_Timestamp.
+ * <li>We set the "CAMUTC" keyword value to frame->Camera_UTC_Time, and "CLKUNCER" to frame->Camera_UTC_Uncertainty.
+ * </ul>
+ * This is called by the writer threads, each with their own copy of the template's card images.
+ * @param frame The read out frame being written to disk, containing the per-frame data captured when it was acquired.
+ * @param card_image_list This frame's copy of the bias/dark FITS header template card images.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #BIAS_DARK_HEADER_SLOT
+ * @see #Bias_Dark_Data
+ * @see #Bias_Dark_Header_Template
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_String_Set
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Integer_Set
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Float_Set
+ * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Strings
+ * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Mjd
+ * @see moptop_general.html#fdifftime
+ */
+static int Bias_Dark_Fits_Headers_Patch(struct Moptop_Writer_Frame_Struct *frame,char *card_image_list)
+{
+	char date_string[16];
+	char date_obs_string[32];
+	char utstart_string[16];
+	double mjd;
+
+	/* DATE, DATE-OBS, UTSTART from frame->Exposure_Start_Time */
+	Moptop_Fits_Header_TimeSpec_To_Strings(frame->Exposure_Start_Time,date_string,date_obs_string,utstart_string);
+	if(!Moptop_Fits_Header_Template_String_Set(&Bias_Dark_Header_Template,card_image_list,
+						   BIAS_DARK_HEADER_SLOT_DATE,date_string))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_String_Set(&Bias_Dark_Header_Template,card_image_list,
+						   BIAS_DARK_HEADER_SLOT_DATE_OBS,date_obs_string))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_String_Set(&Bias_Dark_Header_Template,card_image_list,
+						   BIAS_DARK_HEADER_SLOT_UTSTART,utstart_string))
+		return FALSE;
+	/* MJD from frame->Exposure_Start_Time. Note leap second correction not implemented yet (always FALSE). */
+	if(!Moptop_Fits_Header_TimeSpec_To_Mjd(frame->Exposure_Start_Time,FALSE,&mjd))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Bias_Dark_Header_Template,card_image_list,
+						  BIAS_DARK_HEADER_SLOT_MJD,mjd))
+		return FALSE;
+	/* DATE-END, UTEND from frame->Exposure_End_Time */
+	Moptop_Fits_Header_TimeSpec_To_Strings(frame->Exposure_End_Time,NULL,date_obs_string,utstart_string);
+	if(!Moptop_Fits_Header_Template_String_Set(&Bias_Dark_Header_Template,card_image_list,
+						   BIAS_DARK_HEADER_SLOT_DATE_END,date_obs_string))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_String_Set(&Bias_Dark_Header_Template,card_image_list,
+						   BIAS_DARK_HEADER_SLOT_UTEND,utstart_string))
+		return FALSE;
+	/* TELAPSE is the time between the bias/dark start and the end of this exposure */
+	if(!Moptop_Fits_Header_Template_Float_Set(&Bias_Dark_Header_Template,card_image_list,
+				     BIAS_DARK_HEADER_SLOT_TELAPSE,
+				     fdifftime(frame->Exposure_End_Time,Bias_Dark_Data.Multrun_Start_Time)))
+		return FALSE;
+	/* RUNNUM/EXPNUM are the frame->Image_Index */
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Bias_Dark_Header_Template,card_image_list,
+						    BIAS_DARK_HEADER_SLOT_RUNNUM,frame->Image_Index))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Bias_Dark_Header_Template,card_image_list,
+						    BIAS_DARK_HEADER_SLOT_EXPNUM,frame->Image_Index))
+		return FALSE;
+	/* PICNUM is the camera image number retrieved from the camera read out's metadata. */
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Bias_Dark_Header_Template,card_image_list,
+						    BIAS_DARK_HEADER_SLOT_PICNUM,frame->Camera_Image_Number))
+		return FALSE;
+	/* CAMTIME is the camera clock timestamp the when this exposure started, from the camera's meta-data */
+	Moptop_Fits_Header_TimeSpec_To_Strings(frame->Camera_Timestamp,NULL,date_obs_string,NULL);
+	if(!Moptop_Fits_Header_Template_String_Set(&Bias_Dark_Header_Template,card_image_list,
+						   BIAS_DARK_HEADER_SLOT_CAMTIME,date_obs_string))
+		return FALSE;
+	/* CAMUTC/CLKUNCER are the drift corrected camera timestamp and it's uncertainty, from the camera clock model */
+	Moptop_Fits_Header_TimeSpec_To_Strings(frame->Camera_UTC_Time,NULL,date_obs_string,NULL);
+	if(!Moptop_Fits_Header_Template_String_Set(&Bias_Dark_Header_Template,card_image_list,
+						   BIAS_DARK_HEADER_SLOT_CAMUTC,date_obs_string))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Bias_Dark_Header_Template,card_image_list,
+						  BIAS_DARK_HEADER_SLOT_CLKUNCER,frame->Camera_UTC_Uncertainty))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Write the FITS image to disk.
+ * <ul>
+ * <li>We start publishing the FITS image using CCD_Fits_Filename_Publish_Begin. Depending on the publish mode,
+ *     this either creates a file lock on the filename, or returns a hidden temporary filename to write to instead.
+ * <li>We calculate the binned image dimensions using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
+ *     CCD_Setup_Get_Binning.
+ * <li>We check the computed binned image size is not larger than the frame->Image_Buffer_Length.
+ * <li>We copy the bias/dark FITS header template's card images into card_image_list, using 
+ *     Moptop_Fits_Header_Template_Copy.
+ * <li>We call Bias_Dark_Fits_Headers_Patch to overwrite the per-frame FITS keywords in card_image_list.
+ * <li>If Bias_Dark_Data.Native_Fits_Writer is TRUE:
+ *     <ul>
+ *     <li>We convert the image data in place to FITS format, flipping it in X and/or Y if Bias_Dark_Data.Flip_X / 
+ *         Bias_Dark_Data.Flip_Y are TRUE, in one pass using CCD_Fits_Image_Data_Convert.
+ *     <li>We write the headers and image data to disk using CCD_Fits_Image_Write. This uses the FITS I/O backend
+ *         (pwrite or io_uring) selected at startup by "file.fits.io.backend".
+ *     </ul>
+ * <li>Otherwise:
+ *     <ul>
+ *     <li>If Bias_Dark_Data.Flip_X is TRUE, we call Moptop_Multrun_Flip_X to flip the image data in the X direction.
+ *     <li>If Bias_Dark_Data.Flip_Y is TRUE, we call Moptop_Multrun_Flip_Y to flip the image data in the Y direction.
+ *     <li>We write the headers and image data using CFITSIO, by calling Bias_Dark_Write_Fits_Image_Cfitsio.
+ *     </ul>
+ * <li>We publish the FITS image using Moptop_Writer_Publish, which (once the file is as durable as the 
+ *     writer durability policy requires) either removes the file lock, or renames the temporary file 
+ *     to the FITS filename. Depending on the policy, this may not happen until the writer is stopped.
+ * </ul>
+ * The times taken by the filename lock (publish begin), header, image convert and FITS write steps
+ * are added to the timing histograms using Moptop_Timing_Add. The writer adds the file sync and
+ * filename unlock (publish end) times.
+ * Before any of this, if the frames are being combined into a master frame (Moptop_Master_Is_Enabled), the frame is
+ * accumulated into it by Bias_Dark_Master_Frame.
+ * This routine is called by the writer threads (as the write function passed to Moptop_Writer_Start),
+ * so all per-frame data is taken from frame rather than Bias_Dark_Data, which the acquisition thread
+ * will be updating for the next frame.
+ * @param frame The read out frame to write to disk. This contains the image data and all the per-frame data
+ *        captured when it was acquired, including the FITS filename to write the data into.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Bias_Dark_Data
+ * @see #Bias_Dark_Header_Template
+ * @see #Bias_Dark_Fits_Headers_Patch
+ * @see #Bias_Dark_Write_Fits_Image_Cfitsio
+ * @see #Bias_Dark_Master_Frame
+ * @see #Moptop_Multrun_Flip_X
+ * @see #Moptop_Multrun_Flip_Y
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_writer.html#Moptop_Writer_Start
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_LENGTH
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Log
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Convert
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Write
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static int Bias_Dark_Write_Fits_Image(struct Moptop_Writer_Frame_Struct *frame)
+{
+	struct timespec start_time,end_time;
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int ncols_unbinned,nrows_unbinned,binning,ncols_binned,nrows_binned;
+	
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("biasdark","moptop_bias_dark.c","Bias_Dark_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
+				  "BIASDARK","Started saving FITS filename '%s'.",frame->Filename);
+#endif
+	/* accumulate the frame into the master frame, while it is still in camera format */
+	if(Moptop_Master_Is_Enabled())
+		Bias_Dark_Master_Frame(frame);
+	/* create lock file, or get the temporary filename to write to */
 #if MOPTOP_DEBUG > 5
 	Moptop_General_Log_Format("biasdark","moptop_bias_dark.c","Bias_Dark_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
-				  "BIASDARK","Locking FITS filename %s.",filename);
+				  "BIASDARK","Locking FITS filename %s.",frame->Filename);
 #endif
-	if(!CCD_Fits_Filename_Lock(filename))
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Filename_Publish_Begin(frame->Filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH))
 	{
 		Moptop_General_Error_Number = 741;
-		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:Failed to lock '%s'.",filename);
+		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:Failed to lock '%s'.",frame->Filename);
 		return FALSE;				
 	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_FILENAME_LOCK,start_time,end_time);
+	/* basic dimensions */
+	ncols_unbinned = CCD_Setup_Get_Sensor_Width();
+	nrows_unbinned = CCD_Setup_Get_Sensor_Height();
+	binning = CCD_Setup_Get_Binning();
+	ncols_binned = ncols_unbinned/binning;
+	nrows_binned = nrows_unbinned/binning;
+	if((ncols_binned*nrows_binned) > frame->Image_Buffer_Length)
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		Moptop_General_Error_Number = 745;
+		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:FITS image dimension mismatch:"
+			"filename '%s', binned ncols = %d, binned_nrows = %d, image buffer length = %d.",
+			frame->Filename,ncols_binned,nrows_binned,frame->Image_Buffer_Length);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	/* Copy the pre-formatted bias/dark FITS headers, and overwrite the per-frame keywords.
+	** The template is read-only during the bias/dark, so the writer threads don't need to lock it. */
+	Moptop_Fits_Header_Template_Copy(&Bias_Dark_Header_Template,card_image_list);
+	if(!Bias_Dark_Fits_Headers_Patch(frame,card_image_list))
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_HEADER,start_time,end_time);
 #if MOPTOP_DEBUG > 5
-	Moptop_General_Log_Format("biasdark","moptop_bias_dark.c","Bias_Dark_Write_Fits_Image",
-				  LOG_VERBOSITY_INTERMEDIATE,"BIASDARK","Saving to filename %s.",filename);
+	Moptop_General_Log_Format("biasdark","moptop_bias_dark.c","Bias_Dark_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
+				  "BIASDARK","Saving to filename %s.",write_filename);
 #endif
+	if(Bias_Dark_Data.Native_Fits_Writer)
+	{
+		/* flip and convert the image buffer to FITS format in place, in one pass.
+		** This is OK as the frame is returned to the writer's free list afterwards. */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Fits_Image_Data_Convert((unsigned short *)frame->Image_Buffer,(unsigned short *)frame->Image_Buffer,
+						ncols_binned,nrows_binned,Bias_Dark_Data.Flip_X,Bias_Dark_Data.Flip_Y))
+		{
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			Moptop_General_Error_Number = 758;
+			sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:Failed to convert image data for '%s'.",
+				frame->Filename);
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_IMAGE_CONVERT,start_time,end_time);
+		/* write the headers and data directly */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Fits_Image_Write(write_filename,card_image_list,Bias_Dark_Header_Template.Card_Count,ncols_binned,nrows_binned,
+					 (unsigned short *)frame->Image_Buffer))
+		{
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			Moptop_General_Error_Number = 757;
+			sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:Failed to write '%s'.",
+				frame->Filename);
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_FITS_WRITE,start_time,end_time);
+	}
+	else
+	{
+		/* check and flip images if configured to do so */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(Bias_Dark_Data.Flip_X)
+			Moptop_Multrun_Flip_X(ncols_binned,nrows_binned,(unsigned short *)frame->Image_Buffer);
+		if(Bias_Dark_Data.Flip_Y)
+			Moptop_Multrun_Flip_Y(ncols_binned,nrows_binned,(unsigned short *)frame->Image_Buffer);
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_IMAGE_CONVERT,start_time,end_time);
+		if(!Bias_Dark_Write_Fits_Image_Cfitsio(frame,write_filename,card_image_list,ncols_binned,nrows_binned))
+		{
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			return FALSE;
+		}
+	}
+	/* unlock FITS filename lock, or rename the temporary file to the FITS filename,
+	** once it is as durable as the writer durability policy requires */
+	if(!Moptop_Writer_Publish(write_filename,0,1))
+		return FALSE;
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log("biasdark","moptop_bias_dark.c","Bias_Dark_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,"BIASDARK",
+			   "Finished.");
+#endif
+	return TRUE;
+}
+
+/**
+ * Accumulate a frame into the master bias/dark, and write the master frame if this was the last frame.
+ * This is called by Bias_Dark_Write_Fits_Image, before the image data is converted.
+ * <ul>
+ * <li>We accumulate the frame using Moptop_Master_Frame_Add.
+ * <li>If this was the last frame, we generate the master frame's FITS filename using 
+ *     CCD_Fits_Filename_Get_Run_Window_Filename, with the last frame's run number (Bias_Dark_Data.Master_Run_Number),
+ *     the run window number, and the CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME pipeline flag.
+ * <li>We copy the bias/dark FITS header template, and patch it with this frame's per-frame keywords using
+ *     Bias_Dark_Fits_Headers_Patch.
+ * <li>We combine, flip and write the master frame using Moptop_Master_Write.
+ * </ul>
+ * The master frame is not added to the bias/dark's list of filenames. Failing to combine the master frame is logged,
+ * rather than failing the bias/dark.
+ * @param frame The read out frame being written, with it's image data still in camera format.
+ * @see #Bias_Dark_Data
+ * @see #Bias_Dark_Header_Template
+ * @see #Bias_Dark_Fits_Headers_Patch
+ * @see #BIAS_DARK_FITS_FILENAME_LENGTH
+ * @see moptop_master.html#Moptop_Master_Frame_Add
+ * @see moptop_master.html#Moptop_Master_Write
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_general.html#Moptop_General_Error
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Get_Run_Window_Filename
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_RUN_WINDOW_NUMBER
+ */
+static void Bias_Dark_Master_Frame(struct Moptop_Writer_Frame_Struct *frame)
+{
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	char filename[BIAS_DARK_FITS_FILENAME_LENGTH];
+	int master_complete;
+
+	if(!Moptop_Master_Frame_Add(frame->Image_Index,(unsigned short *)frame->Image_Buffer,&master_complete))
+	{
+		Moptop_General_Error("biasdark","moptop_bias_dark.c","Bias_Dark_Master_Frame",LOG_VERBOSITY_TERSE,
+				     "BIASDARK");
+		return;
+	}
+	if(master_complete == FALSE)
+		return;
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(Bias_Dark_Data.Exposure_Type,
+						      CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME,
+						      Bias_Dark_Data.Master_Run_Number,CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,
+						      filename,BIAS_DARK_FITS_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 761;
+		sprintf(Moptop_General_Error_String,"Bias_Dark_Master_Frame:"
+			"Failed to get master filename for run %d.",Bias_Dark_Data.Master_Run_Number);
+		Moptop_General_Error("biasdark","moptop_bias_dark.c","Bias_Dark_Master_Frame",LOG_VERBOSITY_TERSE,
+				     "BIASDARK");
+		return;
+	}
+	Moptop_Fits_Header_Template_Copy(&Bias_Dark_Header_Template,card_image_list);
+	if(!Bias_Dark_Fits_Headers_Patch(frame,card_image_list))
+	{
+		Moptop_General_Error("biasdark","moptop_bias_dark.c","Bias_Dark_Master_Frame",LOG_VERBOSITY_TERSE,
+				     "BIASDARK");
+		return;
+	}
+	if(!Moptop_Master_Write(filename,card_image_list,Bias_Dark_Header_Template.Card_Count,
+				Bias_Dark_Data.Flip_X,Bias_Dark_Data.Flip_Y))
+	{
+		Moptop_General_Error("biasdark","moptop_bias_dark.c","Bias_Dark_Master_Frame",LOG_VERBOSITY_TERSE,
+				     "BIASDARK");
+		return;
+	}
+}
+
+/**
+ * Write the FITS headers and image data to disk using CFITSIO. This is used when the native FITS writer
+ * (Bias_Dark_Data.Native_Fits_Writer) is not enabled.
+ * <ul>
+ * <li>We create the FITS filename using fits_create_file.
+ * <li>We create an empty image of the correct dimensions using fits_create_img.
+ * <li>We write the FITS headers to the FITS image using Moptop_Fits_Header_Template_Write_To_Fits.
+ * <li>We write the image data to the FITS image using fits_write_img.
+ * <li>We close the FITS image using fits_close_file.
+ * </ul>
+ * The times taken by the FITS create, FITS write (headers and image data) and FITS close steps
+ * are added to the timing histograms using Moptop_Timing_Add.
+ * The caller is responsible for the FITS filename lock (publishing the FITS image).
+ * @param frame The read out frame to write to disk. This contains the image data.
+ * @param filename The filename to write the data into. This is frame's FITS filename, or a temporary filename
+ *        if the FITS image is published by renaming it (CCD_Fits_Filename_Publish_Begin).
+ * @param card_image_list This frame's copy of the bias/dark FITS header template card images, already patched.
+ * @param ncols_binned The number of columns in the (binned) image.
+ * @param nrows_binned The number of rows in the (binned) image.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Bias_Dark_Header_Template
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Write_To_Fits
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+static int Bias_Dark_Write_Fits_Image_Cfitsio(struct Moptop_Writer_Frame_Struct *frame,char *filename,
+					      char *card_image_list,int ncols_binned,int nrows_binned)
+{
+	struct timespec start_time,end_time;
+	fitsfile *fp = NULL;
+	long axes[2];
+	int retval=0,status=0;
+	char buff[32]; /* fits_get_errstatus returns 30 chars max */
+
 	/* create FITS file */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
 	retval = fits_create_file(&fp,filename,&status);
 	if(retval)
 	{
 		fits_get_errstatus(status,buff);
 		fits_report_error(stderr,status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 742;
-		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:File create failed(%s,%d,%s).",
+		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image_Cfitsio:File create failed(%s,%d,%s).",
 			filename,status,buff);
 		return FALSE;
 	}
-	/* basic dimensions */
-	ncols_unbinned = CCD_Setup_Get_Sensor_Width();
-	nrows_unbinned = CCD_Setup_Get_Sensor_Height();
-	binning = CCD_Setup_Get_Binning();
-	ncols_binned = ncols_unbinned/binning;
-	nrows_binned = nrows_unbinned/binning;
 	axes[0] = ncols_binned;
 	axes[1] = nrows_binned;
 	retval = fits_create_img(fp,USHORT_IMG,2,axes,&status);
@@ -1047,108 +1625,49 @@ static int Bias_Dark_Write_Fits_Image(enum CCD_FITS_FILENAME_EXPOSURE_TYPE expos
 		fits_get_errstatus(status,buff);
 		fits_report_error(stderr,status);
 		fits_close_file(fp,&status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 743;
-		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:create image failed(%s,%d,%s).",
+		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image_Cfitsio:create image failed(%s,%d,%s).",
 			filename,status,buff);
 		return FALSE;
 	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_FITS_CREATE,start_time,end_time);
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
 	/* save FITS headers to filename */
-	if(!CCD_Fits_Header_Write_To_Fits(fp))
+	if(!Moptop_Fits_Header_Template_Write_To_Fits(&Bias_Dark_Header_Template,card_image_list,fp))
 	{
 		fits_close_file(fp,&status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 744;
-		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:CCD_Fits_Header_Write_To_Fits failed.");
-		return FALSE;
-	}
-	/* save data to filename */
-	if((ncols_binned*nrows_binned) > image_buffer_length)
-	{
-		fits_close_file(fp,&status);
-		CCD_Fits_Filename_UnLock(filename);
-		Moptop_General_Error_Number = 745;
-		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:FITS image dimension mismatch:"
-			"filename '%s', binned ncols = %d, binned_nrows = %d, image buffer length = %d.",
-			filename,ncols_binned,nrows_binned,image_buffer_length);
+		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image_Cfitsio:Writing FITS headers failed.");
 		return FALSE;
 	}
-	/* check and flip images if configured to do so */
-	if(Bias_Dark_Data.Flip_X)
-		Moptop_Multrun_Flip_X(ncols_binned,nrows_binned,(unsigned short *)image_buffer);
-	if(Bias_Dark_Data.Flip_Y)
-		Moptop_Multrun_Flip_Y(ncols_binned,nrows_binned,(unsigned short *)image_buffer);
 	/* write the data */
-	retval = fits_write_img(fp,TUSHORT,1,ncols_binned*nrows_binned,image_buffer,&status);
+	retval = fits_write_img(fp,TUSHORT,1,ncols_binned*nrows_binned,frame->Image_Buffer,&status);
 	if(retval)
 	{
 		fits_get_errstatus(status,buff);
 		fits_report_error(stderr,status);
 		fits_close_file(fp,&status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 746;
-		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:File write failed(%s,%d,%s).",
+		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image_Cfitsio:File write failed(%s,%d,%s).",
 			filename,status,buff);
 		return FALSE;
 	}
-	/* CCDSCALE */
-	/* bin1 value configured in Java layer and passed into fits header list.
-	** Should have been written to file in CCD_Fits_Header_Write_To_Fits.
-	** So retrieve bin1 value using CFITSIO, mod by binning and update value */
-	if(binning != 1)
-	{
-		retval = fits_read_key(fp,TDOUBLE,"CCDSCALE",&ccdscale,NULL,&status);
-		if(retval)
-		{
-			fits_get_errstatus(status,buff);
-			fits_report_error(stderr,status);
-			fits_close_file(fp,&status);
-			CCD_Fits_Filename_UnLock(filename);
-			Moptop_General_Error_Number = 747;
-			sprintf(Moptop_General_Error_String,
-				"Bias_Dark_Write_Fits_Image: Retrieving ccdscale failed(%s,%d,%s).",
-				filename,status,buff);
-			return FALSE;
-		}
-		/* adjust for binning */
-		ccdscale *= binning; /* assume xbin and ybin are equal */
-		/* write adjusted value back */
-		retval = fits_update_key_fixdbl(fp,"CCDSCALE",ccdscale,6,NULL,&status);
-		if(retval)
-		{
-			fits_get_errstatus(status,buff);
-			fits_report_error(stderr,status);
-			fits_close_file(fp,&status);
-			CCD_Fits_Filename_UnLock(filename);
-			Moptop_General_Error_Number = 748;
-			sprintf(Moptop_General_Error_String,
-				"Bias_Dark_Write_Fits_Image: Updating ccdscale failed(%.2f,%s,%d,%s).",
-				ccdscale,filename,status,buff);
-			return FALSE;
-		}
-	}/* end if binning != 1 */
-/* close file */
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_FITS_WRITE,start_time,end_time);
+	/* close file */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
 	retval = fits_close_file(fp,&status);
 	if(retval)
 	{
 		fits_get_errstatus(status,buff);
 		fits_report_error(stderr,status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 749;
 		sprintf(Moptop_General_Error_String,
-			"Bias_Dark_Write_Fits_Image: File close failed(%s,%d,%s).",filename,status,buff);
+			"Bias_Dark_Write_Fits_Image_Cfitsio: File close failed(%s,%d,%s).",filename,status,buff);
 		return FALSE;
 	}
-	/* unlock FITS filename lock */
-	if(!CCD_Fits_Filename_UnLock(filename))
-	{
-		Moptop_General_Error_Number = 750;
-		sprintf(Moptop_General_Error_String,"Bias_Dark_Write_Fits_Image:Failed to unlock '%s'.",filename);
-		return FALSE;
-	}
-#if MOPTOP_DEBUG > 5
-	Moptop_General_Log("biasdark","moptop_bias_dark.c","Bias_Dark_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
-			   "BIASDARK","Finished.");
-#endif
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_FITS_CLOSE,start_time,end_time);
 	return TRUE;
 }
@@ -0,0 +1,902 @@
+/* moptop_calibrate.c
+** Moptop real time calibration routines
+*/
+/**
+ * Routines to calibrate each frame of a multrun as it is written, using master calibration frames held in memory,
+ * rather than leaving this to an offline pipeline. The master bias, dark and flat are either loaded from FITS images
+ * (the configured master filenames), or combined from the frames of the last multbias/multdark as they are taken
+ * (moptop_master.c).
+ * At the start of each multrun the master bias and the master dark (scaled to the multrun's exposure length) are
+ * combined into one offset image, and the reciprocal of the master flat is taken, so each frame only needs one
+ * subtraction (and one multiplication) per pixel: calibrated = (frame - (bias + dark * EXPTIME)) / flat.
+ * This is done by the writer threads, using AVX2/FMA instructions where the CPU supports them, and the calibrated
+ * frame is written as a float FITS image with the real time pipeline flag set in it's filename.
+ * The master frames are held in FITS image orientation (as written to disk, after any flip), and the offset and
+ * reciprocal flat are flipped back to camera orientation at the start of each multrun.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "fitsio.h"
+
+#include "log_udp.h"
+
+#include "ccd_fits_filename.h"
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+
+#include "moptop_calibrate.h"
+#include "moptop_config.h"
+#include "moptop_fits_header.h"
+#include "moptop_general.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
+
+/* hash defines */
+/**
+ * The number of FITS cards added to the header of a calibrated frame, describing the master frames used.
+ */
+#define CALIBRATE_CARD_COUNT            (3)
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Defined if this is an x86 build, and the AVX2/FMA calibration kernel can be compiled (and selected
+ * at run time if the CPU supports it).
+ */
+#define CALIBRATE_X86                   (1)
+#endif
+
+/* data types */
+/**
+ * Data type holding one master calibration frame.
+ * <dl>
+ * <dt>Data</dt> <dd>The master frame, Ncols x Nrows floats in FITS image orientation, or NULL if there is no
+ *                   master of this type. Dark masters are held as counts per second, flat masters are normalised
+ *                   to a mean of 1.</dd>
+ * <dt>Ncols</dt> <dd>The number of columns in the master frame.</dd>
+ * <dt>Nrows</dt> <dd>The number of rows in the master frame.</dd>
+ * <dt>Source</dt> <dd>Where the master frame came from (the FITS image loaded, or the first frame it was
+ *                     built from).</dd>
+ * <dt>Loaded_Filename</dt> <dd>The filename last loaded by Moptop_Calibrate_Master_Load. This is not reloaded
+ *                              by Moptop_Calibrate_Start until the configured filename changes, so a master
+ *                              built from a multbias/multdark is used until then.</dd>
+ * </dl>
+ * @see moptop_calibrate.html#MOPTOP_CALIBRATE_SOURCE_LENGTH
+ */
+struct Calibrate_Master_Struct
+{
+	float *Data;
+	int Ncols;
+	int Nrows;
+	char Source[MOPTOP_CALIBRATE_SOURCE_LENGTH];
+	char Loaded_Filename[MOPTOP_CALIBRATE_SOURCE_LENGTH];
+};
+
+/**
+ * Data type holding local data to the moptop calibrate routines.
+ * <dl>
+ * <dt>Enable</dt> <dd>A boolean, TRUE if frames are being calibrated during this multrun
+ *                     ("moptop.multrun.calibrate.enable", and there is a master bias of the right size).</dd>
+ * <dt>Use_FMA</dt> <dd>A boolean, TRUE if the CPU supports AVX2 and FMA, and the SIMD kernel is used.</dd>
+ * <dt>Ncols</dt> <dd>The number of (binned) columns in each frame.</dd>
+ * <dt>Nrows</dt> <dd>The number of (binned) rows in each frame.</dd>
+ * <dt>Flip_X</dt> <dd>A boolean, if TRUE the calibrated frames are flipped in X.</dd>
+ * <dt>Flip_Y</dt> <dd>A boolean, if TRUE the calibrated frames are flipped in Y.</dd>
+ * <dt>Master_List</dt> <dd>The master calibration frames, indexed by MOPTOP_CALIBRATE_MASTER.</dd>
+ * <dt>Card_Value_List</dt> <dd>The source of each master used this multrun, or "none", for the FITS headers.</dd>
+ * <dt>Offset</dt> <dd>The bias plus scaled dark to subtract from each frame, in camera orientation.</dd>
+ * <dt>Gain</dt> <dd>The reciprocal of the flat to multiply each frame by, in camera orientation,
+ *                   or NULL if there is no flat this multrun.</dd>
+ * <dt>Gain_List</dt> <dd>The allocated reciprocal flat (Gain points to this when there is a flat).</dd>
+ * <dt>Pixel_Count</dt> <dd>The number of pixels Offset and Gain_List were allocated for.</dd>
+ * <dt>Buffer_List</dt> <dd>The float buffers calibrated frames are made in, one per writer thread.
+ *                          These are allocated the first time they are used, and kept between multruns.</dd>
+ * <dt>Buffer_Pixel_Count_List</dt> <dd>The number of pixels each buffer was allocated for.</dd>
+ * <dt>Buffer_In_Use_List</dt> <dd>A boolean for each buffer, TRUE whilst a writer thread is using it.</dd>
+ * </dl>
+ * @see #Calibrate_Master_Struct
+ * @see moptop_calibrate.html#MOPTOP_CALIBRATE_MASTER_COUNT
+ * @see moptop_writer.html#MOPTOP_WRITER_THREAD_COUNT_MAX
+ */
+struct Calibrate_Struct
+{
+	int Enable;
+	int Use_FMA;
+	int Ncols;
+	int Nrows;
+	int Flip_X;
+	int Flip_Y;
+	struct Calibrate_Master_Struct Master_List[MOPTOP_CALIBRATE_MASTER_COUNT];
+	char Card_Value_List[MOPTOP_CALIBRATE_MASTER_COUNT][MOPTOP_CALIBRATE_SOURCE_LENGTH];
+	float *Offset;
+	float *Gain;
+	float *Gain_List;
+	size_t Pixel_Count;
+	float *Buffer_List[MOPTOP_WRITER_THREAD_COUNT_MAX];
+	size_t Buffer_Pixel_Count_List[MOPTOP_WRITER_THREAD_COUNT_MAX];
+	int Buffer_In_Use_List[MOPTOP_WRITER_THREAD_COUNT_MAX];
+};
+
+/* internal data */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * The instance of Calibrate_Struct that contains local data for this module.
+ * @see #Calibrate_Struct
+ */
+static struct Calibrate_Struct Calibrate_Data;
+/**
+ * A mutex protecting the master frames, and the allocation of the calibration buffers.
+ */
+static pthread_mutex_t Calibrate_Mutex = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * The name of each type of master frame, used in config keywords and log messages.
+ * @see moptop_calibrate.html#MOPTOP_CALIBRATE_MASTER
+ */
+static char *Calibrate_Master_Name_List[MOPTOP_CALIBRATE_MASTER_COUNT] = {"bias","dark","flat"};
+/**
+ * The keywords of the FITS cards added to the header of a calibrated frame, one per type of master frame.
+ * @see #CALIBRATE_CARD_COUNT
+ * @see moptop_calibrate.html#MOPTOP_CALIBRATE_MASTER
+ */
+static char *Calibrate_Card_Keyword_List[CALIBRATE_CARD_COUNT] = {"CALBIAS","CALDARK","CALFLAT"};
+
+/* internal functions */
+static int Calibrate_Fits_Read(char *filename,float **image_data,int *ncols,int *nrows,double *exposure_length);
+static void Calibrate_Apply_Row(float *output_row,unsigned short *image_row,float *offset_row,float *gain_row,
+				int ncols);
+static int Calibrate_Apply_Row_Scalar(float *output_row,unsigned short *image_row,float *offset_row,
+				      float *gain_row,int start,int ncols);
+#ifdef CALIBRATE_X86
+static int Calibrate_Apply_Row_FMA(float *output_row,unsigned short *image_row,float *offset_row,float *gain_row,
+				   int ncols);
+#endif
+
+/* ----------------------------------------------------------------------------
+** 		external functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Set a master calibration frame in memory, replacing any previous master of that type.
+ * <ul>
+ * <li>A master bias is copied as it is.
+ * <li>A master dark (which must already be bias subtracted) is divided by it's exposure length, so it can be
+ *     scaled to the exposure length of each multrun.
+ * <li>A master flat is normalised by the mean of it's positive pixels.
+ * </ul>
+ * The image data should be in FITS image orientation, i.e. as written to disk (after any flip).
+ * @param type Which type of master frame this is.
+ * @param image_data The master frame, ncols x nrows floats. This is copied, and not changed.
+ * @param ncols The number of columns in the master frame.
+ * @param nrows The number of rows in the master frame.
+ * @param exposure_length The exposure length of the master frame in seconds. This must be positive for a master dark,
+ *        and is otherwise unused.
+ * @param source A string describing where the master frame came from (a filename), put in the FITS headers
+ *        of the calibrated frames.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Calibrate_Data
+ * @see #Calibrate_Mutex
+ * @see #Calibrate_Master_Name_List
+ * @see moptop_calibrate.html#MOPTOP_CALIBRATE_IS_MASTER
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Calibrate_Master_Set(enum MOPTOP_CALIBRATE_MASTER type,float *image_data,int ncols,int nrows,
+				double exposure_length,char *source)
+{
+	struct Calibrate_Master_Struct *master = NULL;
+	float *data = NULL;
+	double sum,scale;
+	size_t i,pixel_count,positive_count;
+
+	if(!MOPTOP_CALIBRATE_IS_MASTER(type))
+	{
+		Moptop_General_Error_Number = 1200;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Set:Illegal master type %d.",type);
+		return FALSE;
+	}
+	if((image_data == NULL)||(ncols < 1)||(nrows < 1)||(source == NULL))
+	{
+		Moptop_General_Error_Number = 1201;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Set:"
+			"Illegal %s master image (%p,%d,%d) or source.",Calibrate_Master_Name_List[type],
+			(void*)image_data,ncols,nrows);
+		return FALSE;
+	}
+	if((type == MOPTOP_CALIBRATE_MASTER_DARK)&&(exposure_length <= 0.0))
+	{
+		Moptop_General_Error_Number = 1202;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Set:"
+			"Illegal master dark exposure length %.6f s.",exposure_length);
+		return FALSE;
+	}
+	pixel_count = ((size_t)ncols)*((size_t)nrows);
+	data = (float *)malloc(pixel_count*sizeof(float));
+	if(data == NULL)
+	{
+		Moptop_General_Error_Number = 1203;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Set:"
+			"Failed to allocate %s master (%d x %d).",Calibrate_Master_Name_List[type],ncols,nrows);
+		return FALSE;
+	}
+	if(type == MOPTOP_CALIBRATE_MASTER_DARK)
+	{
+		scale = 1.0/exposure_length;
+		for(i = 0; i < pixel_count; i++)
+			data[i] = (float)(image_data[i]*scale);
+	}
+	else if(type == MOPTOP_CALIBRATE_MASTER_FLAT)
+	{
+		sum = 0.0;
+		positive_count = 0;
+		for(i = 0; i < pixel_count; i++)
+		{
+			if(image_data[i] > 0.0f)
+			{
+				sum += image_data[i];
+				positive_count++;
+			}
+		}
+		if(positive_count == 0)
+		{
+			free(data);
+			Moptop_General_Error_Number = 1204;
+			sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Set:"
+				"Master flat from '%s' has no positive pixels.",source);
+			return FALSE;
+		}
+		scale = ((double)positive_count)/sum;
+		for(i = 0; i < pixel_count; i++)
+			data[i] = (float)(image_data[i]*scale);
+	}
+	else
+		memcpy(data,image_data,pixel_count*sizeof(float));
+	if(!Moptop_General_Mutex_Lock(&Calibrate_Mutex))
+	{
+		free(data);
+		return FALSE;
+	}
+	master = &(Calibrate_Data.Master_List[type]);
+	if(master->Data != NULL)
+		free(master->Data);
+	master->Data = data;
+	master->Ncols = ncols;
+	master->Nrows = nrows;
+	strncpy(master->Source,source,MOPTOP_CALIBRATE_SOURCE_LENGTH-1);
+	master->Source[MOPTOP_CALIBRATE_SOURCE_LENGTH-1] = '\0';
+	if(!Moptop_General_Mutex_Unlock(&Calibrate_Mutex))
+		return FALSE;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("calibrate","moptop_calibrate.c","Moptop_Calibrate_Master_Set",
+				  LOG_VERBOSITY_INTERMEDIATE,"CALIBRATE","Master %s of %d x %d pixels set from '%s'.",
+				  Calibrate_Master_Name_List[type],ncols,nrows,source);
+#endif
+	return TRUE;
+}
+
+/**
+ * Load a master calibration frame from a FITS image.
+ * <ul>
+ * <li>We read the image (and it's EXPTIME keyword, if it has one) using Calibrate_Fits_Read.
+ * <li>We set it as the master frame using Moptop_Calibrate_Master_Set. A master dark must be bias subtracted, and
+ *     have an EXPTIME keyword.
+ * <li>We remember the filename in the master's Loaded_Filename, so Moptop_Calibrate_Start does not reload it.
+ * </ul>
+ * @param type Which type of master frame to load.
+ * @param filename The FITS image to load.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Calibrate_Data
+ * @see #Calibrate_Mutex
+ * @see #Calibrate_Fits_Read
+ * @see #Moptop_Calibrate_Master_Set
+ * @see moptop_calibrate.html#MOPTOP_CALIBRATE_IS_MASTER
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Calibrate_Master_Load(enum MOPTOP_CALIBRATE_MASTER type,char *filename)
+{
+	float *image_data = NULL;
+	double exposure_length;
+	int ncols,nrows,retval;
+
+	if(!MOPTOP_CALIBRATE_IS_MASTER(type))
+	{
+		Moptop_General_Error_Number = 1205;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Load:Illegal master type %d.",type);
+		return FALSE;
+	}
+	if((filename == NULL)||(strlen(filename) >= MOPTOP_CALIBRATE_SOURCE_LENGTH))
+	{
+		Moptop_General_Error_Number = 1206;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Load:Illegal %s master filename.",
+			Calibrate_Master_Name_List[type]);
+		return FALSE;
+	}
+	if(!Calibrate_Fits_Read(filename,&image_data,&ncols,&nrows,&exposure_length))
+		return FALSE;
+	retval = Moptop_Calibrate_Master_Set(type,image_data,ncols,nrows,exposure_length,filename);
+	free(image_data);
+	if(retval == FALSE)
+		return FALSE;
+	if(!Moptop_General_Mutex_Lock(&Calibrate_Mutex))
+		return FALSE;
+	strcpy(Calibrate_Data.Master_List[type].Loaded_Filename,filename);
+	if(!Moptop_General_Mutex_Unlock(&Calibrate_Mutex))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Subtract the master bias from an image, for instance to make a master dark before passing it to
+ * Moptop_Calibrate_Master_Set. The master bias must be the same size as the image.
+ * @param image_data The image, ncols x nrows floats in FITS image orientation. This is modified.
+ * @param ncols The number of columns in the image.
+ * @param nrows The number of rows in the image.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Calibrate_Data
+ * @see #Calibrate_Mutex
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Calibrate_Master_Bias_Subtract(float *image_data,int ncols,int nrows)
+{
+	struct Calibrate_Master_Struct *bias = NULL;
+	size_t i,pixel_count;
+
+	if(image_data == NULL)
+	{
+		Moptop_General_Error_Number = 1207;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Bias_Subtract:image_data was NULL.");
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&Calibrate_Mutex))
+		return FALSE;
+	bias = &(Calibrate_Data.Master_List[MOPTOP_CALIBRATE_MASTER_BIAS]);
+	if((bias->Data == NULL)||(bias->Ncols != ncols)||(bias->Nrows != nrows))
+	{
+		Moptop_General_Mutex_Unlock(&Calibrate_Mutex);
+		Moptop_General_Error_Number = 1211;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Master_Bias_Subtract:"
+			"No %d x %d master bias to subtract.",ncols,nrows);
+		return FALSE;
+	}
+	pixel_count = ((size_t)ncols)*((size_t)nrows);
+	for(i = 0; i < pixel_count; i++)
+		image_data[i] -= bias->Data[i];
+	if(!Moptop_General_Mutex_Unlock(&Calibrate_Mutex))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Setup the real time calibration of the frames of a multrun. This must be called before the writer threads
+ * are started.
+ * <ul>
+ * <li>We retrieve the "moptop.multrun.calibrate.enable" config value. If it is FALSE we return.
+ * <li>For each type of master frame, we retrieve the "moptop.multrun.calibrate.<bias|dark|flat>.filename" config
+ *     value. If it is not "none", and has changed since it was last loaded, we load it using
+ *     Moptop_Calibrate_Master_Load. A failure to load a master is logged, and any previous master is kept.
+ * <li>If there is no master bias of the right size, the frames are not calibrated this multrun (this is logged,
+ *     but does not fail the multrun). A master dark or flat of the wrong size is not used.
+ * <li>We compute the offset (bias + dark * exposure_length) and gain (1 / flat, or 0 where the flat is not
+ *     positive) images, and flip them back into camera orientation using Moptop_General_Float_Plane_Flip.
+ * <li>We select the calibration kernel: AVX2/FMA if the CPU supports it, otherwise scalar.
+ * </ul>
+ * @param ncols The number of (binned) columns in each frame.
+ * @param nrows The number of (binned) rows in each frame.
+ * @param flip_x A boolean, if TRUE the frames are flipped in X when written.
+ * @param flip_y A boolean, if TRUE the frames are flipped in Y when written.
+ * @param exposure_length The length of each exposure, in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Calibrate_Data
+ * @see #Calibrate_Mutex
+ * @see #Calibrate_Master_Name_List
+ * @see moptop_general.html#Moptop_General_Float_Plane_Flip
+ * @see #Moptop_Calibrate_Master_Load
+ * @see moptop_config.html#Moptop_Config_Get_Boolean
+ * @see moptop_config.html#Moptop_Config_Get_String
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Calibrate_Start(int ncols,int nrows,int flip_x,int flip_y,double exposure_length)
+{
+	struct Calibrate_Master_Struct *master = NULL;
+	float *bias_data = NULL;
+	float *dark_data = NULL;
+	float *flat_data = NULL;
+	float *new_data = NULL;
+	char keyword[64];
+	char *filename = NULL;
+	size_t i,pixel_count;
+	int type,reload;
+
+	Calibrate_Data.Enable = FALSE;
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.calibrate.enable",&(Calibrate_Data.Enable)))
+		return FALSE;
+	if(Calibrate_Data.Enable == FALSE)
+		return TRUE;
+	Calibrate_Data.Enable = FALSE;
+	if((ncols < 1)||(nrows < 1))
+	{
+		Moptop_General_Error_Number = 1212;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Start:Illegal image dimensions (%d,%d).",
+			ncols,nrows);
+		return FALSE;
+	}
+	/* (re)load any configured master frames */
+	for(type = 0; type < MOPTOP_CALIBRATE_MASTER_COUNT; type++)
+	{
+		sprintf(keyword,"moptop.multrun.calibrate.%s.filename",Calibrate_Master_Name_List[type]);
+		if(!Moptop_Config_Get_String(keyword,&filename))
+			return FALSE;
+		reload = (strcmp(filename,"none") != 0)&&
+			(strcmp(filename,Calibrate_Data.Master_List[type].Loaded_Filename) != 0);
+		if(reload && (!Moptop_Calibrate_Master_Load(type,filename)))
+		{
+			Moptop_General_Error("calibrate","moptop_calibrate.c","Moptop_Calibrate_Start",
+					     LOG_VERBOSITY_TERSE,"CALIBRATE");
+		}
+		free(filename);
+	}
+	if(!Moptop_General_Mutex_Lock(&Calibrate_Mutex))
+		return FALSE;
+	/* which master frames can we use */
+	for(type = 0; type < MOPTOP_CALIBRATE_MASTER_COUNT; type++)
+	{
+		master = &(Calibrate_Data.Master_List[type]);
+		if((master->Data != NULL)&&(master->Ncols == ncols)&&(master->Nrows == nrows))
+			strcpy(Calibrate_Data.Card_Value_List[type],master->Source);
+		else
+		{
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log_Format("calibrate","moptop_calibrate.c","Moptop_Calibrate_Start",
+						  LOG_VERBOSITY_INTERMEDIATE,"CALIBRATE","No %d x %d master %s.",ncols,nrows,
+						  Calibrate_Master_Name_List[type]);
+#endif
+			strcpy(Calibrate_Data.Card_Value_List[type],"none");
+		}
+	}
+	if(strcmp(Calibrate_Data.Card_Value_List[MOPTOP_CALIBRATE_MASTER_BIAS],"none") == 0)
+	{
+		Moptop_General_Mutex_Unlock(&Calibrate_Mutex);
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log("calibrate","moptop_calibrate.c","Moptop_Calibrate_Start",LOG_VERBOSITY_TERSE,
+				   "CALIBRATE","No master bias: frames will not be calibrated.");
+#endif
+		return TRUE;
+	}
+	bias_data = Calibrate_Data.Master_List[MOPTOP_CALIBRATE_MASTER_BIAS].Data;
+	if(strcmp(Calibrate_Data.Card_Value_List[MOPTOP_CALIBRATE_MASTER_DARK],"none") != 0)
+		dark_data = Calibrate_Data.Master_List[MOPTOP_CALIBRATE_MASTER_DARK].Data;
+	if(strcmp(Calibrate_Data.Card_Value_List[MOPTOP_CALIBRATE_MASTER_FLAT],"none") != 0)
+		flat_data = Calibrate_Data.Master_List[MOPTOP_CALIBRATE_MASTER_FLAT].Data;
+	/* combine the master frames into the offset and gain images */
+	pixel_count = ((size_t)ncols)*((size_t)nrows);
+	if(Calibrate_Data.Pixel_Count < pixel_count)
+	{
+		new_data = (float *)realloc(Calibrate_Data.Offset,pixel_count*sizeof(float));
+		if(new_data != NULL)
+		{
+			Calibrate_Data.Offset = new_data;
+			new_data = (float *)realloc(Calibrate_Data.Gain_List,pixel_count*sizeof(float));
+		}
+		if(new_data == NULL)
+		{
+			Moptop_General_Mutex_Unlock(&Calibrate_Mutex);
+			Moptop_General_Error_Number = 1213;
+			sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Start:"
+				"Failed to allocate offset and gain images (%d x %d).",ncols,nrows);
+			return FALSE;
+		}
+		Calibrate_Data.Gain_List = new_data;
+		Calibrate_Data.Pixel_Count = pixel_count;
+	}
+	for(i = 0; i < pixel_count; i++)
+	{
+		if(dark_data != NULL)
+			Calibrate_Data.Offset[i] = bias_data[i]+(float)(dark_data[i]*exposure_length);
+		else
+			Calibrate_Data.Offset[i] = bias_data[i];
+	}
+	Moptop_General_Float_Plane_Flip(Calibrate_Data.Offset,ncols,nrows,flip_x,flip_y);
+	Calibrate_Data.Gain = NULL;
+	if(flat_data != NULL)
+	{
+		for(i = 0; i < pixel_count; i++)
+		{
+			if(flat_data[i] > 0.0f)
+				Calibrate_Data.Gain_List[i] = 1.0f/flat_data[i];
+			else
+				Calibrate_Data.Gain_List[i] = 0.0f;
+		}
+		Moptop_General_Float_Plane_Flip(Calibrate_Data.Gain_List,ncols,nrows,flip_x,flip_y);
+		Calibrate_Data.Gain = Calibrate_Data.Gain_List;
+	}
+	if(!Moptop_General_Mutex_Unlock(&Calibrate_Mutex))
+		return FALSE;
+	Calibrate_Data.Ncols = ncols;
+	Calibrate_Data.Nrows = nrows;
+	Calibrate_Data.Flip_X = flip_x;
+	Calibrate_Data.Flip_Y = flip_y;
+	Calibrate_Data.Use_FMA = FALSE;
+#ifdef CALIBRATE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		Calibrate_Data.Use_FMA = TRUE;
+#endif
+	Calibrate_Data.Enable = TRUE;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("calibrate","moptop_calibrate.c","Moptop_Calibrate_Start",LOG_VERBOSITY_INTERMEDIATE,
+				  "CALIBRATE","Calibrating frames of %d x %d pixels (bias '%s', dark '%s' scaled to "
+				  "%.6f s, flat '%s') using the %s kernel.",ncols,nrows,
+				  Calibrate_Data.Card_Value_List[MOPTOP_CALIBRATE_MASTER_BIAS],
+				  Calibrate_Data.Card_Value_List[MOPTOP_CALIBRATE_MASTER_DARK],exposure_length,
+				  Calibrate_Data.Card_Value_List[MOPTOP_CALIBRATE_MASTER_FLAT],
+				  Calibrate_Data.Use_FMA ? "avx2/fma" : "scalar");
+#endif
+	return TRUE;
+}
+
+/**
+ * Return whether frames are being calibrated during this multrun.
+ * @return TRUE if Moptop_Calibrate_Start enabled the calibration, FALSE otherwise.
+ * @see #Calibrate_Data
+ */
+int Moptop_Calibrate_Is_Enabled(void)
+{
+	return Calibrate_Data.Enable;
+}
+
+/**
+ * Calibrate a frame, and write it as a float FITS image. This is called by the writer threads, before the frame's
+ * image data is converted to FITS format.
+ * <ul>
+ * <li>We get a free calibration buffer (allocating it the first time it is used), holding Calibrate_Mutex.
+ * <li>We calibrate each row of the frame into the buffer using Calibrate_Apply_Row, writing the rows in reverse
+ *     order if the frame is flipped in Y. If the frame is flipped in X, we then flip the buffer in X.
+ * <li>We add the time taken to the MOPTOP_TIMING_TYPE_CALIBRATE timing histogram.
+ * <li>If there is room, we add the CALBIAS/CALDARK/CALFLAT (master frames used) cards to card_image_list.
+ * <li>We lock the FITS filename (or get the temporary filename to write to) using CCD_Fits_Filename_Publish_Begin.
+ * <li>We write the buffer to a float FITS image using CCD_Fits_Image_Float_Write.
+ * <li>We publish it using Moptop_Writer_Publish, as part of the rotation's group but holding no frames.
+ * </ul>
+ * If the calibration is not enabled, this routine does nothing.
+ * @param rotation_number The rotation number (from 1) of the frame.
+ * @param image_data The frame's image data, Ncols x Nrows unsigned shorts in host byte order (as read out
+ *        from the camera).
+ * @param filename The FITS filename of the calibrated frame.
+ * @param card_image_list The FITS header card images to put in the calibrated frame, of at least
+ *        MOPTOP_FITS_HEADER_TEMPLATE_LENGTH characters. This is modified.
+ * @param card_count The number of card images in card_image_list.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #CALIBRATE_CARD_COUNT
+ * @see #Calibrate_Card_Keyword_List
+ * @see #Calibrate_Data
+ * @see #Calibrate_Mutex
+ * @see #Calibrate_Apply_Row
+ * @see moptop_general.html#Moptop_General_Float_Plane_Flip
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_String_Set
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Float_Write
+ */
+int Moptop_Calibrate_Frame_Write(int rotation_number,unsigned short *image_data,char *filename,
+				 char *card_image_list,int card_count)
+{
+	struct timespec start_time,end_time;
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	float *buffer = NULL;
+	float *new_buffer = NULL;
+	float *gain_row = NULL;
+	size_t pixel_count,row_offset;
+	int i,buffer_index,y,output_y,retval;
+
+	if(Calibrate_Data.Enable == FALSE)
+		return TRUE;
+	if((image_data == NULL)||(filename == NULL)||(card_image_list == NULL))
+	{
+		Moptop_General_Error_Number = 1214;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Frame_Write:"
+			"image_data, filename or card_image_list was NULL.");
+		return FALSE;
+	}
+	/* get a calibration buffer */
+	pixel_count = ((size_t)Calibrate_Data.Ncols)*((size_t)Calibrate_Data.Nrows);
+	if(!Moptop_General_Mutex_Lock(&Calibrate_Mutex))
+		return FALSE;
+	buffer_index = -1;
+	for(i = 0; i < MOPTOP_WRITER_THREAD_COUNT_MAX; i++)
+	{
+		if(Calibrate_Data.Buffer_In_Use_List[i] == FALSE)
+		{
+			buffer_index = i;
+			break;
+		}
+	}
+	if(buffer_index == -1)
+	{
+		Moptop_General_Mutex_Unlock(&Calibrate_Mutex);
+		Moptop_General_Error_Number = 1215;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Frame_Write:"
+			"No free calibration buffers for '%s'.",filename);
+		return FALSE;
+	}
+	if(Calibrate_Data.Buffer_Pixel_Count_List[buffer_index] < pixel_count)
+	{
+		new_buffer = (float *)realloc(Calibrate_Data.Buffer_List[buffer_index],pixel_count*sizeof(float));
+		if(new_buffer == NULL)
+		{
+			Moptop_General_Mutex_Unlock(&Calibrate_Mutex);
+			Moptop_General_Error_Number = 1216;
+			sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Frame_Write:"
+				"Failed to allocate calibration buffer %d (%d x %d).",buffer_index,
+				Calibrate_Data.Ncols,Calibrate_Data.Nrows);
+			return FALSE;
+		}
+		Calibrate_Data.Buffer_List[buffer_index] = new_buffer;
+		Calibrate_Data.Buffer_Pixel_Count_List[buffer_index] = pixel_count;
+	}
+	Calibrate_Data.Buffer_In_Use_List[buffer_index] = TRUE;
+	buffer = Calibrate_Data.Buffer_List[buffer_index];
+	if(!Moptop_General_Mutex_Unlock(&Calibrate_Mutex))
+		return FALSE;
+	/* calibrate the frame into the buffer, flipping it as we go */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	for(y = 0; y < Calibrate_Data.Nrows; y++)
+	{
+		if(Calibrate_Data.Flip_Y)
+			output_y = Calibrate_Data.Nrows-(y+1);
+		else
+			output_y = y;
+		row_offset = ((size_t)y)*((size_t)Calibrate_Data.Ncols);
+		if(Calibrate_Data.Gain != NULL)
+			gain_row = Calibrate_Data.Gain+row_offset;
+		Calibrate_Apply_Row(buffer+(((size_t)output_y)*((size_t)Calibrate_Data.Ncols)),image_data+row_offset,
+				    Calibrate_Data.Offset+row_offset,gain_row,Calibrate_Data.Ncols);
+	}
+	if(Calibrate_Data.Flip_X)
+		Moptop_General_Float_Plane_Flip(buffer,Calibrate_Data.Ncols,Calibrate_Data.Nrows,TRUE,FALSE);
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_CALIBRATE,start_time,end_time);
+	/* describe the master frames used */
+	if((card_count+CALIBRATE_CARD_COUNT) <= MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX)
+	{
+		for(i = 0; i < CALIBRATE_CARD_COUNT; i++)
+		{
+			CCD_Fits_Header_Card_Image_String_Set(card_image_list+((card_count+i)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+							      Calibrate_Card_Keyword_List[i],
+							      Calibrate_Data.Card_Value_List[i]);
+		}
+		card_count += CALIBRATE_CARD_COUNT;
+	}
+	retval = CCD_Fits_Filename_Publish_Begin(filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH);
+	if(retval == FALSE)
+	{
+		Moptop_General_Error_Number = 1217;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Frame_Write:Failed to lock '%s'.",filename);
+	}
+	else if(!CCD_Fits_Image_Float_Write(write_filename,card_image_list,card_count,Calibrate_Data.Ncols,
+					    Calibrate_Data.Nrows,0,buffer))
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		Moptop_General_Error_Number = 1218;
+		sprintf(Moptop_General_Error_String,"Moptop_Calibrate_Frame_Write:Failed to write '%s'.",filename);
+		retval = FALSE;
+	}
+	/* release the calibration buffer */
+	pthread_mutex_lock(&Calibrate_Mutex);
+	Calibrate_Data.Buffer_In_Use_List[buffer_index] = FALSE;
+	pthread_mutex_unlock(&Calibrate_Mutex);
+	if(retval == FALSE)
+		return FALSE;
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("calibrate","moptop_calibrate.c","Moptop_Calibrate_Frame_Write",
+				  LOG_VERBOSITY_INTERMEDIATE,"CALIBRATE","Calibrated frame written to '%s' in %.3f ms.",
+				  filename,fdifftime(end_time,start_time)*1000.0);
+#endif
+	/* publish the calibrated frame with the rotation's frames. It holds no frames, so does not complete the rotation */
+	return Moptop_Writer_Publish(write_filename,rotation_number,0);
+}
+
+/* ----------------------------------------------------------------------------
+** 		internal functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Read a 2D FITS image into a newly allocated float buffer using CFITSIO (applying any BZERO/BSCALE),
+ * and get it's EXPTIME keyword.
+ * @param filename The FITS image to read.
+ * @param image_data The address of a float pointer, set to the allocated image data, which should be freed
+ *        by the caller.
+ * @param ncols The address of an integer to store the number of columns (NAXIS1).
+ * @param nrows The address of an integer to store the number of rows (NAXIS2).
+ * @param exposure_length The address of a double to store the EXPTIME keyword value in seconds, or 0.0
+ *        if the image has no EXPTIME keyword.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+static int Calibrate_Fits_Read(char *filename,float **image_data,int *ncols,int *nrows,double *exposure_length)
+{
+	fitsfile *fp = NULL;
+	long axes[2];
+	float nulval = 0.0f;
+	int status = 0;
+	int naxis,anynul;
+	char buff[32]; /* fits_get_errstatus returns 30 chars max */
+
+	(*image_data) = NULL;
+	if(fits_open_file(&fp,filename,READONLY,&status))
+	{
+		fits_get_errstatus(status,buff);
+		Moptop_General_Error_Number = 1219;
+		sprintf(Moptop_General_Error_String,"Calibrate_Fits_Read:Failed to open '%s' (%d,%s).",filename,
+			status,buff);
+		return FALSE;
+	}
+	if(fits_get_img_dim(fp,&naxis,&status)||(naxis != 2)||fits_get_img_size(fp,2,axes,&status))
+	{
+		fits_get_errstatus(status,buff);
+		status = 0;
+		fits_close_file(fp,&status);
+		Moptop_General_Error_Number = 1220;
+		sprintf(Moptop_General_Error_String,"Calibrate_Fits_Read:'%s' is not a 2D image (%d,%s).",filename,
+			naxis,buff);
+		return FALSE;
+	}
+	(*ncols) = (int)axes[0];
+	(*nrows) = (int)axes[1];
+	(*image_data) = (float *)malloc(((size_t)axes[0])*((size_t)axes[1])*sizeof(float));
+	if((*image_data) == NULL)
+	{
+		fits_close_file(fp,&status);
+		Moptop_General_Error_Number = 1221;
+		sprintf(Moptop_General_Error_String,"Calibrate_Fits_Read:Failed to allocate image data for '%s' (%ld x %ld).",
+			filename,axes[0],axes[1]);
+		return FALSE;
+	}
+	if(fits_read_img(fp,TFLOAT,1,axes[0]*axes[1],&nulval,(*image_data),&anynul,&status))
+	{
+		fits_get_errstatus(status,buff);
+		status = 0;
+		fits_close_file(fp,&status);
+		free((*image_data));
+		(*image_data) = NULL;
+		Moptop_General_Error_Number = 1222;
+		sprintf(Moptop_General_Error_String,"Calibrate_Fits_Read:Failed to read '%s' (%s).",filename,buff);
+		return FALSE;
+	}
+	if(fits_read_key(fp,TDOUBLE,"EXPTIME",exposure_length,NULL,&status))
+	{
+		(*exposure_length) = 0.0;
+		status = 0;
+	}
+	fits_close_file(fp,&status);
+	return TRUE;
+}
+
+/**
+ * Calibrate one row of a frame: output = (image - offset) * gain, or (image - offset) if there is no gain.
+ * The AVX2/FMA kernel is used if Calibrate_Data.Use_FMA is TRUE, and the scalar kernel does any remaining pixels.
+ * @param output_row The row of the calibrated frame to write, ncols floats.
+ * @param image_row The row of the frame, ncols unsigned shorts in host byte order.
+ * @param offset_row The row of the offset image, ncols floats.
+ * @param gain_row The row of the gain image, ncols floats, or NULL if there is no flat.
+ * @param ncols The number of pixels in the row.
+ * @see #Calibrate_Data
+ * @see #Calibrate_Apply_Row_Scalar
+ * @see #Calibrate_Apply_Row_FMA
+ */
+static void Calibrate_Apply_Row(float *output_row,unsigned short *image_row,float *offset_row,float *gain_row,
+				int ncols)
+{
+	int start = 0;
+
+#ifdef CALIBRATE_X86
+	if(Calibrate_Data.Use_FMA)
+		start = Calibrate_Apply_Row_FMA(output_row,image_row,offset_row,gain_row,ncols);
+#endif
+	Calibrate_Apply_Row_Scalar(output_row,image_row,offset_row,gain_row,start,ncols);
+}
+
+/**
+ * Scalar calibration kernel. See Calibrate_Apply_Row.
+ * @param output_row The row of the calibrated frame to write, ncols floats.
+ * @param image_row The row of the frame, ncols unsigned shorts in host byte order.
+ * @param offset_row The row of the offset image, ncols floats.
+ * @param gain_row The row of the gain image, ncols floats, or NULL if there is no flat.
+ * @param start The first pixel to calibrate (the pixels before this have been done by a SIMD kernel).
+ * @param ncols The number of pixels in the row.
+ * @return The number of pixels processed (ncols).
+ * @see #Calibrate_Apply_Row
+ */
+static int Calibrate_Apply_Row_Scalar(float *output_row,unsigned short *image_row,float *offset_row,
+				      float *gain_row,int start,int ncols)
+{
+	int i;
+
+	if(gain_row != NULL)
+	{
+		for(i = start; i < ncols; i++)
+			output_row[i] = (((float)image_row[i])-offset_row[i])*gain_row[i];
+	}
+	else
+	{
+		for(i = start; i < ncols; i++)
+			output_row[i] = ((float)image_row[i])-offset_row[i];
+	}
+	return ncols;
+}
+
+#ifdef CALIBRATE_X86
+/**
+ * AVX2/FMA calibration kernel, 8 pixels at a time: each 8 unsigned shorts are widened to 32 bit integers,
+ * converted to floats, and have the offset subtracted, and are multiplied by the gain (if there is a flat).
+ * See Calibrate_Apply_Row.
+ * @param output_row The row of the calibrated frame to write, ncols floats.
+ * @param image_row The row of the frame, ncols unsigned shorts in host byte order.
+ * @param offset_row The row of the offset image, ncols floats.
+ * @param gain_row The row of the gain image, ncols floats, or NULL if there is no flat.
+ * @param ncols The number of pixels in the row.
+ * @return The number of pixels processed (a multiple of 8), the rest must be done by Calibrate_Apply_Row_Scalar.
+ * @see #Calibrate_Apply_Row
+ */
+__attribute__((target("avx2,fma")))
+static int Calibrate_Apply_Row_FMA(float *output_row,unsigned short *image_row,float *offset_row,float *gain_row,
+				   int ncols)
+{
+	__m256 value,gain;
+	int i;
+
+	if(gain_row != NULL)
+	{
+		for(i = 0; (i+8) <= ncols; i += 8)
+		{
+			value = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_row+i))));
+			gain = _mm256_loadu_ps(gain_row+i);
+			/* (value - offset) * gain = value * gain - offset * gain */
+			_mm256_storeu_ps(output_row+i,_mm256_fmsub_ps(value,gain,
+						_mm256_mul_ps(_mm256_loadu_ps(offset_row+i),gain)));
+		}
+	}
+	else
+	{
+		for(i = 0; (i+8) <= ncols; i += 8)
+		{
+			value = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_row+i))));
+			_mm256_storeu_ps(output_row+i,_mm256_sub_ps(value,_mm256_loadu_ps(offset_row+i)));
+		}
+	}
+	return i;
+}
+#endif
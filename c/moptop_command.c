@@ -47,6 +47,9 @@
 #include "moptop_multrun.h"
 #include "moptop_general.h"
 #include "moptop_server.h"
+#include "moptop_statistics.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
 
 #include "pirot_command.h"
 #include "pirot_general.h"
@@ -87,7 +90,7 @@ static int Command_Parse_Date(char *time_string,int *time_secs);
  * <li>Otherwise we set the reply_string to a successful message.
  * </ul>
  * @param command_string The command. This is not changed during this routine.
- * @param reply_string The address of a pointer to allocate and set the reply string.
+ * @param reply_string The address of a Moptop_General_String_Struct to build the reply string in.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_general.html#Moptop_General_Log
  * @see moptop_general.html#Moptop_General_Error_Number
@@ -96,7 +99,7 @@ static int Command_Parse_Date(char *time_string,int *time_secs);
  * @see moptop_multrun.html#Moptop_Multrun_Abort
  * @see moptop_bias_dark.html#Moptop_Bias_Dark_Abort
  */
-int Moptop_Command_Abort(char *command_string,char **reply_string)
+int Moptop_Command_Abort(char *command_string,struct Moptop_General_String_Struct *reply_string)
 {
 	int multrun_abort_retval, bias_dark_abort_retval;
 #if MOPTOP_DEBUG > 1
@@ -143,10 +146,11 @@ int Moptop_Command_Abort(char *command_string,char **reply_string)
  * <ul>
  * <li>"config bin <bin>"
  * <li>"config filter <filtername>"
+ * <li>"config output <frame|cube|raw|stack>"
  * <li>"config rotorspeed <slow|fast>"
  * </ul>
  * @param command_string The command. This is not changed during this routine.
- * @param reply_string The address of a pointer to allocate and set the reply string.
+ * @param reply_string The address of a Moptop_General_String_Struct to build the reply string in.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_config.html#Moptop_Config_Rotator_Is_Enabled
  * @see moptop_config.html#Moptop_Config_Filter_Wheel_Is_Enabled
@@ -157,6 +161,7 @@ int Moptop_Command_Abort(char *command_string,char **reply_string)
  * @see moptop_general.html#Moptop_General_Add_Integer_To_String
  * @see moptop_multrun.html#Moptop_Multrun_Exposure_Length_Set
  * @see moptop_multrun.html#Moptop_Multrun_Filter_Name_Set
+ * @see moptop_multrun.html#Moptop_Multrun_Output_Mode_Set
  * @see moptop_multrun.html#Moptop_Multrun_Rotator_Speed_Set
  * @see moptop_multrun.html#Moptop_Multrun_Rotator_Run_Velocity_Set
  * @see moptop_multrun.html#Moptop_Multrun_Rotator_Step_Angle_Set
@@ -168,11 +173,12 @@ int Moptop_Command_Abort(char *command_string,char **reply_string)
  * @see ../pirot/cdocs/pirot_setup.html#PIROT_Setup_Rotator_Run_Velocity
  * @see ../pirot/cdocs/pirot_setup.html#PIROT_Setup_Trigger_Step_Angle
  */
-int Moptop_Command_Config(char *command_string,char **reply_string)
+int Moptop_Command_Config(char *command_string,struct Moptop_General_String_Struct *reply_string)
 {
 	int retval,bin,parameter_index,filter_position;
 	double camera_exposure_length;
 	char filter_string[32];
+	char output_mode_string[32];
 	char rotor_speed_string[32];
 	char sub_config_command_string[16];
 
@@ -339,6 +345,49 @@ int Moptop_Command_Config(char *command_string,char **reply_string)
 				return FALSE;
 		}
 	}
+	else if(strcmp(sub_config_command_string,"output") == 0)
+	{
+		retval = sscanf(command_string+parameter_index,"%31s",output_mode_string);
+		if(retval != 1)
+		{
+			Moptop_General_Error_Number = 549;
+			sprintf(Moptop_General_Error_String,"Moptop_Command_Config:"
+				"Failed to parse command %s (%d).",command_string,retval);
+			Moptop_General_Error("command","moptop_command.c","Moptop_Command_Config",
+					     LOG_VERBOSITY_TERSE,"COMMAND");
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log("command","moptop_command.c","Moptop_Command_Config",
+					   LOG_VERBOSITY_TERSE,"COMMAND","finished (command parse failed).");
+#endif
+			if(!Moptop_General_Add_String(reply_string,"1 Failed to parse config output command."))
+				return FALSE;
+			return TRUE;
+		}
+#if MOPTOP_DEBUG > 5
+		Moptop_General_Log_Format("command","moptop_command.c","Moptop_Command_Config",
+					  LOG_VERBOSITY_VERBOSE,"COMMAND","Setting multrun output mode to: %s.",
+					  output_mode_string);
+#endif
+		if(!Moptop_Multrun_Output_Mode_Set(output_mode_string))
+		{
+			Moptop_General_Error("command","moptop_command.c","Moptop_Command_Config",
+					     LOG_VERBOSITY_TERSE,"COMMAND");
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log_Format("command","moptop_command.c","Moptop_Command_Config",
+						  LOG_VERBOSITY_TERSE,"COMMAND",
+						  "finished (Failed to set multrun output mode to %s).",output_mode_string);
+#endif
+			if(!Moptop_General_Add_String(reply_string,"1 Failed to set multrun output mode:"))
+				return FALSE;
+			if(!Moptop_General_Add_String(reply_string,output_mode_string))
+				return FALSE;
+			return TRUE;
+		}
+		if(!Moptop_General_Add_String(reply_string,"0 Multrun output mode set to:"))
+			return FALSE;
+		if(!Moptop_General_Add_String(reply_string,output_mode_string))
+			return FALSE;
+	}
 	else if(strcmp(sub_config_command_string,"rotorspeed") == 0)
 	{
 		retval = sscanf(command_string+parameter_index,"%31s",rotor_speed_string);
@@ -497,7 +546,7 @@ int Moptop_Command_Config(char *command_string,char **reply_string)
 /**
  * Implementation of FITS Header commands.
  * @param command_string The command. This is not changed during this routine.
- * @param reply_string The address of a pointer to allocate and set the reply string.
+ * @param reply_string The address of a Moptop_General_String_Struct to build the reply string in.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_general.html#Moptop_General_Log
  * @see moptop_general.html#Moptop_General_Error_Number
@@ -510,7 +559,7 @@ int Moptop_Command_Config(char *command_string,char **reply_string)
  * @see moptop_fits_header.html#Moptop_Fits_Header_Clear
  * @see moptop_fits_header.html#Moptop_Fits_Header_Delete
  */
-int Moptop_Command_Fits_Header(char *command_string,char **reply_string)
+int Moptop_Command_Fits_Header(char *command_string,struct Moptop_General_String_Struct *reply_string)
 {
 	char operation_string[8];
 	char keyword_string[13];
@@ -785,7 +834,7 @@ int Moptop_Command_Fits_Header(char *command_string,char **reply_string)
  * <li>We free the returned filenames.
  * </ul>
  * @param command_string The command. This is not changed during this routine.
- * @param reply_string The address of a pointer to allocate and set the reply string.
+ * @param reply_string The address of a Moptop_General_String_Struct to build the reply string in.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_general.html#Moptop_General_Log
  * @see moptop_general.html#Moptop_General_Error_Number
@@ -795,13 +844,13 @@ int Moptop_Command_Fits_Header(char *command_string,char **reply_string)
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Multrun_Get
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_List_Free
  */
-int Moptop_Command_Multrun(char *command_string,char **reply_string)
+int Moptop_Command_Multrun(char *command_string,struct Moptop_General_String_Struct *reply_string)
 {
 	struct timespec start_time = {0L,0L};
 	char **filename_list = NULL;
 	char standard_string[8];
 	char count_string[16];
-	int i,retval,exposure_length,exposure_count,filename_count,do_standard,multrun_number;
+	int i,retval,exposure_length,exposure_count,filename_count = 0,do_standard,multrun_number;
 
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log("command","moptop_command.c","Moptop_Command_Multrun",LOG_VERBOSITY_TERSE,
@@ -851,6 +900,8 @@ int Moptop_Command_Multrun(char *command_string,char **reply_string)
 		Moptop_General_Log("command","moptop_command.c","Moptop_Command_Multrun",
 				   LOG_VERBOSITY_TERSE,"COMMAND","Multrun failed.");
 #endif
+		/* free any filenames acquired before the failure, so the filename arena is rewound */
+		CCD_Fits_Filename_List_Free(&filename_list,&filename_count);
 		if(!Moptop_General_Add_String(reply_string,"1 Multrun failed."))
 			return FALSE;
 		return TRUE;
@@ -922,7 +973,7 @@ int Moptop_Command_Multrun(char *command_string,char **reply_string)
  * Routine to implement the "multrun_setup" command. This is used to set everything up
  * the rotator is started.
  * @param command_string The command. This is not changed during this routine.
- * @param reply_string The address of a pointer to allocate and set the reply string.
+ * @param reply_string The address of a Moptop_General_String_Struct to build the reply string in.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_general.html#Moptop_General_Log
  * @see moptop_general.html#Moptop_General_Error_Number
@@ -931,7 +982,7 @@ int Moptop_Command_Multrun(char *command_string,char **reply_string)
  * @see moptop_general.html#Moptop_General_Add_Integer_To_String
  * @see moptop_multrun.html#Moptop_Multrun_Setup
  */
-int Moptop_Command_Multrun_Setup(char *command_string,char **reply_string)
+int Moptop_Command_Multrun_Setup(char *command_string,struct Moptop_General_String_Struct *reply_string)
 {
 	int retval,multrun_number;
 	
@@ -974,7 +1025,7 @@ int Moptop_Command_Multrun_Setup(char *command_string,char **reply_string)
  * <li>We free the returned filenames.
  * </ul>
  * @param command_string The command. This is not changed during this routine.
- * @param reply_string The address of a pointer to allocate and set the reply string.
+ * @param reply_string The address of a Moptop_General_String_Struct to build the reply string in.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_general.html#Moptop_General_Log
  * @see moptop_general.html#Moptop_General_Error_Number
@@ -984,11 +1035,11 @@ int Moptop_Command_Multrun_Setup(char *command_string,char **reply_string)
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Multrun_Get
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_List_Free
  */
-int Moptop_Command_MultBias(char *command_string,char **reply_string)
+int Moptop_Command_MultBias(char *command_string,struct Moptop_General_String_Struct *reply_string)
 {
 	char **filename_list = NULL;
 	char count_string[16];
-	int i,retval,exposure_count,filename_count,multrun_number;
+	int i,retval,exposure_count,filename_count = 0,multrun_number;
 
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log("command","moptop_command.c","Moptop_Command_MultBias",LOG_VERBOSITY_TERSE,
@@ -1021,6 +1072,8 @@ int Moptop_Command_MultBias(char *command_string,char **reply_string)
 		Moptop_General_Log("command","moptop_command.c","Moptop_Command_MultBias",
 				   LOG_VERBOSITY_TERSE,"COMMAND","MultBias failed.");
 #endif
+		/* free any filenames acquired before the failure, so the filename arena is rewound */
+		CCD_Fits_Filename_List_Free(&filename_list,&filename_count);
 		if(!Moptop_General_Add_String(reply_string,"1 MultBias failed."))
 			return FALSE;
 		return TRUE;
@@ -1098,7 +1151,7 @@ int Moptop_Command_MultBias(char *command_string,char **reply_string)
  * <li>We free the returned filenames.
  * </ul>
  * @param command_string The command. This is not changed during this routine.
- * @param reply_string The address of a pointer to allocate and set the reply string.
+ * @param reply_string The address of a Moptop_General_String_Struct to build the reply string in.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_bias_dark.html#Moptop_Bias_Dark_MultDark
  * @see moptop_general.html#Moptop_General_Log
@@ -1108,11 +1161,11 @@ int Moptop_Command_MultBias(char *command_string,char **reply_string)
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Multrun_Get
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_List_Free
  */
-int Moptop_Command_MultDark(char *command_string,char **reply_string)
+int Moptop_Command_MultDark(char *command_string,struct Moptop_General_String_Struct *reply_string)
 {
 	char **filename_list = NULL;
 	char count_string[16];
-	int i,retval,exposure_length,exposure_count,filename_count,multrun_number;
+	int i,retval,exposure_length,exposure_count,filename_count = 0,multrun_number;
 
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log("command","moptop_command.c","Moptop_Command_MultDark",LOG_VERBOSITY_TERSE,
@@ -1145,6 +1198,8 @@ int Moptop_Command_MultDark(char *command_string,char **reply_string)
 		Moptop_General_Log("command","moptop_command.c","Moptop_Command_MultDark",
 				   LOG_VERBOSITY_TERSE,"COMMAND","MultDark failed.");
 #endif
+		/* free any filenames acquired before the failure, so the filename arena is rewound */
+		CCD_Fits_Filename_List_Free(&filename_list,&filename_count);
 		if(!Moptop_General_Add_String(reply_string,"1 MultDark failed."))
 			return FALSE;
 		return TRUE;
@@ -1219,16 +1274,24 @@ int Moptop_Command_MultDark(char *command_string,char **reply_string)
  * <li>status filterwheel [filter|position|status]
  * <li>status rotator [position|speed|status]
  * <li>status exposure [status|count|length|start_time]
- * <li>status exposure [index|multrun|run|window]
+ * <li>status exposure [index|multrun|run|window|dropped|statistics]
  * <li>status fits_instrument_code
+ * <li>status writer [threads|queue_length|written|high_water|blocked_count|blocked_time|blocked_time_max|
+ *                     compression_ratio|compression_cpu_time|durability|sync_count|synced_files|sync_time|
+ *                     sync_time_max|staging|stage_size|stage_used|stage_occupancy|stage_high_water|stage_frames|
+ *                     stage_flushed|stage_blocked_count|stage_blocked_time]
+ * <li>status timing [multrun|biasdark] [&lt;type&gt;]
  * </ul>
  * <ul>
  * <li>The status command is parsed to retrieve the subsystem (1st parameter).
  * <li>Based on the subsystem, further parsing occurs.
  * <li>The relevant status is retrieved, and a suitable reply constructed.
  * </ul>
+ * "status timing" with no type returns a summary of all the timing histograms in the set 
+ * (Moptop_Timing_Summary_Get). With a type (e.g. grabber_wait), the count, p50, p95, p99 and max durations 
+ * (in seconds) of that type are returned.
  * @param command_string The command. This is not changed during this routine.
- * @param reply_string The address of a pointer to allocate and set the reply string.
+ * @param reply_string The address of a Moptop_General_String_Struct to build the reply string in.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_bias_dark.html#Moptop_Bias_Dark_In_Progress
  * @see moptop_bias_dark.html#Moptop_Bias_Dark_Count_Get
@@ -1253,6 +1316,18 @@ int Moptop_Command_MultDark(char *command_string,char **reply_string)
  * @see moptop_multrun.html#Moptop_Multrun_Multrun_Get
  * @see moptop_multrun.html#Moptop_Multrun_Run_Get
  * @see moptop_multrun.html#Moptop_Multrun_Window_Get
+ * @see moptop_multrun.html#Moptop_Multrun_Dropped_Frame_Count_Get
+ * @see moptop_statistics.html#Moptop_Statistics_Struct
+ * @see moptop_statistics.html#Moptop_Statistics_Latest_Get
+ * @see moptop_writer.html#Moptop_Writer_Statistics_Struct
+ * @see moptop_writer.html#Moptop_Writer_Statistics_Get
+ * @see moptop_writer.html#Moptop_Writer_Durability_To_String
+ * @see moptop_timing.html#MOPTOP_TIMING_SUMMARY_STRING_LENGTH
+ * @see moptop_timing.html#Moptop_Timing_Statistics_Struct
+ * @see moptop_timing.html#Moptop_Timing_Set_From_String
+ * @see moptop_timing.html#Moptop_Timing_Type_From_String
+ * @see moptop_timing.html#Moptop_Timing_Statistics_Get
+ * @see moptop_timing.html#Moptop_Timing_Summary_Get
  * @see ../ccd/cdocs/ccd_exposure.html#CCD_Exposure_Status_To_String
  * @see ../ccd/cdocs/ccd_exposure.html#CCD_EXPOSURE_TRIGGER_MODE
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Multrun_Get
@@ -1265,8 +1340,13 @@ int Moptop_Command_MultDark(char *command_string,char **reply_string)
  * @see ../filter_wheel/cdocs/filter_wheel_command.html#Filter_Wheel_Command_Get_Position
  * @see ../pirot/cdocs/pirot_command.html#PIROT_Command_Query_POS
  */
-int Moptop_Command_Status(char *command_string,char **reply_string)
+int Moptop_Command_Status(char *command_string,struct Moptop_General_String_Struct *reply_string)
 {
+	struct Moptop_Writer_Statistics_Struct writer_statistics;
+	struct Moptop_Timing_Statistics_Struct timing_statistics;
+	struct Moptop_Statistics_Struct frame_statistics;
+	enum MOPTOP_TIMING_SET timing_set;
+	enum MOPTOP_TIMING_TYPE timing_type;
 	struct timespec status_time;
 	char time_string[32];
 	char return_string[128];
@@ -1276,6 +1356,9 @@ int Moptop_Command_Status(char *command_string,char **reply_string)
 	char temperature_status_string[32];
 	char filter_name_string[32];
 	char rotator_speed_string[32];
+	char timing_set_string[16];
+	char timing_type_string[32];
+	char timing_summary_string[MOPTOP_TIMING_SUMMARY_STRING_LENGTH];
 	char instrument_code;
 	char *camera_name_string = NULL;
 	int retval,command_string_index,ivalue,filter_wheel_position,rotator_on_target;
@@ -1367,6 +1450,30 @@ int Moptop_Command_Status(char *command_string,char **reply_string)
 				ivalue = Moptop_Multrun_Window_Get();
 			sprintf(return_string+strlen(return_string),"%d",ivalue);
 		}
+		else if(strncmp(command_string+command_string_index,"dropped",7)==0)
+		{
+			if(Moptop_Bias_Dark_In_Progress())
+				ivalue = 0; /* bias/darks are not triggered by the rotator */
+			else
+				ivalue = Moptop_Multrun_Dropped_Frame_Count_Get();
+			sprintf(return_string+strlen(return_string),"%d",ivalue);
+		}
+		else if(strncmp(command_string+command_string_index,"statistics",10)==0)
+		{
+			/* the image statistics of the last multrun frame written:
+			** mean median standard_deviation minimum maximum saturated_count */
+			if(!Moptop_Statistics_Latest_Get(&frame_statistics))
+			{
+				Moptop_General_Error("command","moptop_command.c","Moptop_Command_Status",
+						     LOG_VERBOSITY_TERSE,"COMMAND");
+				if(!Moptop_General_Add_String(reply_string,"1 Failed to get frame statistics."))
+					return FALSE;
+				return TRUE;
+			}
+			sprintf(return_string+strlen(return_string),"%.3f %.1f %.3f %d %d %d",frame_statistics.Mean,
+				frame_statistics.Median,frame_statistics.Standard_Deviation,frame_statistics.Minimum,
+				frame_statistics.Maximum,frame_statistics.Saturated_Count);
+		}
 		else
 		{
 			Moptop_General_Error_Number = 512;
@@ -1662,6 +1769,214 @@ int Moptop_Command_Status(char *command_string,char **reply_string)
 			return TRUE;
 		}
 	}
+	else if(strncmp(subsystem_string,"writer",6) == 0)
+	{
+		if(!Moptop_Writer_Statistics_Get(&writer_statistics))
+		{
+			Moptop_General_Error("command","moptop_command.c","Moptop_Command_Status",
+					     LOG_VERBOSITY_TERSE,"COMMAND");
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log("command","moptop_command.c","Moptop_Command_Status",
+					   LOG_VERBOSITY_TERSE,"COMMAND","Failed to get writer statistics.");
+#endif
+			if(!Moptop_General_Add_String(reply_string,"1 Failed to get writer statistics."))
+				return FALSE;
+			return TRUE;
+		}
+		if(strncmp(command_string+command_string_index,"threads",7)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Thread_Count);
+		}
+		else if(strncmp(command_string+command_string_index,"queue_length",12)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Queue_Length);
+		}
+		else if(strncmp(command_string+command_string_index,"written",7)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Frames_Written);
+		}
+		else if(strncmp(command_string+command_string_index,"high_water",10)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Queue_High_Water);
+		}
+		else if(strncmp(command_string+command_string_index,"blocked_count",13)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Blocked_Count);
+		}
+		else if(strncmp(command_string+command_string_index,"blocked_time_max",16)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%.6f",writer_statistics.Blocked_Time_Max);
+		}
+		else if(strncmp(command_string+command_string_index,"blocked_time",12)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%.6f",writer_statistics.Blocked_Time);
+		}
+		else if(strncmp(command_string+command_string_index,"compression_ratio",17)==0)
+		{
+			if(writer_statistics.Compressed_Bytes > 0)
+			{
+				sprintf(return_string+strlen(return_string),"%.3f",
+					((double)writer_statistics.Uncompressed_Bytes)/
+					((double)writer_statistics.Compressed_Bytes));
+			}
+			else
+				strcat(return_string,"0");
+		}
+		else if(strncmp(command_string+command_string_index,"compression_cpu_time",20)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%.6f",writer_statistics.Compress_CPU_Time);
+		}
+		else if(strncmp(command_string+command_string_index,"durability",10)==0)
+		{
+			strcat(return_string,Moptop_Writer_Durability_To_String(writer_statistics.Durability));
+		}
+		else if(strncmp(command_string+command_string_index,"sync_count",10)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Sync_Count);
+		}
+		else if(strncmp(command_string+command_string_index,"synced_files",12)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Synced_File_Count);
+		}
+		else if(strncmp(command_string+command_string_index,"sync_time_max",13)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%.6f",writer_statistics.Sync_Time_Max);
+		}
+		else if(strncmp(command_string+command_string_index,"sync_time",9)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%.6f",writer_statistics.Sync_Time);
+		}
+		else if(strncmp(command_string+command_string_index,"staging",7)==0)
+		{
+			if(writer_statistics.Stage_Enable)
+				strcat(return_string,"true");
+			else
+				strcat(return_string,"false");
+		}
+		else if(strncmp(command_string+command_string_index,"stage_size",10)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%lld",writer_statistics.Stage_Size);
+		}
+		else if(strncmp(command_string+command_string_index,"stage_used",10)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%lld",writer_statistics.Stage_Used);
+		}
+		else if(strncmp(command_string+command_string_index,"stage_occupancy",15)==0)
+		{
+			if(writer_statistics.Stage_Size > 0)
+			{
+				sprintf(return_string+strlen(return_string),"%.2f",
+					(100.0*writer_statistics.Stage_Used)/((double)writer_statistics.Stage_Size));
+			}
+			else
+				strcat(return_string,"0.00");
+		}
+		else if(strncmp(command_string+command_string_index,"stage_high_water",16)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%lld",writer_statistics.Stage_Used_High_Water);
+		}
+		else if(strncmp(command_string+command_string_index,"stage_frames",12)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Stage_Frame_Count);
+		}
+		else if(strncmp(command_string+command_string_index,"stage_flushed",13)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Stage_Frames_Flushed);
+		}
+		else if(strncmp(command_string+command_string_index,"stage_blocked_count",19)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%d",writer_statistics.Stage_Blocked_Count);
+		}
+		else if(strncmp(command_string+command_string_index,"stage_blocked_time",18)==0)
+		{
+			sprintf(return_string+strlen(return_string),"%.6f",writer_statistics.Stage_Blocked_Time);
+		}
+		else
+		{
+			Moptop_General_Error_Number = 547;
+			sprintf(Moptop_General_Error_String,"Moptop_Command_Status:"
+				"Failed to parse writer command %s.",command_string+command_string_index);
+			Moptop_General_Error("command","moptop_command.c","Moptop_Command_Status",
+					     LOG_VERBOSITY_TERSE,"COMMAND");
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log_Format("command","moptop_command.c","Moptop_Command_Status",
+						  LOG_VERBOSITY_TERSE,"COMMAND",
+						  "Failed to parse writer command %s.",
+						  command_string+command_string_index);
+#endif
+			if(!Moptop_General_Add_String(reply_string,"1 Failed to parse status writer command."))
+				return FALSE;
+			return TRUE;
+		}
+	}
+	else if(strncmp(subsystem_string,"timing",6) == 0)
+	{
+		retval = sscanf(command_string+command_string_index,"%15s %31s",timing_set_string,timing_type_string);
+		if((retval != 1)&&(retval != 2))
+		{
+			Moptop_General_Error_Number = 548;
+			sprintf(Moptop_General_Error_String,"Moptop_Command_Status:"
+				"Failed to parse timing command %s (%d).",command_string+command_string_index,retval);
+			Moptop_General_Error("command","moptop_command.c","Moptop_Command_Status",
+					     LOG_VERBOSITY_TERSE,"COMMAND");
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log_Format("command","moptop_command.c","Moptop_Command_Status",
+						  LOG_VERBOSITY_TERSE,"COMMAND",
+						  "Failed to parse timing command %s.",
+						  command_string+command_string_index);
+#endif
+			if(!Moptop_General_Add_String(reply_string,"1 Failed to parse status timing command."))
+				return FALSE;
+			return TRUE;
+		}
+		if(!Moptop_Timing_Set_From_String(timing_set_string,&timing_set))
+		{
+			Moptop_General_Error("command","moptop_command.c","Moptop_Command_Status",
+					     LOG_VERBOSITY_TERSE,"COMMAND");
+			if(!Moptop_General_Add_String(reply_string,"1 Failed to parse status timing set."))
+				return FALSE;
+			return TRUE;
+		}
+		if(retval == 1)
+		{
+			/* summary of all timing types in the set. This is too long for return_string */
+			if(!Moptop_Timing_Summary_Get(timing_set,timing_summary_string,MOPTOP_TIMING_SUMMARY_STRING_LENGTH))
+			{
+				Moptop_General_Error("command","moptop_command.c","Moptop_Command_Status",
+						     LOG_VERBOSITY_TERSE,"COMMAND");
+				if(!Moptop_General_Add_String(reply_string,"1 Failed to get timing summary."))
+					return FALSE;
+				return TRUE;
+			}
+			if(!Moptop_General_Add_String(reply_string,return_string))
+				return FALSE;
+			if(!Moptop_General_Add_String(reply_string,timing_summary_string))
+				return FALSE;
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log("command","moptop_command.c","Moptop_Command_Status",LOG_VERBOSITY_TERSE,
+					   "COMMAND","finished.");
+#endif
+			return TRUE;
+		}
+		if(!Moptop_Timing_Type_From_String(timing_type_string,&timing_type))
+		{
+			Moptop_General_Error("command","moptop_command.c","Moptop_Command_Status",
+					     LOG_VERBOSITY_TERSE,"COMMAND");
+			if(!Moptop_General_Add_String(reply_string,"1 Failed to parse status timing type."))
+				return FALSE;
+			return TRUE;
+		}
+		if(!Moptop_Timing_Statistics_Get(timing_set,timing_type,&timing_statistics))
+		{
+			Moptop_General_Error("command","moptop_command.c","Moptop_Command_Status",
+					     LOG_VERBOSITY_TERSE,"COMMAND");
+			if(!Moptop_General_Add_String(reply_string,"1 Failed to get timing statistics."))
+				return FALSE;
+			return TRUE;
+		}
+		sprintf(return_string+strlen(return_string),"%d %.6f %.6f %.6f %.6f",timing_statistics.Count,
+			timing_statistics.P50,timing_statistics.P95,timing_statistics.P99,timing_statistics.Max);
+	}
 	else
 	{
 		Moptop_General_Error_Number = 516;
@@ -5,7 +5,9 @@
  * @author $Author$
  * @version $Revision$
  */
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -27,6 +29,13 @@
  * Revision control system identifier.
  */
 static char rcsid[] = "$Id$";
+/**
+ * Mutex used to serialise access to the FITS header list between the multrun/bias/dark writer threads,
+ * which each update the per-frame keywords and then write the list to their own FITS image.
+ * @see #Moptop_Fits_Header_Lock
+ * @see #Moptop_Fits_Header_Unlock
+ */
+static pthread_mutex_t Fits_Header_Mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 /* internal routines */
@@ -201,6 +210,395 @@ int Moptop_Fits_Header_Clear(void)
 	return TRUE;
 }
 
+/**
+ * Lock the FITS header list, so a writer thread can update the per-frame keywords and write them to a FITS image
+ * without another writer thread changing them in between.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Header_Mutex
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ */
+int Moptop_Fits_Header_Lock(void)
+{
+	return Moptop_General_Mutex_Lock(&Fits_Header_Mutex);
+}
+
+/**
+ * Unlock the FITS header list, previously locked with Moptop_Fits_Header_Lock.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Header_Mutex
+ * @see #Moptop_Fits_Header_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ */
+int Moptop_Fits_Header_Unlock(void)
+{
+	return Moptop_General_Mutex_Unlock(&Fits_Header_Mutex);
+}
+
+/**
+ * Create a FITS header template from the current FITS header list. The caller should hold the FITS header list lock
+ * (Moptop_Fits_Header_Lock), and should have already added all the per-frame (slot) keywords to the list (with
+ * any value), so they have a card image in the template to overwrite.
+ * <ul>
+ * <li>We format the FITS header list into card images using CCD_Fits_Header_To_Card_Images.
+ * <li>For each keyword in slot_keyword_list, we find the index of the card image with that keyword,
+ *     and store it in header_template->Slot_Index_List.
+ * </ul>
+ * @param header_template The address of the template to create.
+ * @param slot_keyword_list A list of the keywords (uppercase) whose values change every frame.
+ * @param slot_count The number of keywords in slot_keyword_list.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX
+ * @see #MOPTOP_FITS_HEADER_TEMPLATE_SLOT_COUNT_MAX
+ * @see #Moptop_Fits_Header_Template_Struct
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_To_Card_Images
+ */
+int Moptop_Fits_Header_Template_Create(struct Moptop_Fits_Header_Template_Struct *header_template,
+				       char **slot_keyword_list,int slot_count)
+{
+	char keyword_field[16];
+	int slot,index,found;
+
+	if(header_template == NULL)
+	{
+		Moptop_General_Error_Number = 409;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Create:header_template was NULL.");
+		return FALSE;
+	}
+	if((slot_keyword_list == NULL)||(slot_count < 0)||(slot_count > MOPTOP_FITS_HEADER_TEMPLATE_SLOT_COUNT_MAX))
+	{
+		Moptop_General_Error_Number = 410;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Create:Illegal slot list (%d).",
+			slot_count);
+		return FALSE;
+	}
+	if(!CCD_Fits_Header_To_Card_Images(header_template->Card_Image_List,MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX,
+					   &(header_template->Card_Count)))
+	{
+		Moptop_General_Error_Number = 411;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Create:"
+			"Failed to format FITS header card images.");
+		return FALSE;
+	}
+	for(slot = 0; slot < slot_count; slot++)
+	{
+		if(strlen(slot_keyword_list[slot]) > 8)
+		{
+			Moptop_General_Error_Number = 412;
+			sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Create:"
+				"Slot keyword '%s' too long.",slot_keyword_list[slot]);
+			return FALSE;
+		}
+		strcpy(header_template->Slot_Keyword_List[slot],slot_keyword_list[slot]);
+		/* the keyword is in columns 1-8 of the card image, space padded */
+		sprintf(keyword_field,"%-8s",slot_keyword_list[slot]);
+		found = FALSE;
+		for(index = 0; (index < header_template->Card_Count) && (found == FALSE); index++)
+		{
+			if(strncmp(header_template->Card_Image_List+(index*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+				   keyword_field,8) == 0)
+			{
+				header_template->Slot_Index_List[slot] = index;
+				found = TRUE;
+			}
+		}
+		if(found == FALSE)
+		{
+			Moptop_General_Error_Number = 413;
+			sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Create:"
+				"Slot keyword '%s' not found in %d cards.",slot_keyword_list[slot],
+				header_template->Card_Count);
+			return FALSE;
+		}
+	}
+	header_template->Slot_Count = slot_count;
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("fits_header","moptop_fits_header.c","Moptop_Fits_Header_Template_Create",
+				  LOG_VERBOSITY_VERBOSE,"FITS","Created template with %d cards and %d slots.",
+				  header_template->Card_Count,header_template->Slot_Count);
+#endif
+	return TRUE;
+}
+
+/**
+ * Copy the card images in a FITS header template into a per-frame card image list, ready for the slot
+ * card images to be overwritten with this frame's values. 
+ * @param header_template The address of the template to copy.
+ * @param card_image_list A buffer of (at least) MOPTOP_FITS_HEADER_TEMPLATE_LENGTH characters to copy the
+ *        card images into.
+ * @see #MOPTOP_FITS_HEADER_TEMPLATE_LENGTH
+ * @see #Moptop_Fits_Header_Template_Struct
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+void Moptop_Fits_Header_Template_Copy(struct Moptop_Fits_Header_Template_Struct *header_template,
+				      char *card_image_list)
+{
+	memcpy(card_image_list,header_template->Card_Image_List,
+	       header_template->Card_Count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+}
+
+/**
+ * Overwrite a slot card image in a per-frame copy of a FITS header template with a new string value.
+ * @param header_template The address of the template card_image_list was copied from.
+ * @param card_image_list The per-frame copy of the template's card images.
+ * @param slot Which slot (index into the slot_keyword_list passed to Moptop_Fits_Header_Template_Create) to set.
+ * @param value The new value.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Moptop_Fits_Header_Template_Struct
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_String_Set
+ */
+int Moptop_Fits_Header_Template_String_Set(struct Moptop_Fits_Header_Template_Struct *header_template,
+					   char *card_image_list,int slot,char *value)
+{
+	if((slot < 0)||(slot >= header_template->Slot_Count))
+	{
+		Moptop_General_Error_Number = 414;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_String_Set:Illegal slot %d.",slot);
+		return FALSE;
+	}
+	if(!CCD_Fits_Header_Card_Image_String_Set(card_image_list+
+						  (header_template->Slot_Index_List[slot]*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						  header_template->Slot_Keyword_List[slot],value))
+	{
+		Moptop_General_Error_Number = 415;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_String_Set:"
+			"Failed to set card %s to '%s'.",header_template->Slot_Keyword_List[slot],value);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Overwrite a slot card image in a per-frame copy of a FITS header template with a new integer value.
+ * @param header_template The address of the template card_image_list was copied from.
+ * @param card_image_list The per-frame copy of the template's card images.
+ * @param slot Which slot (index into the slot_keyword_list passed to Moptop_Fits_Header_Template_Create) to set.
+ * @param value The new value.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Moptop_Fits_Header_Template_Struct
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Int_Set
+ */
+int Moptop_Fits_Header_Template_Integer_Set(struct Moptop_Fits_Header_Template_Struct *header_template,
+					    char *card_image_list,int slot,int value)
+{
+	if((slot < 0)||(slot >= header_template->Slot_Count))
+	{
+		Moptop_General_Error_Number = 416;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Integer_Set:Illegal slot %d.",slot);
+		return FALSE;
+	}
+	if(!CCD_Fits_Header_Card_Image_Int_Set(card_image_list+
+					       (header_template->Slot_Index_List[slot]*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+					       header_template->Slot_Keyword_List[slot],value))
+	{
+		Moptop_General_Error_Number = 417;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Integer_Set:"
+			"Failed to set card %s to %d.",header_template->Slot_Keyword_List[slot],value);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Overwrite a slot card image in a per-frame copy of a FITS header template with a new float (double) value.
+ * @param header_template The address of the template card_image_list was copied from.
+ * @param card_image_list The per-frame copy of the template's card images.
+ * @param slot Which slot (index into the slot_keyword_list passed to Moptop_Fits_Header_Template_Create) to set.
+ * @param value The new value.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Moptop_Fits_Header_Template_Struct
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Float_Set
+ */
+int Moptop_Fits_Header_Template_Float_Set(struct Moptop_Fits_Header_Template_Struct *header_template,
+					  char *card_image_list,int slot,double value)
+{
+	if((slot < 0)||(slot >= header_template->Slot_Count))
+	{
+		Moptop_General_Error_Number = 418;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Float_Set:Illegal slot %d.",slot);
+		return FALSE;
+	}
+	if(!CCD_Fits_Header_Card_Image_Float_Set(card_image_list+
+						 (header_template->Slot_Index_List[slot]*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						 header_template->Slot_Keyword_List[slot],value))
+	{
+		Moptop_General_Error_Number = 419;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Float_Set:"
+			"Failed to set card %s to %.6f.",header_template->Slot_Keyword_List[slot],value);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Multiply the value of a (non-slot) float card in a FITS header template by a scale factor. This is used to
+ * adjust values that depend on the multrun configuration (for instance CCDSCALE by the binning) once per template,
+ * rather than in every FITS image.
+ * <ul>
+ * <li>We search the template's card images for one with the specified keyword in columns 1-8.
+ * <li>We parse the value from columns 11 onwards using strtod.
+ * <li>We multiply the value by scale, and overwrite the card image with the new value using 
+ *     CCD_Fits_Header_Card_Image_Float_Set.
+ * </ul>
+ * @param header_template The address of the template to modify.
+ * @param keyword The keyword (uppercase) of the card to modify.
+ * @param scale The amount to multiply the value by.
+ * @return The routine returns TRUE on success, and FALSE on failure (including if the keyword is not in the template).
+ * @see #Moptop_Fits_Header_Template_Struct
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Float_Set
+ */
+int Moptop_Fits_Header_Template_Float_Scale(struct Moptop_Fits_Header_Template_Struct *header_template,
+					    char *keyword,double scale)
+{
+	char keyword_field[16];
+	char value_string[CCD_FITS_HEADER_CARD_IMAGE_LENGTH];
+	char *card_image = NULL;
+	char *end_ptr = NULL;
+	double value;
+	int index;
+
+	if((keyword == NULL)||(strlen(keyword) > 8))
+	{
+		Moptop_General_Error_Number = 421;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Float_Scale:Illegal keyword.");
+		return FALSE;
+	}
+	/* the keyword is in columns 1-8 of the card image, space padded */
+	sprintf(keyword_field,"%-8s",keyword);
+	for(index = 0; index < header_template->Card_Count; index++)
+	{
+		if(strncmp(header_template->Card_Image_List+(index*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+			   keyword_field,8) == 0)
+		{
+			card_image = header_template->Card_Image_List+(index*CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+			break;
+		}
+	}
+	if(card_image == NULL)
+	{
+		Moptop_General_Error_Number = 422;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Float_Scale:"
+			"Keyword '%s' not found in %d cards.",keyword,header_template->Card_Count);
+		return FALSE;
+	}
+	/* the value starts in column 11, after '= ' */
+	strncpy(value_string,card_image+10,CCD_FITS_HEADER_CARD_IMAGE_LENGTH-10);
+	value_string[CCD_FITS_HEADER_CARD_IMAGE_LENGTH-10] = '\0';
+	value = strtod(value_string,&end_ptr);
+	if(end_ptr == value_string)
+	{
+		Moptop_General_Error_Number = 423;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Float_Scale:"
+			"Failed to parse value of '%s' from '%s'.",keyword,value_string);
+		return FALSE;
+	}
+	value *= scale;
+	if(!CCD_Fits_Header_Card_Image_Float_Set(card_image,keyword,value))
+	{
+		Moptop_General_Error_Number = 424;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Float_Scale:"
+			"Failed to set card %s to %.6f.",keyword,value);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Set the value of a (non-slot) float card in a per-frame copy of a FITS header template's card images.
+ * This is used for the occasional image whose value of a keyword differs from the rest of the multrun (for instance
+ * EXPTIME in a stacked frame), where the keyword is not worth making a slot.
+ * <ul>
+ * <li>We search the template's card images for one with the specified keyword in columns 1-8.
+ * <li>We overwrite the card image at the same index in card_image_list with the new value using 
+ *     CCD_Fits_Header_Card_Image_Float_Set.
+ * </ul>
+ * @param header_template The address of the template card_image_list was copied from.
+ * @param card_image_list The per-frame copy of the template's card images to modify.
+ * @param keyword The keyword (uppercase) of the card to modify.
+ * @param value The value to set.
+ * @return The routine returns TRUE on success, and FALSE on failure (including if the keyword is not in the template).
+ * @see #Moptop_Fits_Header_Template_Struct
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Float_Set
+ */
+int Moptop_Fits_Header_Template_Keyword_Float_Set(struct Moptop_Fits_Header_Template_Struct *header_template,
+						  char *card_image_list,char *keyword,double value)
+{
+	char keyword_field[16];
+	int index;
+
+	if((keyword == NULL)||(strlen(keyword) > 8))
+	{
+		Moptop_General_Error_Number = 425;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Keyword_Float_Set:Illegal keyword.");
+		return FALSE;
+	}
+	/* the keyword is in columns 1-8 of the card image, space padded */
+	sprintf(keyword_field,"%-8s",keyword);
+	for(index = 0; index < header_template->Card_Count; index++)
+	{
+		if(strncmp(header_template->Card_Image_List+(index*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+			   keyword_field,8) == 0)
+			break;
+	}
+	if(index == header_template->Card_Count)
+	{
+		Moptop_General_Error_Number = 426;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Keyword_Float_Set:"
+			"Keyword '%s' not found in %d cards.",keyword,header_template->Card_Count);
+		return FALSE;
+	}
+	if(!CCD_Fits_Header_Card_Image_Float_Set(card_image_list+(index*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),keyword,
+						 value))
+	{
+		Moptop_General_Error_Number = 427;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Keyword_Float_Set:"
+			"Failed to set card %s to %.6f.",keyword,value);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Write a per-frame copy of a FITS header template's card images to a FITS file.
+ * @param header_template The address of the template card_image_list was copied from.
+ * @param card_image_list The per-frame copy of the template's card images, with the slots updated for this frame.
+ * @param fits_fp A previously created CFITSIO file pointer to write the headers into.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Moptop_Fits_Header_Template_Struct
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Images_Write_To_Fits
+ */
+int Moptop_Fits_Header_Template_Write_To_Fits(struct Moptop_Fits_Header_Template_Struct *header_template,
+					      char *card_image_list,fitsfile *fits_fp)
+{
+	if(!CCD_Fits_Header_Card_Images_Write_To_Fits(fits_fp,card_image_list,header_template->Card_Count))
+	{
+		Moptop_General_Error_Number = 420;
+		sprintf(Moptop_General_Error_String,"Moptop_Fits_Header_Template_Write_To_Fits:"
+			"Failed to write %d card images.",header_template->Card_Count);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 /**
  * Routine to convert a timespec structure to a DATE sytle string to put into a FITS header.
  * This uses gmtime_r and strftime to format the string. The resultant string is of the form:
@@ -264,6 +662,47 @@ void Moptop_Fits_Header_TimeSpec_To_UtStart_String(struct timespec time,char *ti
 	sprintf(time_string,"%s%03d",buff,milliseconds);
 }
 
+/**
+ * Routine to convert a timespec structure to DATE, DATE-OBS and UTSTART style strings to put into a FITS header.
+ * This produces the same strings as Moptop_Fits_Header_TimeSpec_To_Date_String, 
+ * Moptop_Fits_Header_TimeSpec_To_Date_Obs_String and Moptop_Fits_Header_TimeSpec_To_UtStart_String, but only
+ * calls gmtime_r once, and formats the strings directly from the broken down time.
+ * @param time The time to convert.
+ * @param date_string The string to put the DATE (<b>CCYY-MM-DD</b>) representation in, or NULL. 
+ *        The string must be at least 12 characters long.
+ * @param date_obs_string The string to put the DATE-OBS (<b>CCYY-MM-DDTHH:MM:SS.sss</b>) representation in, or NULL. 
+ *        The string must be at least 24 characters long.
+ * @param utstart_string The string to put the UTSTART (<b>HH:MM:SS.sss</b>) representation in, or NULL. 
+ *        The string must be at least 14 characters long.
+ * @see #Moptop_Fits_Header_TimeSpec_To_Date_String
+ * @see #Moptop_Fits_Header_TimeSpec_To_Date_Obs_String
+ * @see #Moptop_Fits_Header_TimeSpec_To_UtStart_String
+ * @see moptop_general.html#MOPTOP_GENERAL_ONE_MILLISECOND_NS
+ */
+void Moptop_Fits_Header_TimeSpec_To_Strings(struct timespec time,char *date_string,char *date_obs_string,
+					    char *utstart_string)
+{
+	struct tm tm_time;
+	int milliseconds;
+
+	gmtime_r(&(time.tv_sec),&tm_time);
+	milliseconds = (((double)time.tv_nsec)/((double)MOPTOP_GENERAL_ONE_MILLISECOND_NS));
+	if(date_string != NULL)
+	{
+		sprintf(date_string,"%04d-%02d-%02d",tm_time.tm_year+1900,tm_time.tm_mon+1,tm_time.tm_mday);
+	}
+	if(date_obs_string != NULL)
+	{
+		sprintf(date_obs_string,"%04d-%02d-%02dT%02d:%02d:%02d.%03d",tm_time.tm_year+1900,tm_time.tm_mon+1,
+			tm_time.tm_mday,tm_time.tm_hour,tm_time.tm_min,tm_time.tm_sec,milliseconds);
+	}
+	if(utstart_string != NULL)
+	{
+		sprintf(utstart_string,"%02d:%02d:%02d.%03d",tm_time.tm_hour,tm_time.tm_min,tm_time.tm_sec,
+			milliseconds);
+	}
+}
+
 /**
  * Routine to convert a timespec structure to a Modified Julian Date (decimal days) to put into a FITS header.
  * <p>If NGATASTRO is defined, this uses NGAT_Astro_Timespec_To_MJD to get the MJD.
@@ -58,17 +58,23 @@ typedef void (*Log_Handler_Function)(char *sub_system,char *source_filename,char
  * Number of log handlers in the log handler list.
  */
 #define LOG_HANDLER_LIST_COUNT                  (5)
+/**
+ * The minimum length allocated for a string built by Moptop_General_Add_String.
+ * @see #Moptop_General_Add_String
+ */
+#define GENERAL_STRING_MIN_LENGTH               (128)
 
 /* external variables */
 /**
- * Variable holding error code of last operation performed.
+ * Variable holding error code of last operation performed. Each thread has it's own copy, so the writer threads
+ * (which write frames at the same time) don't overwrite each other's errors.
  */
-int Moptop_General_Error_Number = 0;
+__thread int Moptop_General_Error_Number = 0;
 /**
- * Internal variable holding description of the last error that occured.
+ * Internal variable holding description of the last error that occured, in this thread.
  * @see #MOPTOP_GENERAL_ERROR_STRING_LENGTH
  */
-char Moptop_General_Error_String[MOPTOP_GENERAL_ERROR_STRING_LENGTH] = "";
+__thread char Moptop_General_Error_String[MOPTOP_GENERAL_ERROR_STRING_LENGTH] = "";
 
 /* data types */
 /**
@@ -803,16 +809,25 @@ int Moptop_General_Log_Filter_Level_Bitwise(char *sub_system,char *source_filena
 }
 
 /**
- * Utility function to add a string to an allocated string.
- * @param string The address of a pointer to a string. If a new string, the pointer should have
- *             been initialised to NULL.
+ * Utility function to add a string to a string being built up (e.g. a reply string). The string's length and
+ * allocated length are kept in the Moptop_General_String_Struct, so add is copied to the known end of the string
+ * (rather than using strcat), and the string is only reallocated when it is full, doubling it's allocated length
+ * (starting at GENERAL_STRING_MIN_LENGTH). Building a long string is therefore not quadratic.
+ * @param string The address of a Moptop_General_String_Struct. If a new string, it should have been initialised
+ *             to {NULL,0,0}. The string should only have been modified by this routine, and should be freed
+ *             with Moptop_General_String_Free.
  * @param add A non-null string to apend to the current contents of string.
  * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #GENERAL_STRING_MIN_LENGTH
  * @see #Moptop_General_Error_Number
  * @see #Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_String_Struct
  */
-int Moptop_General_Add_String(char **string,char *add)
+int Moptop_General_Add_String(struct Moptop_General_String_Struct *string,char *add)
 {
+	char *new_string = NULL;
+	size_t add_length,allocated_length;
+
 	if(string == NULL)
 	{
 		Moptop_General_Error_Number = 100;
@@ -822,34 +837,40 @@ int Moptop_General_Add_String(char **string,char *add)
 	}
 	if(add == NULL)
 		return TRUE;
-	if((*string) == NULL)
+	add_length = strlen(add);
+	if((string->String == NULL)||((string->Length+add_length+1) > string->Allocated))
 	{
-		(*string) = (char*)malloc((strlen(add)+1)*sizeof(char));
-		if((*string) != NULL)
-			(*string)[0] = '\0';
-	}
-	else
-		(*string) = (char*)realloc((*string),(strlen((*string))+strlen(add)+1)*sizeof(char));
-	if((*string) == NULL)
-	{
-		Moptop_General_Error_Number = 101;
-		sprintf(Moptop_General_Error_String,"Moptop_General_Add_String:Memory allocation error (%s).",add);
-		return FALSE;
+		if(string->String == NULL)
+			string->Length = 0;
+		allocated_length = MAX(string->Allocated,GENERAL_STRING_MIN_LENGTH);
+		while(allocated_length < (string->Length+add_length+1))
+			allocated_length *= 2;
+		new_string = (char*)realloc(string->String,allocated_length*sizeof(char));
+		if(new_string == NULL)
+		{
+			Moptop_General_Error_Number = 101;
+			sprintf(Moptop_General_Error_String,"Moptop_General_Add_String:Memory allocation error (%s).",
+				add);
+			return FALSE;
+		}
+		string->String = new_string;
+		string->Allocated = allocated_length;
 	}
-	strcat((*string),add);
+	memcpy(string->String+string->Length,add,add_length+1);
+	string->Length += add_length;
 	return TRUE;
 }
 
 /**
- * Utility function to add a string representation of an integer to an allocated string.
- * @param string The address of a pointer to a string. If a new string, the pointer should have
- *             been initialised to NULL.
+ * Utility function to add a string representation of an integer to a string being built up.
+ * @param string The address of a Moptop_General_String_Struct. If a new string, it should have
+ *             been initialised to {NULL,0,0}.
  * @param i The integer to convert into a string and add to the string parameter.
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see #Moptop_General_Error_Number
  * @see #Moptop_General_Error_String
  */
-int Moptop_General_Add_Integer_To_String(char **string,int i)
+int Moptop_General_Add_Integer_To_String(struct Moptop_General_String_Struct *string,int i)
 {
 	int retval;
 	char integer_buff[32];
@@ -865,6 +886,23 @@ int Moptop_General_Add_Integer_To_String(char **string,int i)
 	return Moptop_General_Add_String(string,integer_buff);
 }
 
+/**
+ * Free a string built up by Moptop_General_Add_String, and reset it to an empty string ({NULL,0,0}),
+ * so it can be reused.
+ * @param string The address of a Moptop_General_String_Struct. Can be NULL.
+ * @see moptop_general.html#Moptop_General_String_Struct
+ */
+void Moptop_General_String_Free(struct Moptop_General_String_Struct *string)
+{
+	if(string == NULL)
+		return;
+	if(string->String != NULL)
+		free(string->String);
+	string->String = NULL;
+	string->Length = 0;
+	string->Allocated = 0;
+}
+
 /**
  * Add an integer to a list of integers.
  * @param add The integer value to add.
@@ -911,6 +949,54 @@ int Moptop_General_Int_List_Sort(const void *f,const void *s)
 	return (*(int*)f) - (*(int*)s);
 }
 
+/**
+ * Flip a plane of floats in place in the X and/or Y directions. This is used to put the reduced, master and 
+ * calibration planes (which are built in camera orientation) into the same orientation as the multrun frames
+ * (see Moptop_Multrun_Flip_X / Moptop_Multrun_Flip_Y), or back again.
+ * @param plane The plane, of ncols x nrows floats.
+ * @param ncols The number of columns in the plane.
+ * @param nrows The number of rows in the plane.
+ * @param flip_x A boolean, if TRUE the plane is flipped in X.
+ * @param flip_y A boolean, if TRUE the plane is flipped in Y.
+ * @see moptop_multrun.html#Moptop_Multrun_Flip_X
+ * @see moptop_multrun.html#Moptop_Multrun_Flip_Y
+ */
+void Moptop_General_Float_Plane_Flip(float *plane,int ncols,int nrows,int flip_x,int flip_y)
+{
+	float *row_a = NULL;
+	float *row_b = NULL;
+	float value;
+	int x,y;
+
+	if(flip_x)
+	{
+		for(y = 0; y < nrows; y++)
+		{
+			row_a = plane+(((size_t)y)*ncols);
+			for(x = 0; x < (ncols/2); x++)
+			{
+				value = row_a[x];
+				row_a[x] = row_a[ncols-(x+1)];
+				row_a[ncols-(x+1)] = value;
+			}
+		}
+	}
+	if(flip_y)
+	{
+		for(y = 0; y < (nrows/2); y++)
+		{
+			row_a = plane+(((size_t)y)*ncols);
+			row_b = plane+(((size_t)(nrows-(y+1)))*ncols);
+			for(x = 0; x < ncols; x++)
+			{
+				value = row_a[x];
+				row_a[x] = row_b[x];
+				row_b[x] = value;
+			}
+		}
+	}
+}
+
 /**
  * Routine to lock a access mutex. This will block until the mutex has been acquired,
  * unless an error occurs.
@@ -16,6 +16,7 @@
 
 #include "ccd_buffer.h"
 #include "ccd_fits_filename.h"
+#include "ccd_fits_image.h"
 #include "ccd_general.h"
 #include "ccd_setup.h"
 #include "ccd_temperature.h"
@@ -472,6 +473,14 @@ static void Moptop_Shutdown_Mechanisms(void)
  * <li>We call Moptop_Config_Get_String to get the data directory to store generated FITS images in using the
  *     property keyword: "file.fits.path".
  * <li>We call CCD_Fits_Filename_Initialise to initialise FITS filename data and find the current MULTRUN number.
+ * <li>We call Moptop_Config_Get_String to get how finished FITS images are published to the data transfer 
+ *     processes using the property keyword: "file.fits.publish.mode". This is either "lock" (create and remove 
+ *     a '.lock' file for each FITS image) or "rename" (write each FITS image to a hidden temporary filename and 
+ *     rename it once complete). We set the publish mode using CCD_Fits_Filename_Publish_Mode_Set.
+ * <li>We call Moptop_Config_Get_String to get which system call interface the native FITS writer uses, using the 
+ *     property keyword: "file.fits.io.backend". This is either "pwrite" or "io_uring". We set the backend using 
+ *     CCD_Fits_Image_Io_Backend_Set. If the io_uring backend cannot be used (the CCD library was built without it,
+ *     or the kernel does not support it), we log the reason and carry on using the pwrite backend.
  * <li>We call CCD_Fits_Header_Initialise to initialise FITS header data.
  * </ul>
  * @return The routine returns TRUE on success and FALSE on failure.
@@ -486,7 +495,9 @@ static void Moptop_Shutdown_Mechanisms(void)
  * @see moptop_general.html#Moptop_General_Log_Format
  * @see ../ccd/cdocs/ccd_buffer.html#CCD_Buffer_Initialise
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Initialise
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Mode_Set
  * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Initialise
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Io_Backend_Set
  * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Set_Board
  * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Set_Camera_Setup
  * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Set_Timestamp_Mode
@@ -496,10 +507,13 @@ static void Moptop_Shutdown_Mechanisms(void)
 static int Moptop_Startup_CCD(void)
 {
 	enum CCD_COMMAND_SETUP_FLAG camera_setup_flag;
-	int enabled,board_number,timestamp_mode,test_serial_number,camera_serial_number;
+	int enabled,board_number,timestamp_mode,test_serial_number,camera_serial_number,retval;
 	char instrument_code;
 	char* camera_setup_flag_string = NULL;
 	char* data_dir = NULL;
+	char* publish_mode_string = NULL;
+	char* io_backend_string = NULL;
+	char error_string[CCD_GENERAL_ERROR_STRING_LENGTH];
 
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log("main","moptop_main.c","Moptop_Startup_CCD",LOG_VERBOSITY_TERSE,"STARTUP","Started.");
@@ -625,6 +639,64 @@ static int Moptop_Startup_CCD(void)
 	/* free allocated data */
 	if(data_dir != NULL)
 		free(data_dir);
+	/* how to publish finished FITS images to the data transfer processes */
+	if(!Moptop_Config_Get_String("file.fits.publish.mode",&publish_mode_string))
+		return FALSE;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("main","moptop_main.c","Moptop_Startup_CCD",LOG_VERBOSITY_TERSE,"STARTUP",
+				  "Using FITS publish mode '%s'.",publish_mode_string);
+#endif
+	if(strcmp(publish_mode_string,"lock") == 0)
+		retval = CCD_Fits_Filename_Publish_Mode_Set(CCD_FITS_FILENAME_PUBLISH_MODE_LOCK);
+	else if(strcmp(publish_mode_string,"rename") == 0)
+		retval = CCD_Fits_Filename_Publish_Mode_Set(CCD_FITS_FILENAME_PUBLISH_MODE_RENAME);
+	else
+	{
+		Moptop_General_Error_Number = 36;
+		sprintf(Moptop_General_Error_String,"Moptop_Startup_CCD:Illegal FITS publish mode '%s'.",
+			publish_mode_string);
+		free(publish_mode_string);
+		return FALSE;
+	}
+	free(publish_mode_string);
+	if(retval == FALSE)
+	{
+		Moptop_General_Error_Number = 37;
+		sprintf(Moptop_General_Error_String,"Moptop_Startup_CCD:CCD_Fits_Filename_Publish_Mode_Set failed.");
+		return FALSE;
+	}
+	/* which system call interface the native FITS writer uses */
+	if(!Moptop_Config_Get_String("file.fits.io.backend",&io_backend_string))
+		return FALSE;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("main","moptop_main.c","Moptop_Startup_CCD",LOG_VERBOSITY_TERSE,"STARTUP",
+				  "Using FITS I/O backend '%s'.",io_backend_string);
+#endif
+	if(strcmp(io_backend_string,"pwrite") == 0)
+		retval = CCD_Fits_Image_Io_Backend_Set(CCD_FITS_IMAGE_IO_BACKEND_PWRITE);
+	else if(strcmp(io_backend_string,"io_uring") == 0)
+		retval = CCD_Fits_Image_Io_Backend_Set(CCD_FITS_IMAGE_IO_BACKEND_IO_URING);
+	else
+	{
+		Moptop_General_Error_Number = 38;
+		sprintf(Moptop_General_Error_String,"Moptop_Startup_CCD:Illegal FITS I/O backend '%s'.",
+			io_backend_string);
+		free(io_backend_string);
+		return FALSE;
+	}
+	free(io_backend_string);
+	/* io_uring is optional (library build / kernel version), fall back to the pwrite backend */
+	if(retval == FALSE)
+	{
+		error_string[0] = '\0';
+		CCD_Fits_Image_Error_String(error_string);
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log_Format("main","moptop_main.c","Moptop_Startup_CCD",LOG_VERBOSITY_TERSE,"STARTUP",
+					  "Failed to set FITS I/O backend, using %s:%s",
+					  CCD_Fits_Image_Io_Backend_To_String(CCD_Fits_Image_Io_Backend_Get()),
+					  error_string);
+#endif
+	}
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log("main","moptop_main.c","Moptop_Startup_CCD",LOG_VERBOSITY_TERSE,"STARTUP",
 			   "Calling CCD_Fits_Header_Initialise.");
@@ -648,10 +720,13 @@ static int Moptop_Startup_CCD(void)
  * <li>If it is _not_ enabled, log and return success.
  * <li>Call CCD_Setup_Shutdown to shutdown the connection to the CCD.
  * <li>Call CCD_Buffer_Free to free the image buffer memory.
+ * <li>Call CCD_Fits_Image_Io_Backend_Set to go back to the pwrite FITS I/O backend, which stops the io_uring thread
+ *     (if it was started).
  * </ul>
  * @return The routine returns TRUE on success and FALSE on failure.
  * @see moptop_config.html#Moptop_Config_Get_Boolean
  * @see ../ccd/cdocs/ccd_buffer.html#CCD_Buffer_Free
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Io_Backend_Set
  * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Shutdown
  */
 static int Moptop_Shutdown_CCD(void)
@@ -699,6 +774,13 @@ static int Moptop_Shutdown_CCD(void)
 		sprintf(Moptop_General_Error_String,"Moptop_Shutdown_CCD:CCD_Buffer_Free failed.");
 		return FALSE;
 	}
+	/* stop the io_uring thread, if the io_uring FITS I/O backend is in use */
+	if(!CCD_Fits_Image_Io_Backend_Set(CCD_FITS_IMAGE_IO_BACKEND_PWRITE))
+	{
+		Moptop_General_Error_Number = 39;
+		sprintf(Moptop_General_Error_String,"Moptop_Shutdown_CCD:CCD_Fits_Image_Io_Backend_Set failed.");
+		return FALSE;
+	}
 
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log("main","moptop_main.c","Moptop_Shutdown_CCD",LOG_VERBOSITY_TERSE,"STARTUP","Finished.");
@@ -0,0 +1,639 @@
+/* moptop_master.c
+** Moptop streaming master bias/dark combination routines
+*/
+/**
+ * Routines to combine the frames of a multbias or multdark into a master bias or dark as they are taken, rather
+ * than re-reading all the frames afterwards.
+ * Each frame is accumulated (by the writer threads, before it is converted to FITS format) into a running mean and
+ * variance per pixel (Welford's algorithm, in double precision, using AVX2/FMA instructions where the CPU supports
+ * them). The first few frames are also kept in memory (a bounded window). When the last frame arrives, the window
+ * frames are sigma clipped against the running mean and standard deviation, the rejected pixel values are removed
+ * from the mean, and the master frame is written as a float FITS image with the real time pipeline flag set in
+ * it's filename. It is also passed to the real time calibration (Moptop_Calibrate_Master_Set), so it is used
+ * by the next multrun straight away. Master darks have the master bias subtracted.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "log_udp.h"
+
+#include "ccd_fits_filename.h"
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+
+#include "moptop_calibrate.h"
+#include "moptop_config.h"
+#include "moptop_fits_header.h"
+#include "moptop_general.h"
+#include "moptop_master.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
+
+/* hash defines */
+/**
+ * The number of FITS cards added to the header of a master frame, describing how it was combined.
+ */
+#define MASTER_CARD_COUNT               (4)
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Defined if this is an x86 build, and the AVX2/FMA accumulation kernel can be compiled (and selected
+ * at run time if the CPU supports it).
+ */
+#define MASTER_X86                      (1)
+#endif
+
+/* data types */
+/**
+ * Data type holding local data to the moptop master routines.
+ * <dl>
+ * <dt>Enable</dt> <dd>A boolean, TRUE if the frames of this bias/dark are being combined into a master frame
+ *                     ("moptop.bias_dark.master.enable"), and the master has not been written yet.</dd>
+ * <dt>Use_FMA</dt> <dd>A boolean, TRUE if the CPU supports AVX2 and FMA, and the SIMD kernel is used.</dd>
+ * <dt>Type</dt> <dd>Which type of master frame is being combined (bias or dark).</dd>
+ * <dt>Image_Count</dt> <dd>The number of frames in the bias/dark.</dd>
+ * <dt>Ncols</dt> <dd>The number of (binned) columns in each frame.</dd>
+ * <dt>Nrows</dt> <dd>The number of (binned) rows in each frame.</dd>
+ * <dt>Exposure_Length</dt> <dd>The exposure length of each frame, in seconds.</dd>
+ * <dt>Window_Count</dt> <dd>The number of frames (the first ones) kept in memory for the sigma clipping pass
+ *                           ("moptop.bias_dark.master.window.count", at most Image_Count).</dd>
+ * <dt>Sigma_Clip</dt> <dd>Window frame pixel values further than this many standard deviations from the mean
+ *                         are rejected ("moptop.bias_dark.master.sigma.clip").</dd>
+ * <dt>Frame_Count</dt> <dd>The number of frames accumulated so far.</dd>
+ * <dt>Rejected_Count</dt> <dd>The number of pixel values rejected by the sigma clipping pass.</dd>
+ * <dt>Mean</dt> <dd>The running mean of each pixel, in camera orientation.</dd>
+ * <dt>M2</dt> <dd>The running sum of squared differences from the mean of each pixel (the standard deviation
+ *                 limit of each pixel, during the sigma clipping pass).</dd>
+ * <dt>Window</dt> <dd>Window_Count frames of image data, in camera orientation.</dd>
+ * <dt>Reject</dt> <dd>The number of values of each pixel rejected by the sigma clipping pass.</dd>
+ * <dt>Master</dt> <dd>The combined master frame.</dd>
+ * <dt>Pixel_Count</dt> <dd>The number of pixels Mean, M2, Reject and Master were allocated for.</dd>
+ * <dt>Window_Pixel_Count</dt> <dd>The number of pixels Window was allocated for.</dd>
+ * </dl>
+ * The buffers are allocated the first time they are needed, and kept between biases/darks.
+ * @see moptop_calibrate.html#MOPTOP_CALIBRATE_MASTER
+ */
+struct Master_Struct
+{
+	int Enable;
+	int Use_FMA;
+	enum MOPTOP_CALIBRATE_MASTER Type;
+	int Image_Count;
+	int Ncols;
+	int Nrows;
+	double Exposure_Length;
+	int Window_Count;
+	double Sigma_Clip;
+	int Frame_Count;
+	int Rejected_Count;
+	double *Mean;
+	double *M2;
+	unsigned short *Window;
+	unsigned char *Reject;
+	float *Master;
+	size_t Pixel_Count;
+	size_t Window_Pixel_Count;
+};
+
+/* internal data */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * The instance of Master_Struct that contains local data for this module.
+ * @see #Master_Struct
+ */
+static struct Master_Struct Master_Data;
+/**
+ * A mutex protecting the running mean and variance, which the writer threads accumulate frames into.
+ */
+static pthread_mutex_t Master_Mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* internal functions */
+static void Master_Accumulate(unsigned short *image_data,size_t pixel_count,double reciprocal_n);
+static size_t Master_Accumulate_Scalar(unsigned short *image_data,size_t start,size_t pixel_count,
+				       double reciprocal_n);
+#ifdef MASTER_X86
+static size_t Master_Accumulate_FMA(unsigned short *image_data,size_t pixel_count,double reciprocal_n);
+#endif
+static void Master_Combine(void);
+
+/* ----------------------------------------------------------------------------
+** 		external functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Setup the combination of the frames of a multbias/multdark into a master frame. This must be called before the
+ * writer threads are started.
+ * <ul>
+ * <li>We retrieve the "moptop.bias_dark.master.enable" config value. If it is FALSE we return.
+ * <li>We retrieve the "moptop.bias_dark.master.window.count" and "moptop.bias_dark.master.sigma.clip" config
+ *     values, and check them.
+ * <li>We (re)allocate the running mean and variance, rejection count, master and window buffers if they are
+ *     too small, and zero the running mean and variance.
+ * <li>We select the accumulation kernel: AVX2/FMA if the CPU supports it, otherwise scalar.
+ * </ul>
+ * @param type Which type of master frame to combine, MOPTOP_CALIBRATE_MASTER_BIAS or MOPTOP_CALIBRATE_MASTER_DARK.
+ * @param image_count The number of frames in the bias/dark.
+ * @param ncols The number of (binned) columns in each frame.
+ * @param nrows The number of (binned) rows in each frame.
+ * @param exposure_length The exposure length of each frame, in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Master_Data
+ * @see moptop_master.html#MOPTOP_MASTER_WINDOW_COUNT_MAX
+ * @see moptop_config.html#Moptop_Config_Get_Boolean
+ * @see moptop_config.html#Moptop_Config_Get_Integer
+ * @see moptop_config.html#Moptop_Config_Get_Double
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Master_Start(enum MOPTOP_CALIBRATE_MASTER type,int image_count,int ncols,int nrows,
+			double exposure_length)
+{
+	void *new_data = NULL;
+	size_t pixel_count,window_pixel_count;
+	int window_count;
+
+	Master_Data.Enable = FALSE;
+	if(!Moptop_Config_Get_Boolean("moptop.bias_dark.master.enable",&(Master_Data.Enable)))
+		return FALSE;
+	if(Master_Data.Enable == FALSE)
+		return TRUE;
+	Master_Data.Enable = FALSE;
+	if((type != MOPTOP_CALIBRATE_MASTER_BIAS)&&(type != MOPTOP_CALIBRATE_MASTER_DARK))
+	{
+		Moptop_General_Error_Number = 1300;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Start:Cannot combine master type %d.",type);
+		return FALSE;
+	}
+	if((image_count < 1)||(ncols < 1)||(nrows < 1))
+	{
+		Moptop_General_Error_Number = 1301;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Start:Illegal image count %d or dimensions (%d,%d).",
+			image_count,ncols,nrows);
+		return FALSE;
+	}
+	if(!Moptop_Config_Get_Integer("moptop.bias_dark.master.window.count",&window_count))
+		return FALSE;
+	if((window_count < 0)||(window_count > MOPTOP_MASTER_WINDOW_COUNT_MAX))
+	{
+		Moptop_General_Error_Number = 1302;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Start:Illegal window count %d (0..%d).",window_count,
+			MOPTOP_MASTER_WINDOW_COUNT_MAX);
+		return FALSE;
+	}
+	if(!Moptop_Config_Get_Double("moptop.bias_dark.master.sigma.clip",&(Master_Data.Sigma_Clip)))
+		return FALSE;
+	if(Master_Data.Sigma_Clip <= 0.0)
+	{
+		Moptop_General_Error_Number = 1303;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Start:Illegal sigma clip %.3f.",Master_Data.Sigma_Clip);
+		return FALSE;
+	}
+	if(window_count > image_count)
+		window_count = image_count;
+	pixel_count = ((size_t)ncols)*((size_t)nrows);
+	window_pixel_count = pixel_count*((size_t)window_count);
+	if(Master_Data.Pixel_Count < pixel_count)
+	{
+		new_data = realloc(Master_Data.Mean,pixel_count*sizeof(double));
+		if(new_data != NULL)
+		{
+			Master_Data.Mean = (double *)new_data;
+			new_data = realloc(Master_Data.M2,pixel_count*sizeof(double));
+		}
+		if(new_data != NULL)
+		{
+			Master_Data.M2 = (double *)new_data;
+			new_data = realloc(Master_Data.Reject,pixel_count*sizeof(unsigned char));
+		}
+		if(new_data != NULL)
+		{
+			Master_Data.Reject = (unsigned char *)new_data;
+			new_data = realloc(Master_Data.Master,pixel_count*sizeof(float));
+		}
+		if(new_data == NULL)
+		{
+			Moptop_General_Error_Number = 1304;
+			sprintf(Moptop_General_Error_String,"Moptop_Master_Start:"
+				"Failed to allocate accumulators (%d x %d).",ncols,nrows);
+			return FALSE;
+		}
+		Master_Data.Master = (float *)new_data;
+		Master_Data.Pixel_Count = pixel_count;
+	}
+	if(Master_Data.Window_Pixel_Count < window_pixel_count)
+	{
+		new_data = realloc(Master_Data.Window,window_pixel_count*sizeof(unsigned short));
+		if(new_data == NULL)
+		{
+			Moptop_General_Error_Number = 1305;
+			sprintf(Moptop_General_Error_String,"Moptop_Master_Start:"
+				"Failed to allocate window of %d frames (%d x %d).",window_count,ncols,nrows);
+			return FALSE;
+		}
+		Master_Data.Window = (unsigned short *)new_data;
+		Master_Data.Window_Pixel_Count = window_pixel_count;
+	}
+	memset(Master_Data.Mean,0,pixel_count*sizeof(double));
+	memset(Master_Data.M2,0,pixel_count*sizeof(double));
+	Master_Data.Type = type;
+	Master_Data.Image_Count = image_count;
+	Master_Data.Ncols = ncols;
+	Master_Data.Nrows = nrows;
+	Master_Data.Exposure_Length = exposure_length;
+	Master_Data.Window_Count = window_count;
+	Master_Data.Frame_Count = 0;
+	Master_Data.Rejected_Count = 0;
+	Master_Data.Use_FMA = FALSE;
+#ifdef MASTER_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		Master_Data.Use_FMA = TRUE;
+#endif
+	Master_Data.Enable = TRUE;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("master","moptop_master.c","Moptop_Master_Start",LOG_VERBOSITY_INTERMEDIATE,
+				  "MASTER","Combining %d frames of %d x %d pixels into a master %s, sigma clipping "
+				  "the first %d at %.2f sigma, using the %s kernel.",image_count,ncols,nrows,
+				  (type == MOPTOP_CALIBRATE_MASTER_BIAS) ? "bias" : "dark",window_count,
+				  Master_Data.Sigma_Clip,Master_Data.Use_FMA ? "avx2/fma" : "scalar");
+#endif
+	return TRUE;
+}
+
+/**
+ * Return whether the frames of this bias/dark are being combined into a master frame.
+ * @return TRUE if Moptop_Master_Start enabled the combination, and the master has not been written yet,
+ *         FALSE otherwise.
+ * @see #Master_Data
+ */
+int Moptop_Master_Is_Enabled(void)
+{
+	return Master_Data.Enable;
+}
+
+/**
+ * Accumulate a frame into the master frame's running mean and variance. This is called by the writer threads,
+ * before the frame's image data is converted to FITS format.
+ * <ul>
+ * <li>If the frame is in the window (it's image index is less than Window_Count), we copy it into the window.
+ * <li>We lock Master_Mutex, increment the frame count, and update the running mean and variance of each pixel
+ *     using Master_Accumulate. The frames are accumulated one at a time, as each update depends on the number of
+ *     frames accumulated so far.
+ * <li>If this was the last frame, master_complete is set to TRUE: the caller should then write the master
+ *     frame using Moptop_Master_Write.
+ * <li>We add the time taken to the MOPTOP_TIMING_TYPE_MASTER timing histogram.
+ * </ul>
+ * If the combination is not enabled, this routine does nothing.
+ * @param image_index The index of the frame in the bias/dark (from 0).
+ * @param image_data The frame's image data, Ncols x Nrows unsigned shorts in host byte order (as read out
+ *        from the camera).
+ * @param master_complete The address of an integer, set to TRUE if this was the last frame of the bias/dark,
+ *        and FALSE otherwise.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Master_Data
+ * @see #Master_Mutex
+ * @see #Master_Accumulate
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Master_Frame_Add(int image_index,unsigned short *image_data,int *master_complete)
+{
+	struct timespec start_time,end_time;
+	size_t pixel_count;
+
+	if(master_complete == NULL)
+	{
+		Moptop_General_Error_Number = 1306;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Frame_Add:master_complete was NULL.");
+		return FALSE;
+	}
+	(*master_complete) = FALSE;
+	if(Master_Data.Enable == FALSE)
+		return TRUE;
+	if((image_data == NULL)||(image_index < 0)||(image_index >= Master_Data.Image_Count))
+	{
+		Moptop_General_Error_Number = 1307;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Frame_Add:"
+			"Illegal image data %p or image index %d (%d).",(void*)image_data,image_index,
+			Master_Data.Image_Count);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	pixel_count = ((size_t)Master_Data.Ncols)*((size_t)Master_Data.Nrows);
+	/* each window frame has it's own slot, so this does not need the mutex */
+	if(image_index < Master_Data.Window_Count)
+	{
+		memcpy(Master_Data.Window+(((size_t)image_index)*pixel_count),image_data,
+		       pixel_count*sizeof(unsigned short));
+	}
+	if(!Moptop_General_Mutex_Lock(&Master_Mutex))
+		return FALSE;
+	if(Master_Data.Frame_Count >= Master_Data.Image_Count)
+	{
+		Moptop_General_Mutex_Unlock(&Master_Mutex);
+		Moptop_General_Error_Number = 1308;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Frame_Add:"
+			"Too many frames (image index %d, %d frames already accumulated).",image_index,
+			Master_Data.Frame_Count);
+		return FALSE;
+	}
+	Master_Data.Frame_Count++;
+	Master_Accumulate(image_data,pixel_count,1.0/((double)Master_Data.Frame_Count));
+	if(Master_Data.Frame_Count == Master_Data.Image_Count)
+		(*master_complete) = TRUE;
+	if(!Moptop_General_Mutex_Unlock(&Master_Mutex))
+		return FALSE;
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_BIAS_DARK,MOPTOP_TIMING_TYPE_MASTER,start_time,end_time);
+	return TRUE;
+}
+
+/**
+ * Finish combining the master frame, and write it as a float FITS image. This should be called once,
+ * by the writer thread whose call to Moptop_Master_Frame_Add accumulated the last frame.
+ * <ul>
+ * <li>We sigma clip the window frames and compute the master frame using Master_Combine.
+ * <li>We flip the master frame into FITS image orientation using Moptop_General_Float_Plane_Flip.
+ * <li>For a master dark, we subtract the master bias using Moptop_Calibrate_Master_Bias_Subtract.
+ * <li>We set it as the master frame used by the real time calibration, using Moptop_Calibrate_Master_Set.
+ * <li>If there is room, we add the MASTNUM/MASTWIN/MASTCLIP/MASTREJ (combination) cards to card_image_list.
+ * <li>We lock the FITS filename (or get the temporary filename to write to) using CCD_Fits_Filename_Publish_Begin.
+ * <li>We write the master frame to a float FITS image using CCD_Fits_Image_Float_Write.
+ * <li>We publish it using Moptop_Writer_Publish, holding no frames.
+ * </ul>
+ * The combination is then disabled until the next call to Moptop_Master_Start.
+ * @param filename The FITS filename of the master frame.
+ * @param card_image_list The FITS header card images to put in the master frame, of at least
+ *        MOPTOP_FITS_HEADER_TEMPLATE_LENGTH characters. This is modified.
+ * @param card_count The number of card images in card_image_list.
+ * @param flip_x A boolean, if TRUE the frames were flipped in X when written.
+ * @param flip_y A boolean, if TRUE the frames were flipped in Y when written.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MASTER_CARD_COUNT
+ * @see #Master_Data
+ * @see #Master_Combine
+ * @see moptop_general.html#Moptop_General_Float_Plane_Flip
+ * @see moptop_calibrate.html#Moptop_Calibrate_Master_Bias_Subtract
+ * @see moptop_calibrate.html#Moptop_Calibrate_Master_Set
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Int_Set
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Float_Set
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Float_Write
+ */
+int Moptop_Master_Write(char *filename,char *card_image_list,int card_count,int flip_x,int flip_y)
+{
+	struct timespec start_time,end_time;
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+
+	if(Master_Data.Enable == FALSE)
+	{
+		Moptop_General_Error_Number = 1309;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Write:No master frame is being combined.");
+		return FALSE;
+	}
+	if((filename == NULL)||(card_image_list == NULL))
+	{
+		Moptop_General_Error_Number = 1310;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Write:filename or card_image_list was NULL.");
+		return FALSE;
+	}
+	if(Master_Data.Frame_Count != Master_Data.Image_Count)
+	{
+		Moptop_General_Error_Number = 1311;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Write:Only %d of %d frames accumulated.",
+			Master_Data.Frame_Count,Master_Data.Image_Count);
+		return FALSE;
+	}
+	Master_Data.Enable = FALSE;
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	Master_Combine();
+	Moptop_General_Float_Plane_Flip(Master_Data.Master,Master_Data.Ncols,Master_Data.Nrows,flip_x,flip_y);
+	if(Master_Data.Type == MOPTOP_CALIBRATE_MASTER_DARK)
+	{
+		if(!Moptop_Calibrate_Master_Bias_Subtract(Master_Data.Master,Master_Data.Ncols,Master_Data.Nrows))
+			return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("master","moptop_master.c","Moptop_Master_Write",LOG_VERBOSITY_INTERMEDIATE,
+				  "MASTER","Combined %d frames, rejecting %d pixel values from %d window frames, "
+				  "in %.3f s.",Master_Data.Frame_Count,Master_Data.Rejected_Count,
+				  Master_Data.Window_Count,fdifftime(end_time,start_time));
+#endif
+	/* set the master frame in memory first, as the FITS writer byte swaps it in place */
+	if(!Moptop_Calibrate_Master_Set(Master_Data.Type,Master_Data.Master,Master_Data.Ncols,Master_Data.Nrows,
+					Master_Data.Exposure_Length,filename))
+		return FALSE;
+	if((card_count+MASTER_CARD_COUNT) <= MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX)
+	{
+		CCD_Fits_Header_Card_Image_Int_Set(card_image_list+(card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						   "MASTNUM",Master_Data.Frame_Count);
+		CCD_Fits_Header_Card_Image_Int_Set(card_image_list+((card_count+1)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						   "MASTWIN",Master_Data.Window_Count);
+		CCD_Fits_Header_Card_Image_Float_Set(card_image_list+((card_count+2)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						     "MASTCLIP",Master_Data.Sigma_Clip);
+		CCD_Fits_Header_Card_Image_Int_Set(card_image_list+((card_count+3)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						   "MASTREJ",Master_Data.Rejected_Count);
+		card_count += MASTER_CARD_COUNT;
+	}
+	if(!CCD_Fits_Filename_Publish_Begin(filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 1312;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Write:Failed to lock '%s'.",filename);
+		return FALSE;
+	}
+	if(!CCD_Fits_Image_Float_Write(write_filename,card_image_list,card_count,Master_Data.Ncols,
+				       Master_Data.Nrows,0,Master_Data.Master))
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		Moptop_General_Error_Number = 1313;
+		sprintf(Moptop_General_Error_String,"Moptop_Master_Write:Failed to write '%s'.",filename);
+		return FALSE;
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("master","moptop_master.c","Moptop_Master_Write",LOG_VERBOSITY_INTERMEDIATE,
+				  "MASTER","Master frame written to '%s'.",filename);
+#endif
+	return Moptop_Writer_Publish(write_filename,0,0);
+}
+
+/* ----------------------------------------------------------------------------
+** 		internal functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Accumulate a frame into the running mean and variance of each pixel (Welford's algorithm):
+ * delta = x - mean; mean += delta / n; M2 += delta * (x - mean).
+ * The AVX2/FMA kernel is used if Master_Data.Use_FMA is TRUE, and the scalar kernel does any remaining pixels.
+ * The caller must hold Master_Mutex.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param pixel_count The number of pixels in the frame.
+ * @param reciprocal_n The reciprocal of the number of frames accumulated, including this one.
+ * @see #Master_Data
+ * @see #Master_Accumulate_Scalar
+ * @see #Master_Accumulate_FMA
+ */
+static void Master_Accumulate(unsigned short *image_data,size_t pixel_count,double reciprocal_n)
+{
+	size_t start = 0;
+
+#ifdef MASTER_X86
+	if(Master_Data.Use_FMA)
+		start = Master_Accumulate_FMA(image_data,pixel_count,reciprocal_n);
+#endif
+	Master_Accumulate_Scalar(image_data,start,pixel_count,reciprocal_n);
+}
+
+/**
+ * Scalar accumulation kernel. See Master_Accumulate.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param start The first pixel to accumulate (the pixels before this have been done by a SIMD kernel).
+ * @param pixel_count The number of pixels in the frame.
+ * @param reciprocal_n The reciprocal of the number of frames accumulated, including this one.
+ * @return The number of pixels processed (pixel_count).
+ * @see #Master_Data
+ * @see #Master_Accumulate
+ */
+static size_t Master_Accumulate_Scalar(unsigned short *image_data,size_t start,size_t pixel_count,
+				       double reciprocal_n)
+{
+	double *mean = Master_Data.Mean;
+	double *m2 = Master_Data.M2;
+	double value,delta;
+	size_t i;
+
+	for(i = start; i < pixel_count; i++)
+	{
+		value = (double)image_data[i];
+		delta = value-mean[i];
+		mean[i] += delta*reciprocal_n;
+		m2[i] += delta*(value-mean[i]);
+	}
+	return pixel_count;
+}
+
+#ifdef MASTER_X86
+/**
+ * AVX2/FMA accumulation kernel, 8 pixels (two vectors of 4 doubles) at a time. See Master_Accumulate.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param pixel_count The number of pixels in the frame.
+ * @param reciprocal_n The reciprocal of the number of frames accumulated, including this one.
+ * @return The number of pixels processed (a multiple of 8), the rest must be done by Master_Accumulate_Scalar.
+ * @see #Master_Data
+ * @see #Master_Accumulate
+ */
+__attribute__((target("avx2,fma")))
+static size_t Master_Accumulate_FMA(unsigned short *image_data,size_t pixel_count,double reciprocal_n)
+{
+	double *mean = Master_Data.Mean;
+	double *m2 = Master_Data.M2;
+	__m256d r = _mm256_set1_pd(reciprocal_n);
+	__m256d value_lo,value_hi,delta_lo,delta_hi,mean_lo,mean_hi;
+	__m256i value;
+	size_t i;
+
+	for(i = 0; (i+8) <= pixel_count; i += 8)
+	{
+		value = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_data+i)));
+		value_lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(value));
+		value_hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(value,1));
+		mean_lo = _mm256_loadu_pd(mean+i);
+		mean_hi = _mm256_loadu_pd(mean+i+4);
+		delta_lo = _mm256_sub_pd(value_lo,mean_lo);
+		delta_hi = _mm256_sub_pd(value_hi,mean_hi);
+		mean_lo = _mm256_fmadd_pd(delta_lo,r,mean_lo);
+		mean_hi = _mm256_fmadd_pd(delta_hi,r,mean_hi);
+		_mm256_storeu_pd(mean+i,mean_lo);
+		_mm256_storeu_pd(mean+i+4,mean_hi);
+		_mm256_storeu_pd(m2+i,_mm256_fmadd_pd(delta_lo,_mm256_sub_pd(value_lo,mean_lo),_mm256_loadu_pd(m2+i)));
+		_mm256_storeu_pd(m2+i+4,_mm256_fmadd_pd(delta_hi,_mm256_sub_pd(value_hi,mean_hi),
+							_mm256_loadu_pd(m2+i+4)));
+	}
+	return i;
+}
+#endif
+
+/**
+ * Compute the sigma clipped master frame (in camera orientation) into Master_Data.Master.
+ * <ul>
+ * <li>We turn each pixel's M2 into it's rejection limit: Sigma_Clip times the standard deviation.
+ * <li>We compare each window frame's pixel values to the mean, and sum the values (and count the number of values)
+ *     that are further from the mean than the limit.
+ * <li>We remove the rejected values from the mean: master = ((mean * n) - rejected sum) / (n - rejected count).
+ *     If all the values of a pixel were rejected, it's master value is the mean.
+ * </ul>
+ * Only the window frames are sigma clipped, the values of the other frames all contribute to the mean.
+ * If there is only one frame, no values are rejected.
+ * @see #Master_Data
+ */
+static void Master_Combine(void)
+{
+	unsigned short *window_frame = NULL;
+	double n,value,limit;
+	size_t i,pixel_count;
+	int w,count;
+
+	pixel_count = ((size_t)Master_Data.Ncols)*((size_t)Master_Data.Nrows);
+	n = (double)Master_Data.Frame_Count;
+	if(Master_Data.Frame_Count > 1)
+	{
+		for(i = 0; i < pixel_count; i++)
+			Master_Data.M2[i] = Master_Data.Sigma_Clip*sqrt(Master_Data.M2[i]/(n-1.0));
+	}
+	else
+		memset(Master_Data.M2,0,pixel_count*sizeof(double));
+	/* the rejected sum of each pixel is exact in a float, as it is at most 255 x 65535 */
+	memset(Master_Data.Master,0,pixel_count*sizeof(float));
+	memset(Master_Data.Reject,0,pixel_count*sizeof(unsigned char));
+	for(w = 0; w < Master_Data.Window_Count; w++)
+	{
+		window_frame = Master_Data.Window+(((size_t)w)*pixel_count);
+		for(i = 0; i < pixel_count; i++)
+		{
+			value = (double)window_frame[i];
+			limit = Master_Data.M2[i];
+			if((limit > 0.0)&&(fabs(value-Master_Data.Mean[i]) > limit))
+			{
+				Master_Data.Master[i] += (float)value;
+				Master_Data.Reject[i]++;
+			}
+		}
+	}
+	for(i = 0; i < pixel_count; i++)
+	{
+		count = Master_Data.Frame_Count-Master_Data.Reject[i];
+		Master_Data.Rejected_Count += Master_Data.Reject[i];
+		if((Master_Data.Reject[i] > 0)&&(count > 0))
+			Master_Data.Master[i] = (float)(((Master_Data.Mean[i]*n)-Master_Data.Master[i])/((double)count));
+		else
+			Master_Data.Master[i] = (float)Master_Data.Mean[i];
+	}
+}
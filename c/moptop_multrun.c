@@ -16,20 +16,24 @@
 #define _POSIX_C_SOURCE 199309L
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "log_udp.h"
 
 #include "ccd_buffer.h"
+#include "ccd_clock_model.h"
 #include "ccd_command.h"
 #include "ccd_exposure.h"
 #include "ccd_fits_filename.h"
 #include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
 #include "ccd_setup.h"
 #include "ccd_temperature.h"
 
@@ -37,18 +41,26 @@
 #include "filter_wheel_config.h"
 
 #include "pirot_command.h"
+#include "pirot_recorder.h"
 #include "pirot_setup.h"
 
+#include "moptop_calibrate.h"
 #include "moptop_config.h"
 #include "moptop_fits_header.h"
 #include "moptop_general.h"
 #include "moptop_multrun.h"
+#include "moptop_reduce.h"
+#include "moptop_stack.h"
+#include "moptop_statistics.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
 
 /* hash defines */
 /**
  * Length of FITS filename string.
+ * @see moptop_writer.html#MOPTOP_WRITER_FILENAME_LENGTH
  */
-#define MULTRUN_FITS_FILENAME_LENGTH  (256)
+#define MULTRUN_FITS_FILENAME_LENGTH  (MOPTOP_WRITER_FILENAME_LENGTH)
 /**
  * Length of cached filter name and id data.
  */
@@ -57,8 +69,86 @@
  * Length of cached rotator speed.
  */
 #define MULTRUN_ROTATOR_SPEED_LENGTH  (32)
+/**
+ * The extra time (in seconds) the rotator's data recorder is armed to record for, on top of the time the
+ * rotator takes to reach it's end position at the run velocity. This covers the rotator accelerating from it's start
+ * position (before the first trigger) up to the run velocity.
+ */
+#define MULTRUN_ROTATOR_RECORDER_MARGIN (5.0)
+/**
+ * The number of per-rotation FITS cubes that can be open at once in cube output mode. The writer threads can 
+ * still be writing the last frames of one rotation when the first frames of the next rotation arrive, and a 
+ * rotation's cube stays open until all it's planes have been written (or dropped).
+ */
+#define MULTRUN_CUBE_SLOT_COUNT         (4)
+/**
+ * The number of columns in each cube's per-plane binary table. 
+ * @see #Multrun_Cube_Column_Name_List
+ * @see #Multrun_Cube_Column_Unit_List
+ */
+#define MULTRUN_CUBE_COLUMN_COUNT       (8)
+/**
+ * The extension that replaces '.fits' in the multrun's raw capture filename, in raw output mode.
+ * @see #Multrun_Raw_Create
+ */
+#define MULTRUN_RAW_EXTENSION           ".raw"
 
 /* data types */
+/**
+ * Enumeration of the FITS header keywords whose values change every frame of a multrun. These are the slots
+ * in the multrun FITS header template that are overwritten for each frame. The order must match
+ * Multrun_Header_Slot_Keyword_List.
+ * @see #Multrun_Header_Slot_Keyword_List
+ * @see #Multrun_Header_Template
+ */
+enum MULTRUN_HEADER_SLOT
+{
+	MULTRUN_HEADER_SLOT_DATE=0,MULTRUN_HEADER_SLOT_DATE_OBS,MULTRUN_HEADER_SLOT_UTSTART,MULTRUN_HEADER_SLOT_MJD,
+	MULTRUN_HEADER_SLOT_DATE_END,MULTRUN_HEADER_SLOT_UTEND,MULTRUN_HEADER_SLOT_TELAPSE,MULTRUN_HEADER_SLOT_RUNNUM,
+	MULTRUN_HEADER_SLOT_EXPNUM,MULTRUN_HEADER_SLOT_MOPRREQ,MULTRUN_HEADER_SLOT_MOPRBEG,MULTRUN_HEADER_SLOT_MOPREND,
+	MULTRUN_HEADER_SLOT_MOPRARC,MULTRUN_HEADER_SLOT_MOPRNUM,MULTRUN_HEADER_SLOT_MOPRPOS,MULTRUN_HEADER_SLOT_PICNUM,
+	MULTRUN_HEADER_SLOT_CAMTIME,MULTRUN_HEADER_SLOT_CAMUTC,MULTRUN_HEADER_SLOT_CLKUNCER,MULTRUN_HEADER_SLOT_DROPPED,
+	MULTRUN_HEADER_SLOT_STATMEAN,MULTRUN_HEADER_SLOT_STATMED,MULTRUN_HEADER_SLOT_STATSDEV,MULTRUN_HEADER_SLOT_STATMIN,
+	MULTRUN_HEADER_SLOT_STATMAX,MULTRUN_HEADER_SLOT_STATSAT,MULTRUN_HEADER_SLOT_COUNT
+};
+
+/**
+ * Enumeration of how the frames acquired during a multrun are written to disk.
+ * <dl>
+ * <dt>MULTRUN_OUTPUT_MODE_FRAME</dt> <dd>Each frame is written to it's own FITS image.</dd>
+ * <dt>MULTRUN_OUTPUT_MODE_CUBE</dt> <dd>The frames from each rotation of the rotator are written as the planes of
+ *     one FITS cube, with a per-plane binary table holding the per-frame rotator positions and timestamps.</dd>
+ * <dt>MULTRUN_OUTPUT_MODE_RAW</dt> <dd>The frames are written unconverted into one preallocated raw capture file 
+ *     per multrun, each with a fixed-size record holding it's FITS headers, rotator positions and timestamps. 
+ *     The raw capture file is converted into the FITS images frame mode would have written later, offline,
+ *     using moptop_raw_convert.</dd>
+ * <dt>MULTRUN_OUTPUT_MODE_STACK</dt> <dd>The frames taken at each rotator position are added together as they
+ *     arrive, and only one (32 bit integer) FITS image per rotator position is written, at the end of the 
+ *     multrun.</dd>
+ * </dl>
+ */
+enum MULTRUN_OUTPUT_MODE
+{
+	MULTRUN_OUTPUT_MODE_FRAME=0,MULTRUN_OUTPUT_MODE_CUBE,MULTRUN_OUTPUT_MODE_RAW,MULTRUN_OUTPUT_MODE_STACK
+};
+
+/**
+ * Enumeration of the state of each file in the multrun's preallocated output file pool.
+ * <dl>
+ * <dt>MULTRUN_PREALLOCATE_STATE_NONE</dt> <dd>The file has not been preallocated (yet, or it failed).</dd>
+ * <dt>MULTRUN_PREALLOCATE_STATE_IN_PROGRESS</dt> <dd>The preallocation thread is creating the file.</dd>
+ * <dt>MULTRUN_PREALLOCATE_STATE_DONE</dt> <dd>The file has been created and preallocated, and is waiting for it's
+ *                                              frame to be written into it.</dd>
+ * <dt>MULTRUN_PREALLOCATE_STATE_USED</dt> <dd>A writer thread has claimed the file, whether or not 
+ *                                              it was preallocated.</dd>
+ * </dl>
+ */
+enum MULTRUN_PREALLOCATE_STATE
+{
+	MULTRUN_PREALLOCATE_STATE_NONE=0,MULTRUN_PREALLOCATE_STATE_IN_PROGRESS,MULTRUN_PREALLOCATE_STATE_DONE,
+	MULTRUN_PREALLOCATE_STATE_USED
+};
+
 /**
  * Data type holding local data to moptop multruns.
  * <dl>
@@ -78,7 +168,8 @@
  *                                            taken at the start of a multrun. Used to populate FITS headers.</dd>
  * <dt>Requested_Exposure_Length</dt> <dd>A copy of the per-frame requested exposure length (in seconds) 
  *                                        used to configure the CCD camera. Used to populate FITS headers.</dd>
- * <dt>Image_Index</dt> <dd>Which frame in the multrun we are currently working on.</dd>
+ * <dt>Image_Index</dt> <dd>Which frame in the multrun we are currently working on. This is the index of the
+ *                        rotator trigger that started the frame, so skips any dropped frames.</dd>
  * <dt>Image_Count</dt> <dd>The number of FITS images we are expecting to generate in the current multrun.</dd>
  * <dt>Multrun_Start_Time</dt> <dd>A timestamp taken the first time an exposure was started in the multrun 
  *                              (actually, just before we start waiting for the next image to arrive, 
@@ -92,7 +183,32 @@
  *                              (from 1 to images_per_cycle).</dd>
  * <dt>Flip_X</dt> <dd>A boolean, if TRUE flip the image data in the X (horizontal) direction.</dd>
  * <dt>Flip_Y</dt> <dd>A boolean, if TRUE flip the image data in the Y (vertical) direction.</dd>
+ * <dt>Native_Fits_Writer</dt> <dd>A boolean, if TRUE write FITS images using the native FITS writer 
+ *                                 (CCD_Fits_Image_Write), otherwise use CFITSIO.</dd>
+ * <dt>Compress_Enable</dt> <dd>A boolean, if TRUE write FITS images Rice tile compressed (using CFITSIO),
+ *                              whichever writer Native_Fits_Writer selects.</dd>
+ * <dt>Preallocate_Enable</dt> <dd>A boolean, if TRUE create and preallocate the multrun's output files 
+ *                                 in advance, on a background thread.</dd>
+ * <dt>Rotator_Recorder_Enable</dt> <dd>A boolean, if TRUE use the rotator's data recorder to retrieve the
+ *                                      rotator position at the end of each frame, rather than querying it per-frame.</dd>
+ * <dt>Rotator_Recorder_Armed</dt> <dd>A boolean, TRUE if the rotator's data recorder was armed for the current
+ *                                     multrun. If so, the per-frame rotator position query is not done, and
+ *                                     MOPREND/MOPRARC are back-filled from the recorder at the end of the multrun.</dd>
+ * <dt>Dropped_Frame_Abort</dt> <dd>A boolean, if TRUE abort the multrun when a frame is dropped (or does not arrive 
+ *                                  in time), otherwise continue without it.</dd>
+ * <dt>Frame_Timeout_Retry_Count</dt> <dd>When continuing after dropped frames, the number of extra times to wait
+ *                                        for a frame that has not arrived in time, before assuming no more frames
+ *                                        are coming.</dd>
+ * <dt>Dropped_Frame_List</dt> <dd>An allocated list of the trigger indexes (Image_Index values) of frames dropped 
+ *                                 in the current (or last) multrun.</dd>
+ * <dt>Dropped_Frame_Count</dt> <dd>The number of trigger indexes in Dropped_Frame_List.</dd>
+ * <dt>Output_Mode</dt> <dd>How the acquired frames are written to disk, one FITS image per frame,
+ *                          one FITS cube per rotation, one raw capture file per multrun, or one stacked 
+ *                          FITS image per rotator position.</dd>
+ * <dt>Images_Per_Cycle</dt> <dd>The number of frames acquired in each rotation of the rotator in the current 
+ *                               multrun.</dd>
  * </dl>
+ * @see #MULTRUN_OUTPUT_MODE
  * @see #MULTRUN_ROTATOR_SPEED_LENGTH
  * @see #MULTRUN_FILTER_NAME_LENGTH
  */
@@ -115,6 +231,90 @@ struct Multrun_Struct
 	int Sequence_Number;
 	int Flip_X;
 	int Flip_Y;
+	int Native_Fits_Writer;
+	int Compress_Enable;
+	int Preallocate_Enable;
+	int Rotator_Recorder_Enable;
+	int Rotator_Recorder_Armed;
+	int Dropped_Frame_Abort;
+	int Frame_Timeout_Retry_Count;
+	int *Dropped_Frame_List;
+	int Dropped_Frame_Count;
+	enum MULTRUN_OUTPUT_MODE Output_Mode;
+	int Images_Per_Cycle;
+};
+
+/**
+ * Data type holding the state of one rotation's FITS cube, in cube output mode.
+ * <dl>
+ * <dt>Rotation_Number</dt> <dd>The rotation number (from 1) this cube is for, or 0 if this slot is not in use.</dd>
+ * <dt>Plane_Count</dt> <dd>The number of planes (frames) in this rotation.</dd>
+ * <dt>Planes_Done</dt> <dd>The number of planes that have been written, or dropped. When this reaches 
+ *                          Plane_Count, the cube is closed and the slot freed.</dd>
+ * <dt>Is_Open</dt> <dd>A boolean, TRUE if the cube file has been created (and locked).</dd>
+ * <dt>Cube</dt> <dd>The CCD library's cube data, holding the file descriptor, filename and layout.</dd>
+ * </dl>
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Struct
+ */
+struct Multrun_Cube_Struct
+{
+	int Rotation_Number;
+	int Plane_Count;
+	int Planes_Done;
+	int Is_Open;
+	struct CCD_Fits_Image_Cube_Struct Cube;
+};
+
+/**
+ * Data type holding the state of the multrun's raw capture file, in raw output mode.
+ * <dl>
+ * <dt>Is_Open</dt> <dd>A boolean, TRUE if the raw capture file has been created, and not yet closed.</dd>
+ * <dt>Raw</dt> <dd>The CCD library's raw capture file data, holding the file descriptor, filename and layout.</dd>
+ * </dl>
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Struct
+ */
+struct Multrun_Raw_Struct
+{
+	int Is_Open;
+	struct CCD_Fits_Image_Raw_Struct Raw;
+};
+
+/**
+ * Data type holding the multrun's preallocated output file pool. The files are created and preallocated 
+ * (at the filenames the writer threads will write them to) by Multrun_Preallocate_Thread, in trigger index order,
+ * whilst the multrun is acquiring frames.
+ * <dl>
+ * <dt>Is_Active</dt> <dd>A boolean, TRUE if the preallocation thread has been started for this multrun.</dd>
+ * <dt>Abort</dt> <dd>A boolean, set to TRUE to stop the preallocation thread before it has finished.</dd>
+ * <dt>Thread</dt> <dd>The preallocation thread.</dd>
+ * <dt>State_List</dt> <dd>An allocated list of File_Count states, one for each trigger index.</dd>
+ * <dt>File_Count</dt> <dd>The number of files in the pool (Multrun_Data.Image_Count).</dd>
+ * <dt>Images_Per_Cycle</dt> <dd>The number of frames in each rotation, used to compute each file's 
+ *                               run and window number from it's trigger index.</dd>
+ * <dt>Exposure_Type</dt> <dd>The exposure type in the filenames.</dd>
+ * <dt>Card_Count</dt> <dd>The number of card images in each file's header (excluding the mandatory ones).</dd>
+ * <dt>Ncols</dt> <dd>The number of (binned) columns in each file's image.</dd>
+ * <dt>Nrows</dt> <dd>The number of (binned) rows in each file's image.</dd>
+ * <dt>Preallocated_Count</dt> <dd>The number of files preallocated so far.</dd>
+ * <dt>Used_Count</dt> <dd>The number of preallocated files the writer threads have written into.</dd>
+ * </dl>
+ * @see #MULTRUN_PREALLOCATE_STATE
+ * @see #Multrun_Preallocate_Thread
+ */
+struct Multrun_Preallocate_Struct
+{
+	int Is_Active;
+	int Abort;
+	pthread_t Thread;
+	enum MULTRUN_PREALLOCATE_STATE *State_List;
+	int File_Count;
+	int Images_Per_Cycle;
+	enum CCD_FITS_FILENAME_EXPOSURE_TYPE Exposure_Type;
+	int Card_Count;
+	int Ncols;
+	int Nrows;
+	int Preallocated_Count;
+	int Used_Count;
 };
 	
 /* internal data */
@@ -142,14 +342,98 @@ static char rcsid[] = "$Id$";
  * <dt>Sequence_Number</dt>               <dd>0</dd>
  * <dt>Flip_X</dt>                        <dd>FALSE</dd>
  * <dt>Flip_Y</dt>                        <dd>FALSE</dd>
+ * <dt>Native_Fits_Writer</dt>            <dd>FALSE</dd>
+ * <dt>Compress_Enable</dt>               <dd>FALSE</dd>
+ * <dt>Preallocate_Enable</dt>            <dd>FALSE</dd>
+ * <dt>Rotator_Recorder_Enable</dt>       <dd>FALSE</dd>
+ * <dt>Rotator_Recorder_Armed</dt>        <dd>FALSE</dd>
+ * <dt>Dropped_Frame_Abort</dt>           <dd>TRUE</dd>
+ * <dt>Frame_Timeout_Retry_Count</dt>     <dd>0</dd>
+ * <dt>Dropped_Frame_List</dt>            <dd>NULL</dd>
+ * <dt>Dropped_Frame_Count</dt>           <dd>0</dd>
+ * <dt>Output_Mode</dt>                   <dd>MULTRUN_OUTPUT_MODE_FRAME</dd>
+ * <dt>Images_Per_Cycle</dt>              <dd>0</dd>
  * </dl>
  * @see #Multrun_Struct
  */
 static struct Multrun_Struct Multrun_Data =
 {
-	"",0.0,0.0,-1,"","",0.0,"",0.0,0,0,{0,0},{0,0},0,0,FALSE,FALSE
+	"",0.0,0.0,-1,"","",0.0,"",0.0,0,0,{0,0},{0,0},0,0,FALSE,FALSE,FALSE,FALSE,FALSE,FALSE,FALSE,TRUE,0,NULL,0,
+	MULTRUN_OUTPUT_MODE_FRAME,0
 };
 
+/**
+ * The keywords of the per-frame slots in the multrun FITS header template, in MULTRUN_HEADER_SLOT order.
+ * @see #MULTRUN_HEADER_SLOT
+ */
+static char *Multrun_Header_Slot_Keyword_List[MULTRUN_HEADER_SLOT_COUNT] =
+{
+	"DATE","DATE-OBS","UTSTART","MJD","DATE-END","UTEND","TELAPSE","RUNNUM","EXPNUM","MOPRREQ","MOPRBEG",
+	"MOPREND","MOPRARC","MOPRNUM","MOPRPOS","PICNUM","CAMTIME","CAMUTC","CLKUNCER","DROPPED",
+	"STATMEAN","STATMED","STATSDEV","STATMIN","STATMAX","STATSAT"
+};
+/**
+ * The multrun FITS header template. This is created once per multrun (by Multrun_Fits_Header_Template_Create),
+ * and is then read-only whilst the writer threads copy it into each frame's FITS header.
+ * @see #Multrun_Fits_Header_Template_Create
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Struct
+ */
+static struct Moptop_Fits_Header_Template_Struct Multrun_Header_Template;
+/**
+ * The per-rotation FITS cubes currently being written, in cube output mode.
+ * @see #MULTRUN_CUBE_SLOT_COUNT
+ * @see #Multrun_Cube_Mutex
+ */
+static struct Multrun_Cube_Struct Multrun_Cube_List[MULTRUN_CUBE_SLOT_COUNT];
+/**
+ * Mutex protecting Multrun_Cube_List, which is updated by the writer threads (as planes are written) and the 
+ * acquisition thread (as frames are dropped).
+ * @see #Multrun_Cube_List
+ */
+static pthread_mutex_t Multrun_Cube_Mutex = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * The multrun's raw capture file, in raw output mode. This is created (by Multrun_Raw_Create) before the writer 
+ * threads are started, and closed (by Multrun_Raw_Close) after they have stopped, so the writer threads 
+ * can write their frames into it without a mutex.
+ * @see #Multrun_Raw_Create
+ * @see #Multrun_Raw_Close
+ */
+static struct Multrun_Raw_Struct Multrun_Raw_Data;
+/**
+ * The multrun's preallocated output file pool.
+ * @see #Multrun_Preallocate_Mutex
+ */
+static struct Multrun_Preallocate_Struct Multrun_Preallocate_Data;
+/**
+ * Mutex protecting Multrun_Preallocate_Data, which is updated by the preallocation thread 
+ * and the writer threads.
+ * @see #Multrun_Preallocate_Data
+ */
+static pthread_mutex_t Multrun_Preallocate_Mutex = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Condition variable signalled by the preallocation thread whenever it finishes with a file, so a writer thread 
+ * waiting for a file that is being preallocated can claim it.
+ * @see #Multrun_Preallocate_Mutex
+ */
+static pthread_cond_t Multrun_Preallocate_Condition = PTHREAD_COND_INITIALIZER;
+/**
+ * The column names of each cube's per-plane binary table, in the order Multrun_Frame_Values_Get
+ * fills in the row values. These are also the names of the per-frame values in each raw capture file record.
+ * @see #MULTRUN_CUBE_COLUMN_COUNT
+ * @see #Multrun_Frame_Values_Get
+ */
+static char *Multrun_Cube_Column_Name_List[MULTRUN_CUBE_COLUMN_COUNT] =
+{
+	"MOPRREQ","MOPRBEG","MOPREND","MOPRARC","PICNUM","CAMTIME","CAMUTC","CLKUNCER"
+};
+/**
+ * The column units of each cube's per-plane binary table. The timestamps are in seconds since the Unix epoch.
+ * @see #MULTRUN_CUBE_COLUMN_COUNT
+ */
+static char *Multrun_Cube_Column_Unit_List[MULTRUN_CUBE_COLUMN_COUNT] =
+{
+	"deg","deg","deg","deg",NULL,"s","s","s"
+};
 /**
  * Is a multrun in progress.
  */
@@ -161,14 +445,37 @@ static int Moptop_Abort = FALSE;
 
 /* internal functions */
 static int Multrun_Acquire_Images(int do_standard,char ***filename_list,int *filename_count);
-static int Multrun_Get_Fits_Filename(int images_per_cycle,int do_standard,char *filename,int filename_length);
-static int Multrun_Write_Fits_Image(int do_standard,double pco_exposure_length_s,
-				    struct timespec exposure_end_time,int camera_image_number,
-				    struct timespec camera_timestamp,
-				    double requested_rotator_angle,double rotator_start_angle,
-				    double rotator_end_angle,double rotator_difference,
-				    unsigned char *image_buffer,
-				    int image_buffer_length,char *filename);
+static int Multrun_Get_Fits_Filename(int images_per_cycle,int skip_count,int do_standard,char *filename,
+				     int filename_length);
+static int Multrun_Dropped_Frame_Add(int image_index);
+static void Multrun_Dropped_Frame_List_Free(void);
+static struct Multrun_Cube_Struct *Multrun_Cube_Slot_Get(int rotation_number);
+static int Multrun_Cube_Plane_Done(struct Multrun_Cube_Struct *cube_slot);
+static void Multrun_Cube_Close_All(void);
+static int Multrun_Raw_Create(int do_standard,char ***filename_list,int *filename_count);
+static void Multrun_Raw_Close(void);
+static int Multrun_Stack_Write_All(char ***filename_list,int *filename_count);
+static int Multrun_Preallocate_Start(int do_standard);
+static void *Multrun_Preallocate_Thread(void *arg);
+static int Multrun_Preallocate_Filename_Get(int trigger_index,char *write_filename);
+static int Multrun_Preallocate_Claim(struct Moptop_Writer_Frame_Struct *frame);
+static void Multrun_Preallocate_Stop(void);
+static int Multrun_Rotator_Position_Backfill(char **filename_list,int filename_count,double exposure_length);
+static int Multrun_Rotator_Position_Backfill_Cube(char **filename_list,int filename_count,double exposure_length);
+static int Multrun_Rotator_Position_Backfill_Raw(double exposure_length);
+static int Multrun_Fits_Headers_Set(struct Moptop_Writer_Frame_Struct *frame);
+static int Multrun_Fits_Header_Template_Create(int do_standard,double exposure_length);
+static int Multrun_Fits_Headers_Patch(struct Moptop_Writer_Frame_Struct *frame,char *card_image_list);
+static int Multrun_Write_Fits_Image(struct Moptop_Writer_Frame_Struct *frame);
+static void Multrun_Reduce_Frame(struct Moptop_Writer_Frame_Struct *frame);
+static void Multrun_Calibrate_Frame(struct Moptop_Writer_Frame_Struct *frame);
+static void Multrun_Statistics_Frame(struct Moptop_Writer_Frame_Struct *frame);
+static int Multrun_Write_Fits_Image_Staged(struct Moptop_Writer_Frame_Struct *frame);
+static int Multrun_Write_Fits_Image_Cfitsio(struct Moptop_Writer_Frame_Struct *frame,char *filename,
+					    char *card_image_list,int ncols_binned,int nrows_binned);
+static int Multrun_Write_Fits_Cube_Plane(struct Moptop_Writer_Frame_Struct *frame);
+static int Multrun_Write_Raw_Frame(struct Moptop_Writer_Frame_Struct *frame);
+static void Multrun_Frame_Values_Get(struct Moptop_Writer_Frame_Struct *frame,double *value_list);
 /* ----------------------------------------------------------------------------
 ** 		external functions 
 ** ---------------------------------------------------------------------------- */
@@ -263,6 +570,56 @@ int Moptop_Multrun_Flip_Set(int flip_x,int flip_y)
 	return TRUE;
 }
 
+/**
+ * Routine to configure how the frames acquired by subsequent multruns are written to disk. 
+ * This cannot be changed whilst a multrun is in progress.
+ * @param output_mode A string, either "frame" (each frame is written to it's own FITS image), "cube" 
+ *        (the frames from each rotation of the rotator are written as the planes of one FITS cube, 
+ *        using the native FITS writer), "raw" (the frames are captured unconverted into one raw capture file,
+ *        to be converted into FITS images offline) or "stack" (the frames taken at each rotator position are
+ *        added together, and one 32 bit integer FITS image per rotator position is written at the end of the 
+ *        multrun).
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MULTRUN_OUTPUT_MODE
+ * @see #Multrun_Data
+ * @see #Multrun_In_Progress
+ * @see #Moptop_General_Error_Number
+ * @see #Moptop_General_Error_String
+ */
+int Moptop_Multrun_Output_Mode_Set(char *output_mode)
+{
+	if(output_mode == NULL)
+	{
+		Moptop_General_Error_Number = 666;
+		sprintf(Moptop_General_Error_String,"Moptop_Multrun_Output_Mode_Set: output_mode was NULL.");
+		return FALSE;
+	}
+	if(Multrun_In_Progress)
+	{
+		Moptop_General_Error_Number = 667;
+		sprintf(Moptop_General_Error_String,
+			"Moptop_Multrun_Output_Mode_Set: Cannot set output mode to '%s' whilst a multrun is in progress.",
+			output_mode);
+		return FALSE;
+	}
+	if(strcmp(output_mode,"frame") == 0)
+		Multrun_Data.Output_Mode = MULTRUN_OUTPUT_MODE_FRAME;
+	else if(strcmp(output_mode,"cube") == 0)
+		Multrun_Data.Output_Mode = MULTRUN_OUTPUT_MODE_CUBE;
+	else if(strcmp(output_mode,"raw") == 0)
+		Multrun_Data.Output_Mode = MULTRUN_OUTPUT_MODE_RAW;
+	else if(strcmp(output_mode,"stack") == 0)
+		Multrun_Data.Output_Mode = MULTRUN_OUTPUT_MODE_STACK;
+	else
+	{
+		Moptop_General_Error_Number = 668;
+		sprintf(Moptop_General_Error_String,"Moptop_Multrun_Output_Mode_Set: Unknown output mode '%s'.",
+			output_mode);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 /**
  * Routine to setup the Multrun.
  * <ul>
@@ -279,11 +636,32 @@ int Moptop_Multrun_Flip_Set(int flip_x,int flip_y)
  *     Multrun_Data.CCD_Temperature.
  * <li>We get and cache the current CCD temperature status string using CCD_Temperature_Get_Temperature_Status_String 
  *     to store the temperature in Multrun_Data.CCD_Temperature_Status_String.
- * <li>We set the PCO camera to use the current time by calling CCD_Command_Set_Camera_To_Current_Time.
- *     We must do this every multrun as the internal camera clocks drift with respect to real time, see Fault 2745.
+ * <li>We retrieve whether to reset the camera clock every multrun from the 'moptop.multrun.camera.clock.reset' config.
+ *     If so, we set the PCO camera to use the current time by calling CCD_Command_Set_Camera_To_Current_Time
+ *     (which also restarts the camera clock model). The internal camera clocks drift with respect to real time, 
+ *     see Fault 2745, but this is now normally corrected per-frame by the camera clock model, so the camera clock 
+ *     is only set at startup.
+ * <li>We retrieve the camera clock model's forgetting factor from the 
+ *     'moptop.multrun.camera.clock.model.forgetting_factor' config, and set it with 
+ *     CCD_Clock_Model_Forgetting_Factor_Set.
+ * <li>We retrieve the camera's read out and transfer delay from the 
+ *     'moptop.multrun.camera.clock.model.readout_delay' config, and set it with CCD_Clock_Model_Readout_Delay_Set.
  * <li>We configure whether to flip the output image data before writing to disk. We use Moptop_Config_Get_Boolean
  *     to retrieve the 'moptop.multrun.image.flip.x' and 'moptop.multrun.image.flip.y' config from the config file,
  *     and then call Moptop_Multrun_Flip_Set to set the flip flags for later use in the readout code.
+ * <li>We retrieve whether to use the native FITS writer (rather than CFITSIO) from the 
+ *     'moptop.multrun.writer.native.enable' config, and store it in Multrun_Data.Native_Fits_Writer.
+ * <li>We retrieve whether to Rice tile compress the FITS images from the 'moptop.multrun.writer.compress.enable'
+ *     config, and store it in Multrun_Data.Compress_Enable.
+ * <li>We retrieve whether to preallocate the multrun's output files from the 
+ *     'moptop.multrun.writer.preallocate.enable' config, and store it in Multrun_Data.Preallocate_Enable.
+ * <li>We retrieve whether to use the rotator's data recorder (rather than a per-frame rotator position query)
+ *     from the 'moptop.multrun.rotator.recorder.enable' config, and store it in Multrun_Data.Rotator_Recorder_Enable.
+ * <li>We retrieve whether to abort the multrun when a frame is dropped from the 
+ *     'moptop.multrun.dropped_frame.abort' config, and store it in Multrun_Data.Dropped_Frame_Abort.
+ * <li>We retrieve the number of times to retry waiting for a frame that has not arrived in time from the
+ *     'moptop.multrun.frame.timeout.retry.count' config, check it is not negative, and store it in 
+ *     Multrun_Data.Frame_Timeout_Retry_Count.
  * </ul>
  * @param multrun_number The address of an integer to store the multrun number we expect to use for this multrun.
  * @return The routine returns TRUE on success and FALSE on failure.
@@ -295,6 +673,8 @@ int Moptop_Multrun_Flip_Set(int flip_x,int flip_y)
  * @see moptop_general.html#Moptop_General_Error_String
  * @see moptop_config.html#Moptop_Config_Rotator_Is_Enabled
  * @see moptop_config.html#Moptop_Config_Filter_Wheel_Is_Enabled
+ * @see ../ccd/cdocs/ccd_clock_model.html#CCD_Clock_Model_Forgetting_Factor_Set
+ * @see ../ccd/cdocs/ccd_clock_model.html#CCD_Clock_Model_Readout_Delay_Set
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Set_Camera_To_Current_Time
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Next_Multrun
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Multrun_Get
@@ -308,7 +688,8 @@ int Moptop_Multrun_Flip_Set(int flip_x,int flip_y)
  */
 int Moptop_Multrun_Setup(int *multrun_number)
 {
-	int flip_x,flip_y;
+	double forgetting_factor,readout_delay;
+	int flip_x,flip_y,clock_reset;
 	
 	if(multrun_number == NULL)
 	{
@@ -376,13 +757,38 @@ int Moptop_Multrun_Setup(int *multrun_number)
 		sprintf(Moptop_General_Error_String,"Moptop_Multrun_Setup: Failed to get CCD temperature status string.");
 		return FALSE;		
 	}
-	/* set the camera's internal clock to the current system time.
-	** We do this for every multrun as the camera's internal clock drifts with respect to real time, see
-	** Fault #2745 for details */
-	if(!CCD_Command_Set_Camera_To_Current_Time())
+	/* The camera's internal clock drifts with respect to real time, see Fault #2745 for details.
+	** This is corrected per-frame by the camera clock model, so by default we no longer set the camera's
+	** internal clock to the current system time every multrun. */
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.camera.clock.reset",&clock_reset))
+		return FALSE;
+	if(clock_reset)
+	{
+		if(!CCD_Command_Set_Camera_To_Current_Time())
+		{
+			Moptop_General_Error_Number = 621;
+			sprintf(Moptop_General_Error_String,
+				"Moptop_Multrun_Setup: Failed to set the camera to the current time.");
+			return FALSE;
+		}
+	}
+	if(!Moptop_Config_Get_Double("moptop.multrun.camera.clock.model.forgetting_factor",&forgetting_factor))
+		return FALSE;
+	if(!CCD_Clock_Model_Forgetting_Factor_Set(forgetting_factor))
+	{
+		Moptop_General_Error_Number = 655;
+		sprintf(Moptop_General_Error_String,
+			"Moptop_Multrun_Setup: Failed to set the camera clock model forgetting factor to %.6f.",
+			forgetting_factor);
+		return FALSE;
+	}
+	if(!Moptop_Config_Get_Double("moptop.multrun.camera.clock.model.readout_delay",&readout_delay))
+		return FALSE;
+	if(!CCD_Clock_Model_Readout_Delay_Set(readout_delay))
 	{
-		Moptop_General_Error_Number = 621;
-		sprintf(Moptop_General_Error_String,"Moptop_Multrun_Setup: Failed to set the camera to the current time.");
+		Moptop_General_Error_Number = 699;
+		sprintf(Moptop_General_Error_String,
+			"Moptop_Multrun_Setup: Failed to set the camera clock model readout delay to %.6f.",readout_delay);
 		return FALSE;
 	}
 	/* configure flipping of output image */
@@ -391,6 +797,30 @@ int Moptop_Multrun_Setup(int *multrun_number)
 	if(!Moptop_Config_Get_Boolean("moptop.multrun.image.flip.y",&flip_y))
 		return FALSE;		
 	Moptop_Multrun_Flip_Set(flip_x,flip_y);
+	/* configure which FITS writer to use */
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.writer.native.enable",&(Multrun_Data.Native_Fits_Writer)))
+		return FALSE;
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.writer.compress.enable",&(Multrun_Data.Compress_Enable)))
+		return FALSE;
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.writer.preallocate.enable",&(Multrun_Data.Preallocate_Enable)))
+		return FALSE;
+	/* configure how the rotator end position of each frame is retrieved */
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.rotator.recorder.enable",
+				      &(Multrun_Data.Rotator_Recorder_Enable)))
+		return FALSE;
+	/* dropped frame policy */
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.dropped_frame.abort",&(Multrun_Data.Dropped_Frame_Abort)))
+		return FALSE;
+	if(!Moptop_Config_Get_Integer("moptop.multrun.frame.timeout.retry.count",
+				      &(Multrun_Data.Frame_Timeout_Retry_Count)))
+		return FALSE;
+	if(Multrun_Data.Frame_Timeout_Retry_Count < 0)
+	{
+		Moptop_General_Error_Number = 664;
+		sprintf(Moptop_General_Error_String,"Moptop_Multrun_Setup: Frame timeout retry count %d is negative.",
+			Multrun_Data.Frame_Timeout_Retry_Count);
+		return FALSE;
+	}
 	return TRUE;
 }
 
@@ -418,11 +848,17 @@ int Moptop_Multrun_Setup(int *multrun_number)
  * <li>We tell the camera to start responding to triggers by calling CCD_Command_Set_Recording_State(TRUE).
  * <li>If the rotator is enabled (Moptop_Config_Rotator_Is_Enabled):
  *     <ul>
+ *     <li>If Multrun_Data.Rotator_Recorder_Enable is TRUE, we arm the rotator's data recorder using 
+ *         PIROT_Recorder_Arm, to record the rotator position from the MOV command until the rotator reaches 
+ *         it's end position (plus MULTRUN_ROTATOR_RECORDER_MARGIN), and set Multrun_Data.Rotator_Recorder_Armed.
  *     <li>We enable the rotator hardware triggers using PIROT_Command_TRO.
  *     <li>We command the rotator to start moving towards it's end position using 
  *         PIROT_Command_MOV(rotator_end_position).
  *     </ul>
  * <li>We acquire the image date using  Multrun_Acquire_Images.
+ * <li>If acquiring the images failed, we close any FITS cubes still open using Multrun_Cube_Close_All,
+ *     and the raw capture file (if open) using Multrun_Raw_Close, and publish any files held back for the rotator
+ *     position back-fill using Moptop_Writer_Publish_Release.
  * <li>We stop the camera recording image by calling CCD_Command_Set_Recording_State(FALSE).
  * <li>We set the camera back to internal triggers by calling CCD_Command_Set_Trigger_Mode with parameter
  *     CCD_COMMAND_TRIGGER_MODE_INTERNAL.
@@ -445,6 +881,8 @@ int Moptop_Multrun_Setup(int *multrun_number)
  * @see #Moptop_Abort
  * @see #Multrun_In_Progress
  * @see #Multrun_Acquire_Images
+ * @see #Multrun_Cube_Close_All
+ * @see #Multrun_Raw_Close
  * @see moptop_general.html#Moptop_General_Log
  * @see moptop_general.html#Moptop_General_Log_Format
  * @see moptop_general.html#Moptop_General_Error_Number
@@ -460,6 +898,7 @@ int Moptop_Multrun_Setup(int *multrun_number)
  * @see ../pirot/cdocs/pirot_command.html#PIROT_Command_TRO
  * @see ../pirot/cdocs/pirot_command.html#PIROT_Command_MOV
  * @see ../pirot/cdocs/pirot_setup.html#PIROT_SETUP_ROTATOR_TOLERANCE
+ * @see ../pirot/cdocs/pirot_recorder.html#PIROT_Recorder_Arm
  */
 int Moptop_Multrun(int exposure_length_ms,int use_exposure_length,int exposure_count,int use_exposure_count,
 		   int do_standard,char ***filename_list,int *filename_count)
@@ -591,8 +1030,24 @@ int Moptop_Multrun(int exposure_length_ms,int use_exposure_length,int exposure_c
 		return FALSE;
 	}
 	/* only configure and move the rotator, this this is the C layer with it enabled */
+	Multrun_Data.Rotator_Recorder_Armed = FALSE;
 	if(Moptop_Config_Rotator_Is_Enabled())
 	{
+		/* record the rotator position from the MOV until the rotator reaches it's end position */
+		if(Multrun_Data.Rotator_Recorder_Enable)
+		{
+			if(!PIROT_Recorder_Arm((rotator_end_position/Moptop_Multrun_Rotator_Run_Velocity_Get())+
+					       MULTRUN_ROTATOR_RECORDER_MARGIN))
+			{
+				Multrun_In_Progress = FALSE;
+				CCD_Command_Set_Recording_State(FALSE);
+				CCD_Command_Set_Trigger_Mode(CCD_COMMAND_TRIGGER_MODE_INTERNAL);
+				Moptop_General_Error_Number = 658;
+				sprintf(Moptop_General_Error_String,"Moptop_Multrun:Failed to arm rotator data recorder.");
+				return FALSE;
+			}
+			Multrun_Data.Rotator_Recorder_Armed = TRUE;
+		}
 		/* enable rotator hardware trigger */
 		if(!PIROT_Command_TRO(TRUE))
 		{
@@ -624,6 +1079,11 @@ int Moptop_Multrun(int exposure_length_ms,int use_exposure_length,int exposure_c
 	retval = Multrun_Acquire_Images(do_standard,filename_list,filename_count);
 	if(retval == FALSE)
 	{
+		Multrun_Cube_Close_All();
+		Multrun_Raw_Close();
+		Multrun_Preallocate_Stop();
+		/* publish any files held back for the rotator position back-fill, with their provisional positions */
+		Moptop_Writer_Publish_Release(FALSE);
 		CCD_Command_Set_Recording_State(FALSE);
 		CCD_Command_Set_Trigger_Mode(CCD_COMMAND_TRIGGER_MODE_INTERNAL);
 		if(Moptop_Config_Rotator_Is_Enabled())
@@ -779,6 +1239,16 @@ int Moptop_Multrun_Exposure_Index_Get(void)
 	return Multrun_Data.Image_Index;
 }
 
+/**
+ * Return the number of frames dropped so far in the current (or last) multrun.
+ * @return The number of dropped frames.
+ * @see #Multrun_Data
+ */
+int Moptop_Multrun_Dropped_Frame_Count_Get(void)
+{
+	return Multrun_Data.Dropped_Frame_Count;
+}
+
 /**
  * Return the multrun number (in the generated FITS filenames) of this multrun.
  * @return The current multrun number.
@@ -983,30 +1453,88 @@ void Moptop_Multrun_Flip_Y(int ncols,int nrows,unsigned short *exposure_data)
  * <li>We check the filename_list and filename_count are not NULL and initialise them.
  * <li>We get the camera exposure length using CCD_Exposure_Length_Get.
  * <li>We calculate a timeout as being four times the length of time between two triggers.
- * <li>We loop over the Multrun_Data.Image_Count, using Multrun_Data.Image_Index as an index counter (for status reporting):
+ * <li>We compute the number of frames per rotation, and store it in Multrun_Data.Images_Per_Cycle.
+ * <li>We create the multrun FITS header template using Multrun_Fits_Header_Template_Create.
+ * <li>We setup the per-frame image statistics using Moptop_Statistics_Start.
+ * <li>We reset the multrun timing histograms using Moptop_Timing_Reset.
+ * <li>In raw output mode, we create the multrun's raw capture file, and add it to the filename list,
+ *     using Multrun_Raw_Create.
+ * <li>We start the writer threads using Moptop_Writer_Start, with Multrun_Write_Fits_Image as the write function.
+ * <li>We start preallocating the multrun's output files (if configured) using Multrun_Preallocate_Start.
+ * <li>We reset the list of dropped frames using Multrun_Dropped_Frame_List_Free.
+ * <li>We close any FITS cubes left open by a previous multrun using Multrun_Cube_Close_All.
+ * <li>We loop over the Multrun_Data.Image_Count, using Multrun_Data.Image_Index as the rotator trigger index
+ *     of the frame being acquired (also used for status reporting):
  *     <ul>
+ *     <li>We get a free frame (and it's associated image buffer) using Moptop_Writer_Frame_Get. 
+ *         This blocks if all the image buffers are waiting to be written to disk.
  *     <li>We take a timestamp and store it in Multrun_Data.Exposure_Start_Time.
  *     <li>If this is the first exposure in the multrun we set Multrun_Data.Multrun_Start_Time to the same timestamp.
- *     <li>We compute the theoretical rotator start angle (within a rotation) and store it in rotator_start_angle.
+ *     <li>We wait for a readout into the frame's image buffer by calling 
+ *         CCD_Command_Grabber_Acquire_Image_Async_Wait_Timeout with a timeout four times the time between two triggers.
+ *         If the wait times out, and Multrun_Data.Dropped_Frame_Abort is FALSE, we retry the wait up to
+ *         Multrun_Data.Frame_Timeout_Retry_Count times. If still no frame arrives, and some frames have already been 
+ *         acquired, the remaining triggers are added to the dropped frame list and we stop acquiring, 
+ *         otherwise the multrun fails.
+ *     <li>We get an exposure end timestamp and store it in the frame's Exposure_End_Time.
+ *     <li>We get the camera image number from the image metadata using CCD_Command_Get_Image_Number_From_Metadata.
+ *     <li>We get the camera image timestamp from the image metadata using CCD_Command_Get_Timestamp_From_Metadata.
+ *     <li>We add the camera timestamp and the exposure end timestamp (taken an exposure length after the camera 
+ *         timestamp) to the camera clock model using CCD_Clock_Model_Sample_Add.
+ *     <li>We convert the camera timestamp to a drift corrected UTC time and uncertainty using 
+ *         CCD_Clock_Model_Camera_To_UTC, and store them in the frame.
+ *     <li>We compute the frame's trigger index from the camera image number, relative to the camera image number of
+ *         the first frame. If it is ahead of Multrun_Data.Image_Index the skipped triggers are dropped frames: 
+ *         they are added to the dropped frame list using Multrun_Dropped_Frame_Add, and Multrun_Data.Image_Index 
+ *         is moved on to the trigger index. If Multrun_Data.Dropped_Frame_Abort is TRUE the multrun then fails.
+ *     <li>We compute the theoretical rotator start angle from the trigger index, 
+ *         and store it in requested_rotator_angle.
  *     <li>We compute which rotation we are on and store it in Multrun_Data.Rotation_Number.
  *     <li>We compute the image we are taking within the current rotation and store it in Multrun_Data.Sequence_Number.
- *     <li>We wait for a readout by calling CCD_Command_Grabber_Acquire_Image_Async_Wait_Timeout with a timeout
- *         four times the time between two triggers.
- *     <li>If the rotator is configured (Moptop_Config_Rotator_Is_Enabled) we retrieve the actual final rotator 
+ *     <li>If the rotator's data recorder was armed (Multrun_Data.Rotator_Recorder_Armed), we make no rotator
+ *         I/O, and compute a provisional rotator_difference and rotator_end_angle from the rotator run velocity
+ *         and exposure length. These are replaced by Multrun_Rotator_Position_Backfill at the end of the multrun.
+ *     <li>Otherwise if the rotator is configured (Moptop_Config_Rotator_Is_Enabled) we retrieve the actual final rotator 
  *         position using PIROT_Command_Query_POS, and use it compute the rotator_difference and the
  *         rotator_end_angle (the curent position in the current rotation).
  *     <li>If the rotator is _not_ configured  we compute a theoretical rotator_difference and rotator_end_angle.
- *     <li>We get the camera image number from the image metadata using CCD_Command_Get_Image_Number_From_Metadata.
- *     <li>We get the camera image timestamp from the image metadata using CCD_Command_Get_Timestamp_From_Metadata.
- *     <li>We get an exposure end timestamp and store it in exposure_end_time.
- *     <li>We call Multrun_Get_Fits_Filename to generate a new FITS filename.
- *     <li>We call Multrun_Write_Fits_Image to write the image data to the generated FITS filename.
- *     <li>We add the generated filename to the filename list using CCD_Fits_Filename_List_Add.
- *     <li>We increment requested_rotator_angle to the theoretical rotator start angle of the next image.
+ *     <li>We call Multrun_Get_Fits_Filename to generate a new FITS filename, skipping the filenames of any
+ *         dropped frames.
+ *     <li>We add the generated filename to the filename list using CCD_Fits_Filename_List_Add. In cube output mode
+ *         every frame in a rotation has the same (cube) filename, which is only added to the list once.
+ *         In raw output mode the filename is only stored in the frame's raw capture file record 
+ *         (the FITS image is written when the raw capture file is converted), so it is not added to the list.
+ *         In stack output mode the frame is added to it's rotator position's stack, so it is not added to 
+ *         the list either.
+ *     <li>We queue the frame using Moptop_Writer_Frame_Queue. One of the writer threads calls Multrun_Write_Fits_Image
+ *         to write the image data to the generated FITS filename, whilst we wait for the next frame.
  *     <li>We check whether the multrun has been aborted (Moptop_Abort).
  *     </ul>
- * <li>
+ * <li>If the rotator's data recorder was armed (Multrun_Data.Rotator_Recorder_Armed) in frame or cube output mode,
+ *     we hold back publishing the written files (Moptop_Writer_Publish_Hold) until their rotator positions have
+ *     been back-filled.
+ * <li>We call Moptop_Writer_Stop to wait for any queued frames to be written to disk, and stop the writer threads. 
+ *     This is also done if the acquisition fails or is aborted, without overwriting the acquisition error.
+ * <li>We close any FITS cubes that are still open (if the last rotation is incomplete) using Multrun_Cube_Close_All.
+ * <li>We write one stacked FITS image per rotator position (in stack output mode), and add them to the filename
+ *     list, using Multrun_Stack_Write_All.
+ * <li>We stop preallocating output files, and remove any unused preallocated files, using Multrun_Preallocate_Stop.
+ * <li>We log the number of file system metadata system calls used to publish the FITS images 
+ *     (CCD_Fits_Filename_Publish_Syscall_Count_Get), and the number of dropped frames, if any.
+ * <li>If the rotator's data recorder was armed (Multrun_Data.Rotator_Recorder_Armed), we call
+ *     Multrun_Rotator_Position_Backfill to update MOPREND/MOPRARC in the written (but unpublished) FITS images,
+ *     or the frames stored in the raw capture file, with the recorded rotator positions. A failure to do so is 
+ *     logged, but does not fail the multrun. This is not done in stack output mode, where the stacked images 
+ *     keep their provisional rotator end angles.
+ * <li>We close the raw capture file (in raw output mode) using Multrun_Raw_Close.
+ * <li>We publish any held files using Moptop_Writer_Publish_Release. If the multrun fails before this, 
+ *     Moptop_Multrun releases them instead.
+ * <li>We call Moptop_Timing_Summary_Write to write a summary of the multrun timing histograms (if configured). 
+ *     A failure to do so is logged, but does not fail the multrun.
  * </ul>
+ * The time spent in the frame get, grabber wait, rotator query and metadata decode, and the interval between frames,
+ * are added to the multrun timing histograms (Moptop_Timing_Add), so they can be retrieved using 
+ * "status timing multrun".
  * @param do_standard A boolean, if TRUE this is an observation of a standard, otherwise it is not.
  * @param filename_list The address of a list of filenames of FITS images acquired during this multrun.
  * @param filename_count The address of an integer to store the number of FITS images in filename_list.
@@ -1016,13 +1544,37 @@ void Moptop_Multrun_Flip_Y(int ncols,int nrows,unsigned short *exposure_data)
  * @see #Moptop_Multrun_Rotator_Step_Angle_Get
  * @see #Moptop_Multrun_Rotator_Run_Velocity_Get
  * @see #Multrun_Get_Fits_Filename
+ * @see #Multrun_Dropped_Frame_Add
+ * @see #Multrun_Dropped_Frame_List_Free
+ * @see #Multrun_Cube_Close_All
+ * @see #Multrun_Raw_Create
+ * @see #Multrun_Raw_Close
+ * @see #Multrun_Stack_Write_All
+ * @see #Multrun_Preallocate_Start
+ * @see #Multrun_Preallocate_Stop
+ * @see #Multrun_Fits_Header_Template_Create
+ * @see moptop_statistics.html#Moptop_Statistics_Start
  * @see #Multrun_Write_Fits_Image
+ * @see #Multrun_Rotator_Position_Backfill
+ * @see #Multrun_Data
  * @see moptop_general.html#Moptop_General_Log
  * @see moptop_general.html#Moptop_General_Log_Format
  * @see moptop_general.html#Moptop_General_Error_Number
  * @see moptop_general.html#Moptop_General_Error_String
  * @see moptop_config.html#Moptop_Config_Rotator_Is_Enabled
- * @see ../ccd/cdocs/ccd_buffer.html#CCD_Buffer_Get_Image_Buffer
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_writer.html#Moptop_Writer_Start
+ * @see moptop_writer.html#Moptop_Writer_Frame_Get
+ * @see moptop_writer.html#Moptop_Writer_Frame_Put
+ * @see moptop_writer.html#Moptop_Writer_Frame_Queue
+ * @see ../ccd/cdocs/ccd_clock_model.html#CCD_Clock_Model_Sample_Add
+ * @see ../ccd/cdocs/ccd_clock_model.html#CCD_Clock_Model_Camera_To_UTC
+ * @see moptop_writer.html#Moptop_Writer_Stop
+ * @see moptop_writer.html#Moptop_Writer_Publish_Hold
+ * @see moptop_writer.html#Moptop_Writer_Publish_Release
+ * @see moptop_timing.html#Moptop_Timing_Reset
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_timing.html#Moptop_Timing_Summary_Write
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Grabber_Acquire_Image_Async_Wait_Timeout
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Get_Image_Number_From_Metadata
  * @see ../ccd/cdocs/ccd_command.html#CCD_Command_Get_Timestamp_From_Metadata
@@ -1033,15 +1585,17 @@ void Moptop_Multrun_Flip_Y(int ncols,int nrows,unsigned short *exposure_data)
  */
 static int Multrun_Acquire_Images(int do_standard,char ***filename_list,int *filename_count)
 {
-	struct timespec exposure_end_time,camera_timestamp;
-	char filename[MULTRUN_FITS_FILENAME_LENGTH];
+	struct Moptop_Writer_Frame_Struct *frame = NULL;
+	struct timespec start_time,end_time,last_readout_time;
 	unsigned int timeout_ms;
 	double requested_rotator_angle = 0.0;
-	double rotator_start_angle,current_rotator_position,rotator_difference,rotator_end_angle;
-	double camera_clock_difference;
+	double current_rotator_position;
 	double pco_exposure_length_s;
-	int camera_image_number;
-	int images_per_cycle;
+	int images_per_cycle,retval,timeout_count,trigger_index;
+	int first_camera_image_number = 0;
+	int skip_count = 0;
+	int acquired_count = 0;
+	int publish_syscall_count;
 	
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Acquire_Images",LOG_VERBOSITY_INTERMEDIATE,
@@ -1080,91 +1634,360 @@ static int Multrun_Acquire_Images(int do_standard,char ***filename_list,int *fil
 				  "MULTRUN","Using acquire timeout of %d ms.",timeout_ms);
 #endif
 	images_per_cycle = (int)(360.0 / Moptop_Multrun_Rotator_Step_Angle_Get());
-	/* acquire frames */
+	Multrun_Data.Images_Per_Cycle = images_per_cycle;
+	/* pre-format the FITS headers that don't change during this multrun */
+	if(!Multrun_Fits_Header_Template_Create(do_standard,pco_exposure_length_s))
+		return FALSE;
+	/* setup the per-frame image statistics */
+	if(!Moptop_Statistics_Start())
+		return FALSE;
+	/* setup the real time reduction of each rotation, if configured */
+	if(!Moptop_Reduce_Start(images_per_cycle,Multrun_Data.Image_Count,
+				CCD_Setup_Get_Sensor_Width()/CCD_Setup_Get_Binning(),
+				CCD_Setup_Get_Sensor_Height()/CCD_Setup_Get_Binning(),
+				Moptop_Multrun_Rotator_Step_Angle_Get(),Moptop_Multrun_Rotator_Run_Velocity_Get(),
+				pco_exposure_length_s))
+		return FALSE;
+	/* reset the per rotator position stacks, in stack output mode */
+	if(Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_STACK)
+	{
+		if(!Moptop_Stack_Start(images_per_cycle,Multrun_Data.Image_Count,
+				       CCD_Setup_Get_Sensor_Width()/CCD_Setup_Get_Binning(),
+				       CCD_Setup_Get_Sensor_Height()/CCD_Setup_Get_Binning()))
+			return FALSE;
+	}
+	/* setup the real time calibration of each frame, if configured */
+	if(!Moptop_Calibrate_Start(CCD_Setup_Get_Sensor_Width()/CCD_Setup_Get_Binning(),
+				   CCD_Setup_Get_Sensor_Height()/CCD_Setup_Get_Binning(),
+				   Multrun_Data.Flip_X,Multrun_Data.Flip_Y,pco_exposure_length_s))
+		return FALSE;
+	/* reset the per-frame timing histograms for this multrun */
+	if(!Moptop_Timing_Reset(MOPTOP_TIMING_SET_MULTRUN))
+		return FALSE;
+	/* reset the list of dropped frames for this multrun */
+	Multrun_Dropped_Frame_List_Free();
+	Multrun_Cube_Close_All();
+	publish_syscall_count = CCD_Fits_Filename_Publish_Syscall_Count_Get();
+	/* create the multrun's raw capture file, in raw output mode */
+	if(!Multrun_Raw_Create(do_standard,filename_list,filename_count))
+		return FALSE;
+	/* start the thread that writes the acquired frames to disk */
+	if(!Moptop_Writer_Start(Multrun_Write_Fits_Image,MOPTOP_TIMING_SET_MULTRUN,images_per_cycle))
+		return FALSE;
+	/* the frames' provisional rotator end angles are back-filled at the end of the multrun,
+	** so they must not be published before then */
+	if(Multrun_Data.Rotator_Recorder_Armed&&((Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_FRAME)||
+						 (Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_CUBE)))
+	{
+		if(!Moptop_Writer_Publish_Hold())
+		{
+			Moptop_Writer_Stop(FALSE);
+			return FALSE;
+		}
+	}
+	/* create and preallocate the multrun's output files in the background, if configured.
+	** This is done after the writer is started, as preallocation is not used when frames are staged in memory. */
+	if(!Multrun_Preallocate_Start(do_standard))
+	{
+		Moptop_Writer_Stop(FALSE);
+		return FALSE;
+	}
+	/* acquire frames. Multrun_Data.Image_Index is the rotator trigger index of the frame being acquired,
+	** and is moved on past any frames the camera image number shows were dropped. */
 	for(Multrun_Data.Image_Index=0;Multrun_Data.Image_Index < Multrun_Data.Image_Count; Multrun_Data.Image_Index++)
 	{
+		/* get a free frame/image buffer to read out into. 
+		** This blocks if all the image buffers are waiting to be written to disk */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!Moptop_Writer_Frame_Get(&frame))
+		{
+			/* report the writer threads' error, if one has failed */
+			Moptop_Writer_Stop(TRUE);
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FRAME_GET,start_time,end_time);
+		frame->Do_Standard = do_standard;
+		frame->Exposure_Length = pco_exposure_length_s;
 		/* get exposure start timestamp */
 		clock_gettime(CLOCK_REALTIME,&(Multrun_Data.Exposure_Start_Time));
+		frame->Exposure_Start_Time = Multrun_Data.Exposure_Start_Time;
 		/* If this is the first exposure in the multrun, 
 		** the exposure start time is also the multrun start time. */
-		if(Multrun_Data.Image_Index == 0)
+		if(acquired_count == 0)
 			Multrun_Data.Multrun_Start_Time = Multrun_Data.Exposure_Start_Time;
-		rotator_start_angle = fmod(requested_rotator_angle, 360.0);
-		Multrun_Data.Rotation_Number = (Multrun_Data.Image_Index / images_per_cycle) + 1;
-		Multrun_Data.Sequence_Number = (Multrun_Data.Image_Index % images_per_cycle) + 1;
-		/* get an acquired image buffer */
-		if(!CCD_Command_Grabber_Acquire_Image_Async_Wait_Timeout(CCD_Buffer_Get_Image_Buffer(),timeout_ms))
+		/* get an acquired image buffer. Retry a timed out wait if the dropped frame policy allows it. */
+		timeout_count = 0;
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		do
+		{
+			retval = CCD_Command_Grabber_Acquire_Image_Async_Wait_Timeout(frame->Image_Buffer,timeout_ms);
+			if(retval == FALSE)
+			{
+				timeout_count++;
+#if MOPTOP_DEBUG > 1
+				Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Acquire_Images",
+							  LOG_VERBOSITY_TERSE,"MULTRUN",
+							  "Frame %d of %d not retrieved after %d waits of %d ms.",
+							  Multrun_Data.Image_Index,Multrun_Data.Image_Count,timeout_count,
+							  timeout_ms);
+#endif
+			}
+		} while((retval == FALSE)&&(Multrun_Data.Dropped_Frame_Abort == FALSE)&&
+			(timeout_count <= Multrun_Data.Frame_Timeout_Retry_Count)&&(Moptop_Abort == FALSE));
+		if(retval == FALSE)
 		{
+			Moptop_Writer_Frame_Put(frame);
+			/* If we are allowed to continue with dropped frames, and have some frames, assume no more frames are
+			** coming and keep the frames we have. */
+			if((Multrun_Data.Dropped_Frame_Abort == FALSE)&&(Moptop_Abort == FALSE)&&(acquired_count > 0))
+			{
+				for(;Multrun_Data.Image_Index < Multrun_Data.Image_Count; Multrun_Data.Image_Index++)
+				{
+					if(!Multrun_Dropped_Frame_Add(Multrun_Data.Image_Index))
+					{
+						Moptop_Writer_Stop(FALSE);
+						return FALSE;
+					}
+				}
+				break;
+			}
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 611;
 			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:Failed to retrieve image buffer.");
 			return FALSE;
 		}
-		if(Moptop_Config_Rotator_Is_Enabled())
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_GRABBER_WAIT,start_time,end_time);
+		/* get exposure end timestamp, as soon as the frame has been read out */
+		clock_gettime(CLOCK_REALTIME,&(frame->Exposure_End_Time));
+		/* time between successive readouts */
+		if(acquired_count > 0)
+		{
+			Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FRAME_INTERVAL,last_readout_time,
+					  end_time);
+		}
+		last_readout_time = end_time;
+		frame->Image_Buffer_Length = CCD_Setup_Get_Image_Size_Bytes();
+		/* get camera image number */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Command_Get_Image_Number_From_Metadata(frame->Image_Buffer,frame->Image_Buffer_Length,
+							       &(frame->Camera_Image_Number)))
+		{
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
+			Moptop_General_Error_Number = 614;
+			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
+				"Failed to get image_number from metadata.");
+			return FALSE;
+		}
+		/* get camera timestamp */
+		if(!CCD_Command_Get_Timestamp_From_Metadata(frame->Image_Buffer,frame->Image_Buffer_Length,
+							    &(frame->Camera_Timestamp)))
+		{
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
+			Moptop_General_Error_Number = 622;
+			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
+				"Failed to get timestamp from metadata.");
+			return FALSE;
+		}
+		/* update the camera clock model, and use it to correct the camera timestamp for clock drift */
+		if(!CCD_Clock_Model_Sample_Add(frame->Camera_Timestamp,frame->Exposure_End_Time,frame->Exposure_Length))
+		{
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
+			Moptop_General_Error_Number = 656;
+			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
+				"Failed to add camera timestamp to the camera clock model.");
+			return FALSE;
+		}
+		if(!CCD_Clock_Model_Camera_To_UTC(frame->Camera_Timestamp,&(frame->Camera_UTC_Time),
+						  &(frame->Camera_UTC_Uncertainty)))
+		{
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
+			Moptop_General_Error_Number = 657;
+			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
+				"Failed to convert camera timestamp to UTC.");
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_METADATA_DECODE,start_time,end_time);
+		/* The camera image number increments once per trigger, so use it (relative to the first frame)
+		** as the trigger index of this frame. Any triggers we have skipped over are dropped frames. */
+		if(acquired_count == 0)
+			first_camera_image_number = frame->Camera_Image_Number-Multrun_Data.Image_Index;
+		trigger_index = frame->Camera_Image_Number-first_camera_image_number;
+		if((trigger_index < Multrun_Data.Image_Index)||(trigger_index >= Multrun_Data.Image_Count))
+		{
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
+			Moptop_General_Error_Number = 662;
+			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
+				"Camera image number %d (trigger index %d) out of sequence (expected %d..%d).",
+				frame->Camera_Image_Number,trigger_index,Multrun_Data.Image_Index,
+				Multrun_Data.Image_Count-1);
+			return FALSE;
+		}
+		skip_count = trigger_index-Multrun_Data.Image_Index;
+		if(skip_count > 0)
+		{
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Acquire_Images",
+						  LOG_VERBOSITY_TERSE,"MULTRUN",
+						  "Camera image number %d: %d frames dropped before trigger index %d.",
+						  frame->Camera_Image_Number,skip_count,trigger_index);
+#endif
+			for(;Multrun_Data.Image_Index < trigger_index; Multrun_Data.Image_Index++)
+			{
+				if(!Multrun_Dropped_Frame_Add(Multrun_Data.Image_Index))
+				{
+					Moptop_Writer_Frame_Put(frame);
+					Moptop_Writer_Stop(FALSE);
+					return FALSE;
+				}
+			}
+			if(Multrun_Data.Dropped_Frame_Abort)
+			{
+				Moptop_Writer_Frame_Put(frame);
+				Moptop_Writer_Stop(FALSE);
+				Moptop_General_Error_Number = 663;
+				sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
+					"%d frames dropped before camera image number %d (trigger index %d).",
+					skip_count,frame->Camera_Image_Number,trigger_index);
+				return FALSE;
+			}
+		}
+		/* compute the theoretical rotator start angle, rotation and image in the rotation from the trigger index */
+		frame->Image_Index = Multrun_Data.Image_Index;
+		frame->Dropped_Frame_Count = Multrun_Data.Dropped_Frame_Count;
+		requested_rotator_angle = Multrun_Data.Image_Index*Moptop_Multrun_Rotator_Step_Angle_Get();
+		frame->Requested_Rotator_Angle = requested_rotator_angle;
+		frame->Rotator_Start_Angle = fmod(requested_rotator_angle, 360.0);
+		Multrun_Data.Rotation_Number = (Multrun_Data.Image_Index / images_per_cycle) + 1;
+		Multrun_Data.Sequence_Number = (Multrun_Data.Image_Index % images_per_cycle) + 1;
+		frame->Rotation_Number = Multrun_Data.Rotation_Number;
+		frame->Sequence_Number = Multrun_Data.Sequence_Number;
+		if(Multrun_Data.Rotator_Recorder_Armed)
+		{
+			/* provisional rotator end angle, back-filled from the rotator's data recorder 
+			** at the end of the multrun */
+			frame->Rotator_Difference = Moptop_Multrun_Rotator_Run_Velocity_Get()*pco_exposure_length_s;
+			frame->Rotator_End_Angle = fmod(requested_rotator_angle+frame->Rotator_Difference,360.0);
+		}
+		else if(Moptop_Config_Rotator_Is_Enabled())
 		{
 			/* get final rotator angle */
+			clock_gettime(CLOCK_MONOTONIC,&start_time);
 			if(!PIROT_Command_Query_POS(&current_rotator_position))
 			{
+				Moptop_Writer_Frame_Put(frame);
+				Moptop_Writer_Stop(FALSE);
 				Moptop_General_Error_Number = 612;
 				sprintf(Moptop_General_Error_String,
 					"Multrun_Acquire_Images:Failed to query rotator position.");
 				return FALSE;
 			}
-			rotator_difference = current_rotator_position-requested_rotator_angle;
-			rotator_end_angle = fmod(current_rotator_position, 360.0);
+			clock_gettime(CLOCK_MONOTONIC,&end_time);
+			Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_ROTATOR_QUERY,start_time,end_time);
+			frame->Rotator_Difference = current_rotator_position-requested_rotator_angle;
+			frame->Rotator_End_Angle = fmod(current_rotator_position, 360.0);
 		}
 		else
 		{
 			/* emulate what the rotator angle should be */
-			rotator_difference = Moptop_Multrun_Rotator_Step_Angle_Get();
-			rotator_end_angle = fmod(requested_rotator_angle+Moptop_Multrun_Rotator_Step_Angle_Get(),360.0);
+			frame->Rotator_Difference = Moptop_Multrun_Rotator_Step_Angle_Get();
+			frame->Rotator_End_Angle = fmod(requested_rotator_angle+Moptop_Multrun_Rotator_Step_Angle_Get(),
+							360.0);
 		}
-		/* get camera image number */
-		if(!CCD_Command_Get_Image_Number_From_Metadata(CCD_Buffer_Get_Image_Buffer(),
-							       CCD_Setup_Get_Image_Size_Bytes(),&camera_image_number))
+		/* generate a new filename for this FITS image */
+		if(!Multrun_Get_Fits_Filename(images_per_cycle,skip_count,do_standard,frame->Filename,
+					      MULTRUN_FITS_FILENAME_LENGTH))
 		{
-			Moptop_General_Error_Number = 614;
-			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
-				"Failed to get image_number from metadata.");
+			Moptop_Writer_Frame_Put(frame);
+			Moptop_Writer_Stop(FALSE);
 			return FALSE;
 		}
-		/* get camera timestamp */
-		if(!CCD_Command_Get_Timestamp_From_Metadata(CCD_Buffer_Get_Image_Buffer(),
-							    CCD_Setup_Get_Image_Size_Bytes(),&camera_timestamp))
+		/* add fits image to list. In cube output mode, each rotation's cube is only added once.
+		** In raw output mode, only the raw capture file is in the list. In stack output mode,
+		** the stacked images are added to the list when they are written, at the end of the multrun. */
+		if((Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_FRAME)||
+		   ((Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_CUBE)&&(((*filename_count) == 0)||
+		    (strcmp((*filename_list)[(*filename_count)-1],frame->Filename) != 0))))
 		{
-			Moptop_General_Error_Number = 622;
-			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
-				"Failed to get timestamp from metadata.");
-			return FALSE;
+			if(!CCD_Fits_Filename_List_Add(frame->Filename,filename_list,filename_count))
+			{
+				Moptop_Writer_Frame_Put(frame);
+				Moptop_Writer_Stop(FALSE);
+				Moptop_General_Error_Number = 623;
+				sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
+					"Failed to add filename '%s' to list of filenames (count = %d).",
+					frame->Filename,(*filename_count));
+				return FALSE;
+			}
 		}
-		/* get exposure end timestamp */
-		clock_gettime(CLOCK_REALTIME,&exposure_end_time);
-		/* generate a new filename for this FITS image */
-		Multrun_Get_Fits_Filename(images_per_cycle,do_standard,filename,MULTRUN_FITS_FILENAME_LENGTH);
-		/* write fits image */
-		Multrun_Write_Fits_Image(do_standard,pco_exposure_length_s,exposure_end_time,
-					 camera_image_number,camera_timestamp,
-					 requested_rotator_angle,rotator_start_angle,rotator_end_angle,
-					 rotator_difference,
-					 CCD_Buffer_Get_Image_Buffer(),CCD_Setup_Get_Image_Size_Bytes(),filename);
-		/* add fits image to list */
-		if(!CCD_Fits_Filename_List_Add(filename,filename_list,filename_count))
+		/* pass the frame to the writer threads, to write the fits image */
+		if(!Moptop_Writer_Frame_Queue(frame))
 		{
-			Moptop_General_Error_Number = 623;
-			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:"
-				"Failed to add filename '%s' to list of filenames (count = %d).",
-				filename,(*filename_count));
+			Moptop_Writer_Stop(FALSE);
 			return FALSE;
 		}
-		/* increment theoretical start rotator angle of next exposure */
-		requested_rotator_angle += Moptop_Multrun_Rotator_Step_Angle_Get();
+		acquired_count++;
 		/* check for abort */
 		if(Moptop_Abort)
 		{
+			Moptop_Writer_Stop(FALSE);
 			Moptop_General_Error_Number = 613;
 			sprintf(Moptop_General_Error_String,"Multrun_Acquire_Images:Multrun Aborted.");
 			return FALSE;
 		}
 	}/* end for on Multrun_Data.Image_Index / Multrun_Data.Image_Count */
+	/* wait for the writer threads to write any queued frames to disk */
+	if(!Moptop_Writer_Stop(TRUE))
+		return FALSE;
+	/* close any cubes with missing planes */
+	Multrun_Cube_Close_All();
+	Moptop_Reduce_Stop();
+	/* write the stacked image for each rotator position, in stack output mode */
+	if(!Multrun_Stack_Write_All(filename_list,filename_count))
+	{
+		Multrun_Preallocate_Stop();
+		return FALSE;
+	}
+	/* remove any preallocated files that were not used (dropped frames) */
+	Multrun_Preallocate_Stop();
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Acquire_Images",LOG_VERBOSITY_VERBOSE,
+				  "MULTRUN","Publishing %d files used %d file system metadata calls (publish mode %d).",
+				  (*filename_count),CCD_Fits_Filename_Publish_Syscall_Count_Get()-publish_syscall_count,
+				  CCD_Fits_Filename_Publish_Mode_Get());
+	if(Multrun_Data.Dropped_Frame_Count > 0)
+	{
+		Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Acquire_Images",LOG_VERBOSITY_TERSE,
+					  "MULTRUN","%d of %d frames were dropped.",Multrun_Data.Dropped_Frame_Count,
+					  Multrun_Data.Image_Count);
+	}
+#endif
+	/* replace the provisional rotator end angles with the recorded ones, before the (held) files are published,
+	** or the raw capture file is closed. Failing to do so should not fail the multrun. 
+	** The stacked images (which hold many frames) are not updated. */
+	if(Multrun_Data.Rotator_Recorder_Armed&&(Multrun_Data.Output_Mode != MULTRUN_OUTPUT_MODE_STACK))
+	{
+		if(!Multrun_Rotator_Position_Backfill((*filename_list),(*filename_count),pco_exposure_length_s))
+			Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Acquire_Images",
+					     LOG_VERBOSITY_TERSE,"MULTRUN");
+	}
+	Multrun_Raw_Close();
+	if(!Moptop_Writer_Publish_Release(TRUE))
+		return FALSE;
+	/* write a per-multrun timing summary, if configured. Failing to do so should not fail the multrun. */
+	if((*filename_count) > 0)
+	{
+		if(!Moptop_Timing_Summary_Write(MOPTOP_TIMING_SET_MULTRUN,(*filename_list)[0]))
+			Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Acquire_Images",
+					     LOG_VERBOSITY_TERSE,"MULTRUN");
+	}
 #if MOPTOP_DEBUG > 1
 	Moptop_General_Log("multrun","moptop_multrun.c","Multrun_Acquire_Images",LOG_VERBOSITY_INTERMEDIATE,
 				  "MULTRUN","finished.");
@@ -1175,19 +1998,25 @@ static int Multrun_Acquire_Images(int do_standard,char ***filename_list,int *fil
 /**
  * Generate the next FITS filename to write image data into.
  * <ul>
- * <li>Increment the window number by calling CCD_Fits_Filename_Next_Window.
- * <li>If the current window number (CCD_Fits_Filename_Window_Get) is greater than images_per_cycle, we must
- *     have started another rotation of the rotator.
+ * <li>We loop skip_count+1 times, so the run/window numbers of any dropped frames are not used:
  *     <ul>
- *     <li>Increment the run number (rotation number) by calling CCD_Fits_Filename_Next_Run. This resets the
- *         window number to zero.
- *     <li>Increment the window number back to one using CCD_Fits_Filename_Next_Window.
+ *     <li>Increment the window number by calling CCD_Fits_Filename_Next_Window.
+ *     <li>If the current window number (CCD_Fits_Filename_Window_Get) is greater than images_per_cycle, we must
+ *         have started another rotation of the rotator.
+ *         <ul>
+ *         <li>Increment the run number (rotation number) by calling CCD_Fits_Filename_Next_Run. This resets the
+ *             window number to zero.
+ *         <li>Increment the window number back to one using CCD_Fits_Filename_Next_Window.
+ *         </ul>
  *     </ul>
- * <li>Generate an unreduced FITS filename by calling CCD_Fits_Filename_Get_Filename.
+ * <li>Generate an unreduced FITS filename by calling CCD_Fits_Filename_Get_Filename. In cube output mode, we generate
+ *     the rotation's cube filename instead, by calling CCD_Fits_Filename_Get_Run_Filename.
  * </ul>
  * @param images_per_cycle The number of images we generate for a full rotation of the rotator.
  *        If the incremented window number is greater than this number, we reset the window number to one
  *        and increment the run number (rotation number).
+ * @param skip_count The number of dropped frames since the last filename was generated. The filename
+ *        of each dropped frame is skipped, so a frame's filename always reflects the rotator position it was taken at.
  * @param do_standard A boolean, if TRUE this is an observation of a standard, otherwise it is not.
  * @param filename A previously allocated string to write the generated FITS image filename into.
  * @param filename_length The length of the filename buffer to store a filename in characters.
@@ -1199,27 +2028,42 @@ static int Multrun_Acquire_Images(int do_standard,char ***filename_list,int *fil
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Next_Window
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Next_Run
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Get_Filename
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Get_Run_Filename
  * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Window_Get
  */
-static int Multrun_Get_Fits_Filename(int images_per_cycle,int do_standard,char *filename,int filename_length)
+static int Multrun_Get_Fits_Filename(int images_per_cycle,int skip_count,int do_standard,char *filename,
+				     int filename_length)
 {
 	enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type;
+	int i,retval;
 
-	/* increment the window number */
-	CCD_Fits_Filename_Next_Window();
-	/* if the window number is greater than the number of images we generate for a full rotation of the rotator,
-	** we reset the window number to one and increment the run number (rotation number).*/
-	if(CCD_Fits_Filename_Window_Get() > images_per_cycle)
+	for(i = 0; i <= skip_count; i++)
 	{
-		CCD_Fits_Filename_Next_Run();
+		/* increment the window number */
 		CCD_Fits_Filename_Next_Window();
+		/* if the window number is greater than the number of images we generate for a full rotation of the 
+		** rotator, we reset the window number to one and increment the run number (rotation number).*/
+		if(CCD_Fits_Filename_Window_Get() > images_per_cycle)
+		{
+			CCD_Fits_Filename_Next_Run();
+			CCD_Fits_Filename_Next_Window();
+		}
 	}
 	if(do_standard)
 		exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_STANDARD;
 	else
 		exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_EXPOSURE;
-	if(!CCD_Fits_Filename_Get_Filename(exposure_type,CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,
-					   filename,filename_length))
+	if(Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_CUBE)
+	{
+		retval = CCD_Fits_Filename_Get_Run_Filename(exposure_type,CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,
+							    filename,filename_length);
+	}
+	else
+	{
+		retval = CCD_Fits_Filename_Get_Filename(exposure_type,CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,
+							filename,filename_length);
+	}
+	if(retval == FALSE)
 	{
 		Moptop_General_Error_Number = 625;
 		sprintf(Moptop_General_Error_String,"Multrun_Get_Fits_Filename:Getting filename failed.");
@@ -1233,269 +2077,2061 @@ static int Multrun_Get_Fits_Filename(int images_per_cycle,int do_standard,char *
 }
 
 /**
- * Write the FITS image to disk.
- * <ul>
- * <li>We set the "OBSTYPE" FITS keyword value based on the value of do_standard.
- * <li>We set the "FILTER1" FITS keyword value based on the cached filter name in Multrun_Data.Filter_Name.
- * <li>We set the "FILTERI1" FITS keyword value based on the cached filter name in Multrun_Data.Filter_Id.
- * <li>We set the "DATE"/"DATE-OBS"/"UTSTART" and "MJD" keyword values based on the value of Multrun_Data.Exposure_Start_Time.
- * <li>We set the "DATE-END" and "UTEND" keyword values based on the value of exposure_end_time.
- * <li>We set the "TELAPSE" keyword value based on the time elapsed between 
- *     Multrun_Data.Multrun_Start_Time and exposure_end_time.
- * <li>We set the "RUNNUM" keyword value to Multrun_Data.Rotation_Number.
- * <li>We set the "EXPNUM" keyword value to Multrun_Data.Sequence_Number.
- * <li>We set the "EXPTOTAL" keyword value to Multrun_Data.Image_Count.
- * <li>We set the "CCDXBIN"/"CCDYBIN" FITS keyword values based on CCD_Setup_Get_Binning. 
- * <li>We set the "CCDATEMP" FITS keyword value based on the cached CCD temperature stored in Multrun_Data.CCD_Temperature.
- * <li>We set the "TEMPSTAT" FITS keyword value based on the cached CCD temperature status stored in
+ * Add a rotator trigger index to the list of frames dropped during this multrun (Multrun_Data.Dropped_Frame_List).
+ * In cube output mode, the dropped frame's plane will never be written, so it is counted as done in it's 
+ * rotation's cube (Multrun_Cube_Plane_Done), so the cube is still closed when the rest of it's planes are written.
+ * In raw output mode, the dropped frame's slot in the raw capture file is never written, and so is skipped when
+ * the file is converted. In stack output mode, the dropped frame is simply not in it's rotator position's stack,
+ * and nothing is published until the end of the multrun.
+ * Otherwise the dropped frame is passed to Moptop_Writer_Publish with no filename, so if the writer durability policy
+ * publishes files a rotation at a time, the dropped frame's rotation is still published when the rest of it's
+ * frames are written.
+ * The dropped frame is also passed to Moptop_Reduce_Frame_Dropped, so it's rotation is not reduced. Failing to
+ * do so is logged, rather than failing the multrun.
+ * @param image_index The rotator trigger index (Image_Index) of the dropped frame. Frames must be added in 
+ *        increasing trigger index order.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Data
+ * @see #Multrun_Cube_Mutex
+ * @see #Multrun_Cube_Slot_Get
+ * @see #Multrun_Cube_Plane_Done
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ * @see moptop_reduce.html#Moptop_Reduce_Frame_Dropped
+ */
+static int Multrun_Dropped_Frame_Add(int image_index)
+{
+	struct Multrun_Cube_Struct *cube_slot = NULL;
+	int *new_list = NULL;
+	int retval;
+
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Dropped_Frame_Add",LOG_VERBOSITY_VERBOSE,
+				  "MULTRUN","Frame with trigger index %d dropped.",image_index);
+#endif
+	new_list = (int *)realloc(Multrun_Data.Dropped_Frame_List,(Multrun_Data.Dropped_Frame_Count+1)*sizeof(int));
+	if(new_list == NULL)
+	{
+		Moptop_General_Error_Number = 665;
+		sprintf(Moptop_General_Error_String,"Multrun_Dropped_Frame_Add:"
+			"Failed to reallocate dropped frame list (%d,%d).",image_index,Multrun_Data.Dropped_Frame_Count);
+		return FALSE;
+	}
+	Multrun_Data.Dropped_Frame_List = new_list;
+	Multrun_Data.Dropped_Frame_List[Multrun_Data.Dropped_Frame_Count] = image_index;
+	Multrun_Data.Dropped_Frame_Count++;
+	/* the dropped frame's rotation can no longer be reduced, but it's reduction slot must still be freed */
+	if(!Moptop_Reduce_Frame_Dropped((image_index/Multrun_Data.Images_Per_Cycle)+1))
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Dropped_Frame_Add",LOG_VERBOSITY_TERSE,
+				     "MULTRUN");
+	if(Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_CUBE)
+	{
+		pthread_mutex_lock(&Multrun_Cube_Mutex);
+		cube_slot = Multrun_Cube_Slot_Get((image_index/Multrun_Data.Images_Per_Cycle)+1);
+		if(cube_slot != NULL)
+			retval = Multrun_Cube_Plane_Done(cube_slot);
+		else
+			retval = FALSE;
+		pthread_mutex_unlock(&Multrun_Cube_Mutex);
+		return retval;
+	}
+	if((Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_RAW)||
+	   (Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_STACK))
+		return TRUE;
+	return Moptop_Writer_Publish(NULL,(image_index/Multrun_Data.Images_Per_Cycle)+1,1);
+}
+
+/**
+ * Free the list of frames dropped during the last multrun (Multrun_Data.Dropped_Frame_List), and reset the 
+ * dropped frame count.
+ * @see #Multrun_Data
+ */
+static void Multrun_Dropped_Frame_List_Free(void)
+{
+	if(Multrun_Data.Dropped_Frame_List != NULL)
+		free(Multrun_Data.Dropped_Frame_List);
+	Multrun_Data.Dropped_Frame_List = NULL;
+	Multrun_Data.Dropped_Frame_Count = 0;
+}
+
+/**
+ * Find the cube slot in Multrun_Cube_List for the specified rotation. If there isn't one, a free slot is 
+ * allocated to the rotation, with the number of planes the rotation will contain (the last rotation is short if
+ * Multrun_Data.Image_Count is not a multiple of Multrun_Data.Images_Per_Cycle). The cube file itself is not
+ * created until the first plane is written.
+ * The caller must hold Multrun_Cube_Mutex.
+ * @param rotation_number The rotation number (from 1) to find a cube slot for.
+ * @return A pointer to the rotation's cube slot, or NULL if there are no free slots.
+ * @see #MULTRUN_CUBE_SLOT_COUNT
+ * @see #Multrun_Cube_List
+ * @see #Multrun_Cube_Mutex
+ * @see #Multrun_Data
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+static struct Multrun_Cube_Struct *Multrun_Cube_Slot_Get(int rotation_number)
+{
+	int i,free_index;
+
+	free_index = -1;
+	for(i = 0; i < MULTRUN_CUBE_SLOT_COUNT; i++)
+	{
+		if(Multrun_Cube_List[i].Rotation_Number == rotation_number)
+			return &(Multrun_Cube_List[i]);
+		if((Multrun_Cube_List[i].Rotation_Number == 0)&&(free_index == -1))
+			free_index = i;
+	}
+	if(free_index == -1)
+	{
+		Moptop_General_Error_Number = 669;
+		sprintf(Moptop_General_Error_String,"Multrun_Cube_Slot_Get:"
+			"No free cube slots for rotation %d (%d cubes already open).",rotation_number,
+			MULTRUN_CUBE_SLOT_COUNT);
+		return NULL;
+	}
+	Multrun_Cube_List[free_index].Rotation_Number = rotation_number;
+	Multrun_Cube_List[free_index].Plane_Count = Multrun_Data.Image_Count-
+		((rotation_number-1)*Multrun_Data.Images_Per_Cycle);
+	if(Multrun_Cube_List[free_index].Plane_Count > Multrun_Data.Images_Per_Cycle)
+		Multrun_Cube_List[free_index].Plane_Count = Multrun_Data.Images_Per_Cycle;
+	Multrun_Cube_List[free_index].Planes_Done = 0;
+	Multrun_Cube_List[free_index].Is_Open = FALSE;
+	return &(Multrun_Cube_List[free_index]);
+}
+
+/**
+ * Count one of a cube's planes as done (written, or dropped). When all the cube's planes are done,
+ * the cube is closed using CCD_Fits_Image_Cube_Close, it is published (it's FITS filename lock is removed, or 
+ * it is renamed to it's FITS filename) using Moptop_Writer_Publish, which first makes it as durable as the
+ * writer durability policy requires, and the cube slot is freed.
+ * The caller must hold Multrun_Cube_Mutex.
+ * @param cube_slot The cube slot, returned by Multrun_Cube_Slot_Get.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Cube_Mutex
+ * @see #Multrun_Cube_Slot_Get
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Close
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ */
+static int Multrun_Cube_Plane_Done(struct Multrun_Cube_Struct *cube_slot)
+{
+	struct timespec start_time,end_time;
+	int rotation_number;
+
+	cube_slot->Planes_Done++;
+	if(cube_slot->Planes_Done < cube_slot->Plane_Count)
+		return TRUE;
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Cube_Plane_Done",LOG_VERBOSITY_INTERMEDIATE,
+				  "MULTRUN","All %d planes of rotation %d done.",cube_slot->Plane_Count,
+				  cube_slot->Rotation_Number);
+#endif
+	/* free the slot, even if closing the cube fails */
+	rotation_number = cube_slot->Rotation_Number;
+	cube_slot->Rotation_Number = 0;
+	if(cube_slot->Is_Open == FALSE)
+		return TRUE;
+	cube_slot->Is_Open = FALSE;
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Image_Cube_Close(&(cube_slot->Cube)))
+	{
+		CCD_Fits_Filename_Publish_Abort(cube_slot->Cube.Filename);
+		Moptop_General_Error_Number = 674;
+		sprintf(Moptop_General_Error_String,"Multrun_Cube_Plane_Done:Failed to close '%s'.",
+			cube_slot->Cube.Filename);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_CLOSE,start_time,end_time);
+	if(!Moptop_Writer_Publish(cube_slot->Cube.Filename,rotation_number,cube_slot->Plane_Count))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Close any FITS cubes in Multrun_Cube_List that are still open, publish them (Moptop_Writer_Publish, which
+ * syncs them first unless the writer durability policy is none),
+ * and free all the cube slots. This is called when the writer threads have stopped, to tidy up the cubes of
+ * rotations with missing planes (the last rotation of an aborted or failed multrun). 
+ * The missing planes are left as they were created (zero data, and NaN per-plane table values).
+ * Failures are logged, rather than returned, as this is also called after a multrun has already failed.
+ * @see #Multrun_Cube_List
+ * @see #Multrun_Cube_Mutex
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Close
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Get_Error_Number
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ */
+static void Multrun_Cube_Close_All(void)
+{
+	int i;
+
+	pthread_mutex_lock(&Multrun_Cube_Mutex);
+	for(i = 0; i < MULTRUN_CUBE_SLOT_COUNT; i++)
+	{
+		if((Multrun_Cube_List[i].Rotation_Number != 0)&&(Multrun_Cube_List[i].Is_Open))
+		{
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Cube_Close_All",
+						  LOG_VERBOSITY_TERSE,"MULTRUN","Closing '%s' with %d of %d planes done.",
+						  Multrun_Cube_List[i].Cube.Filename,Multrun_Cube_List[i].Planes_Done,
+						  Multrun_Cube_List[i].Plane_Count);
+#endif
+			if(!CCD_Fits_Image_Cube_Close(&(Multrun_Cube_List[i].Cube)))
+			{
+#if MOPTOP_DEBUG > 1
+				Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Cube_Close_All",
+							  LOG_VERBOSITY_TERSE,"MULTRUN","Failed to close '%s' (%d).",
+							  Multrun_Cube_List[i].Cube.Filename,
+							  CCD_Fits_Image_Get_Error_Number());
+#endif
+				CCD_Fits_Filename_Publish_Abort(Multrun_Cube_List[i].Cube.Filename);
+			}
+			else if(!Moptop_Writer_Publish(Multrun_Cube_List[i].Cube.Filename,
+						       Multrun_Cube_List[i].Rotation_Number,
+						       Multrun_Cube_List[i].Planes_Done))
+			{
+				Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Cube_Close_All",
+						     LOG_VERBOSITY_TERSE,"MULTRUN");
+			}
+		}
+		Multrun_Cube_List[i].Rotation_Number = 0;
+		Multrun_Cube_List[i].Is_Open = FALSE;
+	}
+	pthread_mutex_unlock(&Multrun_Cube_Mutex);
+}
+
+/**
+ * Create the multrun's raw capture file, in raw output mode. If Multrun_Data.Output_Mode is not 
+ * MULTRUN_OUTPUT_MODE_RAW, we do nothing and return TRUE.
+ * <ul>
+ * <li>We get the raw capture filename, the current multrun's run and window zero FITS filename 
+ *     (CCD_Fits_Filename_Get_Run_Window_Filename) with it's '.fits' extension replaced by MULTRUN_RAW_EXTENSION.
+ *     The data transfer processes only look for '.fits' files, so the raw capture file is not transferred, 
+ *     or published.
+ * <li>We calculate the binned image dimensions using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
+ *     CCD_Setup_Get_Binning.
+ * <li>We create (and preallocate) the raw capture file using CCD_Fits_Image_Raw_Create, with a slot for each of 
+ *     the Multrun_Data.Image_Count frames, the multrun FITS header template's card count, the 
+ *     Multrun_Cube_Column_Name_List per-frame values, and the configured flips (which are applied when the file is 
+ *     converted).
+ * <li>We add the raw capture filename to the filename list using CCD_Fits_Filename_List_Add.
+ * </ul>
+ * @param do_standard A boolean, if TRUE this is an observation of a standard, otherwise it is not.
+ * @param filename_list The address of the list of filenames acquired during this multrun.
+ * @param filename_count The address of the number of filenames in filename_list.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MULTRUN_RAW_EXTENSION
+ * @see #MULTRUN_CUBE_COLUMN_COUNT
+ * @see #Multrun_Data
+ * @see #Multrun_Raw_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Cube_Column_Name_List
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_RUN_WINDOW_NUMBER
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Get_Run_Window_Filename
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_List_Add
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Create
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static int Multrun_Raw_Create(int do_standard,char ***filename_list,int *filename_count)
+{
+	enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type;
+	char filename[MULTRUN_FITS_FILENAME_LENGTH];
+	char *extension_ptr = NULL;
+	int binning,ncols_binned,nrows_binned;
+
+	Multrun_Raw_Data.Is_Open = FALSE;
+	if(Multrun_Data.Output_Mode != MULTRUN_OUTPUT_MODE_RAW)
+		return TRUE;
+	if(do_standard)
+		exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_STANDARD;
+	else
+		exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_EXPOSURE;
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(exposure_type,CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,
+						      CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,
+						      CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,filename,
+						      MULTRUN_FITS_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 688;
+		sprintf(Moptop_General_Error_String,"Multrun_Raw_Create:Getting raw capture filename failed.");
+		return FALSE;
+	}
+	extension_ptr = strstr(filename,".fits");
+	if(extension_ptr == NULL)
+	{
+		Moptop_General_Error_Number = 689;
+		sprintf(Moptop_General_Error_String,"Multrun_Raw_Create:'.fits' not found in filename '%s'.",filename);
+		return FALSE;
+	}
+	strcpy(extension_ptr,MULTRUN_RAW_EXTENSION);
+	binning = CCD_Setup_Get_Binning();
+	ncols_binned = CCD_Setup_Get_Sensor_Width()/binning;
+	nrows_binned = CCD_Setup_Get_Sensor_Height()/binning;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Raw_Create",LOG_VERBOSITY_INTERMEDIATE,
+				  "MULTRUN","Creating raw capture file '%s' for %d frames of %d x %d.",filename,
+				  Multrun_Data.Image_Count,ncols_binned,nrows_binned);
+#endif
+	if(!CCD_Fits_Image_Raw_Create(filename,Multrun_Header_Template.Card_Count,ncols_binned,nrows_binned,
+				      Multrun_Data.Image_Count,Multrun_Cube_Column_Name_List,MULTRUN_CUBE_COLUMN_COUNT,
+				      Multrun_Data.Flip_X,Multrun_Data.Flip_Y,&(Multrun_Raw_Data.Raw)))
+	{
+		Moptop_General_Error_Number = 690;
+		sprintf(Moptop_General_Error_String,"Multrun_Raw_Create:Failed to create '%s'.",filename);
+		return FALSE;
+	}
+	Multrun_Raw_Data.Is_Open = TRUE;
+	if(!CCD_Fits_Filename_List_Add(filename,filename_list,filename_count))
+	{
+		Multrun_Raw_Close();
+		Moptop_General_Error_Number = 691;
+		sprintf(Moptop_General_Error_String,"Multrun_Raw_Create:"
+			"Failed to add filename '%s' to list of filenames (count = %d).",filename,(*filename_count));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Close the multrun's raw capture file, if it is open. This is called when the writer threads have stopped.
+ * Failures are logged, rather than returned, as this is also called after a multrun has already failed.
+ * @see #Multrun_Raw_Data
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Close
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Get_Error_Number
+ */
+static void Multrun_Raw_Close(void)
+{
+	if(Multrun_Raw_Data.Is_Open == FALSE)
+		return;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Raw_Close",LOG_VERBOSITY_INTERMEDIATE,
+				  "MULTRUN","Closing raw capture file '%s'.",Multrun_Raw_Data.Raw.Filename);
+#endif
+	if(!CCD_Fits_Image_Raw_Close(&(Multrun_Raw_Data.Raw)))
+	{
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Raw_Close",LOG_VERBOSITY_TERSE,
+					  "MULTRUN","Failed to close '%s' (%d).",Multrun_Raw_Data.Raw.Filename,
+					  CCD_Fits_Image_Get_Error_Number());
+#endif
+	}
+	Multrun_Raw_Data.Is_Open = FALSE;
+}
+
+/**
+ * Write one stacked FITS image per rotator position, in stack output mode. If Multrun_Data.Output_Mode is 
+ * not MULTRUN_OUTPUT_MODE_STACK, this routine does nothing. This is called when the writer threads have stopped,
+ * so all the frames have been added to their position's stack. For each rotator position (sequence number):
+ * <ul>
+ * <li>We get the position's stack using Moptop_Stack_Position_Get. Positions with no frames (a multrun shorter 
+ *     than one rotation, or every frame at that position dropped) are skipped.
+ * <li>The stacked image is saved to the FITS filename of it's first frame (the first rotation stacked).
+ * <li>We copy the multrun FITS header template, and patch it with the per-frame keywords of the first frame using
+ *     Multrun_Fits_Headers_Patch (so MOPRNUM is the first rotation stacked, and DATE-END/UTEND/TELAPSE are taken 
+ *     from the last frame stacked).
+ * <li>We set EXPTIME and XPOSURE (if they are in the template) to the summed exposure length of the stack, 
+ *     using Moptop_Fits_Header_Template_Keyword_Float_Set.
+ * <li>We write the stacked image using Moptop_Stack_Position_Write.
+ * <li>We add the stacked image's filename to the filename list using CCD_Fits_Filename_List_Add.
+ * </ul>
+ * @param filename_list The address of a list of filenames, the stacked images are added to this list.
+ * @param filename_count The address of an integer holding the number of filenames in filename_list.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MULTRUN_OUTPUT_MODE
+ * @see #Multrun_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Fits_Headers_Patch
+ * @see moptop_stack.html#Moptop_Stack_Position_Get
+ * @see moptop_stack.html#Moptop_Stack_Position_Write
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Keyword_Float_Set
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_List_Add
+ */
+static int Multrun_Stack_Write_All(char ***filename_list,int *filename_count)
+{
+	struct Moptop_Writer_Frame_Struct header_frame;
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	double exposure_length_sum;
+	int sequence_number,frame_count,first_rotation_number,last_rotation_number;
+
+	if(Multrun_Data.Output_Mode != MULTRUN_OUTPUT_MODE_STACK)
+		return TRUE;
+	for(sequence_number = 1; sequence_number <= Multrun_Data.Images_Per_Cycle; sequence_number++)
+	{
+		if(!Moptop_Stack_Position_Get(sequence_number,&header_frame,&frame_count,&first_rotation_number,
+					      &last_rotation_number,&exposure_length_sum))
+			return FALSE;
+		if(frame_count == 0)
+			continue;
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Stack_Write_All",
+					  LOG_VERBOSITY_INTERMEDIATE,"MULTRUN","Writing position %d stack of %d frames "
+					  "(rotations %d to %d, %.3f s) to '%s'.",sequence_number,frame_count,
+					  first_rotation_number,last_rotation_number,exposure_length_sum,
+					  header_frame.Filename);
+#endif
+		Moptop_Fits_Header_Template_Copy(&Multrun_Header_Template,card_image_list);
+		if(!Multrun_Fits_Headers_Patch(&header_frame,card_image_list))
+			return FALSE;
+		/* EXPTIME/XPOSURE are set by the robotic layer, and may not be in the template */
+		if(!Moptop_Fits_Header_Template_Keyword_Float_Set(&Multrun_Header_Template,card_image_list,"EXPTIME",
+								  exposure_length_sum))
+		{
+			Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Stack_Write_All",
+					     LOG_VERBOSITY_VERBOSE,"MULTRUN");
+		}
+		if(!Moptop_Fits_Header_Template_Keyword_Float_Set(&Multrun_Header_Template,card_image_list,"XPOSURE",
+								  exposure_length_sum))
+		{
+			Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Stack_Write_All",
+					     LOG_VERBOSITY_VERBOSE,"MULTRUN");
+		}
+		if(!Moptop_Stack_Position_Write(sequence_number,header_frame.Filename,card_image_list,
+						Multrun_Header_Template.Card_Count,Multrun_Data.Flip_X,
+						Multrun_Data.Flip_Y))
+			return FALSE;
+		if(!CCD_Fits_Filename_List_Add(header_frame.Filename,filename_list,filename_count))
+		{
+			Moptop_General_Error_Number = 697;
+			sprintf(Moptop_General_Error_String,"Multrun_Stack_Write_All:"
+				"Failed to add filename '%s' to list of filenames (count = %d).",header_frame.Filename,
+				(*filename_count));
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Start creating and preallocating the multrun's output files, in the background. The pool is only used
+ * when all of the following are true, otherwise we log why and return TRUE:
+ * <ul>
+ * <li>Multrun_Data.Preallocate_Enable is TRUE.
+ * <li>Multrun_Data.Native_Fits_Writer is TRUE, and Multrun_Data.Compress_Enable is FALSE, as the size of
+ *     each file is only known in advance for the (uncompressed) native FITS writer.
+ * <li>Multrun_Data.Output_Mode is MULTRUN_OUTPUT_MODE_FRAME.
+ * <li>The FITS filename publish mode is CCD_FITS_FILENAME_PUBLISH_MODE_RENAME, so the preallocated files
+ *     have temporary filenames, and cannot be picked up by the data transfer before they are written.
+ * <li>The writer is not staging frames in memory (Moptop_Writer_Stage_Is_Enabled), as the staging flush thread
+ *     creates each file when it writes it. This must therefore be called after Moptop_Writer_Start.
+ * </ul>
+ * Otherwise:
+ * <ul>
+ * <li>We setup Multrun_Preallocate_Data for this multrun. The header card count is taken from the
+ *     multrun's FITS header template, so this must be called after Multrun_Fits_Header_Template_Create.
+ * <li>We allocate a state for each file (Multrun_Data.Image_Count).
+ * <li>We start Multrun_Preallocate_Thread.
+ * </ul>
+ * @param do_standard A boolean, if TRUE this is an observation of a standard, otherwise it is not.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MULTRUN_OUTPUT_MODE
+ * @see #MULTRUN_PREALLOCATE_STATE
+ * @see #Multrun_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Preallocate_Data
+ * @see #Multrun_Preallocate_Mutex
+ * @see #Multrun_Preallocate_Thread
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_writer.html#Moptop_Writer_Stage_Is_Enabled
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Mode_Get
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static int Multrun_Preallocate_Start(int do_standard)
+{
+	int binning,retval;
+
+	if((Multrun_Data.Preallocate_Enable == FALSE)||(Multrun_Data.Native_Fits_Writer == FALSE)||
+	   Multrun_Data.Compress_Enable||(Multrun_Data.Output_Mode != MULTRUN_OUTPUT_MODE_FRAME)||
+	   (CCD_Fits_Filename_Publish_Mode_Get() != CCD_FITS_FILENAME_PUBLISH_MODE_RENAME)||
+	   Moptop_Writer_Stage_Is_Enabled())
+	{
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Preallocate_Start",
+					  LOG_VERBOSITY_VERBOSE,"MULTRUN","Not preallocating output files:"
+					  "enable = %d, native writer = %d, compress = %d, output mode = %d, "
+					  "publish mode = %d, staging = %d.",Multrun_Data.Preallocate_Enable,
+					  Multrun_Data.Native_Fits_Writer,Multrun_Data.Compress_Enable,
+					  Multrun_Data.Output_Mode,CCD_Fits_Filename_Publish_Mode_Get(),
+					  Moptop_Writer_Stage_Is_Enabled());
+#endif
+		return TRUE;
+	}
+	if(Multrun_Preallocate_Data.Is_Active)
+	{
+		Moptop_General_Error_Number = 683;
+		sprintf(Moptop_General_Error_String,"Multrun_Preallocate_Start:Preallocation thread already active.");
+		return FALSE;
+	}
+	binning = CCD_Setup_Get_Binning();
+	pthread_mutex_lock(&Multrun_Preallocate_Mutex);
+	Multrun_Preallocate_Data.Abort = FALSE;
+	Multrun_Preallocate_Data.File_Count = Multrun_Data.Image_Count;
+	Multrun_Preallocate_Data.Images_Per_Cycle = Multrun_Data.Images_Per_Cycle;
+	if(do_standard)
+		Multrun_Preallocate_Data.Exposure_Type = CCD_FITS_FILENAME_EXPOSURE_TYPE_STANDARD;
+	else
+		Multrun_Preallocate_Data.Exposure_Type = CCD_FITS_FILENAME_EXPOSURE_TYPE_EXPOSURE;
+	Multrun_Preallocate_Data.Card_Count = Multrun_Header_Template.Card_Count;
+	Multrun_Preallocate_Data.Ncols = CCD_Setup_Get_Sensor_Width()/binning;
+	Multrun_Preallocate_Data.Nrows = CCD_Setup_Get_Sensor_Height()/binning;
+	Multrun_Preallocate_Data.Preallocated_Count = 0;
+	Multrun_Preallocate_Data.Used_Count = 0;
+	Multrun_Preallocate_Data.State_List = (enum MULTRUN_PREALLOCATE_STATE *)calloc(Multrun_Data.Image_Count,
+										sizeof(enum MULTRUN_PREALLOCATE_STATE));
+	if(Multrun_Preallocate_Data.State_List == NULL)
+	{
+		pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+		Moptop_General_Error_Number = 684;
+		sprintf(Moptop_General_Error_String,"Multrun_Preallocate_Start:Failed to allocate state list (%d).",
+			Multrun_Data.Image_Count);
+		return FALSE;
+	}
+	pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+	retval = pthread_create(&(Multrun_Preallocate_Data.Thread),NULL,Multrun_Preallocate_Thread,NULL);
+	if(retval != 0)
+	{
+		pthread_mutex_lock(&Multrun_Preallocate_Mutex);
+		free(Multrun_Preallocate_Data.State_List);
+		Multrun_Preallocate_Data.State_List = NULL;
+		pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+		Moptop_General_Error_Number = 685;
+		sprintf(Moptop_General_Error_String,"Multrun_Preallocate_Start:Failed to create thread (%d).",retval);
+		return FALSE;
+	}
+	Multrun_Preallocate_Data.Is_Active = TRUE;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Preallocate_Start",LOG_VERBOSITY_VERBOSE,
+				  "MULTRUN","Started preallocating %d files of %d x %d pixels with %d header cards.",
+				  Multrun_Preallocate_Data.File_Count,Multrun_Preallocate_Data.Ncols,
+				  Multrun_Preallocate_Data.Nrows,Multrun_Preallocate_Data.Card_Count);
+#endif
+	return TRUE;
+}
+
+/**
+ * The preallocation thread. We loop over the files in the pool, in trigger index order:
+ * <ul>
+ * <li>We stop if Multrun_Preallocate_Data.Abort is set. If a writer thread has already claimed the file 
+ *     (it's state is not MULTRUN_PREALLOCATE_STATE_NONE), we skip it. Otherwise we mark it's state as 
+ *     MULTRUN_PREALLOCATE_STATE_IN_PROGRESS.
+ * <li>We get the filename the writer thread will write the file to, using Multrun_Preallocate_Filename_Get.
+ * <li>We create and preallocate the file using CCD_Fits_Image_Preallocate.
+ * <li>We mark the file's state as MULTRUN_PREALLOCATE_STATE_DONE (or MULTRUN_PREALLOCATE_STATE_NONE if
+ *     it failed, when we also stop preallocating, and the writer threads create the rest of the files as normal),
+ *     and broadcast Multrun_Preallocate_Condition to wake up any writer thread waiting for the file.
+ * </ul>
+ * @param arg The thread argument, not used.
+ * @return The routine always returns NULL.
+ * @see #MULTRUN_PREALLOCATE_STATE
+ * @see #Multrun_Preallocate_Data
+ * @see #Multrun_Preallocate_Mutex
+ * @see #Multrun_Preallocate_Condition
+ * @see #Multrun_Preallocate_Filename_Get
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Preallocate
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Get_Error_Number
+ */
+static void *Multrun_Preallocate_Thread(void *arg)
+{
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int i,done;
+
+	done = FALSE;
+	for(i = 0; (i < Multrun_Preallocate_Data.File_Count) && (done == FALSE); i++)
+	{
+		pthread_mutex_lock(&Multrun_Preallocate_Mutex);
+		if(Multrun_Preallocate_Data.Abort)
+		{
+			pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+			break;
+		}
+		if(Multrun_Preallocate_Data.State_List[i] != MULTRUN_PREALLOCATE_STATE_NONE)
+		{
+			pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+			continue;
+		}
+		Multrun_Preallocate_Data.State_List[i] = MULTRUN_PREALLOCATE_STATE_IN_PROGRESS;
+		pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+		if(Multrun_Preallocate_Filename_Get(i,write_filename) &&
+		   CCD_Fits_Image_Preallocate(write_filename,Multrun_Preallocate_Data.Card_Count,
+					      Multrun_Preallocate_Data.Ncols,Multrun_Preallocate_Data.Nrows))
+		{
+			pthread_mutex_lock(&Multrun_Preallocate_Mutex);
+			Multrun_Preallocate_Data.State_List[i] = MULTRUN_PREALLOCATE_STATE_DONE;
+			Multrun_Preallocate_Data.Preallocated_Count++;
+		}
+		else
+		{
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Preallocate_Thread",
+						  LOG_VERBOSITY_TERSE,"MULTRUN","Failed to preallocate file %d (%d,%d):"
+						  "Stopping preallocation.",i,Moptop_General_Error_Number,
+						  CCD_Fits_Image_Get_Error_Number());
+#endif
+			pthread_mutex_lock(&Multrun_Preallocate_Mutex);
+			Multrun_Preallocate_Data.State_List[i] = MULTRUN_PREALLOCATE_STATE_NONE;
+			done = TRUE;
+		}
+		pthread_cond_broadcast(&Multrun_Preallocate_Condition);
+		pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Preallocate_Thread",LOG_VERBOSITY_VERBOSE,
+				  "MULTRUN","Preallocation thread finished after %d files.",i);
+#endif
+	return NULL;
+}
+
+/**
+ * Get the filename a writer thread will write the frame with the specified trigger index into. 
+ * The run and window numbers are computed from the trigger index, in the same way as Multrun_Get_Fits_Filename 
+ * increments them, and the FITS filename is converted into the filename to write to
+ * by CCD_Fits_Filename_Publish_Write_Filename_Get, which makes no system calls (so no lock file is created
+ * in lock publish mode). The writer thread still calls CCD_Fits_Filename_Publish_Begin itself.
+ * @param trigger_index The trigger index of the frame in the multrun.
+ * @param write_filename A previously allocated string, of length MOPTOP_WRITER_FILENAME_LENGTH, to store
+ *        the temporary filename in.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Preallocate_Data
+ * @see #Multrun_Get_Fits_Filename
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Get_Run_Window_Filename
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Write_Filename_Get
+ */
+static int Multrun_Preallocate_Filename_Get(int trigger_index,char *write_filename)
+{
+	char filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int run_number,window_number;
+
+	run_number = (trigger_index/Multrun_Preallocate_Data.Images_Per_Cycle)+1;
+	window_number = (trigger_index%Multrun_Preallocate_Data.Images_Per_Cycle)+1;
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(Multrun_Preallocate_Data.Exposure_Type,
+						      CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,run_number,
+						      window_number,filename,MOPTOP_WRITER_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 686;
+		sprintf(Moptop_General_Error_String,"Multrun_Preallocate_Filename_Get:"
+			"Getting filename for run %d window %d failed.",run_number,window_number);
+		return FALSE;
+	}
+	if(!CCD_Fits_Filename_Publish_Write_Filename_Get(filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 687;
+		sprintf(Moptop_General_Error_String,"Multrun_Preallocate_Filename_Get:"
+			"Getting temporary filename for '%s' failed.",filename);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Claim the preallocated file for a frame, if there is one. If the preallocation thread is currently
+ * creating the frame's file, we wait for it to finish. The frame's file is marked as MULTRUN_PREALLOCATE_STATE_USED
+ * whether or not it was preallocated, so the preallocation thread skips it if it has not got to it yet.
+ * @param frame The frame about to be written. It's trigger index is computed from it's rotation and sequence number.
+ * @return The routine returns TRUE if the frame's file has been preallocated, and FALSE if it has not 
+ *         (or the pool is not in use for this multrun).
+ * @see #MULTRUN_PREALLOCATE_STATE
+ * @see #Multrun_Preallocate_Data
+ * @see #Multrun_Preallocate_Mutex
+ * @see #Multrun_Preallocate_Condition
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ */
+static int Multrun_Preallocate_Claim(struct Moptop_Writer_Frame_Struct *frame)
+{
+	int trigger_index,retval;
+
+	retval = FALSE;
+	pthread_mutex_lock(&Multrun_Preallocate_Mutex);
+	if(Multrun_Preallocate_Data.State_List != NULL)
+	{
+		trigger_index = ((frame->Rotation_Number-1)*Multrun_Preallocate_Data.Images_Per_Cycle)+
+			(frame->Sequence_Number-1);
+		if((trigger_index >= 0)&&(trigger_index < Multrun_Preallocate_Data.File_Count))
+		{
+			while(Multrun_Preallocate_Data.State_List[trigger_index] == MULTRUN_PREALLOCATE_STATE_IN_PROGRESS)
+				pthread_cond_wait(&Multrun_Preallocate_Condition,&Multrun_Preallocate_Mutex);
+			if(Multrun_Preallocate_Data.State_List[trigger_index] == MULTRUN_PREALLOCATE_STATE_DONE)
+			{
+				Multrun_Preallocate_Data.Used_Count++;
+				retval = TRUE;
+			}
+			Multrun_Preallocate_Data.State_List[trigger_index] = MULTRUN_PREALLOCATE_STATE_USED;
+		}
+	}
+	pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+	return retval;
+}
+
+/**
+ * Stop the preallocation thread (if it is running), and remove any preallocated files that were not written
+ * (i.e. of dropped frames, or frames not acquired because the multrun was aborted or failed). 
+ * This is called when the writer threads have stopped. It does nothing if the pool is not in use.
+ * Failures are logged, rather than returned, as this is also called after a multrun has already failed.
+ * @see #MULTRUN_PREALLOCATE_STATE
+ * @see #Multrun_Preallocate_Data
+ * @see #Multrun_Preallocate_Mutex
+ * @see #Multrun_Preallocate_Filename_Get
+ * @see moptop_general.html#Moptop_General_Log_Format
+ */
+static void Multrun_Preallocate_Stop(void)
+{
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int i,unused_count;
+
+	if(Multrun_Preallocate_Data.Is_Active == FALSE)
+		return;
+	pthread_mutex_lock(&Multrun_Preallocate_Mutex);
+	Multrun_Preallocate_Data.Abort = TRUE;
+	pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+	pthread_join(Multrun_Preallocate_Data.Thread,NULL);
+	Multrun_Preallocate_Data.Is_Active = FALSE;
+	unused_count = 0;
+	for(i = 0; i < Multrun_Preallocate_Data.File_Count; i++)
+	{
+		if(Multrun_Preallocate_Data.State_List[i] != MULTRUN_PREALLOCATE_STATE_DONE)
+			continue;
+		unused_count++;
+		if(Multrun_Preallocate_Filename_Get(i,write_filename))
+		{
+			if(unlink(write_filename) != 0)
+			{
+#if MOPTOP_DEBUG > 1
+				Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Preallocate_Stop",
+							  LOG_VERBOSITY_TERSE,"MULTRUN","Failed to remove unused '%s' (%d).",
+							  write_filename,errno);
+#endif
+			}
+		}
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Preallocate_Stop",LOG_VERBOSITY_TERSE,
+				  "MULTRUN","Preallocated %d of %d files, %d used, %d unused removed.",
+				  Multrun_Preallocate_Data.Preallocated_Count,Multrun_Preallocate_Data.File_Count,
+				  Multrun_Preallocate_Data.Used_Count,unused_count);
+#endif
+	pthread_mutex_lock(&Multrun_Preallocate_Mutex);
+	free(Multrun_Preallocate_Data.State_List);
+	Multrun_Preallocate_Data.State_List = NULL;
+	pthread_mutex_unlock(&Multrun_Preallocate_Mutex);
+}
+
+/**
+ * Replace the provisional rotator end angles in the FITS images written during a multrun with the rotator
+ * positions recorded by the rotator's data recorder. This is done once at the end of the multrun, so the 
+ * recorder is read across the (slow) USB link in one bulk transfer, rather than querying the rotator position
+ * after every frame. The FITS images are held back from being published (Moptop_Writer_Publish_Hold) until
+ * this has been done.
+ * <ul>
+ * <li>We read the recorded rotator positions from the controller using PIROT_Recorder_Read.
+ * <li>We loop over the filenames in filename_list. Frames are added to filename_list in acquisition order,
+ *     so the trigger index of each image is it's index in filename_list, plus the number of dropped frames 
+ *     (Multrun_Data.Dropped_Frame_List) before it. The requested (trigger) rotator angle is the trigger index 
+ *     times the rotator step angle.
+ *     <ul>
+ *     <li>We compute the rotator position at the end of the exposure using PIROT_Recorder_Get_End_Position.
+ *     <li>The FITS image has not been published yet, so we get the filename it was written to using
+ *         CCD_Fits_Filename_Publish_Write_Filename_Get.
+ *     <li>We update the "MOPREND" (end angle within the rotation) and "MOPRARC" (end position minus the 
+ *         requested angle) keywords in the FITS image using CCD_Fits_Image_Header_Float_Update.
+ *     </ul>
+ * <li>In cube output mode, we instead call Multrun_Rotator_Position_Backfill_Cube to update the cubes' 
+ *     per-plane tables.
+ * <li>In raw output mode, we instead call Multrun_Rotator_Position_Backfill_Raw to update the frames stored in
+ *     the raw capture file.
+ * </ul>
+ * @param filename_list The list of filenames of FITS images acquired during this multrun.
+ * @param filename_count The number of FITS images in filename_list.
+ * @param exposure_length The length of each exposure in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure. If a frame's position cannot be 
+ *         back-filled, it and the following frames keep their provisional values.
+ * @see #Multrun_Data
+ * @see #Moptop_Multrun_Rotator_Step_Angle_Get
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see #Multrun_Rotator_Position_Backfill_Cube
+ * @see #Multrun_Rotator_Position_Backfill_Raw
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Write_Filename_Get
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Header_Float_Update
+ * @see ../pirot/cdocs/pirot_recorder.html#PIROT_Recorder_Read
+ * @see ../pirot/cdocs/pirot_recorder.html#PIROT_Recorder_Get_End_Position
+ */
+static int Multrun_Rotator_Position_Backfill(char **filename_list,int filename_count,double exposure_length)
+{
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	char *keyword_list[2] = {"MOPREND","MOPRARC"};
+	double value_list[2];
+	double requested_rotator_angle,end_rotator_position;
+	int i,trigger_index,dropped_index;
+
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Rotator_Position_Backfill",
+				  LOG_VERBOSITY_INTERMEDIATE,"MULTRUN","Started with %d files.",filename_count);
+#endif
+	if(!PIROT_Recorder_Read())
+	{
+		Moptop_General_Error_Number = 659;
+		sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+			"Failed to read rotator data recorder.");
+		return FALSE;
+	}
+	if(Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_CUBE)
+		return Multrun_Rotator_Position_Backfill_Cube(filename_list,filename_count,exposure_length);
+	if(Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_RAW)
+		return Multrun_Rotator_Position_Backfill_Raw(exposure_length);
+	trigger_index = 0;
+	dropped_index = 0;
+	for(i = 0; i < filename_count; i++)
+	{
+		/* move the trigger index past any frames dropped before this one */
+		while((dropped_index < Multrun_Data.Dropped_Frame_Count)&&
+		      (Multrun_Data.Dropped_Frame_List[dropped_index] == trigger_index))
+		{
+			trigger_index++;
+			dropped_index++;
+		}
+		requested_rotator_angle = trigger_index*Moptop_Multrun_Rotator_Step_Angle_Get();
+		if(!PIROT_Recorder_Get_End_Position(requested_rotator_angle,exposure_length,&end_rotator_position))
+		{
+			Moptop_General_Error_Number = 660;
+			sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+				"Failed to get recorded rotator end position for '%s' (requested angle %.3f).",
+				filename_list[i],requested_rotator_angle);
+			return FALSE;
+		}
+		value_list[0] = fmod(end_rotator_position,360.0);
+		value_list[1] = end_rotator_position-requested_rotator_angle;
+		if(!CCD_Fits_Filename_Publish_Write_Filename_Get(filename_list[i],write_filename,
+								 MOPTOP_WRITER_FILENAME_LENGTH))
+		{
+			Moptop_General_Error_Number = 675;
+			sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+				"Failed to get the filename '%s' was written to.",filename_list[i]);
+			return FALSE;
+		}
+		if(!CCD_Fits_Image_Header_Float_Update(write_filename,keyword_list,value_list,2))
+		{
+			Moptop_General_Error_Number = 661;
+			sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+				"Failed to update rotator end position in '%s'.",filename_list[i]);
+			return FALSE;
+		}
+		trigger_index++;
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Rotator_Position_Backfill",
+				  LOG_VERBOSITY_INTERMEDIATE,"MULTRUN","Finished, using %d recorded positions "
+				  "at %.4f s intervals.",PIROT_Recorder_Get_Sample_Count(),
+				  PIROT_Recorder_Get_Sample_Interval());
+#endif
+	return TRUE;
+}
+
+/**
+ * Replace the provisional rotator end angles in the FITS cubes written during a cube output mode multrun with 
+ * the rotator positions recorded by the rotator's data recorder. This is called by Multrun_Rotator_Position_Backfill,
+ * once the recorder has been read. Each file in filename_list is the cube of one rotation (rotations where every 
+ * frame was dropped have no cube), so we loop over the trigger indexes, skipping dropped frames:
+ * <ul>
+ * <li>When the rotation changes, we close the last cube and open the next one using CCD_Fits_Image_Cube_Open.
+ *     The cubes have not been published yet, so each is opened at the filename it was written to
+ *     (CCD_Fits_Filename_Publish_Write_Filename_Get).
+ * <li>We compute the rotator position at the end of the exposure using PIROT_Recorder_Get_End_Position.
+ * <li>We update the MOPREND and MOPRARC columns of the frame's row in the cube's per-plane table, using 
+ *     CCD_Fits_Image_Cube_Row_Update.
+ * </ul>
+ * @param filename_list The list of filenames of FITS cubes acquired during this multrun.
+ * @param filename_count The number of FITS cubes in filename_list.
+ * @param exposure_length The length of each exposure in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Data
+ * @see #Multrun_Cube_Column_Name_List
+ * @see #Multrun_Rotator_Position_Backfill
+ * @see #Moptop_Multrun_Rotator_Step_Angle_Get
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Write_Filename_Get
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Open
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Row_Update
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Close
+ * @see ../pirot/cdocs/pirot_recorder.html#PIROT_Recorder_Get_End_Position
+ */
+static int Multrun_Rotator_Position_Backfill_Cube(char **filename_list,int filename_count,double exposure_length)
+{
+	struct CCD_Fits_Image_Cube_Struct cube;
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	double requested_rotator_angle,end_rotator_position;
+	int i,trigger_index,dropped_index,rotation_number;
+
+	/* i is the index in filename_list of the currently open cube */
+	i = -1;
+	rotation_number = 0;
+	dropped_index = 0;
+	for(trigger_index = 0; trigger_index < Multrun_Data.Image_Count; trigger_index++)
+	{
+		if((dropped_index < Multrun_Data.Dropped_Frame_Count)&&
+		   (Multrun_Data.Dropped_Frame_List[dropped_index] == trigger_index))
+		{
+			dropped_index++;
+			continue;
+		}
+		/* move on to the next cube when the rotation changes */
+		if(((trigger_index/Multrun_Data.Images_Per_Cycle)+1) != rotation_number)
+		{
+			if((i >= 0)&&(!CCD_Fits_Image_Cube_Close(&cube)))
+			{
+				Moptop_General_Error_Number = 679;
+				sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+					"Failed to close '%s'.",filename_list[i]);
+				return FALSE;
+			}
+			rotation_number = (trigger_index/Multrun_Data.Images_Per_Cycle)+1;
+			i++;
+			if(i >= filename_count)
+			{
+				Moptop_General_Error_Number = 680;
+				sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+					"No cube for rotation %d (%d cubes).",rotation_number,filename_count);
+				return FALSE;
+			}
+			if(!CCD_Fits_Filename_Publish_Write_Filename_Get(filename_list[i],write_filename,
+									 MOPTOP_WRITER_FILENAME_LENGTH))
+			{
+				Moptop_General_Error_Number = 675;
+				sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+					"Failed to get the filename '%s' was written to.",filename_list[i]);
+				return FALSE;
+			}
+			if(!CCD_Fits_Image_Cube_Open(write_filename,&cube))
+			{
+				Moptop_General_Error_Number = 677;
+				sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+					"Failed to open '%s'.",filename_list[i]);
+				return FALSE;
+			}
+		}
+		requested_rotator_angle = trigger_index*Moptop_Multrun_Rotator_Step_Angle_Get();
+		if(!PIROT_Recorder_Get_End_Position(requested_rotator_angle,exposure_length,
+						    &end_rotator_position))
+		{
+			CCD_Fits_Image_Cube_Close(&cube);
+			Moptop_General_Error_Number = 660;
+			sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+				"Failed to get recorded rotator end position for '%s' (requested angle %.3f).",
+				filename_list[i],requested_rotator_angle);
+			return FALSE;
+		}
+		/* MOPREND and MOPRARC are columns 2 and 3 of Multrun_Cube_Column_Name_List */
+		if((!CCD_Fits_Image_Cube_Row_Update(&cube,trigger_index%Multrun_Data.Images_Per_Cycle,2,
+						    fmod(end_rotator_position,360.0)))||
+		   (!CCD_Fits_Image_Cube_Row_Update(&cube,trigger_index%Multrun_Data.Images_Per_Cycle,3,
+						    end_rotator_position-requested_rotator_angle)))
+		{
+			CCD_Fits_Image_Cube_Close(&cube);
+			Moptop_General_Error_Number = 678;
+			sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+				"Failed to update rotator end position in '%s'.",filename_list[i]);
+			return FALSE;
+		}
+	}
+	if((i >= 0)&&(!CCD_Fits_Image_Cube_Close(&cube)))
+	{
+		Moptop_General_Error_Number = 679;
+		sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+			"Failed to close '%s'.",filename_list[i]);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Replace the provisional rotator end angles of the frames stored in the raw capture file during a raw output mode 
+ * multrun with the rotator positions recorded by the rotator's data recorder, so the FITS images converted from 
+ * it later (by moptop_raw_convert) have the recorded positions. This is called by 
+ * Multrun_Rotator_Position_Backfill, once the recorder has been read, and before the raw capture file is closed.
+ * Each frame is stored in the slot of it's trigger index, so for each slot:
+ * <ul>
+ * <li>We read the frame's record and card images using CCD_Fits_Image_Raw_Frame_Read. Slots that were never 
+ *     written (dropped frames) are skipped.
+ * <li>We compute the rotator position at the end of the exposure using PIROT_Recorder_Get_End_Position.
+ * <li>We update the MOPREND and MOPRARC per-frame values in the record, and their keywords in the frame's 
+ *     FITS header using Moptop_Fits_Header_Template_Float_Set.
+ * <li>We write the record and card images back using CCD_Fits_Image_Raw_Record_Write.
+ * </ul>
+ * @param exposure_length The length of each exposure in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MULTRUN_HEADER_SLOT
+ * @see #Multrun_Data
+ * @see #Multrun_Raw_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Cube_Column_Name_List
+ * @see #Multrun_Rotator_Position_Backfill
+ * @see #Moptop_Multrun_Rotator_Step_Angle_Get
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_LENGTH
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Float_Set
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Record_Struct
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Frame_Read
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Record_Write
+ * @see ../pirot/cdocs/pirot_recorder.html#PIROT_Recorder_Get_End_Position
+ */
+static int Multrun_Rotator_Position_Backfill_Raw(double exposure_length)
+{
+	struct CCD_Fits_Image_Raw_Record_Struct record;
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	double requested_rotator_angle,end_rotator_position;
+	int trigger_index;
+
+	if(Multrun_Raw_Data.Is_Open == FALSE)
+		return TRUE;
+	for(trigger_index = 0; trigger_index < Multrun_Raw_Data.Raw.Frame_Count; trigger_index++)
+	{
+		if(!CCD_Fits_Image_Raw_Frame_Read(&(Multrun_Raw_Data.Raw),trigger_index,&record,card_image_list,NULL))
+		{
+			Moptop_General_Error_Number = 624;
+			sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+				"Failed to read frame %d from '%s'.",trigger_index,Multrun_Raw_Data.Raw.Filename);
+			return FALSE;
+		}
+		if(record.Is_Valid == FALSE)
+			continue;
+		requested_rotator_angle = trigger_index*Moptop_Multrun_Rotator_Step_Angle_Get();
+		if(!PIROT_Recorder_Get_End_Position(requested_rotator_angle,exposure_length,&end_rotator_position))
+		{
+			Moptop_General_Error_Number = 660;
+			sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+				"Failed to get recorded rotator end position for '%s' (requested angle %.3f).",
+				record.Filename,requested_rotator_angle);
+			return FALSE;
+		}
+		/* MOPREND and MOPRARC are values 2 and 3 of Multrun_Cube_Column_Name_List */
+		record.Value_List[2] = fmod(end_rotator_position,360.0);
+		record.Value_List[3] = end_rotator_position-requested_rotator_angle;
+		if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+							  MULTRUN_HEADER_SLOT_MOPREND,record.Value_List[2]))
+			return FALSE;
+		if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+							  MULTRUN_HEADER_SLOT_MOPRARC,record.Value_List[3]))
+			return FALSE;
+		if(!CCD_Fits_Image_Raw_Record_Write(&(Multrun_Raw_Data.Raw),trigger_index,&record,card_image_list))
+		{
+			Moptop_General_Error_Number = 661;
+			sprintf(Moptop_General_Error_String,"Multrun_Rotator_Position_Backfill:"
+				"Failed to update rotator end position of frame %d in '%s'.",trigger_index,
+				Multrun_Raw_Data.Raw.Filename);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Update the multrun FITS keywords in the FITS header list, ready for the multrun FITS header template to be
+ * created from the list. This is called once per multrun by Multrun_Fits_Header_Template_Create, with a prototype
+ * frame: the per-frame keywords are added to the list with prototype values, and are overwritten for each frame
+ * by Multrun_Fits_Headers_Patch.
+ * The caller must hold the FITS header list lock (Moptop_Fits_Header_Lock).
+ * <ul>
+ * <li>We set the "OBSTYPE" FITS keyword value based on the value of frame->Do_Standard.
+ * <li>We set the "FILTER1" FITS keyword value based on the cached filter name in Multrun_Data.Filter_Name.
+ * <li>We set the "FILTERI1" FITS keyword value based on the cached filter name in Multrun_Data.Filter_Id.
+ * <li>We set the "DATE"/"DATE-OBS"/"UTSTART" and "MJD" keyword values based on the value of frame->Exposure_Start_Time.
+ * <li>We set the "DATE-END" and "UTEND" keyword values based on the value of frame->Exposure_End_Time.
+ * <li>We set the "TELAPSE" keyword value based on the time elapsed between 
+ *     Multrun_Data.Multrun_Start_Time and frame->Exposure_End_Time.
+ * <li>We set the "RUNNUM" keyword value to frame->Rotation_Number.
+ * <li>We set the "EXPNUM" keyword value to frame->Sequence_Number.
+ * <li>We set the "EXPTOTAL" keyword value to Multrun_Data.Image_Count.
+ * <li>We set the "CCDXBIN"/"CCDYBIN" FITS keyword values based on CCD_Setup_Get_Binning. 
+ * <li>We set the "CCDATEMP" FITS keyword value based on the cached CCD temperature stored in Multrun_Data.CCD_Temperature.
+ * <li>We set the "TEMPSTAT" FITS keyword value based on the cached CCD temperature status stored in
  *     Multrun_Data.CCD_Temperature_Status_String.
  * <li>We set the "MOPRMODE" FITS keyword value to the requested rotator speed stored in Multrun_Data.Rotator_Speed.
  * <li>We set the "MOPRRATE" FITS keyword value to the rotator angular velocity stored in Multrun_Data.Rotator_Run_Velocity.
- * <li>We set the "MOPRREQ" FITS keyword value to the requested_rotator_angle.
- * <li>We set the "MOPRBEG" FITS keyword value to the rotator_start_angle.
- * <li>We set the "MOPREND" FITS keyword value to the rotator_end_angle.
- * <li>We set the "MOPRARC" FITS keyword value to the rotator_difference.
- * <li>We set the "MOPRNUM" FITS keyword value to the Multrun_Data.Rotation_Number.
- * <li>We set the "MOPRPOS" FITS keyword value to the Multrun_Data.Sequence_Number.
- * <li>We set the "EXPTIME" and "XPOSURE" FITS keyword value to the pco_exposure_length_s in seconds.
+ * <li>We set the "MOPRREQ" FITS keyword value to the frame->Requested_Rotator_Angle.
+ * <li>We set the "MOPRBEG" FITS keyword value to the frame->Rotator_Start_Angle.
+ * <li>We set the "MOPREND" FITS keyword value to the frame->Rotator_End_Angle.
+ * <li>We set the "MOPRARC" FITS keyword value to the frame->Rotator_Difference.
+ * <li>We set the "MOPRNUM" FITS keyword value to the frame->Rotation_Number.
+ * <li>We set the "MOPRPOS" FITS keyword value to the frame->Sequence_Number.
+ * <li>We set the "EXPTIME" and "XPOSURE" FITS keyword value to the frame->Exposure_Length in seconds.
  * <li>We set the "EXPREQST" FITS keyword value to the Multrun_Data.Requested_Exposure_Length.
  * <li>We set the "CCDXPIXE" FITS keyword value to CCD_Setup_Get_Pixel_Width in m.
  * <li>We set the "CCDYPIXE" FITS keyword value to CCD_Setup_Get_Pixel_Height in m.
- * <li>We set the "PICNUM" FITS keyword value to the camera_image_number.
- * <li>We set the "CAMTIME" FITS keyword value to the camera_timestamp.
- * <li>We create a file lock on the filename to write to using CCD_Fits_Filename_Lock.
+ * <li>We set the "PICNUM" FITS keyword value to the frame->Camera_Image_Number.
+ * <li>We set the "CAMTIME" FITS keyword value to the frame->Camera_Timestamp.
+ * <li>We set the "CAMUTC" FITS keyword value to the frame->Camera_UTC_Time.
+ * <li>We set the "CLKUNCER" FITS keyword value to the frame->Camera_UTC_Uncertainty.
+ * <li>We set the "DROPPED" FITS keyword value to the frame->Dropped_Frame_Count.
+ * <li>We set the "STATMEAN", "STATMED", "STATSDEV", "STATMIN", "STATMAX" and "STATSAT" FITS keyword values to
+ *     the frame->Statistics.
+ * </ul>
+ * @param frame A prototype frame, containing the data that is the same for every frame in the multrun.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Data
+ * @see #Multrun_Fits_Header_Template_Create
+ * @see #Multrun_Fits_Headers_Patch
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Lock
+ * @see moptop_fits_header.html#Moptop_Fits_Header_String_Add
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Integer_Add
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Float_Add
+ * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Date_String
+ * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Date_Obs_String
+ * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_UtStart_String
+ * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Mjd
+ * @see moptop_general.html#fdifftime
+ * @see moptop_general.html#MOPTOP_GENERAL_ONE_METRE_MICROMETRE
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Pixel_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Pixel_Height
+ */
+static int Multrun_Fits_Headers_Set(struct Moptop_Writer_Frame_Struct *frame)
+{
+	char exposure_time_string[64];
+	double mjd,dvalue;
+	int retval,ivalue;
+
+	/* OBSTYPE */
+	if(frame->Do_Standard)
+		retval = Moptop_Fits_Header_String_Add("OBSTYPE","STANDARD",NULL);
+	else
+		retval = Moptop_Fits_Header_String_Add("OBSTYPE","EXPOSE",NULL);
+	if(retval == FALSE)
+		return FALSE;
+	/* FILTER1 */
+	if(!Moptop_Fits_Header_String_Add("FILTER1",Multrun_Data.Filter_Name,NULL))
+		return FALSE;
+	/* FILTERI1 */
+	if(!Moptop_Fits_Header_String_Add("FILTERI1",Multrun_Data.Filter_Id,NULL))
+		return FALSE;
+	/* update DATE keyword from frame->Exposure_Start_Time */
+	Moptop_Fits_Header_TimeSpec_To_Date_String(frame->Exposure_Start_Time,exposure_time_string);
+	if(!Moptop_Fits_Header_String_Add("DATE",exposure_time_string,"[UTC] Start date of obs."))
+		return FALSE;
+	/* update DATE-OBS keyword from frame->Exposure_Start_Time */
+	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(frame->Exposure_Start_Time,exposure_time_string);
+	if(!Moptop_Fits_Header_String_Add("DATE-OBS",exposure_time_string,"[UTC] Start of obs."))
+		return FALSE;
+	/* update UTSTART keyword from frame->Exposure_Start_Time */
+	Moptop_Fits_Header_TimeSpec_To_UtStart_String(frame->Exposure_Start_Time,exposure_time_string);
+	if(!Moptop_Fits_Header_String_Add("UTSTART",exposure_time_string,"[UTC] Start time of obs."))
+		return FALSE;
+	/* update MJD keyword from frame->Exposure_Start_Time */
+	/* note leap second correction not implemented yet (always FALSE). */
+	if(!Moptop_Fits_Header_TimeSpec_To_Mjd(frame->Exposure_Start_Time,FALSE,&mjd))
+		return FALSE;
+	if(!Moptop_Fits_Header_Float_Add("MJD",mjd,NULL))
+		return FALSE;
+	/* update DATE-END keyword from frame->Exposure_End_Time */
+	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(frame->Exposure_End_Time,exposure_time_string);
+	if(!Moptop_Fits_Header_String_Add("DATE-END",exposure_time_string,"[UTC] End of obs."))
+		return FALSE;
+	/* update UTENDT keyword from frame->Exposure_End_Time */
+	Moptop_Fits_Header_TimeSpec_To_UtStart_String(frame->Exposure_End_Time,exposure_time_string);
+	if(!Moptop_Fits_Header_String_Add("UTEND",exposure_time_string,"[UTC] End time of obs."))
+		return FALSE;
+	/* update TELAPSE keyword with difference between the multrun start timestamp and the 
+	** end timestamp of the current exposure. This means TELAPSE is increasing in each frame of the multrun. */
+	dvalue = fdifftime(frame->Exposure_End_Time,Multrun_Data.Multrun_Start_Time);
+	if(!Moptop_Fits_Header_Float_Add("TELAPSE",dvalue,"[sec] Total obs. duration"))
+		return FALSE;
+	/* update RUNNUM keyword value with the frame->Rotation_Number */
+	if(!Moptop_Fits_Header_Integer_Add("RUNNUM",frame->Rotation_Number,
+					   "Which rotation of the rotator we are on."))
+		return FALSE;
+	/* update EXPNUM keyword value with the frame->Sequence_Number */
+	if(!Moptop_Fits_Header_Integer_Add("EXPNUM",frame->Sequence_Number,
+					   "Which image in the current rotation we are on."))
+		return FALSE;
+	/* update EXPTOTAL keyword value with Multrun_Data.Image_Count */
+	if(!Moptop_Fits_Header_Integer_Add("EXPTOTAL",Multrun_Data.Image_Count,
+					   "Total number of frames expected this multrun."))
+		return FALSE;
+	/* ccdxbin */
+	ivalue = CCD_Setup_Get_Binning();
+	if(!Moptop_Fits_Header_Integer_Add("CCDXBIN",ivalue,NULL))
+		return FALSE;
+	/* ccdybin */
+	ivalue = CCD_Setup_Get_Binning();
+	if(!Moptop_Fits_Header_Integer_Add("CCDYBIN",ivalue,NULL))
+		return FALSE;
+	/* update actual ccd temperature with value stored at start of multrun */
+	if(!Moptop_Fits_Header_Float_Add("CCDATEMP",Multrun_Data.CCD_Temperature,NULL))
+		return FALSE;
+	/* update ccd temperature status string with value stored at start of multrun */
+	if(!Moptop_Fits_Header_String_Add("TEMPSTAT",Multrun_Data.CCD_Temperature_Status_String,NULL))
+		return FALSE;
+	/* update MOPRMODE with configured rotator speed string */
+	if(!Moptop_Fits_Header_String_Add("MOPRMODE",Multrun_Data.Rotator_Speed,"Configured rotator speed"))
+		return FALSE;
+	/* update MOPRRATE with stored angular velocity of rotor in deg/sec */
+	if(!Moptop_Fits_Header_Float_Add("MOPRRATE",Multrun_Data.Rotator_Run_Velocity,
+					 "[deg/s] Angular velocity of rotator"))
+		return FALSE;
+	/* update MOPRREQ with frame->Requested_Rotator_Angle */
+	if(!Moptop_Fits_Header_Float_Add("MOPRREQ",frame->Requested_Rotator_Angle,"[deg] MOPTOP Rotator requested angle"))
+		return FALSE;
+	/* update MOPRBEG with frame->Rotator_Start_Angle */
+	if(!Moptop_Fits_Header_Float_Add("MOPRBEG",frame->Rotator_Start_Angle,"[deg] MOPTOP Rotator begin angle"))
+		return FALSE;
+	/* update MOPREND with frame->Rotator_End_Angle */
+	if(!Moptop_Fits_Header_Float_Add("MOPREND",frame->Rotator_End_Angle,"[deg] MOPTOP Rotator angle at end of exposure"))
+		return FALSE;
+	/* update MOPRARC with frame->Rotator_Difference */
+	if(!Moptop_Fits_Header_Float_Add("MOPRARC",frame->Rotator_Difference,"[deg] MOPTOP Rotator exposure arc"))
+		return FALSE;
+	/* MOPRNUM is the frame->Rotation_Number */
+	if(!Moptop_Fits_Header_Integer_Add("MOPRNUM",frame->Rotation_Number,"MOPTOP Rotation number"))
+		return FALSE;
+	/* MOPRPOS is the frame->Sequence_Number */
+	if(!Moptop_Fits_Header_Integer_Add("MOPRPOS",frame->Sequence_Number,"MOPTOP Position number within rotation"))
+		return FALSE;
+	/* EXPTIME is the actual exposure length returned from the camera, in seconds */
+	if(!Moptop_Fits_Header_Float_Add("EXPTIME",frame->Exposure_Length,"[sec] Actual exposure"))
+		return FALSE;
+	/* XPOSURE is the actual exposure length returned from the camera, in seconds */
+	if(!Moptop_Fits_Header_Float_Add("XPOSURE",frame->Exposure_Length,"[sec] Actual exposure"))
+		return FALSE;
+	/* EXPREQST is the requested exposure length in seconds (from Multrun_Data.Requested_Exposure_Length) */
+	if(!Moptop_Fits_Header_Float_Add("EXPREQST",Multrun_Data.Requested_Exposure_Length,"[sec] Requested exposure"))
+		return FALSE;
+	/* CCDXPIXE is the physical x width of a pixel in metres */
+	if(!Moptop_Fits_Header_Float_Add("CCDXPIXE",
+					 CCD_Setup_Get_Pixel_Width()/((double)MOPTOP_GENERAL_ONE_METRE_MICROMETRE),
+					 "[m] Detector pixel width"))
+		return FALSE;
+	/* CCDYPIXE is the physical y height of a pixel in metres */
+	if(!Moptop_Fits_Header_Float_Add("CCDYPIXE",
+					 CCD_Setup_Get_Pixel_Height()/((double)MOPTOP_GENERAL_ONE_METRE_MICROMETRE),
+					 "[m] Detector pixel height"))
+		return FALSE;
+	/* PICNUM is the camera image number retrieved from the camera read out's metadata. */
+	if(!Moptop_Fits_Header_Integer_Add("PICNUM",frame->Camera_Image_Number,"Camera meta-data image number"))
+		return FALSE;
+	/* CAMTIME is the camera clock timestamp the when this exposure started, from the camera's meta-data */
+	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(frame->Camera_Timestamp,exposure_time_string);
+	if(!Moptop_Fits_Header_String_Add("CAMTIME",exposure_time_string,"[UTC] Cameras timestamp."))
+		return FALSE;
+	/* CAMUTC is the camera timestamp corrected for the camera clock's drift by the camera clock model */
+	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(frame->Camera_UTC_Time,exposure_time_string);
+	if(!Moptop_Fits_Header_String_Add("CAMUTC",exposure_time_string,"[UTC] Drift corrected camera timestamp."))
+		return FALSE;
+	/* CLKUNCER is the camera clock model's fit uncertainty in CAMUTC. CAMUTC can still be late by any error in
+	** the configured readout delay, plus the least host latency in the clock model's lower envelope */
+	if(!Moptop_Fits_Header_Float_Add("CLKUNCER",frame->Camera_UTC_Uncertainty,
+					 "[sec] CAMUTC fit error, excl. readout delay bias"))
+		return FALSE;
+	/* DROPPED is the number of frames dropped so far in this multrun */
+	if(!Moptop_Fits_Header_Integer_Add("DROPPED",frame->Dropped_Frame_Count,"Frames dropped so far in this multrun"))
+		return FALSE;
+	/* STATMEAN/STATMED/STATSDEV/STATMIN/STATMAX/STATSAT are the frame's image statistics */
+	if(!Moptop_Fits_Header_Float_Add("STATMEAN",frame->Statistics.Mean,"[counts] Frame mean pixel value"))
+		return FALSE;
+	if(!Moptop_Fits_Header_Float_Add("STATMED",frame->Statistics.Median,"[counts] Frame median pixel value"))
+		return FALSE;
+	if(!Moptop_Fits_Header_Float_Add("STATSDEV",frame->Statistics.Standard_Deviation,
+					 "[counts] Frame pixel standard deviation"))
+		return FALSE;
+	if(!Moptop_Fits_Header_Integer_Add("STATMIN",frame->Statistics.Minimum,"[counts] Frame minimum pixel value"))
+		return FALSE;
+	if(!Moptop_Fits_Header_Integer_Add("STATMAX",frame->Statistics.Maximum,"[counts] Frame maximum pixel value"))
+		return FALSE;
+	if(!Moptop_Fits_Header_Integer_Add("STATSAT",frame->Statistics.Saturated_Count,"Saturated pixels in frame"))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Create the multrun FITS header template, which contains the FITS headers pre-formatted into card images.
+ * <ul>
+ * <li>We setup a prototype frame containing the per-multrun frame data (do_standard and exposure_length).
+ * <li>We lock the FITS header list using Moptop_Fits_Header_Lock, as it can be updated by other commands.
+ * <li>We call Multrun_Fits_Headers_Set to update the multrun FITS keywords in the FITS header list.
+ * <li>We call Moptop_Fits_Header_Template_Create to format the FITS header list into Multrun_Header_Template, 
+ *     with the keywords in Multrun_Header_Slot_Keyword_List as the per-frame slots.
+ * <li>We unlock the FITS header list using Moptop_Fits_Header_Unlock.
+ * <li>If the binning (CCD_Setup_Get_Binning) is not 1, we scale the template's CCDSCALE value
+ *     (configured for binning 1 in the Java layer) by the binning, using Moptop_Fits_Header_Template_Float_Scale.
+ * </ul>
+ * @param do_standard A boolean, if TRUE this is an observation of a standard, otherwise it is not.
+ * @param exposure_length The exposure length as retrieved from the camera, in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MULTRUN_HEADER_SLOT_COUNT
+ * @see #Multrun_Header_Slot_Keyword_List
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Fits_Headers_Set
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Lock
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Unlock
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Create
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Float_Scale
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static int Multrun_Fits_Header_Template_Create(int do_standard,double exposure_length)
+{
+	struct Moptop_Writer_Frame_Struct prototype_frame;
+	int binning;
+
+	memset(&prototype_frame,0,sizeof(struct Moptop_Writer_Frame_Struct));
+	prototype_frame.Do_Standard = do_standard;
+	prototype_frame.Exposure_Length = exposure_length;
+	if(!Moptop_Fits_Header_Lock())
+		return FALSE;
+	if(!Multrun_Fits_Headers_Set(&prototype_frame))
+	{
+		Moptop_Fits_Header_Unlock();
+		return FALSE;
+	}
+	if(!Moptop_Fits_Header_Template_Create(&Multrun_Header_Template,Multrun_Header_Slot_Keyword_List,
+					       MULTRUN_HEADER_SLOT_COUNT))
+	{
+		Moptop_Fits_Header_Unlock();
+		return FALSE;
+	}
+	if(!Moptop_Fits_Header_Unlock())
+		return FALSE;
+	/* CCDSCALE is configured for binning 1 in the Java layer. Adjust for binning (assume xbin and ybin are equal) */
+	binning = CCD_Setup_Get_Binning();
+	if(binning != 1)
+	{
+		if(!Moptop_Fits_Header_Template_Float_Scale(&Multrun_Header_Template,"CCDSCALE",(double)binning))
+			return FALSE;
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Fits_Header_Template_Create",
+				  LOG_VERBOSITY_VERBOSE,"MULTRUN","Created FITS header template of %d cards.",
+				  Multrun_Header_Template.Card_Count);
+#endif
+	return TRUE;
+}
+
+/**
+ * Overwrite the per-frame slots in a copy of the multrun FITS header template with the values for this frame.
+ * <ul>
+ * <li>We format the "DATE"/"DATE-OBS"/"UTSTART" keyword values from frame->Exposure_Start_Time, 
+ *     and "DATE-END"/"UTEND" from frame->Exposure_End_Time, using Moptop_Fits_Header_TimeSpec_To_Strings.
+ * <li>We set the "MJD" keyword value based on the value of frame->Exposure_Start_Time.
+ * <li>We set the "TELAPSE" keyword value based on the time elapsed between 
+ *     Multrun_Data.Multrun_Start_Time and frame->Exposure_End_Time.
+ * <li>We set the "RUNNUM" and "MOPRNUM" keyword values to frame->Rotation_Number.
+ * <li>We set the "EXPNUM" and "MOPRPOS" keyword values to frame->Sequence_Number.
+ * <li>We set the "MOPRREQ", "MOPRBEG", "MOPREND" and "MOPRARC" keyword values to frame->Requested_Rotator_Angle,
+ *     frame->Rotator_Start_Angle, frame->Rotator_End_Angle and frame->Rotator_Difference.
+ * <li>We set the "PICNUM" keyword value to frame->Camera_Image_Number.
+ * <li>We set the "CAMTIME" keyword value to frame->Camera_Timestamp.
+ * <li>We set the "CAMUTC" keyword value to frame->Camera_UTC_Time, and "CLKUNCER" to frame->Camera_UTC_Uncertainty.
+ * <li>We set the "DROPPED" keyword value to frame->Dropped_Frame_Count.
+ * <li>We set the "STATMEAN", "STATMED", "STATSDEV", "STATMIN", "STATMAX" and "STATSAT" keyword values to 
+ *     frame->Statistics.
+ * </ul>
+ * This is called by the writer threads, each with their own copy of the template's card images.
+ * @param frame The read out frame being written to disk, containing the per-frame data captured when it was acquired.
+ * @param card_image_list This frame's copy of the multrun FITS header template card images.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MULTRUN_HEADER_SLOT
+ * @see #Multrun_Data
+ * @see #Multrun_Header_Template
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_String_Set
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Integer_Set
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Float_Set
+ * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Strings
+ * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Mjd
+ * @see moptop_general.html#fdifftime
+ */
+static int Multrun_Fits_Headers_Patch(struct Moptop_Writer_Frame_Struct *frame,char *card_image_list)
+{
+	char date_string[16];
+	char date_obs_string[32];
+	char utstart_string[16];
+	double mjd;
+
+	/* DATE, DATE-OBS, UTSTART from frame->Exposure_Start_Time */
+	Moptop_Fits_Header_TimeSpec_To_Strings(frame->Exposure_Start_Time,date_string,date_obs_string,utstart_string);
+	if(!Moptop_Fits_Header_Template_String_Set(&Multrun_Header_Template,card_image_list,
+						   MULTRUN_HEADER_SLOT_DATE,date_string))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_String_Set(&Multrun_Header_Template,card_image_list,
+						   MULTRUN_HEADER_SLOT_DATE_OBS,date_obs_string))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_String_Set(&Multrun_Header_Template,card_image_list,
+						   MULTRUN_HEADER_SLOT_UTSTART,utstart_string))
+		return FALSE;
+	/* MJD from frame->Exposure_Start_Time. Note leap second correction not implemented yet (always FALSE). */
+	if(!Moptop_Fits_Header_TimeSpec_To_Mjd(frame->Exposure_Start_Time,FALSE,&mjd))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_MJD,mjd))
+		return FALSE;
+	/* DATE-END, UTEND from frame->Exposure_End_Time */
+	Moptop_Fits_Header_TimeSpec_To_Strings(frame->Exposure_End_Time,NULL,date_obs_string,utstart_string);
+	if(!Moptop_Fits_Header_Template_String_Set(&Multrun_Header_Template,card_image_list,
+						   MULTRUN_HEADER_SLOT_DATE_END,date_obs_string))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_String_Set(&Multrun_Header_Template,card_image_list,
+						   MULTRUN_HEADER_SLOT_UTEND,utstart_string))
+		return FALSE;
+	/* TELAPSE is the time between the multrun start and the end of this exposure */
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,MULTRUN_HEADER_SLOT_TELAPSE,
+				     fdifftime(frame->Exposure_End_Time,Multrun_Data.Multrun_Start_Time)))
+		return FALSE;
+	/* RUNNUM/MOPRNUM are the frame->Rotation_Number */
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_RUNNUM,frame->Rotation_Number))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_MOPRNUM,frame->Rotation_Number))
+		return FALSE;
+	/* EXPNUM/MOPRPOS are the frame->Sequence_Number */
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_EXPNUM,frame->Sequence_Number))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_MOPRPOS,frame->Sequence_Number))
+		return FALSE;
+	/* rotator angles */
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_MOPRREQ,frame->Requested_Rotator_Angle))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_MOPRBEG,frame->Rotator_Start_Angle))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_MOPREND,frame->Rotator_End_Angle))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_MOPRARC,frame->Rotator_Difference))
+		return FALSE;
+	/* PICNUM is the camera image number retrieved from the camera read out's metadata. */
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_PICNUM,frame->Camera_Image_Number))
+		return FALSE;
+	/* CAMTIME is the camera clock timestamp the when this exposure started, from the camera's meta-data */
+	Moptop_Fits_Header_TimeSpec_To_Strings(frame->Camera_Timestamp,NULL,date_obs_string,NULL);
+	if(!Moptop_Fits_Header_Template_String_Set(&Multrun_Header_Template,card_image_list,
+						   MULTRUN_HEADER_SLOT_CAMTIME,date_obs_string))
+		return FALSE;
+	/* CAMUTC/CLKUNCER are the drift corrected camera timestamp and it's uncertainty, from the camera clock model */
+	Moptop_Fits_Header_TimeSpec_To_Strings(frame->Camera_UTC_Time,NULL,date_obs_string,NULL);
+	if(!Moptop_Fits_Header_Template_String_Set(&Multrun_Header_Template,card_image_list,
+						   MULTRUN_HEADER_SLOT_CAMUTC,date_obs_string))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_CLKUNCER,frame->Camera_UTC_Uncertainty))
+		return FALSE;
+	/* DROPPED is the number of frames dropped so far in this multrun */
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_DROPPED,frame->Dropped_Frame_Count))
+		return FALSE;
+	/* STATMEAN/STATMED/STATSDEV/STATMIN/STATMAX/STATSAT are the frame's image statistics */
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_STATMEAN,frame->Statistics.Mean))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_STATMED,frame->Statistics.Median))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Float_Set(&Multrun_Header_Template,card_image_list,
+						  MULTRUN_HEADER_SLOT_STATSDEV,frame->Statistics.Standard_Deviation))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_STATMIN,frame->Statistics.Minimum))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_STATMAX,frame->Statistics.Maximum))
+		return FALSE;
+	if(!Moptop_Fits_Header_Template_Integer_Set(&Multrun_Header_Template,card_image_list,
+						    MULTRUN_HEADER_SLOT_STATSAT,frame->Statistics.Saturated_Count))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Write the FITS image to disk.
+ * <ul>
+ * <li>If Multrun_Data.Output_Mode is MULTRUN_OUTPUT_MODE_CUBE, we instead write the frame as a plane of it's 
+ *     rotation's FITS cube, by calling Multrun_Write_Fits_Cube_Plane.
+ * <li>If Multrun_Data.Output_Mode is MULTRUN_OUTPUT_MODE_RAW, we instead write the frame into the multrun's 
+ *     raw capture file, by calling Multrun_Write_Raw_Frame.
+ * <li>If Multrun_Data.Output_Mode is MULTRUN_OUTPUT_MODE_STACK, we instead add the frame to it's rotator 
+ *     position's stack, by calling Moptop_Stack_Frame_Add.
+ * <li>If the native FITS writer is in use without compression, and the writer is staging frames in memory 
+ *     (Moptop_Writer_Stage_Is_Enabled), we instead stage the frame by calling Multrun_Write_Fits_Image_Staged.
+ * <li>We start publishing the FITS image using CCD_Fits_Filename_Publish_Begin. Depending on the publish mode,
+ *     this either creates a file lock on the filename, or returns a hidden temporary filename to write to instead.
+ * <li>We calculate the binned image dimensions using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
+ *     CCD_Setup_Get_Binning.
+ * <li>We check the computed binned image size is not larger than the frame->Image_Buffer_Length.
+ * <li>We copy the multrun FITS header template's card images into card_image_list, using 
+ *     Moptop_Fits_Header_Template_Copy.
+ * <li>We call Multrun_Fits_Headers_Patch to overwrite the per-frame FITS keywords in card_image_list.
+ * <li>If Multrun_Data.Native_Fits_Writer is TRUE, and Multrun_Data.Compress_Enable is FALSE:
+ *     <ul>
+ *     <li>We convert the image data in place to FITS format, flipping it in X and/or Y if Multrun_Data.Flip_X / 
+ *         Multrun_Data.Flip_Y are TRUE, in one pass using CCD_Fits_Image_Data_Convert.
+ *     <li>If Multrun_Preallocate_Claim returns TRUE, the file has already been created and preallocated,
+ *         and we write the headers and image data into it using CCD_Fits_Image_Write_Preallocated.
+ *         Otherwise we write the headers and image data to disk using CCD_Fits_Image_Write.
+ *         Both use the FITS I/O backend (pwrite or io_uring) selected at startup by "file.fits.io.backend".
+ *     </ul>
+ * <li>Otherwise:
+ *     <ul>
+ *     <li>If Multrun_Data.Flip_X is TRUE, we call Moptop_Multrun_Flip_X to flip the image data in the X direction.
+ *     <li>If Multrun_Data.Flip_Y is TRUE, we call Moptop_Multrun_Flip_Y to flip the image data in the Y direction.
+ *     <li>We write the headers and image data using CFITSIO, by calling Multrun_Write_Fits_Image_Cfitsio. 
+ *         This tile compresses the image if Multrun_Data.Compress_Enable is TRUE.
+ *     </ul>
+ * <li>We publish the FITS image using Moptop_Writer_Publish, which (once the file is as durable as the 
+ *     writer durability policy requires) either removes the file lock, or renames the temporary file 
+ *     to the FITS filename. Depending on the policy, this may happen later, when the rest of the frame's
+ *     rotation has been written.
+ * </ul>
+ * The times taken by the filename lock (publish begin), header, image convert and FITS write steps
+ * are added to the timing histograms using Moptop_Timing_Add. The writer adds the file sync and
+ * filename unlock (publish end) times.
+ * Before any of this, the frame's image statistics are computed into frame->Statistics by Multrun_Statistics_Frame,
+ * for the FITS headers. Then, if the real time reduction is enabled (Moptop_Reduce_Is_Enabled), the frame is accumulated 
+ * into it's rotation's reduction by Multrun_Reduce_Frame, and if the real time calibration is enabled 
+ * (Moptop_Calibrate_Is_Enabled), a calibrated copy of the frame is written by Multrun_Calibrate_Frame, 
+ * whatever the output mode.
+ * This routine is called by the writer threads (as the write function passed to Moptop_Writer_Start),
+ * so all per-frame data is taken from frame rather than Multrun_Data, which the acquisition thread
+ * will be updating for the next frame.
+ * @param frame The read out frame to write to disk. This contains the image data and all the per-frame data
+ *        captured when it was acquired, including the FITS filename to write the data into.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Fits_Headers_Patch
+ * @see #Multrun_Statistics_Frame
+ * @see #Multrun_Reduce_Frame
+ * @see #Multrun_Calibrate_Frame
+ * @see #Multrun_Write_Fits_Image_Cfitsio
+ * @see #Multrun_Write_Fits_Cube_Plane
+ * @see #Multrun_Write_Raw_Frame
+ * @see #Multrun_Write_Fits_Image_Staged
+ * @see #Multrun_Preallocate_Claim
+ * @see #Moptop_Multrun_Flip_X
+ * @see #Moptop_Multrun_Flip_Y
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_writer.html#Moptop_Writer_Start
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ * @see moptop_writer.html#Moptop_Writer_Stage_Is_Enabled
+ * @see moptop_stack.html#Moptop_Stack_Frame_Add
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_LENGTH
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Log
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Convert
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Write
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Write_Preallocated
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Timestamp_Clock_Frequency
+ */
+static int Multrun_Write_Fits_Image(struct Moptop_Writer_Frame_Struct *frame)
+{
+	struct timespec start_time,end_time;
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int ncols_unbinned,nrows_unbinned,binning,ncols_binned,nrows_binned,retval;
+	
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
+				  "MULTRUN","Started saving FITS filename '%s'.",frame->Filename);
+#endif
+	/* compute the frame's image statistics for it's FITS headers, while it is still in camera format */
+	Multrun_Statistics_Frame(frame);
+	/* accumulate the frame into it's rotation's real time reduction, while it is still in camera format */
+	if(Moptop_Reduce_Is_Enabled())
+		Multrun_Reduce_Frame(frame);
+	/* write a calibrated copy of the frame, also from the camera format image data */
+	if(Moptop_Calibrate_Is_Enabled())
+		Multrun_Calibrate_Frame(frame);
+	if(Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_CUBE)
+		return Multrun_Write_Fits_Cube_Plane(frame);
+	if(Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_RAW)
+		return Multrun_Write_Raw_Frame(frame);
+	if(Multrun_Data.Output_Mode == MULTRUN_OUTPUT_MODE_STACK)
+		return Moptop_Stack_Frame_Add(frame);
+	if(Multrun_Data.Native_Fits_Writer && (Multrun_Data.Compress_Enable == FALSE) && 
+	   Moptop_Writer_Stage_Is_Enabled())
+		return Multrun_Write_Fits_Image_Staged(frame);
+	/* create lock file, or get the temporary filename to write to */
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
+				  "MULTRUN","Locking FITS filename %s.",frame->Filename);
+#endif
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Filename_Publish_Begin(frame->Filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 630;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:Failed to lock '%s'.",frame->Filename);
+		return FALSE;				
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FILENAME_LOCK,start_time,end_time);
+	/* basic dimensions */
+	ncols_unbinned = CCD_Setup_Get_Sensor_Width();
+	nrows_unbinned = CCD_Setup_Get_Sensor_Height();
+	binning = CCD_Setup_Get_Binning();
+	ncols_binned = ncols_unbinned/binning;
+	nrows_binned = nrows_unbinned/binning;
+	if((ncols_binned*nrows_binned) > frame->Image_Buffer_Length)
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		Moptop_General_Error_Number = 634;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:FITS image dimension mismatch:"
+			"filename '%s', binned ncols = %d, binned_nrows = %d, image buffer length = %d.",
+			frame->Filename,ncols_binned,nrows_binned,frame->Image_Buffer_Length);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	/* Copy the pre-formatted multrun FITS headers, and overwrite the per-frame keywords.
+	** The template is read-only during the multrun, so the writer threads don't need to lock it. */
+	Moptop_Fits_Header_Template_Copy(&Multrun_Header_Template,card_image_list);
+	if(!Multrun_Fits_Headers_Patch(frame,card_image_list))
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_HEADER,start_time,end_time);
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
+				  "MULTRUN","Saving to filename %s.",write_filename);
+#endif
+	if(Multrun_Data.Native_Fits_Writer && (Multrun_Data.Compress_Enable == FALSE))
+	{
+		/* flip and convert the image buffer to FITS format in place, in one pass.
+		** This is OK as the frame is returned to the writer's free list afterwards. */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Fits_Image_Data_Convert((unsigned short *)frame->Image_Buffer,(unsigned short *)frame->Image_Buffer,
+						ncols_binned,nrows_binned,Multrun_Data.Flip_X,Multrun_Data.Flip_Y))
+		{
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			Moptop_General_Error_Number = 654;
+			sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:Failed to convert image data for '%s'.",
+				frame->Filename);
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_IMAGE_CONVERT,start_time,end_time);
+		/* write the headers and data directly, into the preallocated file if there is one */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(Multrun_Preallocate_Claim(frame))
+		{
+			retval = CCD_Fits_Image_Write_Preallocated(write_filename,card_image_list,
+								   Multrun_Header_Template.Card_Count,ncols_binned,
+								   nrows_binned,(unsigned short *)frame->Image_Buffer);
+		}
+		else
+		{
+			retval = CCD_Fits_Image_Write(write_filename,card_image_list,Multrun_Header_Template.Card_Count,
+						      ncols_binned,nrows_binned,(unsigned short *)frame->Image_Buffer);
+		}
+		if(retval == FALSE)
+		{
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			Moptop_General_Error_Number = 653;
+			sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:Failed to write '%s'.",
+				frame->Filename);
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_WRITE,start_time,end_time);
+	}
+	else
+	{
+		/* check and flip images if configured to do so */
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(Multrun_Data.Flip_X)
+			Moptop_Multrun_Flip_X(ncols_binned,nrows_binned,(unsigned short *)frame->Image_Buffer);
+		if(Multrun_Data.Flip_Y)
+			Moptop_Multrun_Flip_Y(ncols_binned,nrows_binned,(unsigned short *)frame->Image_Buffer);
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_IMAGE_CONVERT,start_time,end_time);
+		if(!Multrun_Write_Fits_Image_Cfitsio(frame,write_filename,card_image_list,ncols_binned,nrows_binned))
+		{
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			return FALSE;
+		}
+	}
+	/* unlock FITS filename lock, or rename the temporary file to the FITS filename,
+	** once it is as durable as the writer durability policy requires */
+	if(!Moptop_Writer_Publish(write_filename,frame->Rotation_Number,1))
+		return FALSE;
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log("multrun","moptop_multrun.c","Multrun_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,"MULTRUN",
+			   "Finished.");
+#endif
+	return TRUE;
+}
+
+/**
+ * Accumulate a frame into it's rotation's real time Stokes reduction, and write the reduced product if this frame
+ * completes the rotation. This is called by Multrun_Write_Fits_Image, before the image data is converted.
+ * <ul>
+ * <li>We accumulate the frame using Moptop_Reduce_Frame_Add.
+ * <li>If the rotation is now complete, we generate the product's FITS filename using 
+ *     CCD_Fits_Filename_Get_Run_Window_Filename, with the rotation number as the run number, the run window number,
+ *     and the CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME pipeline flag.
+ * <li>We copy the multrun FITS header template, and patch it with this (the last) frame's per-frame keywords using
+ *     Multrun_Fits_Headers_Patch.
+ * <li>We normalise, flip and write the product using Moptop_Reduce_Rotation_Write.
+ * </ul>
+ * The reduced products are not added to the multrun's list of filenames. Failing to reduce a rotation is logged,
+ * rather than failing the multrun. If the product cannot be written, the rotation is discarded using 
+ * Moptop_Reduce_Rotation_Discard.
+ * @param frame The read out frame being written, with it's image data still in camera format.
+ * @see #Multrun_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Fits_Headers_Patch
+ * @see moptop_reduce.html#Moptop_Reduce_Frame_Add
+ * @see moptop_reduce.html#Moptop_Reduce_Rotation_Write
+ * @see moptop_reduce.html#Moptop_Reduce_Rotation_Discard
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_general.html#Moptop_General_Error
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Get_Run_Window_Filename
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_RUN_WINDOW_NUMBER
+ */
+static void Multrun_Reduce_Frame(struct Moptop_Writer_Frame_Struct *frame)
+{
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	char filename[MULTRUN_FITS_FILENAME_LENGTH];
+	enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type;
+	int rotation_complete;
+
+	if(!Moptop_Reduce_Frame_Add(frame->Rotation_Number,frame->Sequence_Number,
+				    (unsigned short *)frame->Image_Buffer,&rotation_complete))
+	{
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Reduce_Frame",LOG_VERBOSITY_TERSE,"MULTRUN");
+		return;
+	}
+	if(rotation_complete == FALSE)
+		return;
+	if(frame->Do_Standard)
+		exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_STANDARD;
+	else
+		exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_EXPOSURE;
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(exposure_type,CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME,
+						      frame->Rotation_Number,CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,
+						      filename,MULTRUN_FITS_FILENAME_LENGTH))
+	{
+		Moptop_Reduce_Rotation_Discard(frame->Rotation_Number);
+		Moptop_General_Error_Number = 696;
+		sprintf(Moptop_General_Error_String,"Multrun_Reduce_Frame:"
+			"Failed to get reduced filename for rotation %d.",frame->Rotation_Number);
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Reduce_Frame",LOG_VERBOSITY_TERSE,"MULTRUN");
+		return;
+	}
+	Moptop_Fits_Header_Template_Copy(&Multrun_Header_Template,card_image_list);
+	if(!Multrun_Fits_Headers_Patch(frame,card_image_list))
+	{
+		Moptop_Reduce_Rotation_Discard(frame->Rotation_Number);
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Reduce_Frame",LOG_VERBOSITY_TERSE,"MULTRUN");
+		return;
+	}
+	if(!Moptop_Reduce_Rotation_Write(frame->Rotation_Number,filename,card_image_list,
+					 Multrun_Header_Template.Card_Count,Multrun_Data.Flip_X,Multrun_Data.Flip_Y))
+	{
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Reduce_Frame",LOG_VERBOSITY_TERSE,"MULTRUN");
+		return;
+	}
+}
+
+/**
+ * Write a bias/dark subtracted (and flat fielded) copy of a frame, using the master frames held in memory.
+ * This is called by Multrun_Write_Fits_Image, before the image data is converted.
+ * <ul>
+ * <li>We generate the calibrated frame's FITS filename using CCD_Fits_Filename_Get_Run_Window_Filename, 
+ *     with the frame's rotation number as the run number, it's sequence number as the window number,
+ *     and the CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME pipeline flag.
+ * <li>We copy the multrun FITS header template, and patch it with the frame's per-frame keywords using
+ *     Multrun_Fits_Headers_Patch.
+ * <li>We calibrate, flip and write the frame using Moptop_Calibrate_Frame_Write.
+ * </ul>
+ * The calibrated frames are not added to the multrun's list of filenames. Failing to calibrate a frame is logged,
+ * rather than failing the multrun.
+ * @param frame The read out frame being written, with it's image data still in camera format.
+ * @see #Multrun_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Fits_Headers_Patch
+ * @see moptop_calibrate.html#Moptop_Calibrate_Frame_Write
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_general.html#Moptop_General_Error
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Get_Run_Window_Filename
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME
+ */
+static void Multrun_Calibrate_Frame(struct Moptop_Writer_Frame_Struct *frame)
+{
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	char filename[MULTRUN_FITS_FILENAME_LENGTH];
+	enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type;
+
+	if(frame->Do_Standard)
+		exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_STANDARD;
+	else
+		exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_EXPOSURE;
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(exposure_type,CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME,
+						      frame->Rotation_Number,frame->Sequence_Number,
+						      filename,MULTRUN_FITS_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 698;
+		sprintf(Moptop_General_Error_String,"Multrun_Calibrate_Frame:"
+			"Failed to get calibrated filename for rotation %d sequence %d.",frame->Rotation_Number,
+			frame->Sequence_Number);
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Calibrate_Frame",LOG_VERBOSITY_TERSE,
+				     "MULTRUN");
+		return;
+	}
+	Moptop_Fits_Header_Template_Copy(&Multrun_Header_Template,card_image_list);
+	if(!Multrun_Fits_Headers_Patch(frame,card_image_list))
+	{
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Calibrate_Frame",LOG_VERBOSITY_TERSE,
+				     "MULTRUN");
+		return;
+	}
+	if(!Moptop_Calibrate_Frame_Write(frame->Rotation_Number,(unsigned short *)frame->Image_Buffer,filename,
+					 card_image_list,Multrun_Header_Template.Card_Count))
+	{
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Calibrate_Frame",LOG_VERBOSITY_TERSE,
+				     "MULTRUN");
+		return;
+	}
+}
+
+/**
+ * Compute the image statistics of a frame, for it's FITS headers. This is called by Multrun_Write_Fits_Image, 
+ * before the image data is converted.
+ * <ul>
+ * <li>If the statistics are disabled (Moptop_Statistics_Is_Enabled), we set the frame's statistics to zero
+ *     and return.
+ * <li>We calculate the number of binned pixels using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
+ *     CCD_Setup_Get_Binning, limited to the number of pixels in frame->Image_Buffer_Length.
+ * <li>We compute the statistics into frame->Statistics using Moptop_Statistics_Frame_Compute.
+ * </ul>
+ * Failing to compute the statistics is logged, rather than failing the multrun, and the frame's statistics
+ * are set to zero.
+ * @param frame The read out frame being written, with it's image data still in camera format.
+ * @see moptop_statistics.html#Moptop_Statistics_Is_Enabled
+ * @see moptop_statistics.html#Moptop_Statistics_Frame_Compute
+ * @see moptop_general.html#Moptop_General_Error
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static void Multrun_Statistics_Frame(struct Moptop_Writer_Frame_Struct *frame)
+{
+	int binning,pixel_count;
+
+	if(!Moptop_Statistics_Is_Enabled())
+	{
+		memset(&(frame->Statistics),0,sizeof(struct Moptop_Statistics_Struct));
+		return;
+	}
+	binning = CCD_Setup_Get_Binning();
+	pixel_count = (CCD_Setup_Get_Sensor_Width()/binning)*(CCD_Setup_Get_Sensor_Height()/binning);
+	if(pixel_count > (frame->Image_Buffer_Length/(int)sizeof(unsigned short)))
+		pixel_count = frame->Image_Buffer_Length/sizeof(unsigned short);
+	if(!Moptop_Statistics_Frame_Compute((unsigned short *)frame->Image_Buffer,pixel_count,&(frame->Statistics)))
+	{
+		memset(&(frame->Statistics),0,sizeof(struct Moptop_Statistics_Struct));
+		Moptop_General_Error("multrun","moptop_multrun.c","Multrun_Statistics_Frame",LOG_VERBOSITY_TERSE,
+				     "MULTRUN");
+	}
+}
+
+/**
+ * Stage the FITS image in memory, to be written to disk by the writer's staging flush thread. This is used instead
+ * of writing the image directly when the writer is staging frames (Moptop_Writer_Stage_Is_Enabled) and the native
+ * FITS writer is in use without compression.
+ * <ul>
+ * <li>We calculate the binned image dimensions using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
+ *     CCD_Setup_Get_Binning, and check the binned image size is not larger than the frame->Image_Buffer_Length.
+ * <li>We copy the multrun FITS header template's card images into card_image_list, using 
+ *     Moptop_Fits_Header_Template_Copy, and call Multrun_Fits_Headers_Patch to overwrite the per-frame keywords.
+ * <li>We convert the image data in place to FITS format, flipping it in X and/or Y if Multrun_Data.Flip_X / 
+ *     Multrun_Data.Flip_Y are TRUE, in one pass using CCD_Fits_Image_Data_Convert.
+ * <li>We copy the headers and image data into the staging arena using Moptop_Writer_Stage. This blocks if the
+ *     arena is full. The staging flush thread then locks the FITS filename (or creates the temporary filename),
+ *     writes the file and publishes it through Moptop_Writer_Publish.
+ * </ul>
+ * The times taken by the header, image convert and staging copy steps are added to the HEADER, IMAGE_CONVERT and 
+ * FITS_WRITE timing histograms using Moptop_Timing_Add. The writer adds the filename lock, staging flush, file sync 
+ * and filename unlock times.
+ * @param frame The read out frame to stage. This contains the image data and all the per-frame data
+ *        captured when it was acquired, including the FITS filename to write the data into.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Fits_Headers_Patch
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_writer.html#Moptop_Writer_Stage
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_LENGTH
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Convert
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static int Multrun_Write_Fits_Image_Staged(struct Moptop_Writer_Frame_Struct *frame)
+{
+	struct timespec start_time,end_time;
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	int binning,ncols_binned,nrows_binned;
+
+	binning = CCD_Setup_Get_Binning();
+	ncols_binned = CCD_Setup_Get_Sensor_Width()/binning;
+	nrows_binned = CCD_Setup_Get_Sensor_Height()/binning;
+	if((ncols_binned*nrows_binned) > frame->Image_Buffer_Length)
+	{
+		Moptop_General_Error_Number = 694;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image_Staged:FITS image dimension mismatch:"
+			"filename '%s', binned ncols = %d, binned_nrows = %d, image buffer length = %d.",
+			frame->Filename,ncols_binned,nrows_binned,frame->Image_Buffer_Length);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	Moptop_Fits_Header_Template_Copy(&Multrun_Header_Template,card_image_list);
+	if(!Multrun_Fits_Headers_Patch(frame,card_image_list))
+		return FALSE;
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_HEADER,start_time,end_time);
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Image_Data_Convert((unsigned short *)frame->Image_Buffer,(unsigned short *)frame->Image_Buffer,
+					ncols_binned,nrows_binned,Multrun_Data.Flip_X,Multrun_Data.Flip_Y))
+	{
+		Moptop_General_Error_Number = 695;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image_Staged:Failed to convert image data for '%s'.",
+			frame->Filename);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_IMAGE_CONVERT,start_time,end_time);
+	/* copy the headers and data into the staging arena, the staging flush thread writes and publishes the file */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!Moptop_Writer_Stage(frame->Filename,frame->Rotation_Number,card_image_list,
+				Multrun_Header_Template.Card_Count,ncols_binned,nrows_binned,
+				(unsigned short *)frame->Image_Buffer))
+		return FALSE;
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_WRITE,start_time,end_time);
+	return TRUE;
+}
+
+/**
+ * Write the FITS headers and image data to disk using CFITSIO. This is used when the native FITS writer
+ * (Multrun_Data.Native_Fits_Writer) is not enabled, or tile compression (Multrun_Data.Compress_Enable) is.
+ * <ul>
  * <li>We create the FITS filename using fits_create_file.
- * <li>We calculate the binned image dimensions using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
- *     CCD_Setup_Get_Binning.
+ * <li>If Multrun_Data.Compress_Enable is TRUE, we set the compression type to RICE_1 using 
+ *     fits_set_compression_type. The image is then written as an fpack compatible tile compressed (ZIMAGE) binary 
+ *     table extension after an empty primary HDU, with the default CFITSIO tiling of one image row per tile. 
+ *     Rice compression of integer data is lossless. We take the writer thread's CPU time 
+ *     (CLOCK_THREAD_CPUTIME_ID) before writing the headers.
  * <li>We create an empty image of the correct dimensions using fits_create_img.
- * <li>We write the FITS headers to the FITS image using CCD_Fits_Header_Write_To_Fits.
- * <li>We check the computed binned image size is not larger than the image_buffer_length.
- * <li>If Multrun_Data.Flip_X is TRUE, we call Moptop_Multrun_Flip_X to flip the image data in the X direction.
- * <li>If Multrun_Data.Flip_Y is TRUE, we call Moptop_Multrun_Flip_Y to flip the image data in the Y direction.
+ * <li>We write the FITS headers to the FITS image using Moptop_Fits_Header_Template_Write_To_Fits.
  * <li>We write the image data to the FITS image using fits_write_img.
- * <li>If the binning value is not 1, we retrieve the current CCDSCALE value, scale it by the binning, and update the FITS
- *     keyword value.
  * <li>We close the FITS image using fits_close_file.
- * <li>We remove the file lock on the FITS image using CCD_Fits_Filename_UnLock.
+ * <li>If the image was compressed, we get the compressed file size using stat, and add it, the uncompressed 
+ *     image data size and the CPU time used to write and compress the image to the writer statistics, using 
+ *     Moptop_Writer_Compression_Add.
  * </ul>
- * @param do_standard A boolean, if TRUE this is an observation of a standard, otherwise it is not.
- * @param pco_exposure_length_s The exposure length as retrieved from the camera, in seconds.
- * @param exposure_end_time A timestamp representing the end time of the exposure being saved. Actually a timestamp
- *        taken just after the camera has signalled a buffer is available.
- * @param camera_image_number The camera image number extracted from the read-out image's meta-data.
- * @param camera_timestamp A timestamp recorded by the camera and extracted from the read-out image's meta-data.
- * @param requested_rotator_angle The requested rotator angle at which we expect the exposure to have started at 
- *        in degrees.
- * @param rotator_start_angle The rotator angle _in the current rotation_ at which 
- *        we expect the exposure to have started at in degrees.
- * @param rotator_end_angle The rotator angle _in the current rotation_ either measured or predicted at the end of the 
- *        exposure.
- * @param rotator_difference The difference between the rotator start angle and the rotator end angle in degrees.
- * @param image_buffer The image buffer containing the data to write to disk.
- * @param image_buffer_length The length of data in the image buffer.
- * @param filename A string containing the FITS filename to write the data into.
+ * The times taken by the FITS create, FITS write (headers and image data) and FITS close steps
+ * are added to the timing histograms using Moptop_Timing_Add.
+ * The caller is responsible for the FITS filename lock (publishing the FITS image).
+ * @param frame The read out frame to write to disk. This contains the image data.
+ * @param filename The filename to write the data into. This is frame's FITS filename, or a temporary filename
+ *        if the FITS image is published by renaming it (CCD_Fits_Filename_Publish_Begin).
+ * @param card_image_list This frame's copy of the multrun FITS header template card images, already patched.
+ * @param ncols_binned The number of columns in the (binned) image.
+ * @param nrows_binned The number of rows in the (binned) image.
  * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Header_Template
  * @see #Multrun_Data
- * @see #Moptop_Multrun_Flip_X
- * @see #Moptop_Multrun_Flip_Y
- * @see moptop_fits_header.html#Moptop_Fits_Header_String_Add
- * @see moptop_fits_header.html#Moptop_Fits_Header_Integer_Add
- * @see moptop_fits_header.html#Moptop_Fits_Header_Long_Long_Integer_Add
- * @see moptop_fits_header.html#Moptop_Fits_Header_Float_Add
- * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Date_String
- * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Date_Obs_String
- * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_UtStart_String
- * @see moptop_fits_header.html#Moptop_Fits_Header_TimeSpec_To_Mjd
- * @see moptop_general.html#fdifftime
- * @see moptop_general.html#MOPTOP_GENERAL_ONE_METRE_MICROMETRE
- * @see moptop_general.html#Moptop_General_Log
- * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_writer.html#Moptop_Writer_Compression_Add
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Write_To_Fits
+ * @see moptop_timing.html#Moptop_Timing_Add
  * @see moptop_general.html#Moptop_General_Error_Number
  * @see moptop_general.html#Moptop_General_Error_String
- * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Lock
- * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_UnLock
- * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
- * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
- * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
- * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Pixel_Width
- * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Pixel_Height
- * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Timestamp_Clock_Frequency
  */
-static int Multrun_Write_Fits_Image(int do_standard,double pco_exposure_length_s,
-				    struct timespec exposure_end_time,int camera_image_number,
-				    struct timespec camera_timestamp,
-				    double requested_rotator_angle,double rotator_start_angle,
-				    double rotator_end_angle,double rotator_difference,
-				    unsigned char *image_buffer,
-				    int image_buffer_length,char *filename)
+static int Multrun_Write_Fits_Image_Cfitsio(struct Moptop_Writer_Frame_Struct *frame,char *filename,
+					    char *card_image_list,int ncols_binned,int nrows_binned)
 {
+	struct timespec start_time,end_time,cpu_start_time,cpu_end_time;
+	struct stat file_status;
 	fitsfile *fp = NULL;
-	char exposure_time_string[64];
-	double mjd,ccdscale,dvalue;
 	long axes[2];
 	int retval=0,status=0;
-	int ncols_unbinned,nrows_unbinned,binning,ncols_binned,nrows_binned,ivalue;
 	char buff[32]; /* fits_get_errstatus returns 30 chars max */
-	
-#if MOPTOP_DEBUG > 5
-	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
-				  "MULTRUN","Started saving FITS filename '%s'.",filename);
-#endif
-	/* sort out some FITS headers for later */
-	/* OBSTYPE */
-	if(do_standard)
-		retval = Moptop_Fits_Header_String_Add("OBSTYPE","STANDARD",NULL);
-	else
-		retval = Moptop_Fits_Header_String_Add("OBSTYPE","EXPOSE",NULL);
-	if(retval == FALSE)
-		return FALSE;
-	/* FILTER1 */
-	if(!Moptop_Fits_Header_String_Add("FILTER1",Multrun_Data.Filter_Name,NULL))
-		return FALSE;
-	/* FILTERI1 */
-	if(!Moptop_Fits_Header_String_Add("FILTERI1",Multrun_Data.Filter_Id,NULL))
-		return FALSE;
-	/* update DATE keyword from Multrun_Data.Exposure_Start_Time */
-	Moptop_Fits_Header_TimeSpec_To_Date_String(Multrun_Data.Exposure_Start_Time,exposure_time_string);
-	if(!Moptop_Fits_Header_String_Add("DATE",exposure_time_string,"[UTC] Start date of obs."))
-		return FALSE;
-	/* update DATE-OBS keyword from Multrun_Data.Exposure_Start_Time */
-	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(Multrun_Data.Exposure_Start_Time,exposure_time_string);
-	if(!Moptop_Fits_Header_String_Add("DATE-OBS",exposure_time_string,"[UTC] Start of obs."))
-		return FALSE;
-	/* update UTSTART keyword from Multrun_Data.Exposure_Start_Time */
-	Moptop_Fits_Header_TimeSpec_To_UtStart_String(Multrun_Data.Exposure_Start_Time,exposure_time_string);
-	if(!Moptop_Fits_Header_String_Add("UTSTART",exposure_time_string,"[UTC] Start time of obs."))
-		return FALSE;
-	/* update MJD keyword from Multrun_Data.Exposure_Start_Time */
-	/* note leap second correction not implemented yet (always FALSE). */
-	if(!Moptop_Fits_Header_TimeSpec_To_Mjd(Multrun_Data.Exposure_Start_Time,FALSE,&mjd))
-		return FALSE;
-	if(!Moptop_Fits_Header_Float_Add("MJD",mjd,NULL))
-		return FALSE;
-	/* update DATE-END keyword from exposure_end_time */
-	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(exposure_end_time,exposure_time_string);
-	if(!Moptop_Fits_Header_String_Add("DATE-END",exposure_time_string,"[UTC] End of obs."))
-		return FALSE;
-	/* update UTENDT keyword from exposure_end_time */
-	Moptop_Fits_Header_TimeSpec_To_UtStart_String(exposure_end_time,exposure_time_string);
-	if(!Moptop_Fits_Header_String_Add("UTEND",exposure_time_string,"[UTC] End time of obs."))
-		return FALSE;
-	/* update TELAPSE keyword with difference between the multrun start timestamp and the 
-	** end timestamp of the current exposure. This means TELAPSE is increasing in each frame of the multrun. */
-	dvalue = fdifftime(exposure_end_time,Multrun_Data.Multrun_Start_Time);
-	if(!Moptop_Fits_Header_Float_Add("TELAPSE",dvalue,"[sec] Total obs. duration"))
-		return FALSE;
-	/* update RUNNUM keyword value with the Multrun_Data.Rotation_Number */
-	if(!Moptop_Fits_Header_Integer_Add("RUNNUM",Multrun_Data.Rotation_Number,
-					   "Which rotation of the rotator we are on."))
-		return FALSE;
-	/* update EXPNUM keyword value with the Multrun_Data.Sequence_Number */
-	if(!Moptop_Fits_Header_Integer_Add("EXPNUM",Multrun_Data.Sequence_Number,
-					   "Which image in the current rotation we are on."))
-		return FALSE;
-	/* update EXPTOTAL keyword value with Multrun_Data.Image_Count */
-	if(!Moptop_Fits_Header_Integer_Add("EXPTOTAL",Multrun_Data.Image_Count,
-					   "Total number of frames expected this multrun."))
-		return FALSE;
-	/* ccdxbin */
-	ivalue = CCD_Setup_Get_Binning();
-	if(!Moptop_Fits_Header_Integer_Add("CCDXBIN",ivalue,NULL))
-		return FALSE;
-	/* ccdybin */
-	ivalue = CCD_Setup_Get_Binning();
-	if(!Moptop_Fits_Header_Integer_Add("CCDYBIN",ivalue,NULL))
-		return FALSE;
-	/* update actual ccd temperature with value stored at start of multrun */
-	if(!Moptop_Fits_Header_Float_Add("CCDATEMP",Multrun_Data.CCD_Temperature,NULL))
-		return FALSE;
-	/* update ccd temperature status string with value stored at start of multrun */
-	if(!Moptop_Fits_Header_String_Add("TEMPSTAT",Multrun_Data.CCD_Temperature_Status_String,NULL))
-		return FALSE;
-	/* update MOPRMODE with configured rotator speed string */
-	if(!Moptop_Fits_Header_String_Add("MOPRMODE",Multrun_Data.Rotator_Speed,"Configured rotator speed"))
-		return FALSE;
-	/* update MOPRRATE with stored angular velocity of rotor in deg/sec */
-	if(!Moptop_Fits_Header_Float_Add("MOPRRATE",Multrun_Data.Rotator_Run_Velocity,
-					 "[deg/s] Angular velocity of rotator"))
-		return FALSE;
-	/* update MOPRREQ with requested_rotator_angle */
-	if(!Moptop_Fits_Header_Float_Add("MOPRREQ",requested_rotator_angle,"[deg] MOPTOP Rotator requested angle"))
-		return FALSE;
-	/* update MOPRBEG with rotator_start_angle */
-	if(!Moptop_Fits_Header_Float_Add("MOPRBEG",rotator_start_angle,"[deg] MOPTOP Rotator begin angle"))
-		return FALSE;
-	/* update MOPREND with rotator_end_angle */
-	if(!Moptop_Fits_Header_Float_Add("MOPREND",rotator_end_angle,"[deg] MOPTOP Rotator angle at end of exposure"))
-		return FALSE;
-	/* update MOPRARC with rotator_difference */
-	if(!Moptop_Fits_Header_Float_Add("MOPRARC",rotator_difference,"[deg] MOPTOP Rotator exposure arc"))
-		return FALSE;
-	/* MOPRNUM is the Multrun_Data.Rotation_Number */
-	if(!Moptop_Fits_Header_Integer_Add("MOPRNUM",Multrun_Data.Rotation_Number,"MOPTOP Rotation number"))
-		return FALSE;
-	/* MOPRPOS is the Multrun_Data.Sequence_Number */
-	if(!Moptop_Fits_Header_Integer_Add("MOPRPOS",Multrun_Data.Sequence_Number,"MOPTOP Position number within rotation"))
-		return FALSE;
-	/* EXPTIME is the actual exposure length returned from the camera, in seconds */
-	if(!Moptop_Fits_Header_Float_Add("EXPTIME",pco_exposure_length_s,"[sec] Actual exposure"))
-		return FALSE;
-	/* XPOSURE is the actual exposure length returned from the camera, in seconds */
-	if(!Moptop_Fits_Header_Float_Add("XPOSURE",pco_exposure_length_s,"[sec] Actual exposure"))
-		return FALSE;
-	/* EXPREQST is the requested exposure length in seconds (from Multrun_Data.Requested_Exposure_Length) */
-	if(!Moptop_Fits_Header_Float_Add("EXPREQST",Multrun_Data.Requested_Exposure_Length,"[sec] Requested exposure"))
-		return FALSE;
-	/* CCDXPIXE is the physical x width of a pixel in metres */
-	if(!Moptop_Fits_Header_Float_Add("CCDXPIXE",
-					 CCD_Setup_Get_Pixel_Width()/((double)MOPTOP_GENERAL_ONE_METRE_MICROMETRE),
-					 "[m] Detector pixel width"))
-		return FALSE;
-	/* CCDYPIXE is the physical y height of a pixel in metres */
-	if(!Moptop_Fits_Header_Float_Add("CCDYPIXE",
-					 CCD_Setup_Get_Pixel_Height()/((double)MOPTOP_GENERAL_ONE_METRE_MICROMETRE),
-					 "[m] Detector pixel height"))
-		return FALSE;
-	/* PICNUM is the camera image number retrieved from the camera read out's metadata. */
-	if(!Moptop_Fits_Header_Integer_Add("PICNUM",camera_image_number,"Camera meta-data image number"))
-		return FALSE;
-	/* CAMTIME is the camera clock timestamp the when this exposure started, from the camera's meta-data */
-	Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(camera_timestamp,exposure_time_string);
-	if(!Moptop_Fits_Header_String_Add("CAMTIME",exposure_time_string,"[UTC] Cameras timestamp."))
-		return FALSE;
-	/* create lock file */
-#if MOPTOP_DEBUG > 5
-	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
-				  "MULTRUN","Locking FITS filename %s.",filename);
-#endif
-	if(!CCD_Fits_Filename_Lock(filename))
-	{
-		Moptop_General_Error_Number = 630;
-		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:Failed to lock '%s'.",filename);
-		return FALSE;				
-	}
-#if MOPTOP_DEBUG > 5
-	Moptop_General_Log_Format("multrun","moptop_multrun.c","Multrun_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,
-				  "MULTRUN","Saving to filename %s.",filename);
-#endif
+
 	/* create FITS file */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
 	retval = fits_create_file(&fp,filename,&status);
 	if(retval)
 	{
 		fits_get_errstatus(status,buff);
 		fits_report_error(stderr,status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 631;
-		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:File create failed(%s,%d,%s).",
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image_Cfitsio:File create failed(%s,%d,%s).",
 			filename,status,buff);
 		return FALSE;
 	}
-	/* basic dimensions */
-	ncols_unbinned = CCD_Setup_Get_Sensor_Width();
-	nrows_unbinned = CCD_Setup_Get_Sensor_Height();
-	binning = CCD_Setup_Get_Binning();
-	ncols_binned = ncols_unbinned/binning;
-	nrows_binned = nrows_unbinned/binning;
+	if(Multrun_Data.Compress_Enable)
+	{
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID,&cpu_start_time);
+		retval = fits_set_compression_type(fp,RICE_1,&status);
+		if(retval)
+		{
+			fits_get_errstatus(status,buff);
+			fits_report_error(stderr,status);
+			fits_close_file(fp,&status);
+			Moptop_General_Error_Number = 681;
+			sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image_Cfitsio:"
+				"Setting compression type failed(%s,%d,%s).",filename,status,buff);
+			return FALSE;
+		}
+	}
 	axes[0] = ncols_binned;
 	axes[1] = nrows_binned;
 	retval = fits_create_img(fp,USHORT_IMG,2,axes,&status);
@@ -1504,110 +4140,331 @@ static int Multrun_Write_Fits_Image(int do_standard,double pco_exposure_length_s
 		fits_get_errstatus(status,buff);
 		fits_report_error(stderr,status);
 		fits_close_file(fp,&status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 632;
-		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:create image failed(%s,%d,%s).",
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image_Cfitsio:create image failed(%s,%d,%s).",
 			filename,status,buff);
 		return FALSE;
 	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_CREATE,start_time,end_time);
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
 	/* save FITS headers to filename */
-	if(!CCD_Fits_Header_Write_To_Fits(fp))
+	if(!Moptop_Fits_Header_Template_Write_To_Fits(&Multrun_Header_Template,card_image_list,fp))
 	{
 		fits_close_file(fp,&status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 633;
-		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:CCD_Fits_Header_Write_To_Fits failed.");
-		return FALSE;
-	}
-	/* save data to filename */
-	if((ncols_binned*nrows_binned) > image_buffer_length)
-	{
-		fits_close_file(fp,&status);
-		CCD_Fits_Filename_UnLock(filename);
-		Moptop_General_Error_Number = 634;
-		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:FITS image dimension mismatch:"
-			"filename '%s', binned ncols = %d, binned_nrows = %d, image buffer length = %d.",
-			filename,ncols_binned,nrows_binned,image_buffer_length);
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image_Cfitsio:Writing FITS headers failed.");
 		return FALSE;
 	}
-	/* check and flip images if configured to do so */
-	if(Multrun_Data.Flip_X)
-		Moptop_Multrun_Flip_X(ncols_binned,nrows_binned,(unsigned short *)image_buffer);
-	if(Multrun_Data.Flip_Y)
-		Moptop_Multrun_Flip_Y(ncols_binned,nrows_binned,(unsigned short *)image_buffer);
 	/* write the data */
-	retval = fits_write_img(fp,TUSHORT,1,ncols_binned*nrows_binned,image_buffer,&status);
+	retval = fits_write_img(fp,TUSHORT,1,ncols_binned*nrows_binned,frame->Image_Buffer,&status);
 	if(retval)
 	{
 		fits_get_errstatus(status,buff);
 		fits_report_error(stderr,status);
 		fits_close_file(fp,&status);
-		CCD_Fits_Filename_UnLock(filename);
 		Moptop_General_Error_Number = 635;
-		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:File write failed(%s,%d,%s).",
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image_Cfitsio:File write failed(%s,%d,%s).",
 			filename,status,buff);
 		return FALSE;
 	}
-	/* CCDSCALE */
-	/* bin1 value configured in Java layer and passed into fits header list.
-	** Should have been written to file in CCD_Fits_Header_Write_To_Fits.
-	** So retrieve bin1 value using CFITSIO, mod by binning and update value */
-	if(binning != 1)
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_WRITE,start_time,end_time);
+	/* close file */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	retval = fits_close_file(fp,&status);
+	if(retval)
 	{
-		retval = fits_read_key(fp,TDOUBLE,"CCDSCALE",&ccdscale,NULL,&status);
-		if(retval)
+		fits_get_errstatus(status,buff);
+		fits_report_error(stderr,status);
+		Moptop_General_Error_Number = 638;
+		sprintf(Moptop_General_Error_String,
+			"Multrun_Write_Fits_Image_Cfitsio: File close failed(%s,%d,%s).",filename,status,buff);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_CLOSE,start_time,end_time);
+	/* compression statistics */
+	if(Multrun_Data.Compress_Enable)
+	{
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID,&cpu_end_time);
+		if(stat(filename,&file_status) != 0)
 		{
-			fits_get_errstatus(status,buff);
-			fits_report_error(stderr,status);
-			fits_close_file(fp,&status);
-			CCD_Fits_Filename_UnLock(filename);
-			Moptop_General_Error_Number = 636;
-			sprintf(Moptop_General_Error_String,
-				"Multrun_Write_Fits_Image: Retrieving ccdscale failed(%s,%d,%s).",
-				filename,status,buff);
+			Moptop_General_Error_Number = 682;
+			sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image_Cfitsio:Failed to stat '%s' (%d).",
+				filename,errno);
 			return FALSE;
 		}
-		/* adjust for binning */
-		ccdscale *= binning; /* assume xbin and ybin are equal */
-		/* write adjusted value back */
-		retval = fits_update_key_fixdbl(fp,"CCDSCALE",ccdscale,6,NULL,&status);
-		if(retval)
+		if(!Moptop_Writer_Compression_Add(((long long int)ncols_binned)*nrows_binned*sizeof(unsigned short),
+						  (long long int)file_status.st_size,
+						  fdifftime(cpu_end_time,cpu_start_time)))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Write a frame to disk as a plane of it's rotation's FITS cube. This is used when Multrun_Data.Output_Mode is
+ * MULTRUN_OUTPUT_MODE_CUBE, and always uses the native FITS writer.
+ * <ul>
+ * <li>We calculate the binned image dimensions using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
+ *     CCD_Setup_Get_Binning, and check the binned image size is not larger than the frame->Image_Buffer_Length.
+ * <li>We convert the image data in place to FITS format, flipping it if configured, using 
+ *     CCD_Fits_Image_Data_Convert. 
+ * <li>We lock Multrun_Cube_Mutex, and find the cube slot for frame->Rotation_Number using Multrun_Cube_Slot_Get.
+ * <li>If the cube has not been created yet (this is the first of the rotation's frames to be written):
+ *     <ul>
+ *     <li>We start publishing the cube using CCD_Fits_Filename_Publish_Begin, which creates a file lock on the 
+ *         cube's filename, or returns a hidden temporary filename to create the cube as.
+ *     <li>We copy the multrun FITS header template's card images using Moptop_Fits_Header_Template_Copy,
+ *         and overwrite the per-frame FITS keywords with this frame's values using Multrun_Fits_Headers_Patch.
+ *     <li>We create the cube using CCD_Fits_Image_Cube_Create, with one plane per frame in the rotation,
+ *         and a per-plane binary table with the columns in Multrun_Cube_Column_Name_List.
+ *     </ul>
+ * <li>We unlock Multrun_Cube_Mutex, so the other writer threads can write their planes in parallel.
+ * <li>We write the image data and the frame's rotator angles, camera image number and timestamps
+ *     (from Multrun_Frame_Values_Get) into the cube's plane (frame->Sequence_Number-1) using 
+ *     CCD_Fits_Image_Cube_Plane_Write.
+ * <li>We lock Multrun_Cube_Mutex and call Multrun_Cube_Plane_Done, which closes and publishes the cube once all
+ *     the rotation's planes are done.
+ * </ul>
+ * The cube's primary header holds the per-frame keyword values of the first frame written into it; 
+ * the per-plane values are in the binary table. The filename lock, create and close are therefore done once per 
+ * rotation, rather than once per frame.
+ * @param frame The read out frame to write to disk. This contains the image data and all the per-frame data
+ *        captured when it was acquired, including the cube filename to write the data into.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #MULTRUN_CUBE_COLUMN_COUNT
+ * @see #Multrun_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Cube_Mutex
+ * @see #Multrun_Cube_Column_Name_List
+ * @see #Multrun_Cube_Column_Unit_List
+ * @see #Multrun_Cube_Slot_Get
+ * @see #Multrun_Cube_Plane_Done
+ * @see #Multrun_Fits_Headers_Patch
+ * @see #Multrun_Frame_Values_Get
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_LENGTH
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Convert
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Create
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Plane_Write
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static int Multrun_Write_Fits_Cube_Plane(struct Moptop_Writer_Frame_Struct *frame)
+{
+	struct timespec start_time,end_time;
+	struct Multrun_Cube_Struct *cube_slot = NULL;
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	double row_value_list[MULTRUN_CUBE_COLUMN_COUNT];
+	int binning,ncols_binned,nrows_binned,retval;
+
+	/* basic dimensions */
+	binning = CCD_Setup_Get_Binning();
+	ncols_binned = CCD_Setup_Get_Sensor_Width()/binning;
+	nrows_binned = CCD_Setup_Get_Sensor_Height()/binning;
+	if((ncols_binned*nrows_binned) > frame->Image_Buffer_Length)
+	{
+		Moptop_General_Error_Number = 676;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Cube_Plane:FITS image dimension mismatch:"
+			"filename '%s', binned ncols = %d, binned_nrows = %d, image buffer length = %d.",
+			frame->Filename,ncols_binned,nrows_binned,frame->Image_Buffer_Length);
+		return FALSE;
+	}
+	/* flip and convert the image buffer to FITS format in place, in one pass */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Image_Data_Convert((unsigned short *)frame->Image_Buffer,(unsigned short *)frame->Image_Buffer,
+					ncols_binned,nrows_binned,Multrun_Data.Flip_X,Multrun_Data.Flip_Y))
+	{
+		Moptop_General_Error_Number = 670;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Cube_Plane:"
+			"Failed to convert image data for '%s'.",frame->Filename);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_IMAGE_CONVERT,start_time,end_time);
+	/* find this rotation's cube, and create it if we are the first writer to get here */
+	pthread_mutex_lock(&Multrun_Cube_Mutex);
+	cube_slot = Multrun_Cube_Slot_Get(frame->Rotation_Number);
+	if(cube_slot == NULL)
+	{
+		pthread_mutex_unlock(&Multrun_Cube_Mutex);
+		return FALSE;
+	}
+	if(cube_slot->Is_Open == FALSE)
+	{
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Fits_Filename_Publish_Begin(frame->Filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH))
 		{
-			fits_get_errstatus(status,buff);
-			fits_report_error(stderr,status);
-			fits_close_file(fp,&status);
-			CCD_Fits_Filename_UnLock(filename);
-			Moptop_General_Error_Number = 637;
-			sprintf(Moptop_General_Error_String,
-				"Multrun_Write_Fits_Image: Updating ccdscale failed(%.2f,%s,%d,%s).",
-				ccdscale,filename,status,buff);
+			pthread_mutex_unlock(&Multrun_Cube_Mutex);
+			Moptop_General_Error_Number = 671;
+			sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Cube_Plane:Failed to lock '%s'.",
+				frame->Filename);
 			return FALSE;
 		}
-	}/* end if binning != 1 */
-/* close file */
-	retval = fits_close_file(fp,&status);
-	if(retval)
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FILENAME_LOCK,start_time,end_time);
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		Moptop_Fits_Header_Template_Copy(&Multrun_Header_Template,card_image_list);
+		if(!Multrun_Fits_Headers_Patch(frame,card_image_list))
+		{
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			pthread_mutex_unlock(&Multrun_Cube_Mutex);
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_HEADER,start_time,end_time);
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Fits_Image_Cube_Create(write_filename,card_image_list,Multrun_Header_Template.Card_Count,
+					       ncols_binned,nrows_binned,cube_slot->Plane_Count,
+					       Multrun_Cube_Column_Name_List,Multrun_Cube_Column_Unit_List,
+					       MULTRUN_CUBE_COLUMN_COUNT,&(cube_slot->Cube)))
+		{
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			pthread_mutex_unlock(&Multrun_Cube_Mutex);
+			Moptop_General_Error_Number = 672;
+			sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Cube_Plane:Failed to create '%s'.",
+				frame->Filename);
+			return FALSE;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_CREATE,start_time,end_time);
+		cube_slot->Is_Open = TRUE;
+	}
+	pthread_mutex_unlock(&Multrun_Cube_Mutex);
+	/* write the plane and it's table row. The slot cannot be freed until this plane is done. */
+	Multrun_Frame_Values_Get(frame,row_value_list);
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Image_Cube_Plane_Write(&(cube_slot->Cube),frame->Sequence_Number-1,
+					    (unsigned short *)frame->Image_Buffer,row_value_list))
 	{
-		fits_get_errstatus(status,buff);
-		fits_report_error(stderr,status);
-		CCD_Fits_Filename_UnLock(filename);
-		Moptop_General_Error_Number = 638;
-		sprintf(Moptop_General_Error_String,
-			"Multrun_Write_Fits_Image: File close failed(%s,%d,%s).",filename,status,buff);
+		Moptop_General_Error_Number = 673;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Cube_Plane:Failed to write plane %d of '%s'.",
+			frame->Sequence_Number-1,frame->Filename);
 		return FALSE;
 	}
-	/* unlock FITS filename lock */
-	if(!CCD_Fits_Filename_UnLock(filename))
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_WRITE,start_time,end_time);
+	/* close the cube if this was the last plane */
+	pthread_mutex_lock(&Multrun_Cube_Mutex);
+	retval = Multrun_Cube_Plane_Done(cube_slot);
+	pthread_mutex_unlock(&Multrun_Cube_Mutex);
+	return retval;
+}
+
+/**
+ * Write a frame into it's slot (frame->Image_Index) in the multrun's raw capture file. This is used when 
+ * Multrun_Data.Output_Mode is MULTRUN_OUTPUT_MODE_RAW. The image data is not converted (or flipped), 
+ * and no per-frame file is created or published, so this is the cheapest way of getting a frame onto disk. 
+ * The frame is converted into the FITS image frame output mode would have written (frame->Filename) 
+ * when the raw capture file is converted.
+ * <ul>
+ * <li>We calculate the binned image dimensions using CCD_Setup_Get_Sensor_Width / CCD_Setup_Get_Sensor_Height / 
+ *     CCD_Setup_Get_Binning, and check the binned image size is not larger than the frame->Image_Buffer_Length.
+ * <li>We copy the multrun FITS header template's card images using Moptop_Fits_Header_Template_Copy,
+ *     and overwrite the per-frame FITS keywords with this frame's values using Multrun_Fits_Headers_Patch.
+ * <li>We fill in the frame's record: it's rotation and sequence number, FITS filename, and it's rotator angles, 
+ *     camera image number and timestamps (from Multrun_Frame_Values_Get).
+ * <li>We write the record, card images and image data into the raw capture file using 
+ *     CCD_Fits_Image_Raw_Frame_Write.
+ * </ul>
+ * @param frame The read out frame to write to disk. This contains the image data and all the per-frame data
+ *        captured when it was acquired.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Multrun_Data
+ * @see #Multrun_Raw_Data
+ * @see #Multrun_Header_Template
+ * @see #Multrun_Fits_Headers_Patch
+ * @see #Multrun_Frame_Values_Get
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_LENGTH
+ * @see moptop_fits_header.html#Moptop_Fits_Header_Template_Copy
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Record_Struct
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Frame_Write
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Width
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Sensor_Height
+ * @see ../ccd/cdocs/ccd_setup.html#CCD_Setup_Get_Binning
+ */
+static int Multrun_Write_Raw_Frame(struct Moptop_Writer_Frame_Struct *frame)
+{
+	struct CCD_Fits_Image_Raw_Record_Struct record;
+	struct timespec start_time,end_time;
+	char card_image_list[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	int binning,ncols_binned,nrows_binned;
+
+	/* basic dimensions */
+	binning = CCD_Setup_Get_Binning();
+	ncols_binned = CCD_Setup_Get_Sensor_Width()/binning;
+	nrows_binned = CCD_Setup_Get_Sensor_Height()/binning;
+	if((ncols_binned*nrows_binned) > frame->Image_Buffer_Length)
 	{
-		Moptop_General_Error_Number = 639;
-		sprintf(Moptop_General_Error_String,"Multrun_Write_Fits_Image:Failed to unlock '%s'.",filename);
+		Moptop_General_Error_Number = 692;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Raw_Frame:FITS image dimension mismatch:"
+			"filename '%s', binned ncols = %d, binned_nrows = %d, image buffer length = %d.",
+			frame->Filename,ncols_binned,nrows_binned,frame->Image_Buffer_Length);
 		return FALSE;
 	}
-#if MOPTOP_DEBUG > 5
-	Moptop_General_Log("multrun","moptop_multrun.c","Multrun_Write_Fits_Image",LOG_VERBOSITY_INTERMEDIATE,"MULTRUN",
-			   "Finished.");
-#endif
+	/* headers */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	Moptop_Fits_Header_Template_Copy(&Multrun_Header_Template,card_image_list);
+	if(!Multrun_Fits_Headers_Patch(frame,card_image_list))
+		return FALSE;
+	memset(&record,0,sizeof(struct CCD_Fits_Image_Raw_Record_Struct));
+	record.Group_Number = frame->Rotation_Number;
+	record.Sequence_Number = frame->Sequence_Number;
+	strncpy(record.Filename,frame->Filename,CCD_FITS_IMAGE_RAW_FILENAME_LENGTH-1);
+	Multrun_Frame_Values_Get(frame,record.Value_List);
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_HEADER,start_time,end_time);
+	/* record, headers and unconverted image data, in one write */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Image_Raw_Frame_Write(&(Multrun_Raw_Data.Raw),frame->Image_Index,&record,card_image_list,
+					   (unsigned short *)frame->Image_Buffer))
+	{
+		Moptop_General_Error_Number = 693;
+		sprintf(Moptop_General_Error_String,"Multrun_Write_Raw_Frame:Failed to write frame %d ('%s') to '%s'.",
+			frame->Image_Index,frame->Filename,Multrun_Raw_Data.Raw.Filename);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_FITS_WRITE,start_time,end_time);
 	return TRUE;
 }
 
-
+/**
+ * Get a frame's per-frame values, in Multrun_Cube_Column_Name_List order: the requested, start and end rotator 
+ * angles, the rotator difference, the camera image number, and the camera timestamp, UTC time 
+ * (in seconds since the Unix epoch) and UTC uncertainty. These are written into each cube's per-plane binary 
+ * table, and each raw capture file record.
+ * @param frame The frame to get the values of.
+ * @param value_list A list of at least MULTRUN_CUBE_COLUMN_COUNT doubles, to fill in.
+ * @see #MULTRUN_CUBE_COLUMN_COUNT
+ * @see #Multrun_Cube_Column_Name_List
+ * @see moptop_writer.html#Moptop_Writer_Frame_Struct
+ * @see moptop_general.html#MOPTOP_GENERAL_ONE_SECOND_NS
+ */
+static void Multrun_Frame_Values_Get(struct Moptop_Writer_Frame_Struct *frame,double *value_list)
+{
+	value_list[0] = frame->Requested_Rotator_Angle;
+	value_list[1] = frame->Rotator_Start_Angle;
+	value_list[2] = frame->Rotator_End_Angle;
+	value_list[3] = frame->Rotator_Difference;
+	value_list[4] = frame->Camera_Image_Number;
+	value_list[5] = ((double)frame->Camera_Timestamp.tv_sec)+
+		(((double)frame->Camera_Timestamp.tv_nsec)/MOPTOP_GENERAL_ONE_SECOND_NS);
+	value_list[6] = ((double)frame->Camera_UTC_Time.tv_sec)+
+		(((double)frame->Camera_UTC_Time.tv_nsec)/MOPTOP_GENERAL_ONE_SECOND_NS);
+	value_list[7] = frame->Camera_UTC_Uncertainty;
+}
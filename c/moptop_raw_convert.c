@@ -0,0 +1,343 @@
+/* moptop_raw_convert.c */
+/**
+ * Moptop raw capture file conversion utility. This converts a raw capture file (written by a raw output mode 
+ * multrun, see CCD_Fits_Image_Raw_Create) into the FITS images the multrun would have written in frame output mode,
+ * once the observations are over. Each captured frame is converted and flipped using CCD_Fits_Image_Data_Convert,
+ * and written with it's stored FITS header using CCD_Fits_Image_Write, so the FITS images are identical to those 
+ * written by the native FITS writer at the time. If the rotator's data recorder was used, the multrun has already
+ * replaced the provisional rotator end angles (MOPREND/MOPRARC) in each frame's stored header and record with the
+ * recorded ones. Frames that were dropped (their slot in the raw capture file was never written) are skipped. 
+ * No camera is needed.
+ * @author $Author$
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "log_udp.h"
+#include "ccd_fits_filename.h"
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+#include "ccd_general.h"
+
+/* hash defines */
+/**
+ * Length of some of the strings used in this program.
+ */
+#define STRING_LENGTH        (256)
+
+/* internal variables */
+/**
+ * Revision control system identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * Verbosity log level : initialised to LOG_VERBOSITY_VERY_TERSE.
+ */
+static int Log_Level = LOG_VERBOSITY_VERY_TERSE;
+/**
+ * The filename of the raw capture file to convert.
+ */
+static char Raw_Filename[STRING_LENGTH] = "";
+/**
+ * If not blank, the directory to write the FITS images into, instead of the directory they were originally
+ * going to be written into.
+ */
+static char Output_Directory[STRING_LENGTH] = "";
+/**
+ * A boolean, if TRUE just list the frame records in the raw capture file, rather than converting them.
+ */
+static int List_Only = FALSE;
+
+/* functions */
+static int Output_Filename_Get(char *record_filename,char *filename);
+static int Parse_Arguments(int argc, char *argv[]);
+static void Help(void);
+
+/* ------------------------------------------------------------------
+**          External functions
+** ------------------------------------------------------------------ */
+/**
+ * Main program. The program returns 0 on success, 1 if the arguments are wrong, and a larger number identifying
+ * the step that failed otherwise.
+ * <ul>
+ * <li>We parse the arguments with Parse_Arguments.
+ * <li>We setup the CCD library's logging.
+ * <li>We open the raw capture file using CCD_Fits_Image_Raw_Open, and allocate a card image list and
+ *     image buffer big enough for one frame.
+ * <li>For each frame slot, we read the frame using CCD_Fits_Image_Raw_Frame_Read. Slots that were never written
+ *     (dropped frames) are skipped.
+ * <li>If List_Only is set, we print the frame's record. Otherwise:
+ *     <ul>
+ *     <li>We get the FITS filename to write using Output_Filename_Get.
+ *     <li>We convert (and flip, as configured when the frame was captured) the image data in place using
+ *         CCD_Fits_Image_Data_Convert.
+ *     <li>We write the FITS image using CCD_Fits_Filename_Publish_Begin, CCD_Fits_Image_Write and
+ *         CCD_Fits_Filename_Publish_End, as the multrun would have done.
+ *     </ul>
+ * <li>We close the raw capture file using CCD_Fits_Image_Raw_Close.
+ * </ul>
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @see #Parse_Arguments
+ * @see #Output_Filename_Get
+ * @see #Log_Level
+ * @see #Raw_Filename
+ * @see #List_Only
+ * @see ../ccd/cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Level
+ * @see ../ccd/cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Function
+ * @see ../ccd/cdocs/ccd_general.html#CCD_General_Log_Filter_Level_Absolute
+ * @see ../ccd/cdocs/ccd_general.html#CCD_General_Set_Log_Handler_Function
+ * @see ../ccd/cdocs/ccd_general.html#CCD_General_Log_Handler_Stdout
+ * @see ../ccd/cdocs/ccd_general.html#CCD_General_Error
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_End
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Open
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Frame_Read
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Raw_Close
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Convert
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Write
+ */
+int main(int argc, char *argv[])
+{
+	struct CCD_Fits_Image_Raw_Struct raw;
+	struct CCD_Fits_Image_Raw_Record_Struct record;
+	char filename[STRING_LENGTH];
+	char write_filename[STRING_LENGTH];
+	char *card_image_list = NULL;
+	unsigned short *image_data = NULL;
+	struct timespec start_time,end_time;
+	int frame_index,value_index,converted_count,dropped_count;
+
+	/* parse arguments */
+	if(!Parse_Arguments(argc,argv))
+		return 1;
+	if(strlen(Raw_Filename) == 0)
+	{
+		fprintf(stderr,"moptop_raw_convert : No raw capture file specified.\n");
+		Help();
+		return 1;
+	}
+	CCD_General_Set_Log_Filter_Level(Log_Level);
+	CCD_General_Set_Log_Filter_Function(CCD_General_Log_Filter_Level_Absolute);
+	CCD_General_Set_Log_Handler_Function(CCD_General_Log_Handler_Stdout);
+	if(!CCD_Fits_Image_Raw_Open(Raw_Filename,&raw))
+	{
+		CCD_General_Error();
+		return 2;
+	}
+	fprintf(stdout,"moptop_raw_convert : '%s' has %d frame slots of %d x %d, %d header cards, "
+		"flip x %d, flip y %d.\n",Raw_Filename,raw.Frame_Count,raw.Ncols,raw.Nrows,raw.Card_Count,
+		raw.Flip_X,raw.Flip_Y);
+	card_image_list = (char *)malloc((raw.Card_Count+1)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	image_data = (unsigned short *)malloc(((size_t)raw.Ncols)*raw.Nrows*sizeof(unsigned short));
+	if((card_image_list == NULL)||(image_data == NULL))
+	{
+		fprintf(stderr,"moptop_raw_convert : Failed to allocate %d cards / %d x %d image.\n",
+			raw.Card_Count,raw.Ncols,raw.Nrows);
+		return 3;
+	}
+	converted_count = 0;
+	dropped_count = 0;
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	for(frame_index = 0; frame_index < raw.Frame_Count; frame_index++)
+	{
+		if(!CCD_Fits_Image_Raw_Frame_Read(&raw,frame_index,&record,card_image_list,
+						  List_Only ? NULL : image_data))
+		{
+			CCD_General_Error();
+			return 4;
+		}
+		if(record.Is_Valid == FALSE)
+		{
+			fprintf(stdout,"moptop_raw_convert : Frame %d was dropped.\n",frame_index);
+			dropped_count++;
+			continue;
+		}
+		if(List_Only)
+		{
+			fprintf(stdout,"%d %d %d %s",record.Frame_Index,record.Group_Number,record.Sequence_Number,
+				record.Filename);
+			for(value_index = 0; value_index < raw.Value_Count; value_index++)
+			{
+				fprintf(stdout," %s=%.6f",raw.Value_Name_List[value_index],
+					record.Value_List[value_index]);
+			}
+			fprintf(stdout,"\n");
+			continue;
+		}
+		if(!Output_Filename_Get(record.Filename,filename))
+			return 5;
+		if(!CCD_Fits_Image_Data_Convert(image_data,image_data,raw.Ncols,raw.Nrows,raw.Flip_X,raw.Flip_Y))
+		{
+			CCD_General_Error();
+			return 6;
+		}
+		if(!CCD_Fits_Filename_Publish_Begin(filename,write_filename,STRING_LENGTH))
+		{
+			CCD_General_Error();
+			return 7;
+		}
+		if(!CCD_Fits_Image_Write(write_filename,card_image_list,raw.Card_Count,raw.Ncols,raw.Nrows,image_data))
+		{
+			CCD_General_Error();
+			CCD_Fits_Filename_Publish_Abort(write_filename);
+			return 8;
+		}
+		if(!CCD_Fits_Filename_Publish_End(write_filename))
+		{
+			CCD_General_Error();
+			return 9;
+		}
+		converted_count++;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	if(!CCD_Fits_Image_Raw_Close(&raw))
+	{
+		CCD_General_Error();
+		return 10;
+	}
+	free(card_image_list);
+	free(image_data);
+	fprintf(stdout,"moptop_raw_convert : Converted %d frames (%d dropped) in %.6f s.\n",converted_count,
+		dropped_count,(end_time.tv_sec-start_time.tv_sec)+((end_time.tv_nsec-start_time.tv_nsec)/1.0E9));
+	return 0;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions
+** ------------------------------------------------------------------ */
+/**
+ * Get the FITS filename to write a frame to. This is the filename stored in the frame's record, or if
+ * Output_Directory is set, the leaf of that filename in Output_Directory.
+ * @param record_filename The filename stored in the frame's record.
+ * @param filename A buffer of at least STRING_LENGTH characters, to put the FITS filename in.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Output_Directory
+ * @see #STRING_LENGTH
+ */
+static int Output_Filename_Get(char *record_filename,char *filename)
+{
+	char *leaf_ptr = NULL;
+
+	if(strlen(Output_Directory) == 0)
+	{
+		strcpy(filename,record_filename);
+		return TRUE;
+	}
+	leaf_ptr = strrchr(record_filename,'/');
+	if(leaf_ptr == NULL)
+		leaf_ptr = record_filename;
+	else
+		leaf_ptr++;
+	if((strlen(Output_Directory)+strlen(leaf_ptr)+2) > STRING_LENGTH)
+	{
+		fprintf(stderr,"Output_Filename_Get:'%s/%s' is too long.\n",Output_Directory,leaf_ptr);
+		return FALSE;
+	}
+	sprintf(filename,"%s/%s",Output_Directory,leaf_ptr);
+	return TRUE;
+}
+
+/**
+ * Routine to parse command line arguments.
+ * @param argc The number of arguments sent to the program.
+ * @param argv An array of argument strings.
+ * @see #Raw_Filename
+ * @see #Output_Directory
+ * @see #List_Only
+ * @see #Log_Level
+ * @see #Help
+ */
+static int Parse_Arguments(int argc, char *argv[])
+{
+	int i,retval;
+
+	for(i=1;i<argc;i++)
+	{
+		if((strcmp(argv[i],"-d")==0)||(strcmp(argv[i],"-directory")==0))
+		{
+			if((i+1)<argc)
+			{
+				strncpy(Output_Directory,argv[i+1],STRING_LENGTH-1);
+				Output_Directory[STRING_LENGTH-1] = '\0';
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-directory requires a directory.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-f")==0)||(strcmp(argv[i],"-filename")==0))
+		{
+			if((i+1)<argc)
+			{
+				strncpy(Raw_Filename,argv[i+1],STRING_LENGTH-1);
+				Raw_Filename[STRING_LENGTH-1] = '\0';
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-filename requires a filename.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-help")==0))
+		{
+			Help();
+			return FALSE;
+		}
+		else if((strcmp(argv[i],"-list")==0))
+		{
+			List_Only = TRUE;
+		}
+		else if((strcmp(argv[i],"-l")==0)||(strcmp(argv[i],"-log_level")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Log_Level);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse log level %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-log_level requires a number 0..5.\n");
+				return FALSE;
+			}
+		}
+		else
+		{
+			fprintf(stderr,"Parse_Arguments:argument '%s' not recognized.\n",argv[i]);
+			return FALSE;
+		}
+	}/* end for */
+	return TRUE;
+}
+
+/**
+ * Help routine. Prints the program's usage.
+ */
+static void Help(void)
+{
+	fprintf(stdout,"Moptop Raw Convert:Help.\n");
+	fprintf(stdout,"This program converts a raw capture file, written by a raw output mode multrun, into the ");
+	fprintf(stdout,"FITS images the multrun would have written in frame output mode.\n");
+	fprintf(stdout,"Usage:\n");
+	fprintf(stdout,"\tmoptop_raw_convert -f[ilename] <raw file> [-d[irectory] <path>][-list]"
+		"[-l[og_level] <0..5>][-help]\n");
+	fprintf(stdout,"\t-filename is the raw capture file to convert (the multrun's '.raw' file).\n");
+	fprintf(stdout,"\t-directory writes the FITS images into this directory, "
+		"rather than the directory they were captured for.\n");
+	fprintf(stdout,"\t-list just lists each captured frame's record (filename, rotation, sequence number and "
+		"per-frame values), without converting it.\n");
+	fprintf(stdout,"\t-log_level sets the CCD library's log level (0..5).\n");
+	fprintf(stdout,"\t-help prints this help.\n");
+	fprintf(stdout,"Dropped frames are reported and skipped.\n");
+}
@@ -0,0 +1,826 @@
+/* moptop_reduce.c
+** Moptop real time polarimetric reduction routines
+*/
+/**
+ * Routines to reduce each rotation of a multrun to Stokes I, q and u images as it's frames are written,
+ * rather than leaving this to an offline pipeline. Each frame (still in camera format) is accumulated into
+ * per-rotation float planes, weighted by the cosine and sine of twice the polaroid angle it was taken at.
+ * When all the frames of a rotation have been accumulated, the planes are normalised and written to a
+ * three plane float FITS image with the real time pipeline flag set in it's filename.
+ * The weights are precomputed at the start of each multrun, and the accumulation uses AVX2 fused multiply-add
+ * instructions where the CPU supports them.
+ * The accumulation is done by the writer threads, so frames of the same rotation can be added concurrently:
+ * each rotation's planes are protected by their own mutex, so frames of different rotations do not contend.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "log_udp.h"
+
+#include "ccd_fits_filename.h"
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+
+#include "moptop_config.h"
+#include "moptop_fits_header.h"
+#include "moptop_general.h"
+#include "moptop_reduce.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
+
+/* hash defines */
+/**
+ * The number of rotations that can be being reduced at once. The writer threads can be writing frames from
+ * more than one rotation at a time, but not from rotations very far apart.
+ */
+#define REDUCE_SLOT_COUNT               (4)
+/**
+ * The number of FITS cards added to the header of a reduced product, describing the planes
+ * and the reduction.
+ */
+#define REDUCE_CARD_COUNT               (5)
+/**
+ * Degrees to radians conversion factor (M_PI is not defined with _POSIX_C_SOURCE).
+ */
+#define REDUCE_DEGREES_TO_RADIANS       (3.14159265358979323846/180.0)
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Defined if this is an x86 build, and the AVX2/FMA accumulation kernel can be compiled (and selected
+ * at run time if the CPU supports it).
+ */
+#define REDUCE_X86                      (1)
+#endif
+
+/* data types */
+/**
+ * Data type holding the planes of one rotation being reduced.
+ * <dl>
+ * <dt>Mutex</dt> <dd>A mutex protecting the planes and counts, as frames of the same rotation can be added
+ *                    by different writer threads.</dd>
+ * <dt>Rotation_Number</dt> <dd>The rotation number (from 1) being reduced in this slot, or 0 if the slot is free.</dd>
+ * <dt>Frame_Count</dt> <dd>The number of frames in the rotation (less than the images per cycle for
+ *                          the last rotation of a multrun that is not a whole number of rotations).</dd>
+ * <dt>Frames_Done</dt> <dd>The number of the rotation's frames added or dropped so far.</dd>
+ * <dt>Frames_Added</dt> <dd>The number of the rotation's frames accumulated into the planes so far.</dd>
+ * <dt>Plane_List</dt> <dd>The I, Q and U planes, MOPTOP_REDUCE_PLANE_COUNT*Pixel_Count floats.
+ *                         This is allocated the first time the slot is used, and kept between multruns.</dd>
+ * <dt>Pixel_Count</dt> <dd>The number of pixels in each plane Plane_List was allocated for.</dd>
+ * </dl>
+ * @see moptop_reduce.html#MOPTOP_REDUCE_PLANE_COUNT
+ */
+struct Reduce_Slot_Struct
+{
+	pthread_mutex_t Mutex;
+	int Rotation_Number;
+	int Frame_Count;
+	int Frames_Done;
+	int Frames_Added;
+	float *Plane_List;
+	size_t Pixel_Count;
+};
+
+/**
+ * Data type holding local data to the moptop reduce routines.
+ * <dl>
+ * <dt>Is_Initialised</dt> <dd>A boolean, TRUE once the slot mutexes have been initialised.</dd>
+ * <dt>Enable</dt> <dd>A boolean, TRUE if rotations are being reduced during this multrun
+ *                     ("moptop.multrun.reduce.enable").</dd>
+ * <dt>Use_FMA</dt> <dd>A boolean, TRUE if the CPU supports AVX2 and FMA, and the SIMD kernel is used.</dd>
+ * <dt>Images_Per_Cycle</dt> <dd>The number of frames in a whole rotation.</dd>
+ * <dt>Image_Count</dt> <dd>The number of frames in the multrun.</dd>
+ * <dt>Ncols</dt> <dd>The number of (binned) columns in each frame.</dd>
+ * <dt>Nrows</dt> <dd>The number of (binned) rows in each frame.</dd>
+ * <dt>Angle_Offset</dt> <dd>The angle in degrees added to the rotator angle of each frame, to get the polaroid angle
+ *                           ("moptop.multrun.reduce.angle.offset").</dd>
+ * <dt>Cos_Weight_List</dt> <dd>cos(2 theta) for each frame (sequence number - 1) in a rotation.</dd>
+ * <dt>Sin_Weight_List</dt> <dd>sin(2 theta) for each frame (sequence number - 1) in a rotation.</dd>
+ * <dt>Reduced_Count</dt> <dd>The number of rotations reduced and written this multrun.</dd>
+ * <dt>Skipped_Count</dt> <dd>The number of rotations not reduced this multrun (because of dropped frames, or
+ *                            because they were not whole rotations).</dd>
+ * <dt>Slot_List</dt> <dd>The rotations being reduced.</dd>
+ * </dl>
+ * @see #REDUCE_SLOT_COUNT
+ * @see #Reduce_Slot_Struct
+ * @see moptop_reduce.html#MOPTOP_REDUCE_SEQUENCE_COUNT_MAX
+ */
+struct Reduce_Struct
+{
+	int Is_Initialised;
+	int Enable;
+	int Use_FMA;
+	int Images_Per_Cycle;
+	int Image_Count;
+	int Ncols;
+	int Nrows;
+	double Angle_Offset;
+	float Cos_Weight_List[MOPTOP_REDUCE_SEQUENCE_COUNT_MAX];
+	float Sin_Weight_List[MOPTOP_REDUCE_SEQUENCE_COUNT_MAX];
+	int Reduced_Count;
+	int Skipped_Count;
+	struct Reduce_Slot_Struct Slot_List[REDUCE_SLOT_COUNT];
+};
+
+/* internal data */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * The instance of Reduce_Struct that contains local data for this module.
+ * @see #Reduce_Struct
+ */
+static struct Reduce_Struct Reduce_Data;
+/**
+ * A mutex protecting the allocation and freeing of slots in Reduce_Data.Slot_List, and the counts.
+ */
+static pthread_mutex_t Reduce_Mutex = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * The keywords of the FITS cards added to the header of a reduced product.
+ * @see #REDUCE_CARD_COUNT
+ */
+static char *Reduce_Card_Keyword_List[REDUCE_CARD_COUNT] = {"PLANE1","PLANE2","PLANE3","REDFRAME","REDANGOF"};
+
+/* internal functions */
+static struct Reduce_Slot_Struct *Reduce_Slot_Get(int rotation_number,int allocate);
+static void Reduce_Slot_Free(struct Reduce_Slot_Struct *slot,int reduced);
+static void Reduce_Accumulate(float *plane_list,size_t pixel_count,unsigned short *image_data,float cos_weight,
+			      float sin_weight,int first);
+static size_t Reduce_Accumulate_Scalar(float *plane_list,size_t pixel_count,unsigned short *image_data,
+				       size_t start,float cos_weight,float sin_weight,int first);
+#ifdef REDUCE_X86
+static size_t Reduce_Accumulate_FMA(float *plane_list,size_t pixel_count,unsigned short *image_data,
+				    float cos_weight,float sin_weight,int first);
+#endif
+
+/* ----------------------------------------------------------------------------
+** 		external functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Setup the reduction of the rotations of a multrun. This must be called before the writer threads are started.
+ * <ul>
+ * <li>We initialise the slot mutexes, if this is the first call.
+ * <li>We free all the slots, left over from a previous (failed) multrun.
+ * <li>We retrieve the "moptop.multrun.reduce.enable" config value. If it is FALSE we return.
+ * <li>We retrieve the "moptop.multrun.reduce.angle.offset" config value.
+ * <li>We check images_per_cycle is no more than MOPTOP_REDUCE_SEQUENCE_COUNT_MAX.
+ * <li>We compute the cos(2 theta) and sin(2 theta) weights of each frame in a rotation. theta is the mean
+ *     polaroid angle during the exposure: the rotator start angle ((sequence number - 1) * step_angle),
+ *     plus the angle moved during half the exposure (run_velocity * exposure_length / 2), plus the angle offset.
+ * <li>We select the accumulation kernel: AVX2/FMA if the CPU supports it, otherwise scalar.
+ * </ul>
+ * @param images_per_cycle The number of frames in a whole rotation of the rotator.
+ * @param image_count The number of frames in the multrun.
+ * @param ncols The number of (binned) columns in each frame.
+ * @param nrows The number of (binned) rows in each frame.
+ * @param step_angle The rotator angle between frames, in degrees.
+ * @param run_velocity The rotator velocity, in degrees/s.
+ * @param exposure_length The length of each exposure, in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Reduce_Data
+ * @see #Reduce_Mutex
+ * @see moptop_reduce.html#MOPTOP_REDUCE_SEQUENCE_COUNT_MAX
+ * @see moptop_config.html#Moptop_Config_Get_Boolean
+ * @see moptop_config.html#Moptop_Config_Get_Double
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Reduce_Start(int images_per_cycle,int image_count,int ncols,int nrows,double step_angle,
+			double run_velocity,double exposure_length)
+{
+	double theta;
+	int i;
+
+	if(!Reduce_Data.Is_Initialised)
+	{
+		for(i = 0; i < REDUCE_SLOT_COUNT; i++)
+		{
+			pthread_mutex_init(&(Reduce_Data.Slot_List[i].Mutex),NULL);
+			Reduce_Data.Slot_List[i].Plane_List = NULL;
+			Reduce_Data.Slot_List[i].Pixel_Count = 0;
+		}
+		Reduce_Data.Is_Initialised = TRUE;
+	}
+	for(i = 0; i < REDUCE_SLOT_COUNT; i++)
+		Reduce_Data.Slot_List[i].Rotation_Number = 0;
+	Reduce_Data.Reduced_Count = 0;
+	Reduce_Data.Skipped_Count = 0;
+	Reduce_Data.Enable = FALSE;
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.reduce.enable",&(Reduce_Data.Enable)))
+		return FALSE;
+	if(Reduce_Data.Enable == FALSE)
+		return TRUE;
+	if(!Moptop_Config_Get_Double("moptop.multrun.reduce.angle.offset",&(Reduce_Data.Angle_Offset)))
+	{
+		Reduce_Data.Enable = FALSE;
+		return FALSE;
+	}
+	if((images_per_cycle < 1)||(images_per_cycle > MOPTOP_REDUCE_SEQUENCE_COUNT_MAX)||(ncols < 1)||(nrows < 1))
+	{
+		Reduce_Data.Enable = FALSE;
+		Moptop_General_Error_Number = 1000;
+		sprintf(Moptop_General_Error_String,"Moptop_Reduce_Start:"
+			"Illegal images per cycle %d (max %d) or image dimensions (%d,%d).",images_per_cycle,
+			MOPTOP_REDUCE_SEQUENCE_COUNT_MAX,ncols,nrows);
+		return FALSE;
+	}
+	Reduce_Data.Images_Per_Cycle = images_per_cycle;
+	Reduce_Data.Image_Count = image_count;
+	Reduce_Data.Ncols = ncols;
+	Reduce_Data.Nrows = nrows;
+	for(i = 0; i < images_per_cycle; i++)
+	{
+		theta = (i*step_angle)+(run_velocity*exposure_length/2.0)+Reduce_Data.Angle_Offset;
+		Reduce_Data.Cos_Weight_List[i] = (float)cos(2.0*theta*REDUCE_DEGREES_TO_RADIANS);
+		Reduce_Data.Sin_Weight_List[i] = (float)sin(2.0*theta*REDUCE_DEGREES_TO_RADIANS);
+	}
+	Reduce_Data.Use_FMA = FALSE;
+#ifdef REDUCE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		Reduce_Data.Use_FMA = TRUE;
+#endif
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("reduce","moptop_reduce.c","Moptop_Reduce_Start",LOG_VERBOSITY_INTERMEDIATE,
+				  "REDUCE","Reducing rotations of %d frames of %d x %d pixels with angle offset %.3f "
+				  "degrees using the %s kernel.",images_per_cycle,ncols,nrows,Reduce_Data.Angle_Offset,
+				  Reduce_Data.Use_FMA ? "avx2/fma" : "scalar");
+#endif
+	return TRUE;
+}
+
+/**
+ * Return whether rotations are being reduced during this multrun.
+ * @return TRUE if Moptop_Reduce_Start enabled the reduction, FALSE otherwise.
+ * @see #Reduce_Data
+ */
+int Moptop_Reduce_Is_Enabled(void)
+{
+	return Reduce_Data.Enable;
+}
+
+/**
+ * Accumulate a frame into it's rotation's planes. This is called by the writer threads, before the frame's
+ * image data is converted to FITS format.
+ * <ul>
+ * <li>We get (or allocate) the rotation's slot using Reduce_Slot_Get, holding Reduce_Mutex.
+ * <li>Holding the slot's mutex, we accumulate the frame into the slot's planes using Reduce_Accumulate
+ *     (the first frame added sets the planes, rather than adding to them), and count the frame as added and done.
+ * <li>We add the time taken to the MOPTOP_TIMING_TYPE_REDUCE timing histogram.
+ * <li>If all the rotation's frames are now done, and they were all added (none were dropped) and make up a whole
+ *     rotation, rotation_complete is set to TRUE, and the caller must write the reduced product using
+ *     Moptop_Reduce_Rotation_Write. Otherwise the rotation cannot be reduced, and it's slot is freed.
+ * </ul>
+ * If the reduction is not enabled, this routine does nothing.
+ * @param rotation_number The rotation number (from 1) of the frame.
+ * @param sequence_number The sequence number (from 1) of the frame within it's rotation.
+ * @param image_data The frame's image data, Ncols x Nrows unsigned shorts in host byte order (as read out
+ *        from the camera).
+ * @param rotation_complete The address of an integer, set to TRUE if this frame completes the rotation,
+ *        and the rotation can be reduced, and FALSE otherwise.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Reduce_Data
+ * @see #Reduce_Mutex
+ * @see #Reduce_Slot_Get
+ * @see #Reduce_Slot_Free
+ * @see #Reduce_Accumulate
+ * @see #Moptop_Reduce_Rotation_Write
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Reduce_Frame_Add(int rotation_number,int sequence_number,unsigned short *image_data,
+			    int *rotation_complete)
+{
+	struct Reduce_Slot_Struct *slot = NULL;
+	struct timespec start_time,end_time;
+	int done,whole;
+
+	if(rotation_complete == NULL)
+	{
+		Moptop_General_Error_Number = 1001;
+		sprintf(Moptop_General_Error_String,"Moptop_Reduce_Frame_Add:rotation_complete was NULL.");
+		return FALSE;
+	}
+	(*rotation_complete) = FALSE;
+	if(Reduce_Data.Enable == FALSE)
+		return TRUE;
+	if((sequence_number < 1)||(sequence_number > Reduce_Data.Images_Per_Cycle)||(image_data == NULL))
+	{
+		Moptop_General_Error_Number = 1002;
+		sprintf(Moptop_General_Error_String,"Moptop_Reduce_Frame_Add:"
+			"Illegal sequence number %d (of %d) or image data %p.",sequence_number,
+			Reduce_Data.Images_Per_Cycle,(void*)image_data);
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&Reduce_Mutex))
+		return FALSE;
+	slot = Reduce_Slot_Get(rotation_number,TRUE);
+	if(!Moptop_General_Mutex_Unlock(&Reduce_Mutex))
+		return FALSE;
+	if(slot == NULL)
+		return FALSE;
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!Moptop_General_Mutex_Lock(&(slot->Mutex)))
+		return FALSE;
+	Reduce_Accumulate(slot->Plane_List,((size_t)Reduce_Data.Ncols)*((size_t)Reduce_Data.Nrows),image_data,
+			  Reduce_Data.Cos_Weight_List[sequence_number-1],Reduce_Data.Sin_Weight_List[sequence_number-1],
+			  (slot->Frames_Added == 0));
+	slot->Frames_Added++;
+	slot->Frames_Done++;
+	done = (slot->Frames_Done >= slot->Frame_Count);
+	whole = ((slot->Frames_Added == slot->Frame_Count)&&(slot->Frame_Count == Reduce_Data.Images_Per_Cycle));
+	if(!Moptop_General_Mutex_Unlock(&(slot->Mutex)))
+		return FALSE;
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_REDUCE,start_time,end_time);
+	if(done)
+	{
+		if(whole)
+			(*rotation_complete) = TRUE;
+		else
+			Reduce_Slot_Free(slot,FALSE);
+	}
+	return TRUE;
+}
+
+/**
+ * Count a dropped frame as done in it's rotation. The rotation will then not be reduced (as the weights
+ * of the remaining frames are no longer balanced), but it's slot must still be freed when the rest of
+ * it's frames have been written.
+ * If the reduction is not enabled, this routine does nothing.
+ * @param rotation_number The rotation number (from 1) of the dropped frame.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Reduce_Data
+ * @see #Reduce_Mutex
+ * @see #Reduce_Slot_Get
+ * @see #Reduce_Slot_Free
+ */
+int Moptop_Reduce_Frame_Dropped(int rotation_number)
+{
+	struct Reduce_Slot_Struct *slot = NULL;
+	int done;
+
+	if(Reduce_Data.Enable == FALSE)
+		return TRUE;
+	if(!Moptop_General_Mutex_Lock(&Reduce_Mutex))
+		return FALSE;
+	slot = Reduce_Slot_Get(rotation_number,TRUE);
+	if(!Moptop_General_Mutex_Unlock(&Reduce_Mutex))
+		return FALSE;
+	if(slot == NULL)
+		return FALSE;
+	if(!Moptop_General_Mutex_Lock(&(slot->Mutex)))
+		return FALSE;
+	slot->Frames_Done++;
+	done = (slot->Frames_Done >= slot->Frame_Count);
+	if(!Moptop_General_Mutex_Unlock(&(slot->Mutex)))
+		return FALSE;
+	if(done)
+		Reduce_Slot_Free(slot,FALSE);
+	return TRUE;
+}
+
+/**
+ * Normalise a complete rotation's planes, and write them as a reduced product. This is called by the writer
+ * thread whose call to Moptop_Reduce_Frame_Add completed the rotation.
+ * <ul>
+ * <li>We find the rotation's slot using Reduce_Slot_Get.
+ * <li>We normalise the accumulated planes in place: Stokes I = 2 * sum(S) / N, q = 2 * sum(S cos 2 theta) / sum(S),
+ *     u = 2 * sum(S sin 2 theta) / sum(S), where S is the counts in each of the N frames. Pixels with no counts
+ *     have q and u set to NaN.
+ * <li>We flip each plane in X and/or Y (as the raw frames are) using Moptop_General_Float_Plane_Flip.
+ * <li>If there is room, we add the PLANE1/PLANE2/PLANE3 (plane contents), REDFRAME (number of frames) and
+ *     REDANGOF (angle offset) cards to card_image_list.
+ * <li>We lock the FITS filename (or get the temporary filename to write to) using CCD_Fits_Filename_Publish_Begin.
+ * <li>We write the three planes to a float FITS image using CCD_Fits_Image_Float_Write.
+ * <li>We publish it using Moptop_Writer_Publish, as part of the rotation's group but holding no frames.
+ * <li>We free the slot using Reduce_Slot_Free (even if writing the product failed).
+ * </ul>
+ * @param rotation_number The rotation number (from 1) to write.
+ * @param filename The FITS filename of the reduced product.
+ * @param card_image_list The FITS header card images to put in the product, of at least
+ *        MOPTOP_FITS_HEADER_TEMPLATE_LENGTH characters. This is modified.
+ * @param card_count The number of card images in card_image_list.
+ * @param flip_x A boolean, if TRUE the planes are flipped in X.
+ * @param flip_y A boolean, if TRUE the planes are flipped in Y.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #REDUCE_CARD_COUNT
+ * @see #Reduce_Card_Keyword_List
+ * @see #Reduce_Data
+ * @see #Reduce_Mutex
+ * @see #Reduce_Slot_Get
+ * @see #Reduce_Slot_Free
+ * @see moptop_general.html#Moptop_General_Float_Plane_Flip
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_String_Set
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Int_Set
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Float_Set
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Float_Write
+ */
+int Moptop_Reduce_Rotation_Write(int rotation_number,char *filename,char *card_image_list,int card_count,
+				 int flip_x,int flip_y)
+{
+	struct Reduce_Slot_Struct *slot = NULL;
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	float *i_plane = NULL;
+	float *q_plane = NULL;
+	float *u_plane = NULL;
+	float sum;
+	size_t i,pixel_count;
+	int p,frame_count;
+
+	if((filename == NULL)||(card_image_list == NULL))
+	{
+		Moptop_General_Error_Number = 1003;
+		sprintf(Moptop_General_Error_String,"Moptop_Reduce_Rotation_Write:filename or card_image_list was NULL.");
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&Reduce_Mutex))
+		return FALSE;
+	slot = Reduce_Slot_Get(rotation_number,FALSE);
+	if(!Moptop_General_Mutex_Unlock(&Reduce_Mutex))
+		return FALSE;
+	if(slot == NULL)
+		return FALSE;
+	/* normalise the planes. All the rotation's frames are done, so no other thread is using the slot */
+	pixel_count = ((size_t)Reduce_Data.Ncols)*((size_t)Reduce_Data.Nrows);
+	i_plane = slot->Plane_List;
+	q_plane = slot->Plane_List+pixel_count;
+	u_plane = slot->Plane_List+(2*pixel_count);
+	frame_count = slot->Frames_Added;
+	for(i = 0; i < pixel_count; i++)
+	{
+		sum = i_plane[i];
+		if(sum > 0.0f)
+		{
+			q_plane[i] = 2.0f*q_plane[i]/sum;
+			u_plane[i] = 2.0f*u_plane[i]/sum;
+		}
+		else
+		{
+			q_plane[i] = NAN;
+			u_plane[i] = NAN;
+		}
+		i_plane[i] = 2.0f*sum/((float)frame_count);
+	}
+	for(p = 0; p < MOPTOP_REDUCE_PLANE_COUNT; p++)
+	{
+		Moptop_General_Float_Plane_Flip(slot->Plane_List+(p*pixel_count),Reduce_Data.Ncols,Reduce_Data.Nrows,
+						flip_x,flip_y);
+	}
+	/* describe the planes */
+	if((card_count+REDUCE_CARD_COUNT) <= MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX)
+	{
+		CCD_Fits_Header_Card_Image_String_Set(card_image_list+(card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						      Reduce_Card_Keyword_List[0],"I");
+		CCD_Fits_Header_Card_Image_String_Set(card_image_list+((card_count+1)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						      Reduce_Card_Keyword_List[1],"q");
+		CCD_Fits_Header_Card_Image_String_Set(card_image_list+((card_count+2)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						      Reduce_Card_Keyword_List[2],"u");
+		CCD_Fits_Header_Card_Image_Int_Set(card_image_list+((card_count+3)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						   Reduce_Card_Keyword_List[3],frame_count);
+		CCD_Fits_Header_Card_Image_Float_Set(card_image_list+((card_count+4)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						     Reduce_Card_Keyword_List[4],Reduce_Data.Angle_Offset);
+		card_count += REDUCE_CARD_COUNT;
+	}
+	if(!CCD_Fits_Filename_Publish_Begin(filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH))
+	{
+		Reduce_Slot_Free(slot,FALSE);
+		Moptop_General_Error_Number = 1004;
+		sprintf(Moptop_General_Error_String,"Moptop_Reduce_Rotation_Write:Failed to lock '%s'.",filename);
+		return FALSE;
+	}
+	if(!CCD_Fits_Image_Float_Write(write_filename,card_image_list,card_count,Reduce_Data.Ncols,
+				       Reduce_Data.Nrows,MOPTOP_REDUCE_PLANE_COUNT,slot->Plane_List))
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		Reduce_Slot_Free(slot,FALSE);
+		Moptop_General_Error_Number = 1005;
+		sprintf(Moptop_General_Error_String,"Moptop_Reduce_Rotation_Write:Failed to write '%s'.",filename);
+		return FALSE;
+	}
+	Reduce_Slot_Free(slot,TRUE);
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("reduce","moptop_reduce.c","Moptop_Reduce_Rotation_Write",
+				  LOG_VERBOSITY_INTERMEDIATE,"REDUCE","Rotation %d reduced from %d frames to '%s'.",
+				  rotation_number,frame_count,filename);
+#endif
+	/* publish the product with the rotation's frames. It holds no frames, so does not complete the rotation */
+	return Moptop_Writer_Publish(write_filename,rotation_number,0);
+}
+
+/**
+ * Discard a complete rotation without writing it, freeing it's slot. This is called instead of
+ * Moptop_Reduce_Rotation_Write when the reduced product's filename or headers could not be generated.
+ * @param rotation_number The rotation number (from 1) to discard.
+ * @return The routine returns TRUE on success and FALSE on failure (the rotation was not being reduced).
+ * @see #Reduce_Mutex
+ * @see #Reduce_Slot_Get
+ * @see #Reduce_Slot_Free
+ */
+int Moptop_Reduce_Rotation_Discard(int rotation_number)
+{
+	struct Reduce_Slot_Struct *slot = NULL;
+
+	if(!Moptop_General_Mutex_Lock(&Reduce_Mutex))
+		return FALSE;
+	slot = Reduce_Slot_Get(rotation_number,FALSE);
+	if(!Moptop_General_Mutex_Unlock(&Reduce_Mutex))
+		return FALSE;
+	if(slot == NULL)
+		return FALSE;
+	Reduce_Slot_Free(slot,FALSE);
+	return TRUE;
+}
+
+/**
+ * Finish the reduction of a multrun's rotations. This is called when the writer threads have stopped.
+ * Any rotations still being reduced (the last rotation of an aborted or failed multrun) are discarded,
+ * and the number of rotations reduced and skipped is logged. The slot plane memory is kept for the next multrun.
+ * @see #Reduce_Data
+ * @see #Reduce_Mutex
+ * @see moptop_general.html#Moptop_General_Log_Format
+ */
+void Moptop_Reduce_Stop(void)
+{
+	int i;
+
+	if(Reduce_Data.Enable == FALSE)
+		return;
+	pthread_mutex_lock(&Reduce_Mutex);
+	for(i = 0; i < REDUCE_SLOT_COUNT; i++)
+	{
+		if(Reduce_Data.Slot_List[i].Rotation_Number != 0)
+		{
+			Reduce_Data.Slot_List[i].Rotation_Number = 0;
+			Reduce_Data.Skipped_Count++;
+		}
+	}
+	pthread_mutex_unlock(&Reduce_Mutex);
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("reduce","moptop_reduce.c","Moptop_Reduce_Stop",LOG_VERBOSITY_INTERMEDIATE,
+				  "REDUCE","%d rotations reduced, %d rotations skipped.",Reduce_Data.Reduced_Count,
+				  Reduce_Data.Skipped_Count);
+#endif
+}
+
+/**
+ * Get the number of rotations reduced, and not reduced, during the last (or current) multrun.
+ * @param reduced_count The address of an integer to store the number of rotations reduced and written.
+ * @param skipped_count The address of an integer to store the number of rotations not reduced
+ *        (because of dropped frames, or because they were not whole rotations).
+ * @see #Reduce_Data
+ * @see #Reduce_Mutex
+ */
+void Moptop_Reduce_Count_Get(int *reduced_count,int *skipped_count)
+{
+	pthread_mutex_lock(&Reduce_Mutex);
+	if(reduced_count != NULL)
+		(*reduced_count) = Reduce_Data.Reduced_Count;
+	if(skipped_count != NULL)
+		(*skipped_count) = Reduce_Data.Skipped_Count;
+	pthread_mutex_unlock(&Reduce_Mutex);
+}
+
+/* ----------------------------------------------------------------------------
+** 		internal functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Find the slot in Reduce_Data.Slot_List for the specified rotation. If there isn't one, and allocate is TRUE,
+ * a free slot is allocated to the rotation, with the number of frames the rotation will contain
+ * (the last rotation is short if the image count is not a multiple of the images per cycle).
+ * The slot's planes are (re)allocated if they are too small for the current image dimensions.
+ * The planes are not cleared, the first frame added to the rotation overwrites them.
+ * The caller must hold Reduce_Mutex.
+ * @param rotation_number The rotation number (from 1) to find a slot for.
+ * @param allocate A boolean, if TRUE a free slot is allocated if the rotation does not have one.
+ * @return A pointer to the rotation's slot, or NULL if there are no free slots (or the rotation has no slot and
+ *         allocate is FALSE, or the planes could not be allocated).
+ * @see #REDUCE_SLOT_COUNT
+ * @see #Reduce_Data
+ * @see #Reduce_Mutex
+ * @see moptop_reduce.html#MOPTOP_REDUCE_PLANE_COUNT
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+static struct Reduce_Slot_Struct *Reduce_Slot_Get(int rotation_number,int allocate)
+{
+	struct Reduce_Slot_Struct *slot = NULL;
+	float *new_plane_list = NULL;
+	size_t pixel_count;
+	int i,free_index;
+
+	free_index = -1;
+	for(i = 0; i < REDUCE_SLOT_COUNT; i++)
+	{
+		if(Reduce_Data.Slot_List[i].Rotation_Number == rotation_number)
+			return &(Reduce_Data.Slot_List[i]);
+		if((Reduce_Data.Slot_List[i].Rotation_Number == 0)&&(free_index == -1))
+			free_index = i;
+	}
+	if(allocate == FALSE)
+	{
+		Moptop_General_Error_Number = 1006;
+		sprintf(Moptop_General_Error_String,"Reduce_Slot_Get:Rotation %d is not being reduced.",rotation_number);
+		return NULL;
+	}
+	if(free_index == -1)
+	{
+		Moptop_General_Error_Number = 1007;
+		sprintf(Moptop_General_Error_String,"Reduce_Slot_Get:"
+			"No free slots for rotation %d (%d rotations already being reduced).",rotation_number,
+			REDUCE_SLOT_COUNT);
+		return NULL;
+	}
+	slot = &(Reduce_Data.Slot_List[free_index]);
+	pixel_count = ((size_t)Reduce_Data.Ncols)*((size_t)Reduce_Data.Nrows);
+	if(slot->Pixel_Count < pixel_count)
+	{
+		new_plane_list = (float *)realloc(slot->Plane_List,MOPTOP_REDUCE_PLANE_COUNT*pixel_count*sizeof(float));
+		if(new_plane_list == NULL)
+		{
+			Moptop_General_Error_Number = 1008;
+			sprintf(Moptop_General_Error_String,"Reduce_Slot_Get:"
+				"Failed to allocate planes for rotation %d (%d x %d).",rotation_number,
+				Reduce_Data.Ncols,Reduce_Data.Nrows);
+			return NULL;
+		}
+		slot->Plane_List = new_plane_list;
+		slot->Pixel_Count = pixel_count;
+	}
+	slot->Rotation_Number = rotation_number;
+	slot->Frame_Count = Reduce_Data.Image_Count-((rotation_number-1)*Reduce_Data.Images_Per_Cycle);
+	if(slot->Frame_Count > Reduce_Data.Images_Per_Cycle)
+		slot->Frame_Count = Reduce_Data.Images_Per_Cycle;
+	slot->Frames_Done = 0;
+	slot->Frames_Added = 0;
+	return slot;
+}
+
+/**
+ * Free a slot, so it can be used by another rotation, and count the rotation as reduced or skipped.
+ * @param slot The slot to free.
+ * @param reduced A boolean, TRUE if the rotation was reduced, FALSE if it was skipped.
+ * @see #Reduce_Data
+ * @see #Reduce_Mutex
+ */
+static void Reduce_Slot_Free(struct Reduce_Slot_Struct *slot,int reduced)
+{
+	pthread_mutex_lock(&Reduce_Mutex);
+#if MOPTOP_DEBUG > 5
+	if(reduced == FALSE)
+	{
+		Moptop_General_Log_Format("reduce","moptop_reduce.c","Reduce_Slot_Free",LOG_VERBOSITY_VERBOSE,
+					  "REDUCE","Rotation %d not reduced (%d of %d frames, %d per rotation).",
+					  slot->Rotation_Number,slot->Frames_Added,slot->Frame_Count,
+					  Reduce_Data.Images_Per_Cycle);
+	}
+#endif
+	slot->Rotation_Number = 0;
+	if(reduced)
+		Reduce_Data.Reduced_Count++;
+	else
+		Reduce_Data.Skipped_Count++;
+	pthread_mutex_unlock(&Reduce_Mutex);
+}
+
+/**
+ * Accumulate a frame into a rotation's I, Q and U planes: I += S, Q += S * cos_weight, U += S * sin_weight,
+ * for the counts S in each pixel. If first is TRUE, the planes are set rather than added to.
+ * The AVX2/FMA kernel is used if Reduce_Data.Use_FMA is TRUE, and the scalar kernel does any remaining pixels.
+ * @param plane_list The I, Q and U planes, each of pixel_count floats.
+ * @param pixel_count The number of pixels in a plane.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param cos_weight cos(2 theta) for the frame.
+ * @param sin_weight sin(2 theta) for the frame.
+ * @param first A boolean, TRUE if this is the first frame added to the planes.
+ * @see #Reduce_Data
+ * @see #Reduce_Accumulate_Scalar
+ * @see #Reduce_Accumulate_FMA
+ */
+static void Reduce_Accumulate(float *plane_list,size_t pixel_count,unsigned short *image_data,float cos_weight,
+			      float sin_weight,int first)
+{
+	size_t start = 0;
+
+#ifdef REDUCE_X86
+	if(Reduce_Data.Use_FMA)
+		start = Reduce_Accumulate_FMA(plane_list,pixel_count,image_data,cos_weight,sin_weight,first);
+#endif
+	Reduce_Accumulate_Scalar(plane_list,pixel_count,image_data,start,cos_weight,sin_weight,first);
+}
+
+/**
+ * Scalar accumulation kernel. See Reduce_Accumulate.
+ * @param plane_list The I, Q and U planes, each of pixel_count floats.
+ * @param pixel_count The number of pixels in a plane.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param start The first pixel to accumulate (the pixels before this have been done by a SIMD kernel).
+ * @param cos_weight cos(2 theta) for the frame.
+ * @param sin_weight sin(2 theta) for the frame.
+ * @param first A boolean, TRUE if this is the first frame added to the planes.
+ * @return The number of pixels processed (pixel_count).
+ * @see #Reduce_Accumulate
+ */
+static size_t Reduce_Accumulate_Scalar(float *plane_list,size_t pixel_count,unsigned short *image_data,
+				       size_t start,float cos_weight,float sin_weight,int first)
+{
+	float *i_plane = plane_list;
+	float *q_plane = plane_list+pixel_count;
+	float *u_plane = plane_list+(2*pixel_count);
+	float value;
+	size_t i;
+
+	for(i = start; i < pixel_count; i++)
+	{
+		value = (float)image_data[i];
+		if(first)
+		{
+			i_plane[i] = value;
+			q_plane[i] = value*cos_weight;
+			u_plane[i] = value*sin_weight;
+		}
+		else
+		{
+			i_plane[i] += value;
+			q_plane[i] += value*cos_weight;
+			u_plane[i] += value*sin_weight;
+		}
+	}
+	return pixel_count;
+}
+
+#ifdef REDUCE_X86
+/**
+ * AVX2/FMA accumulation kernel, 8 pixels at a time: each 8 unsigned shorts are widened to 32 bit integers,
+ * converted to floats, and added (I) or fused multiply-added (Q and U) into the planes.
+ * See Reduce_Accumulate.
+ * @param plane_list The I, Q and U planes, each of pixel_count floats.
+ * @param pixel_count The number of pixels in a plane.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param cos_weight cos(2 theta) for the frame.
+ * @param sin_weight sin(2 theta) for the frame.
+ * @param first A boolean, TRUE if this is the first frame added to the planes.
+ * @return The number of pixels processed (a multiple of 8), the rest must be done by Reduce_Accumulate_Scalar.
+ * @see #Reduce_Accumulate
+ */
+__attribute__((target("avx2,fma")))
+static size_t Reduce_Accumulate_FMA(float *plane_list,size_t pixel_count,unsigned short *image_data,
+				    float cos_weight,float sin_weight,int first)
+{
+	float *i_plane = plane_list;
+	float *q_plane = plane_list+pixel_count;
+	float *u_plane = plane_list+(2*pixel_count);
+	__m256 value,cos_value,sin_value;
+	size_t i;
+
+	cos_value = _mm256_set1_ps(cos_weight);
+	sin_value = _mm256_set1_ps(sin_weight);
+	if(first)
+	{
+		for(i = 0; (i+8) <= pixel_count; i += 8)
+		{
+			value = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_data+i))));
+			_mm256_storeu_ps(i_plane+i,value);
+			_mm256_storeu_ps(q_plane+i,_mm256_mul_ps(value,cos_value));
+			_mm256_storeu_ps(u_plane+i,_mm256_mul_ps(value,sin_value));
+		}
+	}
+	else
+	{
+		for(i = 0; (i+8) <= pixel_count; i += 8)
+		{
+			value = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_data+i))));
+			_mm256_storeu_ps(i_plane+i,_mm256_add_ps(_mm256_loadu_ps(i_plane+i),value));
+			_mm256_storeu_ps(q_plane+i,_mm256_fmadd_ps(value,cos_value,_mm256_loadu_ps(q_plane+i)));
+			_mm256_storeu_ps(u_plane+i,_mm256_fmadd_ps(value,sin_value,_mm256_loadu_ps(u_plane+i)));
+		}
+	}
+	return i;
+}
+#endif
@@ -187,13 +187,15 @@ int Moptop_Server_Stop(void)
  * @see moptop_general.html#Moptop_General_Log_Format
  * @see moptop_general.html#Moptop_General_Thread_Priority_Set_Normal
  * @see moptop_general.html#Moptop_General_Thread_Priority_Set_Exposure
+ * @see moptop_general.html#Moptop_General_String_Struct
+ * @see moptop_general.html#Moptop_General_String_Free
  * @see ../command_server/cdocs/command_server.html#Command_Server_Read_Message
  */
 static void Server_Connection_Callback(Command_Server_Handle_T connection_handle)
 {
 	void *buffer_ptr = NULL;
 	size_t buffer_length = 0;
-	char *reply_string = NULL;
+	struct Moptop_General_String_Struct reply_string = {NULL,0,0};
 	char *client_message = NULL;
 	int retval;
 	int seconds,i;
@@ -230,9 +232,8 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 		retval = Moptop_Command_Abort(client_message,&reply_string);
 		if(retval == TRUE)
 		{
-			retval = Send_Reply(connection_handle,reply_string);
-			if(reply_string != NULL)
-				free(reply_string);
+			retval = Send_Reply(connection_handle,reply_string.String);
+			Moptop_General_String_Free(&reply_string);
 			if(retval == FALSE)
 			{
 				Moptop_General_Error("server","moptop_server.c",
@@ -270,9 +271,8 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 		retval = Moptop_Command_Config(client_message,&reply_string);
 		if(retval == TRUE)
 		{
-			retval = Send_Reply(connection_handle,reply_string);
-			if(reply_string != NULL)
-				free(reply_string);
+			retval = Send_Reply(connection_handle,reply_string.String);
+			Moptop_General_String_Free(&reply_string);
 			if(retval == FALSE)
 			{
 				Moptop_General_Error("server","moptop_server.c",
@@ -310,9 +310,8 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 		retval = Moptop_Command_Fits_Header(client_message,&reply_string);
 		if(retval == TRUE)
 		{
-			retval = Send_Reply(connection_handle,reply_string);
-			if(reply_string != NULL)
-				free(reply_string);
+			retval = Send_Reply(connection_handle,reply_string.String);
+			Moptop_General_String_Free(&reply_string);
 			if(retval == FALSE)
 			{
 				Moptop_General_Error("server","moptop_server.c",
@@ -351,6 +350,7 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 			   "\tabort\n"
 			   "\tconfig filter <filter_name>\n"
 			   "\tconfig bin <bin>\n"
+			   "\tconfig output <frame|cube|raw|stack>\n"
 			   "\tconfig rotorspeed <slow|fast>\n"
 			   "\tfitsheader add <keyword> <boolean|float|integer|string> <value>\n"
 			   "\tfitsheader delete <keyword>\n"
@@ -365,7 +365,11 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 			   "\tstatus filterwheel [filter|position|status]\n"
 			   "\tstatus rotator [position|status]\n"
 			   "\tstatus exposure [status|count|length|start_time]\n"
-			   "\tstatus exposure [index|multrun|run|window]\n"
+			   "\tstatus exposure [index|multrun|run|window|dropped|statistics]\n"
+			   "\tstatus writer [threads|queue_length|written|high_water]\n"
+			   "\tstatus writer [blocked_count|blocked_time|blocked_time_max]\n"
+			   "\tstatus writer [compression_ratio|compression_cpu_time]\n"
+			   "\tstatus timing [multrun|biasdark] [<type>]\n"
 			   "\tshutdown\n");
 	}
 	else if(strncmp(client_message,"multbias",8) == 0)
@@ -384,9 +388,8 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 		retval = Moptop_Command_MultBias(client_message,&reply_string);
 		if(retval == TRUE)
 		{
-			retval = Send_Reply(connection_handle,reply_string);
-			if(reply_string != NULL)
-				free(reply_string);
+			retval = Send_Reply(connection_handle,reply_string.String);
+			Moptop_General_String_Free(&reply_string);
 			if(retval == FALSE)
 			{
 				Moptop_General_Error("server","moptop_server.c",
@@ -424,9 +427,8 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 		retval = Moptop_Command_MultDark(client_message,&reply_string);
 		if(retval == TRUE)
 		{
-			retval = Send_Reply(connection_handle,reply_string);
-			if(reply_string != NULL)
-				free(reply_string);
+			retval = Send_Reply(connection_handle,reply_string.String);
+			Moptop_General_String_Free(&reply_string);
 			if(retval == FALSE)
 			{
 				Moptop_General_Error("server","moptop_server.c",
@@ -466,9 +468,8 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 		retval = Moptop_Command_Multrun_Setup(client_message,&reply_string);
 		if(retval == TRUE)
 		{
-			retval = Send_Reply(connection_handle,reply_string);
-			if(reply_string != NULL)
-				free(reply_string);
+			retval = Send_Reply(connection_handle,reply_string.String);
+			Moptop_General_String_Free(&reply_string);
 			if(retval == FALSE)
 			{
 				Moptop_General_Error("server","moptop_server.c",
@@ -508,9 +509,8 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 		retval = Moptop_Command_Multrun(client_message,&reply_string);
 		if(retval == TRUE)
 		{
-			retval = Send_Reply(connection_handle,reply_string);
-			if(reply_string != NULL)
-				free(reply_string);
+			retval = Send_Reply(connection_handle,reply_string.String);
+			Moptop_General_String_Free(&reply_string);
 			if(retval == FALSE)
 			{
 				Moptop_General_Error("server","moptop_server.c",
@@ -547,9 +547,8 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 		retval = Moptop_Command_Status(client_message,&reply_string);
 		if(retval == TRUE)
 		{
-			retval = Send_Reply(connection_handle,reply_string);
-			if(reply_string != NULL)
-				free(reply_string);
+			retval = Send_Reply(connection_handle,reply_string.String);
+			Moptop_General_String_Free(&reply_string);
 			if(retval == FALSE)
 			{
 				Moptop_General_Error("server","moptop_server.c",
@@ -612,8 +611,9 @@ static void Server_Connection_Callback(Command_Server_Handle_T connection_handle
 						 LOG_VERBOSITY_VERY_TERSE,"SERVER");
 		}
 	}
-	/* free message */
+	/* free message, and any partial reply string left by a failed command */
 	free(client_message);
+	Moptop_General_String_Free(&reply_string);
 }
 
 /**
@@ -0,0 +1,572 @@
+/* moptop_stack.c
+** Moptop per rotator position frame stacking routines
+*/
+/**
+ * Routines to co-add (stack) the frames of a multrun taken at the same rotator position, when the multrun
+ * output mode is "stack". Each rotator position (sequence number within a rotation) has it's own 32 bit integer
+ * accumulator image, and each frame (still in camera format) is added into it's position's accumulator
+ * as it is written. At the end of the multrun only one FITS image per rotator position is written,
+ * rather than one per frame.
+ * The addition uses AVX2 instructions where the CPU supports them.
+ * The addition is done by the writer threads: each position's accumulator is protected by it's own mutex,
+ * so frames of different positions do not contend.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "log_udp.h"
+
+#include "ccd_fits_filename.h"
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+
+#include "moptop_fits_header.h"
+#include "moptop_general.h"
+#include "moptop_stack.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
+
+/* hash defines */
+/**
+ * The number of FITS cards added to the header of a stacked image, describing the frames in the stack.
+ */
+#define STACK_CARD_COUNT                (3)
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Defined if this is an x86 build, and the AVX2 addition kernel can be compiled (and selected
+ * at run time if the CPU supports it).
+ */
+#define STACK_X86                       (1)
+#endif
+
+/* data types */
+/**
+ * Data type holding the stack of one rotator position.
+ * <dl>
+ * <dt>Mutex</dt> <dd>A mutex protecting the accumulator and counts, as frames of the same position (from
+ *                    different rotations) can be added by different writer threads.</dd>
+ * <dt>Frame_Count</dt> <dd>The number of frames added to the stack this multrun.</dd>
+ * <dt>First_Rotation_Number</dt> <dd>The lowest rotation number (from 1) of the frames in the stack.</dd>
+ * <dt>Last_Rotation_Number</dt> <dd>The highest rotation number (from 1) of the frames in the stack.</dd>
+ * <dt>Exposure_Length_Sum</dt> <dd>The sum of the exposure lengths of the frames in the stack, in seconds.</dd>
+ * <dt>Exposure_End_Time</dt> <dd>The latest exposure end time of the frames in the stack.</dd>
+ * <dt>Dropped_Frame_Count</dt> <dd>The largest number of frames dropped before a frame in the stack
+ *                                  was acquired.</dd>
+ * <dt>Header_Frame</dt> <dd>A copy of the frame (without it's image data) from the first rotation in the stack,
+ *                           used to generate the stacked image's filename and per-frame FITS headers.</dd>
+ * <dt>Data</dt> <dd>The accumulator image, Pixel_Count unsigned 32 bit integers.
+ *                   This is allocated the first time the position is used, and kept between multruns.</dd>
+ * <dt>Pixel_Count</dt> <dd>The number of pixels Data was allocated for.</dd>
+ * </dl>
+ */
+struct Stack_Position_Struct
+{
+	pthread_mutex_t Mutex;
+	int Frame_Count;
+	int First_Rotation_Number;
+	int Last_Rotation_Number;
+	double Exposure_Length_Sum;
+	struct timespec Exposure_End_Time;
+	int Dropped_Frame_Count;
+	struct Moptop_Writer_Frame_Struct Header_Frame;
+	unsigned int *Data;
+	size_t Pixel_Count;
+};
+
+/**
+ * Data type holding local data to the moptop stack routines.
+ * <dl>
+ * <dt>Is_Initialised</dt> <dd>A boolean, TRUE once the position mutexes have been initialised.</dd>
+ * <dt>Use_AVX2</dt> <dd>A boolean, TRUE if the CPU supports AVX2, and the SIMD kernel is used.</dd>
+ * <dt>Images_Per_Cycle</dt> <dd>The number of rotator positions (frames in a whole rotation).</dd>
+ * <dt>Ncols</dt> <dd>The number of (binned) columns in each frame.</dd>
+ * <dt>Nrows</dt> <dd>The number of (binned) rows in each frame.</dd>
+ * <dt>Position_List</dt> <dd>The stack of each rotator position, indexed by sequence number - 1.</dd>
+ * </dl>
+ * @see #Stack_Position_Struct
+ * @see moptop_stack.html#MOPTOP_STACK_POSITION_COUNT_MAX
+ */
+struct Stack_Struct
+{
+	int Is_Initialised;
+	int Use_AVX2;
+	int Images_Per_Cycle;
+	int Ncols;
+	int Nrows;
+	struct Stack_Position_Struct Position_List[MOPTOP_STACK_POSITION_COUNT_MAX];
+};
+
+/* internal data */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * The instance of Stack_Struct that contains local data for this module.
+ * @see #Stack_Struct
+ */
+static struct Stack_Struct Stack_Data;
+/**
+ * The keywords of the FITS cards added to the header of a stacked image.
+ * @see #STACK_CARD_COUNT
+ */
+static char *Stack_Card_Keyword_List[STACK_CARD_COUNT] = {"MOPRNBEG","MOPRNEND","STACKNUM"};
+
+/* internal functions */
+static struct Stack_Position_Struct *Stack_Position_Find(int sequence_number,char *function_name);
+static void Stack_Add(unsigned int *stack_data,size_t pixel_count,unsigned short *image_data,int first);
+static size_t Stack_Add_Scalar(unsigned int *stack_data,size_t pixel_count,unsigned short *image_data,
+			       size_t start,int first);
+#ifdef STACK_X86
+static size_t Stack_Add_AVX2(unsigned int *stack_data,size_t pixel_count,unsigned short *image_data,int first);
+#endif
+
+/* ----------------------------------------------------------------------------
+** 		external functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Setup the stacking of the frames of a multrun. This must be called before the writer threads are started.
+ * <ul>
+ * <li>We initialise the position mutexes, if this is the first call.
+ * <li>We check images_per_cycle is no more than MOPTOP_STACK_POSITION_COUNT_MAX, and the number of rotations
+ *     in the multrun is no more than MOPTOP_STACK_ROTATION_COUNT_MAX (so the accumulators cannot overflow).
+ * <li>We empty every position's stack, left over from a previous multrun.
+ * <li>We select the addition kernel: AVX2 if the CPU supports it, otherwise scalar.
+ * </ul>
+ * @param images_per_cycle The number of frames in a whole rotation of the rotator.
+ * @param image_count The number of frames in the multrun.
+ * @param ncols The number of (binned) columns in each frame.
+ * @param nrows The number of (binned) rows in each frame.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Stack_Data
+ * @see moptop_stack.html#MOPTOP_STACK_POSITION_COUNT_MAX
+ * @see moptop_stack.html#MOPTOP_STACK_ROTATION_COUNT_MAX
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Stack_Start(int images_per_cycle,int image_count,int ncols,int nrows)
+{
+	int i,rotation_count;
+
+	if(!Stack_Data.Is_Initialised)
+	{
+		for(i = 0; i < MOPTOP_STACK_POSITION_COUNT_MAX; i++)
+		{
+			pthread_mutex_init(&(Stack_Data.Position_List[i].Mutex),NULL);
+			Stack_Data.Position_List[i].Data = NULL;
+			Stack_Data.Position_List[i].Pixel_Count = 0;
+		}
+		Stack_Data.Is_Initialised = TRUE;
+	}
+	for(i = 0; i < MOPTOP_STACK_POSITION_COUNT_MAX; i++)
+		Stack_Data.Position_List[i].Frame_Count = 0;
+	Stack_Data.Images_Per_Cycle = 0;
+	if((images_per_cycle < 1)||(images_per_cycle > MOPTOP_STACK_POSITION_COUNT_MAX)||(image_count < 1)||
+	   (ncols < 1)||(nrows < 1))
+	{
+		Moptop_General_Error_Number = 1100;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Start:"
+			"Illegal images per cycle %d (max %d), image count %d or image dimensions (%d,%d).",
+			images_per_cycle,MOPTOP_STACK_POSITION_COUNT_MAX,image_count,ncols,nrows);
+		return FALSE;
+	}
+	rotation_count = (image_count+images_per_cycle-1)/images_per_cycle;
+	if(rotation_count > MOPTOP_STACK_ROTATION_COUNT_MAX)
+	{
+		Moptop_General_Error_Number = 1101;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Start:"
+			"Too many rotations to stack %d (max %d).",rotation_count,MOPTOP_STACK_ROTATION_COUNT_MAX);
+		return FALSE;
+	}
+	Stack_Data.Images_Per_Cycle = images_per_cycle;
+	Stack_Data.Ncols = ncols;
+	Stack_Data.Nrows = nrows;
+	Stack_Data.Use_AVX2 = FALSE;
+#ifdef STACK_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		Stack_Data.Use_AVX2 = TRUE;
+#endif
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("stack","moptop_stack.c","Moptop_Stack_Start",LOG_VERBOSITY_INTERMEDIATE,
+				  "STACK","Stacking %d rotations of %d frames of %d x %d pixels using the %s kernel.",
+				  rotation_count,images_per_cycle,ncols,nrows,Stack_Data.Use_AVX2 ? "avx2" : "scalar");
+#endif
+	return TRUE;
+}
+
+/**
+ * Add a frame to it's rotator position's stack. This is called by the writer threads, instead of writing the
+ * frame to disk.
+ * <ul>
+ * <li>We check the frame's sequence number and image buffer.
+ * <li>Holding the position's mutex, we (re)allocate the accumulator if it is too small for the current
+ *     image dimensions.
+ * <li>We add the frame into the accumulator using Stack_Add (the first frame added sets the accumulator,
+ *     rather than adding to it).
+ * <li>We update the position's frame count, rotation range, summed exposure length, latest exposure end time
+ *     and dropped frame count. If this frame is from the earliest rotation in the stack so far, we copy it
+ *     (without it's image data) to the position's Header_Frame.
+ * <li>We add the time taken to the MOPTOP_TIMING_TYPE_STACK timing histogram.
+ * </ul>
+ * @param frame The frame to add, with it's image data still in camera format (Ncols x Nrows unsigned shorts
+ *        in host byte order).
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Stack_Data
+ * @see #Stack_Add
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Stack_Frame_Add(struct Moptop_Writer_Frame_Struct *frame)
+{
+	struct Stack_Position_Struct *position = NULL;
+	struct timespec start_time,end_time;
+	unsigned int *new_data = NULL;
+	size_t pixel_count;
+
+	if(frame == NULL)
+	{
+		Moptop_General_Error_Number = 1102;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Frame_Add:frame was NULL.");
+		return FALSE;
+	}
+	position = Stack_Position_Find(frame->Sequence_Number,"Moptop_Stack_Frame_Add");
+	if(position == NULL)
+		return FALSE;
+	pixel_count = ((size_t)Stack_Data.Ncols)*((size_t)Stack_Data.Nrows);
+	if((frame->Image_Buffer == NULL)||(((size_t)frame->Image_Buffer_Length) < (pixel_count*sizeof(unsigned short))))
+	{
+		Moptop_General_Error_Number = 1103;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Frame_Add:"
+			"Image buffer %p of length %d is too small for a %d x %d image.",(void*)frame->Image_Buffer,
+			frame->Image_Buffer_Length,Stack_Data.Ncols,Stack_Data.Nrows);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!Moptop_General_Mutex_Lock(&(position->Mutex)))
+		return FALSE;
+	if(position->Pixel_Count < pixel_count)
+	{
+		new_data = (unsigned int *)realloc(position->Data,pixel_count*sizeof(unsigned int));
+		if(new_data == NULL)
+		{
+			Moptop_General_Mutex_Unlock(&(position->Mutex));
+			Moptop_General_Error_Number = 1104;
+			sprintf(Moptop_General_Error_String,"Moptop_Stack_Frame_Add:"
+				"Failed to allocate stack for position %d (%d x %d).",frame->Sequence_Number,
+				Stack_Data.Ncols,Stack_Data.Nrows);
+			return FALSE;
+		}
+		position->Data = new_data;
+		position->Pixel_Count = pixel_count;
+	}
+	Stack_Add(position->Data,pixel_count,(unsigned short *)frame->Image_Buffer,(position->Frame_Count == 0));
+	if((position->Frame_Count == 0)||(frame->Rotation_Number < position->First_Rotation_Number))
+	{
+		position->Header_Frame = (*frame);
+		position->Header_Frame.Image_Buffer = NULL;
+		position->Header_Frame.Image_Buffer_Length = 0;
+		position->First_Rotation_Number = frame->Rotation_Number;
+	}
+	if((position->Frame_Count == 0)||(frame->Rotation_Number > position->Last_Rotation_Number))
+		position->Last_Rotation_Number = frame->Rotation_Number;
+	if((position->Frame_Count == 0)||
+	   (fdifftime(frame->Exposure_End_Time,position->Exposure_End_Time) > 0.0))
+		position->Exposure_End_Time = frame->Exposure_End_Time;
+	if((position->Frame_Count == 0)||(frame->Dropped_Frame_Count > position->Dropped_Frame_Count))
+		position->Dropped_Frame_Count = frame->Dropped_Frame_Count;
+	if(position->Frame_Count == 0)
+		position->Exposure_Length_Sum = 0.0;
+	position->Exposure_Length_Sum += frame->Exposure_Length;
+	position->Frame_Count++;
+	if(!Moptop_General_Mutex_Unlock(&(position->Mutex)))
+		return FALSE;
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_STACK,start_time,end_time);
+	return TRUE;
+}
+
+/**
+ * Get a rotator position's stack details, so the stacked image's filename and FITS headers can be generated.
+ * This is called once the writer threads have stopped, so no more frames are being added.
+ * @param sequence_number The rotator position (sequence number, from 1) to get.
+ * @param header_frame The address of a frame structure, filled in with a copy of the frame from the first rotation
+ *        in the stack (without it's image data), with it's exposure end time and dropped frame count replaced
+ *        by the latest of the frames in the stack. Only filled in if the stack contains frames.
+ * @param frame_count The address of an integer to store the number of frames in the stack (0 if the
+ *        position has no frames, for instance the later positions of a multrun shorter than one rotation).
+ * @param first_rotation_number The address of an integer to store the first rotation number in the stack.
+ * @param last_rotation_number The address of an integer to store the last rotation number in the stack.
+ * @param exposure_length_sum The address of a double to store the summed exposure length of the stack, in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Stack_Data
+ * @see #Stack_Position_Find
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Stack_Position_Get(int sequence_number,struct Moptop_Writer_Frame_Struct *header_frame,
+			      int *frame_count,int *first_rotation_number,int *last_rotation_number,
+			      double *exposure_length_sum)
+{
+	struct Stack_Position_Struct *position = NULL;
+
+	if((header_frame == NULL)||(frame_count == NULL)||(first_rotation_number == NULL)||
+	   (last_rotation_number == NULL)||(exposure_length_sum == NULL))
+	{
+		Moptop_General_Error_Number = 1105;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Position_Get:Illegal NULL parameter.");
+		return FALSE;
+	}
+	position = Stack_Position_Find(sequence_number,"Moptop_Stack_Position_Get");
+	if(position == NULL)
+		return FALSE;
+	if(!Moptop_General_Mutex_Lock(&(position->Mutex)))
+		return FALSE;
+	(*frame_count) = position->Frame_Count;
+	if(position->Frame_Count > 0)
+	{
+		(*header_frame) = position->Header_Frame;
+		header_frame->Exposure_End_Time = position->Exposure_End_Time;
+		header_frame->Dropped_Frame_Count = position->Dropped_Frame_Count;
+		(*first_rotation_number) = position->First_Rotation_Number;
+		(*last_rotation_number) = position->Last_Rotation_Number;
+		(*exposure_length_sum) = position->Exposure_Length_Sum;
+	}
+	if(!Moptop_General_Mutex_Unlock(&(position->Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Write a rotator position's stack as a 32 bit integer FITS image. This is called once the writer threads
+ * have stopped, so no more frames are being added.
+ * <ul>
+ * <li>We check the position's stack contains frames.
+ * <li>If there is room, we add the MOPRNBEG/MOPRNEND (first and last rotation number stacked) and
+ *     STACKNUM (number of frames stacked) cards to card_image_list.
+ * <li>We lock the FITS filename (or get the temporary filename to write to) using CCD_Fits_Filename_Publish_Begin.
+ * <li>We flip and write the accumulator using CCD_Fits_Image_Int_Write. This flips and byte swaps the
+ *     accumulator in place, so the stack is emptied whether or not the write succeeds.
+ * <li>We publish it using Moptop_Writer_Publish, as part of the first rotation's group but holding no frames.
+ *     The writer has stopped, so it is published straight away.
+ * </ul>
+ * @param sequence_number The rotator position (sequence number, from 1) to write.
+ * @param filename The FITS filename of the stacked image.
+ * @param card_image_list The FITS header card images to put in the image, of at least
+ *        MOPTOP_FITS_HEADER_TEMPLATE_LENGTH characters. This is modified.
+ * @param card_count The number of card images in card_image_list.
+ * @param flip_x A boolean, if TRUE the image is flipped in X.
+ * @param flip_y A boolean, if TRUE the image is flipped in Y.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #STACK_CARD_COUNT
+ * @see #Stack_Card_Keyword_List
+ * @see #Stack_Data
+ * @see #Stack_Position_Find
+ * @see moptop_fits_header.html#MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX
+ * @see moptop_writer.html#Moptop_Writer_Publish
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_Fits_Header_Card_Image_Int_Set
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Int_Write
+ */
+int Moptop_Stack_Position_Write(int sequence_number,char *filename,char *card_image_list,int card_count,
+				int flip_x,int flip_y)
+{
+	struct Stack_Position_Struct *position = NULL;
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int frame_count;
+
+	if((filename == NULL)||(card_image_list == NULL))
+	{
+		Moptop_General_Error_Number = 1106;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Position_Write:filename or card_image_list was NULL.");
+		return FALSE;
+	}
+	position = Stack_Position_Find(sequence_number,"Moptop_Stack_Position_Write");
+	if(position == NULL)
+		return FALSE;
+	frame_count = position->Frame_Count;
+	if(frame_count < 1)
+	{
+		Moptop_General_Error_Number = 1107;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Position_Write:"
+			"Position %d has no frames to write to '%s'.",sequence_number,filename);
+		return FALSE;
+	}
+	/* describe the stack */
+	if((card_count+STACK_CARD_COUNT) <= MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX)
+	{
+		CCD_Fits_Header_Card_Image_Int_Set(card_image_list+(card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						   Stack_Card_Keyword_List[0],position->First_Rotation_Number);
+		CCD_Fits_Header_Card_Image_Int_Set(card_image_list+((card_count+1)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						   Stack_Card_Keyword_List[1],position->Last_Rotation_Number);
+		CCD_Fits_Header_Card_Image_Int_Set(card_image_list+((card_count+2)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+						   Stack_Card_Keyword_List[2],frame_count);
+		card_count += STACK_CARD_COUNT;
+	}
+	/* the accumulator is flipped and byte swapped in place by CCD_Fits_Image_Int_Write, so empty the stack */
+	position->Frame_Count = 0;
+	if(!CCD_Fits_Filename_Publish_Begin(filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 1108;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Position_Write:Failed to lock '%s'.",filename);
+		return FALSE;
+	}
+	if(!CCD_Fits_Image_Int_Write(write_filename,card_image_list,card_count,Stack_Data.Ncols,Stack_Data.Nrows,
+				     flip_x,flip_y,position->Data))
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		Moptop_General_Error_Number = 1109;
+		sprintf(Moptop_General_Error_String,"Moptop_Stack_Position_Write:Failed to write '%s'.",filename);
+		return FALSE;
+	}
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("stack","moptop_stack.c","Moptop_Stack_Position_Write",LOG_VERBOSITY_INTERMEDIATE,
+				  "STACK","Position %d stacked from %d frames (rotations %d to %d) to '%s'.",
+				  sequence_number,frame_count,position->First_Rotation_Number,
+				  position->Last_Rotation_Number,filename);
+#endif
+	return Moptop_Writer_Publish(write_filename,position->First_Rotation_Number,0);
+}
+
+/* ----------------------------------------------------------------------------
+** 		internal functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Find the stack of a rotator position in Stack_Data.Position_List.
+ * @param sequence_number The rotator position (sequence number, from 1) to find.
+ * @param function_name The name of the calling function, used in the error string.
+ * @return A pointer to the position's stack, or NULL if the sequence number is not a rotator position of
+ *         the current multrun.
+ * @see #Stack_Data
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+static struct Stack_Position_Struct *Stack_Position_Find(int sequence_number,char *function_name)
+{
+	if((sequence_number < 1)||(sequence_number > Stack_Data.Images_Per_Cycle))
+	{
+		Moptop_General_Error_Number = 1110;
+		sprintf(Moptop_General_Error_String,"%s:Illegal sequence number %d (of %d).",function_name,
+			sequence_number,Stack_Data.Images_Per_Cycle);
+		return NULL;
+	}
+	return &(Stack_Data.Position_List[sequence_number-1]);
+}
+
+/**
+ * Add a frame into a rotator position's accumulator. If first is TRUE, the accumulator is set rather than added to.
+ * The AVX2 kernel is used if Stack_Data.Use_AVX2 is TRUE, and the scalar kernel does any remaining pixels.
+ * @param stack_data The accumulator, pixel_count unsigned integers.
+ * @param pixel_count The number of pixels in the frame.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param first A boolean, TRUE if this is the first frame added to the accumulator.
+ * @see #Stack_Data
+ * @see #Stack_Add_Scalar
+ * @see #Stack_Add_AVX2
+ */
+static void Stack_Add(unsigned int *stack_data,size_t pixel_count,unsigned short *image_data,int first)
+{
+	size_t start = 0;
+
+#ifdef STACK_X86
+	if(Stack_Data.Use_AVX2)
+		start = Stack_Add_AVX2(stack_data,pixel_count,image_data,first);
+#endif
+	Stack_Add_Scalar(stack_data,pixel_count,image_data,start,first);
+}
+
+/**
+ * Scalar addition kernel. See Stack_Add.
+ * @param stack_data The accumulator, pixel_count unsigned integers.
+ * @param pixel_count The number of pixels in the frame.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param start The first pixel to add (the pixels before this have been done by a SIMD kernel).
+ * @param first A boolean, TRUE if this is the first frame added to the accumulator.
+ * @return The number of pixels processed (pixel_count).
+ * @see #Stack_Add
+ */
+static size_t Stack_Add_Scalar(unsigned int *stack_data,size_t pixel_count,unsigned short *image_data,
+			       size_t start,int first)
+{
+	size_t i;
+
+	if(first)
+	{
+		for(i = start; i < pixel_count; i++)
+			stack_data[i] = (unsigned int)image_data[i];
+	}
+	else
+	{
+		for(i = start; i < pixel_count; i++)
+			stack_data[i] += (unsigned int)image_data[i];
+	}
+	return pixel_count;
+}
+
+#ifdef STACK_X86
+/**
+ * AVX2 addition kernel, 16 pixels at a time: each 16 unsigned shorts are widened to two sets of 8 32 bit integers,
+ * and added into the accumulator. See Stack_Add.
+ * @param stack_data The accumulator, pixel_count unsigned integers.
+ * @param pixel_count The number of pixels in the frame.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param first A boolean, TRUE if this is the first frame added to the accumulator.
+ * @return The number of pixels processed (a multiple of 16), the rest must be done by Stack_Add_Scalar.
+ * @see #Stack_Add
+ */
+__attribute__((target("avx2")))
+static size_t Stack_Add_AVX2(unsigned int *stack_data,size_t pixel_count,unsigned short *image_data,int first)
+{
+	__m256i low_value,high_value;
+	size_t i;
+
+	if(first)
+	{
+		for(i = 0; (i+16) <= pixel_count; i += 16)
+		{
+			low_value = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_data+i)));
+			high_value = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_data+i+8)));
+			_mm256_storeu_si256((__m256i *)(stack_data+i),low_value);
+			_mm256_storeu_si256((__m256i *)(stack_data+i+8),high_value);
+		}
+	}
+	else
+	{
+		for(i = 0; (i+16) <= pixel_count; i += 16)
+		{
+			low_value = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_data+i)));
+			high_value = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(image_data+i+8)));
+			_mm256_storeu_si256((__m256i *)(stack_data+i),
+				_mm256_add_epi32(_mm256_loadu_si256((__m256i *)(stack_data+i)),low_value));
+			_mm256_storeu_si256((__m256i *)(stack_data+i+8),
+				_mm256_add_epi32(_mm256_loadu_si256((__m256i *)(stack_data+i+8)),high_value));
+		}
+	}
+	return i;
+}
+#endif
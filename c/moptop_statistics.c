@@ -0,0 +1,525 @@
+/* moptop_statistics.c
+** Moptop per-frame image statistics routines
+*/
+/**
+ * Routines to compute the image statistics (mean, median, standard deviation, minimum, maximum and number of
+ * saturated pixels) of each multrun frame as it is written, for the FITS headers and the
+ * "status exposure statistics" command, so robotic quality control does not have to re-read the FITS images.
+ * Each frame is first scanned for it's minimum and maximum pixel values (with AVX2 where the CPU supports it).
+ * It is then read once more, to build a histogram of it's 16 bit pixel values (spread over several sub-histograms,
+ * so runs of equal pixel values do not stall on the same counter). Only the bins between the minimum and maximum 
+ * are cleared, merged and walked, and all the statistics are computed exactly from them, which is much cheaper 
+ * than another pass over the frame. A constant frame needs no histogram at all.
+ * The computation can be turned off ("moptop.multrun.statistics.enable").
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "log_udp.h"
+
+#include "moptop_config.h"
+#include "moptop_general.h"
+#include "moptop_statistics.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
+
+/* hash defines */
+/**
+ * The number of bins in a histogram of 16 bit pixel values.
+ */
+#define STATISTICS_BIN_COUNT            (65536)
+/**
+ * The number of sub-histograms each frame's pixels are spread over. Consecutive pixels are counted in different
+ * sub-histograms, so a run of equal values does not serialise on one counter.
+ */
+#define STATISTICS_SUB_HISTOGRAM_COUNT  (4)
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Defined if this is an x86 build, and the AVX2 minimum/maximum kernel can be compiled (and selected
+ * at run time if the CPU supports it).
+ */
+#define STATISTICS_X86                  (1)
+#endif
+
+/* data types */
+/**
+ * Data type holding local data to the moptop statistics routines.
+ * <dl>
+ * <dt>Enable</dt> <dd>A boolean, TRUE if the frame statistics are computed ("moptop.multrun.statistics.enable").</dd>
+ * <dt>Use_AVX2</dt> <dd>A boolean, TRUE if the CPU supports AVX2, and the SIMD minimum/maximum kernel is used.</dd>
+ * <dt>Saturation_Level</dt> <dd>Pixels at or above this value are counted as saturated
+ *                               ("moptop.multrun.statistics.saturation.level").</dd>
+ * <dt>Histogram_List</dt> <dd>The histograms frames are counted into, one per writer thread. Each holds
+ *                             STATISTICS_SUB_HISTOGRAM_COUNT x STATISTICS_BIN_COUNT counters. These are allocated
+ *                             the first time they are used, and kept between multruns.</dd>
+ * <dt>Histogram_In_Use_List</dt> <dd>A boolean for each histogram, TRUE whilst a writer thread is using it.</dd>
+ * <dt>Latest</dt> <dd>The statistics of the most recently computed frame.</dd>
+ * </dl>
+ * @see #STATISTICS_BIN_COUNT
+ * @see #STATISTICS_SUB_HISTOGRAM_COUNT
+ * @see moptop_statistics.html#Moptop_Statistics_Struct
+ * @see moptop_writer.html#MOPTOP_WRITER_THREAD_COUNT_MAX
+ */
+struct Statistics_Struct
+{
+	int Enable;
+	int Use_AVX2;
+	int Saturation_Level;
+	unsigned int *Histogram_List[MOPTOP_WRITER_THREAD_COUNT_MAX];
+	int Histogram_In_Use_List[MOPTOP_WRITER_THREAD_COUNT_MAX];
+	struct Moptop_Statistics_Struct Latest;
+};
+
+/* internal data */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * The instance of Statistics_Struct that contains local data for this module.
+ * <dl>
+ * <dt>Enable</dt>                <dd>TRUE</dd>
+ * <dt>Use_AVX2</dt>              <dd>FALSE</dd>
+ * <dt>Saturation_Level</dt>      <dd>65535</dd>
+ * <dt>Histogram_List</dt>        <dd>All NULL</dd>
+ * <dt>Histogram_In_Use_List</dt> <dd>All FALSE</dd>
+ * <dt>Latest</dt>                <dd>All zero</dd>
+ * </dl>
+ * @see #Statistics_Struct
+ */
+static struct Statistics_Struct Statistics_Data = {TRUE,FALSE,65535,{NULL},{FALSE},{0}};
+/**
+ * A mutex protecting the allocation of the histograms, and the latest statistics.
+ */
+static pthread_mutex_t Statistics_Mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* internal functions */
+static void Statistics_Min_Max_Get(unsigned short *image_data,int pixel_count,int *minimum,int *maximum);
+static int Statistics_Min_Max_Get_Scalar(unsigned short *image_data,int start,int pixel_count,int *minimum,
+					 int *maximum);
+#ifdef STATISTICS_X86
+static int Statistics_Min_Max_Get_AVX2(unsigned short *image_data,int pixel_count,int *minimum,int *maximum);
+#endif
+static void Statistics_Histogram_Compute(unsigned int *histogram,int minimum,int maximum,
+					 struct Moptop_Statistics_Struct *statistics);
+
+/* ----------------------------------------------------------------------------
+** 		external functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Setup the computation of the frame statistics for a multrun. This must be called before the writer threads
+ * are started. 
+ * <ul>
+ * <li>We retrieve the "moptop.multrun.statistics.enable" config value into Statistics_Data.Enable.
+ * <li>We retrieve the "moptop.multrun.statistics.saturation.level" config value, and check it.
+ * <li>We select the minimum/maximum kernel: AVX2 if the CPU supports it, otherwise scalar.
+ * </ul>
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #STATISTICS_BIN_COUNT
+ * @see #Statistics_Data
+ * @see moptop_config.html#Moptop_Config_Get_Boolean
+ * @see moptop_config.html#Moptop_Config_Get_Integer
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Statistics_Start(void)
+{
+	int saturation_level;
+
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.statistics.enable",&(Statistics_Data.Enable)))
+		return FALSE;
+	if(!Moptop_Config_Get_Integer("moptop.multrun.statistics.saturation.level",&saturation_level))
+		return FALSE;
+	if((saturation_level < 1)||(saturation_level >= STATISTICS_BIN_COUNT))
+	{
+		Moptop_General_Error_Number = 1400;
+		sprintf(Moptop_General_Error_String,"Moptop_Statistics_Start:Illegal saturation level %d.",
+			saturation_level);
+		return FALSE;
+	}
+	Statistics_Data.Saturation_Level = saturation_level;
+	Statistics_Data.Use_AVX2 = FALSE;
+#ifdef STATISTICS_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		Statistics_Data.Use_AVX2 = TRUE;
+#endif
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("statistics","moptop_statistics.c","Moptop_Statistics_Start",
+				  LOG_VERBOSITY_INTERMEDIATE,"STATISTICS","Frame statistics are %s "
+				  "(saturation level %d, %s minimum/maximum kernel).",
+				  Statistics_Data.Enable ? "enabled" : "disabled",Statistics_Data.Saturation_Level,
+				  Statistics_Data.Use_AVX2 ? "avx2" : "scalar");
+#endif
+	return TRUE;
+}
+
+/**
+ * Return whether the frame statistics are computed, as configured by Moptop_Statistics_Start.
+ * @return TRUE if the frame statistics are enabled, FALSE if they are not.
+ * @see #Statistics_Data
+ */
+int Moptop_Statistics_Is_Enabled(void)
+{
+	return Statistics_Data.Enable;
+}
+
+/**
+ * Compute the statistics of a frame. This is called by the writer threads, before the frame's image data
+ * is converted to FITS format.
+ * <ul>
+ * <li>We find the minimum and maximum pixel values using Statistics_Min_Max_Get.
+ * <li>If they are the same (a constant frame), we fill in the statistics directly, without a histogram.
+ *     Otherwise:
+ *     <ul>
+ *     <li>We get a free histogram (allocating it the first time it is used), holding Statistics_Mutex.
+ *     <li>We clear the bins from the minimum to the maximum of each sub-histogram, and count each pixel value 
+ *         into them, cycling through the sub-histograms.
+ *     <li>We compute the statistics from those bins using Statistics_Histogram_Compute.
+ *     </ul>
+ * <li>We release the histogram, and save the statistics as the latest statistics, holding Statistics_Mutex.
+ * <li>We add the time taken to the MOPTOP_TIMING_TYPE_STATISTICS timing histogram.
+ * </ul>
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order (as read out
+ *        from the camera).
+ * @param pixel_count The number of pixels in the frame.
+ * @param statistics The address of a structure to fill in with the frame's statistics.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #STATISTICS_BIN_COUNT
+ * @see #STATISTICS_SUB_HISTOGRAM_COUNT
+ * @see #Statistics_Data
+ * @see #Statistics_Mutex
+ * @see #Statistics_Min_Max_Get
+ * @see #Statistics_Histogram_Compute
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Statistics_Frame_Compute(unsigned short *image_data,int pixel_count,
+				    struct Moptop_Statistics_Struct *statistics)
+{
+	struct timespec start_time,end_time;
+	unsigned int *histogram = NULL;
+	unsigned int *histogram_0 = NULL;
+	unsigned int *histogram_1 = NULL;
+	unsigned int *histogram_2 = NULL;
+	unsigned int *histogram_3 = NULL;
+	size_t bin_length;
+	int i,histogram_index,minimum,maximum,sub_histogram;
+
+	if((image_data == NULL)||(pixel_count < 1)||(statistics == NULL))
+	{
+		Moptop_General_Error_Number = 1401;
+		sprintf(Moptop_General_Error_String,"Moptop_Statistics_Frame_Compute:"
+			"Illegal image data %p, pixel count %d or statistics %p.",(void*)image_data,pixel_count,
+			(void*)statistics);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	/* the histogram only needs the bins between the minimum and maximum pixel values */
+	Statistics_Min_Max_Get(image_data,pixel_count,&minimum,&maximum);
+	if(minimum == maximum)
+	{
+		statistics->Pixel_Count = pixel_count;
+		statistics->Mean = (double)minimum;
+		statistics->Median = (double)minimum;
+		statistics->Standard_Deviation = 0.0;
+		statistics->Minimum = minimum;
+		statistics->Maximum = maximum;
+		if(minimum >= Statistics_Data.Saturation_Level)
+			statistics->Saturated_Count = pixel_count;
+		else
+			statistics->Saturated_Count = 0;
+		pthread_mutex_lock(&Statistics_Mutex);
+		Statistics_Data.Latest = (*statistics);
+		pthread_mutex_unlock(&Statistics_Mutex);
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_STATISTICS,start_time,end_time);
+		return TRUE;
+	}
+	/* get a histogram */
+	if(!Moptop_General_Mutex_Lock(&Statistics_Mutex))
+		return FALSE;
+	histogram_index = -1;
+	for(i = 0; i < MOPTOP_WRITER_THREAD_COUNT_MAX; i++)
+	{
+		if(Statistics_Data.Histogram_In_Use_List[i] == FALSE)
+		{
+			histogram_index = i;
+			break;
+		}
+	}
+	if(histogram_index == -1)
+	{
+		Moptop_General_Mutex_Unlock(&Statistics_Mutex);
+		Moptop_General_Error_Number = 1402;
+		sprintf(Moptop_General_Error_String,"Moptop_Statistics_Frame_Compute:No free histograms.");
+		return FALSE;
+	}
+	if(Statistics_Data.Histogram_List[histogram_index] == NULL)
+	{
+		Statistics_Data.Histogram_List[histogram_index] = (unsigned int *)malloc(STATISTICS_SUB_HISTOGRAM_COUNT*
+									 STATISTICS_BIN_COUNT*sizeof(unsigned int));
+		if(Statistics_Data.Histogram_List[histogram_index] == NULL)
+		{
+			Moptop_General_Mutex_Unlock(&Statistics_Mutex);
+			Moptop_General_Error_Number = 1403;
+			sprintf(Moptop_General_Error_String,"Moptop_Statistics_Frame_Compute:"
+				"Failed to allocate histogram %d.",histogram_index);
+			return FALSE;
+		}
+	}
+	Statistics_Data.Histogram_In_Use_List[histogram_index] = TRUE;
+	histogram = Statistics_Data.Histogram_List[histogram_index];
+	if(!Moptop_General_Mutex_Unlock(&Statistics_Mutex))
+		return FALSE;
+	/* count the pixel values */
+	bin_length = ((size_t)(maximum-minimum+1))*sizeof(unsigned int);
+	for(sub_histogram = 0; sub_histogram < STATISTICS_SUB_HISTOGRAM_COUNT; sub_histogram++)
+		memset(histogram+(sub_histogram*STATISTICS_BIN_COUNT)+minimum,0,bin_length);
+	histogram_0 = histogram;
+	histogram_1 = histogram+STATISTICS_BIN_COUNT;
+	histogram_2 = histogram+(2*STATISTICS_BIN_COUNT);
+	histogram_3 = histogram+(3*STATISTICS_BIN_COUNT);
+	for(i = 0; (i+STATISTICS_SUB_HISTOGRAM_COUNT) <= pixel_count; i += STATISTICS_SUB_HISTOGRAM_COUNT)
+	{
+		histogram_0[image_data[i]]++;
+		histogram_1[image_data[i+1]]++;
+		histogram_2[image_data[i+2]]++;
+		histogram_3[image_data[i+3]]++;
+	}
+	for(; i < pixel_count; i++)
+		histogram_0[image_data[i]]++;
+	Statistics_Histogram_Compute(histogram,minimum,maximum,statistics);
+	/* release the histogram, and save the latest statistics */
+	pthread_mutex_lock(&Statistics_Mutex);
+	Statistics_Data.Histogram_In_Use_List[histogram_index] = FALSE;
+	Statistics_Data.Latest = (*statistics);
+	pthread_mutex_unlock(&Statistics_Mutex);
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(MOPTOP_TIMING_SET_MULTRUN,MOPTOP_TIMING_TYPE_STATISTICS,start_time,end_time);
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("statistics","moptop_statistics.c","Moptop_Statistics_Frame_Compute",
+				  LOG_VERBOSITY_VERBOSE,"STATISTICS","Mean %.3f, median %.1f, standard deviation %.3f, "
+				  "minimum %d, maximum %d, saturated %d, in %.3f ms.",statistics->Mean,statistics->Median,
+				  statistics->Standard_Deviation,statistics->Minimum,statistics->Maximum,
+				  statistics->Saturated_Count,fdifftime(end_time,start_time)*1000.0);
+#endif
+	return TRUE;
+}
+
+/**
+ * Get the statistics of the most recently computed frame. These are all zero if no frame has been computed yet.
+ * @param statistics The address of a structure to fill in with the latest statistics.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Statistics_Data
+ * @see #Statistics_Mutex
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Statistics_Latest_Get(struct Moptop_Statistics_Struct *statistics)
+{
+	if(statistics == NULL)
+	{
+		Moptop_General_Error_Number = 1404;
+		sprintf(Moptop_General_Error_String,"Moptop_Statistics_Latest_Get:statistics was NULL.");
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&Statistics_Mutex))
+		return FALSE;
+	(*statistics) = Statistics_Data.Latest;
+	if(!Moptop_General_Mutex_Unlock(&Statistics_Mutex))
+		return FALSE;
+	return TRUE;
+}
+
+/* ----------------------------------------------------------------------------
+** 		internal functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Find the minimum and maximum pixel values of a frame. The AVX2 kernel is used if Statistics_Data.Use_AVX2 
+ * is TRUE, and the scalar kernel does any remaining pixels.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param pixel_count The number of pixels in the frame, at least 1.
+ * @param minimum The address of an integer to store the minimum pixel value in.
+ * @param maximum The address of an integer to store the maximum pixel value in.
+ * @see #Statistics_Data
+ * @see #Statistics_Min_Max_Get_Scalar
+ * @see #Statistics_Min_Max_Get_AVX2
+ */
+static void Statistics_Min_Max_Get(unsigned short *image_data,int pixel_count,int *minimum,int *maximum)
+{
+	int start = 0;
+
+	(*minimum) = image_data[0];
+	(*maximum) = image_data[0];
+#ifdef STATISTICS_X86
+	if(Statistics_Data.Use_AVX2)
+		start = Statistics_Min_Max_Get_AVX2(image_data,pixel_count,minimum,maximum);
+#endif
+	Statistics_Min_Max_Get_Scalar(image_data,start,pixel_count,minimum,maximum);
+}
+
+/**
+ * Scalar minimum/maximum kernel. See Statistics_Min_Max_Get.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param start The first pixel to scan (the pixels before this have been done by a SIMD kernel).
+ * @param pixel_count The number of pixels in the frame.
+ * @param minimum The address of the minimum pixel value so far, updated here.
+ * @param maximum The address of the maximum pixel value so far, updated here.
+ * @return The number of pixels processed (pixel_count).
+ * @see #Statistics_Min_Max_Get
+ */
+static int Statistics_Min_Max_Get_Scalar(unsigned short *image_data,int start,int pixel_count,int *minimum,
+					 int *maximum)
+{
+	int i,min_value,max_value;
+
+	min_value = (*minimum);
+	max_value = (*maximum);
+	for(i = start; i < pixel_count; i++)
+	{
+		if(image_data[i] < min_value)
+			min_value = image_data[i];
+		if(image_data[i] > max_value)
+			max_value = image_data[i];
+	}
+	(*minimum) = min_value;
+	(*maximum) = max_value;
+	return pixel_count;
+}
+
+#ifdef STATISTICS_X86
+/**
+ * AVX2 minimum/maximum kernel, 32 pixels at a time (two vectors of 16 unsigned shorts, so the minimum and 
+ * maximum chains overlap). The vector minimum and maximum are reduced to scalars at the end. 
+ * See Statistics_Min_Max_Get.
+ * @param image_data The frame's image data, pixel_count unsigned shorts in host byte order.
+ * @param pixel_count The number of pixels in the frame.
+ * @param minimum The address of the minimum pixel value so far, updated here.
+ * @param maximum The address of the maximum pixel value so far, updated here.
+ * @return The number of pixels processed (a multiple of 32), the rest must be done by 
+ *         Statistics_Min_Max_Get_Scalar.
+ * @see #Statistics_Min_Max_Get
+ */
+__attribute__((target("avx2")))
+static int Statistics_Min_Max_Get_AVX2(unsigned short *image_data,int pixel_count,int *minimum,int *maximum)
+{
+	unsigned short min_list[16],max_list[16];
+	__m256i min_0,min_1,max_0,max_1,value_0,value_1;
+	int i;
+
+	if(pixel_count < 32)
+		return 0;
+	min_0 = _mm256_set1_epi16((short)image_data[0]);
+	min_1 = min_0;
+	max_0 = min_0;
+	max_1 = min_0;
+	for(i = 0; (i+32) <= pixel_count; i += 32)
+	{
+		value_0 = _mm256_loadu_si256((__m256i *)(image_data+i));
+		value_1 = _mm256_loadu_si256((__m256i *)(image_data+i+16));
+		min_0 = _mm256_min_epu16(min_0,value_0);
+		min_1 = _mm256_min_epu16(min_1,value_1);
+		max_0 = _mm256_max_epu16(max_0,value_0);
+		max_1 = _mm256_max_epu16(max_1,value_1);
+	}
+	_mm256_storeu_si256((__m256i *)min_list,_mm256_min_epu16(min_0,min_1));
+	_mm256_storeu_si256((__m256i *)max_list,_mm256_max_epu16(max_0,max_1));
+	Statistics_Min_Max_Get_Scalar(min_list,0,16,minimum,maximum);
+	Statistics_Min_Max_Get_Scalar(max_list,0,16,minimum,maximum);
+	return i;
+}
+#endif
+
+/**
+ * Compute a frame's statistics from it's histogram.
+ * <ul>
+ * <li>We merge the sub-histograms' bins from minimum to maximum into the first one, and sum the counts, values 
+ *     and saturated counts. The sums are exact 64 bit integers.
+ * <li>We find the median by walking the histogram to the middle two pixels (by rank).
+ * <li>We compute the standard deviation by summing count x (value - mean)^2 over the histogram, which does
+ *     not suffer from the cancellation of sum(x^2) - n x mean^2.
+ * </ul>
+ * @param histogram The histogram, STATISTICS_SUB_HISTOGRAM_COUNT x STATISTICS_BIN_COUNT counters, of which only
+ *        the bins from minimum to maximum are used. The first sub-histogram is overwritten with the merged histogram.
+ * @param minimum The minimum pixel value in the frame.
+ * @param maximum The maximum pixel value in the frame.
+ * @param statistics The address of a structure to fill in with the frame's statistics.
+ * @see #STATISTICS_BIN_COUNT
+ * @see #STATISTICS_SUB_HISTOGRAM_COUNT
+ * @see #Statistics_Data
+ */
+static void Statistics_Histogram_Compute(unsigned int *histogram,int minimum,int maximum,
+					 struct Moptop_Statistics_Struct *statistics)
+{
+	unsigned long long int pixel_count,value_sum,rank,lower_rank,upper_rank;
+	double mean,difference,variance_sum;
+	int value,lower_value,upper_value,sub_histogram;
+
+	pixel_count = 0;
+	value_sum = 0;
+	statistics->Minimum = minimum;
+	statistics->Maximum = maximum;
+	statistics->Saturated_Count = 0;
+	for(value = minimum; value <= maximum; value++)
+	{
+		for(sub_histogram = 1; sub_histogram < STATISTICS_SUB_HISTOGRAM_COUNT; sub_histogram++)
+			histogram[value] += histogram[(sub_histogram*STATISTICS_BIN_COUNT)+value];
+		if(histogram[value] == 0)
+			continue;
+		pixel_count += histogram[value];
+		value_sum += ((unsigned long long int)histogram[value])*((unsigned long long int)value);
+		if(value >= Statistics_Data.Saturation_Level)
+			statistics->Saturated_Count += histogram[value];
+	}
+	statistics->Pixel_Count = (int)pixel_count;
+	mean = ((double)value_sum)/((double)pixel_count);
+	statistics->Mean = mean;
+	/* median: the mean of the values at (0 based) ranks (n-1)/2 and n/2 */
+	lower_rank = (pixel_count-1)/2;
+	upper_rank = pixel_count/2;
+	lower_value = -1;
+	upper_value = -1;
+	rank = 0;
+	variance_sum = 0.0;
+	for(value = statistics->Minimum; value <= statistics->Maximum; value++)
+	{
+		if(histogram[value] == 0)
+			continue;
+		rank += histogram[value];
+		if((lower_value < 0)&&(rank > lower_rank))
+			lower_value = value;
+		if((upper_value < 0)&&(rank > upper_rank))
+			upper_value = value;
+		difference = ((double)value)-mean;
+		variance_sum += ((double)histogram[value])*difference*difference;
+	}
+	statistics->Median = (((double)lower_value)+((double)upper_value))/2.0;
+	if(pixel_count > 1)
+		statistics->Standard_Deviation = sqrt(variance_sum/((double)(pixel_count-1)));
+	else
+		statistics->Standard_Deviation = 0.0;
+}
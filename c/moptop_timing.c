@@ -0,0 +1,580 @@
+/* moptop_timing.c
+** Moptop per-frame timing routines
+*/
+/**
+ * Routines to record how long each part of the per-frame acquire/write path takes, during multruns and
+ * bias/darks. Each duration is added to an in-memory fixed-bucket histogram (one per timing set and type),
+ * from which the count, mean, p50/p95/p99 and maximum durations can be retrieved (e.g. by the
+ * "status timing" command), or written to a per-multrun summary file.
+ * Adding a duration is cheap (no allocation, a short critical section), so it can be done in the acquisition
+ * hot loop and the writer threads.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log_udp.h"
+
+#include "moptop_config.h"
+#include "moptop_general.h"
+#include "moptop_timing.h"
+
+/* hash defines */
+/**
+ * The number of linear sub-buckets per power of two in a histogram.
+ */
+#define TIMING_SUB_BUCKET_COUNT        (16)
+/**
+ * The number of bits needed to index a sub-bucket (log2(TIMING_SUB_BUCKET_COUNT)).
+ */
+#define TIMING_SUB_BUCKET_BITS         (4)
+/**
+ * The length of the filename of the timing summary file.
+ */
+#define TIMING_FILENAME_LENGTH         (256)
+
+/* data types */
+/**
+ * Data type holding one timing histogram.
+ * <dl>
+ * <dt>Count</dt> <dd>The number of durations recorded.</dd>
+ * <dt>Sum</dt> <dd>The sum of the durations recorded, in microseconds.</dd>
+ * <dt>Max</dt> <dd>The longest duration recorded, in microseconds.</dd>
+ * <dt>Bucket_List</dt> <dd>The number of durations recorded in each histogram bucket.</dd>
+ * </dl>
+ * @see moptop_timing.html#MOPTOP_TIMING_BUCKET_COUNT
+ */
+struct Timing_Histogram_Struct
+{
+	int Count;
+	double Sum;
+	long long int Max;
+	int Bucket_List[MOPTOP_TIMING_BUCKET_COUNT];
+};
+
+/**
+ * Data type holding local data to the moptop timing routines.
+ * <dl>
+ * <dt>Mutex</dt> <dd>A mutex protecting access to the histograms, as durations are added by the acquisition
+ *                    thread and the writer threads, and read by the command threads.</dd>
+ * <dt>Histogram_List</dt> <dd>A histogram for each timing type in each timing set.</dd>
+ * </dl>
+ * @see #Timing_Histogram_Struct
+ * @see moptop_timing.html#MOPTOP_TIMING_SET_COUNT
+ * @see moptop_timing.html#MOPTOP_TIMING_TYPE_COUNT
+ */
+struct Timing_Struct
+{
+	pthread_mutex_t Mutex;
+	struct Timing_Histogram_Struct Histogram_List[MOPTOP_TIMING_SET_COUNT][MOPTOP_TIMING_TYPE_COUNT];
+};
+
+/* internal data */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * Timing Data holding local data to the moptop timing routines.
+ * <dl>
+ * <dt>Mutex</dt>          <dd>PTHREAD_MUTEX_INITIALIZER</dd>
+ * <dt>Histogram_List</dt> <dd>All zero</dd>
+ * </dl>
+ * @see #Timing_Struct
+ */
+static struct Timing_Struct Timing_Data =
+{
+	PTHREAD_MUTEX_INITIALIZER,{{{0}}}
+};
+/**
+ * The names of each timing set, indexed by MOPTOP_TIMING_SET. These are the names used by the
+ * "status timing" command.
+ * @see moptop_timing.html#MOPTOP_TIMING_SET
+ */
+static char *Timing_Set_Name_List[MOPTOP_TIMING_SET_COUNT] =
+{
+	"multrun","biasdark"
+};
+/**
+ * The names of each timing type, indexed by MOPTOP_TIMING_TYPE.
+ * @see moptop_timing.html#MOPTOP_TIMING_TYPE
+ */
+static char *Timing_Type_Name_List[MOPTOP_TIMING_TYPE_COUNT] =
+{
+	"grabber_wait","rotator_query","metadata_decode","frame_get","frame_interval","filename_lock",
+	"fits_create","header","image_convert","fits_write","fits_close","filename_unlock","file_sync",
+	"stage_flush","reduce","stack","calibrate","master","statistics"
+};
+
+/* internal functions */
+static int Timing_Bucket_Index(long long int duration_us);
+static long long int Timing_Bucket_Upper_Limit(int index);
+static double Timing_Percentile(struct Timing_Histogram_Struct *histogram,double percentile);
+
+/* ----------------------------------------------------------------------------
+** 		external functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Reset the histograms in a timing set. This is called at the start of each multrun / bias / dark, so the
+ * timing statistics reflect the current (or last) acquisition.
+ * @param set Which set of histograms to reset.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Timing_Data
+ * @see moptop_timing.html#MOPTOP_TIMING_SET
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ */
+int Moptop_Timing_Reset(enum MOPTOP_TIMING_SET set)
+{
+	if(!MOPTOP_TIMING_IS_SET(set))
+	{
+		Moptop_General_Error_Number = 900;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Reset: Illegal set %d.",set);
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&(Timing_Data.Mutex)))
+		return FALSE;
+	memset(Timing_Data.Histogram_List[set],0,sizeof(Timing_Data.Histogram_List[set]));
+	if(!Moptop_General_Mutex_Unlock(&(Timing_Data.Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Add a duration to a timing histogram.
+ * @param set Which set of histograms to add the duration to.
+ * @param type Which part of the acquire/write path the duration is for.
+ * @param start_time A timestamp taken at the start of the timed operation.
+ * @param end_time A timestamp taken at the end of the timed operation.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Timing_Data
+ * @see #Timing_Bucket_Index
+ * @see moptop_timing.html#MOPTOP_TIMING_SET
+ * @see moptop_timing.html#MOPTOP_TIMING_TYPE
+ * @see moptop_general.html#fdifftime
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ */
+int Moptop_Timing_Add(enum MOPTOP_TIMING_SET set,enum MOPTOP_TIMING_TYPE type,struct timespec start_time,
+		      struct timespec end_time)
+{
+	struct Timing_Histogram_Struct *histogram = NULL;
+	long long int duration_us;
+
+	if(!MOPTOP_TIMING_IS_SET(set))
+	{
+		Moptop_General_Error_Number = 901;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Add: Illegal set %d.",set);
+		return FALSE;
+	}
+	if(!MOPTOP_TIMING_IS_TYPE(type))
+	{
+		Moptop_General_Error_Number = 902;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Add: Illegal type %d.",type);
+		return FALSE;
+	}
+	duration_us = (long long int)(fdifftime(end_time,start_time)*1000000.0);
+	if(duration_us < 0)
+		duration_us = 0;
+	if(!Moptop_General_Mutex_Lock(&(Timing_Data.Mutex)))
+		return FALSE;
+	histogram = &(Timing_Data.Histogram_List[set][type]);
+	histogram->Count++;
+	histogram->Sum += (double)duration_us;
+	if(duration_us > histogram->Max)
+		histogram->Max = duration_us;
+	histogram->Bucket_List[Timing_Bucket_Index(duration_us)]++;
+	if(!Moptop_General_Mutex_Unlock(&(Timing_Data.Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Compute statistics from a timing histogram.
+ * @param set Which set of histograms to use.
+ * @param type Which histogram in the set to use.
+ * @param statistics The address of a Moptop_Timing_Statistics_Struct to fill in. All times are in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Timing_Data
+ * @see #Timing_Percentile
+ * @see moptop_timing.html#MOPTOP_TIMING_SET
+ * @see moptop_timing.html#MOPTOP_TIMING_TYPE
+ * @see moptop_timing.html#Moptop_Timing_Statistics_Struct
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ */
+int Moptop_Timing_Statistics_Get(enum MOPTOP_TIMING_SET set,enum MOPTOP_TIMING_TYPE type,
+				 struct Moptop_Timing_Statistics_Struct *statistics)
+{
+	struct Timing_Histogram_Struct *histogram = NULL;
+
+	if(!MOPTOP_TIMING_IS_SET(set))
+	{
+		Moptop_General_Error_Number = 903;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Statistics_Get: Illegal set %d.",set);
+		return FALSE;
+	}
+	if(!MOPTOP_TIMING_IS_TYPE(type))
+	{
+		Moptop_General_Error_Number = 904;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Statistics_Get: Illegal type %d.",type);
+		return FALSE;
+	}
+	if(statistics == NULL)
+	{
+		Moptop_General_Error_Number = 905;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Statistics_Get: statistics was NULL.");
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&(Timing_Data.Mutex)))
+		return FALSE;
+	histogram = &(Timing_Data.Histogram_List[set][type]);
+	statistics->Count = histogram->Count;
+	if(histogram->Count > 0)
+		statistics->Mean = (histogram->Sum/((double)histogram->Count))/1000000.0;
+	else
+		statistics->Mean = 0.0;
+	statistics->P50 = Timing_Percentile(histogram,50.0);
+	statistics->P95 = Timing_Percentile(histogram,95.0);
+	statistics->P99 = Timing_Percentile(histogram,99.0);
+	statistics->Max = ((double)histogram->Max)/1000000.0;
+	if(!Moptop_General_Mutex_Unlock(&(Timing_Data.Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Create a one line summary of all the timing histograms in a set. For each timing type with a non-zero count,
+ * a string of the form "&lt;type&gt;=&lt;count&gt;,&lt;p50&gt;,&lt;p95&gt;,&lt;p99&gt;,&lt;max&gt;" is appended
+ * (space separated), where the times are in milliseconds.
+ * @param set Which set of histograms to summarise.
+ * @param summary_string A string to write the summary into.
+ * @param summary_string_length The length of summary_string. This should be at least
+ *        MOPTOP_TIMING_SUMMARY_STRING_LENGTH.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Timing_Type_Name_List
+ * @see moptop_timing.html#MOPTOP_TIMING_SUMMARY_STRING_LENGTH
+ * @see moptop_timing.html#Moptop_Timing_Statistics_Get
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Timing_Summary_Get(enum MOPTOP_TIMING_SET set,char *summary_string,int summary_string_length)
+{
+	struct Moptop_Timing_Statistics_Struct statistics;
+	char buff[128];
+	int type;
+
+	if((summary_string == NULL)||(summary_string_length < 1))
+	{
+		Moptop_General_Error_Number = 906;
+		sprintf(Moptop_General_Error_String,
+			"Moptop_Timing_Summary_Get: summary_string was NULL or too short (%d).",summary_string_length);
+		return FALSE;
+	}
+	strcpy(summary_string,"");
+	for(type = 0; type < MOPTOP_TIMING_TYPE_COUNT; type++)
+	{
+		if(!Moptop_Timing_Statistics_Get(set,type,&statistics))
+			return FALSE;
+		if(statistics.Count == 0)
+			continue;
+		sprintf(buff,"%s%s=%d,%.3f,%.3f,%.3f,%.3f",(strlen(summary_string) > 0) ? " " : "",
+			Timing_Type_Name_List[type],statistics.Count,statistics.P50*1000.0,statistics.P95*1000.0,
+			statistics.P99*1000.0,statistics.Max*1000.0);
+		if((strlen(summary_string)+strlen(buff)+1) > (size_t)summary_string_length)
+		{
+			Moptop_General_Error_Number = 907;
+			sprintf(Moptop_General_Error_String,"Moptop_Timing_Summary_Get: summary_string too short (%d).",
+				summary_string_length);
+			return FALSE;
+		}
+		strcat(summary_string,buff);
+	}
+	return TRUE;
+}
+
+/**
+ * Write a summary of all the timing histograms in a set to a file, if configured to do so.
+ * <ul>
+ * <li>We retrieve the "moptop.timing.summary.enable" config value. If it is FALSE we return TRUE.
+ * <li>We retrieve the "moptop.timing.summary.directory" config value.
+ * <li>We construct the summary filename from the directory, and the leaf of fits_filename with
+ *     "_timing.txt" replacing it's extension.
+ * <li>We write a line per timing type, containing the count, mean, p50, p95, p99 and max durations in milliseconds.
+ * </ul>
+ * @param set Which set of histograms to summarise.
+ * @param fits_filename The filename of a FITS image from the acquisition (normally the first), used to
+ *        name the summary file.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #TIMING_FILENAME_LENGTH
+ * @see #Timing_Set_Name_List
+ * @see #Timing_Type_Name_List
+ * @see moptop_timing.html#Moptop_Timing_Statistics_Get
+ * @see moptop_config.html#Moptop_Config_Get_Boolean
+ * @see moptop_config.html#Moptop_Config_Get_String
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Timing_Summary_Write(enum MOPTOP_TIMING_SET set,char *fits_filename)
+{
+	struct Moptop_Timing_Statistics_Struct statistics;
+	FILE *fp = NULL;
+	char filename[TIMING_FILENAME_LENGTH];
+	char *directory = NULL;
+	char *leaf_ptr = NULL;
+	char *ch_ptr = NULL;
+	int enable,type,leaf_length;
+
+	if(!MOPTOP_TIMING_IS_SET(set))
+	{
+		Moptop_General_Error_Number = 908;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Summary_Write: Illegal set %d.",set);
+		return FALSE;
+	}
+	if(fits_filename == NULL)
+	{
+		Moptop_General_Error_Number = 909;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Summary_Write: fits_filename was NULL.");
+		return FALSE;
+	}
+	if(!Moptop_Config_Get_Boolean("moptop.timing.summary.enable",&enable))
+		return FALSE;
+	if(enable == FALSE)
+		return TRUE;
+	if(!Moptop_Config_Get_String("moptop.timing.summary.directory",&directory))
+		return FALSE;
+	/* find the leaf of the FITS filename, without it's extension */
+	leaf_ptr = strrchr(fits_filename,'/');
+	if(leaf_ptr != NULL)
+		leaf_ptr++;
+	else
+		leaf_ptr = fits_filename;
+	ch_ptr = strrchr(leaf_ptr,'.');
+	if(ch_ptr != NULL)
+		leaf_length = ch_ptr-leaf_ptr;
+	else
+		leaf_length = strlen(leaf_ptr);
+	if((strlen(directory)+leaf_length+13) > TIMING_FILENAME_LENGTH)
+	{
+		Moptop_General_Error_Number = 910;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Summary_Write: Summary filename too long (%s,%s).",
+			directory,leaf_ptr);
+		free(directory);
+		return FALSE;
+	}
+	sprintf(filename,"%s/%.*s_timing.txt",directory,leaf_length,leaf_ptr);
+	free(directory);
+	fp = fopen(filename,"w");
+	if(fp == NULL)
+	{
+		Moptop_General_Error_Number = 911;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Summary_Write: Failed to open '%s' (%d).",
+			filename,errno);
+		return FALSE;
+	}
+	fprintf(fp,"# %s timing summary for %s\n",Timing_Set_Name_List[set],fits_filename);
+	fprintf(fp,"# %-16s %8s %10s %10s %10s %10s %10s\n","type","count","mean(ms)","p50(ms)","p95(ms)",
+		"p99(ms)","max(ms)");
+	for(type = 0; type < MOPTOP_TIMING_TYPE_COUNT; type++)
+	{
+		if(!Moptop_Timing_Statistics_Get(set,type,&statistics))
+		{
+			fclose(fp);
+			return FALSE;
+		}
+		fprintf(fp,"%-18s %8d %10.3f %10.3f %10.3f %10.3f %10.3f\n",Timing_Type_Name_List[type],
+			statistics.Count,statistics.Mean*1000.0,statistics.P50*1000.0,statistics.P95*1000.0,
+			statistics.P99*1000.0,statistics.Max*1000.0);
+	}
+	if(fclose(fp) != 0)
+	{
+		Moptop_General_Error_Number = 912;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Summary_Write: Failed to close '%s' (%d).",
+			filename,errno);
+		return FALSE;
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("timing","moptop_timing.c","Moptop_Timing_Summary_Write",LOG_VERBOSITY_INTERMEDIATE,
+				  "TIMING","Timing summary written to '%s'.",filename);
+#endif
+	return TRUE;
+}
+
+/**
+ * Convert a timing set name (as used by the "status timing" command) into a MOPTOP_TIMING_SET.
+ * @param set_string The set name, one of "multrun" or "biasdark".
+ * @param set The address of a MOPTOP_TIMING_SET to fill in.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Timing_Set_Name_List
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Timing_Set_From_String(char *set_string,enum MOPTOP_TIMING_SET *set)
+{
+	int i;
+
+	if((set_string == NULL)||(set == NULL))
+	{
+		Moptop_General_Error_Number = 913;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Set_From_String: NULL argument.");
+		return FALSE;
+	}
+	for(i = 0; i < MOPTOP_TIMING_SET_COUNT; i++)
+	{
+		if(strcmp(set_string,Timing_Set_Name_List[i]) == 0)
+		{
+			(*set) = i;
+			return TRUE;
+		}
+	}
+	Moptop_General_Error_Number = 914;
+	sprintf(Moptop_General_Error_String,"Moptop_Timing_Set_From_String: Unknown set '%s'.",set_string);
+	return FALSE;
+}
+
+/**
+ * Convert a timing type name into a MOPTOP_TIMING_TYPE.
+ * @param type_string The type name, e.g. "grabber_wait".
+ * @param type The address of a MOPTOP_TIMING_TYPE to fill in.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Timing_Type_Name_List
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Timing_Type_From_String(char *type_string,enum MOPTOP_TIMING_TYPE *type)
+{
+	int i;
+
+	if((type_string == NULL)||(type == NULL))
+	{
+		Moptop_General_Error_Number = 915;
+		sprintf(Moptop_General_Error_String,"Moptop_Timing_Type_From_String: NULL argument.");
+		return FALSE;
+	}
+	for(i = 0; i < MOPTOP_TIMING_TYPE_COUNT; i++)
+	{
+		if(strcmp(type_string,Timing_Type_Name_List[i]) == 0)
+		{
+			(*type) = i;
+			return TRUE;
+		}
+	}
+	Moptop_General_Error_Number = 916;
+	sprintf(Moptop_General_Error_String,"Moptop_Timing_Type_From_String: Unknown type '%s'.",type_string);
+	return FALSE;
+}
+
+/**
+ * Return the name of a timing type.
+ * @param type The timing type.
+ * @return A string containing the type name, or "unknown" if type is not a valid MOPTOP_TIMING_TYPE.
+ * @see #Timing_Type_Name_List
+ */
+char *Moptop_Timing_Type_To_String(enum MOPTOP_TIMING_TYPE type)
+{
+	if(!MOPTOP_TIMING_IS_TYPE(type))
+		return "unknown";
+	return Timing_Type_Name_List[type];
+}
+
+/* ----------------------------------------------------------------------------
+** 		internal functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Work out which histogram bucket a duration belongs in. Durations less than TIMING_SUB_BUCKET_COUNT
+ * microseconds have a bucket each, above that each power of two is split into TIMING_SUB_BUCKET_COUNT
+ * linear sub-buckets.
+ * @param duration_us The duration in microseconds.
+ * @return The bucket index, between 0 and MOPTOP_TIMING_BUCKET_COUNT-1.
+ * @see #TIMING_SUB_BUCKET_COUNT
+ * @see #TIMING_SUB_BUCKET_BITS
+ * @see moptop_timing.html#MOPTOP_TIMING_BUCKET_COUNT
+ */
+static int Timing_Bucket_Index(long long int duration_us)
+{
+	int exponent,index;
+
+	if(duration_us < TIMING_SUB_BUCKET_COUNT)
+		return (int)duration_us;
+	/* find the most significant bit set */
+	exponent = TIMING_SUB_BUCKET_BITS;
+	while((duration_us >> (exponent+1)) > 0)
+		exponent++;
+	index = ((exponent-TIMING_SUB_BUCKET_BITS+1)*TIMING_SUB_BUCKET_COUNT)+
+		(int)((duration_us >> (exponent-TIMING_SUB_BUCKET_BITS))&(TIMING_SUB_BUCKET_COUNT-1));
+	if(index >= MOPTOP_TIMING_BUCKET_COUNT)
+		index = MOPTOP_TIMING_BUCKET_COUNT-1;
+	return index;
+}
+
+/**
+ * Return the (exclusive) upper limit of a histogram bucket, in microseconds. This is the inverse of
+ * Timing_Bucket_Index.
+ * @param index The bucket index.
+ * @return The upper limit of durations put in the bucket, in microseconds.
+ * @see #Timing_Bucket_Index
+ * @see #TIMING_SUB_BUCKET_COUNT
+ * @see #TIMING_SUB_BUCKET_BITS
+ */
+static long long int Timing_Bucket_Upper_Limit(int index)
+{
+	int exponent,sub_bucket;
+
+	if(index < TIMING_SUB_BUCKET_COUNT)
+		return (long long int)(index+1);
+	exponent = (index/TIMING_SUB_BUCKET_COUNT)+TIMING_SUB_BUCKET_BITS-1;
+	sub_bucket = index%TIMING_SUB_BUCKET_COUNT;
+	return ((long long int)(TIMING_SUB_BUCKET_COUNT+sub_bucket+1)) << (exponent-TIMING_SUB_BUCKET_BITS);
+}
+
+/**
+ * Compute a percentile from a histogram. The caller should hold Timing_Data.Mutex.
+ * @param histogram The histogram.
+ * @param percentile The percentile to compute (0..100).
+ * @return The upper limit of the bucket containing the percentile (limited to the maximum duration recorded),
+ *         in seconds. 0.0 is returned if the histogram is empty.
+ * @see #Timing_Histogram_Struct
+ * @see #Timing_Bucket_Upper_Limit
+ */
+static double Timing_Percentile(struct Timing_Histogram_Struct *histogram,double percentile)
+{
+	long long int value_us;
+	int index,rank,cumulative_count;
+
+	if(histogram->Count == 0)
+		return 0.0;
+	rank = (int)(((percentile/100.0)*((double)histogram->Count))+0.999999);
+	if(rank < 1)
+		rank = 1;
+	cumulative_count = 0;
+	for(index = 0; index < MOPTOP_TIMING_BUCKET_COUNT; index++)
+	{
+		cumulative_count += histogram->Bucket_List[index];
+		if(cumulative_count >= rank)
+			break;
+	}
+	value_us = Timing_Bucket_Upper_Limit(MIN(index,MOPTOP_TIMING_BUCKET_COUNT-1));
+	if(value_us > histogram->Max)
+		value_us = histogram->Max;
+	return ((double)value_us)/1000000.0;
+}
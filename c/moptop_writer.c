@@ -0,0 +1,1965 @@
+/* moptop_writer.c
+** Moptop frame writer routines
+*/
+/**
+ * Routines to save read out frames to disk in a pool of threads separate from the one acquiring them.
+ * The acquisition thread gets a free frame (Moptop_Writer_Frame_Get), which acquires the next free CCD library
+ * image buffer for it, reads an image into the buffer, fills in the per-frame data
+ * and queues it (Moptop_Writer_Frame_Queue). The writer threads take frames off the queue in order,
+ * call the configured write function to save them to disk (concurrently, each to a different file),
+ * release the image buffer and return the frame to the free list. The image data is therefore never copied
+ * between being read out and written.
+ * The number of writer threads (moptop.multrun.writer.thread.count) and the number of frames that can be
+ * queued or being written at once (moptop.multrun.writer.queue.length) are configurable.
+ * Disk latency therefore only delays acquisition if all the queued frames are waiting to be written.
+ * Statistics on how often (and for how long) this happens are kept, and logged when the writer is stopped.
+ * If the write function tile compresses frames, it reports the compression achieved and the CPU time used
+ * (Moptop_Writer_Compression_Add), and these are also kept with the statistics.
+ * The write function publishes each written file through Moptop_Writer_Publish, which applies the configured
+ * durability policy (moptop.multrun.writer.durability): files are either published straight away, flushed to
+ * disk one at a time before being published, or held back until all the files in their rotation (or the whole
+ * acquisition) have been written, when the file system is synced once and they are all published together.
+ * Once a group of files has been published, the directory they are in is also synced, so the published filenames
+ * (renamed files or removed lock files) survive a crash as well as the files' data.
+ * The cost of the syncs is kept with the statistics and added to the FILE_SYNC timing histogram.
+ * An acquisition that has to update it's files after they have all been written (for instance with the recorded
+ * rotator positions) can hold publishing (Moptop_Writer_Publish_Hold) until it calls Moptop_Writer_Publish_Release.
+ * Optionally (moptop.multrun.writer.staging.enable), the write function can hand a formatted FITS image to
+ * Moptop_Writer_Stage instead of writing it itself. The image is copied into a RAM staging arena (an anonymous
+ * mapping of moptop.multrun.writer.staging.size megabytes, locked into memory if the process is allowed to), and
+ * a separate staging flush thread writes the staged images to disk in order, and only then publishes them.
+ * Slow writes (a busy disk or network mount) then delay the flush thread rather than the writer threads.
+ * If the arena is full, the writer threads wait for the flush thread to free some space, so no frames are lost.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 199309L
+/**
+ * This hash define is needed before including unistd.h to give us the syncfs prototype.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fitsio.h"
+
+#include "log_udp.h"
+
+#include "ccd_buffer.h"
+#include "ccd_fits_filename.h"
+#include "ccd_fits_image.h"
+
+#include "moptop_config.h"
+#include "moptop_general.h"
+#include "moptop_timing.h"
+#include "moptop_writer.h"
+
+/* hash defines */
+/**
+ * The number of entries Writer_Data.Publish_List is first allocated with. It's capacity is doubled whenever
+ * it fills up after that.
+ * @see #Writer_Data
+ */
+#define WRITER_PUBLISH_LIST_ALLOCATE_MIN  (64)
+
+/* data types */
+/**
+ * Data type holding a written file waiting to be published, when the durability policy publishes files in groups.
+ * <dl>
+ * <dt>Filename</dt> <dd>The filename the data was written to (as returned by CCD_Fits_Filename_Publish_Begin),
+ *                       or an empty string for a dropped frame, which has nothing to publish but still counts
+ *                       towards completing it's group.</dd>
+ * <dt>Group_Number</dt> <dd>The group (rotation number) the file belongs to.</dd>
+ * <dt>Frame_Count</dt> <dd>The number of frames the file holds (1, or the number of planes in a FITS cube).</dd>
+ * </dl>
+ * @see moptop_writer.html#MOPTOP_WRITER_FILENAME_LENGTH
+ */
+struct Writer_Publish_Struct
+{
+	char Filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int Group_Number;
+	int Frame_Count;
+};
+
+/**
+ * Enum of how Writer_Sync flushes data to disk:
+ * <ul>
+ * <li>WRITER_SYNC_TYPE_FILE - The file's data is flushed (fdatasync).
+ * <li>WRITER_SYNC_TYPE_FILE_SYSTEM - The whole file system the file is on is flushed (syncfs).
+ * <li>WRITER_SYNC_TYPE_DIRECTORY - The directory the file is in is flushed (fsync), so it's directory entry
+ *     (a rename, or a removed lock file) is durable.
+ * </ul>
+ * @see #Writer_Sync
+ */
+enum WRITER_SYNC_TYPE
+{
+	WRITER_SYNC_TYPE_FILE=0,WRITER_SYNC_TYPE_FILE_SYSTEM=1,WRITER_SYNC_TYPE_DIRECTORY=2
+};
+
+/**
+ * Data type holding a FITS image staged in the staging arena, waiting to be flushed to disk. The staged images
+ * are kept in a singly linked list in the order their space was reserved, which is also the order they are laid
+ * out in the (circular) staging arena, so space is freed in the order it was allocated.
+ * <dl>
+ * <dt>Filename</dt> <dd>The FITS filename to flush the image to, or an empty string if the image failed to be 
+ *                       staged, in which case it's space is just freed.</dd>
+ * <dt>Group_Number</dt> <dd>The group (rotation number) the image belongs to, passed to Moptop_Writer_Publish.</dd>
+ * <dt>Offset</dt> <dd>The offset of the formatted FITS image in the staging arena.</dd>
+ * <dt>Length</dt> <dd>The length of the formatted FITS image, in bytes.</dd>
+ * <dt>Reserved_Length</dt> <dd>The number of bytes of the arena reserved for the image. This is Length, plus the
+ *                              unused space at the end of the arena if the image had to wrap around to the 
+ *                              start of it.</dd>
+ * <dt>Is_Ready</dt> <dd>A boolean, TRUE once the image has been copied into the arena.</dd>
+ * <dt>Next</dt> <dd>The next staged image in the list.</dd>
+ * </dl>
+ * @see moptop_writer.html#MOPTOP_WRITER_FILENAME_LENGTH
+ */
+struct Writer_Stage_Struct
+{
+	char Filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int Group_Number;
+	size_t Offset;
+	size_t Length;
+	size_t Reserved_Length;
+	int Is_Ready;
+	struct Writer_Stage_Struct *Next;
+};
+
+/**
+ * Data type holding local data to the moptop writer.
+ * <dl>
+ * <dt>Mutex</dt> <dd>A mutex protecting access to the free list, queue, statistics and status data
+ *                    in this structure.</dd>
+ * <dt>Free_Condition</dt> <dd>A condition variable signalled when a frame is returned to the free list,
+ *                             or a writer thread fails.</dd>
+ * <dt>Queue_Condition</dt> <dd>A condition variable signalled when a frame is added to the queue,
+ *                              or the writer threads are asked to stop.</dd>
+ * <dt>Stage_Space_Condition</dt> <dd>A condition variable signalled when the staging flush thread frees space in
+ *                                    the staging arena.</dd>
+ * <dt>Stage_Ready_Condition</dt> <dd>A condition variable signalled when an image has been copied into the staging
+ *                                    arena, or the staging flush thread is asked to stop.</dd>
+ * <dt>Thread_List</dt> <dd>The writer threads' Ids.</dd>
+ * <dt>Thread_Count</dt> <dd>The number of writer threads that have been started and not yet joined.</dd>
+ * <dt>Write_Function</dt> <dd>The function the writer threads call to save each frame.</dd>
+ * <dt>Frame_List</dt> <dd>The list of frames. There are no more frames than CCD library image buffers, so a free frame
+ *                         can always acquire an image buffer.</dd>
+ * <dt>Frame_Count</dt> <dd>The number of frames in Frame_List being used (the configured queue length).</dd>
+ * <dt>Free_List</dt> <dd>A stack of indexes into Frame_List of frames available to be filled.</dd>
+ * <dt>Free_Count</dt> <dd>The number of frame indexes in Free_List.</dd>
+ * <dt>Queue_List</dt> <dd>A circular buffer of indexes into Frame_List of frames waiting to be written.</dd>
+ * <dt>Queue_Head</dt> <dd>The index in Queue_List of the next frame to write.</dd>
+ * <dt>Queue_Count</dt> <dd>The number of frame indexes in Queue_List.</dd>
+ * <dt>Stop</dt> <dd>A boolean, if TRUE the writer threads exit once the queue is empty.</dd>
+ * <dt>Failed</dt> <dd>A boolean, TRUE if a frame failed to be written.</dd>
+ * <dt>Error_Number</dt> <dd>A copy of Moptop_General_Error_Number, taken when the first frame failed
+ *                           to be written.</dd>
+ * <dt>Error_String</dt> <dd>A copy of Moptop_General_Error_String, taken when the first frame failed
+ *                           to be written.</dd>
+ * <dt>Statistics</dt> <dd>Statistics on how well the writer threads are keeping up with acquisition.</dd>
+ * <dt>Durability</dt> <dd>The durability policy in use, retrieved from the config by Moptop_Writer_Start.</dd>
+ * <dt>Timing_Set</dt> <dd>Which set of timing histograms the sync and publish times are added to.</dd>
+ * <dt>Group_Size</dt> <dd>The number of frames in a rotation, used by the ROTATION durability policy to decide
+ *                         when a group of files is complete. Zero means there are no rotations, and all the
+ *                         files are published when the writer is stopped.</dd>
+ * <dt>Publish_Deferred</dt> <dd>A boolean, TRUE between Moptop_Writer_Start and Moptop_Writer_Stop if the
+ *                               durability policy publishes files in groups.</dd>
+ * <dt>Publish_Hold</dt> <dd>A boolean, TRUE between Moptop_Writer_Publish_Hold and Moptop_Writer_Publish_Release.
+ *                           All written files are then kept in Publish_List, even after Moptop_Writer_Stop.</dd>
+ * <dt>Publish_List</dt> <dd>A reallocatable list of written files waiting for their group to be complete.</dd>
+ * <dt>Publish_Count</dt> <dd>The number of files in Publish_List.</dd>
+ * <dt>Publish_Allocated</dt> <dd>The number of entries allocated for Publish_List. This is grown geometrically,
+ *                                so adding a file does not copy the whole list each time.</dd>
+ * <dt>Group_Frame_Count_List</dt> <dd>A reallocatable list, indexed by group number, of the number of frames
+ *                                     in the files added to Publish_List for each group, used by the ROTATION 
+ *                                     durability policy to decide when a group is complete without rescanning 
+ *                                     Publish_List.</dd>
+ * <dt>Group_Frame_Count_Allocated</dt> <dd>The number of entries allocated for Group_Frame_Count_List.</dd>
+ * <dt>Stage_Enable</dt> <dd>A boolean, TRUE between Moptop_Writer_Start and Moptop_Writer_Stop if written frames
+ *                           are staged in memory (moptop.multrun.writer.staging.enable).</dd>
+ * <dt>Stage_Arena</dt> <dd>The staging arena, an anonymous memory mapping. This is kept between acquisitions, 
+ *                          and only remapped if the configured size changes.</dd>
+ * <dt>Stage_Arena_Size</dt> <dd>The size of Stage_Arena in bytes.</dd>
+ * <dt>Stage_Arena_Locked</dt> <dd>A boolean, TRUE if Stage_Arena was successfully locked into memory.</dd>
+ * <dt>Stage_Head</dt> <dd>The offset in Stage_Arena of the oldest staged image.</dd>
+ * <dt>Stage_Tail</dt> <dd>The offset in Stage_Arena just after the newest staged image.</dd>
+ * <dt>Stage_First</dt> <dd>The first (oldest) image in the list of staged images.</dd>
+ * <dt>Stage_Last</dt> <dd>The last (newest) image in the list of staged images.</dd>
+ * <dt>Stage_Thread</dt> <dd>The staging flush thread's Id.</dd>
+ * <dt>Stage_Thread_Running</dt> <dd>A boolean, TRUE if the staging flush thread has been started and not yet 
+ *                                   joined.</dd>
+ * <dt>Stage_Stop</dt> <dd>A boolean, if TRUE the staging flush thread exits once all the staged images have been
+ *                         flushed.</dd>
+ * </dl>
+ * @see #Writer_Publish_Struct
+ * @see #Writer_Stage_Struct
+ * @see ../ccd/cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ * @see moptop_general.html#MOPTOP_GENERAL_ERROR_STRING_LENGTH
+ * @see moptop_writer.html#MOPTOP_WRITER_THREAD_COUNT_MAX
+ * @see moptop_writer.html#Moptop_Writer_Statistics_Struct
+ * @see moptop_writer.html#MOPTOP_WRITER_DURABILITY
+ * @see moptop_timing.html#MOPTOP_TIMING_SET
+ */
+struct Writer_Struct
+{
+	pthread_mutex_t Mutex;
+	pthread_cond_t Free_Condition;
+	pthread_cond_t Queue_Condition;
+	pthread_cond_t Stage_Space_Condition;
+	pthread_cond_t Stage_Ready_Condition;
+	pthread_t Thread_List[MOPTOP_WRITER_THREAD_COUNT_MAX];
+	int Thread_Count;
+	Moptop_Writer_Write_Function_T Write_Function;
+	struct Moptop_Writer_Frame_Struct Frame_List[CCD_BUFFER_COUNT];
+	int Frame_Count;
+	int Free_List[CCD_BUFFER_COUNT];
+	int Free_Count;
+	int Queue_List[CCD_BUFFER_COUNT];
+	int Queue_Head;
+	int Queue_Count;
+	int Stop;
+	int Failed;
+	int Error_Number;
+	char Error_String[MOPTOP_GENERAL_ERROR_STRING_LENGTH];
+	struct Moptop_Writer_Statistics_Struct Statistics;
+	enum MOPTOP_WRITER_DURABILITY Durability;
+	enum MOPTOP_TIMING_SET Timing_Set;
+	int Group_Size;
+	int Publish_Deferred;
+	int Publish_Hold;
+	struct Writer_Publish_Struct *Publish_List;
+	int Publish_Count;
+	int Publish_Allocated;
+	int *Group_Frame_Count_List;
+	int Group_Frame_Count_Allocated;
+	int Stage_Enable;
+	unsigned char *Stage_Arena;
+	size_t Stage_Arena_Size;
+	int Stage_Arena_Locked;
+	size_t Stage_Head;
+	size_t Stage_Tail;
+	struct Writer_Stage_Struct *Stage_First;
+	struct Writer_Stage_Struct *Stage_Last;
+	pthread_t Stage_Thread;
+	int Stage_Thread_Running;
+	int Stage_Stop;
+};
+
+/* internal data */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * Writer Data holding local data to the moptop writer.
+ * <dl>
+ * <dt>Mutex</dt>           <dd>PTHREAD_MUTEX_INITIALIZER</dd>
+ * <dt>Free_Condition</dt>  <dd>PTHREAD_COND_INITIALIZER</dd>
+ * <dt>Queue_Condition</dt> <dd>PTHREAD_COND_INITIALIZER</dd>
+ * <dt>Stage_Space_Condition</dt> <dd>PTHREAD_COND_INITIALIZER</dd>
+ * <dt>Stage_Ready_Condition</dt> <dd>PTHREAD_COND_INITIALIZER</dd>
+ * <dt>Thread_List</dt>     <dd>All zero</dd>
+ * <dt>Thread_Count</dt>    <dd>0</dd>
+ * <dt>Write_Function</dt>  <dd>NULL</dd>
+ * <dt>Frame_List</dt>      <dd>All zero</dd>
+ * <dt>Frame_Count</dt>     <dd>0</dd>
+ * <dt>Free_List</dt>       <dd>All zero</dd>
+ * <dt>Free_Count</dt>      <dd>0</dd>
+ * <dt>Queue_List</dt>      <dd>All zero</dd>
+ * <dt>Queue_Head</dt>      <dd>0</dd>
+ * <dt>Queue_Count</dt>     <dd>0</dd>
+ * <dt>Stop</dt>            <dd>FALSE</dd>
+ * <dt>Failed</dt>          <dd>FALSE</dd>
+ * <dt>Error_Number</dt>    <dd>0</dd>
+ * <dt>Error_String</dt>    <dd>""</dd>
+ * <dt>Statistics</dt>      <dd>All zero</dd>
+ * <dt>Durability</dt>      <dd>MOPTOP_WRITER_DURABILITY_NONE</dd>
+ * <dt>Timing_Set</dt>      <dd>MOPTOP_TIMING_SET_MULTRUN</dd>
+ * <dt>Group_Size</dt>      <dd>0</dd>
+ * <dt>Publish_Deferred</dt> <dd>FALSE</dd>
+ * <dt>Publish_Hold</dt>    <dd>FALSE</dd>
+ * <dt>Publish_List</dt>    <dd>NULL</dd>
+ * <dt>Publish_Count</dt>   <dd>0</dd>
+ * <dt>Publish_Allocated</dt> <dd>0</dd>
+ * <dt>Group_Frame_Count_List</dt> <dd>NULL</dd>
+ * <dt>Group_Frame_Count_Allocated</dt> <dd>0</dd>
+ * <dt>Stage_Enable</dt>    <dd>FALSE</dd>
+ * <dt>Stage_Arena</dt>     <dd>NULL</dd>
+ * <dt>Stage_Arena_Size</dt> <dd>0</dd>
+ * <dt>Stage_Arena_Locked</dt> <dd>FALSE</dd>
+ * <dt>Stage_Head</dt>      <dd>0</dd>
+ * <dt>Stage_Tail</dt>      <dd>0</dd>
+ * <dt>Stage_First</dt>     <dd>NULL</dd>
+ * <dt>Stage_Last</dt>      <dd>NULL</dd>
+ * <dt>Stage_Thread</dt>    <dd>0</dd>
+ * <dt>Stage_Thread_Running</dt> <dd>FALSE</dd>
+ * <dt>Stage_Stop</dt>      <dd>FALSE</dd>
+ * </dl>
+ * @see #Writer_Struct
+ */
+static struct Writer_Struct Writer_Data =
+{
+	PTHREAD_MUTEX_INITIALIZER,PTHREAD_COND_INITIALIZER,PTHREAD_COND_INITIALIZER,PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,{0},0,NULL,{{0}},0,{0},0,{0},0,0,FALSE,FALSE,0,"",{0},
+	MOPTOP_WRITER_DURABILITY_NONE,MOPTOP_TIMING_SET_MULTRUN,0,FALSE,FALSE,NULL,0,0,NULL,0,
+	FALSE,NULL,0,FALSE,0,0,NULL,NULL,0,FALSE,FALSE
+};
+/**
+ * The names of each durability policy, indexed by MOPTOP_WRITER_DURABILITY. These are the values of the
+ * "moptop.multrun.writer.durability" config keyword.
+ * @see moptop_writer.html#MOPTOP_WRITER_DURABILITY
+ */
+static char *Writer_Durability_Name_List[] =
+{
+	"none","frame","rotation","multrun"
+};
+
+/* internal functions */
+static void *Writer_Thread(void *user_arg);
+static int Writer_Threads_Join(void);
+static int Writer_Publish_List_Add(struct Writer_Publish_Struct *publish);
+static int Writer_Publish_Group(struct Writer_Publish_Struct *publish_list,int publish_count,int report_error);
+static int Writer_Sync(char *filename,enum WRITER_SYNC_TYPE sync_type,int file_count,int report_error);
+static int Writer_Stage_Arena_Allocate(size_t size);
+static int Writer_Stage_Space_Get(size_t length,size_t *offset,size_t *reserved_length);
+static void *Writer_Stage_Thread(void *user_arg);
+static int Writer_Stage_Thread_Join(void);
+static int Writer_Stage_Flush(struct Writer_Stage_Struct *stage);
+
+/* ----------------------------------------------------------------------------
+** 		external functions
+** ---------------------------------------------------------------------------- */
+/**
+ * Start the writer threads.
+ * <ul>
+ * <li>We check write_function is not NULL, and the writer threads are not already running.
+ * <li>We retrieve the number of writer threads to start from the "moptop.multrun.writer.thread.count"
+ *     config value, and check it is between 1 and MOPTOP_WRITER_THREAD_COUNT_MAX. If CFITSIO was not built
+ *     reentrant (fits_is_reentrant), the write functions' CFITSIO paths (compression, or the native FITS writer
+ *     disabled) can't run in several threads at once, so only one writer thread is started.
+ * <li>We retrieve the number of frames that can be queued or being written at once from the
+ *     "moptop.multrun.writer.queue.length" config value, and check it is between 1 and the number of
+ *     CCD library image buffers (CCD_Buffer_Get_Buffer_Count).
+ * <li>We retrieve the durability policy from the "moptop.multrun.writer.durability" config value
+ *     (one of "none", "frame", "rotation" or "multrun").
+ * <li>We retrieve whether to stage written frames in memory from the "moptop.multrun.writer.staging.enable"
+ *     config value. If so, we retrieve the size of the staging arena in megabytes from the 
+ *     "moptop.multrun.writer.staging.size" config value, and (re)allocate the arena using 
+ *     Writer_Stage_Arena_Allocate.
+ * <li>We setup Writer_Data.Frame_List, with no image buffers acquired.
+ * <li>We put all the frames on the free list, empty the queue, reset the Stop and Failed flags and the statistics.
+ * <li>We save the durability policy, timing set and group size, empty the list of files waiting to be published
+ *     (and the per-group frame counts), and clear any publish hold.
+ * <li>If staging is enabled, we empty the staging arena and create the staging flush thread, with 
+ *     Writer_Stage_Thread as the thread's start routine.
+ * <li>We create the writer threads using pthread_create, with Writer_Thread as the thread's start routine.
+ *     If one of them can't be created, we stop and join the ones that were, and the staging flush thread.
+ * </ul>
+ * @param write_function The function the writer threads should call to save each frame to disk.
+ * @param timing_set Which set of timing histograms to add the file sync and publish times to.
+ * @param group_size The number of frames in each rotation, used by the ROTATION durability policy to
+ *        decide when all of a rotation's files have been written. Acquisitions without rotations (bias / dark)
+ *        should pass 0, in which case the ROTATION policy publishes all the files when the writer is stopped.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #Writer_Durability_Name_List
+ * @see #Writer_Thread
+ * @see #Writer_Threads_Join
+ * @see #Writer_Stage_Arena_Allocate
+ * @see #Writer_Stage_Thread
+ * @see #Writer_Stage_Thread_Join
+ * @see moptop_config.html#Moptop_Config_Get_Boolean
+ * @see moptop_config.html#Moptop_Config_Get_Integer
+ * @see moptop_config.html#Moptop_Config_Get_String
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_writer.html#MOPTOP_WRITER_THREAD_COUNT_MAX
+ * @see ../ccd/cdocs/ccd_buffer.html#CCD_Buffer_Get_Buffer_Count
+ */
+int Moptop_Writer_Start(Moptop_Writer_Write_Function_T write_function,enum MOPTOP_TIMING_SET timing_set,
+			int group_size)
+{
+	enum MOPTOP_WRITER_DURABILITY durability;
+	char *durability_string = NULL;
+	int i,retval,thread_count,queue_length,buffer_count,stage_enable,stage_size;
+
+	if(write_function == NULL)
+	{
+		Moptop_General_Error_Number = 800;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Start: write_function was NULL.");
+		return FALSE;
+	}
+	if(Writer_Data.Thread_Count > 0)
+	{
+		Moptop_General_Error_Number = 801;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Start: Writer threads already running.");
+		return FALSE;
+	}
+	/* get and check config */
+	if(!Moptop_Config_Get_Integer("moptop.multrun.writer.thread.count",&thread_count))
+		return FALSE;
+	if((thread_count < 1)||(thread_count > MOPTOP_WRITER_THREAD_COUNT_MAX))
+	{
+		Moptop_General_Error_Number = 809;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Start: Illegal writer thread count %d (1..%d).",
+			thread_count,MOPTOP_WRITER_THREAD_COUNT_MAX);
+		return FALSE;
+	}
+	if((thread_count > 1)&&(fits_is_reentrant() == 0))
+	{
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Start",LOG_VERBOSITY_TERSE,
+					  "WRITER","CFITSIO is not reentrant: using 1 writer thread rather than %d.",
+					  thread_count);
+#endif
+		thread_count = 1;
+	}
+	if(!Moptop_Config_Get_Integer("moptop.multrun.writer.queue.length",&queue_length))
+		return FALSE;
+	buffer_count = MIN(CCD_Buffer_Get_Buffer_Count(),CCD_BUFFER_COUNT);
+	if((queue_length < 1)||(queue_length > buffer_count))
+	{
+		Moptop_General_Error_Number = 810;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Start: Illegal writer queue length %d (1..%d).",
+			queue_length,buffer_count);
+		return FALSE;
+	}
+	if(!Moptop_Config_Get_String("moptop.multrun.writer.durability",&durability_string))
+		return FALSE;
+	for(i=0; i <= MOPTOP_WRITER_DURABILITY_MULTRUN; i++)
+	{
+		if(strcmp(durability_string,Writer_Durability_Name_List[i]) == 0)
+			break;
+	}
+	if(i > MOPTOP_WRITER_DURABILITY_MULTRUN)
+	{
+		Moptop_General_Error_Number = 815;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Start: Illegal writer durability '%s'.",
+			durability_string);
+		free(durability_string);
+		return FALSE;
+	}
+	durability = i;
+	free(durability_string);
+	if(!Moptop_Config_Get_Boolean("moptop.multrun.writer.staging.enable",&stage_enable))
+		return FALSE;
+	if(stage_enable)
+	{
+		if(!Moptop_Config_Get_Integer("moptop.multrun.writer.staging.size",&stage_size))
+			return FALSE;
+		if(stage_size < 1)
+		{
+			Moptop_General_Error_Number = 823;
+			sprintf(Moptop_General_Error_String,"Moptop_Writer_Start: Illegal staging size %d MB.",
+				stage_size);
+			return FALSE;
+		}
+		if(!Writer_Stage_Arena_Allocate(((size_t)stage_size)*1024*1024))
+			return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+		return FALSE;
+	Writer_Data.Write_Function = write_function;
+	Writer_Data.Frame_Count = queue_length;
+	Writer_Data.Free_Count = 0;
+	for(i=0; i < Writer_Data.Frame_Count; i++)
+	{
+		Writer_Data.Frame_List[i].Frame_Index = i;
+		Writer_Data.Frame_List[i].Buffer_Index = -1;
+		Writer_Data.Frame_List[i].Image_Buffer = NULL;
+		Writer_Data.Free_List[Writer_Data.Free_Count++] = i;
+	}
+	Writer_Data.Queue_Head = 0;
+	Writer_Data.Queue_Count = 0;
+	Writer_Data.Stop = FALSE;
+	Writer_Data.Failed = FALSE;
+	Writer_Data.Error_Number = 0;
+	strcpy(Writer_Data.Error_String,"");
+	memset(&(Writer_Data.Statistics),0,sizeof(struct Moptop_Writer_Statistics_Struct));
+	Writer_Data.Statistics.Thread_Count = thread_count;
+	Writer_Data.Statistics.Queue_Length = queue_length;
+	Writer_Data.Statistics.Durability = durability;
+	Writer_Data.Durability = durability;
+	Writer_Data.Timing_Set = timing_set;
+	Writer_Data.Group_Size = group_size;
+	Writer_Data.Publish_Deferred = ((durability == MOPTOP_WRITER_DURABILITY_ROTATION)||
+					(durability == MOPTOP_WRITER_DURABILITY_MULTRUN));
+	Writer_Data.Publish_Hold = FALSE;
+	if(Writer_Data.Publish_List != NULL)
+		free(Writer_Data.Publish_List);
+	Writer_Data.Publish_List = NULL;
+	Writer_Data.Publish_Count = 0;
+	Writer_Data.Publish_Allocated = 0;
+	if(Writer_Data.Group_Frame_Count_List != NULL)
+		memset(Writer_Data.Group_Frame_Count_List,0,Writer_Data.Group_Frame_Count_Allocated*sizeof(int));
+	Writer_Data.Stage_Enable = stage_enable;
+	Writer_Data.Stage_Head = 0;
+	Writer_Data.Stage_Tail = 0;
+	Writer_Data.Stage_Stop = FALSE;
+	Writer_Data.Statistics.Stage_Enable = stage_enable;
+	if(stage_enable)
+	{
+		Writer_Data.Statistics.Stage_Size = Writer_Data.Stage_Arena_Size;
+		Writer_Data.Statistics.Stage_Arena_Locked = Writer_Data.Stage_Arena_Locked;
+	}
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+		return FALSE;
+	if(stage_enable)
+	{
+		retval = pthread_create(&(Writer_Data.Stage_Thread),NULL,Writer_Stage_Thread,NULL);
+		if(retval != 0)
+		{
+			Writer_Data.Stage_Enable = FALSE;
+			Moptop_General_Error_Number = 824;
+			sprintf(Moptop_General_Error_String,"Moptop_Writer_Start: Failed to create staging flush thread (%d).",
+				retval);
+			return FALSE;
+		}
+		Writer_Data.Stage_Thread_Running = TRUE;
+	}
+	for(i=0; i < thread_count; i++)
+	{
+		retval = pthread_create(&(Writer_Data.Thread_List[i]),NULL,Writer_Thread,NULL);
+		if(retval != 0)
+		{
+			Writer_Threads_Join();
+			Writer_Stage_Thread_Join();
+			Moptop_General_Error_Number = 803;
+			sprintf(Moptop_General_Error_String,"Moptop_Writer_Start: Failed to create writer thread %d (%d).",
+				i,retval);
+			return FALSE;
+		}
+		Writer_Data.Thread_Count++;
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Start",LOG_VERBOSITY_INTERMEDIATE,
+				  "WRITER","%d writer threads started with a queue length of %d frames (durability %s).",
+				  Writer_Data.Thread_Count,Writer_Data.Frame_Count,
+				  Moptop_Writer_Durability_To_String(Writer_Data.Durability));
+	if(Writer_Data.Stage_Enable)
+	{
+		Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Start",LOG_VERBOSITY_INTERMEDIATE,
+					  "WRITER","Staging frames in a %lu byte arena (locked = %d).",
+					  (unsigned long)Writer_Data.Stage_Arena_Size,Writer_Data.Stage_Arena_Locked);
+	}
+#endif
+	return TRUE;
+}
+
+/**
+ * Get a free frame to read an image into. If all the frames are queued or being written, this routine blocks
+ * until a writer thread returns one to the free list. The number of times this happens, and how long
+ * we wait for, is recorded in Writer_Data.Statistics. The frame's per-frame data is reset, and the next free
+ * CCD library image buffer is acquired for it using CCD_Buffer_Acquire.
+ * @param frame The address of a pointer to a frame, on a successful return this is set to point to a free frame.
+ *        The frame's Buffer_Index and Image_Buffer are setup, the other per-frame data is reset.
+ * @return The routine returns TRUE on success and FALSE on failure. The routine fails if a writer thread has
+ *         failed to write a previous frame.
+ * @see #Writer_Data
+ * @see moptop_general.html#fdifftime
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see ../ccd/cdocs/ccd_buffer.html#CCD_Buffer_Acquire
+ */
+int Moptop_Writer_Frame_Get(struct Moptop_Writer_Frame_Struct **frame)
+{
+	struct Moptop_Writer_Frame_Struct *free_frame = NULL;
+	struct timespec blocked_start_time,blocked_end_time;
+	void *image_buffer = NULL;
+	double blocked_time;
+	int frame_index,buffer_index;
+
+	if(frame == NULL)
+	{
+		Moptop_General_Error_Number = 804;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Frame_Get: frame was NULL.");
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+		return FALSE;
+	if((Writer_Data.Free_Count == 0) && (Writer_Data.Failed == FALSE))
+	{
+		/* all frames are queued or being written, wait for one to be freed */
+		clock_gettime(CLOCK_REALTIME,&blocked_start_time);
+		while((Writer_Data.Free_Count == 0) && (Writer_Data.Failed == FALSE))
+			pthread_cond_wait(&(Writer_Data.Free_Condition),&(Writer_Data.Mutex));
+		clock_gettime(CLOCK_REALTIME,&blocked_end_time);
+		blocked_time = fdifftime(blocked_end_time,blocked_start_time);
+		Writer_Data.Statistics.Blocked_Count++;
+		Writer_Data.Statistics.Blocked_Time += blocked_time;
+		if(blocked_time > Writer_Data.Statistics.Blocked_Time_Max)
+			Writer_Data.Statistics.Blocked_Time_Max = blocked_time;
+	}
+	if(Writer_Data.Failed)
+	{
+		Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex));
+		Moptop_General_Error_Number = 805;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Frame_Get: Writer thread failed to write a frame.");
+		return FALSE;
+	}
+	frame_index = Writer_Data.Free_List[Writer_Data.Free_Count-1];
+	/* there are no more frames than image buffers, and buffers are released before their frame is freed,
+	** so this should not fail */
+	if(!CCD_Buffer_Acquire(&buffer_index,&image_buffer))
+	{
+		Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex));
+		Moptop_General_Error_Number = 802;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Frame_Get: Failed to acquire an image buffer.");
+		return FALSE;
+	}
+	Writer_Data.Free_Count--;
+	free_frame = &(Writer_Data.Frame_List[frame_index]);
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+		return FALSE;
+	/* reset per-frame data */
+	memset(free_frame,0,sizeof(struct Moptop_Writer_Frame_Struct));
+	free_frame->Frame_Index = frame_index;
+	free_frame->Buffer_Index = buffer_index;
+	free_frame->Image_Buffer = (unsigned char *)image_buffer;
+	(*frame) = free_frame;
+	return TRUE;
+}
+
+/**
+ * Return a frame retrieved using Moptop_Writer_Frame_Get to the free list without writing it, releasing it's
+ * image buffer. This is used when the acquisition fails after a frame has been retrieved.
+ * @param frame The frame to return to the free list.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see ../ccd/cdocs/ccd_buffer.html#CCD_Buffer_Release
+ */
+int Moptop_Writer_Frame_Put(struct Moptop_Writer_Frame_Struct *frame)
+{
+	if(frame == NULL)
+	{
+		Moptop_General_Error_Number = 806;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Frame_Put: frame was NULL.");
+		return FALSE;
+	}
+	if(!CCD_Buffer_Release(frame->Buffer_Index))
+	{
+		Moptop_General_Error_Number = 812;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Frame_Put: Failed to release image buffer %d.",
+			frame->Buffer_Index);
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+		return FALSE;
+	Writer_Data.Free_List[Writer_Data.Free_Count++] = frame->Frame_Index;
+	pthread_cond_signal(&(Writer_Data.Free_Condition));
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Add a filled in frame to the end of the queue of frames waiting to be written, and wake up a writer thread.
+ * The number of frames queued or being written is used to update the queue high water mark statistic.
+ * @param frame The frame to queue, previously retrieved using Moptop_Writer_Frame_Get.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see ../ccd/cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ */
+int Moptop_Writer_Frame_Queue(struct Moptop_Writer_Frame_Struct *frame)
+{
+	int queue_depth;
+
+	if(frame == NULL)
+	{
+		Moptop_General_Error_Number = 807;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Frame_Queue: frame was NULL.");
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+		return FALSE;
+	Writer_Data.Queue_List[(Writer_Data.Queue_Head+Writer_Data.Queue_Count)%CCD_BUFFER_COUNT] =
+		frame->Frame_Index;
+	Writer_Data.Queue_Count++;
+	/* frames not on the free list are either queued, being written, or (just) this one */
+	queue_depth = Writer_Data.Frame_Count-Writer_Data.Free_Count;
+	if(queue_depth > Writer_Data.Statistics.Queue_High_Water)
+		Writer_Data.Statistics.Queue_High_Water = queue_depth;
+	pthread_cond_signal(&(Writer_Data.Queue_Condition));
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Stop the writer threads. The writer threads write any frames still in the queue before exiting,
+ * this routine blocks until that has happened.
+ * <ul>
+ * <li>If the writer threads are not running we return TRUE.
+ * <li>We stop the writer threads and wait for them to exit by calling Writer_Threads_Join.
+ * <li>If frames are being staged in memory, we wait for the staging flush thread to write (and pass to 
+ *     Moptop_Writer_Publish) the remaining staged images and exit, by calling Writer_Stage_Thread_Join.
+ * <li>If the durability policy publishes files in groups, we take the files still waiting to be published
+ *     (the last rotation, or the whole acquisition) off Writer_Data.Publish_List, and sync and publish them
+ *     using Writer_Publish_Group. This is done on the failure paths as well, so files that were written before 
+ *     an acquisition failed or was aborted are not left unpublished. If publishing is held 
+ *     (Moptop_Writer_Publish_Hold), the files are left on the list for Moptop_Writer_Publish_Release.
+ * <li>We log the writer statistics.
+ * <li>If a frame failed to be written, we optionally copy the first writer thread error into
+ *     Moptop_General_Error_Number / Moptop_General_Error_String, and return FALSE.
+ * </ul>
+ * @param report_error A boolean, if TRUE and a frame failed to be written, the writer thread's error is copied into
+ *        Moptop_General_Error_Number / Moptop_General_Error_String. Callers that are stopping the writer because
+ *        of an acquisition error should pass FALSE, so the acquisition error is not overwritten.
+ * @return The routine returns TRUE if all the queued frames were written and published, 
+ *         and FALSE if an error occured.
+ * @see #Writer_Data
+ * @see #Writer_Threads_Join
+ * @see #Writer_Stage_Thread_Join
+ * @see #Writer_Publish_Group
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Writer_Stop(int report_error)
+{
+	struct Writer_Publish_Struct *publish_list = NULL;
+	int retval,publish_count,publish_retval;
+
+	if(Writer_Data.Thread_Count == 0)
+		return TRUE;
+	retval = Writer_Threads_Join();
+	if(retval != 0)
+	{
+		if(report_error)
+		{
+			Moptop_General_Error_Number = 808;
+			sprintf(Moptop_General_Error_String,"Moptop_Writer_Stop: Failed to join writer threads (%d).",
+				retval);
+		}
+		return FALSE;
+	}
+	/* no more images can be staged, wait for the staged ones to be flushed (and passed to Moptop_Writer_Publish) */
+	retval = Writer_Stage_Thread_Join();
+	if(retval != 0)
+	{
+		if(report_error)
+		{
+			Moptop_General_Error_Number = 825;
+			sprintf(Moptop_General_Error_String,"Moptop_Writer_Stop: Failed to join staging flush thread (%d).",
+				retval);
+		}
+		return FALSE;
+	}
+	/* the writer threads have exited, so no more files can be added to the publish list */
+	pthread_mutex_lock(&(Writer_Data.Mutex));
+	if(Writer_Data.Publish_Hold == FALSE)
+	{
+		publish_list = Writer_Data.Publish_List;
+		publish_count = Writer_Data.Publish_Count;
+		Writer_Data.Publish_List = NULL;
+		Writer_Data.Publish_Count = 0;
+		Writer_Data.Publish_Allocated = 0;
+	}
+	Writer_Data.Publish_Deferred = FALSE;
+	pthread_mutex_unlock(&(Writer_Data.Mutex));
+	publish_retval = TRUE;
+	if(publish_list != NULL)
+	{
+		publish_retval = Writer_Publish_Group(publish_list,publish_count,report_error);
+		free(publish_list);
+	}
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Stop",LOG_VERBOSITY_TERSE,"WRITER",
+				  "Writer threads stopped (failed = %d): %d threads, %d frames written, "
+				  "queue high water %d of %d, blocked %d times for %.3f s total (%.3f s max).",
+				  Writer_Data.Failed,Writer_Data.Statistics.Thread_Count,
+				  Writer_Data.Statistics.Frames_Written,Writer_Data.Statistics.Queue_High_Water,
+				  Writer_Data.Statistics.Queue_Length,Writer_Data.Statistics.Blocked_Count,
+				  Writer_Data.Statistics.Blocked_Time,Writer_Data.Statistics.Blocked_Time_Max);
+	if(Writer_Data.Statistics.Compressed_Count > 0)
+	{
+		Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Stop",LOG_VERBOSITY_TERSE,
+					  "WRITER","%d frames compressed from %lld to %lld bytes (ratio %.2f), "
+					  "using %.3f s CPU time (%.3f s per frame).",
+					  Writer_Data.Statistics.Compressed_Count,Writer_Data.Statistics.Uncompressed_Bytes,
+					  Writer_Data.Statistics.Compressed_Bytes,
+					  ((double)Writer_Data.Statistics.Uncompressed_Bytes)/
+					  ((double)Writer_Data.Statistics.Compressed_Bytes),
+					  Writer_Data.Statistics.Compress_CPU_Time,
+					  Writer_Data.Statistics.Compress_CPU_Time/Writer_Data.Statistics.Compressed_Count);
+	}
+	if(Writer_Data.Statistics.Sync_Count > 0)
+	{
+		Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Stop",LOG_VERBOSITY_TERSE,
+					  "WRITER","Durability %s: %d files synced in %d syncs, "
+					  "taking %.3f s total (%.3f s max).",
+					  Moptop_Writer_Durability_To_String(Writer_Data.Statistics.Durability),
+					  Writer_Data.Statistics.Synced_File_Count,Writer_Data.Statistics.Sync_Count,
+					  Writer_Data.Statistics.Sync_Time,Writer_Data.Statistics.Sync_Time_Max);
+	}
+	if(Writer_Data.Statistics.Stage_Enable)
+	{
+		Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Stop",LOG_VERBOSITY_TERSE,
+					  "WRITER","Staging: %d frames flushed, arena high water %lld of %lld bytes, "
+					  "blocked %d times for %.3f s total.",
+					  Writer_Data.Statistics.Stage_Frames_Flushed,
+					  Writer_Data.Statistics.Stage_Used_High_Water,Writer_Data.Statistics.Stage_Size,
+					  Writer_Data.Statistics.Stage_Blocked_Count,Writer_Data.Statistics.Stage_Blocked_Time);
+	}
+#endif
+	if(Writer_Data.Failed)
+	{
+		if(report_error)
+		{
+			Moptop_General_Error_Number = Writer_Data.Error_Number;
+			strcpy(Moptop_General_Error_String,Writer_Data.Error_String);
+		}
+		return FALSE;
+	}
+	if(publish_retval == FALSE)
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Return whether a writer thread has failed to write a frame since they were last started.
+ * @return TRUE if a frame has failed to be written, FALSE otherwise.
+ * @see #Writer_Data
+ */
+int Moptop_Writer_Has_Failed(void)
+{
+	return Writer_Data.Failed;
+}
+
+/**
+ * Get a copy of the writer statistics. These are reset by Moptop_Writer_Start, so after a multrun / bias / dark
+ * has finished they contain the statistics for that acquisition.
+ * @param statistics The address of a Moptop_Writer_Statistics_Struct to copy the statistics into.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_writer.html#Moptop_Writer_Statistics_Struct
+ */
+int Moptop_Writer_Statistics_Get(struct Moptop_Writer_Statistics_Struct *statistics)
+{
+	if(statistics == NULL)
+	{
+		Moptop_General_Error_Number = 811;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Statistics_Get: statistics was NULL.");
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+		return FALSE;
+	(*statistics) = Writer_Data.Statistics;
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Add a tile compressed frame to the writer compression statistics. This is called by the write function
+ * (in a writer thread) after it has written a compressed frame.
+ * @param uncompressed_bytes The size of the frame's image data before compression, in bytes.
+ * @param compressed_bytes The size of the compressed FITS file, in bytes.
+ * @param cpu_time The CPU time the writer thread spent compressing and writing the frame, in seconds.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ */
+int Moptop_Writer_Compression_Add(long long int uncompressed_bytes,long long int compressed_bytes,double cpu_time)
+{
+	if(compressed_bytes <= 0)
+	{
+		Moptop_General_Error_Number = 814;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Compression_Add: compressed_bytes %lld too small.",
+			compressed_bytes);
+		return FALSE;
+	}
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+		return FALSE;
+	Writer_Data.Statistics.Compressed_Count++;
+	Writer_Data.Statistics.Uncompressed_Bytes += uncompressed_bytes;
+	Writer_Data.Statistics.Compressed_Bytes += compressed_bytes;
+	Writer_Data.Statistics.Compress_CPU_Time += cpu_time;
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Publish a written file (remove it's FITS filename lock, or rename it to it's FITS filename), once it is as durable
+ * as the configured durability policy requires. This is called by the write function (in a writer thread) 
+ * instead of calling CCD_Fits_Filename_Publish_End directly.
+ * <ul>
+ * <li>If publishing is held (Moptop_Writer_Publish_Hold), the file is added to Writer_Data.Publish_List,
+ *     to be published by Moptop_Writer_Publish_Release. This is also done after the writer has been stopped.
+ * <li>If the durability policy publishes files straight away (NONE or FRAME), or the writer has been stopped,
+ *     the file is synced (unless the policy is NONE) and published by calling Writer_Publish_Group with just 
+ *     this file.
+ * <li>Otherwise the file is added to Writer_Data.Publish_List (using Writer_Publish_List_Add, which also
+ *     counts the frames added for each group). If the policy is ROTATION, and the files in the 
+ *     list for this group now hold Writer_Data.Group_Size frames, the group is complete:
+ *     it's files are taken off the list, and synced and published together by Writer_Publish_Group.
+ *     This is done by whichever thread completes the group, without holding Writer_Data.Mutex, so the other 
+ *     writer threads carry on writing while the file system is synced.
+ * </ul>
+ * Dropped frames are also passed to this routine (with a NULL write_filename), so a rotation with dropped frames
+ * still completes. Files that fail to be written are not passed in, their rotation is published when the writer 
+ * is stopped.
+ * @param write_filename The filename the data was written to (as returned by CCD_Fits_Filename_Publish_Begin),
+ *        or NULL for a dropped frame.
+ * @param group_number The group the file belongs to (it's rotation number).
+ * @param frame_count The number of frames the file holds (1, or the number of planes for a FITS cube).
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #Writer_Publish_Struct
+ * @see #Writer_Publish_List_Add
+ * @see #Writer_Publish_Group
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_writer.html#MOPTOP_WRITER_FILENAME_LENGTH
+ */
+int Moptop_Writer_Publish(char *write_filename,int group_number,int frame_count)
+{
+	struct Writer_Publish_Struct *group_list = NULL;
+	struct Writer_Publish_Struct publish;
+	int i,group_count,keep_count,retval;
+
+	if(frame_count < 0)
+	{
+		Moptop_General_Error_Number = 816;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Publish: Illegal frame count %d.",frame_count);
+		return FALSE;
+	}
+	if((write_filename != NULL)&&(strlen(write_filename) >= MOPTOP_WRITER_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 817;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Publish: Filename too long (%d).",
+			(int)strlen(write_filename));
+		return FALSE;
+	}
+	if(write_filename != NULL)
+		strcpy(publish.Filename,write_filename);
+	else
+		strcpy(publish.Filename,"");
+	publish.Group_Number = group_number;
+	publish.Frame_Count = frame_count;
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+		return FALSE;
+	if((Writer_Data.Publish_Deferred == FALSE)&&(Writer_Data.Publish_Hold == FALSE))
+	{
+		if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+			return FALSE;
+		if(write_filename == NULL)
+			return TRUE;
+		return Writer_Publish_Group(&publish,1,TRUE);
+	}
+	if(!Writer_Publish_List_Add(&publish))
+	{
+		Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex));
+		return FALSE;
+	}
+	/* is this file's rotation complete? The list is only scanned once per rotation, to take the group's files off */
+	group_count = 0;
+	if((Writer_Data.Durability == MOPTOP_WRITER_DURABILITY_ROTATION)&&(Writer_Data.Group_Size > 0)&&
+	   (Writer_Data.Publish_Hold == FALSE)&&(group_number >= 0)&&
+	   (Writer_Data.Group_Frame_Count_List[group_number] >= Writer_Data.Group_Size))
+	{
+		for(i = 0; i < Writer_Data.Publish_Count; i++)
+		{
+			if(Writer_Data.Publish_List[i].Group_Number == group_number)
+				group_count++;
+		}
+		Writer_Data.Group_Frame_Count_List[group_number] = 0;
+	}
+	if(group_count > 0)
+	{
+		group_list = (struct Writer_Publish_Struct *)malloc(group_count*sizeof(struct Writer_Publish_Struct));
+		if(group_list == NULL)
+		{
+			Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex));
+			Moptop_General_Error_Number = 819;
+			sprintf(Moptop_General_Error_String,"Moptop_Writer_Publish: Failed to allocate group list (%d).",
+				group_count);
+			return FALSE;
+		}
+		/* move the group's files to group_list, and compact the publish list */
+		group_count = 0;
+		keep_count = 0;
+		for(i = 0; i < Writer_Data.Publish_Count; i++)
+		{
+			if(Writer_Data.Publish_List[i].Group_Number == group_number)
+				group_list[group_count++] = Writer_Data.Publish_List[i];
+			else
+				Writer_Data.Publish_List[keep_count++] = Writer_Data.Publish_List[i];
+		}
+		Writer_Data.Publish_Count = keep_count;
+	}
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+	{
+		if(group_list != NULL)
+			free(group_list);
+		return FALSE;
+	}
+	if(group_list == NULL)
+		return TRUE;
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Publish",LOG_VERBOSITY_VERBOSE,
+				  "WRITER","Rotation %d complete, publishing %d files.",group_number,group_count);
+#endif
+	retval = Writer_Publish_Group(group_list,group_count,TRUE);
+	free(group_list);
+	return retval;
+}
+
+/**
+ * Hold back publishing every file written from now on (and any files already waiting for their group), until
+ * Moptop_Writer_Publish_Release is called. The hold survives Moptop_Writer_Stop, so files passed to
+ * Moptop_Writer_Publish after the writer has been stopped (e.g. incomplete FITS cubes) are held as well.
+ * This should be called after Moptop_Writer_Start (which clears the hold), before any frames are queued.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #Moptop_Writer_Publish_Release
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ */
+int Moptop_Writer_Publish_Hold(void)
+{
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+		return FALSE;
+	Writer_Data.Publish_Hold = TRUE;
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Clear the publish hold set by Moptop_Writer_Publish_Hold, and sync and publish all the files held back
+ * since then in one group, using Writer_Publish_Group. This must be called after Moptop_Writer_Stop,
+ * and does nothing if publishing is not held, so it can be called on failure paths that may not have held it.
+ * @param report_error A boolean, if TRUE a failure is reported in Moptop_General_Error_Number / 
+ *        Moptop_General_Error_String, otherwise it is only logged (so an earlier error is not overwritten).
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #Writer_Publish_Group
+ * @see #Moptop_Writer_Publish_Hold
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+int Moptop_Writer_Publish_Release(int report_error)
+{
+	struct Writer_Publish_Struct *publish_list = NULL;
+	int publish_count,retval;
+
+	if(Writer_Data.Thread_Count > 0)
+	{
+		if(report_error)
+		{
+			Moptop_General_Error_Number = 835;
+			sprintf(Moptop_General_Error_String,"Moptop_Writer_Publish_Release: Writer threads still running.");
+		}
+		return FALSE;
+	}
+	pthread_mutex_lock(&(Writer_Data.Mutex));
+	if(Writer_Data.Publish_Hold == FALSE)
+	{
+		pthread_mutex_unlock(&(Writer_Data.Mutex));
+		return TRUE;
+	}
+	publish_list = Writer_Data.Publish_List;
+	publish_count = Writer_Data.Publish_Count;
+	Writer_Data.Publish_List = NULL;
+	Writer_Data.Publish_Count = 0;
+	Writer_Data.Publish_Allocated = 0;
+	Writer_Data.Publish_Hold = FALSE;
+	pthread_mutex_unlock(&(Writer_Data.Mutex));
+	if(publish_list == NULL)
+		return TRUE;
+#if MOPTOP_DEBUG > 1
+	Moptop_General_Log_Format("writer","moptop_writer.c","Moptop_Writer_Publish_Release",LOG_VERBOSITY_INTERMEDIATE,
+				  "WRITER","Publishing %d held files.",publish_count);
+#endif
+	retval = Writer_Publish_Group(publish_list,publish_count,report_error);
+	free(publish_list);
+	return retval;
+}
+
+/**
+ * Return a string describing a durability policy.
+ * @param durability The durability policy.
+ * @return A string describing the policy, e.g. "rotation", or "unknown" if durability is not a valid policy.
+ * @see #Writer_Durability_Name_List
+ * @see moptop_writer.html#MOPTOP_WRITER_DURABILITY
+ * @see moptop_writer.html#MOPTOP_WRITER_IS_DURABILITY
+ */
+char *Moptop_Writer_Durability_To_String(enum MOPTOP_WRITER_DURABILITY durability)
+{
+	if(!MOPTOP_WRITER_IS_DURABILITY(durability))
+		return "unknown";
+	return Writer_Durability_Name_List[durability];
+}
+
+/**
+ * Return whether written frames should be staged in memory (using Moptop_Writer_Stage) rather than written 
+ * to disk by the write function. This is set from the "moptop.multrun.writer.staging.enable" config value
+ * by Moptop_Writer_Start, and is TRUE until Moptop_Writer_Stop is called.
+ * @return TRUE if written frames should be staged, FALSE otherwise.
+ * @see #Writer_Data
+ */
+int Moptop_Writer_Stage_Is_Enabled(void)
+{
+	return Writer_Data.Stage_Enable;
+}
+
+/**
+ * Stage a FITS image in memory, to be written to disk (and then published) by the staging flush thread.
+ * This is called by the write function (in a writer thread) instead of locking the filename, writing the 
+ * FITS image and calling Moptop_Writer_Publish itself, when Moptop_Writer_Stage_Is_Enabled returns TRUE.
+ * <ul>
+ * <li>We compute the length of the formatted FITS image using CCD_Fits_Image_Header_Length_Get and
+ *     CCD_Fits_Image_Data_Length_Get, and check it fits in the staging arena.
+ * <li>We reserve space for the image in the staging arena using Writer_Stage_Space_Get. If there is not enough
+ *     free space, we wait for the staging flush thread to free some. The number of times this happens, and how 
+ *     long we wait for, is recorded in Writer_Data.Statistics.
+ * <li>We add the image to the end of the list of staged images (not yet ready), and update the staging 
+ *     occupancy statistics.
+ * <li>We format the FITS image into the reserved space using CCD_Fits_Image_Serialise. 
+ *     This is done without holding Writer_Data.Mutex, so several writer threads can stage images at once.
+ * <li>We mark the image ready, and wake up the staging flush thread. If the image failed to be formatted, 
+ *     it's filename is cleared, so the flush thread just frees it's space.
+ * </ul>
+ * @param filename The FITS filename the image should be written to. The filename is locked (or the temporary 
+ *        filename to write to is created) by the staging flush thread, when the image is flushed.
+ * @param group_number The group the image belongs to (it's rotation number), passed to Moptop_Writer_Publish
+ *        once the image has been written.
+ * @param card_image_list A list of card_count card images to put in the header after the mandatory cards.
+ * @param card_count The number of card images in card_image_list.
+ * @param ncols The number of columns in the image.
+ * @param nrows The number of rows in the image.
+ * @param image_data The image data, already converted to FITS format by CCD_Fits_Image_Data_Convert.
+ *        This is copied into the staging arena, so the caller can reuse it once this routine returns.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #Writer_Stage_Struct
+ * @see #Writer_Stage_Space_Get
+ * @see moptop_general.html#fdifftime
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Mutex_Lock
+ * @see moptop_general.html#Moptop_General_Mutex_Unlock
+ * @see moptop_writer.html#MOPTOP_WRITER_FILENAME_LENGTH
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Header_Length_Get
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Length_Get
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Serialise
+ */
+int Moptop_Writer_Stage(char *filename,int group_number,char *card_image_list,int card_count,int ncols,
+			int nrows,unsigned short *image_data)
+{
+	struct Writer_Stage_Struct *stage = NULL;
+	struct timespec blocked_start_time,blocked_end_time;
+	size_t length,offset,reserved_length;
+	int retval,serialise_retval;
+
+	if(filename == NULL)
+	{
+		Moptop_General_Error_Number = 826;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Stage: filename was NULL.");
+		return FALSE;
+	}
+	if(strlen(filename) >= MOPTOP_WRITER_FILENAME_LENGTH)
+	{
+		Moptop_General_Error_Number = 827;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Stage: Filename too long (%d).",(int)strlen(filename));
+		return FALSE;
+	}
+	length = CCD_Fits_Image_Header_Length_Get(card_count)+CCD_Fits_Image_Data_Length_Get(ncols,nrows);
+	if((Writer_Data.Stage_Enable == FALSE)||(length > Writer_Data.Stage_Arena_Size))
+	{
+		Moptop_General_Error_Number = 828;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Stage: '%s' (%lu bytes) does not fit in the "
+			"staging arena (enabled = %d, %lu bytes).",filename,(unsigned long)length,
+			Writer_Data.Stage_Enable,(unsigned long)Writer_Data.Stage_Arena_Size);
+		return FALSE;
+	}
+	stage = (struct Writer_Stage_Struct *)malloc(sizeof(struct Writer_Stage_Struct));
+	if(stage == NULL)
+	{
+		Moptop_General_Error_Number = 829;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Stage: Failed to allocate staged image for '%s'.",
+			filename);
+		return FALSE;
+	}
+	strcpy(stage->Filename,filename);
+	stage->Group_Number = group_number;
+	stage->Length = length;
+	stage->Is_Ready = FALSE;
+	stage->Next = NULL;
+	if(!Moptop_General_Mutex_Lock(&(Writer_Data.Mutex)))
+	{
+		free(stage);
+		return FALSE;
+	}
+	retval = Writer_Stage_Space_Get(length,&offset,&reserved_length);
+	if((retval == FALSE) && (Writer_Data.Failed == FALSE))
+	{
+		/* the arena is full, wait for the staging flush thread to free some space */
+		clock_gettime(CLOCK_REALTIME,&blocked_start_time);
+		while((retval == FALSE) && (Writer_Data.Failed == FALSE))
+		{
+			pthread_cond_wait(&(Writer_Data.Stage_Space_Condition),&(Writer_Data.Mutex));
+			retval = Writer_Stage_Space_Get(length,&offset,&reserved_length);
+		}
+		clock_gettime(CLOCK_REALTIME,&blocked_end_time);
+		Writer_Data.Statistics.Stage_Blocked_Count++;
+		Writer_Data.Statistics.Stage_Blocked_Time += fdifftime(blocked_end_time,blocked_start_time);
+	}
+	if(retval == FALSE)
+	{
+		Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex));
+		free(stage);
+		Moptop_General_Error_Number = 830;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Stage: Writer failed while waiting to stage '%s'.",
+			filename);
+		return FALSE;
+	}
+	stage->Offset = offset;
+	stage->Reserved_Length = reserved_length;
+	if(Writer_Data.Stage_Last == NULL)
+		Writer_Data.Stage_First = stage;
+	else
+		Writer_Data.Stage_Last->Next = stage;
+	Writer_Data.Stage_Last = stage;
+	Writer_Data.Statistics.Stage_Frame_Count++;
+	if(Writer_Data.Statistics.Stage_Used > Writer_Data.Statistics.Stage_Used_High_Water)
+		Writer_Data.Statistics.Stage_Used_High_Water = Writer_Data.Statistics.Stage_Used;
+	if(!Moptop_General_Mutex_Unlock(&(Writer_Data.Mutex)))
+		return FALSE;
+	/* format the FITS image into the reserved space. No other thread touches it until it is marked ready */
+	serialise_retval = CCD_Fits_Image_Serialise(card_image_list,card_count,ncols,nrows,image_data,
+						    Writer_Data.Stage_Arena+offset,length);
+	pthread_mutex_lock(&(Writer_Data.Mutex));
+	if(serialise_retval == FALSE)
+		strcpy(stage->Filename,"");
+	stage->Is_Ready = TRUE;
+	pthread_cond_signal(&(Writer_Data.Stage_Ready_Condition));
+	pthread_mutex_unlock(&(Writer_Data.Mutex));
+	if(serialise_retval == FALSE)
+	{
+		Moptop_General_Error_Number = 831;
+		sprintf(Moptop_General_Error_String,"Moptop_Writer_Stage: Failed to format '%s' into the staging arena.",
+			filename);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* ----------------------------------------------------------------------------
+** 		internal functions
+** ---------------------------------------------------------------------------- */
+/**
+ * The writer threads' start routine.
+ * <ul>
+ * <li>We set the thread's priority to the "normal" priority using Moptop_General_Thread_Priority_Set_Normal,
+ *     otherwise the thread would inherit the exposure priority of the acquisition thread that created it.
+ * <li>We loop:
+ *     <ul>
+ *     <li>We wait for a frame to be queued, or Writer_Data.Stop to be set.
+ *     <li>If the queue is empty (and therefore Writer_Data.Stop is TRUE) we exit the loop.
+ *     <li>We remove the frame from the head of the queue.
+ *     <li>If no previous frame failed to be written, we call Writer_Data.Write_Function to write the frame.
+ *         If this fails we set Writer_Data.Failed, and (if this is the first failure) copy the error into
+ *         Writer_Data.Error_Number / Writer_Data.Error_String, and wake up the acquisition thread if it is
+ *         waiting for a free frame. The error variables are thread local, so this is this thread's error,
+ *         not one being set by another writer thread.
+ *     <li>We release the frame's image buffer using CCD_Buffer_Release.
+ *     <li>We return the frame to the free list, and signal any thread waiting for a free frame.
+ *     </ul>
+ * </ul>
+ * Several copies of this routine run at once, so frames are not necessarily written in the order they were queued.
+ * @param user_arg Thread argument, not used.
+ * @return The routine returns NULL.
+ * @see #Writer_Data
+ * @see moptop_general.html#Moptop_General_Error
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_general.html#Moptop_General_Thread_Priority_Set_Normal
+ * @see ../ccd/cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ * @see ../ccd/cdocs/ccd_buffer.html#CCD_Buffer_Release
+ */
+static void *Writer_Thread(void *user_arg)
+{
+	struct Moptop_Writer_Frame_Struct *frame = NULL;
+	int frame_index,failed,write_retval;
+
+	if(!Moptop_General_Thread_Priority_Set_Normal())
+		Moptop_General_Error("writer","moptop_writer.c","Writer_Thread",LOG_VERBOSITY_VERY_TERSE,"WRITER");
+	while(TRUE)
+	{
+		pthread_mutex_lock(&(Writer_Data.Mutex));
+		while((Writer_Data.Queue_Count == 0) && (Writer_Data.Stop == FALSE))
+			pthread_cond_wait(&(Writer_Data.Queue_Condition),&(Writer_Data.Mutex));
+		if(Writer_Data.Queue_Count == 0)
+		{
+			pthread_mutex_unlock(&(Writer_Data.Mutex));
+			break;
+		}
+		frame_index = Writer_Data.Queue_List[Writer_Data.Queue_Head];
+		Writer_Data.Queue_Head = (Writer_Data.Queue_Head+1)%CCD_BUFFER_COUNT;
+		Writer_Data.Queue_Count--;
+		failed = Writer_Data.Failed;
+		pthread_mutex_unlock(&(Writer_Data.Mutex));
+		frame = &(Writer_Data.Frame_List[frame_index]);
+		/* once a frame has failed to be written, discard the rest */
+		write_retval = FALSE;
+		if(failed == FALSE)
+		{
+#if MOPTOP_DEBUG > 5
+			Moptop_General_Log_Format("writer","moptop_writer.c","Writer_Thread",LOG_VERBOSITY_VERBOSE,
+						  "WRITER","Writing frame %d from buffer %d to '%s'.",
+						  frame->Image_Index,frame->Buffer_Index,frame->Filename);
+#endif
+			write_retval = Writer_Data.Write_Function(frame);
+			if(write_retval == FALSE)
+			{
+				pthread_mutex_lock(&(Writer_Data.Mutex));
+				/* only keep the first error, later ones are probably a consequence of it */
+				if(Writer_Data.Failed == FALSE)
+				{
+					Writer_Data.Failed = TRUE;
+					Writer_Data.Error_Number = Moptop_General_Error_Number;
+					strcpy(Writer_Data.Error_String,Moptop_General_Error_String);
+				}
+				pthread_mutex_unlock(&(Writer_Data.Mutex));
+				Moptop_General_Error("writer","moptop_writer.c","Writer_Thread",
+						     LOG_VERBOSITY_VERY_TERSE,"WRITER");
+			}
+		}
+		/* release the image buffer, and return the frame to the free list */
+		if(!CCD_Buffer_Release(frame->Buffer_Index))
+		{
+			Moptop_General_Error_Number = 813;
+			sprintf(Moptop_General_Error_String,"Writer_Thread: Failed to release image buffer %d.",
+				frame->Buffer_Index);
+			Moptop_General_Error("writer","moptop_writer.c","Writer_Thread",LOG_VERBOSITY_VERY_TERSE,"WRITER");
+		}
+		pthread_mutex_lock(&(Writer_Data.Mutex));
+		if(write_retval)
+			Writer_Data.Statistics.Frames_Written++;
+		Writer_Data.Free_List[Writer_Data.Free_Count++] = frame_index;
+		pthread_cond_broadcast(&(Writer_Data.Free_Condition));
+		pthread_mutex_unlock(&(Writer_Data.Mutex));
+	}
+	return NULL;
+}
+
+/**
+ * Stop the writer threads, and wait for them to exit.
+ * <ul>
+ * <li>We set Writer_Data.Stop to TRUE and wake up all the writer threads.
+ * <li>We wait for each started writer thread to exit using pthread_join.
+ * <li>We reset Writer_Data.Thread_Count to zero.
+ * </ul>
+ * This routine does not set Moptop_General_Error_Number / Moptop_General_Error_String, so it can be
+ * used on error paths without overwriting the original error.
+ * @return The routine returns 0 on success, and the error returned by the last pthread_join that failed
+ *         on failure.
+ * @see #Writer_Data
+ */
+static int Writer_Threads_Join(void)
+{
+	int i,retval,join_retval;
+
+	pthread_mutex_lock(&(Writer_Data.Mutex));
+	Writer_Data.Stop = TRUE;
+	pthread_cond_broadcast(&(Writer_Data.Queue_Condition));
+	pthread_mutex_unlock(&(Writer_Data.Mutex));
+	retval = 0;
+	for(i=0; i < Writer_Data.Thread_Count; i++)
+	{
+		join_retval = pthread_join(Writer_Data.Thread_List[i],NULL);
+		if(join_retval != 0)
+			retval = join_retval;
+	}
+	Writer_Data.Thread_Count = 0;
+	return retval;
+}
+
+/**
+ * Add a written file to the list of files waiting to be published (Writer_Data.Publish_List), and add it's frames 
+ * to it's group's frame count (Writer_Data.Group_Frame_Count_List). Both lists are grown geometrically (doubling 
+ * their capacity), so adding a file is amortised O(1) rather than copying the whole list each time.
+ * This routine must be called holding Writer_Data.Mutex.
+ * @param publish The file to add.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #Writer_Publish_Struct
+ * @see #WRITER_PUBLISH_LIST_ALLOCATE_MIN
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+static int Writer_Publish_List_Add(struct Writer_Publish_Struct *publish)
+{
+	struct Writer_Publish_Struct *new_list = NULL;
+	int *new_count_list = NULL;
+	int new_allocated;
+
+	if(Writer_Data.Publish_Count >= Writer_Data.Publish_Allocated)
+	{
+		new_allocated = MAX(2*Writer_Data.Publish_Allocated,WRITER_PUBLISH_LIST_ALLOCATE_MIN);
+		new_list = (struct Writer_Publish_Struct *)realloc(Writer_Data.Publish_List,
+							   new_allocated*sizeof(struct Writer_Publish_Struct));
+		if(new_list == NULL)
+		{
+			Moptop_General_Error_Number = 818;
+			sprintf(Moptop_General_Error_String,"Writer_Publish_List_Add: Failed to reallocate publish list "
+				"(%d).",new_allocated);
+			return FALSE;
+		}
+		Writer_Data.Publish_List = new_list;
+		Writer_Data.Publish_Allocated = new_allocated;
+	}
+	if((publish->Group_Number >= 0)&&(publish->Group_Number >= Writer_Data.Group_Frame_Count_Allocated))
+	{
+		new_allocated = MAX(2*Writer_Data.Group_Frame_Count_Allocated,WRITER_PUBLISH_LIST_ALLOCATE_MIN);
+		new_allocated = MAX(new_allocated,publish->Group_Number+1);
+		new_count_list = (int *)realloc(Writer_Data.Group_Frame_Count_List,new_allocated*sizeof(int));
+		if(new_count_list == NULL)
+		{
+			Moptop_General_Error_Number = 836;
+			sprintf(Moptop_General_Error_String,"Writer_Publish_List_Add: Failed to reallocate group frame "
+				"count list (%d).",new_allocated);
+			return FALSE;
+		}
+		memset(new_count_list+Writer_Data.Group_Frame_Count_Allocated,0,
+		       (new_allocated-Writer_Data.Group_Frame_Count_Allocated)*sizeof(int));
+		Writer_Data.Group_Frame_Count_List = new_count_list;
+		Writer_Data.Group_Frame_Count_Allocated = new_allocated;
+	}
+	Writer_Data.Publish_List[Writer_Data.Publish_Count++] = (*publish);
+	if(publish->Group_Number >= 0)
+		Writer_Data.Group_Frame_Count_List[publish->Group_Number] += publish->Frame_Count;
+	return TRUE;
+}
+
+/**
+ * Sync and publish a group of written files.
+ * <ul>
+ * <li>If the durability policy is not NONE, and the group contains any files (rather than just dropped frames), 
+ *     we make them durable using Writer_Sync. A group of one file is flushed using fdatasync, a larger group by 
+ *     syncing the file system the files are on once (syncfs), which is much cheaper than syncing each file 
+ *     in turn. If the sync fails the files are not published, as they may not be complete on disk.
+ * <li>We publish each file using CCD_Fits_Filename_Publish_End, timing each call and adding it to the 
+ *     FILENAME_UNLOCK timing histogram. If a file fails to be published, we carry on publishing the rest.
+ * <li>If the durability policy is not NONE, we sync the directory each published file is in (once per directory,
+ *     normally once per group) using Writer_Sync, so the renames / removed lock files are durable too.
+ * </ul>
+ * This routine must be called without holding Writer_Data.Mutex.
+ * @param publish_list The list of files to publish.
+ * @param publish_count The number of files in publish_list.
+ * @param report_error A boolean, if TRUE a failure is reported in Moptop_General_Error_Number / 
+ *        Moptop_General_Error_String, otherwise it is only logged (so an earlier error is not overwritten).
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #Writer_Publish_Struct
+ * @see #Writer_Sync
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_End
+ */
+static int Writer_Publish_Group(struct Writer_Publish_Struct *publish_list,int publish_count,int report_error)
+{
+	struct timespec start_time,end_time;
+	char *leaf_ptr = NULL;
+	int i,file_count,first_index,retval,directory_length,synced_index,synced_directory_length;
+
+	file_count = 0;
+	first_index = -1;
+	for(i = 0; i < publish_count; i++)
+	{
+		if(strlen(publish_list[i].Filename) > 0)
+		{
+			if(first_index == -1)
+				first_index = i;
+			file_count++;
+		}
+	}
+	if(file_count == 0)
+		return TRUE;
+	if(Writer_Data.Durability != MOPTOP_WRITER_DURABILITY_NONE)
+	{
+		if(!Writer_Sync(publish_list[first_index].Filename,
+				(file_count > 1) ? WRITER_SYNC_TYPE_FILE_SYSTEM : WRITER_SYNC_TYPE_FILE,file_count,
+				report_error))
+			return FALSE;
+	}
+	retval = TRUE;
+	for(i = 0; i < publish_count; i++)
+	{
+		if(strlen(publish_list[i].Filename) == 0)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC,&start_time);
+		if(!CCD_Fits_Filename_Publish_End(publish_list[i].Filename))
+		{
+			if(report_error)
+			{
+				Moptop_General_Error_Number = 822;
+				sprintf(Moptop_General_Error_String,"Writer_Publish_Group: Failed to publish '%s'.",
+					publish_list[i].Filename);
+			}
+#if MOPTOP_DEBUG > 1
+			Moptop_General_Log_Format("writer","moptop_writer.c","Writer_Publish_Group",LOG_VERBOSITY_TERSE,
+						  "WRITER","Failed to publish '%s'.",publish_list[i].Filename);
+#endif
+			retval = FALSE;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&end_time);
+		Moptop_Timing_Add(Writer_Data.Timing_Set,MOPTOP_TIMING_TYPE_FILENAME_UNLOCK,start_time,end_time);
+	}
+	/* make the published directory entries durable, syncing each directory the files are in once */
+	if(Writer_Data.Durability != MOPTOP_WRITER_DURABILITY_NONE)
+	{
+		synced_index = -1;
+		synced_directory_length = 0;
+		for(i = 0; i < publish_count; i++)
+		{
+			if(strlen(publish_list[i].Filename) == 0)
+				continue;
+			leaf_ptr = strrchr(publish_list[i].Filename,'/');
+			if(leaf_ptr == NULL)
+				directory_length = 0;
+			else
+				directory_length = leaf_ptr-publish_list[i].Filename;
+			if((synced_index != -1)&&(directory_length == synced_directory_length)&&
+			   (strncmp(publish_list[i].Filename,publish_list[synced_index].Filename,directory_length) == 0))
+				continue;
+			if(!Writer_Sync(publish_list[i].Filename,WRITER_SYNC_TYPE_DIRECTORY,0,report_error))
+				retval = FALSE;
+			synced_index = i;
+			synced_directory_length = directory_length;
+		}
+	}
+	return retval;
+}
+
+/**
+ * Flush written data to disk, and add the time taken to the writer statistics and the FILE_SYNC timing histogram.
+ * The file is opened read only, and either fdatasync is called on it (to sync just that file), or syncfs
+ * (to sync the whole file system it is on, and so all the other files written to the same directory).
+ * For a directory sync, the directory filename is in is opened read only instead, and fsync is called on it.
+ * This must be called without holding Writer_Data.Mutex.
+ * @param filename The file to sync, or a file on the file system / in the directory to sync.
+ * @param sync_type How to sync the file: fdatasync, syncfs, or fsync of it's directory.
+ * @param file_count The number of files made durable by this sync, for the statistics.
+ * @param report_error A boolean, if TRUE a failure is reported in Moptop_General_Error_Number / 
+ *        Moptop_General_Error_String, otherwise it is only logged.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #WRITER_SYNC_TYPE
+ * @see moptop_general.html#fdifftime
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see moptop_writer.html#MOPTOP_WRITER_FILENAME_LENGTH
+ */
+static int Writer_Sync(char *filename,enum WRITER_SYNC_TYPE sync_type,int file_count,int report_error)
+{
+	struct timespec start_time,end_time;
+	char directory[MOPTOP_WRITER_FILENAME_LENGTH];
+	char *leaf_ptr = NULL;
+	double sync_time;
+	int fd,retval,error_number;
+
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(sync_type == WRITER_SYNC_TYPE_DIRECTORY)
+	{
+		strncpy(directory,filename,MOPTOP_WRITER_FILENAME_LENGTH-1);
+		directory[MOPTOP_WRITER_FILENAME_LENGTH-1] = '\0';
+		leaf_ptr = strrchr(directory,'/');
+		if(leaf_ptr == NULL)
+			strcpy(directory,".");
+		else if(leaf_ptr == directory)
+			directory[1] = '\0';
+		else
+			(*leaf_ptr) = '\0';
+		fd = open(directory,O_RDONLY);
+	}
+	else
+		fd = open(filename,O_RDONLY);
+	if(fd < 0)
+	{
+		error_number = errno;
+		if(report_error)
+		{
+			Moptop_General_Error_Number = 820;
+			sprintf(Moptop_General_Error_String,"Writer_Sync: Failed to open '%s' (%d,%d).",filename,
+				sync_type,error_number);
+		}
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log_Format("writer","moptop_writer.c","Writer_Sync",LOG_VERBOSITY_TERSE,"WRITER",
+					  "Failed to open '%s' (%d,%d).",filename,sync_type,error_number);
+#endif
+		return FALSE;
+	}
+	if(sync_type == WRITER_SYNC_TYPE_FILE_SYSTEM)
+		retval = syncfs(fd);
+	else if(sync_type == WRITER_SYNC_TYPE_DIRECTORY)
+		retval = fsync(fd);
+	else
+		retval = fdatasync(fd);
+	if(retval != 0)
+	{
+		error_number = errno;
+		close(fd);
+		if(report_error)
+		{
+			Moptop_General_Error_Number = 821;
+			sprintf(Moptop_General_Error_String,"Writer_Sync: Failed to sync '%s' (%d,%d).",filename,
+				sync_type,error_number);
+		}
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log_Format("writer","moptop_writer.c","Writer_Sync",LOG_VERBOSITY_TERSE,"WRITER",
+					  "Failed to sync '%s' (%d,%d).",filename,sync_type,error_number);
+#endif
+		return FALSE;
+	}
+	close(fd);
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(Writer_Data.Timing_Set,MOPTOP_TIMING_TYPE_FILE_SYNC,start_time,end_time);
+	sync_time = fdifftime(end_time,start_time);
+	pthread_mutex_lock(&(Writer_Data.Mutex));
+	Writer_Data.Statistics.Sync_Count++;
+	Writer_Data.Statistics.Synced_File_Count += file_count;
+	Writer_Data.Statistics.Sync_Time += sync_time;
+	if(sync_time > Writer_Data.Statistics.Sync_Time_Max)
+		Writer_Data.Statistics.Sync_Time_Max = sync_time;
+	pthread_mutex_unlock(&(Writer_Data.Mutex));
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("writer","moptop_writer.c","Writer_Sync",LOG_VERBOSITY_VERBOSE,"WRITER",
+				  "Synced %d files (%s) in %.3f s.",file_count,
+				  (sync_type == WRITER_SYNC_TYPE_FILE_SYSTEM) ? "syncfs" :
+				  ((sync_type == WRITER_SYNC_TYPE_DIRECTORY) ? "directory fsync" : "fdatasync"),sync_time);
+#endif
+	return TRUE;
+}
+
+/**
+ * (Re)allocate the staging arena, if it has not been allocated yet or the configured size has changed.
+ * The arena is an anonymous private memory mapping (mmap). We try to lock it into memory using mlock, so the
+ * staged images can never be paged out to disk. This needs the process's RLIMIT_MEMLOCK to be at least the arena 
+ * size (or CAP_IPC_LOCK): if the lock fails, we log a warning and carry on with an unlocked arena.
+ * The arena is not unmapped when the writer is stopped, so it is only faulted in (and locked) once.
+ * @param size The size of the arena in bytes.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see moptop_general.html#Moptop_General_Log_Format
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ */
+static int Writer_Stage_Arena_Allocate(size_t size)
+{
+	void *arena = NULL;
+	int error_number;
+
+	if((Writer_Data.Stage_Arena != NULL)&&(Writer_Data.Stage_Arena_Size == size))
+		return TRUE;
+	if(Writer_Data.Stage_Arena != NULL)
+	{
+		if(Writer_Data.Stage_Arena_Locked)
+			munlock(Writer_Data.Stage_Arena,Writer_Data.Stage_Arena_Size);
+		munmap(Writer_Data.Stage_Arena,Writer_Data.Stage_Arena_Size);
+		Writer_Data.Stage_Arena = NULL;
+		Writer_Data.Stage_Arena_Size = 0;
+		Writer_Data.Stage_Arena_Locked = FALSE;
+	}
+	arena = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if(arena == MAP_FAILED)
+	{
+		error_number = errno;
+		Moptop_General_Error_Number = 832;
+		sprintf(Moptop_General_Error_String,"Writer_Stage_Arena_Allocate: Failed to map %lu byte staging arena (%d).",
+			(unsigned long)size,error_number);
+		return FALSE;
+	}
+	Writer_Data.Stage_Arena = (unsigned char *)arena;
+	Writer_Data.Stage_Arena_Size = size;
+	/* lock the arena into memory (this also faults it in), so staging an image never waits for paging */
+	if(mlock(arena,size) == 0)
+		Writer_Data.Stage_Arena_Locked = TRUE;
+	else
+	{
+		error_number = errno;
+		Writer_Data.Stage_Arena_Locked = FALSE;
+#if MOPTOP_DEBUG > 1
+		Moptop_General_Log_Format("writer","moptop_writer.c","Writer_Stage_Arena_Allocate",LOG_VERBOSITY_TERSE,
+					  "WRITER","Failed to lock %lu byte staging arena into memory (%d), "
+					  "using it unlocked.",(unsigned long)size,error_number);
+#endif
+	}
+	return TRUE;
+}
+
+/**
+ * Reserve space for an image in the staging arena. The arena is used as a circular buffer: images are laid out
+ * one after the other from Writer_Data.Stage_Tail, and freed (by the staging flush thread) in the same order 
+ * from Writer_Data.Stage_Head. An image is never split, if it does not fit between the tail and the end of the
+ * arena it is put at the start of the arena instead, and the unused space at the end is reserved with it.
+ * Writer_Data.Statistics.Stage_Used holds the number of bytes reserved, which distinguishes a full arena from
+ * an empty one when the head and tail are at the same offset.
+ * This must be called with Writer_Data.Mutex held.
+ * @param length The length of the image in bytes, which must not be larger than the arena.
+ * @param offset The address of a size_t, on a successful return set to the offset of the reserved space.
+ * @param reserved_length The address of a size_t, on a successful return set to the number of bytes reserved,
+ *        including any unused space skipped at the end of the arena.
+ * @return The routine returns TRUE if the space was reserved, and FALSE if there is not enough free space.
+ * @see #Writer_Data
+ */
+static int Writer_Stage_Space_Get(size_t length,size_t *offset,size_t *reserved_length)
+{
+	size_t used;
+
+	used = (size_t)Writer_Data.Statistics.Stage_Used;
+	if(used == 0)
+	{
+		Writer_Data.Stage_Head = 0;
+		Writer_Data.Stage_Tail = 0;
+	}
+	if((used == 0)||(Writer_Data.Stage_Tail > Writer_Data.Stage_Head))
+	{
+		/* free space is from the tail to the end of the arena, and from the start of the arena to the head */
+		if(Writer_Data.Stage_Arena_Size-Writer_Data.Stage_Tail >= length)
+		{
+			(*offset) = Writer_Data.Stage_Tail;
+			(*reserved_length) = length;
+		}
+		else if(Writer_Data.Stage_Head >= length)
+		{
+			(*offset) = 0;
+			(*reserved_length) = length+(Writer_Data.Stage_Arena_Size-Writer_Data.Stage_Tail);
+		}
+		else
+			return FALSE;
+	}
+	else if(Writer_Data.Stage_Tail < Writer_Data.Stage_Head)
+	{
+		/* the staged images wrap around the end of the arena, free space is from the tail to the head */
+		if(Writer_Data.Stage_Head-Writer_Data.Stage_Tail >= length)
+		{
+			(*offset) = Writer_Data.Stage_Tail;
+			(*reserved_length) = length;
+		}
+		else
+			return FALSE;
+	}
+	else /* the tail has caught up with the head, the arena is full */
+		return FALSE;
+	Writer_Data.Stage_Tail = (*offset)+length;
+	Writer_Data.Statistics.Stage_Used += (*reserved_length);
+	return TRUE;
+}
+
+/**
+ * The staging flush thread's start routine.
+ * <ul>
+ * <li>We set the thread's priority to the "normal" priority using Moptop_General_Thread_Priority_Set_Normal.
+ * <li>We loop:
+ *     <ul>
+ *     <li>We wait for the oldest staged image to be ready, or Writer_Data.Stage_Stop to be set.
+ *     <li>If there are no staged images (and therefore Writer_Data.Stage_Stop is TRUE) we exit the loop.
+ *     <li>If the image was staged successfully, and no previous frame failed to be written, we write it to 
+ *         disk and publish it by calling Writer_Stage_Flush. If this fails we set Writer_Data.Failed, and 
+ *         (if this is the first failure) copy the error into Writer_Data.Error_Number / Writer_Data.Error_String,
+ *         take the frame off the Frames_Written statistic (it was counted when it was staged),
+ *         and wake up the acquisition thread if it is waiting for a free frame.
+ *     <li>We remove the image from the list, free it's space in the arena, update the staging statistics, 
+ *         and wake up any writer thread waiting for space.
+ *     </ul>
+ * </ul>
+ * Images are flushed in the order their space was reserved, one at a time.
+ * @param user_arg Thread argument, not used.
+ * @return The routine returns NULL.
+ * @see #Writer_Data
+ * @see #Writer_Stage_Struct
+ * @see #Writer_Stage_Flush
+ * @see moptop_general.html#Moptop_General_Error
+ * @see moptop_general.html#Moptop_General_Thread_Priority_Set_Normal
+ */
+static void *Writer_Stage_Thread(void *user_arg)
+{
+	struct Writer_Stage_Struct *stage = NULL;
+	int failed,flush_retval;
+
+	if(!Moptop_General_Thread_Priority_Set_Normal())
+		Moptop_General_Error("writer","moptop_writer.c","Writer_Stage_Thread",LOG_VERBOSITY_VERY_TERSE,"WRITER");
+	while(TRUE)
+	{
+		pthread_mutex_lock(&(Writer_Data.Mutex));
+		while(((Writer_Data.Stage_First == NULL)||(Writer_Data.Stage_First->Is_Ready == FALSE)) &&
+		      ((Writer_Data.Stage_First != NULL)||(Writer_Data.Stage_Stop == FALSE)))
+		{
+			pthread_cond_wait(&(Writer_Data.Stage_Ready_Condition),&(Writer_Data.Mutex));
+		}
+		if(Writer_Data.Stage_First == NULL)
+		{
+			pthread_mutex_unlock(&(Writer_Data.Mutex));
+			break;
+		}
+		stage = Writer_Data.Stage_First;
+		failed = Writer_Data.Failed;
+		pthread_mutex_unlock(&(Writer_Data.Mutex));
+		/* once a frame has failed to be written, discard the rest */
+		flush_retval = FALSE;
+		if((failed == FALSE)&&(strlen(stage->Filename) > 0))
+		{
+			flush_retval = Writer_Stage_Flush(stage);
+			if(flush_retval == FALSE)
+			{
+				pthread_mutex_lock(&(Writer_Data.Mutex));
+				if(Writer_Data.Failed == FALSE)
+				{
+					Writer_Data.Failed = TRUE;
+					Writer_Data.Error_Number = Moptop_General_Error_Number;
+					strcpy(Writer_Data.Error_String,Moptop_General_Error_String);
+				}
+				/* the frame was counted as written when it was staged */
+				Writer_Data.Statistics.Frames_Written--;
+				pthread_cond_broadcast(&(Writer_Data.Free_Condition));
+				pthread_mutex_unlock(&(Writer_Data.Mutex));
+				Moptop_General_Error("writer","moptop_writer.c","Writer_Stage_Thread",
+						     LOG_VERBOSITY_VERY_TERSE,"WRITER");
+			}
+		}
+		/* free the image's space in the arena */
+		pthread_mutex_lock(&(Writer_Data.Mutex));
+		Writer_Data.Stage_First = stage->Next;
+		if(Writer_Data.Stage_First == NULL)
+			Writer_Data.Stage_Last = NULL;
+		Writer_Data.Stage_Head = stage->Offset+stage->Length;
+		Writer_Data.Statistics.Stage_Used -= stage->Reserved_Length;
+		Writer_Data.Statistics.Stage_Frame_Count--;
+		if(flush_retval)
+			Writer_Data.Statistics.Stage_Frames_Flushed++;
+		pthread_cond_broadcast(&(Writer_Data.Stage_Space_Condition));
+		pthread_mutex_unlock(&(Writer_Data.Mutex));
+		free(stage);
+	}
+	return NULL;
+}
+
+/**
+ * Stop the staging flush thread, once it has flushed all the staged images, and wait for it to exit.
+ * <ul>
+ * <li>If the staging flush thread is not running we return 0.
+ * <li>We set Writer_Data.Stage_Stop to TRUE and wake up the staging flush thread.
+ * <li>We wait for the thread to exit using pthread_join.
+ * <li>We reset Writer_Data.Stage_Thread_Running and Writer_Data.Stage_Enable to FALSE.
+ * </ul>
+ * This must be called after the writer threads have been joined, so no more images can be staged.
+ * This routine does not set Moptop_General_Error_Number / Moptop_General_Error_String, so it can be
+ * used on error paths without overwriting the original error.
+ * @return The routine returns 0 on success, and the error returned by pthread_join on failure.
+ * @see #Writer_Data
+ */
+static int Writer_Stage_Thread_Join(void)
+{
+	int retval;
+
+	if(Writer_Data.Stage_Thread_Running == FALSE)
+		return 0;
+	pthread_mutex_lock(&(Writer_Data.Mutex));
+	Writer_Data.Stage_Stop = TRUE;
+	pthread_cond_broadcast(&(Writer_Data.Stage_Ready_Condition));
+	pthread_mutex_unlock(&(Writer_Data.Mutex));
+	retval = pthread_join(Writer_Data.Stage_Thread,NULL);
+	Writer_Data.Stage_Thread_Running = FALSE;
+	Writer_Data.Stage_Enable = FALSE;
+	return retval;
+}
+
+/**
+ * Write a staged image to disk, and publish it.
+ * <ul>
+ * <li>We start publishing the FITS image using CCD_Fits_Filename_Publish_Begin. Depending on the publish mode,
+ *     this either creates a file lock on the filename, or returns a hidden temporary filename to write to instead.
+ * <li>We write the formatted FITS image from the staging arena using CCD_Fits_Image_Buffer_Write, which uses the
+ *     configured FITS I/O backend.
+ * <li>We publish the FITS image using Moptop_Writer_Publish, which applies the durability policy as usual.
+ * </ul>
+ * If the write fails, the partially written file is removed using CCD_Fits_Filename_Publish_Abort, so it is never
+ * published.
+ * The filename lock (publish begin) and write times are added to the FILENAME_LOCK and STAGE_FLUSH timing 
+ * histograms. This must be called without holding Writer_Data.Mutex.
+ * @param stage The staged image to write.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Writer_Data
+ * @see #Writer_Stage_Struct
+ * @see #Moptop_Writer_Publish
+ * @see moptop_general.html#Moptop_General_Error_Number
+ * @see moptop_general.html#Moptop_General_Error_String
+ * @see moptop_timing.html#Moptop_Timing_Add
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Begin
+ * @see ../ccd/cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Abort
+ * @see ../ccd/cdocs/ccd_fits_image.html#CCD_Fits_Image_Buffer_Write
+ */
+static int Writer_Stage_Flush(struct Writer_Stage_Struct *stage)
+{
+	struct timespec start_time,end_time;
+	char write_filename[MOPTOP_WRITER_FILENAME_LENGTH];
+
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Filename_Publish_Begin(stage->Filename,write_filename,MOPTOP_WRITER_FILENAME_LENGTH))
+	{
+		Moptop_General_Error_Number = 833;
+		sprintf(Moptop_General_Error_String,"Writer_Stage_Flush: Failed to lock '%s'.",stage->Filename);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(Writer_Data.Timing_Set,MOPTOP_TIMING_TYPE_FILENAME_LOCK,start_time,end_time);
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Image_Buffer_Write(write_filename,Writer_Data.Stage_Arena+stage->Offset,stage->Length))
+	{
+		CCD_Fits_Filename_Publish_Abort(write_filename);
+		Moptop_General_Error_Number = 834;
+		sprintf(Moptop_General_Error_String,"Writer_Stage_Flush: Failed to write '%s'.",stage->Filename);
+		return FALSE;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	Moptop_Timing_Add(Writer_Data.Timing_Set,MOPTOP_TIMING_TYPE_STAGE_FLUSH,start_time,end_time);
+#if MOPTOP_DEBUG > 5
+	Moptop_General_Log_Format("writer","moptop_writer.c","Writer_Stage_Flush",LOG_VERBOSITY_VERBOSE,"WRITER",
+				  "Flushed '%s' (%lu bytes) in %.3f s.",write_filename,(unsigned long)stage->Length,
+				  fdifftime(end_time,start_time));
+#endif
+	return Moptop_Writer_Publish(write_filename,stage->Group_Number,1);
+}
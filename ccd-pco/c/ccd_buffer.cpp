@@ -2,7 +2,11 @@
 ** Moptop PCO CCD library
 */
 /**
- *  Routines to control the output buffers.
+ * Routines to control the output buffers. CCD_BUFFER_COUNT page aligned image buffers are allocated, each large
+ * enough for a binning 1 image. Buffers can be used as a ring: CCD_Buffer_Acquire returns the next free buffer
+ * to read an image into, and the consumer of the image calls CCD_Buffer_Release when it has finished with it.
+ * This allows an image to be processed or saved whilst the next one is read out into another buffer,
+ * without copying it.
  * @author Chris Mottram
  * @version $Revision$
  */
@@ -13,9 +17,10 @@
 /**
  * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
  */
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200112L
 
 #include <errno.h>   /* Error number definitions */
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,14 +39,29 @@
  * <dl>
  * <dt>Image_Size_Bytes</dt> <dd>The image size in bytes, used to allocate image buffers in Image_Buffer_List.
  *                           Note extra space is allocated for the meta-data.</dd>
- * <dt>Image_Buffer</dt> <dd>An allocated image buffer.</dd>
+ * <dt>Allocated_Size_Bytes</dt> <dd>The allocated length of each image buffer in bytes, Image_Size_Bytes
+ *                                rounded up to a multiple of CCD_BUFFER_ALIGNMENT.</dd>
+ * <dt>Image_Buffer_List</dt> <dd>A list of allocated image buffers, of length CCD_BUFFER_COUNT.</dd>
+ * <dt>Mutex</dt> <dd>A mutex protecting In_Use_List, Free_Count and Next_Index, as buffers are acquired by the
+ *                    thread reading out images and released by the threads saving them.</dd>
+ * <dt>In_Use_List</dt> <dd>A list of booleans, of length CCD_BUFFER_COUNT, TRUE if the corresponding image buffer
+ *                          has been acquired (CCD_Buffer_Acquire) and not yet released (CCD_Buffer_Release).</dd>
+ * <dt>Free_Count</dt> <dd>The number of image buffers not in use.</dd>
+ * <dt>Next_Index</dt> <dd>The index of the image buffer to try first on the next CCD_Buffer_Acquire, so the buffers
+ *                         are used in turn.</dd>
  * </dl>
- * @see #BUFFER_COUNT
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_ALIGNMENT
  */
 struct Buffer_Struct
 {
 	int Image_Size_Bytes;
-	int *Image_Buffer;
+	int Allocated_Size_Bytes;
+	unsigned short *Image_Buffer_List[CCD_BUFFER_COUNT];
+	pthread_mutex_t Mutex;
+	int In_Use_List[CCD_BUFFER_COUNT];
+	int Free_Count;
+	int Next_Index;
 };
 
 /* internal variables */
@@ -53,23 +73,29 @@ static char rcsid[] = "$Id$";
  * The instance of Buffer_Struct that contains local data for this module. This is initialised as follows:
  * <dl>
  * <dt>Image_Size_Bytes</dt> <dd>0</dd>
- * <dt>Image_Buffer</dt> <dd>NULL</dd>
+ * <dt>Allocated_Size_Bytes</dt> <dd>0</dd>
+ * <dt>Image_Buffer_List</dt> <dd>{NULL,...}</dd>
+ * <dt>Mutex</dt> <dd>PTHREAD_MUTEX_INITIALIZER</dd>
+ * <dt>In_Use_List</dt> <dd>{FALSE,...}</dd>
+ * <dt>Free_Count</dt> <dd>0</dd>
+ * <dt>Next_Index</dt> <dd>0</dd>
  * </dl>
  */
 static struct Buffer_Struct Buffer_Data = 
 {
-	0,NULL
+	0,0,{NULL},PTHREAD_MUTEX_INITIALIZER,{FALSE},0,0
 };
 
 /**
  * Variable holding error code of last operation performed.
+ * Each thread has it's own copy, as the C layer's writer threads call these routines at the same time.
  */
-static int Buffer_Error_Number = 0;
+static __thread int Buffer_Error_Number = 0;
 /**
  * Local variable holding description of the last error that occured.
  * @see ccd_general.html#CCD_GENERAL_ERROR_STRING_LENGTH
  */
-static char Buffer_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
+static __thread char Buffer_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
 
 /* internal functions */
 
@@ -77,32 +103,51 @@ static char Buffer_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
 ** External Functions
 ** -------------------------------------------------------- */
 /**
- * Create the image buffer used to store read out data from the CCD.
+ * Create the image buffers used to store read out data from the CCD.
  * <ul>
- * <li>We set the image buffer Buffer_Data.Image_Buffer to NULL.
+ * <li>We set the image buffers in Buffer_Data.Image_Buffer_List to NULL, and mark them not in use.
  * <li>We call CCD_Setup_Dimensions with binning 1 to configure the PCO library. This also sets up the setup
  *     module to return the image size in bytes for binning 1.
  * <li>We call CCD_Setup_Get_Image_Size_Bytes to get the image size in bytes for binning 1 from the setup module.
  *     We store this in Buffer_Data.
- * <li>We allocate Buffer_Data.Image_Size_Bytes memory for the image buffer, 
- *     and store the allocated pointer in Buffer_Data.Image_Buffer. 
+ * <li>We round the image size up to a multiple of CCD_BUFFER_ALIGNMENT, and store this in 
+ *     Buffer_Data.Allocated_Size_Bytes.
+ * <li>For each of the CCD_BUFFER_COUNT image buffers, we allocate Buffer_Data.Allocated_Size_Bytes memory 
+ *     aligned to CCD_BUFFER_ALIGNMENT (using posix_memalign) for the image buffer, and store the allocated pointer 
+ *     in Buffer_Data.Image_Buffer_List. 
+ * <li>We set all the image buffers free.
  * </ul>
+ * The binning 1 image is the largest image the camera can produce, so the buffers are large enough for
+ * any later binning.
  * @return The routine returns TRUE on success and FALSE if an error occurs.
- * @see #BUFFER_COUNT
  * @see #Buffer_Error_Number
  * @see #Buffer_Error_String
  * @see #Buffer_Data
+ * @see #CCD_Buffer_Free
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_ALIGNMENT
  * @see ccd_general.html#CCD_General_Log_Format
  * @see ccd_setup.html#CCD_Setup_Dimensions
  * @see ccd_setup.html#CCD_Setup_Get_Image_Size_Bytes
  */
 int CCD_Buffer_Initialise(void)
 {
+	void *image_buffer = NULL;
+	int i,retval;
+
 #if LOGGING > 0
 	CCD_General_Log_Format(LOG_VERBOSITY_TERSE,"CCD_Buffer_Initialise: Started.");
 #endif /* LOGGING */
-	/* initialise the image buffer pointer to NULL */
-	Buffer_Data.Image_Buffer = NULL;
+	/* initialise the image buffer pointers to NULL */
+	pthread_mutex_lock(&(Buffer_Data.Mutex));
+	for(i=0; i < CCD_BUFFER_COUNT; i++)
+	{
+		Buffer_Data.Image_Buffer_List[i] = NULL;
+		Buffer_Data.In_Use_List[i] = FALSE;
+	}
+	Buffer_Data.Free_Count = 0;
+	Buffer_Data.Next_Index = 0;
+	pthread_mutex_unlock(&(Buffer_Data.Mutex));
 	/* set the binning to 1. This also updates setup's image size in bytes. */
 	if(!CCD_Setup_Dimensions(1))
 	{
@@ -113,27 +158,38 @@ int CCD_Buffer_Initialise(void)
 	/* save the pco library computed image size in bytes. This takes account of the binning (set
 	** to 1 above) */
 	Buffer_Data.Image_Size_Bytes = CCD_Setup_Get_Image_Size_Bytes();
+	Buffer_Data.Allocated_Size_Bytes = ((Buffer_Data.Image_Size_Bytes+CCD_BUFFER_ALIGNMENT-1)/CCD_BUFFER_ALIGNMENT)*
+		CCD_BUFFER_ALIGNMENT;
 #if LOGGING > 0
-	CCD_General_Log_Format(LOG_VERBOSITY_INTERMEDIATE,"CCD_Buffer_Initialise: Binned 1 image size %d bytes.",
-			       Buffer_Data.Image_Size_Bytes);
+	CCD_General_Log_Format(LOG_VERBOSITY_INTERMEDIATE,"CCD_Buffer_Initialise: Binned 1 image size %d bytes "
+			       "(%d bytes allocated).",Buffer_Data.Image_Size_Bytes,Buffer_Data.Allocated_Size_Bytes);
 #endif /* LOGGING */
 	/* allocate buffers */
+	for(i=0; i < CCD_BUFFER_COUNT; i++)
+	{
 #if LOGGING > 0
-	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Buffer_Initialise: Allocating image buffer of %d bytes size.",
-			       Buffer_Data.Image_Size_Bytes);
+		CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,
+				       "CCD_Buffer_Initialise: Allocating image buffer %d of %d bytes size.",
+				       i,Buffer_Data.Allocated_Size_Bytes);
 #endif /* LOGGING */
-	Buffer_Data.Image_Buffer = (int *)malloc(Buffer_Data.Image_Size_Bytes* sizeof(int));
-	if(Buffer_Data.Image_Buffer == NULL)
-	{
-		Buffer_Error_Number = 2;
-		sprintf(Buffer_Error_String,"CCD_Buffer_Initialise: Allocating %d bytes failed.",
-			Buffer_Data.Image_Size_Bytes);
-		return FALSE;
-	}
+		retval = posix_memalign(&image_buffer,CCD_BUFFER_ALIGNMENT,Buffer_Data.Allocated_Size_Bytes);
+		if(retval != 0)
+		{
+			CCD_Buffer_Free();
+			Buffer_Error_Number = 2;
+			sprintf(Buffer_Error_String,"CCD_Buffer_Initialise: Allocating image buffer %d of %d bytes failed (%d).",
+				i,Buffer_Data.Allocated_Size_Bytes,retval);
+			return FALSE;
+		}
+		Buffer_Data.Image_Buffer_List[i] = (unsigned short *)image_buffer;
 #if LOGGING > 0
-		CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Buffer_Initialise: Buffer = %p.",
-				       Buffer_Data.Image_Buffer);
+		CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Buffer_Initialise: Buffer %d = %p.",
+				       i,Buffer_Data.Image_Buffer_List[i]);
 #endif /* LOGGING */
+	}
+	pthread_mutex_lock(&(Buffer_Data.Mutex));
+	Buffer_Data.Free_Count = CCD_BUFFER_COUNT;
+	pthread_mutex_unlock(&(Buffer_Data.Mutex));
 #if LOGGING > 0
 	CCD_General_Log_Format(LOG_VERBOSITY_TERSE,"CCD_Buffer_Initialise: Finished.");
 #endif /* LOGGING */
@@ -143,26 +199,200 @@ int CCD_Buffer_Initialise(void)
 /**
  * Free previously allocated buffers.
  * <ul>
- * <li>We free the  allocated data pointed to by Buffer_Data.Image_Buffer and set the pointer to NULL.
+ * <li>We free the allocated data pointed to by each entry in Buffer_Data.Image_Buffer_List 
+ *     and set the pointer to NULL.
+ * <li>We mark all the buffers as not in use, and set the free count to zero, so nothing can be acquired.
  * </ul>
  * @see #Buffer_Data
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
  */
 int CCD_Buffer_Free(void)
 {
-	if(Buffer_Data.Image_Buffer != NULL)
-		free(Buffer_Data.Image_Buffer);
-	Buffer_Data.Image_Buffer = NULL;
+	int i;
+
+	pthread_mutex_lock(&(Buffer_Data.Mutex));
+	for(i=0; i < CCD_BUFFER_COUNT; i++)
+	{
+		if(Buffer_Data.Image_Buffer_List[i] != NULL)
+			free(Buffer_Data.Image_Buffer_List[i]);
+		Buffer_Data.Image_Buffer_List[i] = NULL;
+		Buffer_Data.In_Use_List[i] = FALSE;
+	}
+	Buffer_Data.Free_Count = 0;
+	Buffer_Data.Next_Index = 0;
+	pthread_mutex_unlock(&(Buffer_Data.Mutex));
 	return TRUE;
 }
 
 /**
- * Return the pointer used to store read out CCD images.
- * @return A pointer to the allocated memory, stored in Buffer_Data.Image_Buffer.
- * @see #CCD_Buffer_Get_Image_Buffer
+ * Return the pointer used to store read out CCD images. This is the first image buffer in the list,
+ * and is used by code that only needs to read out one image at a time. It should not be used at the same time 
+ * as CCD_Buffer_Acquire, which does not know about it.
+ * @return A pointer to the allocated memory, stored in Buffer_Data.Image_Buffer_List[0].
+ * @see #Buffer_Data
+ * @see #CCD_Buffer_Get_Image_Buffer_Index
  */
 void *CCD_Buffer_Get_Image_Buffer(void)
 {
-	return Buffer_Data.Image_Buffer;
+	return Buffer_Data.Image_Buffer_List[0];
+}
+
+/**
+ * Return one of the pointers used to store read out CCD images.
+ * @param index Which image buffer to return, from 0 to CCD_BUFFER_COUNT-1.
+ * @return A pointer to the allocated memory, stored in Buffer_Data.Image_Buffer_List[index], 
+ *         or NULL if index is out of range.
+ * @see #Buffer_Data
+ * @see #Buffer_Error_Number
+ * @see #Buffer_Error_String
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ */
+void *CCD_Buffer_Get_Image_Buffer_Index(int index)
+{
+	if((index < 0)||(index >= CCD_BUFFER_COUNT))
+	{
+		Buffer_Error_Number = 3;
+		sprintf(Buffer_Error_String,"CCD_Buffer_Get_Image_Buffer_Index: index %d out of range (0..%d).",
+			index,CCD_BUFFER_COUNT-1);
+		return NULL;
+	}
+	return Buffer_Data.Image_Buffer_List[index];
+}
+
+/**
+ * Return the number of image buffers allocated by CCD_Buffer_Initialise.
+ * @return The number of image buffers, CCD_BUFFER_COUNT.
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ */
+int CCD_Buffer_Get_Buffer_Count(void)
+{
+	return CCD_BUFFER_COUNT;
+}
+
+/**
+ * Acquire the next free image buffer to read an image into. The buffers are handed out in turn, starting after
+ * the last one acquired, so a buffer that has just been released is the last to be reused.
+ * The buffer remains in use until it is given back with CCD_Buffer_Release. This routine does not block:
+ * callers should limit the number of buffers they have in use at once to CCD_Buffer_Get_Buffer_Count.
+ * @param index The address of an integer, on a successful return this is set to the index of the acquired buffer,
+ *        which should be passed to CCD_Buffer_Release.
+ * @param image_buffer The address of a pointer, on a successful return this is set to the acquired image buffer,
+ *        of CCD_Buffer_Get_Image_Size_Bytes bytes.
+ * @return The routine returns TRUE on success and FALSE if an error occurs, including if there are no
+ *         free buffers.
+ * @see #Buffer_Data
+ * @see #Buffer_Error_Number
+ * @see #Buffer_Error_String
+ * @see #CCD_Buffer_Release
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ */
+int CCD_Buffer_Acquire(int *index,void **image_buffer)
+{
+	int i,buffer_index;
+
+	if((index == NULL)||(image_buffer == NULL))
+	{
+		Buffer_Error_Number = 4;
+		sprintf(Buffer_Error_String,"CCD_Buffer_Acquire: index (%p) or image_buffer (%p) was NULL.",
+			(void*)index,(void*)image_buffer);
+		return FALSE;
+	}
+	pthread_mutex_lock(&(Buffer_Data.Mutex));
+	if(Buffer_Data.Image_Buffer_List[0] == NULL)
+	{
+		pthread_mutex_unlock(&(Buffer_Data.Mutex));
+		Buffer_Error_Number = 5;
+		sprintf(Buffer_Error_String,"CCD_Buffer_Acquire: Image buffers have not been allocated.");
+		return FALSE;
+	}
+	if(Buffer_Data.Free_Count == 0)
+	{
+		pthread_mutex_unlock(&(Buffer_Data.Mutex));
+		Buffer_Error_Number = 6;
+		sprintf(Buffer_Error_String,"CCD_Buffer_Acquire: All %d image buffers are in use.",CCD_BUFFER_COUNT);
+		return FALSE;
+	}
+	/* find the next free buffer, starting from Next_Index. There must be one as Free_Count > 0. */
+	buffer_index = Buffer_Data.Next_Index;
+	for(i=0; i < CCD_BUFFER_COUNT; i++)
+	{
+		buffer_index = (Buffer_Data.Next_Index+i)%CCD_BUFFER_COUNT;
+		if(Buffer_Data.In_Use_List[buffer_index] == FALSE)
+			break;
+	}
+	Buffer_Data.In_Use_List[buffer_index] = TRUE;
+	Buffer_Data.Free_Count--;
+	Buffer_Data.Next_Index = (buffer_index+1)%CCD_BUFFER_COUNT;
+	(*index) = buffer_index;
+	(*image_buffer) = Buffer_Data.Image_Buffer_List[buffer_index];
+	pthread_mutex_unlock(&(Buffer_Data.Mutex));
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Buffer_Acquire: Acquired buffer %d (%p).",
+			       buffer_index,(*image_buffer));
+#endif /* LOGGING */
+	return TRUE;
+}
+
+/**
+ * Release an image buffer previously acquired with CCD_Buffer_Acquire, so it can be reused.
+ * This can be called from a different thread to the one that acquired the buffer.
+ * @param index The index of the buffer to release, as returned by CCD_Buffer_Acquire.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #Buffer_Data
+ * @see #Buffer_Error_Number
+ * @see #Buffer_Error_String
+ * @see #CCD_Buffer_Acquire
+ * @see ../cdocs/ccd_buffer.html#CCD_BUFFER_COUNT
+ */
+int CCD_Buffer_Release(int index)
+{
+	if((index < 0)||(index >= CCD_BUFFER_COUNT))
+	{
+		Buffer_Error_Number = 7;
+		sprintf(Buffer_Error_String,"CCD_Buffer_Release: index %d out of range (0..%d).",index,CCD_BUFFER_COUNT-1);
+		return FALSE;
+	}
+	pthread_mutex_lock(&(Buffer_Data.Mutex));
+	if(Buffer_Data.In_Use_List[index] == FALSE)
+	{
+		pthread_mutex_unlock(&(Buffer_Data.Mutex));
+		Buffer_Error_Number = 8;
+		sprintf(Buffer_Error_String,"CCD_Buffer_Release: Buffer %d is not in use.",index);
+		return FALSE;
+	}
+	Buffer_Data.In_Use_List[index] = FALSE;
+	Buffer_Data.Free_Count++;
+	pthread_mutex_unlock(&(Buffer_Data.Mutex));
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Buffer_Release: Released buffer %d.",index);
+#endif /* LOGGING */
+	return TRUE;
+}
+
+/**
+ * Return the number of image buffers that are not currently acquired.
+ * @return The number of free image buffers.
+ * @see #Buffer_Data
+ */
+int CCD_Buffer_Get_Free_Count(void)
+{
+	int free_count;
+
+	pthread_mutex_lock(&(Buffer_Data.Mutex));
+	free_count = Buffer_Data.Free_Count;
+	pthread_mutex_unlock(&(Buffer_Data.Mutex));
+	return free_count;
+}
+
+/**
+ * Return the size of each image buffer, in bytes. This is the size of a binning 1 image, the allocated length
+ * may be slightly larger (see CCD_BUFFER_ALIGNMENT).
+ * @return The size of each image buffer in bytes, as stored in Buffer_Data.Image_Size_Bytes.
+ * @see #Buffer_Data
+ */
+int CCD_Buffer_Get_Image_Size_Bytes(void)
+{
+	return Buffer_Data.Image_Size_Bytes;
 }
 
 /**
@@ -215,7 +445,7 @@ void CCD_Buffer_Error_String(char *error_string)
 	** without there being an error to display */
 	if(Buffer_Error_Number == 0)
 		sprintf(Buffer_Error_String,"Logic Error:No Error defined");
-	sprintf(error_string+strlen(error_string),"%s CCD_Exposure:Error(%d) : %s\n",time_string,
+	sprintf(error_string+strlen(error_string),"%s CCD_Buffer:Error(%d) : %s\n",time_string,
 		Buffer_Error_Number,Buffer_Error_String);
 }
 
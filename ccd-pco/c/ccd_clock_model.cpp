@@ -0,0 +1,770 @@
+/* ccd_clock_model.cpp
+** Moptop PCO CCD library
+*/
+/**
+ * Routines to model the PCO camera's internal clock with respect to UTC.
+ * The camera writes a BCD timestamp into each read out image's meta-data. This is converted to seconds since the
+ * epoch with CCD_Clock_Model_Date_To_Timespec, which caches the start of the current day rather than calling mktime
+ * for every frame (mktime consults the local timezone, which is slow and wrong when TZ is not UTC).
+ * The camera's clock drifts with respect to real time (see Fault #2745). Rather than resetting the camera clock
+ * every multrun, each read out frame adds a sample pairing the camera timestamp with the host's CLOCK_REALTIME
+ * (CCD_Clock_Model_Sample_Add), and an online least squares fit of (host time - camera time) against camera time
+ * is maintained. CCD_Clock_Model_Camera_To_UTC then uses the fit to return a drift corrected UTC time
+ * for a camera timestamp, with an estimate of it's uncertainty.
+ * The host timestamp is taken after the image has been read out and transferred, and after the acquisition thread
+ * has woken up, so it is always late. The fixed part of this latency (the read out and transfer time) is
+ * subtracted from each sample using the readout delay (CCD_Clock_Model_Readout_Delay_Set). The variable part
+ * (USB transfer and wakeup jitter) would bias the fit's mean offset late, so CCD_Clock_Model_Camera_To_UTC
+ * shifts the fitted line down to the lower envelope of the recent samples, i.e. to the samples with the least
+ * latency. The uncertainty estimate includes how well the lower envelope is determined by the number of samples in it.
+ * What remains is any error in the configured readout delay, which is not included in the uncertainty estimate.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>   /* Error number definitions */
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log_udp.h"
+#include "ccd_general.h"
+#include "ccd_clock_model.h"
+
+/* hash defines */
+/**
+ * The number of seconds in a day.
+ */
+#define CLOCK_MODEL_SECONDS_PER_DAY          (86400)
+/**
+ * The number of nanoseconds in a second.
+ */
+#define CLOCK_MODEL_ONE_SECOND_NS            (1000000000)
+/**
+ * The minimum number of samples the clock model must contain before new samples are checked for outliers.
+ */
+#define CLOCK_MODEL_OUTLIER_SAMPLE_COUNT_MIN (10)
+/**
+ * A new sample whose host time is later than the fit predicts by more than this many times the fit's scatter
+ * is treated as an outlier (the host was late taking it's timestamp) and rejected.
+ */
+#define CLOCK_MODEL_OUTLIER_SIGMA            (5.0)
+/**
+ * The minimum scatter (in seconds) used when checking a new sample for outliers, so scheduling jitter on the host
+ * does not reject good samples when the fit's scatter is very small.
+ */
+#define CLOCK_MODEL_OUTLIER_SCATTER_MIN      (0.001)
+/**
+ * If this many samples in a row are rejected as outliers, we assume one of the clocks has been stepped,
+ * and restart the clock model from the latest sample.
+ */
+#define CLOCK_MODEL_REJECT_COUNT_MAX         (10)
+/**
+ * The number of most recently accepted samples kept to find the lower envelope of the clock offsets.
+ */
+#define CLOCK_MODEL_ENVELOPE_SAMPLE_COUNT    (64)
+/**
+ * If the host latency is uniformly distributed over a width W (W = scatter*sqrt(12)), the smallest of n samples
+ * lies on average W/(n+1) above the true minimum latency, with a standard deviation of about W/(n+1).
+ * The uncertainty of the lower envelope is taken to be this many times W/(n+1), to allow for a latency
+ * distribution that is not uniform and a fit scatter estimated from the same samples.
+ */
+#define CLOCK_MODEL_ENVELOPE_SIGMA_FACTOR    (2.0)
+
+/* data types */
+/**
+ * Data type holding local data to ccd_clock_model. This consists of the following:
+ * <dl>
+ * <dt>Mutex</dt> <dd>A mutex protecting the rest of this structure, as samples are added by the thread reading out
+ *                    images, and the model's statistics can be queried by other threads.</dd>
+ * <dt>Day_Key</dt> <dd>The last date converted by CCD_Clock_Model_Date_To_Timespec, as (year*10000)+(month*100)+day,
+ *                      or -1 if no date has been converted yet.</dd>
+ * <dt>Day_Base</dt> <dd>The number of seconds since the epoch at the start (00:00:00 UTC) of Day_Key.</dd>
+ * <dt>Forgetting_Factor</dt> <dd>The factor the fit's accumulated weights are multiplied by before each new
+ *                                sample is added (0..1].</dd>
+ * <dt>Readout_Delay</dt> <dd>The fixed read out and transfer time (in seconds) between the end of an exposure and
+ *                            the host being able to timestamp it, subtracted from every sample.</dd>
+ * <dt>Sample_Count</dt> <dd>The number of samples added to the fit since it was last reset.</dd>
+ * <dt>Rejected_Count</dt> <dd>The number of samples rejected as outliers since the fit was last reset.</dd>
+ * <dt>Consecutive_Reject_Count</dt> <dd>The number of samples rejected as outliers since the last accepted one.</dd>
+ * <dt>Camera_Origin</dt> <dd>The camera time of the first sample since the last reset.
+ *                            The fit's X values are camera times relative to this.</dd>
+ * <dt>Weight</dt> <dd>The sum of the (decayed) weights of the samples in the fit.</dd>
+ * <dt>Mean_X</dt> <dd>The weighted mean camera time (relative to Camera_Origin) of the samples, in seconds.</dd>
+ * <dt>Mean_Y</dt> <dd>The weighted mean clock offset (host time - camera time) of the samples, in seconds.</dd>
+ * <dt>Sum_XX</dt> <dd>The weighted sum of squared deviations of the camera times from Mean_X.</dd>
+ * <dt>Sum_XY</dt> <dd>The weighted sum of the products of the deviations of the camera times and clock offsets
+ *                     from their means.</dd>
+ * <dt>Sum_YY</dt> <dd>The weighted sum of squared deviations of the clock offsets from Mean_Y.</dd>
+ * <dt>Envelope_X</dt> <dd>A ring buffer of the X values of the last CLOCK_MODEL_ENVELOPE_SAMPLE_COUNT
+ *                         accepted samples.</dd>
+ * <dt>Envelope_Y</dt> <dd>A ring buffer of the Y values of the same samples.</dd>
+ * <dt>Envelope_Count</dt> <dd>The number of samples in the ring buffers.</dd>
+ * <dt>Envelope_Index</dt> <dd>The index in the ring buffers the next accepted sample is written to.</dd>
+ * </dl>
+ * @see #CLOCK_MODEL_ENVELOPE_SAMPLE_COUNT
+ */
+struct Clock_Model_Struct
+{
+	pthread_mutex_t Mutex;
+	int Day_Key;
+	time_t Day_Base;
+	double Forgetting_Factor;
+	double Readout_Delay;
+	int Sample_Count;
+	int Rejected_Count;
+	int Consecutive_Reject_Count;
+	struct timespec Camera_Origin;
+	double Weight;
+	double Mean_X;
+	double Mean_Y;
+	double Sum_XX;
+	double Sum_XY;
+	double Sum_YY;
+	double Envelope_X[CLOCK_MODEL_ENVELOPE_SAMPLE_COUNT];
+	double Envelope_Y[CLOCK_MODEL_ENVELOPE_SAMPLE_COUNT];
+	int Envelope_Count;
+	int Envelope_Index;
+};
+
+/* internal variables */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * The instance of Clock_Model_Struct that contains local data for this module. This is initialised as follows:
+ * <dl>
+ * <dt>Mutex</dt> <dd>PTHREAD_MUTEX_INITIALIZER</dd>
+ * <dt>Day_Key</dt> <dd>-1</dd>
+ * <dt>Day_Base</dt> <dd>0</dd>
+ * <dt>Forgetting_Factor</dt> <dd>CCD_CLOCK_MODEL_DEFAULT_FORGETTING_FACTOR</dd>
+ * <dt>Readout_Delay</dt> <dd>0.0</dd>
+ * <dt>Sample_Count</dt> <dd>0</dd>
+ * <dt>Rejected_Count</dt> <dd>0</dd>
+ * <dt>Consecutive_Reject_Count</dt> <dd>0</dd>
+ * <dt>Camera_Origin</dt> <dd>{0,0}</dd>
+ * <dt>Weight</dt> <dd>0.0</dd>
+ * <dt>Mean_X</dt> <dd>0.0</dd>
+ * <dt>Mean_Y</dt> <dd>0.0</dd>
+ * <dt>Sum_XX</dt> <dd>0.0</dd>
+ * <dt>Sum_XY</dt> <dd>0.0</dd>
+ * <dt>Sum_YY</dt> <dd>0.0</dd>
+ * <dt>Envelope_X</dt> <dd>{0.0}</dd>
+ * <dt>Envelope_Y</dt> <dd>{0.0}</dd>
+ * <dt>Envelope_Count</dt> <dd>0</dd>
+ * <dt>Envelope_Index</dt> <dd>0</dd>
+ * </dl>
+ * @see ../cdocs/ccd_clock_model.html#CCD_CLOCK_MODEL_DEFAULT_FORGETTING_FACTOR
+ */
+static struct Clock_Model_Struct Clock_Model_Data =
+{
+	PTHREAD_MUTEX_INITIALIZER,-1,0,CCD_CLOCK_MODEL_DEFAULT_FORGETTING_FACTOR,0.0,0,0,0,{0,0},0.0,0.0,0.0,0.0,0.0,0.0,
+	{0.0},{0.0},0,0
+};
+
+/**
+ * Variable holding error code of last operation performed.
+ */
+static int Clock_Model_Error_Number = 0;
+/**
+ * Local variable holding description of the last error that occured.
+ * @see ccd_general.html#CCD_GENERAL_ERROR_STRING_LENGTH
+ */
+static char Clock_Model_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
+
+/* internal functions */
+static time_t Clock_Model_Days_From_Civil(int year,int month,int day);
+static void Clock_Model_Fit_Reset(void);
+static void Clock_Model_Fit_Add(double x,double y);
+static double Clock_Model_Fit_Slope(void);
+static double Clock_Model_Fit_Scatter(void);
+static double Clock_Model_Fit_Envelope(void);
+static double Clock_Model_Timespec_Diff(struct timespec t1,struct timespec t0);
+
+/* --------------------------------------------------------
+** External Functions
+** -------------------------------------------------------- */
+/**
+ * Convert a UTC date and time (as decoded from the camera's BCD timestamp) into a timespec (seconds since the epoch).
+ * This is equivalent to timegm, but the number of seconds since the epoch at the start of the day is cached
+ * in Clock_Model_Data, so for successive frames on the same day only the time of day is added.
+ * <ul>
+ * <li>We check the timestamp is not NULL and the date and time values are in range.
+ * <li>We lock Clock_Model_Data.Mutex.
+ * <li>If the date does not match Clock_Model_Data.Day_Key, we compute the number of days since the epoch using
+ *     Clock_Model_Days_From_Civil, and cache the seconds since the epoch at the start of the day in
+ *     Clock_Model_Data.Day_Base.
+ * <li>We unlock Clock_Model_Data.Mutex.
+ * <li>We add the time of day in seconds to the day base to get the timestamp's tv_sec, and set it's tv_nsec.
+ * </ul>
+ * @param year The year (including the century), e.g. 2026.
+ * @param month The month of the year (1..12).
+ * @param day The day of the month (1..31).
+ * @param hour The hour of the day (0..23).
+ * @param minute The minute of the hour (0..59).
+ * @param second The second of the minute (0..60).
+ * @param nanosecond The number of nanoseconds within the second (0..999999999).
+ * @param timestamp The address of a timespec structure. On a successful return this will be filled in
+ *        with the converted time.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #CLOCK_MODEL_SECONDS_PER_DAY
+ * @see #CLOCK_MODEL_ONE_SECOND_NS
+ * @see #CLOCK_MODEL_ENVELOPE_SIGMA_FACTOR
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Error_Number
+ * @see #Clock_Model_Error_String
+ * @see #Clock_Model_Days_From_Civil
+ */
+int CCD_Clock_Model_Date_To_Timespec(int year,int month,int day,int hour,int minute,int second,
+				     long nanosecond,struct timespec *timestamp)
+{
+	int day_key;
+	time_t day_base;
+
+	if(timestamp == NULL)
+	{
+		Clock_Model_Error_Number = 1;
+		sprintf(Clock_Model_Error_String,"CCD_Clock_Model_Date_To_Timespec:timestamp was NULL.");
+		return FALSE;
+	}
+	if((month < 1)||(month > 12)||(day < 1)||(day > 31))
+	{
+		Clock_Model_Error_Number = 2;
+		sprintf(Clock_Model_Error_String,"CCD_Clock_Model_Date_To_Timespec:Illegal date %04d-%02d-%02d.",
+			year,month,day);
+		return FALSE;
+	}
+	if((hour < 0)||(hour > 23)||(minute < 0)||(minute > 59)||(second < 0)||(second > 60)||
+	   (nanosecond < 0)||(nanosecond >= CLOCK_MODEL_ONE_SECOND_NS))
+	{
+		Clock_Model_Error_Number = 3;
+		sprintf(Clock_Model_Error_String,"CCD_Clock_Model_Date_To_Timespec:Illegal time %02d:%02d:%02d.%09ld.",
+			hour,minute,second,nanosecond);
+		return FALSE;
+	}
+	day_key = (year*10000)+(month*100)+day;
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	if(day_key != Clock_Model_Data.Day_Key)
+	{
+		Clock_Model_Data.Day_Base = Clock_Model_Days_From_Civil(year,month,day)*CLOCK_MODEL_SECONDS_PER_DAY;
+		Clock_Model_Data.Day_Key = day_key;
+	}
+	day_base = Clock_Model_Data.Day_Base;
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+	timestamp->tv_sec = day_base+(hour*3600)+(minute*60)+second;
+	timestamp->tv_nsec = nanosecond;
+	return TRUE;
+}
+
+/**
+ * Reset the clock model, discarding all samples. This should be called whenever the camera's clock is set,
+ * as samples taken before that no longer describe the camera's clock. The cached day base is not affected.
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Fit_Reset
+ * @see ccd_general.html#CCD_General_Log
+ */
+void CCD_Clock_Model_Reset(void)
+{
+#if LOGGING > 5
+	CCD_General_Log(LOG_VERBOSITY_VERBOSE,"CCD_Clock_Model_Reset: Resetting the camera clock model.");
+#endif /* LOGGING */
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	Clock_Model_Fit_Reset();
+	Clock_Model_Data.Rejected_Count = 0;
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+}
+
+/**
+ * Set the forgetting factor applied to the clock model's fit before each new sample is added.
+ * This does not change the samples already in the fit.
+ * @param forgetting_factor The forgetting factor, which must be greater than zero and no more than one.
+ *        1.0 weights all samples since the last reset equally.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Error_Number
+ * @see #Clock_Model_Error_String
+ */
+int CCD_Clock_Model_Forgetting_Factor_Set(double forgetting_factor)
+{
+	if((forgetting_factor <= 0.0)||(forgetting_factor > 1.0))
+	{
+		Clock_Model_Error_Number = 4;
+		sprintf(Clock_Model_Error_String,"CCD_Clock_Model_Forgetting_Factor_Set:"
+			"Illegal forgetting factor %.6f (0..1].",forgetting_factor);
+		return FALSE;
+	}
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	Clock_Model_Data.Forgetting_Factor = forgetting_factor;
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+	return TRUE;
+}
+
+/**
+ * Set the fixed delay between the end of an exposure and the host timestamp taken when it's image has been
+ * read out and transferred, which is subtracted from every subsequent sample's clock offset.
+ * The camera does not report this, so it has to be measured for each camera and read out mode.
+ * Any error in it appears directly as a constant error in the corrected times.
+ * @param readout_delay The delay in seconds, which must not be negative.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Error_Number
+ * @see #Clock_Model_Error_String
+ */
+int CCD_Clock_Model_Readout_Delay_Set(double readout_delay)
+{
+	if(readout_delay < 0.0)
+	{
+		Clock_Model_Error_Number = 8;
+		sprintf(Clock_Model_Error_String,"CCD_Clock_Model_Readout_Delay_Set:Illegal readout delay %.6f.",
+			readout_delay);
+		return FALSE;
+	}
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	Clock_Model_Data.Readout_Delay = readout_delay;
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+	return TRUE;
+}
+
+/**
+ * Add a sample to the clock model, pairing a camera timestamp with the host's CLOCK_REALTIME.
+ * <ul>
+ * <li>We check host_delay is not negative.
+ * <li>We lock Clock_Model_Data.Mutex.
+ * <li>If this is the first sample since the last reset, we use it's camera time as Clock_Model_Data.Camera_Origin.
+ * <li>We compute the sample's X (camera time relative to the origin) and Y (the clock offset, host time minus
+ *     host_delay minus Clock_Model_Data.Readout_Delay minus camera time) values, in seconds.
+ * <li>If there are at least CLOCK_MODEL_OUTLIER_SAMPLE_COUNT_MIN samples in the fit, we check whether Y is later
+ *     than the fit predicts by more than CLOCK_MODEL_OUTLIER_SIGMA times the fit's scatter
+ *     (at least CLOCK_MODEL_OUTLIER_SCATTER_MIN). If so the sample is rejected, unless CLOCK_MODEL_REJECT_COUNT_MAX
+ *     samples have been rejected in a row, in which case we assume a clock has been stepped and restart the fit.
+ * <li>We add the sample to the fit using Clock_Model_Fit_Add.
+ * <li>We unlock Clock_Model_Data.Mutex.
+ * </ul>
+ * @param camera_time The camera's timestamp, as converted by CCD_Clock_Model_Date_To_Timespec.
+ * @param host_time A timestamp from the host's CLOCK_REALTIME, taken host_delay seconds after camera_time.
+ * @param host_delay How long after the camera timestamp (in seconds) host_time was taken, not counting the
+ *        read out delay, for instance the exposure length if host_time was taken when the image was read out.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #CLOCK_MODEL_OUTLIER_SAMPLE_COUNT_MIN
+ * @see #CLOCK_MODEL_OUTLIER_SIGMA
+ * @see #CLOCK_MODEL_OUTLIER_SCATTER_MIN
+ * @see #CLOCK_MODEL_REJECT_COUNT_MAX
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Error_Number
+ * @see #Clock_Model_Error_String
+ * @see #Clock_Model_Fit_Reset
+ * @see #Clock_Model_Fit_Add
+ * @see #Clock_Model_Fit_Slope
+ * @see #Clock_Model_Fit_Scatter
+ * @see #Clock_Model_Timespec_Diff
+ * @see ccd_general.html#CCD_General_Log_Format
+ */
+int CCD_Clock_Model_Sample_Add(struct timespec camera_time,struct timespec host_time,double host_delay)
+{
+	double x,y,residual,scatter;
+
+	if(host_delay < 0.0)
+	{
+		Clock_Model_Error_Number = 5;
+		sprintf(Clock_Model_Error_String,"CCD_Clock_Model_Sample_Add:Illegal host delay %.6f.",host_delay);
+		return FALSE;
+	}
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	if(Clock_Model_Data.Sample_Count == 0)
+		Clock_Model_Data.Camera_Origin = camera_time;
+	x = Clock_Model_Timespec_Diff(camera_time,Clock_Model_Data.Camera_Origin);
+	y = Clock_Model_Timespec_Diff(host_time,camera_time)-host_delay-Clock_Model_Data.Readout_Delay;
+	if(Clock_Model_Data.Sample_Count >= CLOCK_MODEL_OUTLIER_SAMPLE_COUNT_MIN)
+	{
+		residual = y-(Clock_Model_Data.Mean_Y+(Clock_Model_Fit_Slope()*(x-Clock_Model_Data.Mean_X)));
+		scatter = Clock_Model_Fit_Scatter();
+		if(scatter < CLOCK_MODEL_OUTLIER_SCATTER_MIN)
+			scatter = CLOCK_MODEL_OUTLIER_SCATTER_MIN;
+		if(residual > (CLOCK_MODEL_OUTLIER_SIGMA*scatter))
+		{
+			Clock_Model_Data.Rejected_Count++;
+			Clock_Model_Data.Consecutive_Reject_Count++;
+			if(Clock_Model_Data.Consecutive_Reject_Count < CLOCK_MODEL_REJECT_COUNT_MAX)
+			{
+#if LOGGING > 5
+				CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Clock_Model_Sample_Add:"
+						       "Rejected sample with residual %.6f s (scatter %.6f s).",
+						       residual,scatter);
+#endif /* LOGGING */
+				pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+				return TRUE;
+			}
+#if LOGGING > 1
+			CCD_General_Log_Format(LOG_VERBOSITY_TERSE,"CCD_Clock_Model_Sample_Add:"
+					       "%d samples rejected in a row, restarting the clock model.",
+					       Clock_Model_Data.Consecutive_Reject_Count);
+#endif /* LOGGING */
+			Clock_Model_Fit_Reset();
+			Clock_Model_Data.Camera_Origin = camera_time;
+			x = 0.0;
+		}
+	}
+	Clock_Model_Data.Consecutive_Reject_Count = 0;
+	Clock_Model_Fit_Add(x,y);
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+	return TRUE;
+}
+
+/**
+ * Convert a camera timestamp into a drift corrected UTC time, using the clock model's fit.
+ * <ul>
+ * <li>We check utc_time and uncertainty are not NULL.
+ * <li>We lock Clock_Model_Data.Mutex.
+ * <li>If the model contains no samples, we return the camera time unchanged, with an uncertainty of
+ *     CCD_CLOCK_MODEL_UNCERTAINTY_UNKNOWN.
+ * <li>Otherwise we predict the clock offset at the camera time from the fit (the drift rate is only used once the
+ *     model contains CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN samples), move it down to the lower envelope of the
+ *     recent samples using Clock_Model_Fit_Envelope, and add it to the camera time.
+ * <li>If the model contains at least CCD_CLOCK_MODEL_UNCERTAINTY_SAMPLE_COUNT_MIN samples, the uncertainty is the
+ *     standard error of the fit at the camera time, combined with the uncertainty of the lower envelope
+ *     (CLOCK_MODEL_ENVELOPE_SIGMA_FACTOR times the latency width divided by the number of envelope samples plus one)
+ *     and the resolution of the camera timestamp.
+ *     Otherwise the uncertainty is CCD_CLOCK_MODEL_UNCERTAINTY_UNKNOWN. The uncertainty does not include any error
+ *     in the readout delay, which makes utc_time late.
+ * <li>We unlock Clock_Model_Data.Mutex.
+ * </ul>
+ * @param camera_time The camera's timestamp, as converted by CCD_Clock_Model_Date_To_Timespec.
+ * @param utc_time The address of a timespec structure. On a successful return this will be filled in
+ *        with the drift corrected UTC time.
+ * @param uncertainty The address of a double. On a successful return this will be filled in with the
+ *        estimated (1 sigma) uncertainty of utc_time in seconds, or CCD_CLOCK_MODEL_UNCERTAINTY_UNKNOWN.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #CLOCK_MODEL_ONE_SECOND_NS
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Error_Number
+ * @see #Clock_Model_Error_String
+ * @see #Clock_Model_Fit_Slope
+ * @see #Clock_Model_Fit_Scatter
+ * @see #Clock_Model_Fit_Envelope
+ * @see #Clock_Model_Timespec_Diff
+ * @see ../cdocs/ccd_clock_model.html#CCD_CLOCK_MODEL_TIMESTAMP_RESOLUTION
+ * @see ../cdocs/ccd_clock_model.html#CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN
+ * @see ../cdocs/ccd_clock_model.html#CCD_CLOCK_MODEL_UNCERTAINTY_SAMPLE_COUNT_MIN
+ * @see ../cdocs/ccd_clock_model.html#CCD_CLOCK_MODEL_UNCERTAINTY_UNKNOWN
+ */
+int CCD_Clock_Model_Camera_To_UTC(struct timespec camera_time,struct timespec *utc_time,double *uncertainty)
+{
+	double x,dx,offset,scatter,envelope_sigma,resolution_sigma;
+	long offset_ns;
+	time_t offset_sec;
+
+	if(utc_time == NULL)
+	{
+		Clock_Model_Error_Number = 6;
+		sprintf(Clock_Model_Error_String,"CCD_Clock_Model_Camera_To_UTC:utc_time was NULL.");
+		return FALSE;
+	}
+	if(uncertainty == NULL)
+	{
+		Clock_Model_Error_Number = 7;
+		sprintf(Clock_Model_Error_String,"CCD_Clock_Model_Camera_To_UTC:uncertainty was NULL.");
+		return FALSE;
+	}
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	if(Clock_Model_Data.Sample_Count == 0)
+	{
+		pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+		(*utc_time) = camera_time;
+		(*uncertainty) = CCD_CLOCK_MODEL_UNCERTAINTY_UNKNOWN;
+		return TRUE;
+	}
+	x = Clock_Model_Timespec_Diff(camera_time,Clock_Model_Data.Camera_Origin);
+	dx = x-Clock_Model_Data.Mean_X;
+	offset = Clock_Model_Data.Mean_Y+(Clock_Model_Fit_Slope()*dx)+Clock_Model_Fit_Envelope();
+	if((Clock_Model_Data.Sample_Count >= CCD_CLOCK_MODEL_UNCERTAINTY_SAMPLE_COUNT_MIN)&&
+	   (Clock_Model_Data.Sum_XX > 0.0))
+	{
+		scatter = Clock_Model_Fit_Scatter();
+		envelope_sigma = CLOCK_MODEL_ENVELOPE_SIGMA_FACTOR*scatter*sqrt(12.0)/
+			(((double)Clock_Model_Data.Envelope_Count)+1.0);
+		resolution_sigma = CCD_CLOCK_MODEL_TIMESTAMP_RESOLUTION/sqrt(12.0);
+		(*uncertainty) = sqrt((scatter*scatter*((1.0/Clock_Model_Data.Weight)+((dx*dx)/Clock_Model_Data.Sum_XX)))+
+				      (envelope_sigma*envelope_sigma)+(resolution_sigma*resolution_sigma));
+	}
+	else
+		(*uncertainty) = CCD_CLOCK_MODEL_UNCERTAINTY_UNKNOWN;
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+	/* add the offset to the camera time */
+	offset_sec = (time_t)floor(offset);
+	offset_ns = (long)((offset-((double)offset_sec))*((double)CLOCK_MODEL_ONE_SECOND_NS));
+	utc_time->tv_sec = camera_time.tv_sec+offset_sec;
+	utc_time->tv_nsec = camera_time.tv_nsec+offset_ns;
+	if(utc_time->tv_nsec >= CLOCK_MODEL_ONE_SECOND_NS)
+	{
+		utc_time->tv_sec++;
+		utc_time->tv_nsec -= CLOCK_MODEL_ONE_SECOND_NS;
+	}
+	return TRUE;
+}
+
+/**
+ * Get the number of samples added to the clock model's fit since it was last reset.
+ * @return The number of samples.
+ * @see #Clock_Model_Data
+ */
+int CCD_Clock_Model_Get_Sample_Count(void)
+{
+	int sample_count;
+
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	sample_count = Clock_Model_Data.Sample_Count;
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+	return sample_count;
+}
+
+/**
+ * Get the number of samples rejected as outliers since the clock model was last reset.
+ * @return The number of rejected samples.
+ * @see #Clock_Model_Data
+ */
+int CCD_Clock_Model_Get_Rejected_Count(void)
+{
+	int rejected_count;
+
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	rejected_count = Clock_Model_Data.Rejected_Count;
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+	return rejected_count;
+}
+
+/**
+ * Get the currently fitted drift rate of the camera clock with respect to the host clock.
+ * @return The drift rate, in seconds per second (a positive value means the camera clock runs slow). This is
+ *         zero until the model contains CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN samples.
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Fit_Slope
+ */
+double CCD_Clock_Model_Get_Drift(void)
+{
+	double drift;
+
+	pthread_mutex_lock(&(Clock_Model_Data.Mutex));
+	drift = Clock_Model_Fit_Slope();
+	pthread_mutex_unlock(&(Clock_Model_Data.Mutex));
+	return drift;
+}
+
+/**
+ * Get the current value of the error number.
+ * @return The current value of the error number.
+ * @see #Clock_Model_Error_Number
+ */
+int CCD_Clock_Model_Get_Error_Number(void)
+{
+	return Clock_Model_Error_Number;
+}
+
+/**
+ * The error routine that reports any errors occuring in a standard way.
+ * @see #Clock_Model_Error_Number
+ * @see #Clock_Model_Error_String
+ * @see ccd_general.html#CCD_General_Get_Current_Time_String
+ */
+void CCD_Clock_Model_Error(void)
+{
+	char time_string[32];
+
+	CCD_General_Get_Current_Time_String(time_string,32);
+	/* if the error number is zero an error message has not been set up
+	** This is in itself an error as we should not be calling this routine
+	** without there being an error to display */
+	if(Clock_Model_Error_Number == 0)
+		sprintf(Clock_Model_Error_String,"Logic Error:No Error defined");
+	fprintf(stderr,"%s CCD_Clock_Model:Error(%d) : %s\n",time_string,
+		Clock_Model_Error_Number,Clock_Model_Error_String);
+}
+
+/**
+ * The error routine that reports any errors occuring in a standard way. This routine places the
+ * generated error string at the end of a passed in string argument.
+ * @param error_string A string to put the generated error in. This string should be initialised before
+ * being passed to this routine. The routine will try to concatenate it's error string onto the end
+ * of any string already in existance.
+ * @see #Clock_Model_Error_Number
+ * @see #Clock_Model_Error_String
+ * @see ccd_general.html#CCD_General_Get_Current_Time_String
+ */
+void CCD_Clock_Model_Error_String(char *error_string)
+{
+	char time_string[32];
+
+	CCD_General_Get_Current_Time_String(time_string,32);
+	/* if the error number is zero an error message has not been set up
+	** This is in itself an error as we should not be calling this routine
+	** without there being an error to display */
+	if(Clock_Model_Error_Number == 0)
+		sprintf(Clock_Model_Error_String,"Logic Error:No Error defined");
+	sprintf(error_string+strlen(error_string),"%s CCD_Clock_Model:Error(%d) : %s\n",time_string,
+		Clock_Model_Error_Number,Clock_Model_Error_String);
+}
+
+/* =======================================
+**  internal functions
+** ======================================= */
+/**
+ * Compute the number of days since the epoch (1970-01-01) of a date in the proleptic Gregorian calendar.
+ * This is Howard Hinnant's days_from_civil algorithm, which does not depend on the local timezone.
+ * @param year The year (including the century).
+ * @param month The month of the year (1..12).
+ * @param day The day of the month (1..31).
+ * @return The number of days since the epoch.
+ */
+static time_t Clock_Model_Days_From_Civil(int year,int month,int day)
+{
+	int era,year_of_era,day_of_year,day_of_era;
+
+	/* years start in March, so the leap day is the last day of the year */
+	if(month <= 2)
+		year--;
+	era = (year >= 0 ? year : year-399)/400;
+	year_of_era = year-(era*400);                                        /* 0..399 */
+	day_of_year = ((153*(month > 2 ? month-3 : month+9))+2)/5+day-1;     /* 0..365 */
+	day_of_era = (year_of_era*365)+(year_of_era/4)-(year_of_era/100)+day_of_year; /* 0..146096 */
+	return ((time_t)era*146097)+(time_t)day_of_era-719468;
+}
+
+/**
+ * Reset the clock model's fit, discarding all samples. Clock_Model_Data.Mutex should be locked by the caller.
+ * @see #Clock_Model_Data
+ */
+static void Clock_Model_Fit_Reset(void)
+{
+	Clock_Model_Data.Sample_Count = 0;
+	Clock_Model_Data.Consecutive_Reject_Count = 0;
+	Clock_Model_Data.Camera_Origin.tv_sec = 0;
+	Clock_Model_Data.Camera_Origin.tv_nsec = 0;
+	Clock_Model_Data.Weight = 0.0;
+	Clock_Model_Data.Mean_X = 0.0;
+	Clock_Model_Data.Mean_Y = 0.0;
+	Clock_Model_Data.Sum_XX = 0.0;
+	Clock_Model_Data.Sum_XY = 0.0;
+	Clock_Model_Data.Sum_YY = 0.0;
+	Clock_Model_Data.Envelope_Count = 0;
+	Clock_Model_Data.Envelope_Index = 0;
+}
+
+/**
+ * Add a sample to the clock model's weighted least squares fit. The accumulated weights are first multiplied by
+ * Clock_Model_Data.Forgetting_Factor, and then the sample is added with a weight of one, updating the weighted
+ * means and sums of (co)deviations incrementally (West's algorithm), which avoids the loss of precision of
+ * accumulating raw sums of squares. The sample is also written into the lower envelope ring buffers.
+ * Clock_Model_Data.Mutex should be locked by the caller.
+ * @param x The sample's camera time relative to Clock_Model_Data.Camera_Origin, in seconds.
+ * @param y The sample's clock offset (host time - camera time), in seconds.
+ * @see #Clock_Model_Data
+ * @see #CLOCK_MODEL_ENVELOPE_SAMPLE_COUNT
+ */
+static void Clock_Model_Fit_Add(double x,double y)
+{
+	double dx,dy;
+
+	Clock_Model_Data.Weight *= Clock_Model_Data.Forgetting_Factor;
+	Clock_Model_Data.Sum_XX *= Clock_Model_Data.Forgetting_Factor;
+	Clock_Model_Data.Sum_XY *= Clock_Model_Data.Forgetting_Factor;
+	Clock_Model_Data.Sum_YY *= Clock_Model_Data.Forgetting_Factor;
+	Clock_Model_Data.Weight += 1.0;
+	dx = x-Clock_Model_Data.Mean_X;
+	dy = y-Clock_Model_Data.Mean_Y;
+	Clock_Model_Data.Mean_X += dx/Clock_Model_Data.Weight;
+	Clock_Model_Data.Mean_Y += dy/Clock_Model_Data.Weight;
+	Clock_Model_Data.Sum_XX += dx*(x-Clock_Model_Data.Mean_X);
+	Clock_Model_Data.Sum_XY += dx*(y-Clock_Model_Data.Mean_Y);
+	Clock_Model_Data.Sum_YY += dy*(y-Clock_Model_Data.Mean_Y);
+	Clock_Model_Data.Sample_Count++;
+	Clock_Model_Data.Envelope_X[Clock_Model_Data.Envelope_Index] = x;
+	Clock_Model_Data.Envelope_Y[Clock_Model_Data.Envelope_Index] = y;
+	Clock_Model_Data.Envelope_Index = (Clock_Model_Data.Envelope_Index+1)%CLOCK_MODEL_ENVELOPE_SAMPLE_COUNT;
+	if(Clock_Model_Data.Envelope_Count < CLOCK_MODEL_ENVELOPE_SAMPLE_COUNT)
+		Clock_Model_Data.Envelope_Count++;
+}
+
+/**
+ * Return the slope (drift rate) of the clock model's fit. Clock_Model_Data.Mutex should be locked by the caller.
+ * @return The slope of the fit, or 0.0 if the model contains fewer than CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN samples
+ *         or they were all taken at the same camera time.
+ * @see #Clock_Model_Data
+ * @see ../cdocs/ccd_clock_model.html#CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN
+ */
+static double Clock_Model_Fit_Slope(void)
+{
+	if((Clock_Model_Data.Sample_Count < CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN)||(Clock_Model_Data.Sum_XX <= 0.0))
+		return 0.0;
+	return Clock_Model_Data.Sum_XY/Clock_Model_Data.Sum_XX;
+}
+
+/**
+ * Return the scatter (residual standard deviation) of the samples about the clock model's fit.
+ * Clock_Model_Data.Mutex should be locked by the caller.
+ * @return The scatter in seconds, or 0.0 if the fit's weight is too small to estimate one.
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Fit_Slope
+ */
+static double Clock_Model_Fit_Scatter(void)
+{
+	double residual_sum;
+
+	if(Clock_Model_Data.Weight <= 2.0)
+		return 0.0;
+	residual_sum = Clock_Model_Data.Sum_YY-(Clock_Model_Fit_Slope()*Clock_Model_Data.Sum_XY);
+	if(residual_sum < 0.0)
+		residual_sum = 0.0;
+	return sqrt(residual_sum/(Clock_Model_Data.Weight-2.0));
+}
+
+/**
+ * Return the offset of the lower envelope of the recent samples from the clock model's fit, i.e. the most negative
+ * residual of the samples in the envelope ring buffers. The host timestamps are only ever late, so the samples with
+ * the least latency describe the clock offset better than the mean of all of them.
+ * Clock_Model_Data.Mutex should be locked by the caller.
+ * @return The envelope offset in seconds (zero or negative), or 0.0 if the model contains fewer than
+ *         CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN samples.
+ * @see #Clock_Model_Data
+ * @see #Clock_Model_Fit_Slope
+ * @see ../cdocs/ccd_clock_model.html#CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN
+ */
+static double Clock_Model_Fit_Envelope(void)
+{
+	double slope,residual,envelope;
+	int i;
+
+	if(Clock_Model_Data.Sample_Count < CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN)
+		return 0.0;
+	slope = Clock_Model_Fit_Slope();
+	envelope = 0.0;
+	for(i = 0; i < Clock_Model_Data.Envelope_Count; i++)
+	{
+		residual = Clock_Model_Data.Envelope_Y[i]-(Clock_Model_Data.Mean_Y+
+							   (slope*(Clock_Model_Data.Envelope_X[i]-Clock_Model_Data.Mean_X)));
+		if(residual < envelope)
+			envelope = residual;
+	}
+	return envelope;
+}
+
+/**
+ * Return the difference in seconds between two timespecs (t1-t0).
+ * @param t1 The later time.
+ * @param t0 The earlier time.
+ * @return The difference in seconds.
+ * @see #CLOCK_MODEL_ONE_SECOND_NS
+ */
+static double Clock_Model_Timespec_Diff(struct timespec t1,struct timespec t0)
+{
+	return ((double)(t1.tv_sec-t0.tv_sec))+(((double)(t1.tv_nsec-t0.tv_nsec))/((double)CLOCK_MODEL_ONE_SECOND_NS));
+}
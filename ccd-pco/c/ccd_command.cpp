@@ -42,6 +42,7 @@
 #define sprintf_s snprintf
 #include "PCO_errt_w.h"
 #include "ccd_general.h"
+#include "ccd_clock_model.h"
 #include "ccd_command.h"
 
 /* check CCD_COMMAND_SETUP_FLAG enums match PCO_EDGE_SETUP #defines.
@@ -535,12 +536,14 @@ int CCD_Command_Grabber_Post_Arm(void)
 }
 
 /**
- * Set the camera's time to the current time.
+ * Set the camera's time to the current time. As the camera's clock has been stepped, we also
+ * reset the camera clock model (CCD_Clock_Model_Reset).
  * @return The routine returns TRUE on success and FALSE if an error occurs.
  * @see #Command_Data
  * @see #Command_Error_Number
  * @see #Command_Error_String 
  * @see #Command_PCO_Get_Error_Text
+ * @see ccd_clock_model.html#CCD_Clock_Model_Reset
  * @see ccd_general.html#CCD_General_Log
  */
 int CCD_Command_Set_Camera_To_Current_Time(void)
@@ -566,6 +569,7 @@ int CCD_Command_Set_Camera_To_Current_Time(void)
 			Command_PCO_Get_Error_Text(pco_err));
 		return FALSE;
 	}
+	CCD_Clock_Model_Reset();
 #if LOGGING > 5
 	CCD_General_Log(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Command_Set_Camera_To_Current_Time: Finished.");
 #endif /* LOGGING */
@@ -2120,12 +2124,15 @@ int CCD_Command_Get_Image_Number_From_Metadata(void *image_buffer,size_t image_b
 }
 
 /**
- * Routine to extract the timestamp from the read out image data.
+ * Routine to extract the timestamp from the read out image data. The BCD date and time fields are decoded
+ * using Command_BCD_To_Decimal, and converted to seconds since the epoch (treating the camera time as UTC) using
+ * CCD_Clock_Model_Date_To_Timespec, which is much faster than mktime and does not depend on the local timezone.
  * @param image_buffer A pointer to the image data.
  * @param image_buffer_length The length of the image buffer in bytes.
  * @param camera_timestamp The address of a timespec structure. On a successful return this will be filled in
  *        with the extracted timestamp.
  * @see #Command_BCD_To_Decimal
+ * @see ccd_clock_model.html#CCD_Clock_Model_Date_To_Timespec
  * @see #Command_Error_Number
  * @see #Command_Error_String
  * @see ccd_general.html#CCD_General_Log
@@ -2134,7 +2141,6 @@ int CCD_Command_Get_Image_Number_From_Metadata(void *image_buffer,size_t image_b
 int CCD_Command_Get_Timestamp_From_Metadata(void *image_buffer,size_t image_buffer_length,
 					    struct timespec *camera_timestamp)
 {
-	struct tm timestamp_tm;
 	WORD *picbuf = NULL;
 	int century,year,month,day,hour,mins,secs,csecs,ccsec;
 	
@@ -2171,23 +2177,15 @@ int CCD_Command_Get_Timestamp_From_Metadata(void *image_buffer,size_t image_buff
 			      "CCD_Command_Get_Timestamp_From_Metadata: hour = %d, minutes = %d, seconds = %d, tenths/hundredths = %d, thousandths and ten thousandths = %d.",
 			       hour,mins,secs,csecs,ccsec);
 #endif /* LOGGING */
-	/* setup timestamp_tm */
-	timestamp_tm.tm_sec = secs;
-	timestamp_tm.tm_min = mins;
-	timestamp_tm.tm_hour = hour;
-	timestamp_tm.tm_mday = day;
-	timestamp_tm.tm_mon = month-1; /* tm_mon 0..11, month 1..12 */
-	timestamp_tm.tm_year = year; /* tm_year is year - 1900 */
-	if(century == 20)
-		timestamp_tm.tm_year += 100; /* tm_year is year - 1900 */
-	/* ignored by mktime
-	timestamp_tm.tm_wday = ;
-	timestamp_tm.tm_yday = ;
-	*/
-	timestamp_tm.tm_isdst = 0; /* no daylight saving time */
-	/* convert timestamp_tm to a time_t (seconds since the epoch) and store in camera_timestamp.tv_sec */
-	(*camera_timestamp).tv_sec = mktime(&timestamp_tm);
-	(*camera_timestamp).tv_nsec = (csecs*10000000)+(ccsec*100000);
+	/* convert to seconds since the epoch. csecs and ccsec are in units of 10ms and 100us respectively */
+	if(!CCD_Clock_Model_Date_To_Timespec((century*100)+year,month,day,hour,mins,secs,
+					     (csecs*10000000L)+(ccsec*100000L),camera_timestamp))
+	{
+		Command_Error_Number = 102;
+		sprintf(Command_Error_String,"CCD_Command_Get_Timestamp_From_Metadata:"
+			"Failed to convert camera timestamp to seconds since the epoch.");
+		return FALSE;
+	}
 #if LOGGING > 5
 	CCD_General_Log(LOG_VERBOSITY_VERBOSE,"CCD_Command_Get_Timestamp_From_Metadata: Finished.");
 #endif /* LOGGING */
@@ -18,6 +18,10 @@
  * Define this to enable scandir and alphasort in 'dirent.h', which are BSD 4.3 prototypes. (was _BSD_SOURCE).
  */
 #define _DEFAULT_SOURCE 1
+/**
+ * This hash define is needed to give us the renameat2 prototype and RENAME_NOREPLACE.
+ */
+#define _GNU_SOURCE 1
 
 #include <errno.h>
 #include <stdio.h>
@@ -32,12 +36,49 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "log_udp.h"
 #include "ccd_fits_filename.h"
 #include "ccd_general.h"
 
 /* hash defines */
+/**
+ * Format of the multrun state filename, created in the data directory. The parameters are the data directory and
+ * the instrument code. The filename starts with a '.' and does not end in '0.fits', so it is ignored
+ * by Fits_Filename_File_Select.
+ * @see #Fits_Filename_State_Filename_Get
+ */
+#define FITS_FILENAME_STATE_FILENAME_FORMAT   ("%s/.%c_multrun.state")
+/**
+ * The length of the buffer used to hold the multrun state filename (and it's temporary filename).
+ * This is the maximum data directory length, plus room for the state filename itself.
+ */
+#define FITS_FILENAME_STATE_FILENAME_LENGTH   (CCD_GENERAL_ERROR_STRING_LENGTH+32)
+/**
+ * The extension added to a FITS filename (as well as a leading '.') to make the hidden temporary filename 
+ * the FITS image is written to, in CCD_FITS_FILENAME_PUBLISH_MODE_RENAME publish mode.
+ * The extension means the temporary filename does not end in '.fits'.
+ * @see #CCD_Fits_Filename_Publish_Begin
+ */
+#define FITS_FILENAME_PUBLISH_EXTENSION       (".tmp")
+/**
+ * The extension the moptop multrun gives it's raw capture file, in place of '.fits'. A multrun has already been
+ * started if it's raw capture file exists.
+ * @see #Fits_Filename_State_File_Exists
+ */
+#define FITS_FILENAME_RAW_EXTENSION           (".raw")
+/**
+ * The number of filename pointers initially allocated in a filename list. The list is grown by doubling it's
+ * length when it fills up, so a 1600 frame multrun only reallocates it's list 5 times.
+ * @see #Fits_Filename_List_Length_Get
+ */
+#define FITS_FILENAME_LIST_MIN_LENGTH         (64)
+/**
+ * The length in bytes of each block of the filename arena. Each block holds several hundred FITS filenames.
+ * @see #Fits_Filename_Arena_Strdup
+ */
+#define FITS_FILENAME_ARENA_BLOCK_LENGTH      (64*1024)
 
 /* structure declarations */
 /**
@@ -50,8 +91,13 @@
  * <dt>Current_Multrun_Number</dt> <dd>Current MULTRUN number.</dd>
  * <dt>Current_Run_Number</dt> <dd>Current Run number.</dd>
  * <dt>Current_Window_Number</dt> <dd>Current Window number.</dd>
+ * <dt>Publish_Mode</dt> <dd>How finished FITS images are published to the data transfer processes.</dd>
+ * <dt>Publish_Syscall_Count</dt> <dd>The number of file system metadata system calls used to publish FITS images 
+ *                                    (by the lock file protocol or the rename), since the C layer started. 
+ *                                    Protected by Fits_Filename_Publish_Mutex.</dd>
  * </dl>
  * @see ccd_general.html#CCD_GENERAL_ERROR_STRING_LENGTH
+ * @see ../cdocs/ccd_fits_filename.html#CCD_FITS_FILENAME_PUBLISH_MODE
  */
 struct Fits_Filename_Struct
 {
@@ -61,6 +107,44 @@ struct Fits_Filename_Struct
 	int Current_Multrun_Number;
 	int Current_Run_Number;
 	int Current_Window_Number;
+	enum CCD_FITS_FILENAME_PUBLISH_MODE Publish_Mode;
+	int Publish_Syscall_Count;
+};
+
+/**
+ * Structure holding one block of memory in the filename arena.
+ * <dl>
+ * <dt>Next</dt> <dd>The next block in the arena, or NULL if this is the last block.</dd>
+ * <dt>Data</dt> <dd>The memory in this block filenames are copied into, allocated with the block.</dd>
+ * <dt>Length</dt> <dd>The length of Data in bytes.</dd>
+ * <dt>Used</dt> <dd>The number of bytes of Data currently holding filenames.</dd>
+ * </dl>
+ */
+struct Fits_Filename_Arena_Block_Struct
+{
+	struct Fits_Filename_Arena_Block_Struct *Next;
+	char *Data;
+	size_t Length;
+	size_t Used;
+};
+
+/**
+ * Structure holding the filename arena. The filenames in all the filename lists are copied into the arena,
+ * rather than being individually allocated. When the last list is freed (at the end of each 
+ * multrun/multbias/multdark) the arena is rewound, but it's blocks are kept and re-used by the next list, so
+ * after the first multrun the filename lists no longer allocate memory for each frame.
+ * <dl>
+ * <dt>Block_List</dt> <dd>The first block in the arena.</dd>
+ * <dt>Current_Block</dt> <dd>The block filenames are currently being copied into.</dd>
+ * <dt>List_Count</dt> <dd>The number of filename lists currently using the arena.</dd>
+ * </dl>
+ * @see #Fits_Filename_Arena_Block_Struct
+ */
+struct Fits_Filename_Arena_Struct
+{
+	struct Fits_Filename_Arena_Block_Struct *Block_List;
+	struct Fits_Filename_Arena_Block_Struct *Current_Block;
+	int List_Count;
 };
 
 /* internal data */
@@ -70,26 +154,55 @@ struct Fits_Filename_Struct
 static char rcsid[] = "$Id$";
 /**
  * Variable holding error code of last operation performed by the fits filename routines.
+ * Thread local, as several C layer writer threads can be writing FITS images at once.
  */
-static int Fits_Filename_Error_Number = 0;
+static __thread int Fits_Filename_Error_Number = 0;
 /**
  * Local variable holding description of the last error that occured.
  * @see ccd_general.html#CCD_GENERAL_ERROR_STRING_LENGT
  */
-static char Fits_Filename_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
+static __thread char Fits_Filename_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
 /**
  * The FITS filename data associated with the camera.
  * @see #Fits_Filename_Struct
  */
 static struct Fits_Filename_Struct Fits_Filename_Data = 
 {
-	"",CCD_FITS_FILENAME_DEFAULT_INSTRUMENT_CODE0,0,0,0,0
+	"",CCD_FITS_FILENAME_DEFAULT_INSTRUMENT_CODE0,0,0,0,0,CCD_FITS_FILENAME_PUBLISH_MODE_LOCK,0
 };
+/**
+ * Mutex protecting Fits_Filename_Data.Publish_Syscall_Count, as FITS images are published by several 
+ * writer threads at once.
+ * @see #Fits_Filename_Data
+ */
+static pthread_mutex_t Fits_Filename_Publish_Mutex = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * The arena the filenames in the filename lists are stored in.
+ * @see #Fits_Filename_Arena_Struct
+ */
+static struct Fits_Filename_Arena_Struct Fits_Filename_Arena = {NULL,NULL,0};
+/**
+ * Mutex protecting Fits_Filename_Arena.
+ * @see #Fits_Filename_Arena
+ */
+static pthread_mutex_t Fits_Filename_Arena_Mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* internal functions */
+static int Fits_Filename_Get_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,
+				      enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag,int run_number,
+				      int window_number,char *filename,int filename_length);
 static int Fits_Filename_Get_Date_Number(int *date_number);
 static int Fits_Filename_File_Select(const struct dirent *entry);
 static int Fits_Filename_Lock_Filename_Get(char *filename,char *lock_filename);
+static int Fits_Filename_State_Filename_Get(char *state_filename);
+static int Fits_Filename_State_Read(int *multrun_number);
+static int Fits_Filename_State_Multrun_Used(int multrun_number,int *is_used);
+static int Fits_Filename_State_Write(void);
+static int Fits_Filename_State_File_Exists(char *filename);
+static void Fits_Filename_Publish_Syscall_Count_Add(int count);
+static int Fits_Filename_List_Length_Get(int filename_count);
+static char *Fits_Filename_Arena_Strdup(char *filename);
+static void Fits_Filename_Arena_Rewind(void);
 static int fexist(char *filename);
 
 /* ----------------------------------------------------------------------------
@@ -97,8 +210,15 @@ static int fexist(char *filename);
 ** ---------------------------------------------------------------------------- */
 /**
  * Initialise FITS filename data, using the given data directory and the current (astronomical) day of year.
- * Retrieves current FITS images in directory, find the one with the highest multrun number, and sets
- * the current multrun number to it.
+ * We first try to retrieve the last multrun number from the multrun state file, using Fits_Filename_State_Read, 
+ * which is fast regardless of the number of files in the data directory. If the state file is behind (multruns
+ * were started whilst it could not be saved), Fits_Filename_State_Read scans forward past the multruns that were
+ * started.
+ * If the state file is missing or cannot be parsed, we fall back to retrieving current FITS images in directory, 
+ * find the one with the highest multrun number, and sets the current multrun number to it. 
+ * We then (re)write the state file using Fits_Filename_State_Write, so the next initialisation is fast.
+ * A failure to write the state file is logged but is not fatal, as the directory scan has found the
+ * current multrun number, and the next initialisation will just scan the data directory again.
  * @param instrument_code A character describing which instrument code to associate with this camera, which appears in
  *        the resulting FITS filenames.
  * @param data_dir A string containing the directory name containing FITS images.
@@ -106,6 +226,8 @@ static int fexist(char *filename);
  * @see #Fits_Filename_Data
  * @see #Fits_Filename_File_Select
  * @see #Fits_Filename_Get_Date_Number
+ * @see #Fits_Filename_State_Read
+ * @see #Fits_Filename_State_Write
  * @see #Fits_Filename_Error_Number
  * @see #Fits_Filename_Error_String
  * @see ccd_general.html#CCD_GENERAL_ERROR_STRING_LENGTH
@@ -154,6 +276,23 @@ int CCD_Fits_Filename_Initialise(char instrument_code,const char *data_dir)
 #if LOGGING > 5
 	CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Fits_Filename_Initialise:Current Date Number is %d.",
 			       Fits_Filename_Data.Current_Date_Number);
+#endif
+	/* try to get the last multrun number from the state file, without scanning the data directory */
+	if(Fits_Filename_State_Read(&multrun_number))
+	{
+		Fits_Filename_Data.Current_Multrun_Number = multrun_number;
+		Fits_Filename_Data.Current_Run_Number = 1;
+		Fits_Filename_Data.Current_Window_Number = 1;
+#if LOGGING > 1
+		CCD_General_Log_Format(LOG_VERBOSITY_INTERMEDIATE,"CCD_Fits_Filename_Initialise:"
+				       "Finished with multrun number %d from the state file.",
+				       Fits_Filename_Data.Current_Multrun_Number);
+#endif
+		return TRUE;
+	}
+#if LOGGING > 1
+	CCD_General_Log(LOG_VERBOSITY_INTERMEDIATE,"CCD_Fits_Filename_Initialise:"
+			"Multrun state file missing or invalid, scanning the data directory.");
 #endif
 	Fits_Filename_Data.Current_Multrun_Number = 0;
 	Fits_Filename_Data.Current_Run_Number = 0;
@@ -267,6 +406,14 @@ int CCD_Fits_Filename_Initialise(char instrument_code,const char *data_dir)
 	free(name_list);
 	Fits_Filename_Data.Current_Run_Number = 1;
 	Fits_Filename_Data.Current_Window_Number = 1;
+	if(!Fits_Filename_State_Write())
+	{
+#if LOGGING > 0
+		CCD_General_Log_Format(LOG_VERBOSITY_TERSE,"CCD_Fits_Filename_Initialise:"
+				       "Failed to save multrun state (%d):%s",Fits_Filename_Error_Number,
+				       Fits_Filename_Error_String);
+#endif
+	}
 #if LOGGING > 1
 	CCD_General_Log(LOG_VERBOSITY_INTERMEDIATE,"CCD_Fits_Filename_Initialise:Finished.");
 #endif
@@ -276,8 +423,13 @@ int CCD_Fits_Filename_Initialise(char instrument_code,const char *data_dir)
 /**
  * Start a new Multrun. Increments Current Multrun number, unless date has changed since last multrun,
  * when the date is changed and multrun number set to 1. Current run and Window number reset to 1.
+ * The new date and multrun number are then saved in the multrun state file (Fits_Filename_State_Write).
+ * A failure to save the state is logged but is not fatal, as on initialisation Fits_Filename_State_Read
+ * scans forward from the saved multrun number past any multruns that have already been started.
  * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
  * @see #Fits_Filename_Get_Date_Number
+ * @see #Fits_Filename_State_Write
+ * @see #Fits_Filename_State_Read
  * @see #Fits_Filename_Data
  * @see #Fits_Filename_Error_Number
  * @see #Fits_Filename_Error_String
@@ -298,6 +450,14 @@ int CCD_Fits_Filename_Next_Multrun(void)
 	/* this should get incremented to 1 before the filename is generated */
 	Fits_Filename_Data.Current_Run_Number = 0; 
 	Fits_Filename_Data.Current_Window_Number = 0;
+	if(!Fits_Filename_State_Write())
+	{
+#if LOGGING > 0
+		CCD_General_Log_Format(LOG_VERBOSITY_TERSE,"CCD_Fits_Filename_Next_Multrun:"
+				       "Failed to save multrun state (%d):%s",Fits_Filename_Error_Number,
+				       Fits_Filename_Error_String);
+#endif
+	}
 	return TRUE;
 }
 
@@ -335,75 +495,82 @@ int CCD_Fits_Filename_Next_Window(void)
  * @param filename Pointer to an array of characters filename_length long to store the filename.
  * @param filename_length The length of the filename array.
  * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
- * @see #Fits_Filename_Error_Number
- * @see #Fits_Filename_Error_String
  * @see #Fits_Filename_Data
- * @see #CCD_FITS_FILENAME_IS_EXPOSURE_TYPE
- * @see #CCD_FITS_FILENAME_EXPOSURE_TYPE
+ * @see #Fits_Filename_Get_Filename
  */
 int CCD_Fits_Filename_Get_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,
 				   enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag,
 				   char *filename,int filename_length)
 {
-	char tmp_buff[1100];
-	char exposure_type_string[7] = {'a','b','d','e','f','s','w'};
+	return Fits_Filename_Get_Filename(exposure_type,pipeline_flag,Fits_Filename_Data.Current_Run_Number,
+					  Fits_Filename_Data.Current_Window_Number,filename,filename_length);
+}
 
-	if(filename == NULL)
-	{
-		Fits_Filename_Error_Number = 3;
-		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Get_Filename:filename was NULL.");
-		return FALSE;
-	}
-	if(!CCD_FITS_FILENAME_IS_EXPOSURE_TYPE(exposure_type))
-	{
-		Fits_Filename_Error_Number = 6;
-		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Get_Filename:Illegal exposure type '%d'.",
-			exposure_type);
-		return FALSE;
-	}
-	if(!CCD_FITS_FILENAME_IS_PIPELINE_FLAG(pipeline_flag))
-	{
-		Fits_Filename_Error_Number = 7;
-		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Get_Filename:Illegal pipeline flag '%d'.",
-			pipeline_flag);
-		return FALSE;
-	}
-	/* check data dir is not too long : 1100 is length of tmp_buff, 37 is approx length of filename itself */
-	if(strlen(Fits_Filename_Data.Data_Dir) > (1100-37))
-	{
-		Fits_Filename_Error_Number = 8;
-		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Get_Filename:Data Dir too long (%lu).",
-			strlen(Fits_Filename_Data.Data_Dir));
-		return FALSE;
-	}
-	sprintf(tmp_buff,"%s/%c_%c_%d_%d_%d_%d_%d.fits",Fits_Filename_Data.Data_Dir,
-		Fits_Filename_Data.Instrument_Code,exposure_type_string[exposure_type],
-		Fits_Filename_Data.Current_Date_Number,
-		Fits_Filename_Data.Current_Multrun_Number,
-		Fits_Filename_Data.Current_Run_Number,
-		Fits_Filename_Data.Current_Window_Number,pipeline_flag);
-	if(strlen(tmp_buff) > (filename_length-1))
-	{
-		Fits_Filename_Error_Number = 4;
-		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Get_Filename:"
-			"Generated filename was too long(%lu).",strlen(tmp_buff));
-		return FALSE;
-	}
-	strcpy(filename,tmp_buff);
-	return TRUE;
+/**
+ * Returns a run level filename based on the current filename data. This is used for files containing all the
+ * windows in the current run (e.g. a FITS cube containing all the frames taken in one rotation of the rotator),
+ * and has a window number of zero (CCD_FITS_FILENAME_RUN_WINDOW_NUMBER). 
+ * Window numbers start at one, so this cannot clash with the filename of a single window.
+ * @param exposure_type What sort of exposure the filename will contain (exposure/bias/dark etc).
+ * @param pipeline_flag Pipeline processing level.
+ * @param filename Pointer to an array of characters filename_length long to store the filename.
+ * @param filename_length The length of the filename array.
+ * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
+ * @see #CCD_FITS_FILENAME_RUN_WINDOW_NUMBER
+ * @see #Fits_Filename_Get_Filename
+ */
+int CCD_Fits_Filename_Get_Run_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,
+				       enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag,
+				       char *filename,int filename_length)
+{
+	return Fits_Filename_Get_Filename(exposure_type,pipeline_flag,Fits_Filename_Data.Current_Run_Number,
+					  CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,filename,filename_length);
 }
 
 /**
- * Add filename to a list of filenames.
+ * Returns the filename of the specified run and window of the current multrun, without changing the 
+ * current run and window numbers. This allows the filenames of a multrun's frames to be generated in advance
+ * (e.g. to preallocate them), whilst the current filename data is being moved on by the multrun itself.
+ * @param exposure_type What sort of exposure the filename will contain (exposure/bias/dark etc).
+ * @param pipeline_flag Pipeline processing level.
+ * @param run_number The run number to put in the filename.
+ * @param window_number The window number to put in the filename.
+ * @param filename Pointer to an array of characters filename_length long to store the filename.
+ * @param filename_length The length of the filename array.
+ * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
+ * @see #Fits_Filename_Get_Filename
+ */
+int CCD_Fits_Filename_Get_Run_Window_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,
+					      enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag,int run_number,
+					      int window_number,char *filename,int filename_length)
+{
+	return Fits_Filename_Get_Filename(exposure_type,pipeline_flag,run_number,window_number,
+					  filename,filename_length);
+}
+
+/**
+ * Add filename to a list of filenames. The list of pointers is grown by doubling it's length when it fills up
+ * (see Fits_Filename_List_Length_Get), and the filename itself is copied into the filename arena 
+ * (see Fits_Filename_Arena_Strdup), rather than being individually allocated. The list should therefore only
+ * be freed using CCD_Fits_Filename_List_Free.
  * @param filename A FITS filename.
- * @param filename_list The address of a pointer to a list of filenames.
+ * @param filename_list The address of a pointer to a list of filenames. If a new list, the pointer should have
+ *        been initialised to NULL.
  * @param filename_count The number of filenames in the list.
  * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
  * @see #Fits_Filename_Error_Number
  * @see #Fits_Filename_Error_String
+ * @see #Fits_Filename_Arena
+ * @see #Fits_Filename_Arena_Mutex
+ * @see #Fits_Filename_List_Length_Get
+ * @see #Fits_Filename_Arena_Strdup
+ * @see #CCD_Fits_Filename_List_Free
  */
 int CCD_Fits_Filename_List_Add(char *filename,char ***filename_list,int *filename_count)
 {
+	char **new_filename_list = NULL;
+	int list_length;
+
 	if(filename == NULL)
 	{
 		Fits_Filename_Error_Number = 9;
@@ -422,22 +589,36 @@ int CCD_Fits_Filename_List_Add(char *filename,char ***filename_list,int *filenam
 		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_List_Add:filename_count is NULL.");
 		return FALSE;
 	}
+	pthread_mutex_lock(&Fits_Filename_Arena_Mutex);
 	if((*filename_list) == NULL)
 	{
-		(*filename_list) = (char **)malloc(sizeof(char *));
+		(*filename_count) = 0;
+		new_filename_list = (char **)malloc(FITS_FILENAME_LIST_MIN_LENGTH*sizeof(char *));
+		if(new_filename_list != NULL)
+			Fits_Filename_Arena.List_Count++;
 	}
 	else
 	{
-		(*filename_list) = (char **)realloc((*filename_list),((*filename_count)+1)*sizeof(char *));
+		/* the list is full when the filename count reaches the length it was allocated with */
+		list_length = Fits_Filename_List_Length_Get((*filename_count));
+		if((*filename_count) == list_length)
+		{
+			new_filename_list = (char **)realloc((*filename_list),(2*list_length)*sizeof(char *));
+		}
+		else
+			new_filename_list = (*filename_list);
 	}
-	if((*filename_list) == NULL)
+	if(new_filename_list == NULL)
 	{
+		pthread_mutex_unlock(&Fits_Filename_Arena_Mutex);
 		Fits_Filename_Error_Number = 12;
 		sprintf(Fits_Filename_Error_String,
 			"CCD_Fits_Filename_List_Add:failed to reallocate filename_list(%d).",(*filename_count));
 		return FALSE;
 	}
-	(*filename_list)[(*filename_count)] = strdup(filename);
+	(*filename_list) = new_filename_list;
+	(*filename_list)[(*filename_count)] = Fits_Filename_Arena_Strdup(filename);
+	pthread_mutex_unlock(&Fits_Filename_Arena_Mutex);
 	if((*filename_list)[(*filename_count)] == NULL)
 	{
 		Fits_Filename_Error_Number = 13;
@@ -450,17 +631,19 @@ int CCD_Fits_Filename_List_Add(char *filename,char ***filename_list,int *filenam
 }
 
 /**
- * Free the allocated filename list.
+ * Free the allocated filename list. The filenames themselves are stored in the filename arena, which is rewound
+ * (ready for re-use by the next multrun/multbias/multdark) when the last list using it is freed.
  * @param filename_list The list of filenames.
  * @param filename_count The number of filenames in the list.
  * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
  * @see #Fits_Filename_Error_Number
  * @see #Fits_Filename_Error_String
+ * @see #Fits_Filename_Arena
+ * @see #Fits_Filename_Arena_Mutex
+ * @see #Fits_Filename_Arena_Rewind
  */
 int CCD_Fits_Filename_List_Free(char ***filename_list,int *filename_count)
 {
-	int i;
-
 	if(filename_list == NULL)
 	{
 		Fits_Filename_Error_Number = 15;
@@ -473,11 +656,15 @@ int CCD_Fits_Filename_List_Free(char ***filename_list,int *filename_count)
 		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_List_Free:filename_count is NULL.");
 		return FALSE;
 	}
-	for(i = 0; i < (*filename_count); i ++)
+	if((*filename_list) != NULL)
 	{
-		free((*filename_list)[i]);
+		free((*filename_list));
+		pthread_mutex_lock(&Fits_Filename_Arena_Mutex);
+		Fits_Filename_Arena.List_Count--;
+		if(Fits_Filename_Arena.List_Count <= 0)
+			Fits_Filename_Arena_Rewind();
+		pthread_mutex_unlock(&Fits_Filename_Arena_Mutex);
 	}
-	free((*filename_list));
 	(*filename_list) = NULL;
 	(*filename_count) = 0;
 	return TRUE;
@@ -561,6 +748,7 @@ int CCD_Fits_Filename_Lock(char *filename)
 	/* O_CREAT|O_WRONLY|O_EXCL : create file, O_EXCL means the call will fail if the file already exists. 
 	** Note atomic creation probably fails on NFS systems. */
 	fd = open((const char*)lock_filename,O_CREAT|O_WRONLY|O_EXCL);
+	Fits_Filename_Publish_Syscall_Count_Add(1);
 	if(fd == -1)
 	{
 		open_errno = errno;
@@ -572,6 +760,7 @@ int CCD_Fits_Filename_Lock(char *filename)
 	}
 	/* close created file */
 	close(fd);
+	Fits_Filename_Publish_Syscall_Count_Add(1);
 #if LOGGING > 9
 	CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Fits_Filename_Lock:Lock file %s created.",
 			       lock_filename);
@@ -614,7 +803,8 @@ int CCD_Fits_Filename_UnLock(char *filename)
 	/* get lock filename */
 	if(!Fits_Filename_Lock_Filename_Get(filename,lock_filename))
 		return FALSE;
-	/* check existence */
+	/* check existence. fexist opens and closes the lock file. */
+	Fits_Filename_Publish_Syscall_Count_Add(2);
 	if(fexist(lock_filename))
 	{
 #if LOGGING > 9
@@ -623,6 +813,7 @@ int CCD_Fits_Filename_UnLock(char *filename)
 #endif
 		/* remove lock file */
 		retval = remove(lock_filename);
+		Fits_Filename_Publish_Syscall_Count_Add(1);
 		if(retval == -1)
 		{
 			remove_errno = errno;
@@ -640,6 +831,334 @@ int CCD_Fits_Filename_UnLock(char *filename)
 	return TRUE;
 }
 
+/**
+ * Set how finished FITS images are published to the data transfer processes, by 
+ * CCD_Fits_Filename_Publish_Begin and CCD_Fits_Filename_Publish_End.
+ * @param mode The publish mode to use.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #CCD_FITS_FILENAME_PUBLISH_MODE
+ * @see #CCD_FITS_FILENAME_IS_PUBLISH_MODE
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Error_Number
+ * @see #Fits_Filename_Error_String
+ */
+int CCD_Fits_Filename_Publish_Mode_Set(enum CCD_FITS_FILENAME_PUBLISH_MODE mode)
+{
+	if(!CCD_FITS_FILENAME_IS_PUBLISH_MODE(mode))
+	{
+		Fits_Filename_Error_Number = 30;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Mode_Set:Illegal publish mode '%d'.",mode);
+		return FALSE;
+	}
+	Fits_Filename_Data.Publish_Mode = mode;
+	return TRUE;
+}
+
+/**
+ * Get how finished FITS images are published to the data transfer processes.
+ * @return The current publish mode.
+ * @see #CCD_FITS_FILENAME_PUBLISH_MODE
+ * @see #Fits_Filename_Data
+ */
+enum CCD_FITS_FILENAME_PUBLISH_MODE CCD_Fits_Filename_Publish_Mode_Get(void)
+{
+	return Fits_Filename_Data.Publish_Mode;
+}
+
+/**
+ * Start writing a FITS image, without the data transfer processes seeing it until CCD_Fits_Filename_Publish_End 
+ * is called. This routine returns the filename the FITS image should actually be written to.
+ * <ul>
+ * <li>In CCD_FITS_FILENAME_PUBLISH_MODE_LOCK mode, we lock the FITS image using CCD_Fits_Filename_Lock, 
+ *     and it is written to it's final filename. Whilst holding the lock, we check the final filename does not
+ *     already exist (e.g. an earlier observation with the same multrun number), and fail (and unlock) if it does.
+ *     A file found at the final filename by CCD_Fits_Filename_Publish_Abort can therefore only have been 
+ *     created by the caller, so an abort never removes an earlier, already published, FITS image.
+ * <li>In CCD_FITS_FILENAME_PUBLISH_MODE_RENAME mode, no system calls are made. The FITS image is written to a 
+ *     hidden temporary filename in the same directory: the final filename's leaf with a '.' prepended and 
+ *     FITS_FILENAME_PUBLISH_EXTENSION appended.
+ * </ul>
+ * The filename to write to is derived using CCD_Fits_Filename_Publish_Write_Filename_Get.
+ * @param filename The final filename of the '.fits' FITS image.
+ * @param write_filename A buffer of at least write_filename_length characters. On return, this is filled with 
+ *        the filename to write the FITS image to.
+ * @param write_filename_length The length of the write_filename buffer.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #CCD_Fits_Filename_Lock
+ * @see #CCD_Fits_Filename_UnLock
+ * @see #CCD_Fits_Filename_Publish_End
+ * @see #CCD_Fits_Filename_Publish_Abort
+ * @see #CCD_Fits_Filename_Publish_Write_Filename_Get
+ * @see #Fits_Filename_Publish_Syscall_Count_Add
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Error_Number
+ * @see #Fits_Filename_Error_String
+ */
+int CCD_Fits_Filename_Publish_Begin(char *filename,char *write_filename,int write_filename_length)
+{
+	int retval;
+
+	if(filename == NULL)
+	{
+		Fits_Filename_Error_Number = 31;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Begin:filename was NULL.");
+		return FALSE;
+	}
+	if(write_filename == NULL)
+	{
+		Fits_Filename_Error_Number = 32;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Begin:write_filename was NULL.");
+		return FALSE;
+	}
+	if((strlen(filename)+strlen(FITS_FILENAME_PUBLISH_EXTENSION)+1) > (size_t)(write_filename_length-1))
+	{
+		Fits_Filename_Error_Number = 33;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Begin:"
+			"write_filename too short for '%s' (%d).",filename,write_filename_length);
+		return FALSE;
+	}
+	if(Fits_Filename_Data.Publish_Mode == CCD_FITS_FILENAME_PUBLISH_MODE_LOCK)
+	{
+		if(!CCD_Fits_Filename_Lock(filename))
+			return FALSE;
+		/* never write over (or on abort remove) an existing FITS image */
+		retval = access(filename,F_OK);
+		Fits_Filename_Publish_Syscall_Count_Add(1);
+		if(retval == 0)
+		{
+			CCD_Fits_Filename_UnLock(filename);
+			Fits_Filename_Error_Number = 43;
+			sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Begin:'%s' already exists.",
+				filename);
+			return FALSE;
+		}
+	}
+	return CCD_Fits_Filename_Publish_Write_Filename_Get(filename,write_filename,write_filename_length);
+}
+
+/**
+ * Get the filename a FITS image is written to between CCD_Fits_Filename_Publish_Begin and 
+ * CCD_Fits_Filename_Publish_End, without locking it. This lets a FITS image that has been written but not yet
+ * published be updated. In CCD_FITS_FILENAME_PUBLISH_MODE_LOCK mode this is the final filename, 
+ * in CCD_FITS_FILENAME_PUBLISH_MODE_RENAME mode it is the final filename's leaf with a '.' prepended and 
+ * FITS_FILENAME_PUBLISH_EXTENSION appended. No system calls are made.
+ * @param filename The final filename of the '.fits' FITS image.
+ * @param write_filename A buffer of at least write_filename_length characters. On return, this is filled with 
+ *        the filename the FITS image is written to.
+ * @param write_filename_length The length of the write_filename buffer.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #FITS_FILENAME_PUBLISH_EXTENSION
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Error_Number
+ * @see #Fits_Filename_Error_String
+ */
+int CCD_Fits_Filename_Publish_Write_Filename_Get(char *filename,char *write_filename,int write_filename_length)
+{
+	char *leaf_ptr = NULL;
+	int directory_length;
+
+	if(filename == NULL)
+	{
+		Fits_Filename_Error_Number = 40;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Write_Filename_Get:filename was NULL.");
+		return FALSE;
+	}
+	if(write_filename == NULL)
+	{
+		Fits_Filename_Error_Number = 41;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Write_Filename_Get:"
+			"write_filename was NULL.");
+		return FALSE;
+	}
+	if((strlen(filename)+strlen(FITS_FILENAME_PUBLISH_EXTENSION)+1) > (size_t)(write_filename_length-1))
+	{
+		Fits_Filename_Error_Number = 42;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Write_Filename_Get:"
+			"write_filename too short for '%s' (%d).",filename,write_filename_length);
+		return FALSE;
+	}
+	if(Fits_Filename_Data.Publish_Mode == CCD_FITS_FILENAME_PUBLISH_MODE_LOCK)
+	{
+		strcpy(write_filename,filename);
+		return TRUE;
+	}
+	/* directory/.leaf.tmp */
+	leaf_ptr = strrchr(filename,'/');
+	if(leaf_ptr == NULL)
+		leaf_ptr = filename;
+	else
+		leaf_ptr++;
+	directory_length = leaf_ptr-filename;
+	strncpy(write_filename,filename,directory_length);
+	write_filename[directory_length] = '.';
+	strcpy(write_filename+directory_length+1,leaf_ptr);
+	strcat(write_filename,FITS_FILENAME_PUBLISH_EXTENSION);
+	return TRUE;
+}
+
+/**
+ * Finish writing a FITS image, and make it visible to the data transfer processes.
+ * <ul>
+ * <li>In CCD_FITS_FILENAME_PUBLISH_MODE_LOCK mode, we unlock the FITS image using CCD_Fits_Filename_UnLock.
+ * <li>In CCD_FITS_FILENAME_PUBLISH_MODE_RENAME mode, we derive the final filename from the hidden temporary 
+ *     filename, by removing the '.' at the start of the leaf and the trailing FITS_FILENAME_PUBLISH_EXTENSION,
+ *     and rename the FITS image to it. The rename is atomic, so the final filename is only ever a complete 
+ *     FITS image. The rename never replaces an existing FITS image (renameat2 with RENAME_NOREPLACE, or link 
+ *     and unlink on file systems that do not support it), so a filename collision fails with an error 
+ *     rather than overwriting earlier data.
+ * </ul>
+ * Neither the rename nor the lock file removal is synced to disk here. A caller that needs the published
+ * filename to survive a crash must sync the FITS image's directory (fsync) afterwards.
+ * @param write_filename The filename the FITS image was written to, as returned by CCD_Fits_Filename_Publish_Begin.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #CCD_Fits_Filename_UnLock
+ * @see #CCD_Fits_Filename_Publish_Begin
+ * @see #FITS_FILENAME_PUBLISH_EXTENSION
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Publish_Syscall_Count_Add
+ * @see #Fits_Filename_Error_Number
+ * @see #Fits_Filename_Error_String
+ */
+int CCD_Fits_Filename_Publish_End(char *write_filename)
+{
+	char filename[CCD_GENERAL_ERROR_STRING_LENGTH];
+	char *leaf_ptr = NULL;
+	int directory_length,filename_length,extension_length,retval,rename_errno;
+
+	if(write_filename == NULL)
+	{
+		Fits_Filename_Error_Number = 34;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_End:write_filename was NULL.");
+		return FALSE;
+	}
+	if(Fits_Filename_Data.Publish_Mode == CCD_FITS_FILENAME_PUBLISH_MODE_LOCK)
+		return CCD_Fits_Filename_UnLock(write_filename);
+	if(strlen(write_filename) >= CCD_GENERAL_ERROR_STRING_LENGTH)
+	{
+		Fits_Filename_Error_Number = 35;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_End:write_filename was too long(%lu).",
+			strlen(write_filename));
+		return FALSE;
+	}
+	leaf_ptr = strrchr(write_filename,'/');
+	if(leaf_ptr == NULL)
+		leaf_ptr = write_filename;
+	else
+		leaf_ptr++;
+	extension_length = strlen(FITS_FILENAME_PUBLISH_EXTENSION);
+	filename_length = strlen(write_filename);
+	if((leaf_ptr[0] != '.')||(filename_length < extension_length)||
+	   (strcmp(write_filename+filename_length-extension_length,FITS_FILENAME_PUBLISH_EXTENSION) != 0))
+	{
+		Fits_Filename_Error_Number = 36;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_End:"
+			"'%s' is not a temporary publish filename.",write_filename);
+		return FALSE;
+	}
+	/* remove the leading '.' of the leaf, and the extension */
+	directory_length = leaf_ptr-write_filename;
+	strncpy(filename,write_filename,directory_length);
+	strcpy(filename+directory_length,leaf_ptr+1);
+	filename[filename_length-extension_length-1] = '\0';
+	retval = renameat2(AT_FDCWD,write_filename,AT_FDCWD,filename,RENAME_NOREPLACE);
+	rename_errno = errno;
+	Fits_Filename_Publish_Syscall_Count_Add(1);
+	if((retval != 0)&&((rename_errno == EINVAL)||(rename_errno == ENOSYS)))
+	{
+		/* RENAME_NOREPLACE not supported by this file system, link fails if filename already exists */
+		retval = link(write_filename,filename);
+		rename_errno = errno;
+		Fits_Filename_Publish_Syscall_Count_Add(1);
+		if(retval == 0)
+		{
+			unlink(write_filename);
+			Fits_Filename_Publish_Syscall_Count_Add(1);
+		}
+	}
+	if(retval != 0)
+	{
+		Fits_Filename_Error_Number = 37;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_End:Failed to rename '%s' to '%s' (%d).",
+			write_filename,filename,rename_errno);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Fits_Filename_Publish_End:Published %s.",filename);
+#endif
+	return TRUE;
+}
+
+/**
+ * Abandon writing a FITS image after a failure, so a partially written (or preallocated but unwritten) image is
+ * never made visible to the data transfer processes. CCD_Fits_Filename_Publish_End should only be called when the 
+ * FITS image has been completely written.
+ * <ul>
+ * <li>In CCD_FITS_FILENAME_PUBLISH_MODE_LOCK mode, we remove the partially written FITS image, and then unlock it
+ *     using CCD_Fits_Filename_UnLock. CCD_Fits_Filename_Publish_Begin has checked the FITS image did not exist
+ *     when it was locked, so any file removed was created by the caller, not an earlier observation.
+ * <li>In CCD_FITS_FILENAME_PUBLISH_MODE_RENAME mode, we remove the hidden temporary file.
+ * </ul>
+ * It is not an error if the FITS image was never created.
+ * @param write_filename The filename the FITS image was written to, as returned by CCD_Fits_Filename_Publish_Begin.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #CCD_Fits_Filename_UnLock
+ * @see #CCD_Fits_Filename_Publish_Begin
+ * @see #CCD_Fits_Filename_Publish_End
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Publish_Syscall_Count_Add
+ * @see #Fits_Filename_Error_Number
+ * @see #Fits_Filename_Error_String
+ */
+int CCD_Fits_Filename_Publish_Abort(char *write_filename)
+{
+	int retval,remove_errno;
+
+	if(write_filename == NULL)
+	{
+		Fits_Filename_Error_Number = 38;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Abort:write_filename was NULL.");
+		return FALSE;
+	}
+	retval = remove(write_filename);
+	remove_errno = errno;
+	Fits_Filename_Publish_Syscall_Count_Add(1);
+	if((retval != 0)&&(remove_errno != ENOENT))
+	{
+		/* still try to remove the lock, so the (partial) file does not stay locked forever */
+		if(Fits_Filename_Data.Publish_Mode == CCD_FITS_FILENAME_PUBLISH_MODE_LOCK)
+			CCD_Fits_Filename_UnLock(write_filename);
+		Fits_Filename_Error_Number = 39;
+		sprintf(Fits_Filename_Error_String,"CCD_Fits_Filename_Publish_Abort:Failed to remove '%s' (%d).",
+			write_filename,remove_errno);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Fits_Filename_Publish_Abort:Removed %s.",
+			       write_filename);
+#endif
+	if(Fits_Filename_Data.Publish_Mode == CCD_FITS_FILENAME_PUBLISH_MODE_LOCK)
+		return CCD_Fits_Filename_UnLock(write_filename);
+	return TRUE;
+}
+
+/**
+ * Get the number of file system metadata system calls used to publish FITS images since the C layer started:
+ * the open/close of each lock file, the open/close/remove of each unlock, or each rename.
+ * Callers can take the difference of two calls to measure the cost of publishing a multrun's FITS images.
+ * @return The number of publishing system calls made.
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Publish_Mutex
+ */
+int CCD_Fits_Filename_Publish_Syscall_Count_Get(void)
+{
+	int count;
+
+	pthread_mutex_lock(&Fits_Filename_Publish_Mutex);
+	count = Fits_Filename_Data.Publish_Syscall_Count;
+	pthread_mutex_unlock(&Fits_Filename_Publish_Mutex);
+	return count;
+}
+
 /**
  * Get the current value of ccd_fits_filename's error number.
  * @return The current value of ccd_fits_filename's error number.
@@ -693,6 +1212,73 @@ void CCD_Fits_Filename_Error_String(char *error_string)
 /* ----------------------------------------------------------------------------
 ** 		internal functions 
 ** ---------------------------------------------------------------------------- */
+/**
+ * Returns a filename based on the current filename data, and the specified run and window numbers.
+ * @param exposure_type What sort of exposure the filename will contain (exposure/bias/dark etc).
+ * @param pipeline_flag Pipeline processing level.
+ * @param run_number The run number to put in the filename.
+ * @param window_number The window number to put in the filename.
+ * @param filename Pointer to an array of characters filename_length long to store the filename.
+ * @param filename_length The length of the filename array.
+ * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
+ * @see #Fits_Filename_Error_Number
+ * @see #Fits_Filename_Error_String
+ * @see #Fits_Filename_Data
+ * @see #CCD_FITS_FILENAME_IS_EXPOSURE_TYPE
+ * @see #CCD_FITS_FILENAME_EXPOSURE_TYPE
+ */
+static int Fits_Filename_Get_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,
+				      enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag,int run_number,
+				      int window_number,char *filename,int filename_length)
+{
+	char tmp_buff[1100];
+	char exposure_type_string[7] = {'a','b','d','e','f','s','w'};
+
+	if((filename == NULL)||(filename_length < 1))
+	{
+		Fits_Filename_Error_Number = 3;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_Get_Filename:filename was NULL or too short (%d).",
+			filename_length);
+		return FALSE;
+	}
+	if(!CCD_FITS_FILENAME_IS_EXPOSURE_TYPE(exposure_type))
+	{
+		Fits_Filename_Error_Number = 6;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_Get_Filename:Illegal exposure type '%d'.",
+			exposure_type);
+		return FALSE;
+	}
+	if(!CCD_FITS_FILENAME_IS_PIPELINE_FLAG(pipeline_flag))
+	{
+		Fits_Filename_Error_Number = 7;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_Get_Filename:Illegal pipeline flag '%d'.",
+			pipeline_flag);
+		return FALSE;
+	}
+	/* check data dir is not too long : 1100 is length of tmp_buff, 37 is approx length of filename itself */
+	if(strlen(Fits_Filename_Data.Data_Dir) > (1100-37))
+	{
+		Fits_Filename_Error_Number = 8;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_Get_Filename:Data Dir too long (%lu).",
+			strlen(Fits_Filename_Data.Data_Dir));
+		return FALSE;
+	}
+	sprintf(tmp_buff,"%s/%c_%c_%d_%d_%d_%d_%d.fits",Fits_Filename_Data.Data_Dir,
+		Fits_Filename_Data.Instrument_Code,exposure_type_string[exposure_type],
+		Fits_Filename_Data.Current_Date_Number,
+		Fits_Filename_Data.Current_Multrun_Number,
+		run_number,window_number,pipeline_flag);
+	if(strlen(tmp_buff) >= (size_t)filename_length)
+	{
+		Fits_Filename_Error_Number = 4;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_Get_Filename:"
+			"Generated filename was too long(%lu).",strlen(tmp_buff));
+		return FALSE;
+	}
+	strcpy(filename,tmp_buff);
+	return TRUE;
+}
+
 /**
  * Get a date number. This is an integer of the form yyyymmdd, used as the date indicator
  * in a LT FITS filename. The date is for the start of night, i.e. between mignight and 12 noon the day before is used.
@@ -801,6 +1387,359 @@ static int Fits_Filename_Lock_Filename_Get(char *filename,char *lock_filename)
 	return TRUE;
 }
 
+/**
+ * Get the multrun state filename for the current data directory and instrument code.
+ * @param state_filename A buffer of at least FITS_FILENAME_STATE_FILENAME_LENGTH characters. 
+ *        On return, this is filled with the multrun state filename.
+ * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
+ * @see #FITS_FILENAME_STATE_FILENAME_FORMAT
+ * @see #FITS_FILENAME_STATE_FILENAME_LENGTH
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Error_Number
+ * @see #Fits_Filename_Error_String
+ */
+static int Fits_Filename_State_Filename_Get(char *state_filename)
+{
+	if(state_filename == NULL)
+	{
+		Fits_Filename_Error_Number = 25;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_State_Filename_Get:state_filename was NULL.");
+		return FALSE;
+	}
+	sprintf(state_filename,FITS_FILENAME_STATE_FILENAME_FORMAT,Fits_Filename_Data.Data_Dir,
+		Fits_Filename_Data.Instrument_Code);
+	return TRUE;
+}
+
+/**
+ * Retrieve the last multrun number from the multrun state file, and verify it.
+ * <ul>
+ * <li>We open the state file, and parse the instrument code, date number and multrun number from it. 
+ *     If the file does not exist, cannot be parsed, or is for another instrument code, the state is invalid.
+ * <li>If the state's date number is the current date number, the last multrun number is the state's multrun number.
+ *     Otherwise no multrun has been recorded for the current night, and the last multrun number is 0.
+ * <li>The state file is behind if one or more multruns were started whilst it could not be saved.
+ *     We check whether the next multrun has already been started using Fits_Filename_State_Multrun_Used,
+ *     and if so increment the last multrun number and check again, until we find a multrun number that is unused.
+ * </ul>
+ * This routine uses the current date number in Fits_Filename_Data, and temporarily changes the multrun and run 
+ * numbers to generate the filenames to check.
+ * @param multrun_number The address of an integer. On success, set to the last multrun number for the current date.
+ * @return The routine returns TRUE if the state is valid, and FALSE if it is missing, invalid or 
+ *         an error occurs. In all these cases, the data directory should be scanned instead.
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_State_Filename_Get
+ * @see #Fits_Filename_State_Multrun_Used
+ */
+static int Fits_Filename_State_Read(int *multrun_number)
+{
+	char state_filename[FITS_FILENAME_STATE_FILENAME_LENGTH];
+	FILE *fp = NULL;
+	char instrument_code;
+	int retval,date_number,state_multrun_number,is_used;
+
+	if(!Fits_Filename_State_Filename_Get(state_filename))
+		return FALSE;
+	fp = fopen(state_filename,"r");
+	if(fp == NULL)
+		return FALSE;
+	retval = fscanf(fp,"%c %d %d",&instrument_code,&date_number,&state_multrun_number);
+	fclose(fp);
+	if((retval != 3)||(instrument_code != Fits_Filename_Data.Instrument_Code)||(state_multrun_number < 0))
+	{
+#if LOGGING > 5
+		CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"Fits_Filename_State_Read:"
+				       "Failed to parse state file %s (%d).",state_filename,retval);
+#endif
+		return FALSE;
+	}
+	if(date_number != Fits_Filename_Data.Current_Date_Number)
+		state_multrun_number = 0;
+	/* skip any multruns started after the state was last saved */
+	do
+	{
+		if(!Fits_Filename_State_Multrun_Used(state_multrun_number+1,&is_used))
+			return FALSE;
+		if(is_used)
+		{
+#if LOGGING > 5
+			CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"Fits_Filename_State_Read:"
+					       "State file %s is behind, multrun %d has already been started.",
+					       state_filename,state_multrun_number+1);
+#endif
+			state_multrun_number++;
+		}
+	} while(is_used);
+	(*multrun_number) = state_multrun_number;
+	return TRUE;
+}
+
+/**
+ * Check whether a multrun has already been started, by checking whether any of the files it would start with 
+ * already exist (using Fits_Filename_State_File_Exists, which also checks for the hidden temporary and raw capture 
+ * versions of each filename), for each exposure type:
+ * <ul>
+ * <li>The unreduced first window of the first run (frame and stack output).
+ * <li>The unreduced run window of the first run (cube output).
+ * <li>The unreduced multrun window (CCD_FITS_FILENAME_RUN_WINDOW_NUMBER for both run and window numbers),
+ *     whose '.raw' version is the raw capture file.
+ * <li>The real time reduced first window and run window of the first run (calibrated frames, and the
+ *     real time Stokes reduction).
+ * </ul>
+ * This routine uses the current date number in Fits_Filename_Data, and changes the multrun and run 
+ * numbers to generate the filenames to check.
+ * @param multrun_number The multrun number to check.
+ * @param is_used The address of an integer. On success, set to TRUE if any of the multrun's files exist,
+ *        and FALSE if none do.
+ * @return The routine returns TRUE if the check succeeds, and FALSE if an error occurs.
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Get_Filename
+ * @see #Fits_Filename_State_File_Exists
+ * @see #CCD_FITS_FILENAME_RUN_WINDOW_NUMBER
+ */
+static int Fits_Filename_State_Multrun_Used(int multrun_number,int *is_used)
+{
+	char filename[FITS_FILENAME_STATE_FILENAME_LENGTH];
+	enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag_list[5] = {CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,
+		CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,
+		CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME,CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME};
+	int run_number_list[5] = {1,1,CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,1,1};
+	int window_number_list[5] = {1,CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,
+		1,CCD_FITS_FILENAME_RUN_WINDOW_NUMBER};
+	int exposure_type,i;
+
+	Fits_Filename_Data.Current_Multrun_Number = multrun_number;
+	Fits_Filename_Data.Current_Run_Number = 1;
+	(*is_used) = FALSE;
+	for(exposure_type = CCD_FITS_FILENAME_EXPOSURE_TYPE_ARC; 
+	    exposure_type <= CCD_FITS_FILENAME_EXPOSURE_TYPE_LAMPFLAT; exposure_type++)
+	{
+		for(i = 0; i < 5; i++)
+		{
+			if(!Fits_Filename_Get_Filename((enum CCD_FITS_FILENAME_EXPOSURE_TYPE)exposure_type,
+						       pipeline_flag_list[i],run_number_list[i],window_number_list[i],
+						       filename,FITS_FILENAME_STATE_FILENAME_LENGTH))
+				return FALSE;
+			if(Fits_Filename_State_File_Exists(filename))
+			{
+				(*is_used) = TRUE;
+				return TRUE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Save the current date number and multrun number to the multrun state file. The state file is updated
+ * atomically: we write a temporary file in the data directory, and rename it over the state file, so a crash
+ * leaves either the old or the new state. The state is a single line containing the instrument code, 
+ * date number and multrun number.
+ * @return Returns TRUE if the routine succeeds and returns FALSE if an error occurs.
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_State_Filename_Get
+ * @see #Fits_Filename_Error_Number
+ * @see #Fits_Filename_Error_String
+ */
+static int Fits_Filename_State_Write(void)
+{
+	char state_filename[FITS_FILENAME_STATE_FILENAME_LENGTH];
+	char tmp_filename[FITS_FILENAME_STATE_FILENAME_LENGTH+4];
+	char buff[64];
+	int fd,buff_length;
+
+	if(!Fits_Filename_State_Filename_Get(state_filename))
+		return FALSE;
+	sprintf(tmp_filename,"%s.tmp",state_filename);
+	fd = open(tmp_filename,O_WRONLY|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if(fd < 0)
+	{
+		Fits_Filename_Error_Number = 26;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_State_Write:Failed to open '%s' (%d).",
+			tmp_filename,errno);
+		return FALSE;
+	}
+	sprintf(buff,"%c %d %d\n",Fits_Filename_Data.Instrument_Code,Fits_Filename_Data.Current_Date_Number,
+		Fits_Filename_Data.Current_Multrun_Number);
+	buff_length = strlen(buff);
+	if(write(fd,buff,buff_length) != buff_length)
+	{
+		Fits_Filename_Error_Number = 27;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_State_Write:Failed to write '%s' (%d).",
+			tmp_filename,errno);
+		close(fd);
+		unlink(tmp_filename);
+		return FALSE;
+	}
+	if(close(fd) != 0)
+	{
+		Fits_Filename_Error_Number = 28;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_State_Write:Failed to close '%s' (%d).",
+			tmp_filename,errno);
+		unlink(tmp_filename);
+		return FALSE;
+	}
+	if(rename(tmp_filename,state_filename) != 0)
+	{
+		Fits_Filename_Error_Number = 29;
+		sprintf(Fits_Filename_Error_String,"Fits_Filename_State_Write:Failed to rename '%s' to '%s' (%d).",
+			tmp_filename,state_filename,errno);
+		unlink(tmp_filename);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Check whether a FITS image a multrun would write already exists, in any of the forms it can take on disk:
+ * <ul>
+ * <li>The FITS filename itself.
+ * <li>The hidden temporary filename it is written to in CCD_FITS_FILENAME_PUBLISH_MODE_RENAME publish mode
+ *     (the leaf with a '.' prepended and FITS_FILENAME_PUBLISH_EXTENSION appended), which is left behind if the 
+ *     process stopped before it was published.
+ * <li>The filename with '.fits' replaced by FITS_FILENAME_RAW_EXTENSION (a raw capture file).
+ * </ul>
+ * @param filename The FITS filename to check.
+ * @return The routine returns TRUE if any of the files exist, and FALSE otherwise.
+ * @see #FITS_FILENAME_PUBLISH_EXTENSION
+ * @see #FITS_FILENAME_RAW_EXTENSION
+ * @see #FITS_FILENAME_STATE_FILENAME_LENGTH
+ * @see #fexist
+ */
+static int Fits_Filename_State_File_Exists(char *filename)
+{
+	char check_filename[FITS_FILENAME_STATE_FILENAME_LENGTH+8];
+	char *leaf_ptr = NULL;
+	char *extension_ptr = NULL;
+	int directory_length;
+
+	if(fexist(filename))
+		return TRUE;
+	if(strlen(filename) >= FITS_FILENAME_STATE_FILENAME_LENGTH)
+		return FALSE;
+	/* directory/.leaf.tmp */
+	leaf_ptr = strrchr(filename,'/');
+	if(leaf_ptr == NULL)
+		leaf_ptr = filename;
+	else
+		leaf_ptr++;
+	directory_length = leaf_ptr-filename;
+	strncpy(check_filename,filename,directory_length);
+	check_filename[directory_length] = '.';
+	strcpy(check_filename+directory_length+1,leaf_ptr);
+	strcat(check_filename,FITS_FILENAME_PUBLISH_EXTENSION);
+	if(fexist(check_filename))
+		return TRUE;
+	/* directory/leaf.raw */
+	strcpy(check_filename,filename);
+	extension_ptr = strstr(check_filename,".fits");
+	if(extension_ptr == NULL)
+		return FALSE;
+	strcpy(extension_ptr,FITS_FILENAME_RAW_EXTENSION);
+	if(fexist(check_filename))
+		return TRUE;
+	return FALSE;
+}
+
+/**
+ * Add to the number of file system metadata system calls used to publish FITS images.
+ * @param count The number of system calls to add.
+ * @see #Fits_Filename_Data
+ * @see #Fits_Filename_Publish_Mutex
+ */
+static void Fits_Filename_Publish_Syscall_Count_Add(int count)
+{
+	pthread_mutex_lock(&Fits_Filename_Publish_Mutex);
+	Fits_Filename_Data.Publish_Syscall_Count += count;
+	pthread_mutex_unlock(&Fits_Filename_Publish_Mutex);
+}
+
+/**
+ * Return the number of filename pointers a filename list holding filename_count filenames was allocated with
+ * by CCD_Fits_Filename_List_Add. This is FITS_FILENAME_LIST_MIN_LENGTH, doubled until it is at least 
+ * filename_count, so the allocated length does not have to be stored with the list.
+ * @param filename_count The number of filenames in the list.
+ * @return The allocated length of the list, in filename pointers.
+ * @see #FITS_FILENAME_LIST_MIN_LENGTH
+ * @see #CCD_Fits_Filename_List_Add
+ */
+static int Fits_Filename_List_Length_Get(int filename_count)
+{
+	int list_length;
+
+	list_length = FITS_FILENAME_LIST_MIN_LENGTH;
+	while(list_length < filename_count)
+		list_length *= 2;
+	return list_length;
+}
+
+/**
+ * Copy a filename into the filename arena. The filename is copied into the current block if it fits,
+ * otherwise the next block (kept from a previous multrun) is used, or a new block is allocated.
+ * Fits_Filename_Arena_Mutex should be locked by the caller.
+ * @param filename The filename to copy.
+ * @return A pointer to the copy of the filename in the arena, or NULL if a new block could not be allocated.
+ * @see #FITS_FILENAME_ARENA_BLOCK_LENGTH
+ * @see #Fits_Filename_Arena
+ * @see #Fits_Filename_Arena_Block_Struct
+ */
+static char *Fits_Filename_Arena_Strdup(char *filename)
+{
+	struct Fits_Filename_Arena_Block_Struct *block = NULL;
+	char *arena_filename = NULL;
+	size_t length,block_length;
+
+	length = strlen(filename)+1;
+	block = Fits_Filename_Arena.Current_Block;
+	while((block != NULL)&&((block->Used+length) > block->Length))
+	{
+		block = block->Next;
+		if(block != NULL)
+			block->Used = 0;
+	}
+	if(block == NULL)
+	{
+		block_length = FITS_FILENAME_ARENA_BLOCK_LENGTH;
+		if(length > block_length)
+			block_length = length;
+		block = (struct Fits_Filename_Arena_Block_Struct *)malloc(sizeof(struct Fits_Filename_Arena_Block_Struct)+
+									   block_length);
+		if(block == NULL)
+			return NULL;
+		block->Next = NULL;
+		block->Data = (char *)(block+1);
+		block->Length = block_length;
+		block->Used = 0;
+		/* add the new block to the end of the arena */
+		if(Fits_Filename_Arena.Current_Block == NULL)
+			Fits_Filename_Arena.Block_List = block;
+		else
+		{
+			while(Fits_Filename_Arena.Current_Block->Next != NULL)
+				Fits_Filename_Arena.Current_Block = Fits_Filename_Arena.Current_Block->Next;
+			Fits_Filename_Arena.Current_Block->Next = block;
+		}
+	}
+	Fits_Filename_Arena.Current_Block = block;
+	arena_filename = block->Data+block->Used;
+	memcpy(arena_filename,filename,length);
+	block->Used += length;
+	return arena_filename;
+}
+
+/**
+ * Rewind the filename arena, so the next filename list re-uses the arena's blocks from the start.
+ * The blocks are not freed. Fits_Filename_Arena_Mutex should be locked by the caller.
+ * @see #Fits_Filename_Arena
+ */
+static void Fits_Filename_Arena_Rewind(void)
+{
+	Fits_Filename_Arena.Current_Block = Fits_Filename_Arena.Block_List;
+	if(Fits_Filename_Arena.Current_Block != NULL)
+		Fits_Filename_Arena.Current_Block->Used = 0;
+	Fits_Filename_Arena.List_Count = 0;
+}
+
 /**
  * Return whether the specified filename exists or not.
  * @param filename A string representing the filename to test.
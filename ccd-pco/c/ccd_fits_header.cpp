@@ -42,6 +42,12 @@
  * Maximum length of FITS header comment (can go from column 10 to column 80 inclusive), plus a '\0' terminator.
  */
 #define FITS_HEADER_COMMENT_STRING_LENGTH (72) 
+/**
+ * The minimum number of cards allocated in the card list. The list is grown by doubling it's allocated length
+ * when it fills up, rather than one card at a time.
+ * @see #Fits_Header_Add_Card
+ */
+#define FITS_HEADER_CARD_LIST_MIN_LENGTH  (64)
 
 /* data types */
 /**
@@ -123,13 +129,14 @@ struct Fits_Header_Struct
 static char rcsid[] = "$Id$";
 /**
  * Variable holding error code of last operation performed by the fits header routines.
+ * Thread local, so errors from concurrent callers (e.g. the C layer writer threads) are kept apart.
  */
-static int Fits_Header_Error_Number = 0;
+static __thread int Fits_Header_Error_Number = 0;
 /**
  * Local variable holding description of the last error that occured.
  * @see ccd_general.html#CCD_GENERAL_ERROR_STRING_LENGTH
  */
-static char Fits_Header_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
+static __thread char Fits_Header_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
 /**
  * As we only have 1 CCD per control computer, we have 1 instance of the Fits_Header_Struct
  * per CCD library. This instance contains the FITS headers to be used for this CCD.
@@ -139,6 +146,7 @@ struct Fits_Header_Struct Fits_Header;
 
 /* internal functions */
 static int Fits_Header_Add_Card(struct Fits_Header_Card_Struct card);
+static int Fits_Header_Card_To_Card_Image(struct Fits_Header_Card_Struct *card,char *card_image);
 static void Fits_Header_Uppercase(char *string);
 
 /* ----------------------------------------------------------------------------
@@ -720,6 +728,243 @@ int CCD_Fits_Header_Write_To_Fits(fitsfile *fits_fp)
 	return TRUE;
 }
 
+/**
+ * Get the number of cards currently in the FITS header list.
+ * @return The number of cards in the list.
+ * @see #Fits_Header
+ */
+int CCD_Fits_Header_Card_Count_Get(void)
+{
+	return Fits_Header.Card_Count;
+}
+
+/**
+ * Format every card in the FITS header list into an 80 column FITS card image, in the same order and with the same
+ * formatting that CCD_Fits_Header_Write_To_Fits would use. The card images can then be copied and written to
+ * many FITS images (with CCD_Fits_Header_Card_Images_Write_To_Fits), without re-formatting each card every time.
+ * @param card_image_list A previously allocated buffer of card_image_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ *        characters. Card image i is stored at card_image_list+(i*CCD_FITS_HEADER_CARD_IMAGE_LENGTH), 
+ *        space padded and <b>not</b> '\0' terminated.
+ * @param card_image_count The number of card images card_image_list can hold.
+ * @param card_count The address of an integer to store the number of card images formatted.
+ * @return The routine returns TRUE on success, and FALSE on failure. On failure, Fits_Header_Error_Number
+ *         and Fits_Header_Error_String should be filled in with suitable values.
+ * @see #CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see #Fits_Header
+ * @see #Fits_Header_Card_To_Card_Image
+ * @see #Fits_Header_Error_Number
+ * @see #Fits_Header_Error_String
+ * @see ccd_general.html#CCD_General_Log
+ */
+int CCD_Fits_Header_To_Card_Images(char *card_image_list,int card_image_count,int *card_count)
+{
+	int i;
+
+#if LOGGING > 1
+	CCD_General_Log(LOG_VERBOSITY_INTERMEDIATE,"CCD_Fits_Header_To_Card_Images: Started.");
+#endif
+	if(card_image_list == NULL)
+	{
+		Fits_Header_Error_Number = 21;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_To_Card_Images:card_image_list is NULL.");
+		return FALSE;
+	}
+	if(card_count == NULL)
+	{
+		Fits_Header_Error_Number = 22;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_To_Card_Images:card_count is NULL.");
+		return FALSE;
+	}
+	if(Fits_Header.Card_Count > card_image_count)
+	{
+		Fits_Header_Error_Number = 23;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_To_Card_Images:"
+			"Too many cards in the header (%d vs %d).",Fits_Header.Card_Count,card_image_count);
+		return FALSE;
+	}
+	for(i=0;i<Fits_Header.Card_Count;i++)
+	{
+		if(!Fits_Header_Card_To_Card_Image(&(Fits_Header.Card_List[i]),
+						   card_image_list+(i*CCD_FITS_HEADER_CARD_IMAGE_LENGTH)))
+			return FALSE;
+	}
+	(*card_count) = Fits_Header.Card_Count;
+#if LOGGING > 1
+	CCD_General_Log_Format(LOG_VERBOSITY_INTERMEDIATE,"CCD_Fits_Header_To_Card_Images: Finished (%d cards).",
+			       (*card_count));
+#endif
+	return TRUE;
+}
+
+/**
+ * Format a keyword with a string value into an 80 column FITS card image, as CCD_Fits_Header_Write_To_Fits would.
+ * This is used to overwrite a card image previously created by CCD_Fits_Header_To_Card_Images 
+ * with a new value.
+ * @param card_image The card image to overwrite, of (at least) CCD_FITS_HEADER_CARD_IMAGE_LENGTH characters.
+ *        The card image is space padded and <b>not</b> '\0' terminated.
+ * @param keyword The keyword string, must be at least 1 character less in length than 
+ *        FITS_HEADER_KEYWORD_STRING_LENGTH.
+ * @param value The value string, which if longer than FITS_HEADER_VALUE_STRING_LENGTH-1 characters will be truncated.
+ * @return The routine returns TRUE on success, and FALSE on failure. On failure, Fits_Header_Error_Number
+ *         and Fits_Header_Error_String should be filled in with suitable values.
+ * @see #FITS_HEADER_KEYWORD_STRING_LENGTH
+ * @see #FITS_HEADER_VALUE_STRING_LENGTH
+ * @see #Fits_Header_Card_To_Card_Image
+ * @see #Fits_Header_Error_Number
+ * @see #Fits_Header_Error_String
+ */
+int CCD_Fits_Header_Card_Image_String_Set(char *card_image,char *keyword,char *value)
+{
+	struct Fits_Header_Card_Struct card;
+
+	if((keyword == NULL)||(value == NULL))
+	{
+		Fits_Header_Error_Number = 24;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_Card_Image_String_Set:Keyword or value is NULL.");
+		return FALSE;
+	}
+	if(strlen(keyword) > (FITS_HEADER_KEYWORD_STRING_LENGTH-1))
+	{
+		Fits_Header_Error_Number = 25;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_Card_Image_String_Set:"
+			"Keyword %s (%lu) was too long.",keyword,strlen(keyword));
+		return FALSE;
+	}
+	strcpy(card.Keyword,keyword);
+	card.Type = FITS_HEADER_TYPE_STRING;
+	strncpy(card.Value.String,value,FITS_HEADER_VALUE_STRING_LENGTH-1);
+	card.Value.String[FITS_HEADER_VALUE_STRING_LENGTH-1] = '\0';
+	strcpy(card.Comment,"");
+	return Fits_Header_Card_To_Card_Image(&card,card_image);
+}
+
+/**
+ * Format a keyword with an integer value into an 80 column FITS card image, as CCD_Fits_Header_Write_To_Fits would.
+ * This is used to overwrite a card image previously created by CCD_Fits_Header_To_Card_Images 
+ * with a new value.
+ * @param card_image The card image to overwrite, of (at least) CCD_FITS_HEADER_CARD_IMAGE_LENGTH characters.
+ *        The card image is space padded and <b>not</b> '\0' terminated.
+ * @param keyword The keyword string, must be at least 1 character less in length than 
+ *        FITS_HEADER_KEYWORD_STRING_LENGTH.
+ * @param value The integer value.
+ * @return The routine returns TRUE on success, and FALSE on failure. On failure, Fits_Header_Error_Number
+ *         and Fits_Header_Error_String should be filled in with suitable values.
+ * @see #FITS_HEADER_KEYWORD_STRING_LENGTH
+ * @see #Fits_Header_Card_To_Card_Image
+ * @see #Fits_Header_Error_Number
+ * @see #Fits_Header_Error_String
+ */
+int CCD_Fits_Header_Card_Image_Int_Set(char *card_image,char *keyword,int value)
+{
+	struct Fits_Header_Card_Struct card;
+
+	if(keyword == NULL)
+	{
+		Fits_Header_Error_Number = 26;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_Card_Image_Int_Set:Keyword is NULL.");
+		return FALSE;
+	}
+	if(strlen(keyword) > (FITS_HEADER_KEYWORD_STRING_LENGTH-1))
+	{
+		Fits_Header_Error_Number = 27;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_Card_Image_Int_Set:"
+			"Keyword %s (%lu) was too long.",keyword,strlen(keyword));
+		return FALSE;
+	}
+	strcpy(card.Keyword,keyword);
+	card.Type = FITS_HEADER_TYPE_INTEGER;
+	card.Value.Int = value;
+	strcpy(card.Comment,"");
+	return Fits_Header_Card_To_Card_Image(&card,card_image);
+}
+
+/**
+ * Format a keyword with a float (double) value into an 80 column FITS card image, as CCD_Fits_Header_Write_To_Fits 
+ * would. This is used to overwrite a card image previously created by CCD_Fits_Header_To_Card_Images 
+ * with a new value.
+ * @param card_image The card image to overwrite, of (at least) CCD_FITS_HEADER_CARD_IMAGE_LENGTH characters.
+ *        The card image is space padded and <b>not</b> '\0' terminated.
+ * @param keyword The keyword string, must be at least 1 character less in length than 
+ *        FITS_HEADER_KEYWORD_STRING_LENGTH.
+ * @param value The float value of type double.
+ * @return The routine returns TRUE on success, and FALSE on failure. On failure, Fits_Header_Error_Number
+ *         and Fits_Header_Error_String should be filled in with suitable values.
+ * @see #FITS_HEADER_KEYWORD_STRING_LENGTH
+ * @see #Fits_Header_Card_To_Card_Image
+ * @see #Fits_Header_Error_Number
+ * @see #Fits_Header_Error_String
+ */
+int CCD_Fits_Header_Card_Image_Float_Set(char *card_image,char *keyword,double value)
+{
+	struct Fits_Header_Card_Struct card;
+
+	if(keyword == NULL)
+	{
+		Fits_Header_Error_Number = 28;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_Card_Image_Float_Set:Keyword is NULL.");
+		return FALSE;
+	}
+	if(strlen(keyword) > (FITS_HEADER_KEYWORD_STRING_LENGTH-1))
+	{
+		Fits_Header_Error_Number = 29;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_Card_Image_Float_Set:"
+			"Keyword %s (%lu) was too long.",keyword,strlen(keyword));
+		return FALSE;
+	}
+	strcpy(card.Keyword,keyword);
+	card.Type = FITS_HEADER_TYPE_FLOAT;
+	card.Value.Float = value;
+	strcpy(card.Comment,"");
+	return Fits_Header_Card_To_Card_Image(&card,card_image);
+}
+
+/**
+ * Write a list of previously formatted FITS card images to the specified fitsfile. The cards are appended
+ * to the current header using fits_write_record, rather than updated using fits_update_key, so no search 
+ * of the existing header is done for each card. The card images should therefore not contain any keyword
+ * already written to the header (e.g. by fits_create_img).
+ * @param fits_fp A previously created CFITSIO file pointer to write the headers into.
+ * @param card_image_list The list of card images, of card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH characters,
+ *        normally created by CCD_Fits_Header_To_Card_Images.
+ * @param card_count The number of card images in card_image_list.
+ * @return The routine returns TRUE on success, and FALSE on failure. On failure, Fits_Header_Error_Number
+ *         and Fits_Header_Error_String should be filled in with suitable values.
+ * @see #CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see #CCD_Fits_Header_To_Card_Images
+ * @see #Fits_Header_Error_Number
+ * @see #Fits_Header_Error_String
+ */
+int CCD_Fits_Header_Card_Images_Write_To_Fits(fitsfile *fits_fp,char *card_image_list,int card_count)
+{
+	char card_image[FLEN_CARD];
+	char buff[32]; /* fits_get_errstatus returns 30 chars max */
+	int i,status,retval;
+
+	if(card_image_list == NULL)
+	{
+		Fits_Header_Error_Number = 30;
+		sprintf(Fits_Header_Error_String,"CCD_Fits_Header_Card_Images_Write_To_Fits:card_image_list is NULL.");
+		return FALSE;
+	}
+	status = 0;
+	for(i=0;i<card_count;i++)
+	{
+		memcpy(card_image,card_image_list+(i*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),
+		       CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+		card_image[CCD_FITS_HEADER_CARD_IMAGE_LENGTH] = '\0';
+		retval = fits_write_record(fits_fp,card_image,&status);
+		if(retval)
+		{
+			fits_get_errstatus(status,buff);
+			Fits_Header_Error_Number = 31;
+			sprintf(Fits_Header_Error_String,"CCD_Fits_Header_Card_Images_Write_To_Fits:"
+				"Failed to write card %d '%.8s' (%s).",i,card_image,buff);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 /**
  * Get the current value of ccd_fits_header's error number.
  * @return The current value of ccd_fits_header's error number.
@@ -779,7 +1024,8 @@ void CCD_Fits_Header_Error_String(char *error_string)
 ** ---------------------------------------------------------------------------- */
 /**
  * Routine to add a card to the list. If the keyword already exists, that card will be updated with the new value,
- * otherwise a new card will be allocated (if necessary) and added to the list. The keyword is converted to all
+ * otherwise a new card will be allocated (if necessary) and added to the list. The card list is grown by doubling
+ * it's allocated length (with a minimum of FITS_HEADER_CARD_LIST_MIN_LENGTH cards). The keyword is converted to all
  * uppercase. This matches the way CFITSIO handles keywords so we don't get a lower-case version of the same keyword
  * with a different value overwriting the upprcase one.
  * @param card The new card to add to the list. 
@@ -796,7 +1042,8 @@ void CCD_Fits_Header_Error_String(char *error_string)
  */
 static int Fits_Header_Add_Card(struct Fits_Header_Card_Struct card)
 {
-	int index,done;
+	struct Fits_Header_Card_Struct *new_card_list = NULL;
+	int index,done,new_allocated_card_count;
 
 #if LOGGING > 1
 	CCD_General_Log(LOG_VERBOSITY_VERBOSE,"Fits_Header_Add_Card: Started.");
@@ -827,31 +1074,34 @@ static int Fits_Header_Add_Card(struct Fits_Header_Card_Struct card)
 	}
 	/* add the card to the list */
 	/* if we need to allocate more memory... */
-	if((Fits_Header.Card_Count+1) >= Fits_Header.Allocated_Card_Count)
+	if(Fits_Header.Card_Count >= Fits_Header.Allocated_Card_Count)
 	{
-		/* allocate card list memory to be the current card count +1 */
+		/* double the allocated length of the card list. As CCD_Fits_Header_Clear does not free the list,
+		** the memory is re-used by subsequent headers */
+		new_allocated_card_count = 2*Fits_Header.Allocated_Card_Count;
+		if(new_allocated_card_count < FITS_HEADER_CARD_LIST_MIN_LENGTH)
+			new_allocated_card_count = FITS_HEADER_CARD_LIST_MIN_LENGTH;
 		if(Fits_Header.Card_List == NULL)
 		{
-			Fits_Header.Card_List = (struct Fits_Header_Card_Struct *)malloc((Fits_Header.Card_Count+1)*
-									  sizeof(struct Fits_Header_Card_Struct));
+			new_card_list = (struct Fits_Header_Card_Struct *)malloc(new_allocated_card_count*
+								       sizeof(struct Fits_Header_Card_Struct));
 		}
 		else
 		{
-			Fits_Header.Card_List = (struct Fits_Header_Card_Struct *)realloc(Fits_Header.Card_List,
-					    (Fits_Header.Card_Count+1)*sizeof(struct Fits_Header_Card_Struct));
+			new_card_list = (struct Fits_Header_Card_Struct *)realloc(Fits_Header.Card_List,
+					new_allocated_card_count*sizeof(struct Fits_Header_Card_Struct));
 		}
-		if(Fits_Header.Card_List == NULL)
+		if(new_card_list == NULL)
 		{
-			Fits_Header.Card_Count = 0;
-			Fits_Header.Allocated_Card_Count = 0;
 			Fits_Header_Error_Number = 20;
 			sprintf(Fits_Header_Error_String,"Fits_Header_Add_Card:"
-				"Failed to reallocate card list (%d,%d).",(Fits_Header.Card_Count+1),
+				"Failed to reallocate card list (%d,%d).",new_allocated_card_count,
 				Fits_Header.Allocated_Card_Count);
 			return FALSE;
 		}
+		Fits_Header.Card_List = new_card_list;
 		/* upcate allocated card count */
-		Fits_Header.Allocated_Card_Count = Fits_Header.Card_Count+1;
+		Fits_Header.Allocated_Card_Count = new_allocated_card_count;
 	}/* end if more memory needed */
 	/* add the card to the list */
 	Fits_Header.Card_List[Fits_Header.Card_Count] = card;
@@ -863,6 +1113,78 @@ static int Fits_Header_Add_Card(struct Fits_Header_Card_Struct card)
 
 }
 
+/**
+ * Format a card into an 80 column FITS card image. The value is formatted using the same CFITSIO routines
+ * (and for floats, the same number of decimal places) as fits_update_key / fits_update_key_fixdbl use in 
+ * CCD_Fits_Header_Write_To_Fits, and as in CCD_Fits_Header_Write_To_Fits no comment is written, 
+ * so the resulting card image is identical to the one CCD_Fits_Header_Write_To_Fits would write to the FITS file.
+ * @param card The card to format. The keyword is assumed to already be uppercase.
+ * @param card_image The card image to write to, of (at least) CCD_FITS_HEADER_CARD_IMAGE_LENGTH characters.
+ *        The card image is space padded and <b>not</b> '\0' terminated.
+ * @return The routine returns TRUE on success, and FALSE on failure. On failure, Fits_Header_Error_Number
+ *         and Fits_Header_Error_String should be filled in with suitable values.
+ * @see #CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see #Fits_Header_Card_Struct
+ * @see #Fits_Header_Uppercase
+ * @see #Fits_Header_Error_Number
+ * @see #Fits_Header_Error_String
+ */
+static int Fits_Header_Card_To_Card_Image(struct Fits_Header_Card_Struct *card,char *card_image)
+{
+	char value_string[FLEN_VALUE];
+	char card_string[FLEN_CARD];
+	char buff[32]; /* fits_get_errstatus returns 30 chars max */
+	int status,length;
+
+	if(card_image == NULL)
+	{
+		Fits_Header_Error_Number = 32;
+		sprintf(Fits_Header_Error_String,"Fits_Header_Card_To_Card_Image:card_image is NULL.");
+		return FALSE;
+	}
+	status = 0;
+	Fits_Header_Uppercase(card->Keyword);
+	switch(card->Type)
+	{
+		case FITS_HEADER_TYPE_STRING:
+			ffs2c(card->Value.String,value_string,&status);
+			break;
+		case FITS_HEADER_TYPE_INTEGER:
+			ffi2c((LONGLONG)(card->Value.Int),value_string,&status);
+			break;
+		case FITS_HEADER_TYPE_LONG_LONG_INTEGER:
+			ffi2c((LONGLONG)(card->Value.Long_Long_Int),value_string,&status);
+			break;
+		case FITS_HEADER_TYPE_FLOAT:
+			ffd2f(card->Value.Float,6,value_string,&status);
+			break;
+		case FITS_HEADER_TYPE_LOGICAL:
+			ffl2c(card->Value.Boolean,value_string,&status);
+			break;
+		default:
+			Fits_Header_Error_Number = 33;
+			sprintf(Fits_Header_Error_String,"Fits_Header_Card_To_Card_Image:"
+				"Card (Keyword %s) has unknown type %d.",card->Keyword,card->Type);
+			return FALSE;
+	}
+	fits_make_key(card->Keyword,value_string,NULL,card_string,&status);
+	if(status)
+	{
+		fits_get_errstatus(status,buff);
+		Fits_Header_Error_Number = 34;
+		sprintf(Fits_Header_Error_String,"Fits_Header_Card_To_Card_Image:"
+			"Failed to format card %s (%s).",card->Keyword,buff);
+		return FALSE;
+	}
+	/* card images are space padded to 80 columns, as CFITSIO does when writing the record */
+	length = strlen(card_string);
+	if(length > CCD_FITS_HEADER_CARD_IMAGE_LENGTH)
+		length = CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	memcpy(card_image,card_string,length);
+	memset(card_image+length,' ',CCD_FITS_HEADER_CARD_IMAGE_LENGTH-length);
+	return TRUE;
+}
+
 /**
  * Routine to uppercase the specified string.
  * @param string The string to uppercase.
@@ -0,0 +1,3577 @@
+/* ccd_fits_image.c
+** CCD FITS image writing routines
+*/
+/**
+ * Routines to write FITS images directly, without using CFITSIO. These only support the fixed layout
+ * the PCO camera produces: a single 2D unsigned short image in the primary HDU, stored (as CFITSIO does for
+ * USHORT_IMG) as big-endian signed 16 bit data with a BZERO of 32768.
+ * The header card images are formatted by the caller (see CCD_Fits_Header_To_Card_Images), and the whole
+ * file is written with one pwritev into a preallocated file.
+ * The image data is put into FITS format (with any flipping) by CCD_Fits_Image_Data_Convert, which has
+ * SSE2 and AVX2 implementations selected at run time.
+ * A set of frames can also be written as planes of a 3D cube (CCD_Fits_Image_Cube_Create), with a binary table
+ * extension holding per-plane values. The whole cube is laid out when it is created, so each plane (and it's table 
+ * row) is written in place as it arrives, in any order.
+ * For the highest frame rates, frames can instead be captured unconverted into a raw capture file 
+ * (CCD_Fits_Image_Raw_Create), one fixed-size slot (metadata record, header card images and image data) per frame, 
+ * and converted into FITS images later (CCD_Fits_Image_Raw_Frame_Read).
+ * Single images can be written with plain pwritev calls on the calling thread, or (if built with IO_URING defined)
+ * queued to an io_uring thread that batches the files of all the calling threads into a few submissions.
+ * An image can also be formatted into memory (CCD_Fits_Image_Serialise) and written to disk later, 
+ * on another thread (CCD_Fits_Image_Buffer_Write).
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us fallocate and pwritev prototypes.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef IO_URING
+#include <liburing.h>
+#endif
+
+#include "log_udp.h"
+
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+#include "ccd_general.h"
+
+/* hash defines */
+/**
+ * The value added to signed 16 bit data to get the unsigned pixel value (the BZERO keyword value).
+ */
+#define FITS_IMAGE_USHORT_BZERO          (32768)
+/**
+ * The number of iovec's used to write a FITS image: the mandatory cards, the caller's cards,
+ * the END card and header padding, the image data, and the data padding.
+ */
+#define FITS_IMAGE_IOVEC_COUNT           (5)
+/**
+ * The number of fixed card images in a cube's binary table extension header: XTENSION, BITPIX, NAXIS, NAXIS1, 
+ * NAXIS2, PCOUNT, GCOUNT, TFIELDS and EXTNAME. Each column then has a TTYPEn, TFORMn and TUNITn card.
+ */
+#define FITS_IMAGE_CUBE_TABLE_CARD_COUNT (9)
+/**
+ * The length of each (double) binary table column, in bytes.
+ */
+#define FITS_IMAGE_CUBE_COLUMN_LENGTH    (8)
+/**
+ * The EXTNAME of a cube's per-plane binary table extension.
+ */
+#define FITS_IMAGE_CUBE_TABLE_EXTNAME    "PLANES"
+/**
+ * The magic string at the start of a raw capture file (including the NULL terminator).
+ */
+#define FITS_IMAGE_RAW_MAGIC             "MOPRAW1"
+/**
+ * The version of the raw capture file layout written by CCD_Fits_Image_Raw_Create.
+ */
+#define FITS_IMAGE_RAW_VERSION           (1)
+/**
+ * The value of the Is_Valid field of a frame record that has been written to a raw capture file.
+ * A frame slot that has never been written reads back as zero.
+ */
+#define FITS_IMAGE_RAW_RECORD_VALID      (0x4d4f5052)
+/**
+ * Define this if we are compiling for an x86 CPU, and so can build the SSE2 and AVX2 conversion kernels.
+ * Whether the CPU we are actually running on supports them is checked at run time.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define FITS_IMAGE_X86                   (1)
+#endif
+/**
+ * The maximum number of files the io_uring thread writes in one batch. This is also the number of
+ * (direct) file descriptor slots registered with the ring, each file in a batch using the slot of it's batch index.
+ */
+#define FITS_IMAGE_IO_URING_FILE_COUNT   (32)
+/**
+ * The number of submission queue entries in the ring, enough for FITS_IMAGE_IO_URING_FILE_COUNT files
+ * of FITS_IMAGE_IO_OP_COUNT operations each.
+ * @see #FITS_IMAGE_IO_URING_FILE_COUNT
+ * @see #FITS_IMAGE_IO_OP_COUNT
+ */
+#define FITS_IMAGE_IO_URING_QUEUE_LENGTH (256)
+/**
+ * Macro to convert one unsigned short pixel to FITS format: subtract FITS_IMAGE_USHORT_BZERO
+ * (which for 16 bit data is just flipping the top bit), and (on a little-endian machine) swap the bytes
+ * so the result is stored big-endian.
+ * @see #FITS_IMAGE_USHORT_BZERO
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define FITS_IMAGE_PIXEL_CONVERT(value)  ((unsigned short)((value)^FITS_IMAGE_USHORT_BZERO))
+#else
+#define FITS_IMAGE_PIXEL_CONVERT(value)  ((unsigned short)(((((value)^FITS_IMAGE_USHORT_BZERO)&0xff)<<8)| \
+							   (((value)^FITS_IMAGE_USHORT_BZERO)>>8)))
+#endif
+
+/* enumerations */
+/**
+ * The operations used to write one FITS image file, in the order they are linked in the io_uring thread.
+ * FITS_IMAGE_IO_OP_COUNT is the number of operations.
+ */
+enum FITS_IMAGE_IO_OP
+{
+	FITS_IMAGE_IO_OP_OPEN=0,FITS_IMAGE_IO_OP_FALLOCATE,FITS_IMAGE_IO_OP_WRITE,FITS_IMAGE_IO_OP_SYNC,
+	FITS_IMAGE_IO_OP_CLOSE,FITS_IMAGE_IO_OP_COUNT
+};
+
+/* structures */
+struct Fits_Image_Io_Request_Struct;
+/**
+ * Structure holding one operation of a Fits_Image_Io_Request_Struct. The address of this structure is the
+ * io_uring user data of the operation's submission, so the completion can be matched to it.
+ * <dl>
+ * <dt>Request</dt> <dd>The request this operation is part of.</dd>
+ * <dt>Result</dt> <dd>The result of the operation (the io_uring completion res, a negative errno on failure).</dd>
+ * </dl>
+ */
+struct Fits_Image_Io_Op_Struct
+{
+	struct Fits_Image_Io_Request_Struct *Request;
+	int Result;
+};
+
+/**
+ * Structure holding a request to write one FITS image file, queued by a writing thread to the io_uring thread.
+ * The request (and the filename and buffers it points to) is on the writing thread's stack,
+ * which waits for the request to be done.
+ * <dl>
+ * <dt>Filename</dt> <dd>The filename to write.</dd>
+ * <dt>Open_Flags</dt> <dd>The flags to open the file with.</dd>
+ * <dt>Allocate_Length</dt> <dd>The number of bytes to fallocate, or 0 to skip the fallocate.</dd>
+ * <dt>Iov</dt> <dd>The list of buffers to write.</dd>
+ * <dt>Iov_Count</dt> <dd>The number of buffers in Iov.</dd>
+ * <dt>Write_Length</dt> <dd>The total length of the buffers in Iov.</dd>
+ * <dt>Sync</dt> <dd>A boolean, if TRUE fdatasync the file before closing it.</dd>
+ * <dt>Op_List</dt> <dd>The result of each operation, indexed by FITS_IMAGE_IO_OP.</dd>
+ * <dt>Done</dt> <dd>A boolean, set to TRUE by the io_uring thread when all the operations have completed.</dd>
+ * <dt>Next</dt> <dd>The next request in the pending list.</dd>
+ * </dl>
+ * @see #FITS_IMAGE_IO_OP
+ */
+struct Fits_Image_Io_Request_Struct
+{
+	char *Filename;
+	int Open_Flags;
+	off_t Allocate_Length;
+	struct iovec *Iov;
+	int Iov_Count;
+	size_t Write_Length;
+	int Sync;
+	struct Fits_Image_Io_Op_Struct Op_List[FITS_IMAGE_IO_OP_COUNT];
+	int Done;
+	struct Fits_Image_Io_Request_Struct *Next;
+};
+
+/**
+ * Structure holding the state of the FITS image I/O backend.
+ * <dl>
+ * <dt>Backend</dt> <dd>Which system call interface is used to write files.</dd>
+ * <dt>Sync</dt> <dd>A boolean, if TRUE each file is fdatasync'ed before it is closed.</dd>
+ * <dt>File_Count</dt> <dd>The number of files written by CCD_Fits_Image_Write (or 
+ *                         CCD_Fits_Image_Write_Preallocated).</dd>
+ * <dt>Syscall_Count</dt> <dd>The number of system calls used to write those files. For the pwrite backend this is 
+ *                            one per operation (a partial pwritev retry is not counted), for the io_uring backend
+ *                            it is the number of batch submissions.</dd>
+ * <dt>Ring</dt> <dd>The io_uring (IO_URING builds only).</dd>
+ * <dt>Thread</dt> <dd>The io_uring thread.</dd>
+ * <dt>Thread_Stop</dt> <dd>A boolean, set to TRUE to stop the io_uring thread once the pending list is empty.</dd>
+ * <dt>Pending_Head</dt> <dd>The first request waiting to be submitted.</dd>
+ * <dt>Pending_Tail</dt> <dd>The last request waiting to be submitted.</dd>
+ * </dl>
+ * @see #CCD_FITS_IMAGE_IO_BACKEND
+ * @see #Fits_Image_Io_Mutex
+ */
+struct Fits_Image_Io_Struct
+{
+	enum CCD_FITS_IMAGE_IO_BACKEND Backend;
+	int Sync;
+	int File_Count;
+	int Syscall_Count;
+#ifdef IO_URING
+	struct io_uring Ring;
+#endif
+	pthread_t Thread;
+	int Thread_Stop;
+	struct Fits_Image_Io_Request_Struct *Pending_Head;
+	struct Fits_Image_Io_Request_Struct *Pending_Tail;
+};
+
+/**
+ * Structure holding the header at the start of a raw capture file, written in the host's native byte order
+ * (the raw capture file is converted to FITS on the same architecture it was written on).
+ * The frame's FITS header card images follow each frame record, and the first frame slot starts at 
+ * Header_Length.
+ * <dl>
+ * <dt>Magic</dt> <dd>FITS_IMAGE_RAW_MAGIC.</dd>
+ * <dt>Version</dt> <dd>FITS_IMAGE_RAW_VERSION.</dd>
+ * <dt>Ncols</dt> <dd>The number of columns in each frame.</dd>
+ * <dt>Nrows</dt> <dd>The number of rows in each frame.</dd>
+ * <dt>Frame_Count</dt> <dd>The number of frame slots in the file.</dd>
+ * <dt>Card_Count</dt> <dd>The number of FITS header card images stored with each frame.</dd>
+ * <dt>Value_Count</dt> <dd>The number of per-frame values stored in each frame record.</dd>
+ * <dt>Flip_X</dt> <dd>A boolean, whether to flip the frames in X when converting them to FITS.</dd>
+ * <dt>Flip_Y</dt> <dd>A boolean, whether to flip the frames in Y when converting them to FITS.</dd>
+ * <dt>Header_Length</dt> <dd>The length of the file header (this structure padded to 
+ *                            CCD_FITS_IMAGE_RAW_ALIGNMENT).</dd>
+ * <dt>Record_Length</dt> <dd>The length of each frame's record and card images (padded to 
+ *                            CCD_FITS_IMAGE_RAW_ALIGNMENT).</dd>
+ * <dt>Frame_Length</dt> <dd>The length of each frame slot, the record plus the image data (padded to 
+ *                           CCD_FITS_IMAGE_RAW_ALIGNMENT).</dd>
+ * <dt>Value_Name_List</dt> <dd>The names of the per-frame values.</dd>
+ * </dl>
+ * @see #FITS_IMAGE_RAW_MAGIC
+ * @see #FITS_IMAGE_RAW_VERSION
+ * @see #CCD_FITS_IMAGE_RAW_ALIGNMENT
+ */
+struct Fits_Image_Raw_Header_Struct
+{
+	char Magic[8];
+	int Version;
+	int Ncols;
+	int Nrows;
+	int Frame_Count;
+	int Card_Count;
+	int Value_Count;
+	int Flip_X;
+	int Flip_Y;
+	long long int Header_Length;
+	long long int Record_Length;
+	long long int Frame_Length;
+	char Value_Name_List[CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX][CCD_FITS_IMAGE_RAW_VALUE_NAME_LENGTH];
+};
+
+/* internal variables */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * Variable holding error code of last operation performed.
+ * Thread local, as several C layer writer threads can be writing FITS images at once.
+ */
+static __thread int Fits_Image_Error_Number = 0;
+/**
+ * Local variable holding description of the last error that occured.
+ * @see ccd_general.html#CCD_GENERAL_ERROR_STRING_LENGTH
+ */
+static __thread char Fits_Image_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
+/**
+ * A block of zeros, used to pad the data unit to a multiple of CCD_FITS_IMAGE_BLOCK_LENGTH.
+ * @see #CCD_FITS_IMAGE_BLOCK_LENGTH
+ */
+static char Fits_Image_Zero_Block[CCD_FITS_IMAGE_BLOCK_LENGTH] = {0};
+/**
+ * A block of zeros, used to pad each frame record in a raw capture file to a multiple of 
+ * CCD_FITS_IMAGE_RAW_ALIGNMENT.
+ * @see #CCD_FITS_IMAGE_RAW_ALIGNMENT
+ */
+static char Fits_Image_Raw_Zero_Block[CCD_FITS_IMAGE_RAW_ALIGNMENT] = {0};
+/**
+ * Which implementation of the image data conversion kernel to use. If this is CCD_FITS_IMAGE_CONVERT_METHOD_AUTO,
+ * the fastest method the CPU supports is used.
+ * @see #CCD_FITS_IMAGE_CONVERT_METHOD
+ */
+static enum CCD_FITS_IMAGE_CONVERT_METHOD Fits_Image_Convert_Method = CCD_FITS_IMAGE_CONVERT_METHOD_AUTO;
+/**
+ * The names of the image data conversion methods, indexed by CCD_FITS_IMAGE_CONVERT_METHOD.
+ * @see #CCD_FITS_IMAGE_CONVERT_METHOD
+ */
+static const char *Fits_Image_Convert_Method_Name_List[] = {"auto","scalar","sse2","avx2"};
+/**
+ * The state of the FITS image I/O backend. Initially the pwrite backend, with no sync.
+ * @see #Fits_Image_Io_Struct
+ */
+static struct Fits_Image_Io_Struct Fits_Image_Io_Data;
+/**
+ * The names of the I/O backends, indexed by CCD_FITS_IMAGE_IO_BACKEND.
+ * @see #CCD_FITS_IMAGE_IO_BACKEND
+ */
+static const char *Fits_Image_Io_Backend_Name_List[] = {"pwrite","io_uring"};
+/**
+ * Mutex protecting Fits_Image_Io_Data's counts, pending list and the requests' Done flags.
+ * @see #Fits_Image_Io_Data
+ */
+static pthread_mutex_t Fits_Image_Io_Mutex = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Condition variable signalled when a request is added to the pending list (or the io_uring thread is stopped).
+ * @see #Fits_Image_Io_Mutex
+ */
+static pthread_cond_t Fits_Image_Io_Pending_Condition = PTHREAD_COND_INITIALIZER;
+/**
+ * Condition variable broadcast by the io_uring thread when a batch of requests is done.
+ * @see #Fits_Image_Io_Mutex
+ */
+static pthread_cond_t Fits_Image_Io_Done_Condition = PTHREAD_COND_INITIALIZER;
+
+/* internal functions */
+static void Fits_Image_Card_Image_Set(char *card_image,const char *keyword,const char *value,const char *comment);
+static void Fits_Image_String_Card_Image_Set(char *card_image,const char *keyword,const char *value,
+					     const char *comment);
+static int Fits_Image_Mandatory_Cards_Set(char *card_image_list,int bitpix,int ncols,int nrows,int plane_count);
+static off_t Fits_Image_Block_Length_Get(off_t length);
+static off_t Fits_Image_Raw_Align_Get(off_t length);
+static void Fits_Image_Double_Set(unsigned char *buffer,double value);
+static int Fits_Image_Header_Integers_Get(int fd,off_t offset,char *filename,const char **keyword_list,
+					  int *value_list,int keyword_count,off_t *header_length);
+static int Fits_Image_Convert_Method_Is_Supported(enum CCD_FITS_IMAGE_CONVERT_METHOD method);
+static void Fits_Image_Row_Map(enum CCD_FITS_IMAGE_CONVERT_METHOD method,unsigned short *input_row,
+			       unsigned short *output_row,int ncols);
+static void Fits_Image_Row_Swap(enum CCD_FITS_IMAGE_CONVERT_METHOD method,unsigned short *input_row_a,
+				unsigned short *input_row_b,unsigned short *output_row_a,unsigned short *output_row_b,
+				int ncols);
+static void Fits_Image_Row_Reverse(enum CCD_FITS_IMAGE_CONVERT_METHOD method,unsigned short *input_row_a,
+				   unsigned short *input_row_b,unsigned short *output_row_a,
+				   unsigned short *output_row_b,int count,int ncols);
+static int Fits_Image_Row_Map_Scalar(unsigned short *input_row,unsigned short *output_row,int start,int ncols);
+static int Fits_Image_Row_Swap_Scalar(unsigned short *input_row_a,unsigned short *input_row_b,
+				      unsigned short *output_row_a,unsigned short *output_row_b,int start,int ncols);
+static int Fits_Image_Row_Reverse_Scalar(unsigned short *input_row_a,unsigned short *input_row_b,
+					 unsigned short *output_row_a,unsigned short *output_row_b,int start,int count,
+					 int ncols);
+#ifdef FITS_IMAGE_X86
+static int Fits_Image_Row_Map_SSE2(unsigned short *input_row,unsigned short *output_row,int ncols);
+static int Fits_Image_Row_Swap_SSE2(unsigned short *input_row_a,unsigned short *input_row_b,
+				    unsigned short *output_row_a,unsigned short *output_row_b,int ncols);
+static int Fits_Image_Row_Reverse_SSE2(unsigned short *input_row_a,unsigned short *input_row_b,
+				       unsigned short *output_row_a,unsigned short *output_row_b,int count,int ncols);
+static int Fits_Image_Row_Map_AVX2(unsigned short *input_row,unsigned short *output_row,int ncols);
+static int Fits_Image_Row_Swap_AVX2(unsigned short *input_row_a,unsigned short *input_row_b,
+				    unsigned short *output_row_a,unsigned short *output_row_b,int ncols);
+static int Fits_Image_Row_Reverse_AVX2(unsigned short *input_row_a,unsigned short *input_row_b,
+				       unsigned short *output_row_a,unsigned short *output_row_b,int count,int ncols);
+#endif
+static int Fits_Image_Pwritev(int fd,struct iovec *iov,int iov_count,off_t offset,char *filename);
+static int Fits_Image_Pread(int fd,void *buffer,size_t length,off_t offset,char *filename);
+static void Fits_Image_Io_Count_Add(int file_count,int syscall_count);
+#ifdef IO_URING
+static int Fits_Image_Io_Uring_Start(void);
+static void Fits_Image_Io_Uring_Stop(void);
+static void *Fits_Image_Io_Uring_Thread(void *arg);
+static void Fits_Image_Io_Uring_Batch(struct Fits_Image_Io_Request_Struct **request_list,int request_count);
+static int Fits_Image_Io_Uring_Write(char *filename,int open_flags,off_t allocate_length,struct iovec *iov,
+				     int iov_count);
+#endif
+static int Fits_Image_Write(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+			    unsigned short *image_data,int preallocated);
+static int Fits_Image_Iov_Write(char *filename,struct iovec *iov,int iov_count,off_t file_length,int preallocated);
+static int Fits_Image_Unscaled_Write(char *filename,char *card_image_list,int card_count,int bitpix,int ncols,
+				    int nrows,int plane_count,void *image_data);
+
+/* --------------------------------------------------------
+** External Functions
+** -------------------------------------------------------- */
+/**
+ * Write a 2D unsigned short FITS image to disk, creating a new file. This calls Fits_Image_Write to do the work:
+ * <ul>
+ * <li>We format the mandatory primary header cards using Fits_Image_Mandatory_Cards_Set.
+ * <li>We format the END card, and space pad the header to a multiple of CCD_FITS_IMAGE_BLOCK_LENGTH.
+ * <li>We create the file using open (with O_EXCL, fits_create_file also fails if the file already exists).
+ * <li>We preallocate the whole file using fallocate (if the filesystem supports it).
+ * <li>We write the header, image data and data padding with one call to Fits_Image_Pwritev.
+ * <li>We fdatasync the file, if CCD_Fits_Image_Io_Sync_Set has been called with TRUE.
+ * <li>We close the file.
+ * </ul>
+ * If the I/O backend (CCD_Fits_Image_Io_Backend_Set) is io_uring, the same operations are done by the io_uring thread.
+ * The image data must already have been converted into FITS format using CCD_Fits_Image_Data_Convert.
+ * The resulting file then has the same header cards and data as writing the original image using
+ * fits_create_file / fits_create_img(USHORT_IMG) / CCD_Fits_Header_Write_To_Fits / fits_write_img /
+ * fits_close_file.
+ * @param filename The filename of the FITS image to create.
+ * @param card_image_list A list of card_count (CCD_FITS_HEADER_CARD_IMAGE_LENGTH column, not '\0' terminated)
+ *        card images to put in the header after the mandatory cards, as produced by
+ *        CCD_Fits_Header_To_Card_Images. These should not include any of the mandatory keywords, or END.
+ * @param card_count The number of card images in card_image_list.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @param image_data The image data, of ncols*nrows pixels, already converted to FITS (big-endian, BZERO offset)
+ *        format by CCD_Fits_Image_Data_Convert.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Image_Write
+ */
+int CCD_Fits_Image_Write(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+			 unsigned short *image_data)
+{
+	return Fits_Image_Write(filename,card_image_list,card_count,ncols,nrows,image_data,FALSE);
+}
+
+/**
+ * Write a 2D unsigned short FITS image into a file previously created by CCD_Fits_Image_Preallocate 
+ * (with the same card_count, ncols and nrows). This calls Fits_Image_Write to do the work, which is the same
+ * as CCD_Fits_Image_Write, except the existing file is opened for writing, rather than being created and 
+ * preallocated. The file is not truncated, the write overwrites the whole of the preallocated length.
+ * @param filename The filename of the preallocated FITS image to write.
+ * @param card_image_list A list of card_count card images to put in the header after the mandatory cards.
+ * @param card_count The number of card images in card_image_list.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @param image_data The image data, of ncols*nrows pixels, already converted to FITS format 
+ *        by CCD_Fits_Image_Data_Convert.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Image_Write
+ * @see #CCD_Fits_Image_Preallocate
+ */
+int CCD_Fits_Image_Write_Preallocated(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+				      unsigned short *image_data)
+{
+	return Fits_Image_Write(filename,card_image_list,card_count,ncols,nrows,image_data,TRUE);
+}
+
+/**
+ * Format a complete 2D unsigned short FITS image (header unit and data unit) into a memory buffer, rather than
+ * writing it to disk. The buffer then holds exactly the bytes CCD_Fits_Image_Write would have written, and can be
+ * saved later using CCD_Fits_Image_Buffer_Write. This allows a caller to stage images in memory, and write them
+ * to disk on another thread.
+ * <ul>
+ * <li>We check buffer_length is at least CCD_Fits_Image_Header_Length_Get(card_count) + 
+ *     CCD_Fits_Image_Data_Length_Get(ncols,nrows) bytes.
+ * <li>We format the mandatory primary header cards using Fits_Image_Mandatory_Cards_Set, copy the caller's cards
+ *     after them, and add the END card and space padding.
+ * <li>We copy the image data after the header, and zero pad it to a multiple of CCD_FITS_IMAGE_BLOCK_LENGTH.
+ * </ul>
+ * @param card_image_list A list of card_count card images to put in the header after the mandatory cards.
+ * @param card_count The number of card images in card_image_list.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @param image_data The image data, of ncols*nrows pixels, already converted to FITS format 
+ *        by CCD_Fits_Image_Data_Convert.
+ * @param buffer The memory buffer to format the FITS image into.
+ * @param buffer_length The length of buffer in bytes.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_FITS_IMAGE_MANDATORY_CARD_COUNT
+ * @see #Fits_Image_Mandatory_Cards_Set
+ * @see #CCD_Fits_Image_Header_Length_Get
+ * @see #CCD_Fits_Image_Data_Length_Get
+ * @see #CCD_Fits_Image_Buffer_Write
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Serialise(char *card_image_list,int card_count,int ncols,int nrows,unsigned short *image_data,
+			     void *buffer,size_t buffer_length)
+{
+	char *buffer_ptr = NULL;
+	int header_length,data_length,image_length,card_length;
+
+	Fits_Image_Error_Number = 0;
+	if(((card_image_list == NULL)&&(card_count > 0))||(card_count < 0))
+	{
+		Fits_Image_Error_Number = 74;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Serialise:Illegal card image list (%p,%d).",
+			(void*)card_image_list,card_count);
+		return FALSE;
+	}
+	if((ncols < 1)||(nrows < 1)||(image_data == NULL)||(buffer == NULL))
+	{
+		Fits_Image_Error_Number = 75;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Serialise:Illegal image (%d,%d,%p,%p).",ncols,nrows,
+			(void*)image_data,buffer);
+		return FALSE;
+	}
+	header_length = CCD_Fits_Image_Header_Length_Get(card_count);
+	data_length = CCD_Fits_Image_Data_Length_Get(ncols,nrows);
+	image_length = ncols*nrows*sizeof(unsigned short);
+	if(buffer_length < (size_t)(header_length+data_length))
+	{
+		Fits_Image_Error_Number = 76;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Serialise:Buffer too short (%ld < %d).",
+			(long)buffer_length,header_length+data_length);
+		return FALSE;
+	}
+	/* header: mandatory cards, the caller's cards, END, then space padding */
+	buffer_ptr = (char *)buffer;
+	Fits_Image_Mandatory_Cards_Set(buffer_ptr,16,ncols,nrows,0);
+	card_length = CCD_FITS_IMAGE_MANDATORY_CARD_COUNT*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	if(card_count > 0)
+		memcpy(buffer_ptr+card_length,card_image_list,card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	card_length += card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	memset(buffer_ptr+card_length,' ',header_length-card_length);
+	memcpy(buffer_ptr+card_length,"END",3);
+	/* data (already in FITS format), then zero padding */
+	memcpy(buffer_ptr+header_length,image_data,image_length);
+	memset(buffer_ptr+header_length+image_length,0,data_length-image_length);
+	return TRUE;
+}
+
+/**
+ * Write a FITS image previously formatted into memory by CCD_Fits_Image_Serialise to disk, creating a new file.
+ * This is done in the same way as CCD_Fits_Image_Write (the file is created with O_EXCL, preallocated, written 
+ * with one write call and optionally synced, using the configured I/O backend), by calling Fits_Image_Iov_Write.
+ * @param filename The filename of the FITS image to create.
+ * @param buffer The formatted FITS image.
+ * @param length The length of the formatted FITS image in bytes.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Image_Iov_Write
+ * @see #CCD_Fits_Image_Serialise
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Buffer_Write(char *filename,void *buffer,size_t length)
+{
+	struct iovec iov[1];
+
+	Fits_Image_Error_Number = 0;
+	if(filename == NULL)
+	{
+		Fits_Image_Error_Number = 77;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Buffer_Write:filename is NULL.");
+		return FALSE;
+	}
+	if((buffer == NULL)||(length < CCD_FITS_IMAGE_BLOCK_LENGTH))
+	{
+		Fits_Image_Error_Number = 78;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Buffer_Write:Illegal buffer (%s,%p,%ld).",filename,
+			buffer,(long)length);
+		return FALSE;
+	}
+	iov[0].iov_base = buffer;
+	iov[0].iov_len = length;
+	return Fits_Image_Iov_Write(filename,iov,1,length,FALSE);
+}
+
+/**
+ * Write a 2D (or 3D) 32 bit IEEE float FITS image (BITPIX -32) to disk, creating a new file. This is used
+ * to save reduced (non-integer) products, rather than camera frames.
+ * <ul>
+ * <li>We convert the image data in place to big-endian (on a little-endian machine).
+ * <li>We write the headers and image data using Fits_Image_Unscaled_Write.
+ * </ul>
+ * @param filename The filename of the FITS image to create.
+ * @param card_image_list A list of card_count (CCD_FITS_HEADER_CARD_IMAGE_LENGTH column, not '\0' terminated)
+ *        card images to put in the header after the mandatory cards, as produced by
+ *        CCD_Fits_Header_To_Card_Images. These should not include any of the mandatory keywords, BZERO, BSCALE 
+ *        or END.
+ * @param card_count The number of card images in card_image_list.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @param plane_count The number of planes in the image (NAXIS3), or zero for a 2D image.
+ * @param image_data The image data, of ncols*nrows*(plane_count, or 1 for a 2D image) host order floats.
+ *        <b>This is byte swapped in place on a little-endian machine</b>, so the caller should not use
+ *        the data after this routine returns.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Image_Unscaled_Write
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Float_Write(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+			       int plane_count,float *image_data)
+{
+#if __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+	unsigned int *pixel_ptr = NULL;
+	size_t i,pixel_count;
+#endif
+
+	Fits_Image_Error_Number = 0;
+	if(filename == NULL)
+	{
+		Fits_Image_Error_Number = 79;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Float_Write:filename is NULL.");
+		return FALSE;
+	}
+	if(((card_image_list == NULL)&&(card_count > 0))||(card_count < 0))
+	{
+		Fits_Image_Error_Number = 80;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Float_Write:Illegal card image list (%p,%d).",
+			(void*)card_image_list,card_count);
+		return FALSE;
+	}
+	if((ncols < 1)||(nrows < 1)||(plane_count < 0)||(image_data == NULL))
+	{
+		Fits_Image_Error_Number = 81;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Float_Write:Illegal image (%d,%d,%d,%p).",ncols,nrows,
+			plane_count,(void*)image_data);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Float_Write(%s,card_count=%d,ncols=%d,nrows=%d,"
+			       "plane_count=%d):Started.",filename,card_count,ncols,nrows,plane_count);
+#endif
+	/* data: big-endian IEEE floats */
+#if __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+	pixel_ptr = (unsigned int *)image_data;
+	pixel_count = ((size_t)ncols)*((size_t)nrows)*((size_t)(plane_count > 0 ? plane_count : 1));
+	for(i = 0; i < pixel_count; i++)
+		pixel_ptr[i] = __builtin_bswap32(pixel_ptr[i]);
+#endif
+	return Fits_Image_Unscaled_Write(filename,card_image_list,card_count,-32,ncols,nrows,plane_count,image_data);
+}
+
+/**
+ * Write a 2D 32 bit integer FITS image (BITPIX 32) to disk, creating a new file, flipping the image in X and/or Y
+ * as it is converted. This is used to save stacked (co-added) frames, whose pixel values no longer fit in an 
+ * unsigned short.
+ * <ul>
+ * <li>We convert the image data in place to big-endian (on a little-endian machine), flipping it in X and/or Y
+ *     in the same pass. Rows are swapped in pairs (top and bottom) when flipping in Y, so no copy is needed.
+ * <li>We write the headers and image data using Fits_Image_Unscaled_Write.
+ * </ul>
+ * @param filename The filename of the FITS image to create.
+ * @param card_image_list A list of card_count (CCD_FITS_HEADER_CARD_IMAGE_LENGTH column, not '\0' terminated)
+ *        card images to put in the header after the mandatory cards, as produced by
+ *        CCD_Fits_Header_To_Card_Images. These should not include any of the mandatory keywords, BZERO, BSCALE 
+ *        or END.
+ * @param card_count The number of card images in card_image_list.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @param flip_x A boolean, if TRUE flip the image data in the X (horizontal) direction.
+ * @param flip_y A boolean, if TRUE flip the image data in the Y (vertical) direction.
+ * @param image_data The image data, of ncols*nrows host order unsigned integers. There is no BZERO, so the values
+ *        must be less than 2^31. <b>This is flipped and byte swapped in place</b>, so the caller should not use 
+ *        the data after this routine returns.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Image_Unscaled_Write
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Int_Write(char *filename,char *card_image_list,int card_count,int ncols,int nrows,int flip_x,
+			     int flip_y,unsigned int *image_data)
+{
+	unsigned int *row_a = NULL;
+	unsigned int *row_b = NULL;
+	unsigned int value;
+	int row,row_count,col,col_b;
+
+	Fits_Image_Error_Number = 0;
+	if(filename == NULL)
+	{
+		Fits_Image_Error_Number = 82;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Int_Write:filename is NULL.");
+		return FALSE;
+	}
+	if(((card_image_list == NULL)&&(card_count > 0))||(card_count < 0))
+	{
+		Fits_Image_Error_Number = 83;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Int_Write:Illegal card image list (%p,%d).",
+			(void*)card_image_list,card_count);
+		return FALSE;
+	}
+	if((ncols < 1)||(nrows < 1)||(image_data == NULL))
+	{
+		Fits_Image_Error_Number = 84;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Int_Write:Illegal image (%d,%d,%p).",ncols,nrows,
+			(void*)image_data);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Int_Write(%s,card_count=%d,ncols=%d,nrows=%d,"
+			       "flip_x=%d,flip_y=%d):Started.",filename,card_count,ncols,nrows,flip_x,flip_y);
+#endif
+	/* data: big-endian 32 bit integers, flipped. Row row is swapped with row nrows-1-row when flipping in Y,
+	** and column col with column ncols-1-col when flipping in X. A row (or pixel) mapped onto itself is 
+	** only byte swapped. */
+	if(flip_y)
+		row_count = (nrows+1)/2;
+	else
+		row_count = nrows;
+	for(row = 0; row < row_count; row++)
+	{
+		row_a = image_data+(((size_t)row)*((size_t)ncols));
+		if(flip_y)
+			row_b = image_data+(((size_t)(nrows-1-row))*((size_t)ncols));
+		else
+			row_b = row_a;
+		for(col = 0; col < ncols; col++)
+		{
+			if(flip_x)
+				col_b = ncols-1-col;
+			else
+				col_b = col;
+			/* when swapping within one row, only visit each pair once */
+			if((row_a == row_b)&&(col_b < col))
+				continue;
+			value = row_a[col];
+#if __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+			row_a[col] = __builtin_bswap32(row_b[col_b]);
+			row_b[col_b] = __builtin_bswap32(value);
+#else
+			row_a[col] = row_b[col_b];
+			row_b[col_b] = value;
+#endif
+		}
+	}
+	return Fits_Image_Unscaled_Write(filename,card_image_list,card_count,32,ncols,nrows,0,image_data);
+}
+
+/**
+ * Create an empty FITS image file, and preallocate the disk space for a 2D unsigned short image with 
+ * card_count header cards (as well as the mandatory cards) of ncols by nrows pixels, ready to be written by 
+ * CCD_Fits_Image_Write_Preallocated. This allows a set of files to be created before their image data is 
+ * available, so the block allocation is done outside the write path.
+ * <ul>
+ * <li>We compute the file length using CCD_Fits_Image_Header_Length_Get and CCD_Fits_Image_Data_Length_Get.
+ * <li>We create the file using open (with O_EXCL).
+ * <li>We preallocate the whole file using fallocate. If the filesystem does not support fallocate, the file is 
+ *     left empty, and the write extends it as usual.
+ * <li>We close the file.
+ * </ul>
+ * @param filename The filename of the FITS image to create.
+ * @param card_count The number of card images (excluding the mandatory ones and END) that will be in the header.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Header_Length_Get
+ * @see #CCD_Fits_Image_Data_Length_Get
+ * @see #CCD_Fits_Image_Write_Preallocated
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Preallocate(char *filename,int card_count,int ncols,int nrows)
+{
+	off_t file_length;
+	int fd,retval;
+
+	Fits_Image_Error_Number = 0;
+	if(filename == NULL)
+	{
+		Fits_Image_Error_Number = 39;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Preallocate:filename is NULL.");
+		return FALSE;
+	}
+	if((card_count < 0)||(ncols < 1)||(nrows < 1))
+	{
+		Fits_Image_Error_Number = 40;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Preallocate:Illegal image (%d,%d,%d).",card_count,
+			ncols,nrows);
+		return FALSE;
+	}
+	file_length = ((off_t)CCD_Fits_Image_Header_Length_Get(card_count))+
+		((off_t)CCD_Fits_Image_Data_Length_Get(ncols,nrows));
+	fd = open(filename,O_WRONLY|O_CREAT|O_EXCL,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+	if(fd < 0)
+	{
+		Fits_Image_Error_Number = 41;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Preallocate:Failed to create '%s' (%d:%s).",filename,
+			errno,strerror(errno));
+		return FALSE;
+	}
+	retval = fallocate(fd,0,0,file_length);
+	if((retval != 0)&&(errno != EOPNOTSUPP))
+	{
+		Fits_Image_Error_Number = 42;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Preallocate:Failed to preallocate %ld bytes for '%s' (%d:%s).",
+			(long)file_length,filename,errno,strerror(errno));
+		close(fd);
+		unlink(filename);
+		return FALSE;
+	}
+	retval = close(fd);
+	if(retval != 0)
+	{
+		Fits_Image_Error_Number = 43;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Preallocate:Failed to close '%s' (%d:%s).",filename,
+			errno,strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Overwrite the values of some float cards in the primary header of an existing FITS image, in place.
+ * This is used to fill in values that were not known when the image was written (for instance the rotator
+ * position at the end of the exposure, which is read back from the rotator's data recorder once the multrun
+ * has finished). It works on any FITS file, whether written by CCD_Fits_Image_Write or by CFITSIO, 
+ * as the header is not resized.
+ * <ul>
+ * <li>We open the file read/write.
+ * <li>We read the header a block (CCD_FITS_IMAGE_BLOCK_LENGTH) at a time, until we find the END card.
+ *     If the primary HDU has no data (NAXIS = 0) and not all the keywords have been found, we carry on into the 
+ *     first extension's header, which immediately follows. This is where the keywords of a tile compressed 
+ *     (fpack format) image are.
+ * <li>Any card with a keyword in keyword_list is overwritten with the corresponding value, using 
+ *     CCD_Fits_Header_Card_Image_Float_Set. Any block containing an overwritten card is written back with pwrite.
+ * <li>We close the file.
+ * </ul>
+ * The overwritten cards lose any comment.
+ * @param filename The filename of the FITS image to update.
+ * @param keyword_list A list of keyword_count keywords (uppercase) whose cards should be overwritten.
+ * @param value_list A list of keyword_count values, to overwrite the cards with.
+ * @param keyword_count The number of keywords in keyword_list.
+ * @return The routine returns TRUE on success, and FALSE on failure (including if a keyword is not in the header).
+ * @see #CCD_FITS_IMAGE_BLOCK_LENGTH
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ccd_fits_header.html#CCD_Fits_Header_Card_Image_Float_Set
+ */
+int CCD_Fits_Image_Header_Float_Update(char *filename,char **keyword_list,double *value_list,int keyword_count)
+{
+	char block[CCD_FITS_IMAGE_BLOCK_LENGTH];
+	char keyword_field[16];
+	char *card_image = NULL;
+	ssize_t length;
+	off_t offset;
+	int fd,i,card,found_count,block_modified,done,header_end,header_index,naxis;
+
+	Fits_Image_Error_Number = 0;
+	if((filename == NULL)||(keyword_list == NULL)||(value_list == NULL)||(keyword_count < 0))
+	{
+		Fits_Image_Error_Number = 14;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Header_Float_Update:Illegal arguments (%p,%p,%p,%d).",
+			(void*)filename,(void*)keyword_list,(void*)value_list,keyword_count);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Header_Float_Update(%s,keyword_count=%d):Started.",
+			       filename,keyword_count);
+#endif
+	fd = open(filename,O_RDWR);
+	if(fd < 0)
+	{
+		Fits_Image_Error_Number = 15;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Header_Float_Update:Failed to open '%s' (%d:%s).",
+			filename,errno,strerror(errno));
+		return FALSE;
+	}
+	found_count = 0;
+	offset = 0;
+	header_index = 0;
+	naxis = -1;
+	done = FALSE;
+	while(done == FALSE)
+	{
+		length = pread(fd,block,CCD_FITS_IMAGE_BLOCK_LENGTH,offset);
+		if(length != CCD_FITS_IMAGE_BLOCK_LENGTH)
+		{
+			Fits_Image_Error_Number = 16;
+			sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Header_Float_Update:"
+				"Failed to read header block at offset %ld of '%s' (%ld).",(long)offset,filename,
+				(long)length);
+			close(fd);
+			return FALSE;
+		}
+		block_modified = FALSE;
+		header_end = FALSE;
+		for(card = 0; (card < (CCD_FITS_IMAGE_BLOCK_LENGTH/CCD_FITS_HEADER_CARD_IMAGE_LENGTH))&&(done == FALSE)&&
+			    (header_end == FALSE); card++)
+		{
+			card_image = block+(card*CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+			if(strncmp(card_image,"END     ",8) == 0)
+			{
+				/* an empty primary HDU is followed directly by the first extension's header */
+				if((header_index == 0)&&(naxis == 0)&&(found_count < keyword_count))
+				{
+					header_index++;
+					header_end = TRUE;
+				}
+				else
+					done = TRUE;
+				continue;
+			}
+			if((header_index == 0)&&(strncmp(card_image,"NAXIS   =",9) == 0))
+				naxis = atoi(card_image+10);
+			for(i = 0; i < keyword_count; i++)
+			{
+				/* the keyword is in columns 1-8 of the card image, space padded */
+				sprintf(keyword_field,"%-8.8s",keyword_list[i]);
+				if(strncmp(card_image,keyword_field,8) == 0)
+				{
+					if(!CCD_Fits_Header_Card_Image_Float_Set(card_image,keyword_list[i],value_list[i]))
+					{
+						Fits_Image_Error_Number = 17;
+						sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Header_Float_Update:"
+							"Failed to set card %s to %.6f in '%s'.",keyword_list[i],
+							value_list[i],filename);
+						close(fd);
+						return FALSE;
+					}
+					block_modified = TRUE;
+					found_count++;
+				}
+			}
+		}
+		if(block_modified)
+		{
+			length = pwrite(fd,block,CCD_FITS_IMAGE_BLOCK_LENGTH,offset);
+			if(length != CCD_FITS_IMAGE_BLOCK_LENGTH)
+			{
+				Fits_Image_Error_Number = 18;
+				sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Header_Float_Update:"
+					"Failed to write header block at offset %ld of '%s' (%d:%s).",(long)offset,
+					filename,errno,strerror(errno));
+				close(fd);
+				return FALSE;
+			}
+		}
+		offset += CCD_FITS_IMAGE_BLOCK_LENGTH;
+	}
+	if(close(fd) != 0)
+	{
+		Fits_Image_Error_Number = 19;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Header_Float_Update:Failed to close '%s' (%d:%s).",
+			filename,errno,strerror(errno));
+		return FALSE;
+	}
+	if(found_count != keyword_count)
+	{
+		Fits_Image_Error_Number = 20;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Header_Float_Update:"
+			"Only found %d of %d keywords in '%s'.",found_count,keyword_count,filename);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Header_Float_Update(%s):Finished.",filename);
+#endif
+	return TRUE;
+}
+
+/**
+ * Create a FITS cube, to be filled in a plane at a time by CCD_Fits_Image_Cube_Plane_Write. The cube is a 3D 
+ * unsigned short image in the primary HDU, with one plane per frame, followed by a binary table extension 
+ * (EXTNAME FITS_IMAGE_CUBE_TABLE_EXTNAME) with one row per plane, of column_count double columns.
+ * The whole file is laid out (and preallocated) here, so each plane and it's table row can be written in place 
+ * as it arrives, without rewriting anything already written. 
+ * <ul>
+ * <li>We check the parameters.
+ * <li>We format the primary header: the mandatory cards (using Fits_Image_Mandatory_Cards_Set with plane_count),
+ *     the caller's cards, END and space padding.
+ * <li>We format the binary table header: XTENSION, BITPIX, NAXIS, NAXIS1 (the row length), NAXIS2 (plane_count),
+ *     PCOUNT, GCOUNT, TFIELDS, EXTNAME and a TTYPEn, TFORMn (1D) and TUNITn card for each column, then END and 
+ *     space padding.
+ * <li>We set every table value to NaN, so the rows of any planes that are never written can be recognised.
+ * <li>We create the file using open (with O_EXCL), and preallocate it using fallocate (if the filesystem supports it).
+ * <li>We write the primary header at the start of the file, and the table header and rows after the 
+ *     (space for the) image data, using Fits_Image_Pwritev.
+ * <li>We fill in cube, which keeps the file open.
+ * </ul>
+ * Planes that are never written are left as zero bytes, which read back as 32768 once BZERO is applied.
+ * @param filename The filename of the FITS cube to create.
+ * @param card_image_list A list of card_count card images to put in the primary header after the mandatory cards,
+ *        as for CCD_Fits_Image_Write.
+ * @param card_count The number of card images in card_image_list.
+ * @param ncols The number of columns in each plane (NAXIS1).
+ * @param nrows The number of rows in each plane (NAXIS2).
+ * @param plane_count The number of planes in the cube (NAXIS3).
+ * @param column_name_list A list of column_count column names (TTYPEn) for the per-plane binary table.
+ * @param column_unit_list A list of column_count column units (TUNITn) for the per-plane binary table.
+ *        This can be NULL, or contain NULL entries, for columns without units.
+ * @param column_count The number of columns in the per-plane binary table, 
+ *        up to CCD_FITS_IMAGE_CUBE_COLUMN_COUNT_MAX.
+ * @param cube The address of a cube structure to fill in. 
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_FITS_IMAGE_CUBE_MANDATORY_CARD_COUNT
+ * @see #CCD_FITS_IMAGE_CUBE_COLUMN_COUNT_MAX
+ * @see #CCD_Fits_Image_Cube_Struct
+ * @see #FITS_IMAGE_CUBE_TABLE_CARD_COUNT
+ * @see #FITS_IMAGE_CUBE_COLUMN_LENGTH
+ * @see #FITS_IMAGE_CUBE_TABLE_EXTNAME
+ * @see #Fits_Image_Card_Image_Set
+ * @see #Fits_Image_String_Card_Image_Set
+ * @see #Fits_Image_Mandatory_Cards_Set
+ * @see #Fits_Image_Block_Length_Get
+ * @see #Fits_Image_Double_Set
+ * @see #Fits_Image_Pwritev
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Cube_Create(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+			       int plane_count,char **column_name_list,char **column_unit_list,int column_count,
+			       struct CCD_Fits_Image_Cube_Struct *cube)
+{
+	char mandatory_card_list[CCD_FITS_IMAGE_CUBE_MANDATORY_CARD_COUNT*CCD_FITS_HEADER_CARD_IMAGE_LENGTH];
+	char end_block[CCD_FITS_IMAGE_BLOCK_LENGTH];
+	char keyword_string[16];
+	char value_string[32];
+	char *table_header = NULL;
+	char *card_image = NULL;
+	unsigned char *table_data = NULL;
+	struct iovec iov[FITS_IMAGE_IOVEC_COUNT];
+	off_t header_length,data_length,table_header_length,table_data_length;
+	int fd,retval,end_length,row_length,i;
+
+	Fits_Image_Error_Number = 0;
+	if((filename == NULL)||(strlen(filename) >= CCD_FITS_IMAGE_CUBE_FILENAME_LENGTH)||(cube == NULL))
+	{
+		Fits_Image_Error_Number = 21;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Create:Illegal filename or cube (%p,%p).",
+			(void*)filename,(void*)cube);
+		return FALSE;
+	}
+	if(((card_image_list == NULL)&&(card_count > 0))||(card_count < 0))
+	{
+		Fits_Image_Error_Number = 22;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Create:Illegal card image list (%p,%d).",
+			(void*)card_image_list,card_count);
+		return FALSE;
+	}
+	if((ncols < 1)||(nrows < 1)||(plane_count < 1)||(column_name_list == NULL)||(column_count < 1)||
+	   (column_count > CCD_FITS_IMAGE_CUBE_COLUMN_COUNT_MAX))
+	{
+		Fits_Image_Error_Number = 23;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Create:Illegal cube (%d,%d,%d,%p,%d).",ncols,nrows,
+			plane_count,(void*)column_name_list,column_count);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Cube_Create(%s,card_count=%d,ncols=%d,nrows=%d,"
+			       "plane_count=%d,column_count=%d):Started.",filename,card_count,ncols,nrows,plane_count,
+			       column_count);
+#endif
+	header_length = Fits_Image_Block_Length_Get((CCD_FITS_IMAGE_CUBE_MANDATORY_CARD_COUNT+card_count+1)*
+						    CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	data_length = Fits_Image_Block_Length_Get(((off_t)ncols)*nrows*plane_count*sizeof(unsigned short));
+	row_length = column_count*FITS_IMAGE_CUBE_COLUMN_LENGTH;
+	table_header_length = Fits_Image_Block_Length_Get((FITS_IMAGE_CUBE_TABLE_CARD_COUNT+(3*column_count)+1)*
+							  CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	table_data_length = Fits_Image_Block_Length_Get(((off_t)row_length)*plane_count);
+	/* primary header: mandatory cards, the caller's cards, END, then space padding */
+	Fits_Image_Mandatory_Cards_Set(mandatory_card_list,16,ncols,nrows,plane_count);
+	end_length = header_length-((CCD_FITS_IMAGE_CUBE_MANDATORY_CARD_COUNT+card_count)*
+				    CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	memset(end_block,' ',end_length);
+	memcpy(end_block,"END",3);
+	/* binary table header */
+	table_header = (char *)malloc(table_header_length);
+	table_data = (unsigned char *)calloc(table_data_length,sizeof(unsigned char));
+	if((table_header == NULL)||(table_data == NULL))
+	{
+		if(table_header != NULL)
+			free(table_header);
+		if(table_data != NULL)
+			free(table_data);
+		Fits_Image_Error_Number = 24;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Create:Failed to allocate table (%ld,%ld).",
+			(long)table_header_length,(long)table_data_length);
+		return FALSE;
+	}
+	memset(table_header,' ',table_header_length);
+	card_image = table_header;
+	Fits_Image_String_Card_Image_Set(card_image,"XTENSION","BINTABLE","binary table extension");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	Fits_Image_Card_Image_Set(card_image,"BITPIX","8","8-bit bytes");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	Fits_Image_Card_Image_Set(card_image,"NAXIS","2","2-dimensional binary table");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	sprintf(value_string,"%d",row_length);
+	Fits_Image_Card_Image_Set(card_image,"NAXIS1",value_string,"width of table in bytes");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	sprintf(value_string,"%d",plane_count);
+	Fits_Image_Card_Image_Set(card_image,"NAXIS2",value_string,"number of rows in table");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	Fits_Image_Card_Image_Set(card_image,"PCOUNT","0","size of special data area");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	Fits_Image_Card_Image_Set(card_image,"GCOUNT","1","one data group (required keyword)");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	sprintf(value_string,"%d",column_count);
+	Fits_Image_Card_Image_Set(card_image,"TFIELDS",value_string,"number of fields in each row");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	Fits_Image_String_Card_Image_Set(card_image,"EXTNAME",FITS_IMAGE_CUBE_TABLE_EXTNAME,
+					 "name of this binary table extension");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	for(i = 0; i < column_count; i++)
+	{
+		sprintf(keyword_string,"TTYPE%d",i+1);
+		Fits_Image_String_Card_Image_Set(card_image,keyword_string,column_name_list[i],"label for field");
+		card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+		sprintf(keyword_string,"TFORM%d",i+1);
+		Fits_Image_String_Card_Image_Set(card_image,keyword_string,"1D","data format of field: 8-byte DOUBLE");
+		card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+		if((column_unit_list != NULL)&&(column_unit_list[i] != NULL))
+		{
+			sprintf(keyword_string,"TUNIT%d",i+1);
+			Fits_Image_String_Card_Image_Set(card_image,keyword_string,column_unit_list[i],
+							 "physical unit of field");
+			card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+		}
+	}
+	memcpy(card_image,"END",3);
+	/* table rows, all NaN until each plane is written. The padding after the rows stays zero. */
+	for(i = 0; i < (plane_count*column_count); i++)
+		Fits_Image_Double_Set(table_data+(i*FITS_IMAGE_CUBE_COLUMN_LENGTH),NAN);
+	/* create and preallocate the file */
+	fd = open(filename,O_RDWR|O_CREAT|O_EXCL,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+	if(fd < 0)
+	{
+		free(table_header);
+		free(table_data);
+		Fits_Image_Error_Number = 25;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Create:Failed to create '%s' (%d:%s).",filename,
+			errno,strerror(errno));
+		return FALSE;
+	}
+	retval = fallocate(fd,0,0,header_length+data_length+table_header_length+table_data_length);
+	if((retval != 0)&&(errno != EOPNOTSUPP))
+	{
+		free(table_header);
+		free(table_data);
+		Fits_Image_Error_Number = 26;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Create:Failed to preallocate %ld bytes for '%s' "
+			"(%d:%s).",(long)(header_length+data_length+table_header_length+table_data_length),filename,
+			errno,strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+	/* primary header */
+	iov[0].iov_base = mandatory_card_list;
+	iov[0].iov_len = CCD_FITS_IMAGE_CUBE_MANDATORY_CARD_COUNT*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	iov[1].iov_base = card_image_list;
+	iov[1].iov_len = card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	iov[2].iov_base = end_block;
+	iov[2].iov_len = end_length;
+	if(!Fits_Image_Pwritev(fd,iov,3,0,filename))
+	{
+		free(table_header);
+		free(table_data);
+		close(fd);
+		return FALSE;
+	}
+	/* table header and rows, after the image data */
+	iov[0].iov_base = table_header;
+	iov[0].iov_len = table_header_length;
+	iov[1].iov_base = table_data;
+	iov[1].iov_len = table_data_length;
+	if(!Fits_Image_Pwritev(fd,iov,2,header_length+data_length,filename))
+	{
+		free(table_header);
+		free(table_data);
+		close(fd);
+		return FALSE;
+	}
+	free(table_header);
+	free(table_data);
+	cube->File_Descriptor = fd;
+	strcpy(cube->Filename,filename);
+	cube->Ncols = ncols;
+	cube->Nrows = nrows;
+	cube->Plane_Count = plane_count;
+	cube->Column_Count = column_count;
+	cube->Data_Offset = header_length;
+	cube->Table_Data_Offset = header_length+data_length+table_header_length;
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Cube_Create(%s):Finished.",filename);
+#endif
+	return TRUE;
+}
+
+/**
+ * Open an existing FITS cube (created by CCD_Fits_Image_Cube_Create) read/write, so it's per-plane table values
+ * can be updated using CCD_Fits_Image_Cube_Row_Update.
+ * <ul>
+ * <li>We open the file read/write.
+ * <li>We read the primary header using Fits_Image_Header_Integers_Get, to get the NAXIS/NAXIS1/NAXIS2/NAXIS3 values
+ *     and the length of the primary header.
+ * <li>We read the binary table header following the image data using Fits_Image_Header_Integers_Get, to get the 
+ *     NAXIS1/NAXIS2/TFIELDS values and the length of the table header.
+ * <li>We check the layout is the one CCD_Fits_Image_Cube_Create writes.
+ * <li>We fill in cube, which keeps the file open.
+ * </ul>
+ * @param filename The filename of the FITS cube to open.
+ * @param cube The address of a cube structure to fill in.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Cube_Struct
+ * @see #FITS_IMAGE_CUBE_COLUMN_LENGTH
+ * @see #Fits_Image_Header_Integers_Get
+ * @see #Fits_Image_Block_Length_Get
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Cube_Open(char *filename,struct CCD_Fits_Image_Cube_Struct *cube)
+{
+	const char *primary_keyword_list[4] = {"NAXIS","NAXIS1","NAXIS2","NAXIS3"};
+	const char *table_keyword_list[3] = {"NAXIS1","NAXIS2","TFIELDS"};
+	int primary_value_list[4];
+	int table_value_list[3];
+	off_t header_length,data_length,table_header_length;
+	int fd;
+
+	Fits_Image_Error_Number = 0;
+	if((filename == NULL)||(strlen(filename) >= CCD_FITS_IMAGE_CUBE_FILENAME_LENGTH)||(cube == NULL))
+	{
+		Fits_Image_Error_Number = 27;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Open:Illegal filename or cube (%p,%p).",
+			(void*)filename,(void*)cube);
+		return FALSE;
+	}
+	fd = open(filename,O_RDWR);
+	if(fd < 0)
+	{
+		Fits_Image_Error_Number = 28;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Open:Failed to open '%s' (%d:%s).",filename,
+			errno,strerror(errno));
+		return FALSE;
+	}
+	if(!Fits_Image_Header_Integers_Get(fd,0,filename,primary_keyword_list,primary_value_list,4,&header_length))
+	{
+		close(fd);
+		return FALSE;
+	}
+	if((primary_value_list[0] != 3)||(primary_value_list[1] < 1)||(primary_value_list[2] < 1)||
+	   (primary_value_list[3] < 1))
+	{
+		Fits_Image_Error_Number = 29;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Open:'%s' is not a cube (%d,%d,%d,%d).",filename,
+			primary_value_list[0],primary_value_list[1],primary_value_list[2],primary_value_list[3]);
+		close(fd);
+		return FALSE;
+	}
+	data_length = Fits_Image_Block_Length_Get(((off_t)primary_value_list[1])*primary_value_list[2]*
+						  primary_value_list[3]*sizeof(unsigned short));
+	if(!Fits_Image_Header_Integers_Get(fd,header_length+data_length,filename,table_keyword_list,table_value_list,3,
+					   &table_header_length))
+	{
+		close(fd);
+		return FALSE;
+	}
+	if((table_value_list[2] < 1)||(table_value_list[0] != (table_value_list[2]*FITS_IMAGE_CUBE_COLUMN_LENGTH))||
+	   (table_value_list[1] != primary_value_list[3]))
+	{
+		Fits_Image_Error_Number = 30;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Open:'%s' has an unexpected plane table (%d,%d,%d).",
+			filename,table_value_list[0],table_value_list[1],table_value_list[2]);
+		close(fd);
+		return FALSE;
+	}
+	cube->File_Descriptor = fd;
+	strcpy(cube->Filename,filename);
+	cube->Ncols = primary_value_list[1];
+	cube->Nrows = primary_value_list[2];
+	cube->Plane_Count = primary_value_list[3];
+	cube->Column_Count = table_value_list[2];
+	cube->Data_Offset = header_length;
+	cube->Table_Data_Offset = header_length+data_length+table_header_length;
+	return TRUE;
+}
+
+/**
+ * Write one plane of a FITS cube, and it's row in the per-plane binary table. Different planes of the same cube
+ * can be written concurrently from different threads.
+ * <ul>
+ * <li>We check the parameters.
+ * <li>We write the image data at plane_index planes after cube->Data_Offset, using Fits_Image_Pwritev.
+ * <li>We convert the row values to big-endian doubles using Fits_Image_Double_Set, and write them at
+ *     plane_index rows after cube->Table_Data_Offset, using Fits_Image_Pwritev.
+ * </ul>
+ * @param cube The cube to write to, created by CCD_Fits_Image_Cube_Create.
+ * @param plane_index The index of the plane to write, from 0 to cube->Plane_Count-1.
+ * @param image_data The image data, of cube->Ncols*cube->Nrows pixels, already converted to FITS 
+ *        (big-endian, BZERO offset) format by CCD_Fits_Image_Data_Convert.
+ * @param row_value_list A list of cube->Column_Count values to write into the plane's table row.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Cube_Struct
+ * @see #CCD_FITS_IMAGE_CUBE_COLUMN_COUNT_MAX
+ * @see #FITS_IMAGE_CUBE_COLUMN_LENGTH
+ * @see #Fits_Image_Double_Set
+ * @see #Fits_Image_Pwritev
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Cube_Plane_Write(struct CCD_Fits_Image_Cube_Struct *cube,int plane_index,
+				    unsigned short *image_data,double *row_value_list)
+{
+	unsigned char row[CCD_FITS_IMAGE_CUBE_COLUMN_COUNT_MAX*FITS_IMAGE_CUBE_COLUMN_LENGTH];
+	struct iovec iov[1];
+	off_t plane_length;
+	int i;
+
+	Fits_Image_Error_Number = 0;
+	if((cube == NULL)||(image_data == NULL)||(row_value_list == NULL))
+	{
+		Fits_Image_Error_Number = 31;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Plane_Write:Illegal arguments (%p,%p,%p).",
+			(void*)cube,(void*)image_data,(void*)row_value_list);
+		return FALSE;
+	}
+	if((plane_index < 0)||(plane_index >= cube->Plane_Count))
+	{
+		Fits_Image_Error_Number = 32;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Plane_Write:Plane index %d out of range (0..%d) "
+			"for '%s'.",plane_index,cube->Plane_Count-1,cube->Filename);
+		return FALSE;
+	}
+	plane_length = ((off_t)cube->Ncols)*cube->Nrows*sizeof(unsigned short);
+	iov[0].iov_base = image_data;
+	iov[0].iov_len = plane_length;
+	if(!Fits_Image_Pwritev(cube->File_Descriptor,iov,1,cube->Data_Offset+(plane_index*plane_length),
+			       cube->Filename))
+		return FALSE;
+	for(i = 0; i < cube->Column_Count; i++)
+		Fits_Image_Double_Set(row+(i*FITS_IMAGE_CUBE_COLUMN_LENGTH),row_value_list[i]);
+	iov[0].iov_base = row;
+	iov[0].iov_len = cube->Column_Count*FITS_IMAGE_CUBE_COLUMN_LENGTH;
+	if(!Fits_Image_Pwritev(cube->File_Descriptor,iov,1,cube->Table_Data_Offset+
+			       (((off_t)plane_index)*cube->Column_Count*FITS_IMAGE_CUBE_COLUMN_LENGTH),cube->Filename))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Overwrite one value in the per-plane binary table of a FITS cube. This is used to fill in per-plane values
+ * that were not known when the plane was written (see CCD_Fits_Image_Header_Float_Update for single images).
+ * @param cube The cube to update, created by CCD_Fits_Image_Cube_Create or opened by CCD_Fits_Image_Cube_Open.
+ * @param plane_index The index of the plane (table row) to update, from 0 to cube->Plane_Count-1.
+ * @param column_index The index of the column to update, from 0 to cube->Column_Count-1.
+ * @param value The new value.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Cube_Struct
+ * @see #FITS_IMAGE_CUBE_COLUMN_LENGTH
+ * @see #Fits_Image_Double_Set
+ * @see #Fits_Image_Pwritev
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Cube_Row_Update(struct CCD_Fits_Image_Cube_Struct *cube,int plane_index,int column_index,
+				   double value)
+{
+	unsigned char field[FITS_IMAGE_CUBE_COLUMN_LENGTH];
+	struct iovec iov[1];
+
+	Fits_Image_Error_Number = 0;
+	if(cube == NULL)
+	{
+		Fits_Image_Error_Number = 33;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Row_Update:cube is NULL.");
+		return FALSE;
+	}
+	if((plane_index < 0)||(plane_index >= cube->Plane_Count)||(column_index < 0)||
+	   (column_index >= cube->Column_Count))
+	{
+		Fits_Image_Error_Number = 34;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Row_Update:Plane %d / column %d out of range "
+			"(%d,%d) for '%s'.",plane_index,column_index,cube->Plane_Count,cube->Column_Count,cube->Filename);
+		return FALSE;
+	}
+	Fits_Image_Double_Set(field,value);
+	iov[0].iov_base = field;
+	iov[0].iov_len = FITS_IMAGE_CUBE_COLUMN_LENGTH;
+	if(!Fits_Image_Pwritev(cube->File_Descriptor,iov,1,cube->Table_Data_Offset+
+			       ((((off_t)plane_index)*cube->Column_Count)+column_index)*FITS_IMAGE_CUBE_COLUMN_LENGTH,
+			       cube->Filename))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Close a FITS cube created by CCD_Fits_Image_Cube_Create or opened by CCD_Fits_Image_Cube_Open.
+ * @param cube The cube to close. The File_Descriptor is set to -1.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Cube_Struct
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Cube_Close(struct CCD_Fits_Image_Cube_Struct *cube)
+{
+	int retval;
+
+	Fits_Image_Error_Number = 0;
+	if(cube == NULL)
+	{
+		Fits_Image_Error_Number = 35;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Close:cube is NULL.");
+		return FALSE;
+	}
+	retval = close(cube->File_Descriptor);
+	cube->File_Descriptor = -1;
+	if(retval != 0)
+	{
+		Fits_Image_Error_Number = 36;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Cube_Close:Failed to close '%s' (%d:%s).",
+			cube->Filename,errno,strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Create a raw capture file, to be filled in a frame at a time by CCD_Fits_Image_Raw_Frame_Write, and later
+ * converted into FITS images (see CCD_Fits_Image_Raw_Frame_Read). This is much cheaper than writing a FITS image 
+ * per frame: the whole file is created and preallocated once, and each frame is written in one system call,
+ * unconverted, into it's fixed-size slot.
+ * <ul>
+ * <li>We check the parameters.
+ * <li>We compute the file layout: the header (a Fits_Image_Raw_Header_Struct), then frame_count frame slots,
+ *     each a CCD_Fits_Image_Raw_Record_Struct followed by card_count card images, then the image data. 
+ *     The header, records and image data are each padded to CCD_FITS_IMAGE_RAW_ALIGNMENT, 
+ *     using Fits_Image_Raw_Align_Get.
+ * <li>We create the file using open (with O_EXCL), and preallocate it using fallocate (if the filesystem supports it).
+ *     The unwritten frame slots are zero, and so read back as invalid.
+ * <li>We write the header at the start of the file using Fits_Image_Pwritev.
+ * <li>We fill in raw, which keeps the file open.
+ * </ul>
+ * @param filename The filename of the raw capture file to create.
+ * @param card_count The number of FITS header card images stored with each frame.
+ * @param ncols The number of columns in each frame.
+ * @param nrows The number of rows in each frame.
+ * @param frame_count The number of frame slots in the file.
+ * @param value_name_list A list of value_count names of the per-frame values stored in each frame record.
+ * @param value_count The number of per-frame values, up to CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX.
+ * @param flip_x A boolean, whether the frames should be flipped in X when they are converted to FITS.
+ * @param flip_y A boolean, whether the frames should be flipped in Y when they are converted to FITS.
+ * @param raw The address of a raw capture file structure to fill in.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_FITS_IMAGE_RAW_FILENAME_LENGTH
+ * @see #CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX
+ * @see #CCD_FITS_IMAGE_RAW_VALUE_NAME_LENGTH
+ * @see #CCD_Fits_Image_Raw_Struct
+ * @see #CCD_Fits_Image_Raw_Record_Struct
+ * @see #FITS_IMAGE_RAW_MAGIC
+ * @see #FITS_IMAGE_RAW_VERSION
+ * @see #Fits_Image_Raw_Header_Struct
+ * @see #Fits_Image_Raw_Align_Get
+ * @see #Fits_Image_Pwritev
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_general.html#CCD_GENERAL_IS_BOOLEAN
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Raw_Create(char *filename,int card_count,int ncols,int nrows,int frame_count,
+			      char **value_name_list,int value_count,int flip_x,int flip_y,
+			      struct CCD_Fits_Image_Raw_Struct *raw)
+{
+	struct Fits_Image_Raw_Header_Struct header;
+	struct iovec iov[2];
+	off_t header_length,record_length,frame_length;
+	int fd,retval,i;
+
+	Fits_Image_Error_Number = 0;
+	if((filename == NULL)||(strlen(filename) >= CCD_FITS_IMAGE_RAW_FILENAME_LENGTH)||(raw == NULL))
+	{
+		Fits_Image_Error_Number = 57;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Create:Illegal filename or raw (%p,%p).",
+			(void*)filename,(void*)raw);
+		return FALSE;
+	}
+	if((card_count < 0)||(ncols < 1)||(nrows < 1)||(frame_count < 1)||
+	   ((value_name_list == NULL)&&(value_count > 0))||(value_count < 0)||
+	   (value_count > CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX)||(!CCD_GENERAL_IS_BOOLEAN(flip_x))||
+	   (!CCD_GENERAL_IS_BOOLEAN(flip_y)))
+	{
+		Fits_Image_Error_Number = 58;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Create:Illegal raw capture file "
+			"(%d,%d,%d,%d,%p,%d,%d,%d).",card_count,ncols,nrows,frame_count,(void*)value_name_list,
+			value_count,flip_x,flip_y);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Raw_Create(%s,card_count=%d,ncols=%d,nrows=%d,"
+			       "frame_count=%d,value_count=%d):Started.",filename,card_count,ncols,nrows,frame_count,
+			       value_count);
+#endif
+	memset(&header,0,sizeof(struct Fits_Image_Raw_Header_Struct));
+	strcpy(header.Magic,FITS_IMAGE_RAW_MAGIC);
+	header.Version = FITS_IMAGE_RAW_VERSION;
+	header.Ncols = ncols;
+	header.Nrows = nrows;
+	header.Frame_Count = frame_count;
+	header.Card_Count = card_count;
+	header.Value_Count = value_count;
+	header.Flip_X = flip_x;
+	header.Flip_Y = flip_y;
+	for(i = 0; i < value_count; i++)
+	{
+		if((value_name_list[i] == NULL)||(strlen(value_name_list[i]) >= CCD_FITS_IMAGE_RAW_VALUE_NAME_LENGTH))
+		{
+			Fits_Image_Error_Number = 59;
+			sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Create:Illegal value name %d.",i);
+			return FALSE;
+		}
+		strcpy(header.Value_Name_List[i],value_name_list[i]);
+	}
+	header_length = Fits_Image_Raw_Align_Get(sizeof(struct Fits_Image_Raw_Header_Struct));
+	record_length = Fits_Image_Raw_Align_Get(sizeof(struct CCD_Fits_Image_Raw_Record_Struct)+
+						 (((off_t)card_count)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH));
+	frame_length = record_length+Fits_Image_Raw_Align_Get(((off_t)ncols)*nrows*sizeof(unsigned short));
+	header.Header_Length = header_length;
+	header.Record_Length = record_length;
+	header.Frame_Length = frame_length;
+	/* create and preallocate the file */
+	fd = open(filename,O_RDWR|O_CREAT|O_EXCL,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+	if(fd < 0)
+	{
+		Fits_Image_Error_Number = 60;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Create:Failed to create '%s' (%d:%s).",filename,
+			errno,strerror(errno));
+		return FALSE;
+	}
+	retval = fallocate(fd,0,0,header_length+(frame_length*frame_count));
+	if((retval != 0)&&(errno != EOPNOTSUPP))
+	{
+		Fits_Image_Error_Number = 61;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Create:Failed to preallocate %ld bytes for '%s' "
+			"(%d:%s).",(long)(header_length+(frame_length*frame_count)),filename,errno,strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+	/* extend the file to it's full length if it could not be preallocated */
+	if((retval != 0)&&(ftruncate(fd,header_length+(frame_length*frame_count)) != 0))
+	{
+		Fits_Image_Error_Number = 62;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Create:Failed to extend '%s' to %ld bytes "
+			"(%d:%s).",filename,(long)(header_length+(frame_length*frame_count)),errno,strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(struct Fits_Image_Raw_Header_Struct);
+	if(!Fits_Image_Pwritev(fd,iov,1,0,filename))
+	{
+		close(fd);
+		return FALSE;
+	}
+	raw->File_Descriptor = fd;
+	strcpy(raw->Filename,filename);
+	raw->Ncols = ncols;
+	raw->Nrows = nrows;
+	raw->Frame_Count = frame_count;
+	raw->Card_Count = card_count;
+	raw->Value_Count = value_count;
+	memcpy(raw->Value_Name_List,header.Value_Name_List,sizeof(header.Value_Name_List));
+	raw->Flip_X = flip_x;
+	raw->Flip_Y = flip_y;
+	raw->Header_Length = header_length;
+	raw->Record_Length = record_length;
+	raw->Frame_Length = frame_length;
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Raw_Create(%s):Finished.",filename);
+#endif
+	return TRUE;
+}
+
+/**
+ * Open an existing raw capture file (created by CCD_Fits_Image_Raw_Create) read only, so it's frames can be
+ * read using CCD_Fits_Image_Raw_Frame_Read.
+ * <ul>
+ * <li>We open the file read only.
+ * <li>We read the header using Fits_Image_Pread.
+ * <li>We check the magic string, version and layout are the ones CCD_Fits_Image_Raw_Create writes.
+ * <li>We fill in raw, which keeps the file open.
+ * </ul>
+ * @param filename The filename of the raw capture file to open.
+ * @param raw The address of a raw capture file structure to fill in.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Raw_Struct
+ * @see #FITS_IMAGE_RAW_MAGIC
+ * @see #FITS_IMAGE_RAW_VERSION
+ * @see #Fits_Image_Raw_Header_Struct
+ * @see #Fits_Image_Raw_Align_Get
+ * @see #Fits_Image_Pread
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Raw_Open(char *filename,struct CCD_Fits_Image_Raw_Struct *raw)
+{
+	struct Fits_Image_Raw_Header_Struct header;
+	int fd;
+
+	Fits_Image_Error_Number = 0;
+	if((filename == NULL)||(strlen(filename) >= CCD_FITS_IMAGE_RAW_FILENAME_LENGTH)||(raw == NULL))
+	{
+		Fits_Image_Error_Number = 63;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Open:Illegal filename or raw (%p,%p).",
+			(void*)filename,(void*)raw);
+		return FALSE;
+	}
+	fd = open(filename,O_RDONLY);
+	if(fd < 0)
+	{
+		Fits_Image_Error_Number = 64;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Open:Failed to open '%s' (%d:%s).",filename,
+			errno,strerror(errno));
+		return FALSE;
+	}
+	if(!Fits_Image_Pread(fd,&header,sizeof(struct Fits_Image_Raw_Header_Struct),0,filename))
+	{
+		close(fd);
+		return FALSE;
+	}
+	if((strncmp(header.Magic,FITS_IMAGE_RAW_MAGIC,sizeof(header.Magic)) != 0)||
+	   (header.Version != FITS_IMAGE_RAW_VERSION)||(header.Ncols < 1)||(header.Nrows < 1)||
+	   (header.Frame_Count < 1)||(header.Card_Count < 0)||(header.Value_Count < 0)||
+	   (header.Value_Count > CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX)||
+	   (header.Header_Length != Fits_Image_Raw_Align_Get(sizeof(struct Fits_Image_Raw_Header_Struct)))||
+	   (header.Record_Length != Fits_Image_Raw_Align_Get(sizeof(struct CCD_Fits_Image_Raw_Record_Struct)+
+			       (((off_t)header.Card_Count)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH)))||
+	   (header.Frame_Length != header.Record_Length+
+	    Fits_Image_Raw_Align_Get(((off_t)header.Ncols)*header.Nrows*sizeof(unsigned short))))
+	{
+		Fits_Image_Error_Number = 65;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Open:'%s' is not a version %d raw capture file "
+			"(%.7s,%d,%d,%d,%d).",filename,FITS_IMAGE_RAW_VERSION,header.Magic,header.Version,
+			header.Ncols,header.Nrows,header.Frame_Count);
+		close(fd);
+		return FALSE;
+	}
+	raw->File_Descriptor = fd;
+	strcpy(raw->Filename,filename);
+	raw->Ncols = header.Ncols;
+	raw->Nrows = header.Nrows;
+	raw->Frame_Count = header.Frame_Count;
+	raw->Card_Count = header.Card_Count;
+	raw->Value_Count = header.Value_Count;
+	memcpy(raw->Value_Name_List,header.Value_Name_List,sizeof(header.Value_Name_List));
+	raw->Flip_X = header.Flip_X;
+	raw->Flip_Y = header.Flip_Y;
+	raw->Header_Length = header.Header_Length;
+	raw->Record_Length = header.Record_Length;
+	raw->Frame_Length = header.Frame_Length;
+	return TRUE;
+}
+
+/**
+ * Write one frame into it's slot in a raw capture file. The record, card images and image data are written
+ * with one Fits_Image_Pwritev call, at a fixed offset, so different frames of the same file can be written
+ * concurrently from different threads. Frames arriving in order are written sequentially through the file.
+ * @param raw The raw capture file to write to, created by CCD_Fits_Image_Raw_Create.
+ * @param frame_index The index of the frame slot to write, from 0 to raw->Frame_Count-1.
+ * @param record The frame's metadata record. The Is_Valid and Frame_Index fields are filled in here.
+ * @param card_image_list A list of raw->Card_Count card images, the frame's FITS header (excluding the 
+ *        mandatory cards), as for CCD_Fits_Image_Write.
+ * @param image_data The image data, of raw->Ncols*raw->Nrows pixels, as read out of the camera 
+ *        (i.e. not converted by CCD_Fits_Image_Data_Convert).
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Raw_Struct
+ * @see #CCD_Fits_Image_Raw_Record_Struct
+ * @see #FITS_IMAGE_RAW_RECORD_VALID
+ * @see #Fits_Image_Raw_Zero_Block
+ * @see #Fits_Image_Pwritev
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Raw_Frame_Write(struct CCD_Fits_Image_Raw_Struct *raw,int frame_index,
+				   struct CCD_Fits_Image_Raw_Record_Struct *record,char *card_image_list,
+				   unsigned short *image_data)
+{
+	struct CCD_Fits_Image_Raw_Record_Struct write_record;
+	struct iovec iov[4];
+	off_t card_length;
+
+	Fits_Image_Error_Number = 0;
+	if((raw == NULL)||(record == NULL)||((card_image_list == NULL)&&(raw->Card_Count > 0))||(image_data == NULL))
+	{
+		Fits_Image_Error_Number = 66;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Frame_Write:Illegal arguments (%p,%p,%p,%p).",
+			(void*)raw,(void*)record,(void*)card_image_list,(void*)image_data);
+		return FALSE;
+	}
+	if((frame_index < 0)||(frame_index >= raw->Frame_Count))
+	{
+		Fits_Image_Error_Number = 67;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Frame_Write:Frame index %d out of range (0..%d) "
+			"for '%s'.",frame_index,raw->Frame_Count-1,raw->Filename);
+		return FALSE;
+	}
+	write_record = (*record);
+	write_record.Is_Valid = FITS_IMAGE_RAW_RECORD_VALID;
+	write_record.Frame_Index = frame_index;
+	card_length = ((off_t)raw->Card_Count)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	iov[0].iov_base = &write_record;
+	iov[0].iov_len = sizeof(struct CCD_Fits_Image_Raw_Record_Struct);
+	iov[1].iov_base = card_image_list;
+	iov[1].iov_len = card_length;
+	/* pad the record, so the image data is aligned */
+	iov[2].iov_base = Fits_Image_Raw_Zero_Block;
+	iov[2].iov_len = raw->Record_Length-(sizeof(struct CCD_Fits_Image_Raw_Record_Struct)+card_length);
+	iov[3].iov_base = image_data;
+	iov[3].iov_len = ((off_t)raw->Ncols)*raw->Nrows*sizeof(unsigned short);
+	if(!Fits_Image_Pwritev(raw->File_Descriptor,iov,4,raw->Header_Length+(frame_index*raw->Frame_Length),
+			       raw->Filename))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Read one frame from it's slot in a raw capture file. 
+ * <ul>
+ * <li>We check the parameters.
+ * <li>We read the frame's record using Fits_Image_Pread. If the slot has not been written 
+ *     (the Is_Valid field is not FITS_IMAGE_RAW_RECORD_VALID), we set record->Is_Valid to FALSE and return.
+ * <li>If card_image_list is not NULL, we read the frame's card images into it.
+ * <li>If image_data is not NULL, we read the frame's (unconverted) image data into it.
+ * </ul>
+ * @param raw The raw capture file to read from, opened by CCD_Fits_Image_Raw_Open.
+ * @param frame_index The index of the frame slot to read, from 0 to raw->Frame_Count-1.
+ * @param record The address of a record to fill in. record->Is_Valid is FALSE if the frame was never written 
+ *        (it was dropped), in which case the card images and image data are not read.
+ * @param card_image_list Where to put the raw->Card_Count card images of the frame's FITS header, or NULL.
+ * @param image_data Where to put the raw->Ncols*raw->Nrows pixels of image data, or NULL.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Raw_Struct
+ * @see #CCD_Fits_Image_Raw_Record_Struct
+ * @see #FITS_IMAGE_RAW_RECORD_VALID
+ * @see #Fits_Image_Pread
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Raw_Frame_Read(struct CCD_Fits_Image_Raw_Struct *raw,int frame_index,
+				  struct CCD_Fits_Image_Raw_Record_Struct *record,char *card_image_list,
+				  unsigned short *image_data)
+{
+	off_t offset;
+
+	Fits_Image_Error_Number = 0;
+	if((raw == NULL)||(record == NULL))
+	{
+		Fits_Image_Error_Number = 68;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Frame_Read:Illegal arguments (%p,%p).",
+			(void*)raw,(void*)record);
+		return FALSE;
+	}
+	if((frame_index < 0)||(frame_index >= raw->Frame_Count))
+	{
+		Fits_Image_Error_Number = 69;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Frame_Read:Frame index %d out of range (0..%d) "
+			"for '%s'.",frame_index,raw->Frame_Count-1,raw->Filename);
+		return FALSE;
+	}
+	offset = raw->Header_Length+(frame_index*raw->Frame_Length);
+	if(!Fits_Image_Pread(raw->File_Descriptor,record,sizeof(struct CCD_Fits_Image_Raw_Record_Struct),offset,
+			     raw->Filename))
+		return FALSE;
+	if(record->Is_Valid != FITS_IMAGE_RAW_RECORD_VALID)
+	{
+		record->Is_Valid = FALSE;
+		return TRUE;
+	}
+	record->Is_Valid = TRUE;
+	record->Filename[CCD_FITS_IMAGE_RAW_FILENAME_LENGTH-1] = '\0';
+	if(card_image_list != NULL)
+	{
+		if(!Fits_Image_Pread(raw->File_Descriptor,card_image_list,
+				     ((size_t)raw->Card_Count)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH,
+				     offset+sizeof(struct CCD_Fits_Image_Raw_Record_Struct),raw->Filename))
+			return FALSE;
+	}
+	if(image_data != NULL)
+	{
+		if(!Fits_Image_Pread(raw->File_Descriptor,image_data,
+				     ((size_t)raw->Ncols)*raw->Nrows*sizeof(unsigned short),offset+raw->Record_Length,
+				     raw->Filename))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Rewrite the record and card images of a frame already written into a raw capture file, leaving it's image data 
+ * alone. This is used to replace per-frame values that are only known once the capture has finished 
+ * (e.g. back-filled rotator positions), in both the record and the stored FITS header.
+ * @param raw The raw capture file to write to, created by CCD_Fits_Image_Raw_Create.
+ * @param frame_index The index of the frame slot to rewrite, from 0 to raw->Frame_Count-1. The slot must 
+ *        already have been written by CCD_Fits_Image_Raw_Frame_Write.
+ * @param record The frame's updated metadata record (as read by CCD_Fits_Image_Raw_Frame_Read). 
+ *        The Is_Valid and Frame_Index fields are filled in here.
+ * @param card_image_list A list of raw->Card_Count card images, the frame's updated FITS header.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Raw_Struct
+ * @see #CCD_Fits_Image_Raw_Record_Struct
+ * @see #FITS_IMAGE_RAW_RECORD_VALID
+ * @see #Fits_Image_Pwritev
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Raw_Record_Write(struct CCD_Fits_Image_Raw_Struct *raw,int frame_index,
+				    struct CCD_Fits_Image_Raw_Record_Struct *record,char *card_image_list)
+{
+	struct CCD_Fits_Image_Raw_Record_Struct write_record;
+	struct iovec iov[2];
+
+	Fits_Image_Error_Number = 0;
+	if((raw == NULL)||(record == NULL)||((card_image_list == NULL)&&(raw->Card_Count > 0)))
+	{
+		Fits_Image_Error_Number = 85;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Record_Write:Illegal arguments (%p,%p,%p).",
+			(void*)raw,(void*)record,(void*)card_image_list);
+		return FALSE;
+	}
+	if((frame_index < 0)||(frame_index >= raw->Frame_Count))
+	{
+		Fits_Image_Error_Number = 86;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Record_Write:Frame index %d out of range (0..%d) "
+			"for '%s'.",frame_index,raw->Frame_Count-1,raw->Filename);
+		return FALSE;
+	}
+	write_record = (*record);
+	write_record.Is_Valid = FITS_IMAGE_RAW_RECORD_VALID;
+	write_record.Frame_Index = frame_index;
+	iov[0].iov_base = &write_record;
+	iov[0].iov_len = sizeof(struct CCD_Fits_Image_Raw_Record_Struct);
+	iov[1].iov_base = card_image_list;
+	iov[1].iov_len = ((off_t)raw->Card_Count)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	if(!Fits_Image_Pwritev(raw->File_Descriptor,iov,2,raw->Header_Length+(frame_index*raw->Frame_Length),
+			       raw->Filename))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Close a raw capture file created by CCD_Fits_Image_Raw_Create or opened by CCD_Fits_Image_Raw_Open.
+ * @param raw The raw capture file to close. The File_Descriptor is set to -1.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_Fits_Image_Raw_Struct
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Raw_Close(struct CCD_Fits_Image_Raw_Struct *raw)
+{
+	int retval;
+
+	Fits_Image_Error_Number = 0;
+	if(raw == NULL)
+	{
+		Fits_Image_Error_Number = 70;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Close:raw is NULL.");
+		return FALSE;
+	}
+	retval = close(raw->File_Descriptor);
+	raw->File_Descriptor = -1;
+	if(retval != 0)
+	{
+		Fits_Image_Error_Number = 71;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Raw_Close:Failed to close '%s' (%d:%s).",
+			raw->Filename,errno,strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Convert unsigned short image data into FITS format, flipping it at the same time if required.
+ * Each output pixel has FITS_IMAGE_USHORT_BZERO subtracted and is stored big-endian
+ * (the conversion CFITSIO does when writing TUSHORT data to a USHORT_IMG). The input data is read once and
+ * the output data written once, whatever combination of flips is requested. A flip in both X and Y is a
+ * 180 degree rotation.
+ * <ul>
+ * <li>We check the parameters.
+ * <li>We get the conversion method to use with CCD_Fits_Image_Convert_Method_Get.
+ * <li>If flip_y is TRUE, we loop over the first half of the rows, converting each row and it's mirror
+ *     row (swapping them) in one go. A middle row (of an image with an odd number of rows) is converted on it's own.
+ *     Otherwise we convert each row on it's own.
+ * <li>If flip_x is TRUE, each row (or pair of rows) is converted using Fits_Image_Row_Reverse. A row converted on
+ *     it's own is reversed by converting each half and it's mirror half together, with any middle pixel
+ *     converted on it's own. Otherwise rows are converted using Fits_Image_Row_Swap / Fits_Image_Row_Map.
+ * </ul>
+ * As both pixels of each mirror pair are read before either is written, input_data and output_data can be
+ * the same buffer (an in place conversion). They must not otherwise overlap.
+ * @param input_data The image data to convert, of ncols*nrows pixels.
+ * @param output_data Where to put the converted image data, of ncols*nrows pixels. This can be input_data.
+ * @param ncols The number of columns in the image.
+ * @param nrows The number of rows in the image.
+ * @param flip_x A boolean, if TRUE flip the image data in the X (horizontal) direction.
+ * @param flip_y A boolean, if TRUE flip the image data in the Y (vertical) direction.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #FITS_IMAGE_USHORT_BZERO
+ * @see #FITS_IMAGE_PIXEL_CONVERT
+ * @see #CCD_Fits_Image_Convert_Method_Get
+ * @see #Fits_Image_Row_Map
+ * @see #Fits_Image_Row_Swap
+ * @see #Fits_Image_Row_Reverse
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_general.html#CCD_GENERAL_IS_BOOLEAN
+ */
+int CCD_Fits_Image_Data_Convert(unsigned short *input_data,unsigned short *output_data,int ncols,int nrows,
+				int flip_x,int flip_y)
+{
+	enum CCD_FITS_IMAGE_CONVERT_METHOD method;
+	unsigned short *input_row_a = NULL;
+	unsigned short *input_row_b = NULL;
+	unsigned short *output_row_a = NULL;
+	unsigned short *output_row_b = NULL;
+	int y,row_pair_count,middle;
+
+	Fits_Image_Error_Number = 0;
+	if((input_data == NULL)||(output_data == NULL)||(ncols < 1)||(nrows < 1))
+	{
+		Fits_Image_Error_Number = 10;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Data_Convert:Illegal image (%p,%p,%d,%d).",
+			(void*)input_data,(void*)output_data,ncols,nrows);
+		return FALSE;
+	}
+	if(!CCD_GENERAL_IS_BOOLEAN(flip_x))
+	{
+		Fits_Image_Error_Number = 11;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Data_Convert:flip_x (%d) not a boolean.",flip_x);
+		return FALSE;
+	}
+	if(!CCD_GENERAL_IS_BOOLEAN(flip_y))
+	{
+		Fits_Image_Error_Number = 12;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Data_Convert:flip_y (%d) not a boolean.",flip_y);
+		return FALSE;
+	}
+	method = CCD_Fits_Image_Convert_Method_Get();
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Fits_Image_Data_Convert(ncols=%d,nrows=%d,flip_x=%d,"
+			       "flip_y=%d,in place=%d):Started using method %s.",ncols,nrows,flip_x,flip_y,
+			       (input_data == output_data),CCD_Fits_Image_Convert_Method_To_String(method));
+#endif
+	/* when flipping in Y, each row is converted together with it's mirror row, so only loop over half the rows */
+	if(flip_y)
+		row_pair_count = nrows/2;
+	else
+		row_pair_count = 0;
+	for(y = 0; y < row_pair_count; y++)
+	{
+		input_row_a = input_data+(y*ncols);
+		input_row_b = input_data+((nrows-(y+1))*ncols);
+		output_row_a = output_data+(y*ncols);
+		output_row_b = output_data+((nrows-(y+1))*ncols);
+		if(flip_x)
+			Fits_Image_Row_Reverse(method,input_row_a,input_row_b,output_row_a,output_row_b,ncols,ncols);
+		else
+			Fits_Image_Row_Swap(method,input_row_a,input_row_b,output_row_a,output_row_b,ncols);
+	}
+	/* the remaining rows (all of them if not flipping in Y, the middle row if there is one otherwise)
+	** are converted on their own */
+	for(y = row_pair_count; y < nrows-row_pair_count; y++)
+	{
+		input_row_a = input_data+(y*ncols);
+		output_row_a = output_data+(y*ncols);
+		if(flip_x)
+		{
+			Fits_Image_Row_Reverse(method,input_row_a,input_row_a,output_row_a,output_row_a,ncols/2,ncols);
+			if((ncols % 2) == 1)
+			{
+				middle = ncols/2;
+				output_row_a[middle] = FITS_IMAGE_PIXEL_CONVERT(input_row_a[middle]);
+			}
+		}
+		else
+			Fits_Image_Row_Map(method,input_row_a,output_row_a,ncols);
+	}
+#if LOGGING > 9
+	CCD_General_Log(LOG_VERBOSITY_VERY_VERBOSE,"CCD_Fits_Image_Data_Convert:Finished.");
+#endif
+	return TRUE;
+}
+
+/**
+ * Set which implementation of the image data conversion kernel CCD_Fits_Image_Data_Convert uses. This is
+ * normally left as CCD_FITS_IMAGE_CONVERT_METHOD_AUTO, and is mainly used for testing and benchmarking.
+ * @param method The method to use. This must be supported by the CPU we are running on.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_FITS_IMAGE_CONVERT_METHOD
+ * @see #Fits_Image_Convert_Method
+ * @see #Fits_Image_Convert_Method_Is_Supported
+ * @see #CCD_Fits_Image_Convert_Method_To_String
+ */
+int CCD_Fits_Image_Convert_Method_Set(enum CCD_FITS_IMAGE_CONVERT_METHOD method)
+{
+	Fits_Image_Error_Number = 0;
+	if((method != CCD_FITS_IMAGE_CONVERT_METHOD_AUTO)&&(!Fits_Image_Convert_Method_Is_Supported(method)))
+	{
+		Fits_Image_Error_Number = 13;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Convert_Method_Set:Method %d (%s) is not supported.",
+			method,CCD_Fits_Image_Convert_Method_To_String(method));
+		return FALSE;
+	}
+	Fits_Image_Convert_Method = method;
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"CCD_Fits_Image_Convert_Method_Set:Method set to %s.",
+			       CCD_Fits_Image_Convert_Method_To_String(method));
+#endif
+	return TRUE;
+}
+
+/**
+ * Get which implementation of the image data conversion kernel CCD_Fits_Image_Data_Convert will use.
+ * If the method is CCD_FITS_IMAGE_CONVERT_METHOD_AUTO, we return the fastest method the CPU supports.
+ * @return The method to use (never CCD_FITS_IMAGE_CONVERT_METHOD_AUTO).
+ * @see #CCD_FITS_IMAGE_CONVERT_METHOD
+ * @see #Fits_Image_Convert_Method
+ * @see #Fits_Image_Convert_Method_Is_Supported
+ */
+enum CCD_FITS_IMAGE_CONVERT_METHOD CCD_Fits_Image_Convert_Method_Get(void)
+{
+	if(Fits_Image_Convert_Method != CCD_FITS_IMAGE_CONVERT_METHOD_AUTO)
+		return Fits_Image_Convert_Method;
+	if(Fits_Image_Convert_Method_Is_Supported(CCD_FITS_IMAGE_CONVERT_METHOD_AVX2))
+		return CCD_FITS_IMAGE_CONVERT_METHOD_AVX2;
+	if(Fits_Image_Convert_Method_Is_Supported(CCD_FITS_IMAGE_CONVERT_METHOD_SSE2))
+		return CCD_FITS_IMAGE_CONVERT_METHOD_SSE2;
+	return CCD_FITS_IMAGE_CONVERT_METHOD_SCALAR;
+}
+
+/**
+ * Return a string describing an image data conversion method.
+ * @param method The method.
+ * @return A string describing the method, e.g. "avx2", or "unknown" if method is not a valid method.
+ * @see #CCD_FITS_IMAGE_CONVERT_METHOD
+ * @see #Fits_Image_Convert_Method_Name_List
+ */
+const char *CCD_Fits_Image_Convert_Method_To_String(enum CCD_FITS_IMAGE_CONVERT_METHOD method)
+{
+	if((method < CCD_FITS_IMAGE_CONVERT_METHOD_AUTO)||(method > CCD_FITS_IMAGE_CONVERT_METHOD_AVX2))
+		return "unknown";
+	return Fits_Image_Convert_Method_Name_List[method];
+}
+
+/**
+ * Set which system call interface CCD_Fits_Image_Write (and CCD_Fits_Image_Write_Preallocated) use to write files.
+ * Selecting CCD_FITS_IMAGE_IO_BACKEND_IO_URING creates the ring and starts the io_uring thread 
+ * (Fits_Image_Io_Uring_Start), selecting CCD_FITS_IMAGE_IO_BACKEND_PWRITE stops it (Fits_Image_Io_Uring_Stop), 
+ * so the backend should be set back to CCD_FITS_IMAGE_IO_BACKEND_PWRITE on shutdown.
+ * This should not be called whilst files are being written.
+ * @param backend The backend to use.
+ * @return The routine returns TRUE on success, and FALSE on failure. On failure the backend is left unchanged.
+ *         Selecting CCD_FITS_IMAGE_IO_BACKEND_IO_URING fails if the library was not built with IO_URING defined,
+ *         or the running kernel does not support the io_uring features used.
+ * @see #CCD_FITS_IMAGE_IO_BACKEND
+ * @see #CCD_FITS_IMAGE_IS_IO_BACKEND
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Uring_Start
+ * @see #Fits_Image_Io_Uring_Stop
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+int CCD_Fits_Image_Io_Backend_Set(enum CCD_FITS_IMAGE_IO_BACKEND backend)
+{
+	Fits_Image_Error_Number = 0;
+	if(!CCD_FITS_IMAGE_IS_IO_BACKEND(backend))
+	{
+		Fits_Image_Error_Number = 45;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Io_Backend_Set:Illegal backend %d.",backend);
+		return FALSE;
+	}
+	if(backend == Fits_Image_Io_Data.Backend)
+		return TRUE;
+#ifdef IO_URING
+	if(backend == CCD_FITS_IMAGE_IO_BACKEND_IO_URING)
+	{
+		if(!Fits_Image_Io_Uring_Start())
+			return FALSE;
+	}
+	else
+		Fits_Image_Io_Uring_Stop();
+#else
+	if(backend == CCD_FITS_IMAGE_IO_BACKEND_IO_URING)
+	{
+		Fits_Image_Error_Number = 46;
+		sprintf(Fits_Image_Error_String,"CCD_Fits_Image_Io_Backend_Set:"
+			"The library was not built with io_uring support.");
+		return FALSE;
+	}
+#endif
+	Fits_Image_Io_Data.Backend = backend;
+#if LOGGING > 1
+	CCD_General_Log_Format(LOG_VERBOSITY_TERSE,"CCD_Fits_Image_Io_Backend_Set:Backend set to %s.",
+			       CCD_Fits_Image_Io_Backend_To_String(backend));
+#endif
+	return TRUE;
+}
+
+/**
+ * Get which system call interface CCD_Fits_Image_Write uses to write files.
+ * @return The backend.
+ * @see #CCD_FITS_IMAGE_IO_BACKEND
+ * @see #Fits_Image_Io_Data
+ */
+enum CCD_FITS_IMAGE_IO_BACKEND CCD_Fits_Image_Io_Backend_Get(void)
+{
+	return Fits_Image_Io_Data.Backend;
+}
+
+/**
+ * Return a string describing an I/O backend.
+ * @param backend The backend.
+ * @return A string describing the backend, e.g. "io_uring", or "unknown" if backend is not a valid backend.
+ * @see #CCD_FITS_IMAGE_IO_BACKEND
+ * @see #CCD_FITS_IMAGE_IS_IO_BACKEND
+ * @see #Fits_Image_Io_Backend_Name_List
+ */
+const char *CCD_Fits_Image_Io_Backend_To_String(enum CCD_FITS_IMAGE_IO_BACKEND backend)
+{
+	if(!CCD_FITS_IMAGE_IS_IO_BACKEND(backend))
+		return "unknown";
+	return Fits_Image_Io_Backend_Name_List[backend];
+}
+
+/**
+ * Set whether CCD_Fits_Image_Write (and CCD_Fits_Image_Write_Preallocated) fdatasync each file before closing it.
+ * @param sync A boolean, if TRUE sync each file.
+ * @see #Fits_Image_Io_Data
+ */
+void CCD_Fits_Image_Io_Sync_Set(int sync)
+{
+	Fits_Image_Io_Data.Sync = sync;
+}
+
+/**
+ * Get whether CCD_Fits_Image_Write (and CCD_Fits_Image_Write_Preallocated) fdatasync each file before closing it.
+ * @return A boolean, TRUE if each file is synced.
+ * @see #Fits_Image_Io_Data
+ */
+int CCD_Fits_Image_Io_Sync_Get(void)
+{
+	return Fits_Image_Io_Data.Sync;
+}
+
+/**
+ * Get the number of files written by CCD_Fits_Image_Write (and CCD_Fits_Image_Write_Preallocated), and the number
+ * of system calls used to write them, since the library was loaded. Callers take the difference of two calls
+ * to measure a set of writes.
+ * @param file_count The address of an integer to store the number of files written in.
+ * @param syscall_count The address of an integer to store the number of system calls in. For the pwrite backend 
+ *        this is one per operation (open, fallocate, pwritev, fdatasync and close), for the io_uring backend 
+ *        it is the number of batch submissions (io_uring_submit_and_wait calls).
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Mutex
+ */
+void CCD_Fits_Image_Io_Count_Get(int *file_count,int *syscall_count)
+{
+	pthread_mutex_lock(&Fits_Image_Io_Mutex);
+	if(file_count != NULL)
+		(*file_count) = Fits_Image_Io_Data.File_Count;
+	if(syscall_count != NULL)
+		(*syscall_count) = Fits_Image_Io_Data.Syscall_Count;
+	pthread_mutex_unlock(&Fits_Image_Io_Mutex);
+}
+
+/**
+ * Return the length of the header unit CCD_Fits_Image_Write will write, which is the mandatory cards,
+ * card_count other cards and the END card, padded to a multiple of CCD_FITS_IMAGE_BLOCK_LENGTH.
+ * @param card_count The number of (non-mandatory) card images in the header.
+ * @return The length of the header unit in bytes.
+ * @see #CCD_FITS_IMAGE_BLOCK_LENGTH
+ * @see #CCD_FITS_IMAGE_MANDATORY_CARD_COUNT
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+int CCD_Fits_Image_Header_Length_Get(int card_count)
+{
+	int length;
+
+	/* + 1 for the END card */
+	length = (CCD_FITS_IMAGE_MANDATORY_CARD_COUNT+card_count+1)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	return ((length+CCD_FITS_IMAGE_BLOCK_LENGTH-1)/CCD_FITS_IMAGE_BLOCK_LENGTH)*CCD_FITS_IMAGE_BLOCK_LENGTH;
+}
+
+/**
+ * Return the length of the data unit CCD_Fits_Image_Write will write, which is the 16 bit image data
+ * padded to a multiple of CCD_FITS_IMAGE_BLOCK_LENGTH.
+ * @param ncols The number of columns in the image.
+ * @param nrows The number of rows in the image.
+ * @return The length of the data unit in bytes.
+ * @see #CCD_FITS_IMAGE_BLOCK_LENGTH
+ */
+int CCD_Fits_Image_Data_Length_Get(int ncols,int nrows)
+{
+	int length;
+
+	length = ncols*nrows*sizeof(unsigned short);
+	return ((length+CCD_FITS_IMAGE_BLOCK_LENGTH-1)/CCD_FITS_IMAGE_BLOCK_LENGTH)*CCD_FITS_IMAGE_BLOCK_LENGTH;
+}
+
+/**
+ * Get the current value of ccd_fits_image's error number.
+ * @return The current value of ccd_fits_image's error number.
+ * @see #Fits_Image_Error_Number
+ */
+int CCD_Fits_Image_Get_Error_Number(void)
+{
+	return Fits_Image_Error_Number;
+}
+
+/**
+ * The error routine that reports any errors occuring in ccd_fits_image in a standard way.
+ * @see ccd_general.html#CCD_General_Get_Current_Time_String
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+void CCD_Fits_Image_Error(void)
+{
+	char time_string[32];
+
+	CCD_General_Get_Current_Time_String(time_string,32);
+	/* if the error number is zero an error message has not been set up
+	** This is in itself an error as we should not be calling this routine
+	** without there being an error to display */
+	if(Fits_Image_Error_Number == 0)
+		sprintf(Fits_Image_Error_String,"Logic Error:No Error defined");
+	fprintf(stderr,"%s CCD_Fits_Image:Error(%d) : %s\n",time_string,
+		Fits_Image_Error_Number,Fits_Image_Error_String);
+}
+
+/**
+ * The error routine that reports any errors occuring in ccd_fits_image in a standard way. This routine places the
+ * generated error string at the end of a passed in string argument.
+ * @param error_string A string to put the generated error in. This string should be initialised before
+ * being passed to this routine. The routine will try to concatenate it's error string onto the end
+ * of any string already in existance.
+ * @see ccd_general.html#CCD_General_Get_Current_Time_String
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+void CCD_Fits_Image_Error_String(char *error_string)
+{
+	char time_string[32];
+
+	CCD_General_Get_Current_Time_String(time_string,32);
+	/* if the error number is zero an error message has not been set up
+	** This is in itself an error as we should not be calling this routine
+	** without there being an error to display */
+	if(Fits_Image_Error_Number == 0)
+		sprintf(Fits_Image_Error_String,"Logic Error:No Error defined");
+	sprintf(error_string+strlen(error_string),"%s CCD_Fits_Image:Error(%d) : %s\n",time_string,
+		Fits_Image_Error_Number,Fits_Image_Error_String);
+}
+
+/* =======================================
+**  internal functions
+** ======================================= */
+/**
+ * Format a card image in the same way as CFITSIO's fits_make_key: the keyword left justified in columns 1-8,
+ * "= " in columns 9-10, the value right justified to column 30, then " / " and the comment.
+ * @param card_image The card image to write to, of (at least) CCD_FITS_HEADER_CARD_IMAGE_LENGTH characters.
+ *        The card image is space padded and <b>not</b> '\0' terminated.
+ * @param keyword The keyword.
+ * @param value The formatted value.
+ * @param comment The comment.
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+static void Fits_Image_Card_Image_Set(char *card_image,const char *keyword,const char *value,const char *comment)
+{
+	char card_string[CCD_FITS_HEADER_CARD_IMAGE_LENGTH+1];
+
+	snprintf(card_string,CCD_FITS_HEADER_CARD_IMAGE_LENGTH+1,"%-8s= %20s / %s",keyword,value,comment);
+	memset(card_image,' ',CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	memcpy(card_image,card_string,strlen(card_string));
+}
+
+/**
+ * Format a card image with a string value, in the same way as CFITSIO: the keyword left justified in columns 1-8,
+ * "= " in columns 9-10, the quoted value (padded to at least 8 characters) starting in column 11, 
+ * then " / " and the comment.
+ * @param card_image The card image to write to, of (at least) CCD_FITS_HEADER_CARD_IMAGE_LENGTH characters.
+ *        The card image is space padded and <b>not</b> '\0' terminated.
+ * @param keyword The keyword.
+ * @param value The string value, which must not contain quotes.
+ * @param comment The comment.
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+static void Fits_Image_String_Card_Image_Set(char *card_image,const char *keyword,const char *value,
+					     const char *comment)
+{
+	char card_string[CCD_FITS_HEADER_CARD_IMAGE_LENGTH+1];
+
+	snprintf(card_string,CCD_FITS_HEADER_CARD_IMAGE_LENGTH+1,"%-8s= '%-8s' / %s",keyword,value,comment);
+	memset(card_image,' ',CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	memcpy(card_image,card_string,strlen(card_string));
+}
+
+/**
+ * Format the mandatory primary header cards for a 2D (or 3D) image. These are the cards (with the same
+ * comments) written by fits_create_img: SIMPLE, BITPIX, NAXIS, NAXIS1, NAXIS2, (NAXIS3), EXTEND and
+ * the two COMMENT cards referencing the FITS standard. An unsigned short image (USHORT_IMG, bitpix 16) 
+ * is also given BZERO and BSCALE; 32 bit float (FLOAT_IMG) and integer (LONG_IMG) images are not scaled.
+ * @param card_image_list The card image list to write to, of (at least) CCD_FITS_IMAGE_MANDATORY_CARD_COUNT
+ *        card images (CCD_FITS_IMAGE_CUBE_MANDATORY_CARD_COUNT for a 3D image).
+ * @param bitpix The value of BITPIX: 16 for an unsigned short image, -32 for a float image or 32 for an 
+ *        integer image.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @param plane_count The number of planes in the image (NAXIS3), or zero for a 2D image.
+ * @return The number of card images formatted.
+ * @see #CCD_FITS_IMAGE_MANDATORY_CARD_COUNT
+ * @see #CCD_FITS_IMAGE_CUBE_MANDATORY_CARD_COUNT
+ * @see #CCD_FITS_IMAGE_FLOAT_MANDATORY_CARD_COUNT
+ * @see #FITS_IMAGE_USHORT_BZERO
+ * @see #Fits_Image_Card_Image_Set
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+static int Fits_Image_Mandatory_Cards_Set(char *card_image_list,int bitpix,int ncols,int nrows,int plane_count)
+{
+	char value_string[32];
+	char *card_image = card_image_list;
+	const char *comment = NULL;
+
+	Fits_Image_Card_Image_Set(card_image,"SIMPLE","T","file does conform to FITS standard");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	sprintf(value_string,"%d",bitpix);
+	Fits_Image_Card_Image_Set(card_image,"BITPIX",value_string,"number of bits per data pixel");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	if(plane_count > 0)
+		Fits_Image_Card_Image_Set(card_image,"NAXIS","3","number of data axes");
+	else
+		Fits_Image_Card_Image_Set(card_image,"NAXIS","2","number of data axes");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	sprintf(value_string,"%d",ncols);
+	Fits_Image_Card_Image_Set(card_image,"NAXIS1",value_string,"length of data axis 1");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	sprintf(value_string,"%d",nrows);
+	Fits_Image_Card_Image_Set(card_image,"NAXIS2",value_string,"length of data axis 2");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	if(plane_count > 0)
+	{
+		sprintf(value_string,"%d",plane_count);
+		Fits_Image_Card_Image_Set(card_image,"NAXIS3",value_string,"length of data axis 3");
+		card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	}
+	Fits_Image_Card_Image_Set(card_image,"EXTEND","T","FITS dataset may contain extensions");
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	memset(card_image,' ',2*CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	comment = "COMMENT   FITS (Flexible Image Transport System) format is defined in 'Astronomy";
+	memcpy(card_image,comment,strlen(comment));
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	comment = "COMMENT   and Astrophysics', volume 376, page 359; bibcode: 2001A&A...376..359H";
+	memcpy(card_image,comment,strlen(comment));
+	card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	if(bitpix == 16)
+	{
+		sprintf(value_string,"%d",FITS_IMAGE_USHORT_BZERO);
+		Fits_Image_Card_Image_Set(card_image,"BZERO",value_string,"offset data range to that of unsigned short");
+		card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+		Fits_Image_Card_Image_Set(card_image,"BSCALE","1","default scaling factor");
+		card_image += CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	}
+	return (card_image-card_image_list)/CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+}
+
+/**
+ * Write a 2D (or 3D) FITS image with no BZERO/BSCALE scaling to disk, creating a new file. This does the work for
+ * CCD_Fits_Image_Float_Write and CCD_Fits_Image_Int_Write, which have already checked the arguments and converted
+ * the image data to big-endian.
+ * <ul>
+ * <li>We format the mandatory primary header cards using Fits_Image_Mandatory_Cards_Set.
+ * <li>We format the END card, and space pad the header to a multiple of CCD_FITS_IMAGE_BLOCK_LENGTH.
+ * <li>We write the header, image data and data padding using Fits_Image_Iov_Write, as CCD_Fits_Image_Write does.
+ * </ul>
+ * @param filename The filename of the FITS image to create.
+ * @param card_image_list A list of card_count card images to put in the header after the mandatory cards.
+ * @param card_count The number of card images in card_image_list.
+ * @param bitpix The value of BITPIX, -32 for a float image or 32 for an integer image. Each pixel is 4 bytes.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @param plane_count The number of planes in the image (NAXIS3), or zero for a 2D image.
+ * @param image_data The big-endian image data, of ncols*nrows*(plane_count, or 1 for a 2D image) pixels.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_FITS_IMAGE_BLOCK_LENGTH
+ * @see #CCD_FITS_IMAGE_FLOAT_MANDATORY_CARD_COUNT
+ * @see #FITS_IMAGE_IOVEC_COUNT
+ * @see #Fits_Image_Zero_Block
+ * @see #Fits_Image_Mandatory_Cards_Set
+ * @see #Fits_Image_Block_Length_Get
+ * @see #Fits_Image_Iov_Write
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+static int Fits_Image_Unscaled_Write(char *filename,char *card_image_list,int card_count,int bitpix,int ncols,
+				     int nrows,int plane_count,void *image_data)
+{
+	char mandatory_card_list[CCD_FITS_IMAGE_FLOAT_MANDATORY_CARD_COUNT*CCD_FITS_HEADER_CARD_IMAGE_LENGTH];
+	char end_block[CCD_FITS_IMAGE_BLOCK_LENGTH];
+	struct iovec iov[FITS_IMAGE_IOVEC_COUNT];
+	off_t header_length,data_length,image_length;
+	int mandatory_card_count,end_length;
+
+	/* header: mandatory cards, the caller's cards, END, then space padding */
+	mandatory_card_count = Fits_Image_Mandatory_Cards_Set(mandatory_card_list,bitpix,ncols,nrows,plane_count);
+	header_length = Fits_Image_Block_Length_Get((mandatory_card_count+card_count+1)*
+						    CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	end_length = header_length-((mandatory_card_count+card_count)*CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	memset(end_block,' ',end_length);
+	memcpy(end_block,"END",3);
+	/* data: 4 byte big-endian pixels, then zero padding */
+	image_length = ((off_t)ncols)*((off_t)nrows)*((off_t)(plane_count > 0 ? plane_count : 1))*4;
+	data_length = Fits_Image_Block_Length_Get(image_length);
+	iov[0].iov_base = mandatory_card_list;
+	iov[0].iov_len = mandatory_card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	iov[1].iov_base = card_image_list;
+	iov[1].iov_len = card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	iov[2].iov_base = end_block;
+	iov[2].iov_len = end_length;
+	iov[3].iov_base = image_data;
+	iov[3].iov_len = image_length;
+	iov[4].iov_base = Fits_Image_Zero_Block;
+	iov[4].iov_len = data_length-image_length;
+	return Fits_Image_Iov_Write(filename,iov,FITS_IMAGE_IOVEC_COUNT,header_length+data_length,FALSE);
+}
+
+/**
+ * Round a header or data unit length up to a multiple of CCD_FITS_IMAGE_BLOCK_LENGTH.
+ * @param length The length in bytes.
+ * @return The padded length in bytes.
+ * @see #CCD_FITS_IMAGE_BLOCK_LENGTH
+ */
+static off_t Fits_Image_Block_Length_Get(off_t length)
+{
+	return ((length+CCD_FITS_IMAGE_BLOCK_LENGTH-1)/CCD_FITS_IMAGE_BLOCK_LENGTH)*CCD_FITS_IMAGE_BLOCK_LENGTH;
+}
+
+/**
+ * Round a raw capture file header, record or image data length up to a multiple of CCD_FITS_IMAGE_RAW_ALIGNMENT.
+ * @param length The length in bytes.
+ * @return The padded length in bytes.
+ * @see #CCD_FITS_IMAGE_RAW_ALIGNMENT
+ */
+static off_t Fits_Image_Raw_Align_Get(off_t length)
+{
+	return ((length+CCD_FITS_IMAGE_RAW_ALIGNMENT-1)/CCD_FITS_IMAGE_RAW_ALIGNMENT)*CCD_FITS_IMAGE_RAW_ALIGNMENT;
+}
+
+/**
+ * Store a double in a binary table field, as a big-endian IEEE 754 double (FITS TFORM 'D').
+ * @param buffer The field to write to, of (at least) FITS_IMAGE_CUBE_COLUMN_LENGTH bytes.
+ * @param value The value to store.
+ * @see #FITS_IMAGE_CUBE_COLUMN_LENGTH
+ */
+static void Fits_Image_Double_Set(unsigned char *buffer,double value)
+{
+	unsigned long long int bits;
+	int i;
+
+	memcpy(&bits,&value,sizeof(bits));
+	for(i = FITS_IMAGE_CUBE_COLUMN_LENGTH-1; i >= 0; i--)
+	{
+		buffer[i] = (unsigned char)(bits&0xff);
+		bits >>= 8;
+	}
+}
+
+/**
+ * Read a FITS header starting at offset, a block (CCD_FITS_IMAGE_BLOCK_LENGTH) at a time until the END card,
+ * and retrieve the values of some integer keywords.
+ * @param fd The file descriptor to read from.
+ * @param offset The offset in the file of the start of the header.
+ * @param filename The filename being read, for error messages.
+ * @param keyword_list A list of keyword_count keywords (uppercase) whose values to retrieve.
+ * @param value_list A list of keyword_count integers, to store the retrieved values in.
+ * @param keyword_count The number of keywords in keyword_list.
+ * @param header_length The address of an off_t, to store the length of the header (including padding) in bytes.
+ * @return The routine returns TRUE on success, and FALSE on failure (including if a keyword is not in the header).
+ * @see #CCD_FITS_IMAGE_BLOCK_LENGTH
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+static int Fits_Image_Header_Integers_Get(int fd,off_t offset,char *filename,const char **keyword_list,
+					  int *value_list,int keyword_count,off_t *header_length)
+{
+	char block[CCD_FITS_IMAGE_BLOCK_LENGTH];
+	char keyword_field[16];
+	char *card_image = NULL;
+	ssize_t length;
+	off_t block_offset;
+	int i,card,found_count,done;
+
+	found_count = 0;
+	block_offset = offset;
+	done = FALSE;
+	while(done == FALSE)
+	{
+		length = pread(fd,block,CCD_FITS_IMAGE_BLOCK_LENGTH,block_offset);
+		if(length != CCD_FITS_IMAGE_BLOCK_LENGTH)
+		{
+			Fits_Image_Error_Number = 37;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Header_Integers_Get:"
+				"Failed to read header block at offset %ld of '%s' (%ld).",(long)block_offset,filename,
+				(long)length);
+			return FALSE;
+		}
+		for(card = 0; (card < (CCD_FITS_IMAGE_BLOCK_LENGTH/CCD_FITS_HEADER_CARD_IMAGE_LENGTH))&&(done == FALSE);
+		    card++)
+		{
+			card_image = block+(card*CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+			if(strncmp(card_image,"END     ",8) == 0)
+			{
+				done = TRUE;
+				continue;
+			}
+			for(i = 0; i < keyword_count; i++)
+			{
+				/* the keyword is in columns 1-8 of the card image, space padded, and the value 
+				** starts in column 11 */
+				sprintf(keyword_field,"%-8.8s",keyword_list[i]);
+				if((strncmp(card_image,keyword_field,8) == 0)&&
+				   (sscanf(card_image+10,"%d",&(value_list[i])) == 1))
+				{
+					found_count++;
+				}
+			}
+		}
+		block_offset += CCD_FITS_IMAGE_BLOCK_LENGTH;
+	}
+	if(found_count != keyword_count)
+	{
+		Fits_Image_Error_Number = 38;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Header_Integers_Get:"
+			"Only found %d of %d keywords in the header at offset %ld of '%s'.",found_count,keyword_count,
+			(long)offset,filename);
+		return FALSE;
+	}
+	(*header_length) = block_offset-offset;
+	return TRUE;
+}
+
+/**
+ * Check whether the CPU we are running on supports an image data conversion method.
+ * @param method The method to check.
+ * @return The routine returns TRUE if the method is supported, and FALSE if it is not.
+ * @see #CCD_FITS_IMAGE_CONVERT_METHOD
+ * @see #FITS_IMAGE_X86
+ */
+static int Fits_Image_Convert_Method_Is_Supported(enum CCD_FITS_IMAGE_CONVERT_METHOD method)
+{
+	switch(method)
+	{
+		case CCD_FITS_IMAGE_CONVERT_METHOD_SCALAR:
+			return TRUE;
+#ifdef FITS_IMAGE_X86
+		case CCD_FITS_IMAGE_CONVERT_METHOD_SSE2:
+			return (__builtin_cpu_supports("sse2") != 0);
+		case CCD_FITS_IMAGE_CONVERT_METHOD_AVX2:
+			return (__builtin_cpu_supports("avx2") != 0);
+#endif
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Convert one row of image data into FITS format, without flipping.
+ * @param method Which implementation to use.
+ * @param input_row The row to convert, of ncols pixels.
+ * @param output_row Where to put the converted row. This can be input_row.
+ * @param ncols The number of pixels in the row.
+ * @see #Fits_Image_Row_Map_Scalar
+ * @see #Fits_Image_Row_Map_SSE2
+ * @see #Fits_Image_Row_Map_AVX2
+ */
+static void Fits_Image_Row_Map(enum CCD_FITS_IMAGE_CONVERT_METHOD method,unsigned short *input_row,
+			       unsigned short *output_row,int ncols)
+{
+	int x = 0;
+
+#ifdef FITS_IMAGE_X86
+	if(method == CCD_FITS_IMAGE_CONVERT_METHOD_AVX2)
+		x = Fits_Image_Row_Map_AVX2(input_row,output_row,ncols);
+	else if(method == CCD_FITS_IMAGE_CONVERT_METHOD_SSE2)
+		x = Fits_Image_Row_Map_SSE2(input_row,output_row,ncols);
+#endif
+	Fits_Image_Row_Map_Scalar(input_row,output_row,x,ncols);
+}
+
+/**
+ * Convert two rows of image data into FITS format, swapping them (i.e. flipping in Y but not X).
+ * @param method Which implementation to use.
+ * @param input_row_a The first row to convert, of ncols pixels.
+ * @param input_row_b The second row to convert, of ncols pixels.
+ * @param output_row_a Where to put the converted input_row_b. This can be input_row_a.
+ * @param output_row_b Where to put the converted input_row_a. This can be input_row_b.
+ * @param ncols The number of pixels in each row.
+ * @see #Fits_Image_Row_Swap_Scalar
+ * @see #Fits_Image_Row_Swap_SSE2
+ * @see #Fits_Image_Row_Swap_AVX2
+ */
+static void Fits_Image_Row_Swap(enum CCD_FITS_IMAGE_CONVERT_METHOD method,unsigned short *input_row_a,
+				unsigned short *input_row_b,unsigned short *output_row_a,unsigned short *output_row_b,
+				int ncols)
+{
+	int x = 0;
+
+#ifdef FITS_IMAGE_X86
+	if(method == CCD_FITS_IMAGE_CONVERT_METHOD_AVX2)
+		x = Fits_Image_Row_Swap_AVX2(input_row_a,input_row_b,output_row_a,output_row_b,ncols);
+	else if(method == CCD_FITS_IMAGE_CONVERT_METHOD_SSE2)
+		x = Fits_Image_Row_Swap_SSE2(input_row_a,input_row_b,output_row_a,output_row_b,ncols);
+#endif
+	Fits_Image_Row_Swap_Scalar(input_row_a,input_row_b,output_row_a,output_row_b,x,ncols);
+}
+
+/**
+ * Convert two rows of image data into FITS format, reversing them into each other: output_row_a[x] is the
+ * converted input_row_b[ncols-(x+1)], and output_row_b[ncols-(x+1)] is the converted input_row_a[x], for x
+ * from 0 to count-1. For a flip in X and Y the rows are a row and it's mirror row, and count is ncols.
+ * For a flip in X only, both rows are the same row, and count is ncols/2.
+ * @param method Which implementation to use.
+ * @param input_row_a The first row to convert, of ncols pixels.
+ * @param input_row_b The second row to convert, of ncols pixels. This can be input_row_a.
+ * @param output_row_a Where to put the converted pixels from input_row_b. This can be input_row_a.
+ * @param output_row_b Where to put the converted pixels from input_row_a. This can be input_row_b.
+ * @param count The number of pixel pairs to convert.
+ * @param ncols The number of pixels in each row.
+ * @see #Fits_Image_Row_Reverse_Scalar
+ * @see #Fits_Image_Row_Reverse_SSE2
+ * @see #Fits_Image_Row_Reverse_AVX2
+ */
+static void Fits_Image_Row_Reverse(enum CCD_FITS_IMAGE_CONVERT_METHOD method,unsigned short *input_row_a,
+				   unsigned short *input_row_b,unsigned short *output_row_a,
+				   unsigned short *output_row_b,int count,int ncols)
+{
+	int x = 0;
+
+#ifdef FITS_IMAGE_X86
+	if(method == CCD_FITS_IMAGE_CONVERT_METHOD_AVX2)
+		x = Fits_Image_Row_Reverse_AVX2(input_row_a,input_row_b,output_row_a,output_row_b,count,ncols);
+	else if(method == CCD_FITS_IMAGE_CONVERT_METHOD_SSE2)
+		x = Fits_Image_Row_Reverse_SSE2(input_row_a,input_row_b,output_row_a,output_row_b,count,ncols);
+#endif
+	Fits_Image_Row_Reverse_Scalar(input_row_a,input_row_b,output_row_a,output_row_b,x,count,ncols);
+}
+
+/**
+ * Scalar version of Fits_Image_Row_Map, used on it's own or to finish off a row after the vector version.
+ * @param input_row The row to convert.
+ * @param output_row Where to put the converted row.
+ * @param start The pixel to start at.
+ * @param ncols The number of pixels in the row.
+ * @return The number of pixels converted so far (ncols).
+ * @see #FITS_IMAGE_PIXEL_CONVERT
+ */
+static int Fits_Image_Row_Map_Scalar(unsigned short *input_row,unsigned short *output_row,int start,int ncols)
+{
+	int x;
+
+	for(x = start; x < ncols; x++)
+		output_row[x] = FITS_IMAGE_PIXEL_CONVERT(input_row[x]);
+	return x;
+}
+
+/**
+ * Scalar version of Fits_Image_Row_Swap, used on it's own or to finish off a row pair after the vector version.
+ * @param input_row_a The first row to convert.
+ * @param input_row_b The second row to convert.
+ * @param output_row_a Where to put the converted input_row_b.
+ * @param output_row_b Where to put the converted input_row_a.
+ * @param start The pixel to start at.
+ * @param ncols The number of pixels in each row.
+ * @return The number of pixels converted so far (ncols).
+ * @see #FITS_IMAGE_PIXEL_CONVERT
+ */
+static int Fits_Image_Row_Swap_Scalar(unsigned short *input_row_a,unsigned short *input_row_b,
+				      unsigned short *output_row_a,unsigned short *output_row_b,int start,int ncols)
+{
+	unsigned short value_a,value_b;
+	int x;
+
+	for(x = start; x < ncols; x++)
+	{
+		value_a = input_row_a[x];
+		value_b = input_row_b[x];
+		output_row_a[x] = FITS_IMAGE_PIXEL_CONVERT(value_b);
+		output_row_b[x] = FITS_IMAGE_PIXEL_CONVERT(value_a);
+	}
+	return x;
+}
+
+/**
+ * Scalar version of Fits_Image_Row_Reverse, used on it's own or to finish off a row pair after the
+ * vector version.
+ * @param input_row_a The first row to convert.
+ * @param input_row_b The second row to convert.
+ * @param output_row_a Where to put the converted pixels from input_row_b.
+ * @param output_row_b Where to put the converted pixels from input_row_a.
+ * @param start The pixel pair to start at.
+ * @param count The number of pixel pairs to convert.
+ * @param ncols The number of pixels in each row.
+ * @return The number of pixel pairs converted so far (count).
+ * @see #FITS_IMAGE_PIXEL_CONVERT
+ */
+static int Fits_Image_Row_Reverse_Scalar(unsigned short *input_row_a,unsigned short *input_row_b,
+					 unsigned short *output_row_a,unsigned short *output_row_b,int start,int count,
+					 int ncols)
+{
+	unsigned short value_a,value_b;
+	int x;
+
+	for(x = start; x < count; x++)
+	{
+		value_a = input_row_a[x];
+		value_b = input_row_b[ncols-(x+1)];
+		output_row_a[x] = FITS_IMAGE_PIXEL_CONVERT(value_b);
+		output_row_b[ncols-(x+1)] = FITS_IMAGE_PIXEL_CONVERT(value_a);
+	}
+	return x;
+}
+
+#ifdef FITS_IMAGE_X86
+/**
+ * SSE2 version of FITS_IMAGE_PIXEL_CONVERT, converting 8 pixels.
+ * @param value The 8 pixels to convert.
+ * @return The converted pixels.
+ * @see #FITS_IMAGE_USHORT_BZERO
+ */
+__attribute__((target("sse2"))) static inline __m128i Fits_Image_Convert_SSE2(__m128i value)
+{
+	value = _mm_xor_si128(value,_mm_set1_epi16((short)FITS_IMAGE_USHORT_BZERO));
+	return _mm_or_si128(_mm_slli_epi16(value,8),_mm_srli_epi16(value,8));
+}
+
+/**
+ * Reverse the order of 8 pixels using SSE2: reverse the 4 32 bit words, then swap the pixels in each word.
+ * @param value The 8 pixels to reverse.
+ * @return The reversed pixels.
+ */
+__attribute__((target("sse2"))) static inline __m128i Fits_Image_Reverse_SSE2(__m128i value)
+{
+	value = _mm_shuffle_epi32(value,_MM_SHUFFLE(0,1,2,3));
+	value = _mm_shufflelo_epi16(value,_MM_SHUFFLE(2,3,0,1));
+	return _mm_shufflehi_epi16(value,_MM_SHUFFLE(2,3,0,1));
+}
+
+/**
+ * SSE2 version of Fits_Image_Row_Map, converting 8 pixels at a time.
+ * @param input_row The row to convert.
+ * @param output_row Where to put the converted row.
+ * @param ncols The number of pixels in the row.
+ * @return The number of pixels converted. Any remaining pixels (less than 8) should be converted
+ *         by Fits_Image_Row_Map_Scalar.
+ * @see #Fits_Image_Convert_SSE2
+ */
+__attribute__((target("sse2"))) static int Fits_Image_Row_Map_SSE2(unsigned short *input_row,
+								    unsigned short *output_row,int ncols)
+{
+	__m128i value;
+	int x;
+
+	for(x = 0; x+8 <= ncols; x += 8)
+	{
+		value = _mm_loadu_si128((__m128i *)(input_row+x));
+		_mm_storeu_si128((__m128i *)(output_row+x),Fits_Image_Convert_SSE2(value));
+	}
+	return x;
+}
+
+/**
+ * SSE2 version of Fits_Image_Row_Swap, converting 8 pixels from each row at a time.
+ * @param input_row_a The first row to convert.
+ * @param input_row_b The second row to convert.
+ * @param output_row_a Where to put the converted input_row_b.
+ * @param output_row_b Where to put the converted input_row_a.
+ * @param ncols The number of pixels in each row.
+ * @return The number of pixels converted. Any remaining pixels (less than 8) should be converted
+ *         by Fits_Image_Row_Swap_Scalar.
+ * @see #Fits_Image_Convert_SSE2
+ */
+__attribute__((target("sse2"))) static int Fits_Image_Row_Swap_SSE2(unsigned short *input_row_a,
+								     unsigned short *input_row_b,
+								     unsigned short *output_row_a,
+								     unsigned short *output_row_b,int ncols)
+{
+	__m128i value_a,value_b;
+	int x;
+
+	for(x = 0; x+8 <= ncols; x += 8)
+	{
+		value_a = _mm_loadu_si128((__m128i *)(input_row_a+x));
+		value_b = _mm_loadu_si128((__m128i *)(input_row_b+x));
+		_mm_storeu_si128((__m128i *)(output_row_a+x),Fits_Image_Convert_SSE2(value_b));
+		_mm_storeu_si128((__m128i *)(output_row_b+x),Fits_Image_Convert_SSE2(value_a));
+	}
+	return x;
+}
+
+/**
+ * SSE2 version of Fits_Image_Row_Reverse, converting 8 pixel pairs at a time.
+ * @param input_row_a The first row to convert.
+ * @param input_row_b The second row to convert.
+ * @param output_row_a Where to put the converted pixels from input_row_b.
+ * @param output_row_b Where to put the converted pixels from input_row_a.
+ * @param count The number of pixel pairs to convert.
+ * @param ncols The number of pixels in each row.
+ * @return The number of pixel pairs converted. Any remaining pairs (less than 8) should be converted
+ *         by Fits_Image_Row_Reverse_Scalar.
+ * @see #Fits_Image_Convert_SSE2
+ * @see #Fits_Image_Reverse_SSE2
+ */
+__attribute__((target("sse2"))) static int Fits_Image_Row_Reverse_SSE2(unsigned short *input_row_a,
+									unsigned short *input_row_b,
+									unsigned short *output_row_a,
+									unsigned short *output_row_b,int count,int ncols)
+{
+	__m128i value_a,value_b;
+	int x;
+
+	for(x = 0; x+8 <= count; x += 8)
+	{
+		value_a = _mm_loadu_si128((__m128i *)(input_row_a+x));
+		value_b = _mm_loadu_si128((__m128i *)(input_row_b+ncols-(x+8)));
+		_mm_storeu_si128((__m128i *)(output_row_a+x),Fits_Image_Convert_SSE2(Fits_Image_Reverse_SSE2(value_b)));
+		_mm_storeu_si128((__m128i *)(output_row_b+ncols-(x+8)),
+				 Fits_Image_Convert_SSE2(Fits_Image_Reverse_SSE2(value_a)));
+	}
+	return x;
+}
+
+/**
+ * AVX2 version of FITS_IMAGE_PIXEL_CONVERT, converting 16 pixels. The byte swap is done with one byte shuffle.
+ * @param value The 16 pixels to convert.
+ * @return The converted pixels.
+ * @see #FITS_IMAGE_USHORT_BZERO
+ */
+__attribute__((target("avx2"))) static inline __m256i Fits_Image_Convert_AVX2(__m256i value)
+{
+	const __m256i byte_swap_mask = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+							1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+
+	value = _mm256_xor_si256(value,_mm256_set1_epi16((short)FITS_IMAGE_USHORT_BZERO));
+	return _mm256_shuffle_epi8(value,byte_swap_mask);
+}
+
+/**
+ * Reverse the order of 16 pixels and convert them, using AVX2. Reversing the pixels and swapping the bytes in each
+ * pixel is the same as reversing the 32 bytes, which is done by reversing the bytes in each 128 bit lane
+ * and then swapping the lanes.
+ * @param value The 16 pixels to reverse and convert.
+ * @return The reversed and converted pixels.
+ * @see #FITS_IMAGE_USHORT_BZERO
+ */
+__attribute__((target("avx2"))) static inline __m256i Fits_Image_Reverse_Convert_AVX2(__m256i value)
+{
+	const __m256i byte_reverse_mask = _mm256_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0,
+							   15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+
+	value = _mm256_xor_si256(value,_mm256_set1_epi16((short)FITS_IMAGE_USHORT_BZERO));
+	value = _mm256_shuffle_epi8(value,byte_reverse_mask);
+	return _mm256_permute4x64_epi64(value,_MM_SHUFFLE(1,0,3,2));
+}
+
+/**
+ * AVX2 version of Fits_Image_Row_Map, converting 16 pixels at a time.
+ * @param input_row The row to convert.
+ * @param output_row Where to put the converted row.
+ * @param ncols The number of pixels in the row.
+ * @return The number of pixels converted. Any remaining pixels (less than 16) should be converted
+ *         by Fits_Image_Row_Map_Scalar.
+ * @see #Fits_Image_Convert_AVX2
+ */
+__attribute__((target("avx2"))) static int Fits_Image_Row_Map_AVX2(unsigned short *input_row,
+								    unsigned short *output_row,int ncols)
+{
+	__m256i value;
+	int x;
+
+	for(x = 0; x+16 <= ncols; x += 16)
+	{
+		value = _mm256_loadu_si256((__m256i *)(input_row+x));
+		_mm256_storeu_si256((__m256i *)(output_row+x),Fits_Image_Convert_AVX2(value));
+	}
+	return x;
+}
+
+/**
+ * AVX2 version of Fits_Image_Row_Swap, converting 16 pixels from each row at a time.
+ * @param input_row_a The first row to convert.
+ * @param input_row_b The second row to convert.
+ * @param output_row_a Where to put the converted input_row_b.
+ * @param output_row_b Where to put the converted input_row_a.
+ * @param ncols The number of pixels in each row.
+ * @return The number of pixels converted. Any remaining pixels (less than 16) should be converted
+ *         by Fits_Image_Row_Swap_Scalar.
+ * @see #Fits_Image_Convert_AVX2
+ */
+__attribute__((target("avx2"))) static int Fits_Image_Row_Swap_AVX2(unsigned short *input_row_a,
+								     unsigned short *input_row_b,
+								     unsigned short *output_row_a,
+								     unsigned short *output_row_b,int ncols)
+{
+	__m256i value_a,value_b;
+	int x;
+
+	for(x = 0; x+16 <= ncols; x += 16)
+	{
+		value_a = _mm256_loadu_si256((__m256i *)(input_row_a+x));
+		value_b = _mm256_loadu_si256((__m256i *)(input_row_b+x));
+		_mm256_storeu_si256((__m256i *)(output_row_a+x),Fits_Image_Convert_AVX2(value_b));
+		_mm256_storeu_si256((__m256i *)(output_row_b+x),Fits_Image_Convert_AVX2(value_a));
+	}
+	return x;
+}
+
+/**
+ * AVX2 version of Fits_Image_Row_Reverse, converting 16 pixel pairs at a time.
+ * @param input_row_a The first row to convert.
+ * @param input_row_b The second row to convert.
+ * @param output_row_a Where to put the converted pixels from input_row_b.
+ * @param output_row_b Where to put the converted pixels from input_row_a.
+ * @param count The number of pixel pairs to convert.
+ * @param ncols The number of pixels in each row.
+ * @return The number of pixel pairs converted. Any remaining pairs (less than 16) should be converted
+ *         by Fits_Image_Row_Reverse_Scalar.
+ * @see #Fits_Image_Reverse_Convert_AVX2
+ */
+__attribute__((target("avx2"))) static int Fits_Image_Row_Reverse_AVX2(unsigned short *input_row_a,
+									unsigned short *input_row_b,
+									unsigned short *output_row_a,
+									unsigned short *output_row_b,int count,int ncols)
+{
+	__m256i value_a,value_b;
+	int x;
+
+	for(x = 0; x+16 <= count; x += 16)
+	{
+		value_a = _mm256_loadu_si256((__m256i *)(input_row_a+x));
+		value_b = _mm256_loadu_si256((__m256i *)(input_row_b+ncols-(x+16)));
+		_mm256_storeu_si256((__m256i *)(output_row_a+x),Fits_Image_Reverse_Convert_AVX2(value_b));
+		_mm256_storeu_si256((__m256i *)(output_row_b+ncols-(x+16)),Fits_Image_Reverse_Convert_AVX2(value_a));
+	}
+	return x;
+}
+#endif
+
+/**
+ * Write a 2D unsigned short FITS image to disk.
+ * <ul>
+ * <li>We format the mandatory primary header cards using Fits_Image_Mandatory_Cards_Set.
+ * <li>We format the END card, and space pad the header to a multiple of CCD_FITS_IMAGE_BLOCK_LENGTH.
+ * <li>We write the header, image data and data padding to the file using Fits_Image_Iov_Write.
+ * </ul>
+ * The image data must already have been converted into FITS format using CCD_Fits_Image_Data_Convert.
+ * The resulting file then has the same header cards and data as writing the original image using
+ * fits_create_file / fits_create_img(USHORT_IMG) / CCD_Fits_Header_Write_To_Fits / fits_write_img /
+ * fits_close_file.
+ * @param filename The filename of the FITS image to create.
+ * @param card_image_list A list of card_count (CCD_FITS_HEADER_CARD_IMAGE_LENGTH column, not '\0' terminated)
+ *        card images to put in the header after the mandatory cards, as produced by
+ *        CCD_Fits_Header_To_Card_Images. These should not include any of the mandatory keywords, or END.
+ * @param card_count The number of card images in card_image_list.
+ * @param ncols The number of columns in the image (NAXIS1).
+ * @param nrows The number of rows in the image (NAXIS2).
+ * @param image_data The image data, of ncols*nrows pixels, already converted to FITS (big-endian, BZERO offset)
+ *        format by CCD_Fits_Image_Data_Convert.
+ * @param preallocated A boolean, TRUE if the file has already been created by CCD_Fits_Image_Preallocate.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #CCD_FITS_IMAGE_BLOCK_LENGTH
+ * @see #CCD_FITS_IMAGE_MANDATORY_CARD_COUNT
+ * @see #FITS_IMAGE_IOVEC_COUNT
+ * @see #Fits_Image_Zero_Block
+ * @see #Fits_Image_Card_Image_Set
+ * @see #Fits_Image_Mandatory_Cards_Set
+ * @see #Fits_Image_Iov_Write
+ * @see #CCD_Fits_Image_Data_Convert
+ * @see #CCD_Fits_Image_Header_Length_Get
+ * @see #CCD_Fits_Image_Data_Length_Get
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ * @see ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ccd_fits_header.html#CCD_Fits_Header_To_Card_Images
+ */
+static int Fits_Image_Write(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+			    unsigned short *image_data,int preallocated)
+{
+	char mandatory_card_list[CCD_FITS_IMAGE_MANDATORY_CARD_COUNT*CCD_FITS_HEADER_CARD_IMAGE_LENGTH];
+	char end_block[CCD_FITS_IMAGE_BLOCK_LENGTH];
+	struct iovec iov[FITS_IMAGE_IOVEC_COUNT];
+	int header_length,data_length,image_length,end_length;
+
+	Fits_Image_Error_Number = 0;
+	if(filename == NULL)
+	{
+		Fits_Image_Error_Number = 1;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Write:filename is NULL.");
+		return FALSE;
+	}
+	if((card_image_list == NULL)&&(card_count > 0))
+	{
+		Fits_Image_Error_Number = 2;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Write:card_image_list is NULL.");
+		return FALSE;
+	}
+	if(card_count < 0)
+	{
+		Fits_Image_Error_Number = 3;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Write:Illegal card count %d.",card_count);
+		return FALSE;
+	}
+	if((ncols < 1)||(nrows < 1)||(image_data == NULL))
+	{
+		Fits_Image_Error_Number = 4;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Write:Illegal image (%d,%d,%p).",ncols,nrows,
+			(void*)image_data);
+		return FALSE;
+	}
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"Fits_Image_Write(%s,card_count=%d,ncols=%d,nrows=%d):Started.",
+			       filename,card_count,ncols,nrows);
+#endif
+	header_length = CCD_Fits_Image_Header_Length_Get(card_count);
+	data_length = CCD_Fits_Image_Data_Length_Get(ncols,nrows);
+	image_length = ncols*nrows*sizeof(unsigned short);
+	/* header: mandatory cards, the caller's cards, END, then space padding */
+	Fits_Image_Mandatory_Cards_Set(mandatory_card_list,16,ncols,nrows,0);
+	end_length = header_length-((CCD_FITS_IMAGE_MANDATORY_CARD_COUNT+card_count)*
+				    CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+	memset(end_block,' ',end_length);
+	memcpy(end_block,"END",3);
+	/* data (already in FITS format), then zero padding */
+	iov[0].iov_base = mandatory_card_list;
+	iov[0].iov_len = CCD_FITS_IMAGE_MANDATORY_CARD_COUNT*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	iov[1].iov_base = card_image_list;
+	iov[1].iov_len = card_count*CCD_FITS_HEADER_CARD_IMAGE_LENGTH;
+	iov[2].iov_base = end_block;
+	iov[2].iov_len = end_length;
+	iov[3].iov_base = image_data;
+	iov[3].iov_len = image_length;
+	iov[4].iov_base = Fits_Image_Zero_Block;
+	iov[4].iov_len = data_length-image_length;
+	return Fits_Image_Iov_Write(filename,iov,FITS_IMAGE_IOVEC_COUNT,header_length+data_length,preallocated);
+}
+
+/**
+ * Write a list of buffers to a FITS image file, starting at the beginning of the file.
+ * <ul>
+ * <li>If preallocated is FALSE, we create the file using open (with O_EXCL, fits_create_file also fails if 
+ *     the file already exists), and preallocate the whole file using fallocate (if the filesystem supports it).
+ * <li>If the I/O backend is CCD_FITS_IMAGE_IO_BACKEND_IO_URING, the open (and fallocate), write, sync and close
+ *     are done by the io_uring thread, using Fits_Image_Io_Uring_Write. Otherwise:
+ * <li>If preallocated is TRUE, we open the existing (preallocated) file for writing, without truncating it.
+ * <li>We write the buffers with one call to Fits_Image_Pwritev.
+ * <li>If Fits_Image_Io_Data.Sync is TRUE, we fdatasync the file.
+ * <li>We close the file.
+ * <li>We add the file, and the number of system calls used to write it, to the I/O counts 
+ *     using Fits_Image_Io_Count_Add.
+ * </ul>
+ * @param filename The filename of the FITS image to write.
+ * @param iov The list of buffers to write, which together make up the whole file.
+ * @param iov_count The number of buffers in iov.
+ * @param file_length The total length of the buffers in iov, used to preallocate the file.
+ * @param preallocated A boolean, TRUE if the file has already been created by CCD_Fits_Image_Preallocate.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Image_Pwritev
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Count_Add
+ * @see #Fits_Image_Io_Uring_Write
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+static int Fits_Image_Iov_Write(char *filename,struct iovec *iov,int iov_count,off_t file_length,int preallocated)
+{
+	int fd,retval,syscall_count;
+
+#ifdef IO_URING
+	if(Fits_Image_Io_Data.Backend == CCD_FITS_IMAGE_IO_BACKEND_IO_URING)
+	{
+		if(preallocated)
+			retval = Fits_Image_Io_Uring_Write(filename,O_WRONLY,0,iov,iov_count);
+		else
+		{
+			retval = Fits_Image_Io_Uring_Write(filename,O_WRONLY|O_CREAT|O_EXCL,file_length,iov,
+							   iov_count);
+		}
+#if LOGGING > 9
+		CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"Fits_Image_Iov_Write(%s):Finished (io_uring,%d).",filename,
+				       retval);
+#endif
+		return retval;
+	}
+#endif
+	/* open, (fallocate), pwritev, (fdatasync) and close */
+	syscall_count = 3+Fits_Image_Io_Data.Sync;
+	if(preallocated)
+	{
+		/* the file has already been created and preallocated by CCD_Fits_Image_Preallocate */
+		fd = open(filename,O_WRONLY);
+		if(fd < 0)
+		{
+			Fits_Image_Error_Number = 44;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Iov_Write:Failed to open preallocated '%s' (%d:%s).",
+				filename,errno,strerror(errno));
+			return FALSE;
+		}
+	}
+	else
+	{
+		/* create the file. Use the same permissions as fopen (used by CFITSIO), and fail if it already exists
+		** as fits_create_file does */
+		fd = open(filename,O_WRONLY|O_CREAT|O_EXCL,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+		if(fd < 0)
+		{
+			Fits_Image_Error_Number = 5;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Iov_Write:Failed to create '%s' (%d:%s).",filename,
+				errno,strerror(errno));
+			return FALSE;
+		}
+		/* preallocate the file, so the write does not have to extend it block by block.
+		** Not all filesystems support fallocate, in which case the write extends the file as usual. */
+		retval = fallocate(fd,0,0,file_length);
+		syscall_count++;
+		if((retval != 0)&&(errno != EOPNOTSUPP))
+		{
+			Fits_Image_Error_Number = 6;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Iov_Write:Failed to preallocate %ld bytes for '%s' (%d:%s).",
+				(long)file_length,filename,errno,strerror(errno));
+			close(fd);
+			return FALSE;
+		}
+	}
+	if(!Fits_Image_Pwritev(fd,iov,iov_count,0,filename))
+	{
+		close(fd);
+		return FALSE;
+	}
+	if(Fits_Image_Io_Data.Sync)
+	{
+		retval = fdatasync(fd);
+		if(retval != 0)
+		{
+			Fits_Image_Error_Number = 56;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Iov_Write:Failed to sync '%s' (%d:%s).",filename,
+				errno,strerror(errno));
+			close(fd);
+			return FALSE;
+		}
+	}
+	retval = close(fd);
+	if(retval != 0)
+	{
+		Fits_Image_Error_Number = 7;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Iov_Write:Failed to close '%s' (%d:%s).",filename,
+			errno,strerror(errno));
+		return FALSE;
+	}
+	Fits_Image_Io_Count_Add(1,syscall_count);
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERBOSE,"Fits_Image_Iov_Write(%s):Finished.",filename);
+#endif
+	return TRUE;
+}
+
+/**
+ * Write a list of buffers to a file at the specified offset, using pwritev. pwritev can write less than requested
+ * (or be interrupted by a signal), in which case we retry from where it left off.
+ * @param fd The file descriptor to write to.
+ * @param iov The list of buffers to write. This is modified if a partial write occurs.
+ * @param iov_count The number of buffers in iov.
+ * @param offset The offset in the file to start writing at.
+ * @param filename The filename being written to, for error messages.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+static int Fits_Image_Pwritev(int fd,struct iovec *iov,int iov_count,off_t offset,char *filename)
+{
+	ssize_t written;
+
+	while(iov_count > 0)
+	{
+		/* skip any buffers that have been completely written (or are empty) */
+		if(iov->iov_len == 0)
+		{
+			iov++;
+			iov_count--;
+			continue;
+		}
+		written = pwritev(fd,iov,iov_count,offset);
+		if(written < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			Fits_Image_Error_Number = 8;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Pwritev:Failed to write '%s' at offset %ld (%d:%s).",
+				filename,(long)offset,errno,strerror(errno));
+			return FALSE;
+		}
+		if(written == 0)
+		{
+			Fits_Image_Error_Number = 9;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Pwritev:Wrote nothing to '%s' at offset %ld.",
+				filename,(long)offset);
+			return FALSE;
+		}
+		offset += written;
+		while((iov_count > 0)&&(written >= (ssize_t)(iov->iov_len)))
+		{
+			written -= iov->iov_len;
+			iov++;
+			iov_count--;
+		}
+		if(iov_count > 0)
+		{
+			iov->iov_base = ((char *)(iov->iov_base))+written;
+			iov->iov_len -= written;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Read length bytes from a file at offset, using pread. Short reads (and EINTR) are retried 
+ * until everything has been read.
+ * @param fd The file descriptor to read from.
+ * @param buffer Where to put the data read.
+ * @param length The number of bytes to read.
+ * @param offset The offset in the file to read from.
+ * @param filename The filename, for error messages.
+ * @return The routine returns TRUE on success, and FALSE on failure (including reaching the end of the file).
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+static int Fits_Image_Pread(int fd,void *buffer,size_t length,off_t offset,char *filename)
+{
+	ssize_t read_length;
+
+	while(length > 0)
+	{
+		read_length = pread(fd,buffer,length,offset);
+		if(read_length < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			Fits_Image_Error_Number = 72;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Pread:Failed to read '%s' at offset %ld (%d:%s).",
+				filename,(long)offset,errno,strerror(errno));
+			return FALSE;
+		}
+		if(read_length == 0)
+		{
+			Fits_Image_Error_Number = 73;
+			sprintf(Fits_Image_Error_String,"Fits_Image_Pread:End of '%s' at offset %ld (%ld bytes unread).",
+				filename,(long)offset,(long)length);
+			return FALSE;
+		}
+		buffer = ((char *)buffer)+read_length;
+		length -= read_length;
+		offset += read_length;
+	}
+	return TRUE;
+}
+
+/**
+ * Add to the number of files written, and the system calls used to write them.
+ * @param file_count The number of files to add.
+ * @param syscall_count The number of system calls to add.
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Mutex
+ */
+static void Fits_Image_Io_Count_Add(int file_count,int syscall_count)
+{
+	pthread_mutex_lock(&Fits_Image_Io_Mutex);
+	Fits_Image_Io_Data.File_Count += file_count;
+	Fits_Image_Io_Data.Syscall_Count += syscall_count;
+	pthread_mutex_unlock(&Fits_Image_Io_Mutex);
+}
+
+#ifdef IO_URING
+/**
+ * Create the ring used by the io_uring backend, and start the io_uring thread.
+ * <ul>
+ * <li>We create a ring of FITS_IMAGE_IO_URING_QUEUE_LENGTH entries using io_uring_queue_init. The ring is created
+ *     with IORING_SETUP_SUBMIT_ALL, so a failing operation does not stop the rest of a batch being submitted.
+ * <li>We register FITS_IMAGE_IO_URING_FILE_COUNT empty (direct) file descriptor slots with the ring, using
+ *     io_uring_register_files_sparse. Opening each file into a slot (rather than a normal file descriptor) 
+ *     allows the open, write and close of a file to be linked in one submission.
+ * <li>We start Fits_Image_Io_Uring_Thread.
+ * </ul>
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #FITS_IMAGE_IO_URING_QUEUE_LENGTH
+ * @see #FITS_IMAGE_IO_URING_FILE_COUNT
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Uring_Thread
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+static int Fits_Image_Io_Uring_Start(void)
+{
+	int retval;
+
+	retval = io_uring_queue_init(FITS_IMAGE_IO_URING_QUEUE_LENGTH,&(Fits_Image_Io_Data.Ring),
+				     IORING_SETUP_SUBMIT_ALL);
+	if(retval < 0)
+	{
+		Fits_Image_Error_Number = 47;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Start:io_uring_queue_init failed (%d:%s).",
+			-retval,strerror(-retval));
+		return FALSE;
+	}
+	retval = io_uring_register_files_sparse(&(Fits_Image_Io_Data.Ring),FITS_IMAGE_IO_URING_FILE_COUNT);
+	if(retval < 0)
+	{
+		io_uring_queue_exit(&(Fits_Image_Io_Data.Ring));
+		Fits_Image_Error_Number = 48;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Start:io_uring_register_files_sparse failed (%d:%s).",
+			-retval,strerror(-retval));
+		return FALSE;
+	}
+	Fits_Image_Io_Data.Thread_Stop = FALSE;
+	Fits_Image_Io_Data.Pending_Head = NULL;
+	Fits_Image_Io_Data.Pending_Tail = NULL;
+	retval = pthread_create(&(Fits_Image_Io_Data.Thread),NULL,Fits_Image_Io_Uring_Thread,NULL);
+	if(retval != 0)
+	{
+		io_uring_queue_exit(&(Fits_Image_Io_Data.Ring));
+		Fits_Image_Error_Number = 49;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Start:Failed to create thread (%d).",retval);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Stop the io_uring thread (once it has written any pending requests), and destroy the ring.
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Mutex
+ * @see #Fits_Image_Io_Pending_Condition
+ */
+static void Fits_Image_Io_Uring_Stop(void)
+{
+	pthread_mutex_lock(&Fits_Image_Io_Mutex);
+	Fits_Image_Io_Data.Thread_Stop = TRUE;
+	pthread_cond_signal(&Fits_Image_Io_Pending_Condition);
+	pthread_mutex_unlock(&Fits_Image_Io_Mutex);
+	pthread_join(Fits_Image_Io_Data.Thread,NULL);
+	io_uring_queue_exit(&(Fits_Image_Io_Data.Ring));
+}
+
+/**
+ * The io_uring thread. This is the only thread that submits to, and reaps completions from, the ring.
+ * <ul>
+ * <li>We wait for requests to be added to the pending list.
+ * <li>We take up to FITS_IMAGE_IO_URING_FILE_COUNT requests off the pending list, and write them as one
+ *     batch using Fits_Image_Io_Uring_Batch. Requests queued whilst a batch is in progress are written 
+ *     in the next batch, so the more writing threads are waiting, the more files are submitted at once.
+ * <li>We mark the batch's requests as done, and broadcast Fits_Image_Io_Done_Condition.
+ * <li>We exit when Thread_Stop is set and the pending list is empty.
+ * </ul>
+ * @param arg The thread argument, not used.
+ * @return The routine always returns NULL.
+ * @see #FITS_IMAGE_IO_URING_FILE_COUNT
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Mutex
+ * @see #Fits_Image_Io_Pending_Condition
+ * @see #Fits_Image_Io_Done_Condition
+ * @see #Fits_Image_Io_Uring_Batch
+ */
+static void *Fits_Image_Io_Uring_Thread(void *arg)
+{
+	struct Fits_Image_Io_Request_Struct *request_list[FITS_IMAGE_IO_URING_FILE_COUNT];
+	int i,request_count;
+
+	while(TRUE)
+	{
+		pthread_mutex_lock(&Fits_Image_Io_Mutex);
+		while((Fits_Image_Io_Data.Pending_Head == NULL)&&(Fits_Image_Io_Data.Thread_Stop == FALSE))
+			pthread_cond_wait(&Fits_Image_Io_Pending_Condition,&Fits_Image_Io_Mutex);
+		if(Fits_Image_Io_Data.Pending_Head == NULL)
+		{
+			pthread_mutex_unlock(&Fits_Image_Io_Mutex);
+			break;
+		}
+		request_count = 0;
+		while((Fits_Image_Io_Data.Pending_Head != NULL)&&(request_count < FITS_IMAGE_IO_URING_FILE_COUNT))
+		{
+			request_list[request_count++] = Fits_Image_Io_Data.Pending_Head;
+			Fits_Image_Io_Data.Pending_Head = Fits_Image_Io_Data.Pending_Head->Next;
+		}
+		if(Fits_Image_Io_Data.Pending_Head == NULL)
+			Fits_Image_Io_Data.Pending_Tail = NULL;
+		pthread_mutex_unlock(&Fits_Image_Io_Mutex);
+		Fits_Image_Io_Uring_Batch(request_list,request_count);
+		pthread_mutex_lock(&Fits_Image_Io_Mutex);
+		for(i = 0; i < request_count; i++)
+			request_list[i]->Done = TRUE;
+		pthread_cond_broadcast(&Fits_Image_Io_Done_Condition);
+		pthread_mutex_unlock(&Fits_Image_Io_Mutex);
+	}
+	return NULL;
+}
+
+/**
+ * Write a batch of files using the ring. Each request's operations are linked (IOSQE_IO_HARDLINK, so 
+ * a failure does not cancel the rest of the chain, and the file slot is always closed):
+ * openat into direct file slot i (the request's index in the batch), an optional fallocate, writev of all the 
+ * buffers, an optional fdatasync, and close of the slot. The whole batch is submitted, and all it's 
+ * completions waited for, with one io_uring_submit_and_wait call. 
+ * Each completion's result is stored in the request's Op_List, operations that are not used have a result of 0.
+ * @param request_list The list of requests to write.
+ * @param request_count The number of requests in request_list, at most FITS_IMAGE_IO_URING_FILE_COUNT.
+ * @see #FITS_IMAGE_IO_OP
+ * @see #FITS_IMAGE_IO_URING_FILE_COUNT
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Count_Add
+ */
+static void Fits_Image_Io_Uring_Batch(struct Fits_Image_Io_Request_Struct **request_list,int request_count)
+{
+	struct Fits_Image_Io_Request_Struct *request = NULL;
+	struct Fits_Image_Io_Op_Struct *op = NULL;
+	struct io_uring_sqe *sqe = NULL;
+	struct io_uring_cqe *cqe = NULL;
+	int i,j,op_count,submit_count,complete_count,syscall_count,retval;
+
+	op_count = 0;
+	for(i = 0; i < request_count; i++)
+	{
+		request = request_list[i];
+		for(j = 0; j < FITS_IMAGE_IO_OP_COUNT; j++)
+		{
+			request->Op_List[j].Request = request;
+			request->Op_List[j].Result = 0;
+		}
+		sqe = io_uring_get_sqe(&(Fits_Image_Io_Data.Ring));
+		io_uring_prep_openat_direct(sqe,AT_FDCWD,request->Filename,request->Open_Flags,
+					    S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH,i);
+		io_uring_sqe_set_data(sqe,&(request->Op_List[FITS_IMAGE_IO_OP_OPEN]));
+		sqe->flags |= IOSQE_IO_HARDLINK;
+		op_count++;
+		if(request->Allocate_Length > 0)
+		{
+			sqe = io_uring_get_sqe(&(Fits_Image_Io_Data.Ring));
+			io_uring_prep_fallocate(sqe,i,0,0,request->Allocate_Length);
+			io_uring_sqe_set_data(sqe,&(request->Op_List[FITS_IMAGE_IO_OP_FALLOCATE]));
+			sqe->flags |= IOSQE_FIXED_FILE|IOSQE_IO_HARDLINK;
+			op_count++;
+		}
+		sqe = io_uring_get_sqe(&(Fits_Image_Io_Data.Ring));
+		io_uring_prep_writev(sqe,i,request->Iov,request->Iov_Count,0);
+		io_uring_sqe_set_data(sqe,&(request->Op_List[FITS_IMAGE_IO_OP_WRITE]));
+		sqe->flags |= IOSQE_FIXED_FILE|IOSQE_IO_HARDLINK;
+		op_count++;
+		if(request->Sync)
+		{
+			sqe = io_uring_get_sqe(&(Fits_Image_Io_Data.Ring));
+			io_uring_prep_fsync(sqe,i,IORING_FSYNC_DATASYNC);
+			io_uring_sqe_set_data(sqe,&(request->Op_List[FITS_IMAGE_IO_OP_SYNC]));
+			sqe->flags |= IOSQE_FIXED_FILE|IOSQE_IO_HARDLINK;
+			op_count++;
+		}
+		/* the last operation of the chain, so it is not linked to the next request */
+		sqe = io_uring_get_sqe(&(Fits_Image_Io_Data.Ring));
+		io_uring_prep_close_direct(sqe,i);
+		io_uring_sqe_set_data(sqe,&(request->Op_List[FITS_IMAGE_IO_OP_CLOSE]));
+		op_count++;
+	}
+	/* submit the whole batch, and wait for all of it to complete. The ring is created with 
+	** IORING_SETUP_SUBMIT_ALL, so either all the operations are submitted, or (on error) none are */
+	syscall_count = 0;
+	do
+	{
+		retval = io_uring_submit_and_wait(&(Fits_Image_Io_Data.Ring),op_count);
+		syscall_count++;
+	} while(retval == -EINTR);
+	if(retval < 0)
+	{
+		for(i = 0; i < request_count; i++)
+		{
+			for(j = 0; j < FITS_IMAGE_IO_OP_COUNT; j++)
+				request_list[i]->Op_List[j].Result = retval;
+		}
+		submit_count = 0;
+	}
+	else
+		submit_count = retval;
+	/* reap the completions */
+	complete_count = 0;
+	while(complete_count < submit_count)
+	{
+		retval = io_uring_wait_cqe(&(Fits_Image_Io_Data.Ring),&cqe);
+		if(retval == -EINTR)
+			continue;
+		if(retval < 0)
+			break;
+		op = (struct Fits_Image_Io_Op_Struct *)io_uring_cqe_get_data(cqe);
+		if(op != NULL)
+			op->Result = cqe->res;
+		io_uring_cqe_seen(&(Fits_Image_Io_Data.Ring),cqe);
+		complete_count++;
+	}
+	Fits_Image_Io_Count_Add(0,syscall_count);
+#if LOGGING > 9
+	CCD_General_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"Fits_Image_Io_Uring_Batch:Wrote %d files "
+			       "(%d operations) using %d system calls.",request_count,op_count,syscall_count);
+#endif
+}
+
+/**
+ * Write a FITS image file using the io_uring thread. We add a request to the pending list, signal the io_uring 
+ * thread, and wait for it to be done. We then check the result of each operation.
+ * @param filename The filename to write.
+ * @param open_flags The flags to open the file with.
+ * @param allocate_length The number of bytes to preallocate with fallocate, or 0 to skip the fallocate.
+ * @param iov The list of buffers to write at the start of the file.
+ * @param iov_count The number of buffers in iov.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #FITS_IMAGE_IO_OP
+ * @see #Fits_Image_Io_Data
+ * @see #Fits_Image_Io_Mutex
+ * @see #Fits_Image_Io_Pending_Condition
+ * @see #Fits_Image_Io_Done_Condition
+ * @see #Fits_Image_Io_Uring_Thread
+ * @see #Fits_Image_Error_Number
+ * @see #Fits_Image_Error_String
+ */
+static int Fits_Image_Io_Uring_Write(char *filename,int open_flags,off_t allocate_length,struct iovec *iov,
+				     int iov_count)
+{
+	struct Fits_Image_Io_Request_Struct request;
+	int i,result;
+
+	request.Filename = filename;
+	request.Open_Flags = open_flags;
+	request.Allocate_Length = allocate_length;
+	request.Iov = iov;
+	request.Iov_Count = iov_count;
+	request.Write_Length = 0;
+	for(i = 0; i < iov_count; i++)
+		request.Write_Length += iov[i].iov_len;
+	request.Sync = Fits_Image_Io_Data.Sync;
+	request.Done = FALSE;
+	request.Next = NULL;
+	pthread_mutex_lock(&Fits_Image_Io_Mutex);
+	if(Fits_Image_Io_Data.Pending_Tail == NULL)
+		Fits_Image_Io_Data.Pending_Head = &request;
+	else
+		Fits_Image_Io_Data.Pending_Tail->Next = &request;
+	Fits_Image_Io_Data.Pending_Tail = &request;
+	pthread_cond_signal(&Fits_Image_Io_Pending_Condition);
+	while(request.Done == FALSE)
+		pthread_cond_wait(&Fits_Image_Io_Done_Condition,&Fits_Image_Io_Mutex);
+	Fits_Image_Io_Data.File_Count++;
+	pthread_mutex_unlock(&Fits_Image_Io_Mutex);
+	result = request.Op_List[FITS_IMAGE_IO_OP_OPEN].Result;
+	if(result < 0)
+	{
+		Fits_Image_Error_Number = 50;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Write:Failed to open '%s' (%d:%s).",filename,
+			-result,strerror(-result));
+		return FALSE;
+	}
+	/* not all filesystems support fallocate, in which case the write extends the file as usual */
+	result = request.Op_List[FITS_IMAGE_IO_OP_FALLOCATE].Result;
+	if((result < 0)&&(result != -EOPNOTSUPP))
+	{
+		Fits_Image_Error_Number = 51;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Write:Failed to preallocate %ld bytes for '%s' (%d:%s).",
+			(long)allocate_length,filename,-result,strerror(-result));
+		return FALSE;
+	}
+	result = request.Op_List[FITS_IMAGE_IO_OP_WRITE].Result;
+	if(result < 0)
+	{
+		Fits_Image_Error_Number = 52;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Write:Failed to write '%s' (%d:%s).",filename,
+			-result,strerror(-result));
+		return FALSE;
+	}
+	/* the sync and close were still run after a short write, as the operations are hard linked */
+	if(((size_t)result) != request.Write_Length)
+	{
+		Fits_Image_Error_Number = 53;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Write:Short write to '%s' (%d of %ld bytes).",
+			filename,result,(long)request.Write_Length);
+		return FALSE;
+	}
+	result = request.Op_List[FITS_IMAGE_IO_OP_SYNC].Result;
+	if(result < 0)
+	{
+		Fits_Image_Error_Number = 54;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Write:Failed to sync '%s' (%d:%s).",filename,
+			-result,strerror(-result));
+		return FALSE;
+	}
+	result = request.Op_List[FITS_IMAGE_IO_OP_CLOSE].Result;
+	if(result < 0)
+	{
+		Fits_Image_Error_Number = 55;
+		sprintf(Fits_Image_Error_String,"Fits_Image_Io_Uring_Write:Failed to close '%s' (%d:%s).",filename,
+			-result,strerror(-result));
+		return FALSE;
+	}
+	return TRUE;
+}
+#endif
@@ -25,10 +25,12 @@
 #include <unistd.h>
 #include "ccd_general.h"
 #include "ccd_buffer.h"
+#include "ccd_clock_model.h"
 #include "ccd_command.h"
 #include "ccd_exposure.h"
 #include "ccd_fits_filename.h"
 #include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
 #include "ccd_setup.h"
 #include "ccd_temperature.h"
 
@@ -84,13 +86,14 @@ static struct General_Struct General_Data =
 
 /**
  * Variable holding error code of last operation performed.
+ * Thread local, so errors from concurrent callers (e.g. the C layer writer threads) are kept apart.
  */
-static int General_Error_Number = 0;
+static __thread int General_Error_Number = 0;
 /**
  * Local variable holding description of the last error that occured.
  * @see #CCD_GENERAL_ERROR_STRING_LENGTH
  */
-static char General_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
+static __thread char General_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
 
 /* --------------------------------------------------------
 ** External Functions
@@ -100,10 +103,12 @@ static char General_Error_String[CCD_GENERAL_ERROR_STRING_LENGTH] = "";
  * @return Returns TRUE if an error is found and FALSE if no error is found.
  * @see #General_Error_Number
  * @see ccd_buffer.html#CCD_Buffer_Get_Error_Number
+ * @see ccd_clock_model.html#CCD_Clock_Model_Get_Error_Number
  * @see ccd_command.html#CCD_Command_Get_Error_Number
  * @see ccd_exposure.html#CCD_Exposure_Get_Error_Number
  * @see ccd_fits_filename.html#CCD_Fits_Filename_Get_Error_Number
  * @see ccd_fits_header.html#CCD_Fits_Header_Get_Error_Number
+ * @see ccd_fits_image.html#CCD_Fits_Image_Get_Error_Number
  * @see ccd_setup.html#CCD_Setup_Get_Error_Number
  * @see ccd_temperature.html#CCD_Temperature_Get_Error_Number
  */
@@ -119,12 +124,16 @@ int CCD_General_Is_Error(void)
 		found = TRUE;
 	if(CCD_Fits_Header_Get_Error_Number() != 0)
 		found = TRUE;
+	if(CCD_Fits_Image_Get_Error_Number() != 0)
+		found = TRUE;
 	if(CCD_Exposure_Get_Error_Number() != 0)
 		found = TRUE;
 	if(CCD_Command_Get_Error_Number() != 0)
 		found = TRUE;
 	if(CCD_Buffer_Get_Error_Number() != 0)
 		found = TRUE;
+	if(CCD_Clock_Model_Get_Error_Number() != 0)
+		found = TRUE;
 	if(General_Error_Number != 0)
 		found = TRUE;
 	return found;
@@ -137,6 +146,8 @@ int CCD_General_Is_Error(void)
  * @see #CCD_General_Get_Current_Time_String
  * @see ccd_buffer.html#CCD_Buffer_Get_Error_Number
  * @see ccd_buffer.html#CCD_Buffer_Error
+ * @see ccd_clock_model.html#CCD_Clock_Model_Get_Error_Number
+ * @see ccd_clock_model.html#CCD_Clock_Model_Error
  * @see ccd_command.html#CCD_Command_Get_Error_Number
  * @see ccd_command.html#CCD_Command_Error
  * @see ccd_exposure.html#CCD_Exposure_Get_Error_Number
@@ -145,6 +156,8 @@ int CCD_General_Is_Error(void)
  * @see ccd_fits_filename.html#CCD_Fits_Filename_Error
  * @see ccd_fits_header.html#CCD_Fits_Header_Get_Error_Number
  * @see ccd_fits_header.html#CCD_Fits_Header_Error
+ * @see ccd_fits_image.html#CCD_Fits_Image_Get_Error_Number
+ * @see ccd_fits_image.html#CCD_Fits_Image_Error
  * @see ccd_setup.html#CCD_Setup_Get_Error_Number
  * @see ccd_setup.html#CCD_Setup_Error
  * @see ccd_temperature.html#CCD_Temperature_Get_Error_Number
@@ -175,6 +188,11 @@ void CCD_General_Error(void)
 		found = TRUE;
 		CCD_Fits_Header_Error();
 	}
+	if(CCD_Fits_Image_Get_Error_Number() != 0)
+	{
+		found = TRUE;
+		CCD_Fits_Image_Error();
+	}
 	if(CCD_Exposure_Get_Error_Number() != 0)
 	{
 		found = TRUE;
@@ -190,6 +208,11 @@ void CCD_General_Error(void)
 		found = TRUE;
 		CCD_Buffer_Error();
 	}
+	if(CCD_Clock_Model_Get_Error_Number() != 0)
+	{
+		found = TRUE;
+		CCD_Clock_Model_Error();
+	}
 	if(General_Error_Number != 0)
 	{
 		found = TRUE;
@@ -213,12 +236,16 @@ void CCD_General_Error(void)
  * @see #CCD_General_Get_Current_Time_String
  * @see ccd_buffer.html#CCD_Buffer_Get_Error_Number
  * @see ccd_buffer.html#CCD_Buffer_Error_String
+ * @see ccd_clock_model.html#CCD_Clock_Model_Get_Error_Number
+ * @see ccd_clock_model.html#CCD_Clock_Model_Error_String
  * @see ccd_command.html#CCD_Command_Get_Error_Number
  * @see ccd_command.html#CCD_Command_Error_String
  * @see ccd_fits_filename.html#CCD_Fits_Filename_Get_Error_Number
  * @see ccd_fits_filename.html#CCD_Fits_Filename_Error
  * @see ccd_fits_header.html#CCD_Fits_Header_Get_Error_Number
  * @see ccd_fits_header.html#CCD_Fits_Header_Error
+ * @see ccd_fits_image.html#CCD_Fits_Image_Get_Error_Number
+ * @see ccd_fits_image.html#CCD_Fits_Image_Error_String
  * @see ccd_exposure.html#CCD_Exposure_Get_Error_Number
  * @see ccd_exposure.html#CCD_Exposure_Error_String
  * @see ccd_setup.html#CCD_Setup_Get_Error_Number
@@ -247,6 +274,10 @@ void CCD_General_Error_To_String(char *error_string)
 	{
 		CCD_Fits_Header_Error_String(error_string);
 	}
+	if(CCD_Fits_Image_Get_Error_Number() != 0)
+	{
+		CCD_Fits_Image_Error_String(error_string);
+	}
 	if(CCD_Exposure_Get_Error_Number() != 0)
 	{
 		CCD_Exposure_Error_String(error_string);
@@ -259,6 +290,10 @@ void CCD_General_Error_To_String(char *error_string)
 	{
 		CCD_Buffer_Error_String(error_string);
 	}
+	if(CCD_Clock_Model_Get_Error_Number() != 0)
+	{
+		CCD_Clock_Model_Error_String(error_string);
+	}
 	if(General_Error_Number != 0)
 	{
 		CCD_General_Get_Current_Time_String(time_string,32);
@@ -3,6 +3,18 @@
 #ifndef CCD_BUFFER_H
 #define CCD_BUFFER_H
 
+/* hash defines */
+/**
+ * The number of image buffers to allocate. This allows several read out images to be held in memory
+ * (for instance, waiting to be saved to disk) whilst the next image is being read out.
+ */
+#define CCD_BUFFER_COUNT	(16)
+/**
+ * The alignment (in bytes) of each image buffer. The buffers are page aligned, which suits the vectorised image
+ * data conversion and direct (O_DIRECT) I/O. The allocated length of each buffer is rounded up to a multiple of this.
+ */
+#define CCD_BUFFER_ALIGNMENT	(4096)
+
 /*  the following 3 lines are needed to support C++ compilers */
 #ifdef __cplusplus
 extern "C" {
@@ -11,6 +23,12 @@ extern "C" {
 extern int CCD_Buffer_Initialise(void);
 extern int CCD_Buffer_Free(void);
 extern void *CCD_Buffer_Get_Image_Buffer(void);
+extern void *CCD_Buffer_Get_Image_Buffer_Index(int index);
+extern int CCD_Buffer_Get_Buffer_Count(void);
+extern int CCD_Buffer_Acquire(int *index,void **image_buffer);
+extern int CCD_Buffer_Release(int index);
+extern int CCD_Buffer_Get_Free_Count(void);
+extern int CCD_Buffer_Get_Image_Size_Bytes(void);
 extern int CCD_Buffer_Get_Error_Number(void);
 extern void CCD_Buffer_Error(void);
 extern void CCD_Buffer_Error_String(char *error_string);
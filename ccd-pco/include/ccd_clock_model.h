@@ -0,0 +1,58 @@
+/* ccd_clock_model.h */
+
+#ifndef CCD_CLOCK_MODEL_H
+#define CCD_CLOCK_MODEL_H
+#include <time.h>
+
+/* hash defines */
+/**
+ * The resolution of the camera's BCD timestamp, in seconds (the timestamp is in units of 100us).
+ */
+#define CCD_CLOCK_MODEL_TIMESTAMP_RESOLUTION       (0.0001)
+/**
+ * The default forgetting factor applied to the clock model's fit before each new sample is added.
+ * 1.0 weights all samples since the last reset equally, smaller values track a changing drift rate more quickly.
+ * 0.999 gives an effective fit window of about 1000 frames.
+ */
+#define CCD_CLOCK_MODEL_DEFAULT_FORGETTING_FACTOR  (0.999)
+/**
+ * The minimum number of samples the clock model must contain before it fits a drift rate.
+ */
+#define CCD_CLOCK_MODEL_FIT_SAMPLE_COUNT_MIN       (3)
+/**
+ * The minimum number of samples the clock model must contain before CCD_Clock_Model_Camera_To_UTC
+ * estimates an uncertainty. With fewer samples the scatter and lower envelope of the fit are too poorly determined
+ * for the uncertainty to be trusted.
+ */
+#define CCD_CLOCK_MODEL_UNCERTAINTY_SAMPLE_COUNT_MIN (20)
+/**
+ * The value returned as the uncertainty by CCD_Clock_Model_Camera_To_UTC when the clock model
+ * contains too few samples to estimate one.
+ */
+#define CCD_CLOCK_MODEL_UNCERTAINTY_UNKNOWN        (-1.0)
+
+/*  the following 3 lines are needed to support C++ compilers */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int CCD_Clock_Model_Date_To_Timespec(int year,int month,int day,int hour,int minute,int second,
+					    long nanosecond,struct timespec *timestamp);
+extern void CCD_Clock_Model_Reset(void);
+extern int CCD_Clock_Model_Forgetting_Factor_Set(double forgetting_factor);
+extern int CCD_Clock_Model_Readout_Delay_Set(double readout_delay);
+extern int CCD_Clock_Model_Sample_Add(struct timespec camera_time,struct timespec host_time,double host_delay);
+extern int CCD_Clock_Model_Camera_To_UTC(struct timespec camera_time,struct timespec *utc_time,
+					 double *uncertainty);
+extern int CCD_Clock_Model_Get_Sample_Count(void);
+extern int CCD_Clock_Model_Get_Rejected_Count(void);
+extern double CCD_Clock_Model_Get_Drift(void);
+extern int CCD_Clock_Model_Get_Error_Number(void);
+extern void CCD_Clock_Model_Error(void);
+extern void CCD_Clock_Model_Error_String(char *error_string);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -57,6 +57,29 @@ enum CCD_FITS_FILENAME_PIPELINE_FLAG
 							 ((value) == CCD_FITS_FILENAME_PIPELINE_FLAG_REALTIME)|| \
 							 ((value) == CCD_FITS_FILENAME_PIPELINE_FLAG_OFFLINE))
 
+/**
+ * Enum defining how finished FITS images are published to the data transfer processes.
+ * <ul>
+ * <li>CCD_FITS_FILENAME_PUBLISH_MODE_LOCK - The legacy protocol. A '.lock' file is created before the FITS image
+ *     is written, and removed afterwards. The data transfer processes ignore FITS images with a lock file.
+ * <li>CCD_FITS_FILENAME_PUBLISH_MODE_RENAME - The FITS image is written to a hidden temporary filename in the same
+ *     directory, and renamed to it's final filename once complete. The data transfer processes only ever see 
+ *     finished FITS images.
+ * </ul>
+ */
+enum CCD_FITS_FILENAME_PUBLISH_MODE
+{
+	CCD_FITS_FILENAME_PUBLISH_MODE_LOCK=0,
+	CCD_FITS_FILENAME_PUBLISH_MODE_RENAME=1
+};
+
+/**
+ * Macro to check whether the parameter is a valid publish mode.
+ * @see #CCD_FITS_FILENAME_PUBLISH_MODE
+ */
+#define CCD_FITS_FILENAME_IS_PUBLISH_MODE(value)	(((value) == CCD_FITS_FILENAME_PUBLISH_MODE_LOCK)|| \
+							 ((value) == CCD_FITS_FILENAME_PUBLISH_MODE_RENAME))
+
 /**
  * Default instrument code, used as first character as LT FITS filename for camera 0.
  */
@@ -65,6 +88,11 @@ enum CCD_FITS_FILENAME_PIPELINE_FLAG
  * Default instrument code, used as first character as LT FITS filename for camera 1.
  */
 #define CCD_FITS_FILENAME_DEFAULT_INSTRUMENT_CODE1 ('2')
+/**
+ * The window number used in run level filenames (CCD_Fits_Filename_Get_Run_Filename), 
+ * for files containing all the windows of a run.
+ */
+#define CCD_FITS_FILENAME_RUN_WINDOW_NUMBER        (0)
 
 /*  the following 3 lines are needed to support C++ compilers */
 #ifdef __cplusplus
@@ -78,6 +106,12 @@ extern int CCD_Fits_Filename_Next_Window(void);
 extern int CCD_Fits_Filename_Get_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE type,
 					  enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag,
 					  char *filename,int filename_length);
+extern int CCD_Fits_Filename_Get_Run_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE type,
+					      enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag,
+					      char *filename,int filename_length);
+extern int CCD_Fits_Filename_Get_Run_Window_Filename(enum CCD_FITS_FILENAME_EXPOSURE_TYPE exposure_type,
+						     enum CCD_FITS_FILENAME_PIPELINE_FLAG pipeline_flag,int run_number,
+						     int window_number,char *filename,int filename_length);
 extern int CCD_Fits_Filename_List_Add(char *filename,char ***filename_list,int *filename_count);
 extern int CCD_Fits_Filename_List_Free(char ***filename_list,int *filename_count);
 extern int CCD_Fits_Filename_Multrun_Get(void);
@@ -85,6 +119,14 @@ extern int CCD_Fits_Filename_Run_Get(void);
 extern int CCD_Fits_Filename_Window_Get(void);
 extern int CCD_Fits_Filename_Lock(char *filename);
 extern int CCD_Fits_Filename_UnLock(char *filename);
+extern int CCD_Fits_Filename_Publish_Mode_Set(enum CCD_FITS_FILENAME_PUBLISH_MODE mode);
+extern enum CCD_FITS_FILENAME_PUBLISH_MODE CCD_Fits_Filename_Publish_Mode_Get(void);
+extern int CCD_Fits_Filename_Publish_Begin(char *filename,char *write_filename,int write_filename_length);
+extern int CCD_Fits_Filename_Publish_Write_Filename_Get(char *filename,char *write_filename,
+							int write_filename_length);
+extern int CCD_Fits_Filename_Publish_End(char *write_filename);
+extern int CCD_Fits_Filename_Publish_Abort(char *write_filename);
+extern int CCD_Fits_Filename_Publish_Syscall_Count_Get(void);
 extern int CCD_Fits_Filename_Get_Error_Number(void);
 extern void CCD_Fits_Filename_Error(void);
 extern void CCD_Fits_Filename_Error_String(char *error_string);
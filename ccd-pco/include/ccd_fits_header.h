@@ -6,6 +6,12 @@
 /* for fitsfile declaration */
 #include "fitsio.h"
 
+/* hash defines */
+/**
+ * The length of a FITS header card image (one 80 column line of a FITS header), not including a '\0' terminator.
+ */
+#define CCD_FITS_HEADER_CARD_IMAGE_LENGTH (80)
+
 /*  the following 3 lines are needed to support C++ compilers */
 #ifdef __cplusplus
 extern "C" {
@@ -22,6 +28,12 @@ extern int CCD_Fits_Header_Add_Logical(char *keyword,int value,char *comment);
 extern int CCD_Fits_Header_Free(void);
 
 extern int CCD_Fits_Header_Write_To_Fits(fitsfile *fits_fp);
+extern int CCD_Fits_Header_Card_Count_Get(void);
+extern int CCD_Fits_Header_To_Card_Images(char *card_image_list,int card_image_count,int *card_count);
+extern int CCD_Fits_Header_Card_Image_String_Set(char *card_image,char *keyword,char *value);
+extern int CCD_Fits_Header_Card_Image_Int_Set(char *card_image,char *keyword,int value);
+extern int CCD_Fits_Header_Card_Image_Float_Set(char *card_image,char *keyword,double value);
+extern int CCD_Fits_Header_Card_Images_Write_To_Fits(fitsfile *fits_fp,char *card_image_list,int card_count);
 
 extern int CCD_Fits_Header_Get_Error_Number(void);
 extern void CCD_Fits_Header_Error(void);
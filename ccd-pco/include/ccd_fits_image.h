@@ -0,0 +1,253 @@
+/* ccd_fits_image.h
+*/
+#ifndef CCD_FITS_IMAGE_H
+#define CCD_FITS_IMAGE_H
+#include <sys/types.h>
+
+/* hash defines */
+/**
+ * The length of a FITS logical record (block) in bytes. The header and data units are padded to a multiple of this.
+ */
+#define CCD_FITS_IMAGE_BLOCK_LENGTH      (2880)
+/**
+ * The number of mandatory card images at the start of the primary header written by CCD_Fits_Image_Write
+ * (SIMPLE, BITPIX, NAXIS, NAXIS1, NAXIS2, EXTEND, two COMMENT cards, BZERO and BSCALE),
+ * the same cards fits_create_img writes for a 2D USHORT_IMG.
+ */
+#define CCD_FITS_IMAGE_MANDATORY_CARD_COUNT (10)
+/**
+ * The number of mandatory card images at the start of the primary header of a cube written by 
+ * CCD_Fits_Image_Cube_Create. These are the same as CCD_FITS_IMAGE_MANDATORY_CARD_COUNT, plus NAXIS3.
+ */
+#define CCD_FITS_IMAGE_CUBE_MANDATORY_CARD_COUNT (11)
+/**
+ * The maximum number of mandatory card images at the start of the primary header of a float image written by
+ * CCD_Fits_Image_Float_Write (SIMPLE, BITPIX, NAXIS, NAXIS1, NAXIS2, NAXIS3, EXTEND and two COMMENT cards).
+ * A 2D float image, or an integer image written by CCD_Fits_Image_Int_Write, has one less (no NAXIS3). 
+ * There is no BZERO or BSCALE.
+ */
+#define CCD_FITS_IMAGE_FLOAT_MANDATORY_CARD_COUNT (9)
+/**
+ * The maximum number of columns in the per-plane binary table of a cube.
+ */
+#define CCD_FITS_IMAGE_CUBE_COLUMN_COUNT_MAX (16)
+/**
+ * The length of the filename stored in CCD_Fits_Image_Cube_Struct.
+ */
+#define CCD_FITS_IMAGE_CUBE_FILENAME_LENGTH (256)
+/**
+ * The length of the filenames stored in CCD_Fits_Image_Raw_Struct and CCD_Fits_Image_Raw_Record_Struct.
+ */
+#define CCD_FITS_IMAGE_RAW_FILENAME_LENGTH  (256)
+/**
+ * The maximum number of per-frame values held in each raw capture frame record.
+ */
+#define CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX  (16)
+/**
+ * The maximum length of the name of each per-frame value in a raw capture file (including the NULL terminator).
+ */
+#define CCD_FITS_IMAGE_RAW_VALUE_NAME_LENGTH (16)
+/**
+ * The alignment (in bytes) of the header, and each frame's record and image data, in a raw capture file.
+ */
+#define CCD_FITS_IMAGE_RAW_ALIGNMENT        (4096)
+
+/* enumerations */
+/**
+ * Which implementation of the image data conversion kernel (CCD_Fits_Image_Data_Convert) to use.
+ * <ul>
+ * <li><b>CCD_FITS_IMAGE_CONVERT_METHOD_AUTO</b> Use the fastest method the CPU supports (the default).
+ * <li><b>CCD_FITS_IMAGE_CONVERT_METHOD_SCALAR</b> Plain C, one pixel at a time.
+ * <li><b>CCD_FITS_IMAGE_CONVERT_METHOD_SSE2</b> SSE2, 8 pixels at a time.
+ * <li><b>CCD_FITS_IMAGE_CONVERT_METHOD_AVX2</b> AVX2, 16 pixels at a time.
+ * </ul>
+ * @see #CCD_Fits_Image_Convert_Method_Set
+ */
+enum CCD_FITS_IMAGE_CONVERT_METHOD
+{
+	CCD_FITS_IMAGE_CONVERT_METHOD_AUTO=0,CCD_FITS_IMAGE_CONVERT_METHOD_SCALAR,
+	CCD_FITS_IMAGE_CONVERT_METHOD_SSE2,CCD_FITS_IMAGE_CONVERT_METHOD_AVX2
+};
+
+/**
+ * Which system call interface CCD_Fits_Image_Write (and CCD_Fits_Image_Write_Preallocated) use to write a file.
+ * <ul>
+ * <li><b>CCD_FITS_IMAGE_IO_BACKEND_PWRITE</b> open, fallocate, pwritev, (fdatasync) and close, 
+ *     called by the writing thread (the default).
+ * <li><b>CCD_FITS_IMAGE_IO_BACKEND_IO_URING</b> The same operations are queued to a single io_uring thread, which
+ *     batches the files of all the writing threads into as few submissions as possible, and reaps the completions.
+ *     This is only available if the library was built with IO_URING defined (and linked with liburing), 
+ *     and needs Linux 5.19 or later.
+ * </ul>
+ * @see #CCD_Fits_Image_Io_Backend_Set
+ */
+enum CCD_FITS_IMAGE_IO_BACKEND
+{
+	CCD_FITS_IMAGE_IO_BACKEND_PWRITE=0,CCD_FITS_IMAGE_IO_BACKEND_IO_URING=1
+};
+
+/**
+ * Macro to check whether the parameter is a valid I/O backend.
+ * @see #CCD_FITS_IMAGE_IO_BACKEND
+ */
+#define CCD_FITS_IMAGE_IS_IO_BACKEND(value)	(((value) == CCD_FITS_IMAGE_IO_BACKEND_PWRITE)|| \
+						 ((value) == CCD_FITS_IMAGE_IO_BACKEND_IO_URING))
+
+/* structures */
+/**
+ * Structure describing an open FITS cube, created by CCD_Fits_Image_Cube_Create or opened by 
+ * CCD_Fits_Image_Cube_Open. The cube is a 3D unsigned short image in the primary HDU (one plane per frame),
+ * followed by a binary table extension with one row of double columns per plane.
+ * <dl>
+ * <dt>File_Descriptor</dt> <dd>The file descriptor of the open cube file.</dd>
+ * <dt>Filename</dt> <dd>The cube's filename, of length CCD_FITS_IMAGE_CUBE_FILENAME_LENGTH.</dd>
+ * <dt>Ncols</dt> <dd>The number of columns in each plane (NAXIS1).</dd>
+ * <dt>Nrows</dt> <dd>The number of rows in each plane (NAXIS2).</dd>
+ * <dt>Plane_Count</dt> <dd>The number of planes in the cube (NAXIS3), which is also the number of table rows.</dd>
+ * <dt>Column_Count</dt> <dd>The number of (double) columns in the per-plane binary table.</dd>
+ * <dt>Data_Offset</dt> <dd>The offset in the file of the first plane's image data.</dd>
+ * <dt>Table_Data_Offset</dt> <dd>The offset in the file of the first row of the per-plane binary table.</dd>
+ * </dl>
+ * @see #CCD_FITS_IMAGE_CUBE_FILENAME_LENGTH
+ */
+struct CCD_Fits_Image_Cube_Struct
+{
+	int File_Descriptor;
+	char Filename[CCD_FITS_IMAGE_CUBE_FILENAME_LENGTH];
+	int Ncols;
+	int Nrows;
+	int Plane_Count;
+	int Column_Count;
+	off_t Data_Offset;
+	off_t Table_Data_Offset;
+};
+
+/**
+ * Structure describing an open raw capture file, created by CCD_Fits_Image_Raw_Create or opened by 
+ * CCD_Fits_Image_Raw_Open. A raw capture file holds a fixed number of frame slots, each one a fixed-size 
+ * metadata record, the frame's FITS header card images, and the unconverted image data as read out of the camera.
+ * <dl>
+ * <dt>File_Descriptor</dt> <dd>The file descriptor of the open raw capture file.</dd>
+ * <dt>Filename</dt> <dd>The raw capture file's filename, of length CCD_FITS_IMAGE_RAW_FILENAME_LENGTH.</dd>
+ * <dt>Ncols</dt> <dd>The number of columns in each frame.</dd>
+ * <dt>Nrows</dt> <dd>The number of rows in each frame.</dd>
+ * <dt>Frame_Count</dt> <dd>The number of frame slots in the file.</dd>
+ * <dt>Card_Count</dt> <dd>The number of FITS header card images stored with each frame.</dd>
+ * <dt>Value_Count</dt> <dd>The number of per-frame values stored in each frame's record.</dd>
+ * <dt>Value_Name_List</dt> <dd>The names of the per-frame values.</dd>
+ * <dt>Flip_X</dt> <dd>A boolean, TRUE if the frames should be flipped in X when they are converted to FITS.</dd>
+ * <dt>Flip_Y</dt> <dd>A boolean, TRUE if the frames should be flipped in Y when they are converted to FITS.</dd>
+ * <dt>Header_Length</dt> <dd>The length of the file header, and so the offset of the first frame slot.</dd>
+ * <dt>Record_Length</dt> <dd>The length of each frame slot's record and card images, 
+ *                            and so the offset of it's image data in the slot.</dd>
+ * <dt>Frame_Length</dt> <dd>The length of each frame slot.</dd>
+ * </dl>
+ * @see #CCD_FITS_IMAGE_RAW_FILENAME_LENGTH
+ * @see #CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX
+ * @see #CCD_FITS_IMAGE_RAW_VALUE_NAME_LENGTH
+ */
+struct CCD_Fits_Image_Raw_Struct
+{
+	int File_Descriptor;
+	char Filename[CCD_FITS_IMAGE_RAW_FILENAME_LENGTH];
+	int Ncols;
+	int Nrows;
+	int Frame_Count;
+	int Card_Count;
+	int Value_Count;
+	char Value_Name_List[CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX][CCD_FITS_IMAGE_RAW_VALUE_NAME_LENGTH];
+	int Flip_X;
+	int Flip_Y;
+	off_t Header_Length;
+	off_t Record_Length;
+	off_t Frame_Length;
+};
+
+/**
+ * Structure holding the fixed-size metadata record stored with each frame in a raw capture file.
+ * <dl>
+ * <dt>Is_Valid</dt> <dd>A boolean, TRUE if the frame slot has been written. Slots that are never written
+ *                       (dropped frames) read back as FALSE.</dd>
+ * <dt>Frame_Index</dt> <dd>The index of the frame slot, from 0.</dd>
+ * <dt>Group_Number</dt> <dd>The group (e.g. rotation) number of the frame.</dd>
+ * <dt>Sequence_Number</dt> <dd>The sequence number of the frame within it's group.</dd>
+ * <dt>Filename</dt> <dd>The FITS filename the frame is converted into.</dd>
+ * <dt>Value_List</dt> <dd>The per-frame values (rotator angles, timestamps etc), 
+ *                         named by the raw capture file's Value_Name_List.</dd>
+ * </dl>
+ * @see #CCD_FITS_IMAGE_RAW_FILENAME_LENGTH
+ * @see #CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX
+ */
+struct CCD_Fits_Image_Raw_Record_Struct
+{
+	int Is_Valid;
+	int Frame_Index;
+	int Group_Number;
+	int Sequence_Number;
+	char Filename[CCD_FITS_IMAGE_RAW_FILENAME_LENGTH];
+	double Value_List[CCD_FITS_IMAGE_RAW_VALUE_COUNT_MAX];
+};
+
+/*  the following 3 lines are needed to support C++ compilers */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int CCD_Fits_Image_Write(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+				unsigned short *image_data);
+extern int CCD_Fits_Image_Write_Preallocated(char *filename,char *card_image_list,int card_count,int ncols,
+					     int nrows,unsigned short *image_data);
+extern int CCD_Fits_Image_Serialise(char *card_image_list,int card_count,int ncols,int nrows,
+				    unsigned short *image_data,void *buffer,size_t buffer_length);
+extern int CCD_Fits_Image_Buffer_Write(char *filename,void *buffer,size_t length);
+extern int CCD_Fits_Image_Float_Write(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+				      int plane_count,float *image_data);
+extern int CCD_Fits_Image_Int_Write(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+				    int flip_x,int flip_y,unsigned int *image_data);
+extern int CCD_Fits_Image_Preallocate(char *filename,int card_count,int ncols,int nrows);
+extern int CCD_Fits_Image_Header_Float_Update(char *filename,char **keyword_list,double *value_list,
+					      int keyword_count);
+extern int CCD_Fits_Image_Cube_Create(char *filename,char *card_image_list,int card_count,int ncols,int nrows,
+				      int plane_count,char **column_name_list,char **column_unit_list,int column_count,
+				      struct CCD_Fits_Image_Cube_Struct *cube);
+extern int CCD_Fits_Image_Cube_Open(char *filename,struct CCD_Fits_Image_Cube_Struct *cube);
+extern int CCD_Fits_Image_Cube_Plane_Write(struct CCD_Fits_Image_Cube_Struct *cube,int plane_index,
+					   unsigned short *image_data,double *row_value_list);
+extern int CCD_Fits_Image_Cube_Row_Update(struct CCD_Fits_Image_Cube_Struct *cube,int plane_index,int column_index,
+					  double value);
+extern int CCD_Fits_Image_Cube_Close(struct CCD_Fits_Image_Cube_Struct *cube);
+extern int CCD_Fits_Image_Raw_Create(char *filename,int card_count,int ncols,int nrows,int frame_count,
+				     char **value_name_list,int value_count,int flip_x,int flip_y,
+				     struct CCD_Fits_Image_Raw_Struct *raw);
+extern int CCD_Fits_Image_Raw_Open(char *filename,struct CCD_Fits_Image_Raw_Struct *raw);
+extern int CCD_Fits_Image_Raw_Frame_Write(struct CCD_Fits_Image_Raw_Struct *raw,int frame_index,
+					  struct CCD_Fits_Image_Raw_Record_Struct *record,char *card_image_list,
+					  unsigned short *image_data);
+extern int CCD_Fits_Image_Raw_Frame_Read(struct CCD_Fits_Image_Raw_Struct *raw,int frame_index,
+					 struct CCD_Fits_Image_Raw_Record_Struct *record,char *card_image_list,
+					 unsigned short *image_data);
+extern int CCD_Fits_Image_Raw_Record_Write(struct CCD_Fits_Image_Raw_Struct *raw,int frame_index,
+					   struct CCD_Fits_Image_Raw_Record_Struct *record,char *card_image_list);
+extern int CCD_Fits_Image_Raw_Close(struct CCD_Fits_Image_Raw_Struct *raw);
+extern int CCD_Fits_Image_Data_Convert(unsigned short *input_data,unsigned short *output_data,int ncols,int nrows,
+				       int flip_x,int flip_y);
+extern int CCD_Fits_Image_Convert_Method_Set(enum CCD_FITS_IMAGE_CONVERT_METHOD method);
+extern enum CCD_FITS_IMAGE_CONVERT_METHOD CCD_Fits_Image_Convert_Method_Get(void);
+extern const char *CCD_Fits_Image_Convert_Method_To_String(enum CCD_FITS_IMAGE_CONVERT_METHOD method);
+extern int CCD_Fits_Image_Io_Backend_Set(enum CCD_FITS_IMAGE_IO_BACKEND backend);
+extern enum CCD_FITS_IMAGE_IO_BACKEND CCD_Fits_Image_Io_Backend_Get(void);
+extern const char *CCD_Fits_Image_Io_Backend_To_String(enum CCD_FITS_IMAGE_IO_BACKEND backend);
+extern void CCD_Fits_Image_Io_Sync_Set(int sync);
+extern int CCD_Fits_Image_Io_Sync_Get(void);
+extern void CCD_Fits_Image_Io_Count_Get(int *file_count,int *syscall_count);
+extern int CCD_Fits_Image_Header_Length_Get(int card_count);
+extern int CCD_Fits_Image_Data_Length_Get(int ncols,int nrows);
+extern int CCD_Fits_Image_Get_Error_Number(void);
+extern void CCD_Fits_Image_Error(void);
+extern void CCD_Fits_Image_Error_String(char *error_string);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,468 @@
+/* test_clock_model.c
+** $Header$
+*/
+/**
+ * Test and benchmark the CCD library's camera clock model (ccd_clock_model).
+ * We check CCD_Clock_Model_Date_To_Timespec against timegm for a range of dates, and time it against mktime
+ * (which the camera timestamp decoding used to call for every frame).
+ * We then simulate a camera clock that is offset from and drifting with respect to UTC, with exposures read out
+ * after a fixed read out delay and a jittery (and occasionally very late) host latency, and check the clock model
+ * recovers the drift rate, and that the drift corrected UTC times are consistent with their uncertainties
+ * and not biased late by the host latency.
+ * No camera is needed.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us timegm.
+ */
+#define _DEFAULT_SOURCE 1
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log_udp.h"
+#include "ccd_clock_model.h"
+#include "ccd_general.h"
+
+/* hash defines */
+/**
+ * The number of random dates to check CCD_Clock_Model_Date_To_Timespec with.
+ */
+#define DATE_TEST_COUNT      (100000)
+/**
+ * Every this many frames of the simulation, the host timestamp is very late (as if the acquisition thread had
+ * been descheduled), which the clock model should reject as an outlier.
+ */
+#define OUTLIER_FRAME_STRIDE (97)
+/**
+ * The simulated fixed delay (in seconds) between the end of an exposure and the host timestamp, which the clock
+ * model is told about using CCD_Clock_Model_Readout_Delay_Set.
+ */
+#define READOUT_DELAY        (0.012)
+
+/* variables */
+/**
+ * Verbosity log level : initialised to LOG_VERBOSITY_INTERMEDIATE.
+ */
+static int Log_Level = LOG_VERBOSITY_INTERMEDIATE;
+/**
+ * The simulated camera clock drift, in parts per million.
+ */
+static double Drift_PPM = 20.0;
+/**
+ * The number of frames to simulate.
+ */
+static int Frame_Count = 2000;
+/**
+ * The number of times to convert a timestamp when timing CCD_Clock_Model_Date_To_Timespec and mktime.
+ */
+static int Iteration_Count = 1000000;
+
+/* functions */
+static int Date_Test(void);
+static void Date_Benchmark(void);
+static int Model_Test(void);
+static double Time_Difference(struct timespec start_time,struct timespec end_time);
+static int Parse_Arguments(int argc, char *argv[]);
+static void Help(void);
+
+/* ------------------------------------------------------------------
+**          External functions
+** ------------------------------------------------------------------ */
+/**
+ * Main program.
+ * <ul>
+ * <li>We parse the arguments with Parse_Arguments.
+ * <li>We setup the CCD library's logging.
+ * <li>We check the date conversion using Date_Test, and time it using Date_Benchmark.
+ * <li>We check the clock model's fit using Model_Test.
+ * </ul>
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @return The program returns 0 if all the tests pass, and non-zero otherwise.
+ * @see #Parse_Arguments
+ * @see #Date_Test
+ * @see #Date_Benchmark
+ * @see #Model_Test
+ * @see #Log_Level
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Level
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Function
+ * @see ../cdocs/ccd_general.html#CCD_General_Log_Filter_Level_Absolute
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Handler_Function
+ * @see ../cdocs/ccd_general.html#CCD_General_Log_Handler_Stdout
+ */
+int main(int argc, char *argv[])
+{
+	fprintf(stdout,"test_clock_model : Parsing Arguments.\n");
+	if(!Parse_Arguments(argc,argv))
+		return 1;
+	CCD_General_Set_Log_Filter_Level(Log_Level);
+	CCD_General_Set_Log_Filter_Function(CCD_General_Log_Filter_Level_Absolute);
+	CCD_General_Set_Log_Handler_Function(CCD_General_Log_Handler_Stdout);
+	if(!Date_Test())
+		return 2;
+	Date_Benchmark();
+	if(!Model_Test())
+		return 3;
+	fprintf(stdout,"test_clock_model : Passed.\n");
+	return 0;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions
+** ------------------------------------------------------------------ */
+/**
+ * Check CCD_Clock_Model_Date_To_Timespec converts DATE_TEST_COUNT random times between 1970 and 2100
+ * (plus the leap days around the turn of the century) to the same number of seconds since the epoch as timegm.
+ * Successive random times are often on the same day, so the cached day base is exercised as well.
+ * @return The routine returns TRUE if all the conversions were correct, and FALSE otherwise.
+ * @see #DATE_TEST_COUNT
+ * @see ../cdocs/ccd_clock_model.html#CCD_Clock_Model_Date_To_Timespec
+ */
+static int Date_Test(void)
+{
+	struct timespec timestamp;
+	struct tm time_tm;
+	time_t expected_time;
+	int i;
+
+	srand(42);
+	expected_time = 0;
+	for(i = 0; i < DATE_TEST_COUNT; i++)
+	{
+		if((i%4) == 0)
+			expected_time = (((time_t)rand())*4)%((time_t)4102444800LL); /* 2100-01-01 */
+		else
+			expected_time += rand()%3600;
+		gmtime_r(&expected_time,&time_tm);
+		if(!CCD_Clock_Model_Date_To_Timespec(time_tm.tm_year+1900,time_tm.tm_mon+1,time_tm.tm_mday,
+						     time_tm.tm_hour,time_tm.tm_min,time_tm.tm_sec,123400000L,&timestamp))
+		{
+			CCD_General_Error();
+			return FALSE;
+		}
+		if((timestamp.tv_sec != timegm(&time_tm))||(timestamp.tv_nsec != 123400000L))
+		{
+			fprintf(stderr,"Date_Test:%04d-%02d-%02dT%02d:%02d:%02d converted to %ld.%09ld, expected %ld.\n",
+				time_tm.tm_year+1900,time_tm.tm_mon+1,time_tm.tm_mday,time_tm.tm_hour,time_tm.tm_min,
+				time_tm.tm_sec,(long)timestamp.tv_sec,timestamp.tv_nsec,(long)timegm(&time_tm));
+			return FALSE;
+		}
+	}
+	/* 2000-02-29 and 2000-03-01 */
+	if((!CCD_Clock_Model_Date_To_Timespec(2000,2,29,0,0,0,0,&timestamp))||(timestamp.tv_sec != 951782400))
+	{
+		fprintf(stderr,"Date_Test:2000-02-29 converted to %ld, expected 951782400.\n",(long)timestamp.tv_sec);
+		return FALSE;
+	}
+	if((!CCD_Clock_Model_Date_To_Timespec(2000,3,1,0,0,0,0,&timestamp))||(timestamp.tv_sec != 951868800))
+	{
+		fprintf(stderr,"Date_Test:2000-03-01 converted to %ld, expected 951868800.\n",(long)timestamp.tv_sec);
+		return FALSE;
+	}
+	/* an illegal month should fail */
+	if(CCD_Clock_Model_Date_To_Timespec(2026,13,1,0,0,0,0,&timestamp))
+	{
+		fprintf(stderr,"Date_Test:Illegal month 13 was converted.\n");
+		return FALSE;
+	}
+	fprintf(stdout,"test_clock_model : %d dates converted correctly.\n",DATE_TEST_COUNT);
+	return TRUE;
+}
+
+/**
+ * Time Iteration_Count conversions of successive camera timestamps on the same day, using mktime and using
+ * CCD_Clock_Model_Date_To_Timespec, and print the mean time of each.
+ * @see #Iteration_Count
+ * @see #Time_Difference
+ * @see ../cdocs/ccd_clock_model.html#CCD_Clock_Model_Date_To_Timespec
+ */
+static void Date_Benchmark(void)
+{
+	struct timespec start_time,end_time,timestamp;
+	struct tm time_tm;
+	volatile time_t sum = 0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	for(i = 0; i < Iteration_Count; i++)
+	{
+		memset(&time_tm,0,sizeof(struct tm));
+		time_tm.tm_year = 126;
+		time_tm.tm_mon = 9;
+		time_tm.tm_mday = 17;
+		time_tm.tm_hour = 21;
+		time_tm.tm_min = (i/60)%60;
+		time_tm.tm_sec = i%60;
+		time_tm.tm_isdst = 0;
+		sum += mktime(&time_tm);
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	fprintf(stdout,"test_clock_model : mktime took %.1f ns per timestamp.\n",
+		(Time_Difference(start_time,end_time)*1.0E9)/Iteration_Count);
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	for(i = 0; i < Iteration_Count; i++)
+	{
+		CCD_Clock_Model_Date_To_Timespec(2026,10,17,21,(i/60)%60,i%60,0,&timestamp);
+		sum += timestamp.tv_sec;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	fprintf(stdout,"test_clock_model : CCD_Clock_Model_Date_To_Timespec took %.1f ns per timestamp.\n",
+		(Time_Difference(start_time,end_time)*1.0E9)/Iteration_Count);
+}
+
+/**
+ * Simulate a multrun with a drifting camera clock, and check the clock model.
+ * <ul>
+ * <li>We reset the clock model, and set it's readout delay to READOUT_DELAY.
+ * <li>For each of Frame_Count frames, 0.3s apart:
+ *     <ul>
+ *     <li>We compute the camera timestamp of the exposure start, which is offset from the true (UTC) start by 0.37s,
+ *         and drifts by Drift_PPM.
+ *     <li>We compute the host timestamp, an exposure length plus READOUT_DELAY after the true start, plus a random
+ *         latency of 0..2ms (and every OUTLIER_FRAME_STRIDE frames, an extra 50ms).
+ *     <li>We add the sample to the clock model with CCD_Clock_Model_Sample_Add.
+ *     <li>We convert the camera timestamp to UTC with CCD_Clock_Model_Camera_To_UTC, and check the error in the
+ *         corrected time against the returned uncertainty. The lower envelope correction should remove the
+ *         mean host latency of 1ms. Once the model contains CCD_CLOCK_MODEL_UNCERTAINTY_SAMPLE_COUNT_MIN samples,
+ *         every frame must have an uncertainty estimate.
+ *     </ul>
+ * <li>We check the fitted drift rate, the final error, and that the outliers were rejected.
+ * <li>We check the errors are consistent with the uncertainties: no more than 1% of frames may lie outside
+ *     3 sigma, and none may lie outside 5 sigma.
+ * </ul>
+ * @return The routine returns TRUE if the clock model behaved as expected, and FALSE otherwise.
+ * @see #OUTLIER_FRAME_STRIDE
+ * @see #READOUT_DELAY
+ * @see #Drift_PPM
+ * @see #Frame_Count
+ * @see #Time_Difference
+ * @see ../cdocs/ccd_clock_model.html#CCD_CLOCK_MODEL_UNCERTAINTY_SAMPLE_COUNT_MIN
+ * @see ../cdocs/ccd_clock_model.html#CCD_Clock_Model_Reset
+ * @see ../cdocs/ccd_clock_model.html#CCD_Clock_Model_Readout_Delay_Set
+ * @see ../cdocs/ccd_clock_model.html#CCD_Clock_Model_Sample_Add
+ * @see ../cdocs/ccd_clock_model.html#CCD_Clock_Model_Camera_To_UTC
+ * @see ../cdocs/ccd_clock_model.html#CCD_Clock_Model_Get_Drift
+ * @see ../cdocs/ccd_clock_model.html#CCD_Clock_Model_Get_Rejected_Count
+ */
+static int Model_Test(void)
+{
+	struct timespec utc_start,camera_time,host_time,corrected_time;
+	double true_start,camera_start,host_sample,exposure_length,uncertainty,error,max_sigma,drift;
+	int i,outside_count;
+
+	exposure_length = 0.25;
+	utc_start.tv_sec = 1792270800; /* 2026-10-17T21:00:00 */
+	utc_start.tv_nsec = 0;
+	CCD_Clock_Model_Reset();
+	if(!CCD_Clock_Model_Readout_Delay_Set(READOUT_DELAY))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	srand(42);
+	max_sigma = 0.0;
+	outside_count = 0;
+	error = 0.0;
+	uncertainty = 0.0;
+	for(i = 0; i < Frame_Count; i++)
+	{
+		true_start = i*0.3;
+		camera_start = 0.37+(true_start*(1.0-(Drift_PPM/1.0E6)));
+		host_sample = true_start+exposure_length+READOUT_DELAY+(0.002*((double)rand())/((double)RAND_MAX));
+		if((i > 0)&&((i%OUTLIER_FRAME_STRIDE) == 0))
+			host_sample += 0.05;
+		/* camera timestamps have a resolution of 100us */
+		camera_start = floor(camera_start/CCD_CLOCK_MODEL_TIMESTAMP_RESOLUTION)*CCD_CLOCK_MODEL_TIMESTAMP_RESOLUTION;
+		camera_time.tv_sec = utc_start.tv_sec+(time_t)floor(camera_start);
+		camera_time.tv_nsec = (long)((camera_start-floor(camera_start))*1.0E9);
+		host_time.tv_sec = utc_start.tv_sec+(time_t)floor(host_sample);
+		host_time.tv_nsec = (long)((host_sample-floor(host_sample))*1.0E9);
+		if(!CCD_Clock_Model_Sample_Add(camera_time,host_time,exposure_length))
+		{
+			CCD_General_Error();
+			return FALSE;
+		}
+		if(!CCD_Clock_Model_Camera_To_UTC(camera_time,&corrected_time,&uncertainty))
+		{
+			CCD_General_Error();
+			return FALSE;
+		}
+		error = Time_Difference(utc_start,corrected_time)-true_start;
+		if(uncertainty > 0.0)
+		{
+			if(fabs(error/uncertainty) > max_sigma)
+				max_sigma = fabs(error/uncertainty);
+			if(fabs(error) > (3.0*uncertainty))
+				outside_count++;
+		}
+		else if(i >= CCD_CLOCK_MODEL_UNCERTAINTY_SAMPLE_COUNT_MIN)
+		{
+			fprintf(stderr,"Model_Test:Frame %d has no uncertainty estimate.\n",i);
+			return FALSE;
+		}
+	}
+	drift = CCD_Clock_Model_Get_Drift();
+	fprintf(stdout,"test_clock_model : Simulated %d frames: drift %.3f ppm (simulated %.3f ppm), "
+		"final error %.1f us, uncertainty %.1f us, worst error %.1f sigma, %d frames outside 3 sigma, "
+		"%d samples rejected.\n",Frame_Count,drift*1.0E6,Drift_PPM,error*1.0E6,uncertainty*1.0E6,max_sigma,
+		outside_count,CCD_Clock_Model_Get_Rejected_Count());
+	/* camera clock running slow by Drift_PPM gives a positive drift of about Drift_PPM */
+	if(fabs((drift*1.0E6)-Drift_PPM) > 1.0)
+	{
+		fprintf(stderr,"Model_Test:Fitted drift %.3f ppm does not match simulated %.3f ppm.\n",drift*1.0E6,
+			Drift_PPM);
+		return FALSE;
+	}
+	/* without the lower envelope correction, the error would be the mean host latency of 1ms */
+	if(fabs(error) > 0.0003)
+	{
+		fprintf(stderr,"Model_Test:Final error %.6f s too large.\n",error);
+		return FALSE;
+	}
+	if(outside_count > (Frame_Count/100))
+	{
+		fprintf(stderr,"Model_Test:Too many frames (%d) outside 3 sigma.\n",outside_count);
+		return FALSE;
+	}
+	if(max_sigma > 5.0)
+	{
+		fprintf(stderr,"Model_Test:Worst error %.1f sigma is outside 5 sigma.\n",max_sigma);
+		return FALSE;
+	}
+	if(CCD_Clock_Model_Get_Rejected_Count() < ((Frame_Count/OUTLIER_FRAME_STRIDE)-1))
+	{
+		fprintf(stderr,"Model_Test:Only %d outliers rejected.\n",CCD_Clock_Model_Get_Rejected_Count());
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Return the difference between two timestamps in seconds.
+ * @param start_time The start time.
+ * @param end_time The end time.
+ * @return The difference between the timestamps, in seconds.
+ */
+static double Time_Difference(struct timespec start_time,struct timespec end_time)
+{
+	return (double)(end_time.tv_sec-start_time.tv_sec)+((end_time.tv_nsec-start_time.tv_nsec)/1.0E9);
+}
+
+/**
+ * Routine to parse command line arguments.
+ * @param argc The number of arguments sent to the program.
+ * @param argv An array of argument strings.
+ * @see #Log_Level
+ * @see #Drift_PPM
+ * @see #Frame_Count
+ * @see #Iteration_Count
+ * @see #Help
+ */
+static int Parse_Arguments(int argc, char *argv[])
+{
+	int i,retval;
+
+	for(i=1;i<argc;i++)
+	{
+		if((strcmp(argv[i],"-d")==0)||(strcmp(argv[i],"-drift")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%lf",&Drift_PPM);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse drift %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-drift requires a drift in parts per million.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-f")==0)||(strcmp(argv[i],"-frames")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Frame_Count);
+				if((retval != 1)||(Frame_Count < 100))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse frame count %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-frames requires a number of at least 100.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-help")==0))
+		{
+			Help();
+			return FALSE;
+		}
+		else if((strcmp(argv[i],"-i")==0)||(strcmp(argv[i],"-iterations")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Iteration_Count);
+				if((retval != 1)||(Iteration_Count < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse iteration count %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-iterations requires a number.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-l")==0)||(strcmp(argv[i],"-log_level")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Log_Level);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse log level %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-log_level requires a number 0..5.\n");
+				return FALSE;
+			}
+		}
+		else
+		{
+			fprintf(stderr,"Parse_Arguments:argument '%s' not recognized.\n",argv[i]);
+			return FALSE;
+		}
+	}/* end for */
+	return TRUE;
+}
+
+/**
+ * Help routine.
+ */
+static void Help(void)
+{
+	fprintf(stdout,"Test Clock Model:Help.\n");
+	fprintf(stdout,"This program checks the camera timestamp conversion and the camera clock model.\n");
+	fprintf(stdout,"test_clock_model [-d[rift] <ppm>][-f[rames] <n>][-i[terations] <n>][-help]"
+		"[-l[og_level <0..5>].\n");
+	fprintf(stdout,"\t-drift sets the simulated camera clock drift - the default is 20 ppm.\n");
+	fprintf(stdout,"\t-frames sets the number of simulated frames - the default is 2000.\n");
+	fprintf(stdout,"\t-iterations sets how many timestamps are converted when timing - the default is 1000000.\n");
+}
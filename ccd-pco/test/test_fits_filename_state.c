@@ -0,0 +1,474 @@
+/* test_fits_filename_state.c
+** $Header$
+*/
+/**
+ * Test the CCD library's multrun state file (ccd_fits_filename), which CCD_Fits_Filename_Initialise uses to
+ * find the last multrun number without scanning the data directory.
+ * We simulate the multrun state file failing to save for two multruns in a row, and check CCD_Fits_Filename_Initialise
+ * scans forward past both of them rather than reusing a multrun number and overwriting their data.
+ * We then delete the state file, and check CCD_Fits_Filename_Initialise falls back to scanning the data directory.
+ * No camera is needed.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_udp.h"
+#include "ccd_fits_filename.h"
+#include "ccd_general.h"
+
+/* hash defines */
+/**
+ * Length of some of the strings used in this program.
+ */
+#define STRING_LENGTH         (256)
+/**
+ * Length of the Directory string, leaving room in Data_Dir for the test data directory's leaf.
+ */
+#define DIRECTORY_LENGTH      (128)
+/**
+ * The format of the multrun state filename, which must match FITS_FILENAME_STATE_FILENAME_FORMAT in
+ * ccd_fits_filename.cpp. The parameters are the data directory and the instrument code.
+ */
+#define STATE_FILENAME_FORMAT ("%s/.%c_multrun.state")
+/**
+ * The instrument code used in the test FITS filenames.
+ */
+#define INSTRUMENT_CODE       ('1')
+
+/* variables */
+/**
+ * Verbosity log level : initialised to LOG_VERBOSITY_TERSE.
+ */
+static int Log_Level = LOG_VERBOSITY_TERSE;
+/**
+ * The directory to create the test data directory in.
+ */
+static char Directory[DIRECTORY_LENGTH] = "/tmp";
+/**
+ * The test data directory, created in Directory and removed when the test finishes.
+ */
+static char Data_Dir[STRING_LENGTH] = "";
+
+/* functions */
+static int Recovery_Test(void);
+static int Multrun_Start(int multrun_number);
+static int Multrun_Number_Check(const char *description,int multrun_number);
+static int File_Create(char *filename);
+static int State_Read(char *buff,int buff_length);
+static int State_Write(char *buff);
+static void Data_Dir_Remove(void);
+static int Parse_Arguments(int argc, char *argv[]);
+static void Help(void);
+
+/* ------------------------------------------------------------------
+**          External functions
+** ------------------------------------------------------------------ */
+/**
+ * Main program.
+ * <ul>
+ * <li>We parse the arguments with Parse_Arguments.
+ * <li>We setup the CCD library's logging.
+ * <li>We create an empty test data directory in Directory.
+ * <li>We test the multrun state file recovery using Recovery_Test.
+ * <li>We remove the test data directory using Data_Dir_Remove.
+ * </ul>
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @return The program returns 0 if the test passes, and non-zero otherwise.
+ * @see #Parse_Arguments
+ * @see #Recovery_Test
+ * @see #Data_Dir_Remove
+ * @see #Directory
+ * @see #Data_Dir
+ * @see #DIRECTORY_LENGTH
+ * @see #Log_Level
+ */
+int main(int argc, char *argv[])
+{
+	int retval;
+
+	fprintf(stdout,"test_fits_filename_state : Parsing Arguments.\n");
+	if(!Parse_Arguments(argc,argv))
+		return 1;
+	CCD_General_Set_Log_Filter_Level(Log_Level);
+	CCD_General_Set_Log_Filter_Function(CCD_General_Log_Filter_Level_Absolute);
+	CCD_General_Set_Log_Handler_Function(CCD_General_Log_Handler_Stdout);
+	sprintf(Data_Dir,"%s/test_fits_filename_state.XXXXXX",Directory);
+	if(mkdtemp(Data_Dir) == NULL)
+	{
+		fprintf(stderr,"test_fits_filename_state : Failed to create data directory '%s' (%d).\n",Data_Dir,
+			errno);
+		return 2;
+	}
+	retval = 0;
+	if(!Recovery_Test())
+		retval = 3;
+	Data_Dir_Remove();
+	if(retval == 0)
+		fprintf(stdout,"test_fits_filename_state : Passed.\n");
+	else
+		fprintf(stdout,"test_fits_filename_state : Failed.\n");
+	return retval;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions
+** ------------------------------------------------------------------ */
+/**
+ * Test recovering the last multrun number on startup.
+ * <ul>
+ * <li>We initialise the FITS filename data in the empty Data_Dir, and check the multrun number is 0.
+ * <li>We start multrun 1, which writes a FITS image, and save a copy of the state file using State_Read.
+ * <li>We start multrun 2, which only writes a raw capture file, and multrun 3, which only writes a hidden
+ *     (unpublished) FITS image.
+ * <li>We put back the copy of the state file using State_Write, as if saving the state had failed for
+ *     multruns 2 and 3.
+ * <li>We re-initialise, and check the multrun number is 3, i.e. CCD_Fits_Filename_Initialise scanned forward
+ *     past both multruns.
+ * <li>We start the next multrun, and check it is multrun 4, and that it's first FITS image does not already exist.
+ * <li>We delete the state file, and re-initialise, and check the data directory scan finds multrun 4.
+ * </ul>
+ * @return The routine returns TRUE if the test passes, and FALSE otherwise.
+ * @see #Data_Dir
+ * @see #INSTRUMENT_CODE
+ * @see #STATE_FILENAME_FORMAT
+ * @see #Multrun_Start
+ * @see #Multrun_Number_Check
+ * @see #File_Create
+ * @see #State_Read
+ * @see #State_Write
+ * @see ../cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Initialise
+ * @see ../cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Get_Run_Window_Filename
+ * @see ../cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Mode_Set
+ * @see ../cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Publish_Write_Filename_Get
+ */
+static int Recovery_Test(void)
+{
+	char filename[STRING_LENGTH];
+	char write_filename[STRING_LENGTH];
+	char state_filename[STRING_LENGTH*2];
+	char state_buff[STRING_LENGTH];
+	char *extension_ptr = NULL;
+
+	if(!CCD_Fits_Filename_Initialise(INSTRUMENT_CODE,Data_Dir))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	if(!Multrun_Number_Check("Empty data directory",0))
+		return FALSE;
+	/* multrun 1 writes a FITS image, and saves it's state */
+	if(!Multrun_Start(1))
+		return FALSE;
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(CCD_FITS_FILENAME_EXPOSURE_TYPE_EXPOSURE,
+						      CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,1,1,
+						      filename,STRING_LENGTH))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	if(!File_Create(filename))
+		return FALSE;
+	if(!State_Read(state_buff,STRING_LENGTH))
+		return FALSE;
+	/* multrun 2 only writes a raw capture file */
+	if(!Multrun_Start(2))
+		return FALSE;
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(CCD_FITS_FILENAME_EXPOSURE_TYPE_EXPOSURE,
+						      CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,
+						      CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,
+						      CCD_FITS_FILENAME_RUN_WINDOW_NUMBER,filename,STRING_LENGTH))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	extension_ptr = strstr(filename,".fits");
+	if(extension_ptr == NULL)
+	{
+		fprintf(stderr,"Recovery_Test:'.fits' not found in '%s'.\n",filename);
+		return FALSE;
+	}
+	strcpy(extension_ptr,".raw");
+	if(!File_Create(filename))
+		return FALSE;
+	/* multrun 3 only writes a hidden FITS image, that was never published */
+	if(!Multrun_Start(3))
+		return FALSE;
+	if(!CCD_Fits_Filename_Publish_Mode_Set(CCD_FITS_FILENAME_PUBLISH_MODE_RENAME))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(CCD_FITS_FILENAME_EXPOSURE_TYPE_SKYFLAT,
+						      CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,1,1,
+						      filename,STRING_LENGTH))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	if(!CCD_Fits_Filename_Publish_Write_Filename_Get(filename,write_filename,STRING_LENGTH))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	if(!File_Create(write_filename))
+		return FALSE;
+	/* the state for multruns 2 and 3 failed to save */
+	if(!State_Write(state_buff))
+		return FALSE;
+	if(!CCD_Fits_Filename_Initialise(INSTRUMENT_CODE,Data_Dir))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	if(!Multrun_Number_Check("State file two multruns behind",3))
+		return FALSE;
+	if(!Multrun_Start(4))
+		return FALSE;
+	if(!CCD_Fits_Filename_Get_Run_Window_Filename(CCD_FITS_FILENAME_EXPOSURE_TYPE_EXPOSURE,
+						      CCD_FITS_FILENAME_PIPELINE_FLAG_UNREDUCED,1,1,
+						      filename,STRING_LENGTH))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	if(!File_Create(filename))
+		return FALSE;
+	/* without a state file, the data directory is scanned */
+	sprintf(state_filename,STATE_FILENAME_FORMAT,Data_Dir,INSTRUMENT_CODE);
+	if(unlink(state_filename) != 0)
+	{
+		fprintf(stderr,"Recovery_Test:Failed to delete state file '%s' (%d).\n",state_filename,errno);
+		return FALSE;
+	}
+	if(!CCD_Fits_Filename_Initialise(INSTRUMENT_CODE,Data_Dir))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	if(!Multrun_Number_Check("No state file",4))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Start a new multrun using CCD_Fits_Filename_Next_Multrun, and check it has the expected multrun number.
+ * @param multrun_number The multrun number the new multrun should have.
+ * @return The routine returns TRUE if the multrun was started with the expected number, and FALSE otherwise.
+ * @see #Multrun_Number_Check
+ * @see ../cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Next_Multrun
+ */
+static int Multrun_Start(int multrun_number)
+{
+	char description[STRING_LENGTH];
+
+	if(!CCD_Fits_Filename_Next_Multrun())
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	sprintf(description,"Start multrun %d",multrun_number);
+	return Multrun_Number_Check(description,multrun_number);
+}
+
+/**
+ * Check the current multrun number (CCD_Fits_Filename_Multrun_Get) is the expected one.
+ * @param description A description of the check, printed with the result.
+ * @param multrun_number The expected multrun number.
+ * @return The routine returns TRUE if the multrun number is the expected one, and FALSE otherwise.
+ * @see ../cdocs/ccd_fits_filename.html#CCD_Fits_Filename_Multrun_Get
+ */
+static int Multrun_Number_Check(const char *description,int multrun_number)
+{
+	if(CCD_Fits_Filename_Multrun_Get() != multrun_number)
+	{
+		fprintf(stderr,"Multrun_Number_Check:%s:Multrun number was %d, expected %d.\n",description,
+			CCD_Fits_Filename_Multrun_Get(),multrun_number);
+		return FALSE;
+	}
+	fprintf(stdout,"test_fits_filename_state : %s : multrun number %d.\n",description,multrun_number);
+	return TRUE;
+}
+
+/**
+ * Create an empty file, which must not already exist.
+ * @param filename The filename of the file to create.
+ * @return The routine returns TRUE if the file was created, and FALSE otherwise.
+ */
+static int File_Create(char *filename)
+{
+	int fd;
+
+	fd = open(filename,O_WRONLY|O_CREAT|O_EXCL,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if(fd < 0)
+	{
+		fprintf(stderr,"File_Create:Failed to create '%s' (%d).\n",filename,errno);
+		return FALSE;
+	}
+	close(fd);
+	return TRUE;
+}
+
+/**
+ * Read the contents of the multrun state file in Data_Dir.
+ * @param buff A buffer of at least buff_length characters. On success, filled with the state file's contents.
+ * @param buff_length The length of buff.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Data_Dir
+ * @see #INSTRUMENT_CODE
+ * @see #STATE_FILENAME_FORMAT
+ */
+static int State_Read(char *buff,int buff_length)
+{
+	char state_filename[STRING_LENGTH*2];
+	FILE *fp = NULL;
+
+	sprintf(state_filename,STATE_FILENAME_FORMAT,Data_Dir,INSTRUMENT_CODE);
+	fp = fopen(state_filename,"r");
+	if(fp == NULL)
+	{
+		fprintf(stderr,"State_Read:Failed to open state file '%s' (%d).\n",state_filename,errno);
+		return FALSE;
+	}
+	if(fgets(buff,buff_length,fp) == NULL)
+	{
+		fprintf(stderr,"State_Read:Failed to read state file '%s'.\n",state_filename);
+		fclose(fp);
+		return FALSE;
+	}
+	fclose(fp);
+	return TRUE;
+}
+
+/**
+ * Overwrite the multrun state file in Data_Dir.
+ * @param buff The contents to write to the state file, previously retrieved with State_Read.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Data_Dir
+ * @see #INSTRUMENT_CODE
+ * @see #STATE_FILENAME_FORMAT
+ */
+static int State_Write(char *buff)
+{
+	char state_filename[STRING_LENGTH*2];
+	FILE *fp = NULL;
+
+	sprintf(state_filename,STATE_FILENAME_FORMAT,Data_Dir,INSTRUMENT_CODE);
+	fp = fopen(state_filename,"w");
+	if(fp == NULL)
+	{
+		fprintf(stderr,"State_Write:Failed to open state file '%s' (%d).\n",state_filename,errno);
+		return FALSE;
+	}
+	fputs(buff,fp);
+	if(fclose(fp) != 0)
+	{
+		fprintf(stderr,"State_Write:Failed to write state file '%s' (%d).\n",state_filename,errno);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Delete every file in the test data directory, and then the directory itself.
+ * @see #Data_Dir
+ */
+static void Data_Dir_Remove(void)
+{
+	char filename[STRING_LENGTH*2];
+	struct dirent *entry = NULL;
+	DIR *dir = NULL;
+
+	dir = opendir(Data_Dir);
+	if(dir != NULL)
+	{
+		while((entry = readdir(dir)) != NULL)
+		{
+			if((strcmp(entry->d_name,".") == 0)||(strcmp(entry->d_name,"..") == 0))
+				continue;
+			sprintf(filename,"%s/%s",Data_Dir,entry->d_name);
+			unlink(filename);
+		}
+		closedir(dir);
+	}
+	if(rmdir(Data_Dir) != 0)
+		fprintf(stderr,"Data_Dir_Remove:Failed to remove '%s' (%d).\n",Data_Dir,errno);
+}
+
+/**
+ * Routine to parse command line arguments.
+ * @param argc The number of arguments sent to the program.
+ * @param argv An array of argument strings.
+ * @see #Directory
+ * @see #Log_Level
+ * @see #Help
+ */
+static int Parse_Arguments(int argc, char *argv[])
+{
+	int i,retval;
+
+	for(i=1;i<argc;i++)
+	{
+		if((strcmp(argv[i],"-d")==0)||(strcmp(argv[i],"-directory")==0))
+		{
+			if((i+1)<argc)
+			{
+				strncpy(Directory,argv[i+1],DIRECTORY_LENGTH-1);
+				Directory[DIRECTORY_LENGTH-1] = '\0';
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-directory requires a directory.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-help")==0))
+		{
+			Help();
+			return FALSE;
+		}
+		else if((strcmp(argv[i],"-l")==0)||(strcmp(argv[i],"-log_level")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Log_Level);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse log level %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-log_level requires a number 0..5.\n");
+				return FALSE;
+			}
+		}
+		else
+		{
+			fprintf(stderr,"Parse_Arguments:argument '%s' not recognized.\n",argv[i]);
+			return FALSE;
+		}
+	}/* end for */
+	return TRUE;
+}
+
+/**
+ * Help routine.
+ */
+static void Help(void)
+{
+	fprintf(stdout,"Test FITS Filename State:Help.\n");
+	fprintf(stdout,"This program tests recovering the last multrun number from the multrun state file.\n");
+	fprintf(stdout,"test_fits_filename_state [-d[irectory] <path>][-help][-l[og_level <0..5>].\n");
+	fprintf(stdout,"\t-directory is the directory the test data directory is created in - the default is /tmp.\n");
+}
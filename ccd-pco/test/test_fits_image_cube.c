@@ -0,0 +1,496 @@
+/* test_fits_image_cube.c
+** $Header$
+*/
+/**
+ * Test the CCD library's native FITS cube writer (CCD_Fits_Image_Cube_Create / CCD_Fits_Image_Cube_Plane_Write).
+ * We create a cube, write it's planes out of order (leaving one plane unwritten, as for a dropped frame),
+ * re-open it and update one table value, then read the cube and it's per-plane table back using CFITSIO
+ * to check them. No camera is needed.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fitsio.h"
+#include "log_udp.h"
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+#include "ccd_general.h"
+
+/* hash defines */
+/**
+ * Length of some of the strings used in this program.
+ */
+#define STRING_LENGTH        (256)
+/**
+ * The maximum number of card images we format from the FITS header list.
+ */
+#define CARD_IMAGE_COUNT_MAX (64)
+/**
+ * The number of columns in the per-plane table.
+ */
+#define COLUMN_COUNT         (3)
+/**
+ * The value the re-opened cube's table is updated with (MOPREND, of plane 0).
+ */
+#define UPDATED_VALUE        (123.456)
+
+/* variables */
+/**
+ * Verbosity log level : initialised to LOG_VERBOSITY_VERY_VERBOSE.
+ */
+static int Log_Level = LOG_VERBOSITY_VERY_VERBOSE;
+/**
+ * The filename of the FITS cube to write.
+ */
+static char Filename[STRING_LENGTH] = "/tmp/test_fits_image_cube.fits";
+/**
+ * The number of columns in each plane.
+ */
+static int Ncols = 512;
+/**
+ * The number of rows in each plane.
+ */
+static int Nrows = 512;
+/**
+ * The number of planes in the cube.
+ */
+static int Plane_Count = 16;
+/**
+ * The plane that is not written (a dropped frame).
+ */
+static int Dropped_Plane = 5;
+/**
+ * The per-plane table's column names.
+ */
+static char *Column_Name_List[COLUMN_COUNT] = {"MOPRBEG","MOPREND","PICNUM"};
+/**
+ * The per-plane table's column units.
+ */
+static char *Column_Unit_List[COLUMN_COUNT] = {"deg","deg",NULL};
+
+/* functions */
+static unsigned short Pixel_Value(int plane,int pixel);
+static int Cube_Read_Check(char *filename);
+static int Parse_Arguments(int argc, char *argv[]);
+static void Help(void);
+
+/* ------------------------------------------------------------------
+**          External functions
+** ------------------------------------------------------------------ */
+/**
+ * Main program.
+ * <ul>
+ * <li>We parse the arguments with Parse_Arguments.
+ * <li>We setup the CCD library's logging.
+ * <li>We add a header to the FITS header list, and format it into card images using CCD_Fits_Header_To_Card_Images.
+ * <li>We create the cube using CCD_Fits_Image_Cube_Create.
+ * <li>We write every plane except Dropped_Plane, in reverse order, using CCD_Fits_Image_Data_Convert and
+ *     CCD_Fits_Image_Cube_Plane_Write, and close the cube with CCD_Fits_Image_Cube_Close.
+ * <li>We re-open the cube using CCD_Fits_Image_Cube_Open, update plane 0's MOPREND value using
+ *     CCD_Fits_Image_Cube_Row_Update, and close it again.
+ * <li>We read the cube back using CFITSIO, and check it, using Cube_Read_Check.
+ * </ul>
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @see #Parse_Arguments
+ * @see #Pixel_Value
+ * @see #Cube_Read_Check
+ * @see #Log_Level
+ * @see #Filename
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Plane_Count
+ * @see #Dropped_Plane
+ * @see #Column_Name_List
+ * @see #Column_Unit_List
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Level
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Function
+ * @see ../cdocs/ccd_general.html#CCD_General_Log_Filter_Level_Absolute
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Handler_Function
+ * @see ../cdocs/ccd_general.html#CCD_General_Log_Handler_Stdout
+ * @see ../cdocs/ccd_general.html#CCD_General_Error
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_To_Card_Images
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Convert
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Create
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Open
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Plane_Write
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Row_Update
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Cube_Close
+ */
+int main(int argc, char *argv[])
+{
+	struct CCD_Fits_Image_Cube_Struct cube;
+	char card_image_list[CARD_IMAGE_COUNT_MAX*CCD_FITS_HEADER_CARD_IMAGE_LENGTH];
+	unsigned short *image_data = NULL;
+	double row_value_list[COLUMN_COUNT];
+	struct timespec start_time,end_time;
+	int i,plane,card_count;
+
+	/* parse arguments */
+	fprintf(stdout,"test_fits_image_cube : Parsing Arguments.\n");
+	if(!Parse_Arguments(argc,argv))
+		return 1;
+	CCD_General_Set_Log_Filter_Level(Log_Level);
+	CCD_General_Set_Log_Filter_Function(CCD_General_Log_Filter_Level_Absolute);
+	CCD_General_Set_Log_Handler_Function(CCD_General_Log_Handler_Stdout);
+	/* the cube writer fails if the file already exists */
+	unlink(Filename);
+	image_data = (unsigned short *)malloc(Ncols*Nrows*sizeof(unsigned short));
+	if(image_data == NULL)
+	{
+		fprintf(stderr,"test_fits_image_cube : Failed to allocate %d x %d image.\n",Ncols,Nrows);
+		return 2;
+	}
+	/* headers */
+	if(!CCD_Fits_Header_Initialise())
+	{
+		CCD_General_Error();
+		return 3;
+	}
+	if(!CCD_Fits_Header_Add_String("OBJECT","It's a test",NULL))
+	{
+		CCD_General_Error();
+		return 3;
+	}
+	if(!CCD_Fits_Header_To_Card_Images(card_image_list,CARD_IMAGE_COUNT_MAX,&card_count))
+	{
+		CCD_General_Error();
+		return 4;
+	}
+	/* write the cube */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!CCD_Fits_Image_Cube_Create(Filename,card_image_list,card_count,Ncols,Nrows,Plane_Count,Column_Name_List,
+				       Column_Unit_List,COLUMN_COUNT,&cube))
+	{
+		CCD_General_Error();
+		return 5;
+	}
+	for(plane = Plane_Count-1; plane >= 0; plane--)
+	{
+		if(plane == Dropped_Plane)
+			continue;
+		for(i = 0; i < Ncols*Nrows; i++)
+			image_data[i] = Pixel_Value(plane,i);
+		if(!CCD_Fits_Image_Data_Convert(image_data,image_data,Ncols,Nrows,FALSE,FALSE))
+		{
+			CCD_General_Error();
+			return 6;
+		}
+		row_value_list[0] = plane*22.5;
+		row_value_list[1] = (plane*22.5)+18.0;
+		row_value_list[2] = 1000+plane;
+		if(!CCD_Fits_Image_Cube_Plane_Write(&cube,plane,image_data,row_value_list))
+		{
+			CCD_General_Error();
+			return 7;
+		}
+	}
+	if(!CCD_Fits_Image_Cube_Close(&cube))
+	{
+		CCD_General_Error();
+		return 8;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	fprintf(stdout,"test_fits_image_cube : Writing %d planes of '%s' took %.6f s.\n",Plane_Count-1,Filename,
+		(end_time.tv_sec-start_time.tv_sec)+((end_time.tv_nsec-start_time.tv_nsec)/1.0E9));
+	/* re-open and update a table value, as the rotator position back-fill does */
+	if(!CCD_Fits_Image_Cube_Open(Filename,&cube))
+	{
+		CCD_General_Error();
+		return 9;
+	}
+	if(!CCD_Fits_Image_Cube_Row_Update(&cube,0,1,UPDATED_VALUE))
+	{
+		CCD_General_Error();
+		return 10;
+	}
+	if(!CCD_Fits_Image_Cube_Close(&cube))
+	{
+		CCD_General_Error();
+		return 11;
+	}
+	/* read the cube back using CFITSIO */
+	if(!Cube_Read_Check(Filename))
+		return 12;
+	CCD_Fits_Header_Free();
+	free(image_data);
+	fprintf(stdout,"test_fits_image_cube : Passed.\n");
+	return 0;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions
+** ------------------------------------------------------------------ */
+/**
+ * Return the test pixel value of a pixel in a plane.
+ * @param plane The plane index.
+ * @param pixel The pixel index in the plane.
+ * @return The pixel value.
+ */
+static unsigned short Pixel_Value(int plane,int pixel)
+{
+	return (unsigned short)((pixel*40503)+(plane*977));
+}
+
+/**
+ * Read the cube back using CFITSIO, and check the image type, dimensions, header values, image data and
+ * per-plane table values are correct. The unwritten plane (Dropped_Plane) should have NaN table values.
+ * @param filename The filename to read.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Pixel_Value
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Plane_Count
+ * @see #Dropped_Plane
+ * @see #Column_Name_List
+ */
+static int Cube_Read_Check(char *filename)
+{
+	fitsfile *fp = NULL;
+	char string_value[FLEN_VALUE];
+	unsigned short *read_image_data = NULL;
+	double *column_data = NULL;
+	long axes[3];
+	long nrows;
+	int status = 0,image_type,naxis,anynul,i,plane,column,column_number,retval;
+
+	fits_open_file(&fp,filename,READONLY,&status);
+	fits_get_img_equivtype(fp,&image_type,&status);
+	fits_get_img_dim(fp,&naxis,&status);
+	fits_get_img_size(fp,3,axes,&status);
+	if(status)
+	{
+		fits_report_error(stderr,status);
+		return FALSE;
+	}
+	if((image_type != USHORT_IMG)||(naxis != 3)||(axes[0] != Ncols)||(axes[1] != Nrows)||(axes[2] != Plane_Count))
+	{
+		fprintf(stderr,"Cube_Read_Check:'%s' has type %d, naxis %d, dimensions %ld x %ld x %ld.\n",filename,
+			image_type,naxis,axes[0],axes[1],axes[2]);
+		fits_close_file(fp,&status);
+		return FALSE;
+	}
+	retval = TRUE;
+	fits_read_key(fp,TSTRING,"OBJECT",string_value,NULL,&status);
+	if(strcmp(string_value,"It's a test") != 0)
+	{
+		fprintf(stderr,"Cube_Read_Check:OBJECT was '%s'.\n",string_value);
+		retval = FALSE;
+	}
+	/* image data */
+	read_image_data = (unsigned short *)malloc(Ncols*Nrows*sizeof(unsigned short));
+	column_data = (double *)malloc(Plane_Count*sizeof(double));
+	if((read_image_data == NULL)||(column_data == NULL))
+	{
+		fprintf(stderr,"Cube_Read_Check:Failed to allocate read buffers.\n");
+		fits_close_file(fp,&status);
+		return FALSE;
+	}
+	for(plane = 0; plane < Plane_Count; plane++)
+	{
+		if(plane == Dropped_Plane)
+			continue;
+		fits_read_img(fp,TUSHORT,(((long long)plane)*Ncols*Nrows)+1,Ncols*Nrows,NULL,read_image_data,&anynul,
+			      &status);
+		if(status)
+			break;
+		for(i = 0; i < Ncols*Nrows; i++)
+		{
+			if(read_image_data[i] != Pixel_Value(plane,i))
+			{
+				fprintf(stderr,"Cube_Read_Check:Plane %d pixel %d was %hu, should be %hu.\n",plane,i,
+					read_image_data[i],Pixel_Value(plane,i));
+				retval = FALSE;
+				break;
+			}
+		}
+	}
+	/* per-plane table */
+	fits_movnam_hdu(fp,BINARY_TBL,"PLANES",0,&status);
+	fits_get_num_rows(fp,&nrows,&status);
+	if((status == 0)&&(nrows != Plane_Count))
+	{
+		fprintf(stderr,"Cube_Read_Check:Table has %ld rows, should be %d.\n",nrows,Plane_Count);
+		retval = FALSE;
+	}
+	for(column = 0; (column < COLUMN_COUNT)&&(status == 0); column++)
+	{
+		fits_get_colnum(fp,CASESEN,Column_Name_List[column],&column_number,&status);
+		fits_read_col(fp,TDOUBLE,column_number,1,1,Plane_Count,NULL,column_data,&anynul,&status);
+		if(status)
+			break;
+		for(plane = 0; plane < Plane_Count; plane++)
+		{
+			if(plane == Dropped_Plane)
+			{
+				if(!isnan(column_data[plane]))
+				{
+					fprintf(stderr,"Cube_Read_Check:%s of unwritten plane %d was %.6f, should be NaN.\n",
+						Column_Name_List[column],plane,column_data[plane]);
+					retval = FALSE;
+				}
+			}
+			else if(((column == 0)&&(column_data[plane] != plane*22.5))||
+				((column == 1)&&(plane == 0)&&(column_data[plane] != UPDATED_VALUE))||
+				((column == 1)&&(plane != 0)&&(column_data[plane] != (plane*22.5)+18.0))||
+				((column == 2)&&(column_data[plane] != 1000+plane)))
+			{
+				fprintf(stderr,"Cube_Read_Check:%s of plane %d was %.6f.\n",Column_Name_List[column],plane,
+					column_data[plane]);
+				retval = FALSE;
+			}
+		}
+	}
+	fits_close_file(fp,&status);
+	free(read_image_data);
+	free(column_data);
+	if(status)
+	{
+		fits_report_error(stderr,status);
+		return FALSE;
+	}
+	if(retval)
+		fprintf(stdout,"Cube_Read_Check:'%s' read back correctly using CFITSIO.\n",filename);
+	return retval;
+}
+
+/**
+ * Routine to parse command line arguments.
+ * @param argc The number of arguments sent to the program.
+ * @param argv An array of argument strings.
+ * @see #Filename
+ * @see #Log_Level
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Plane_Count
+ * @see #Dropped_Plane
+ * @see #Help
+ */
+static int Parse_Arguments(int argc, char *argv[])
+{
+	int i,retval;
+
+	for(i=1;i<argc;i++)
+	{
+		if((strcmp(argv[i],"-f")==0)||(strcmp(argv[i],"-filename")==0))
+		{
+			if((i+1)<argc)
+			{
+				strncpy(Filename,argv[i+1],STRING_LENGTH-1);
+				Filename[STRING_LENGTH-1] = '\0';
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-filename requires a filename.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-help")==0))
+		{
+			Help();
+			return FALSE;
+		}
+		else if((strcmp(argv[i],"-l")==0)||(strcmp(argv[i],"-log_level")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Log_Level);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse log level %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-log_level requires a number 0..5.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-p")==0)||(strcmp(argv[i],"-planes")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Plane_Count);
+				if((retval != 1)||(Plane_Count < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of planes %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-planes requires a number of planes.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-x")==0)||(strcmp(argv[i],"-ncols")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Ncols);
+				if((retval != 1)||(Ncols < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of columns %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-ncols requires a number of columns.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-y")==0)||(strcmp(argv[i],"-nrows")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Nrows);
+				if((retval != 1)||(Nrows < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of rows %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-nrows requires a number of rows.\n");
+				return FALSE;
+			}
+		}
+		else
+		{
+			fprintf(stderr,"Parse_Arguments:argument '%s' not recognized.\n",argv[i]);
+			return FALSE;
+		}
+	}/* end for */
+	/* the dropped plane must be in the cube */
+	if(Dropped_Plane >= Plane_Count)
+		Dropped_Plane = Plane_Count-1;
+	return TRUE;
+}
+
+/**
+ * Help routine.
+ */
+static void Help(void)
+{
+	fprintf(stdout,"Test FITS Image Cube:Help.\n");
+	fprintf(stdout,"This program writes a FITS cube (one plane left unwritten) using the native cube writer, ");
+	fprintf(stdout,"and checks the cube and it's per-plane table can be read by CFITSIO.\n");
+	fprintf(stdout,"test_fits_image_cube [-f[ilename] <path>][-x|-ncols <n>][-y|-nrows <n>][-p[lanes] <n>]"
+		"[-help][-l[og_level <0..5>].\n");
+	fprintf(stdout,"\t-filename is the FITS filename to write - the default is /tmp/test_fits_image_cube.fits.\n");
+	fprintf(stdout,"\t-ncols and -nrows set the plane dimensions - the default is 512 x 512.\n");
+	fprintf(stdout,"\t-planes sets the number of planes - the default is 16.\n");
+}
@@ -0,0 +1,427 @@
+/* test_fits_image_data_convert.c
+** $Header$
+*/
+/**
+ * Test and benchmark the CCD library's image data conversion kernel (CCD_Fits_Image_Data_Convert).
+ * For each combination of X and Y flips, and each conversion method the CPU supports, we check the kernel
+ * produces the same result as the previous implementation (flipping the image data in place one pixel at a time,
+ * as Moptop_Multrun_Flip_X / Moptop_Multrun_Flip_Y do, and then byte swapping / BZERO offsetting it as CFITSIO
+ * does when writing), on small images of awkward sizes and on full size images at binning 1 and 2.
+ * We then time the previous implementation against each conversion method for the full size images.
+ * No camera is needed.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log_udp.h"
+#include "ccd_fits_image.h"
+#include "ccd_general.h"
+
+/* hash defines */
+/**
+ * The number of conversion methods we test (scalar, sse2, avx2).
+ */
+#define METHOD_COUNT         (3)
+/**
+ * The number of flip combinations we test (none, X, Y, X and Y).
+ */
+#define FLIP_COUNT           (4)
+
+/* variables */
+/**
+ * Verbosity log level : initialised to LOG_VERBOSITY_INTERMEDIATE.
+ */
+static int Log_Level = LOG_VERBOSITY_INTERMEDIATE;
+/**
+ * The number of columns in the full size (binning 1) test image.
+ */
+static int Ncols = 2048;
+/**
+ * The number of rows in the full size (binning 1) test image.
+ */
+static int Nrows = 2048;
+/**
+ * The number of times to convert the image when timing each method.
+ */
+static int Iteration_Count = 20;
+/**
+ * The conversion methods to test.
+ */
+static enum CCD_FITS_IMAGE_CONVERT_METHOD Method_List[METHOD_COUNT] =
+{
+	CCD_FITS_IMAGE_CONVERT_METHOD_SCALAR,CCD_FITS_IMAGE_CONVERT_METHOD_SSE2,CCD_FITS_IMAGE_CONVERT_METHOD_AVX2
+};
+
+/* functions */
+static int Image_Test(int ncols,int nrows,int benchmark);
+static void Legacy_Convert(int ncols,int nrows,int flip_x,int flip_y,unsigned short *image_data);
+static void Legacy_Flip_X(int ncols,int nrows,unsigned short *image_data);
+static void Legacy_Flip_Y(int ncols,int nrows,unsigned short *image_data);
+static double Time_Difference(struct timespec start_time,struct timespec end_time);
+static int Parse_Arguments(int argc, char *argv[]);
+static void Help(void);
+
+/* ------------------------------------------------------------------
+**          External functions
+** ------------------------------------------------------------------ */
+/**
+ * Main program.
+ * <ul>
+ * <li>We parse the arguments with Parse_Arguments.
+ * <li>We setup the CCD library's logging.
+ * <li>We check the conversion of some small images of awkward (odd, and not a multiple of the vector length)
+ *     sizes, using Image_Test.
+ * <li>We check and benchmark the conversion of full size images at binning 1 and 2, using Image_Test.
+ * </ul>
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @return The program returns 0 if all the tests pass, and non-zero otherwise.
+ * @see #Parse_Arguments
+ * @see #Image_Test
+ * @see #Log_Level
+ * @see #Ncols
+ * @see #Nrows
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Level
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Function
+ * @see ../cdocs/ccd_general.html#CCD_General_Log_Filter_Level_Absolute
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Handler_Function
+ * @see ../cdocs/ccd_general.html#CCD_General_Log_Handler_Stdout
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Convert_Method_Get
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Convert_Method_To_String
+ */
+int main(int argc, char *argv[])
+{
+	int small_size_list[][2] = {{1,1},{2,1},{1,2},{3,3},{7,5},{15,9},{16,16},{17,3},{31,4},{33,33},{37,11}};
+	int i,binning;
+
+	fprintf(stdout,"test_fits_image_data_convert : Parsing Arguments.\n");
+	if(!Parse_Arguments(argc,argv))
+		return 1;
+	CCD_General_Set_Log_Filter_Level(Log_Level);
+	CCD_General_Set_Log_Filter_Function(CCD_General_Log_Filter_Level_Absolute);
+	CCD_General_Set_Log_Handler_Function(CCD_General_Log_Handler_Stdout);
+	fprintf(stdout,"test_fits_image_data_convert : The default conversion method on this CPU is %s.\n",
+		CCD_Fits_Image_Convert_Method_To_String(CCD_Fits_Image_Convert_Method_Get()));
+	for(i = 0; i < (int)(sizeof(small_size_list)/sizeof(small_size_list[0])); i++)
+	{
+		if(!Image_Test(small_size_list[i][0],small_size_list[i][1],FALSE))
+			return 2;
+	}
+	fprintf(stdout,"test_fits_image_data_convert : Small images converted correctly.\n");
+	for(binning = 1; binning <= 2; binning++)
+	{
+		fprintf(stdout,"test_fits_image_data_convert : Binning %d:\n",binning);
+		if(!Image_Test(Ncols/binning,Nrows/binning,TRUE))
+			return 3;
+	}
+	fprintf(stdout,"test_fits_image_data_convert : Passed.\n");
+	return 0;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions
+** ------------------------------------------------------------------ */
+/**
+ * Check (and optionally benchmark) the conversion of one size of image. For each flip combination:
+ * <ul>
+ * <li>We convert a copy of a test image using Legacy_Convert, as a reference.
+ * <li>For each conversion method the CPU supports, we convert the test image using CCD_Fits_Image_Data_Convert,
+ *     both into a separate output buffer and in place, and check the results match the reference.
+ * <li>If benchmark is TRUE, we time Iteration_Count calls of Legacy_Convert and CCD_Fits_Image_Data_Convert (in
+ *     place) for each method, and print the mean time of each.
+ * </ul>
+ * @param ncols The number of columns in the image.
+ * @param nrows The number of rows in the image.
+ * @param benchmark A boolean, if TRUE time the conversions as well as checking them.
+ * @return The routine returns TRUE if all the conversions were correct, and FALSE otherwise.
+ * @see #METHOD_COUNT
+ * @see #FLIP_COUNT
+ * @see #Method_List
+ * @see #Iteration_Count
+ * @see #Legacy_Convert
+ * @see #Time_Difference
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Convert
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Convert_Method_Set
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Convert_Method_To_String
+ */
+static int Image_Test(int ncols,int nrows,int benchmark)
+{
+	struct timespec start_time,end_time;
+	unsigned short *image_data = NULL;
+	unsigned short *reference_data = NULL;
+	unsigned short *output_data = NULL;
+	unsigned short *in_place_data = NULL;
+	int pixel_count,flip,flip_x,flip_y,method_index,i,retval;
+
+	pixel_count = ncols*nrows;
+	image_data = (unsigned short *)malloc(pixel_count*sizeof(unsigned short));
+	reference_data = (unsigned short *)malloc(pixel_count*sizeof(unsigned short));
+	output_data = (unsigned short *)malloc(pixel_count*sizeof(unsigned short));
+	in_place_data = (unsigned short *)malloc(pixel_count*sizeof(unsigned short));
+	if((image_data == NULL)||(reference_data == NULL)||(output_data == NULL)||(in_place_data == NULL))
+	{
+		fprintf(stderr,"Image_Test:Failed to allocate %d x %d images.\n",ncols,nrows);
+		return FALSE;
+	}
+	/* a pattern covering the whole unsigned short range, where every pixel is different from it's neighbours */
+	for(i = 0; i < pixel_count; i++)
+		image_data[i] = (unsigned short)((i*40503)+(i/ncols));
+	retval = TRUE;
+	for(flip = 0; flip < FLIP_COUNT; flip++)
+	{
+		flip_x = ((flip & 1) == 1);
+		flip_y = ((flip & 2) == 2);
+		memcpy(reference_data,image_data,pixel_count*sizeof(unsigned short));
+		Legacy_Convert(ncols,nrows,flip_x,flip_y,reference_data);
+		if(benchmark)
+		{
+			memcpy(in_place_data,image_data,pixel_count*sizeof(unsigned short));
+			clock_gettime(CLOCK_MONOTONIC,&start_time);
+			for(i = 0; i < Iteration_Count; i++)
+				Legacy_Convert(ncols,nrows,flip_x,flip_y,in_place_data);
+			clock_gettime(CLOCK_MONOTONIC,&end_time);
+			fprintf(stdout,"Image_Test:%d x %d flip_x=%d flip_y=%d: legacy: %.3f ms.\n",ncols,nrows,flip_x,flip_y,
+				(Time_Difference(start_time,end_time)*1000.0)/Iteration_Count);
+		}
+		for(method_index = 0; method_index < METHOD_COUNT; method_index++)
+		{
+			if(!CCD_Fits_Image_Convert_Method_Set(Method_List[method_index]))
+				continue;
+			memcpy(in_place_data,image_data,pixel_count*sizeof(unsigned short));
+			if((!CCD_Fits_Image_Data_Convert(image_data,output_data,ncols,nrows,flip_x,flip_y))||
+			   (!CCD_Fits_Image_Data_Convert(in_place_data,in_place_data,ncols,nrows,flip_x,flip_y)))
+			{
+				CCD_General_Error();
+				retval = FALSE;
+				continue;
+			}
+			if((memcmp(output_data,reference_data,pixel_count*sizeof(unsigned short)) != 0)||
+			   (memcmp(in_place_data,reference_data,pixel_count*sizeof(unsigned short)) != 0))
+			{
+				fprintf(stderr,"Image_Test:%d x %d flip_x=%d flip_y=%d: %s conversion does not match "
+					"the legacy conversion.\n",ncols,nrows,flip_x,flip_y,
+					CCD_Fits_Image_Convert_Method_To_String(Method_List[method_index]));
+				retval = FALSE;
+				continue;
+			}
+			if(benchmark)
+			{
+				clock_gettime(CLOCK_MONOTONIC,&start_time);
+				for(i = 0; i < Iteration_Count; i++)
+					CCD_Fits_Image_Data_Convert(in_place_data,in_place_data,ncols,nrows,flip_x,flip_y);
+				clock_gettime(CLOCK_MONOTONIC,&end_time);
+				fprintf(stdout,"Image_Test:%d x %d flip_x=%d flip_y=%d: %s: %.3f ms.\n",ncols,nrows,
+					flip_x,flip_y,CCD_Fits_Image_Convert_Method_To_String(Method_List[method_index]),
+					(Time_Difference(start_time,end_time)*1000.0)/Iteration_Count);
+			}
+		}
+	}
+	CCD_Fits_Image_Convert_Method_Set(CCD_FITS_IMAGE_CONVERT_METHOD_AUTO);
+	free(image_data);
+	free(reference_data);
+	free(output_data);
+	free(in_place_data);
+	return retval;
+}
+
+/**
+ * Convert the image data to FITS format the way it was done before CCD_Fits_Image_Data_Convert:
+ * flip in X and Y in separate in place passes, then subtract BZERO and byte swap it (as CFITSIO does
+ * when writing TUSHORT data to a USHORT_IMG) in another pass.
+ * @param ncols The number of columns in the image.
+ * @param nrows The number of rows in the image.
+ * @param flip_x A boolean, if TRUE flip the image data in the X direction.
+ * @param flip_y A boolean, if TRUE flip the image data in the Y direction.
+ * @param image_data The image data to convert, in place.
+ * @see #Legacy_Flip_X
+ * @see #Legacy_Flip_Y
+ */
+static void Legacy_Convert(int ncols,int nrows,int flip_x,int flip_y,unsigned short *image_data)
+{
+	unsigned short value;
+	int i;
+
+	if(flip_x)
+		Legacy_Flip_X(ncols,nrows,image_data);
+	if(flip_y)
+		Legacy_Flip_Y(ncols,nrows,image_data);
+	for(i = 0; i < ncols*nrows; i++)
+	{
+		value = image_data[i]^32768;
+		((unsigned char *)image_data)[2*i] = (unsigned char)(value >> 8);
+		((unsigned char *)image_data)[(2*i)+1] = (unsigned char)(value & 0xff);
+	}
+}
+
+/**
+ * Flip the image data in the X direction. A copy of Moptop_Multrun_Flip_X.
+ * @param ncols The number of columns in the image.
+ * @param nrows The number of rows in the image.
+ * @param image_data The image data, flipped in place.
+ */
+static void Legacy_Flip_X(int ncols,int nrows,unsigned short *image_data)
+{
+	int x,y;
+	unsigned short int tempval;
+
+	for(y=0;y<nrows;y++)
+	{
+		for(x=0;x<(ncols/2);x++)
+		{
+			tempval = *(image_data+(y*ncols)+x);
+			*(image_data+(y*ncols)+x) = *(image_data+(y*ncols)+(ncols-(x+1)));
+			*(image_data+(y*ncols)+(ncols-(x+1))) = tempval;
+		}
+	}
+}
+
+/**
+ * Flip the image data in the Y direction. A copy of Moptop_Multrun_Flip_Y.
+ * @param ncols The number of columns in the image.
+ * @param nrows The number of rows in the image.
+ * @param image_data The image data, flipped in place.
+ */
+static void Legacy_Flip_Y(int ncols,int nrows,unsigned short *image_data)
+{
+	int x,y;
+	unsigned short int tempval;
+
+	for(y=0;y<(nrows/2);y++)
+	{
+		for(x=0;x<ncols;x++)
+		{
+			tempval = *(image_data+(y*ncols)+x);
+			*(image_data+(y*ncols)+x) = *(image_data+(((nrows-(y+1))*ncols)+x));
+			*(image_data+(((nrows-(y+1))*ncols)+x)) = tempval;
+		}
+	}
+}
+
+/**
+ * Return the difference between two timestamps.
+ * @param start_time The start time.
+ * @param end_time The end time.
+ * @return The difference between the timestamps, in seconds.
+ */
+static double Time_Difference(struct timespec start_time,struct timespec end_time)
+{
+	return (double)(end_time.tv_sec-start_time.tv_sec)+((end_time.tv_nsec-start_time.tv_nsec)/1.0E9);
+}
+
+/**
+ * Routine to parse command line arguments.
+ * @param argc The number of arguments sent to the program.
+ * @param argv An array of argument strings.
+ * @see #Log_Level
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Iteration_Count
+ * @see #Help
+ */
+static int Parse_Arguments(int argc, char *argv[])
+{
+	int i,retval;
+
+	for(i=1;i<argc;i++)
+	{
+		if((strcmp(argv[i],"-help")==0))
+		{
+			Help();
+			return FALSE;
+		}
+		else if((strcmp(argv[i],"-i")==0)||(strcmp(argv[i],"-iterations")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Iteration_Count);
+				if((retval != 1)||(Iteration_Count < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse iteration count %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-iterations requires a number.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-l")==0)||(strcmp(argv[i],"-log_level")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Log_Level);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse log level %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-log_level requires a number 0..5.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-x")==0)||(strcmp(argv[i],"-ncols")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Ncols);
+				if((retval != 1)||(Ncols < 2))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of columns %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-ncols requires a number of columns.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-y")==0)||(strcmp(argv[i],"-nrows")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Nrows);
+				if((retval != 1)||(Nrows < 2))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of rows %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-nrows requires a number of rows.\n");
+				return FALSE;
+			}
+		}
+		else
+		{
+			fprintf(stderr,"Parse_Arguments:argument '%s' not recognized.\n",argv[i]);
+			return FALSE;
+		}
+	}/* end for */
+	return TRUE;
+}
+
+/**
+ * Help routine.
+ */
+static void Help(void)
+{
+	fprintf(stdout,"Test FITS Image Data Convert:Help.\n");
+	fprintf(stdout,"This program checks and benchmarks the image data flip / FITS conversion kernel.\n");
+	fprintf(stdout,"test_fits_image_data_convert [-x|-ncols <n>][-y|-nrows <n>][-i[terations] <n>][-help]"
+		"[-l[og_level <0..5>].\n");
+	fprintf(stdout,"\t-ncols and -nrows set the binning 1 image dimensions - the default is 2048 x 2048.\n");
+	fprintf(stdout,"\t-iterations sets how many times each conversion is timed - the default is 20.\n");
+}
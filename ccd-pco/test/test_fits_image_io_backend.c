@@ -0,0 +1,622 @@
+/* test_fits_image_io_backend.c
+** $Header$
+*/
+/**
+ * Benchmark the CCD library's FITS image I/O backends (CCD_Fits_Image_Io_Backend_Set). For each backend,
+ * frames are released at a fixed rate (by default the fast rotor speed trigger rate, 16 frames per 8 second
+ * rotation) to a pool of writer threads, which write them using CCD_Fits_Image_Write, as the Moptop writer threads do.
+ * We report the write latency, throughput and number of system calls per file of each backend. No camera is needed.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "log_udp.h"
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+#include "ccd_general.h"
+
+/* hash defines */
+/**
+ * Length of some of the strings used in this program.
+ */
+#define STRING_LENGTH        (256)
+/**
+ * The maximum number of writer threads.
+ */
+#define THREAD_COUNT_MAX     (16)
+/**
+ * The number of header cards written in each frame, about the same as a Moptop multrun frame.
+ */
+#define CARD_COUNT           (100)
+/**
+ * The number of nanoseconds in one second.
+ */
+#define ONE_SECOND_NS        (1000000000)
+
+/* structures */
+/**
+ * Structure holding the timing of one frame.
+ * <dl>
+ * <dt>Release_Time</dt> <dd>When the frame was released to the writer threads (i.e. when it was 'read out').</dd>
+ * <dt>Start_Time</dt> <dd>When a writer thread started writing the frame.</dd>
+ * <dt>End_Time</dt> <dd>When the frame had been written.</dd>
+ * </dl>
+ */
+struct Frame_Struct
+{
+	struct timespec Release_Time;
+	struct timespec Start_Time;
+	struct timespec End_Time;
+};
+
+/* variables */
+/**
+ * Verbosity log level : initialised to LOG_VERBOSITY_TERSE.
+ */
+static int Log_Level = LOG_VERBOSITY_TERSE;
+/**
+ * The directory to write the FITS images into.
+ */
+static char Directory[STRING_LENGTH] = "/tmp";
+/**
+ * The number of columns in the test image.
+ */
+static int Ncols = 2048;
+/**
+ * The number of rows in the test image.
+ */
+static int Nrows = 2048;
+/**
+ * The number of frames to write with each backend.
+ */
+static int Frame_Count = 64;
+/**
+ * The number of writer threads.
+ */
+static int Thread_Count = 2;
+/**
+ * The rate frames are released to the writer threads, in Hz. The default is the fast rotor speed trigger rate
+ * (45 deg/s, 16 triggers per rotation). Zero releases all the frames at once.
+ */
+static double Frame_Rate = 2.0;
+/**
+ * A boolean, if TRUE fdatasync each file (CCD_Fits_Image_Io_Sync_Set).
+ */
+static int Sync = FALSE;
+/**
+ * A boolean, if TRUE benchmark the pwrite backend.
+ */
+static int Do_Pwrite = TRUE;
+/**
+ * A boolean, if TRUE benchmark the io_uring backend.
+ */
+static int Do_Io_Uring = TRUE;
+/**
+ * A boolean, if TRUE keep the written FITS images, otherwise they are deleted after each backend's run.
+ */
+static int Keep_Files = FALSE;
+/**
+ * The FITS image data written into every frame (already in FITS format).
+ */
+static unsigned short *Image_Data = NULL;
+/**
+ * The header card images written into every frame.
+ */
+static char Card_Image_List[CARD_COUNT*CCD_FITS_HEADER_CARD_IMAGE_LENGTH];
+/**
+ * The timing of each frame.
+ */
+static struct Frame_Struct *Frame_List = NULL;
+/**
+ * The number of frames released to the writer threads.
+ */
+static int Released_Count = 0;
+/**
+ * The index of the next frame to be written.
+ */
+static int Next_Frame = 0;
+/**
+ * The number of frames that failed to write.
+ */
+static int Failed_Count = 0;
+/**
+ * The maximum number of frames waiting to be written when a frame is released.
+ */
+static int Backlog_Max = 0;
+/**
+ * The name of the backend currently being benchmarked, used in the filenames.
+ */
+static const char *Backend_Name = NULL;
+/**
+ * Mutex protecting Released_Count, Next_Frame, Failed_Count and Backlog_Max.
+ */
+static pthread_mutex_t Frame_Mutex = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Condition variable signalled when a frame is released.
+ */
+static pthread_cond_t Frame_Condition = PTHREAD_COND_INITIALIZER;
+
+/* functions */
+static int Benchmark(enum CCD_FITS_IMAGE_IO_BACKEND backend);
+static void *Writer_Thread(void *arg);
+static void Filename_Get(int frame_index,char *filename);
+static double Time_Diff(struct timespec start_time,struct timespec end_time);
+static int Parse_Arguments(int argc, char *argv[]);
+static void Help(void);
+
+/* ------------------------------------------------------------------
+**          External functions
+** ------------------------------------------------------------------ */
+/**
+ * Main program.
+ * <ul>
+ * <li>We parse the arguments with Parse_Arguments.
+ * <li>We setup the CCD library's logging.
+ * <li>We allocate a test image, and fill it with a pattern, and convert it to FITS format.
+ * <li>We fill the header with CARD_COUNT blank COMMENT cards.
+ * <li>We set whether to sync each file using CCD_Fits_Image_Io_Sync_Set.
+ * <li>We run the benchmark with each selected backend using Benchmark.
+ * <li>We set the backend back to pwrite, which stops the io_uring thread.
+ * </ul>
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @see #Parse_Arguments
+ * @see #Benchmark
+ */
+int main(int argc, char *argv[])
+{
+	int i,retval;
+
+	/* parse arguments */
+	fprintf(stdout,"test_fits_image_io_backend : Parsing Arguments.\n");
+	if(!Parse_Arguments(argc,argv))
+		return 1;
+	CCD_General_Set_Log_Filter_Level(Log_Level);
+	CCD_General_Set_Log_Filter_Function(CCD_General_Log_Filter_Level_Absolute);
+	CCD_General_Set_Log_Handler_Function(CCD_General_Log_Handler_Stdout);
+	Image_Data = (unsigned short *)malloc(Ncols*Nrows*sizeof(unsigned short));
+	Frame_List = (struct Frame_Struct *)malloc(Frame_Count*sizeof(struct Frame_Struct));
+	if((Image_Data == NULL)||(Frame_List == NULL))
+	{
+		fprintf(stderr,"test_fits_image_io_backend : Failed to allocate %d x %d image.\n",Ncols,Nrows);
+		return 2;
+	}
+	for(i = 0; i < Ncols*Nrows; i++)
+		Image_Data[i] = (unsigned short)(i*40503);
+	if(!CCD_Fits_Image_Data_Convert(Image_Data,Image_Data,Ncols,Nrows,FALSE,FALSE))
+	{
+		CCD_General_Error();
+		return 3;
+	}
+	for(i = 0; i < CARD_COUNT; i++)
+	{
+		memset(Card_Image_List+(i*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),' ',CCD_FITS_HEADER_CARD_IMAGE_LENGTH);
+		memcpy(Card_Image_List+(i*CCD_FITS_HEADER_CARD_IMAGE_LENGTH),"COMMENT",7);
+	}
+	CCD_Fits_Image_Io_Sync_Set(Sync);
+	fprintf(stdout,"test_fits_image_io_backend : Writing %d frames of %d x %d at %.2f Hz "
+		"with %d threads (sync = %d) into '%s'.\n",Frame_Count,Ncols,Nrows,Frame_Rate,Thread_Count,Sync,
+		Directory);
+	retval = 0;
+	if(Do_Pwrite)
+	{
+		if(!Benchmark(CCD_FITS_IMAGE_IO_BACKEND_PWRITE))
+			retval = 4;
+	}
+	if(Do_Io_Uring)
+	{
+		if(!Benchmark(CCD_FITS_IMAGE_IO_BACKEND_IO_URING))
+			retval = 5;
+	}
+	if(!CCD_Fits_Image_Io_Backend_Set(CCD_FITS_IMAGE_IO_BACKEND_PWRITE))
+	{
+		CCD_General_Error();
+		retval = 6;
+	}
+	free(Image_Data);
+	free(Frame_List);
+	fprintf(stdout,"test_fits_image_io_backend : Finished.\n");
+	return retval;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions
+** ------------------------------------------------------------------ */
+/**
+ * Run the benchmark with one backend.
+ * <ul>
+ * <li>We select the backend using CCD_Fits_Image_Io_Backend_Set.
+ * <li>We remove any files left over from a previous run, as CCD_Fits_Image_Write fails if the file exists.
+ * <li>We start Thread_Count writer threads (Writer_Thread).
+ * <li>We release Frame_Count frames to the writer threads, one every 1/Frame_Rate seconds.
+ * <li>We wait for the writer threads to finish.
+ * <li>We print the throughput, latency (release to written), write time and system calls per file.
+ * <li>We delete the files, unless Keep_Files is TRUE.
+ * </ul>
+ * @param backend The backend to benchmark.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Writer_Thread
+ * @see #Frame_List
+ */
+static int Benchmark(enum CCD_FITS_IMAGE_IO_BACKEND backend)
+{
+	pthread_t thread_list[THREAD_COUNT_MAX];
+	char filename[STRING_LENGTH];
+	struct timespec start_time,end_time,release_time;
+	double latency,latency_total,latency_max,write_time,write_time_total,write_time_max,elapsed;
+	int i,start_file_count,start_syscall_count,end_file_count,end_syscall_count,backlog,retval;
+
+	if(!CCD_Fits_Image_Io_Backend_Set(backend))
+	{
+		CCD_General_Error();
+		return FALSE;
+	}
+	Backend_Name = CCD_Fits_Image_Io_Backend_To_String(backend);
+	for(i = 0; i < Frame_Count; i++)
+	{
+		Filename_Get(i,filename);
+		unlink(filename);
+	}
+	Released_Count = 0;
+	Next_Frame = 0;
+	Failed_Count = 0;
+	Backlog_Max = 0;
+	CCD_Fits_Image_Io_Count_Get(&start_file_count,&start_syscall_count);
+	for(i = 0; i < Thread_Count; i++)
+	{
+		retval = pthread_create(&(thread_list[i]),NULL,Writer_Thread,NULL);
+		if(retval != 0)
+		{
+			fprintf(stderr,"Benchmark:Failed to create writer thread %d (%d).\n",i,retval);
+			return FALSE;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	release_time = start_time;
+	for(i = 0; i < Frame_Count; i++)
+	{
+		if(Frame_Rate > 0.0)
+		{
+			while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&release_time,NULL) == EINTR)
+				;
+		}
+		pthread_mutex_lock(&Frame_Mutex);
+		clock_gettime(CLOCK_MONOTONIC,&(Frame_List[i].Release_Time));
+		Released_Count++;
+		backlog = Released_Count-Next_Frame;
+		if(backlog > Backlog_Max)
+			Backlog_Max = backlog;
+		pthread_cond_broadcast(&Frame_Condition);
+		pthread_mutex_unlock(&Frame_Mutex);
+		if(Frame_Rate > 0.0)
+		{
+			release_time.tv_nsec += (long)(ONE_SECOND_NS/Frame_Rate);
+			release_time.tv_sec += release_time.tv_nsec/ONE_SECOND_NS;
+			release_time.tv_nsec = release_time.tv_nsec%ONE_SECOND_NS;
+		}
+	}
+	for(i = 0; i < Thread_Count; i++)
+		pthread_join(thread_list[i],NULL);
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	CCD_Fits_Image_Io_Count_Get(&end_file_count,&end_syscall_count);
+	latency_total = 0.0;
+	latency_max = 0.0;
+	write_time_total = 0.0;
+	write_time_max = 0.0;
+	for(i = 0; i < Frame_Count; i++)
+	{
+		latency = Time_Diff(Frame_List[i].Release_Time,Frame_List[i].End_Time);
+		write_time = Time_Diff(Frame_List[i].Start_Time,Frame_List[i].End_Time);
+		latency_total += latency;
+		write_time_total += write_time;
+		if(latency > latency_max)
+			latency_max = latency;
+		if(write_time > write_time_max)
+			write_time_max = write_time;
+	}
+	elapsed = Time_Diff(start_time,end_time);
+	fprintf(stdout,"test_fits_image_io_backend : %s : %d frames (%d failed) in %.3f s, %.1f MB/s.\n",
+		Backend_Name,Frame_Count,Failed_Count,elapsed,
+		(((double)Frame_Count)*CCD_Fits_Image_Data_Length_Get(Ncols,Nrows))/(elapsed*1.0E6));
+	fprintf(stdout,"test_fits_image_io_backend : %s : latency mean %.6f s max %.6f s, "
+		"write time mean %.6f s max %.6f s, maximum backlog %d frames.\n",Backend_Name,
+		latency_total/Frame_Count,latency_max,write_time_total/Frame_Count,write_time_max,Backlog_Max);
+	if(end_file_count > start_file_count)
+	{
+		fprintf(stdout,"test_fits_image_io_backend : %s : %d files written using %d system calls "
+			"(%.2f per file).\n",Backend_Name,end_file_count-start_file_count,
+			end_syscall_count-start_syscall_count,((double)(end_syscall_count-start_syscall_count))/
+			((double)(end_file_count-start_file_count)));
+	}
+	if((Frame_Rate > 0.0)&&(latency_max > (Thread_Count/Frame_Rate)))
+	{
+		fprintf(stdout,"test_fits_image_io_backend : %s : Did not keep up with %.2f Hz using %d threads.\n",
+			Backend_Name,Frame_Rate,Thread_Count);
+	}
+	if(Keep_Files == FALSE)
+	{
+		for(i = 0; i < Frame_Count; i++)
+		{
+			Filename_Get(i,filename);
+			unlink(filename);
+		}
+	}
+	return (Failed_Count == 0);
+}
+
+/**
+ * Writer thread. We wait for a frame to be released, and write it using CCD_Fits_Image_Write, recording when
+ * the write started and finished. We exit when all Frame_Count frames have been taken.
+ * @param arg The thread argument, not used.
+ * @return The routine always returns NULL.
+ * @see #Frame_List
+ * @see #Frame_Mutex
+ * @see #Frame_Condition
+ * @see #Filename_Get
+ */
+static void *Writer_Thread(void *arg)
+{
+	char filename[STRING_LENGTH];
+	int frame_index;
+
+	while(TRUE)
+	{
+		pthread_mutex_lock(&Frame_Mutex);
+		while((Next_Frame >= Released_Count)&&(Next_Frame < Frame_Count))
+			pthread_cond_wait(&Frame_Condition,&Frame_Mutex);
+		if(Next_Frame >= Frame_Count)
+		{
+			pthread_mutex_unlock(&Frame_Mutex);
+			break;
+		}
+		frame_index = Next_Frame++;
+		pthread_mutex_unlock(&Frame_Mutex);
+		Filename_Get(frame_index,filename);
+		clock_gettime(CLOCK_MONOTONIC,&(Frame_List[frame_index].Start_Time));
+		if(!CCD_Fits_Image_Write(filename,Card_Image_List,CARD_COUNT,Ncols,Nrows,Image_Data))
+		{
+			CCD_General_Error();
+			pthread_mutex_lock(&Frame_Mutex);
+			Failed_Count++;
+			pthread_mutex_unlock(&Frame_Mutex);
+		}
+		clock_gettime(CLOCK_MONOTONIC,&(Frame_List[frame_index].End_Time));
+	}
+	return NULL;
+}
+
+/**
+ * Get the filename of a frame.
+ * @param frame_index The index of the frame.
+ * @param filename A string of at least STRING_LENGTH characters to store the filename in.
+ * @see #Directory
+ * @see #Backend_Name
+ */
+static void Filename_Get(int frame_index,char *filename)
+{
+	sprintf(filename,"%s/test_fits_image_io_backend_%s_%d.fits",Directory,Backend_Name,frame_index);
+}
+
+/**
+ * Return the difference between two times, in seconds.
+ * @param start_time The start time.
+ * @param end_time The end time.
+ * @return The end time minus the start time, in seconds.
+ */
+static double Time_Diff(struct timespec start_time,struct timespec end_time)
+{
+	return (end_time.tv_sec-start_time.tv_sec)+((end_time.tv_nsec-start_time.tv_nsec)/1.0E9);
+}
+
+/**
+ * Routine to parse command line arguments.
+ * @param argc The number of arguments sent to the program.
+ * @param argv An array of argument strings.
+ * @see #Directory
+ * @see #Frame_Count
+ * @see #Frame_Rate
+ * @see #Thread_Count
+ * @see #Sync
+ * @see #Do_Pwrite
+ * @see #Do_Io_Uring
+ * @see #Keep_Files
+ * @see #Log_Level
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Help
+ */
+static int Parse_Arguments(int argc, char *argv[])
+{
+	int i,retval;
+
+	for(i=1;i<argc;i++)
+	{
+		if((strcmp(argv[i],"-b")==0)||(strcmp(argv[i],"-backend")==0))
+		{
+			if((i+1)<argc)
+			{
+				Do_Pwrite = (strcmp(argv[i+1],"pwrite") == 0)||(strcmp(argv[i+1],"both") == 0);
+				Do_Io_Uring = (strcmp(argv[i+1],"io_uring") == 0)||(strcmp(argv[i+1],"both") == 0);
+				if((Do_Pwrite == FALSE)&&(Do_Io_Uring == FALSE))
+				{
+					fprintf(stderr,"Parse_Arguments:Illegal backend %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-backend requires pwrite|io_uring|both.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-d")==0)||(strcmp(argv[i],"-directory")==0))
+		{
+			if((i+1)<argc)
+			{
+				strncpy(Directory,argv[i+1],STRING_LENGTH-64);
+				Directory[STRING_LENGTH-64] = '\0';
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-directory requires a directory.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-f")==0)||(strcmp(argv[i],"-frame_count")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Frame_Count);
+				if((retval != 1)||(Frame_Count < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse frame count %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-frame_count requires a number of frames.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-help")==0))
+		{
+			Help();
+			return FALSE;
+		}
+		else if((strcmp(argv[i],"-k")==0)||(strcmp(argv[i],"-keep")==0))
+		{
+			Keep_Files = TRUE;
+		}
+		else if((strcmp(argv[i],"-l")==0)||(strcmp(argv[i],"-log_level")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Log_Level);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse log level %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-log_level requires a number 0..5.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-r")==0)||(strcmp(argv[i],"-rate")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%lf",&Frame_Rate);
+				if((retval != 1)||(Frame_Rate < 0.0))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse frame rate %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-rate requires a frame rate in Hz.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-s")==0)||(strcmp(argv[i],"-sync")==0))
+		{
+			Sync = TRUE;
+		}
+		else if((strcmp(argv[i],"-t")==0)||(strcmp(argv[i],"-thread_count")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Thread_Count);
+				if((retval != 1)||(Thread_Count < 1)||(Thread_Count > THREAD_COUNT_MAX))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse thread count %s (1..%d).\n",
+						argv[i+1],THREAD_COUNT_MAX);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-thread_count requires a number of threads.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-x")==0)||(strcmp(argv[i],"-ncols")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Ncols);
+				if((retval != 1)||(Ncols < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of columns %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-ncols requires a number of columns.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-y")==0)||(strcmp(argv[i],"-nrows")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Nrows);
+				if((retval != 1)||(Nrows < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of rows %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-nrows requires a number of rows.\n");
+				return FALSE;
+			}
+		}
+		else
+		{
+			fprintf(stderr,"Parse_Arguments:argument '%s' not recognized.\n",argv[i]);
+			return FALSE;
+		}
+	}/* end for */
+	return TRUE;
+}
+
+/**
+ * Help routine.
+ */
+static void Help(void)
+{
+	fprintf(stdout,"Test FITS Image I/O Backend:Help.\n");
+	fprintf(stdout,"This program benchmarks writing FITS images with the pwrite and io_uring I/O backends.\n");
+	fprintf(stdout,"test_fits_image_io_backend [-b[ackend] pwrite|io_uring|both][-d[irectory] <path>]"
+		"[-f[rame_count] <n>][-r[ate] <Hz>][-t[hread_count] <n>][-s[ync]][-k[eep]]"
+		"[-x|-ncols <n>][-y|-nrows <n>][-help][-l[og_level <0..5>].\n");
+	fprintf(stdout,"\t-directory is the directory to write the FITS images into - the default is /tmp.\n");
+	fprintf(stdout,"\t-frame_count is the number of frames written with each backend - the default is 64.\n");
+	fprintf(stdout,"\t-rate is the rate frames are released to the writer threads - the default is 2.0 Hz, "
+		"the fast rotor speed trigger rate. 0 releases all the frames at once.\n");
+	fprintf(stdout,"\t-thread_count is the number of writer threads - the default is 2.\n");
+	fprintf(stdout,"\t-sync fdatasyncs each file before it is closed.\n");
+	fprintf(stdout,"\t-keep keeps the written FITS images, otherwise they are deleted.\n");
+	fprintf(stdout,"\t-ncols and -nrows set the image dimensions - the default is 2048 x 2048.\n");
+}
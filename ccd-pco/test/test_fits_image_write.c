@@ -0,0 +1,857 @@
+/* test_fits_image_write.c
+** $Header$
+*/
+/**
+ * Test the CCD library's native FITS image writers. We write the same image and headers using both the native 
+ * writer and CFITSIO, read the native file back with CFITSIO to check the header values, image type, dimensions and
+ * image data, and check the two files are byte for byte identical. No camera is needed.
+ * The -bitpix argument selects the writer tested:
+ * <ul>
+ * <li>16 - The unsigned short writer used for camera frames (CCD_Fits_Image_Write), the default.
+ * <li>-32 - The float writer used for reduced products (CCD_Fits_Image_Float_Write), 
+ *     optionally with -planes planes.
+ * <li>32 - The 32 bit integer writer used for stacked frames (CCD_Fits_Image_Int_Write).
+ * </ul>
+ * The unsigned short and integer writers can also flip the image (-flip_x / -flip_y) as they write it. 
+ * CFITSIO writes a copy we have flipped ourselves.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fitsio.h"
+#include "log_udp.h"
+#include "ccd_fits_header.h"
+#include "ccd_fits_image.h"
+#include "ccd_general.h"
+
+/* hash defines */
+/**
+ * Length of some of the strings used in this program.
+ */
+#define STRING_LENGTH        (256)
+/**
+ * The maximum number of card images we format from the FITS header list.
+ */
+#define CARD_IMAGE_COUNT_MAX (64)
+
+/* variables */
+/**
+ * Verbosity log level : initialised to LOG_VERBOSITY_VERY_VERBOSE.
+ */
+static int Log_Level = LOG_VERBOSITY_VERY_VERBOSE;
+/**
+ * The filename root of the FITS images to write. "_native.fits" and "_cfitsio.fits" are appended to this.
+ */
+static char Filename_Root[STRING_LENGTH] = "/tmp/test_fits_image_write";
+/**
+ * The number of columns in the test image.
+ */
+static int Ncols = 2048;
+/**
+ * The number of rows in the test image.
+ */
+static int Nrows = 2048;
+/**
+ * The FITS BITPIX of the test image, which selects the native writer tested: 16 (unsigned short), -32 (float)
+ * or 32 (integer).
+ */
+static int Bitpix = 16;
+/**
+ * The number of planes in the test image (0 for a 2D image). Only the float writer supports planes.
+ */
+static int Plane_Count = 0;
+/**
+ * A boolean, if TRUE the native writer flips the image in X. Use an odd number of columns to test the 
+ * centre column.
+ */
+static int Flip_X = FALSE;
+/**
+ * A boolean, if TRUE the native writer flips the image in Y. Use an odd number of rows to test the centre row.
+ */
+static int Flip_Y = FALSE;
+
+/* functions */
+static int Headers_Add(void);
+static size_t Pixel_Count_Get(void);
+static size_t Pixel_Size_Get(void);
+static int Image_Type_Get(void);
+static void Test_Image_Create(void *image_data);
+static void Test_Image_Flip(void *image_data,void *flipped_image_data);
+static int Native_Write(char *filename,char *card_image_list,int card_count,void *image_data);
+static int Cfitsio_Write(char *filename,void *image_data);
+static int Native_Read_Check(char *filename,void *image_data);
+static int Pixels_Compare(void *read_image_data,void *image_data);
+static int Files_Compare(char *filename1,char *filename2);
+static int Parse_Arguments(int argc, char *argv[]);
+static void Help(void);
+
+/* ------------------------------------------------------------------
+**          External functions
+** ------------------------------------------------------------------ */
+/**
+ * Main program.
+ * <ul>
+ * <li>We parse the arguments with Parse_Arguments.
+ * <li>We setup the CCD library's logging.
+ * <li>We allocate a test image of Bitpix type, and fill it with a test pattern using Test_Image_Create.
+ * <li>We make a flipped copy of the image (if Flip_X or Flip_Y are set), as the native writer should write it,
+ *     using Test_Image_Flip.
+ * <li>We add some FITS headers of each type to the FITS header list using Headers_Add.
+ * <li>We format the FITS header list into card images using CCD_Fits_Header_To_Card_Images.
+ * <li>We write the flipped image using CFITSIO with Cfitsio_Write.
+ * <li>We write a copy of the unflipped image (the native writers flip and convert it in place) using Native_Write.
+ * <li>We read the natively written image back using CFITSIO, and check it against the flipped image,
+ *     using Native_Read_Check.
+ * <li>We check the two files are identical using Files_Compare.
+ * </ul>
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @see #Parse_Arguments
+ * @see #Pixel_Count_Get
+ * @see #Pixel_Size_Get
+ * @see #Test_Image_Create
+ * @see #Test_Image_Flip
+ * @see #Headers_Add
+ * @see #Native_Write
+ * @see #Cfitsio_Write
+ * @see #Native_Read_Check
+ * @see #Files_Compare
+ * @see #Log_Level
+ * @see #Filename_Root
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Bitpix
+ * @see #Plane_Count
+ * @see #Flip_X
+ * @see #Flip_Y
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Level
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Filter_Function
+ * @see ../cdocs/ccd_general.html#CCD_General_Log_Filter_Level_Absolute
+ * @see ../cdocs/ccd_general.html#CCD_General_Set_Log_Handler_Function
+ * @see ../cdocs/ccd_general.html#CCD_General_Log_Handler_Stdout
+ * @see ../cdocs/ccd_general.html#CCD_General_Error
+ * @see ../cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_To_Card_Images
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_Free
+ */
+int main(int argc, char *argv[])
+{
+	char native_filename[STRING_LENGTH];
+	char cfitsio_filename[STRING_LENGTH];
+	char card_image_list[CARD_IMAGE_COUNT_MAX*CCD_FITS_HEADER_CARD_IMAGE_LENGTH];
+	void *image_data = NULL;
+	void *native_image_data = NULL;
+	void *flipped_image_data = NULL;
+	struct timespec start_time,end_time;
+	int card_count;
+
+	/* parse arguments */
+	fprintf(stdout,"test_fits_image_write : Parsing Arguments.\n");
+	if(!Parse_Arguments(argc,argv))
+		return 1;
+	CCD_General_Set_Log_Filter_Level(Log_Level);
+	CCD_General_Set_Log_Filter_Function(CCD_General_Log_Filter_Level_Absolute);
+	CCD_General_Set_Log_Handler_Function(CCD_General_Log_Handler_Stdout);
+	sprintf(native_filename,"%s_native.fits",Filename_Root);
+	sprintf(cfitsio_filename,"%s_cfitsio.fits",Filename_Root);
+	/* both writers fail if the file already exists */
+	unlink(native_filename);
+	unlink(cfitsio_filename);
+	/* create test image */
+	image_data = malloc(Pixel_Count_Get()*Pixel_Size_Get());
+	native_image_data = malloc(Pixel_Count_Get()*Pixel_Size_Get());
+	flipped_image_data = malloc(Pixel_Count_Get()*Pixel_Size_Get());
+	if((image_data == NULL)||(native_image_data == NULL)||(flipped_image_data == NULL))
+	{
+		fprintf(stderr,"test_fits_image_write : Failed to allocate %d x %d x %d image of bitpix %d.\n",
+			Ncols,Nrows,Plane_Count,Bitpix);
+		return 2;
+	}
+	Test_Image_Create(image_data);
+	Test_Image_Flip(image_data,flipped_image_data);
+	/* headers */
+	if(!Headers_Add())
+	{
+		CCD_General_Error();
+		return 3;
+	}
+	if(!CCD_Fits_Header_To_Card_Images(card_image_list,CARD_IMAGE_COUNT_MAX,&card_count))
+	{
+		CCD_General_Error();
+		return 4;
+	}
+	/* write using CFITSIO */
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!Cfitsio_Write(cfitsio_filename,flipped_image_data))
+		return 5;
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	fprintf(stdout,"test_fits_image_write : CFITSIO write of '%s' took %.6f s.\n",cfitsio_filename,
+		(end_time.tv_sec-start_time.tv_sec)+((end_time.tv_nsec-start_time.tv_nsec)/1.0E9));
+	/* write using the native writer. This flips and converts the image data in place, so write a copy. */
+	memcpy(native_image_data,image_data,Pixel_Count_Get()*Pixel_Size_Get());
+	clock_gettime(CLOCK_MONOTONIC,&start_time);
+	if(!Native_Write(native_filename,card_image_list,card_count,native_image_data))
+		return 6;
+	clock_gettime(CLOCK_MONOTONIC,&end_time);
+	fprintf(stdout,"test_fits_image_write : Native write of '%s' took %.6f s.\n",native_filename,
+		(end_time.tv_sec-start_time.tv_sec)+((end_time.tv_nsec-start_time.tv_nsec)/1.0E9));
+	/* read the native image back using CFITSIO */
+	if(!Native_Read_Check(native_filename,flipped_image_data))
+		return 7;
+	/* check the files are identical */
+	if(!Files_Compare(native_filename,cfitsio_filename))
+		return 8;
+	CCD_Fits_Header_Free();
+	free(image_data);
+	free(native_image_data);
+	free(flipped_image_data);
+	fprintf(stdout,"test_fits_image_write : Passed.\n");
+	return 0;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions
+** ------------------------------------------------------------------ */
+/**
+ * Add some FITS headers of each type to the CCD library's FITS header list.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_Initialise
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_Add_String
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_Add_Int
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_Add_Long_Long_Int
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_Add_Float
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_Add_Logical
+ */
+static int Headers_Add(void)
+{
+	if(!CCD_Fits_Header_Initialise())
+		return FALSE;
+	if(!CCD_Fits_Header_Add_String("OBSTYPE","EXPOSE",NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_String("DATE-OBS","2020-01-01T12:34:56.789",NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_String("OBJECT","It's a test",NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_Int("RUNNUM",12,NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_Int("EXPNUM",-3,NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_Long_Long_Int("PICNUMLL",1234567890123LL,NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_Float("EXPTIME",0.123456789,NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_Float("MJD",58849.524268391,NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_Float("CCDATEMP",-20.5,NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_Logical("PRESCAN",FALSE,NULL))
+		return FALSE;
+	if(!CCD_Fits_Header_Add_Logical("ROTSKY",TRUE,NULL))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * Get the number of pixels in the test image.
+ * @return The number of pixels, Ncols x Nrows (x Plane_Count).
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Plane_Count
+ */
+static size_t Pixel_Count_Get(void)
+{
+	return ((size_t)Ncols)*((size_t)Nrows)*((size_t)(Plane_Count > 0 ? Plane_Count : 1));
+}
+
+/**
+ * Get the size in bytes of each pixel of the test image.
+ * @return The pixel size in bytes, for Bitpix.
+ * @see #Bitpix
+ */
+static size_t Pixel_Size_Get(void)
+{
+	if(Bitpix == 16)
+		return sizeof(unsigned short);
+	return sizeof(float);
+}
+
+/**
+ * Get the CFITSIO image type of the test image.
+ * @return The CFITSIO image type for Bitpix: USHORT_IMG, FLOAT_IMG or LONG_IMG.
+ * @see #Bitpix
+ */
+static int Image_Type_Get(void)
+{
+	if(Bitpix == 16)
+		return USHORT_IMG;
+	else if(Bitpix == 32)
+		return LONG_IMG;
+	return FLOAT_IMG;
+}
+
+/**
+ * Fill the test image with a test pattern, depending on Bitpix:
+ * <ul>
+ * <li>16 - A pattern that covers the whole unsigned short range, including 0, 32767, 32768 and 65535 
+ *     to check the BZERO offset at the edges.
+ * <li>-32 - A pattern of positive, negative, fractional and NaN values.
+ * <li>32 - A pattern of values larger than an unsigned short, as a stack of frames would have.
+ * </ul>
+ * @param image_data The image data to fill in, of Pixel_Count_Get pixels of Bitpix type.
+ * @see #Bitpix
+ * @see #Pixel_Count_Get
+ */
+static void Test_Image_Create(void *image_data)
+{
+	unsigned short *ushort_image_data = NULL;
+	float *float_image_data = NULL;
+	unsigned int *int_image_data = NULL;
+	size_t i,pixel_count;
+
+	pixel_count = Pixel_Count_Get();
+	if(Bitpix == 16)
+	{
+		ushort_image_data = (unsigned short *)image_data;
+		for(i = 0; i < pixel_count; i++)
+			ushort_image_data[i] = (unsigned short)((i*40503)+(i/Ncols));
+		ushort_image_data[0] = 0;
+		ushort_image_data[pixel_count/3] = 32767;
+		ushort_image_data[pixel_count/2] = 32768;
+		ushort_image_data[pixel_count-1] = 65535;
+	}
+	else if(Bitpix == 32)
+	{
+		int_image_data = (unsigned int *)image_data;
+		for(i = 0; i < pixel_count; i++)
+			int_image_data[i] = (unsigned int)(i*40503u)%2147483647u;
+	}
+	else
+	{
+		float_image_data = (float *)image_data;
+		for(i = 0; i < pixel_count; i++)
+			float_image_data[i] = ((float)((i*40503)%65536)-32768.0f)/((float)((i%7)+1));
+		float_image_data[pixel_count/2] = NAN;
+	}
+}
+
+/**
+ * Make the flipped copy of the test image the native writer should write, flipped in X if Flip_X is set,
+ * and in Y if Flip_Y is set.
+ * @param image_data The test image, of Pixel_Count_Get pixels of Bitpix type.
+ * @param flipped_image_data Where to put the flipped image, of Pixel_Count_Get pixels of Bitpix type.
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Plane_Count
+ * @see #Flip_X
+ * @see #Flip_Y
+ * @see #Pixel_Size_Get
+ */
+static void Test_Image_Flip(void *image_data,void *flipped_image_data)
+{
+	size_t pixel_size,plane_offset;
+	int x,y,plane,flipped_x,flipped_y;
+
+	pixel_size = Pixel_Size_Get();
+	for(plane = 0; plane < (Plane_Count > 0 ? Plane_Count : 1); plane++)
+	{
+		plane_offset = ((size_t)plane)*Ncols*Nrows;
+		for(y = 0; y < Nrows; y++)
+		{
+			for(x = 0; x < Ncols; x++)
+			{
+				flipped_x = Flip_X ? (Ncols-1-x) : x;
+				flipped_y = Flip_Y ? (Nrows-1-y) : y;
+				memcpy((char *)flipped_image_data+
+				       ((plane_offset+(((size_t)flipped_y)*Ncols)+flipped_x)*pixel_size),
+				       (char *)image_data+((plane_offset+(((size_t)y)*Ncols)+x)*pixel_size),pixel_size);
+			}
+		}
+	}
+}
+
+/**
+ * Write the image and the formatted card images using the native writer for Bitpix.
+ * <ul>
+ * <li>16 - We convert (and flip) the image to FITS format in place using CCD_Fits_Image_Data_Convert, 
+ *     and write it using CCD_Fits_Image_Write.
+ * <li>-32 - We write it using CCD_Fits_Image_Float_Write, which byte swaps it in place.
+ * <li>32 - We write it using CCD_Fits_Image_Int_Write, which flips and byte swaps it in place.
+ * </ul>
+ * @param filename The filename to write.
+ * @param card_image_list The formatted FITS header card images.
+ * @param card_count The number of card images in card_image_list.
+ * @param image_data The image data, of Pixel_Count_Get pixels of Bitpix type. This is modified.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Bitpix
+ * @see #Plane_Count
+ * @see #Flip_X
+ * @see #Flip_Y
+ * @see ../cdocs/ccd_general.html#CCD_General_Error
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Data_Convert
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Write
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Float_Write
+ * @see ../cdocs/ccd_fits_image.html#CCD_Fits_Image_Int_Write
+ */
+static int Native_Write(char *filename,char *card_image_list,int card_count,void *image_data)
+{
+	int retval;
+
+	if(Bitpix == 16)
+	{
+		retval = CCD_Fits_Image_Data_Convert((unsigned short *)image_data,(unsigned short *)image_data,
+						     Ncols,Nrows,Flip_X,Flip_Y);
+		if(retval)
+		{
+			retval = CCD_Fits_Image_Write(filename,card_image_list,card_count,Ncols,Nrows,
+						      (unsigned short *)image_data);
+		}
+	}
+	else if(Bitpix == 32)
+	{
+		retval = CCD_Fits_Image_Int_Write(filename,card_image_list,card_count,Ncols,Nrows,Flip_X,Flip_Y,
+						  (unsigned int *)image_data);
+	}
+	else
+	{
+		retval = CCD_Fits_Image_Float_Write(filename,card_image_list,card_count,Ncols,Nrows,Plane_Count,
+						    (float *)image_data);
+	}
+	if(!retval)
+		CCD_General_Error();
+	return retval;
+}
+
+/**
+ * Write the image and the FITS header list using CFITSIO, in the same way the C layer does when the
+ * native FITS writer is disabled.
+ * @param filename The filename to write.
+ * @param image_data The image data, of Pixel_Count_Get pixels of Bitpix type.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Bitpix
+ * @see #Plane_Count
+ * @see #Pixel_Count_Get
+ * @see #Image_Type_Get
+ * @see ../cdocs/ccd_fits_header.html#CCD_Fits_Header_Write_To_Fits
+ */
+static int Cfitsio_Write(char *filename,void *image_data)
+{
+	fitsfile *fp = NULL;
+	long axes[3];
+	int status = 0;
+
+	fits_create_file(&fp,filename,&status);
+	axes[0] = Ncols;
+	axes[1] = Nrows;
+	axes[2] = Plane_Count;
+	fits_create_img(fp,Image_Type_Get(),(Plane_Count > 0) ? 3 : 2,axes,&status);
+	if(status)
+	{
+		fits_report_error(stderr,status);
+		return FALSE;
+	}
+	if(!CCD_Fits_Header_Write_To_Fits(fp))
+	{
+		CCD_General_Error();
+		fits_close_file(fp,&status);
+		return FALSE;
+	}
+	if(Bitpix == 16)
+		fits_write_img(fp,TUSHORT,1,(LONGLONG)Pixel_Count_Get(),image_data,&status);
+	else if(Bitpix == 32)
+		fits_write_img(fp,TUINT,1,(LONGLONG)Pixel_Count_Get(),image_data,&status);
+	else
+		fits_write_img(fp,TFLOAT,1,(LONGLONG)Pixel_Count_Get(),image_data,&status);
+	fits_close_file(fp,&status);
+	if(status)
+	{
+		fits_report_error(stderr,status);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Read the natively written FITS image back using CFITSIO, and check the image type, dimensions,
+ * header values and image data (using Pixels_Compare) are correct.
+ * @param filename The filename to read.
+ * @param image_data The original image data, of Pixel_Count_Get pixels of Bitpix type.
+ * @return The routine returns TRUE on success, and FALSE on failure.
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Bitpix
+ * @see #Plane_Count
+ * @see #Pixel_Count_Get
+ * @see #Pixel_Size_Get
+ * @see #Image_Type_Get
+ * @see #Pixels_Compare
+ */
+static int Native_Read_Check(char *filename,void *image_data)
+{
+	fitsfile *fp = NULL;
+	char string_value[FLEN_VALUE];
+	void *read_image_data = NULL;
+	float nulval = NAN;
+	long axes[3] = {0,0,0};
+	long long long_long_value;
+	double double_value;
+	int status = 0,image_type,naxis,int_value,logical_value,anynul,retval;
+
+	fits_open_file(&fp,filename,READONLY,&status);
+	fits_get_img_equivtype(fp,&image_type,&status);
+	fits_get_img_dim(fp,&naxis,&status);
+	fits_get_img_size(fp,3,axes,&status);
+	if(status)
+	{
+		fits_report_error(stderr,status);
+		return FALSE;
+	}
+	if((image_type != Image_Type_Get())||(naxis != ((Plane_Count > 0) ? 3 : 2))||
+	   (axes[0] != Ncols)||(axes[1] != Nrows)||((Plane_Count > 0)&&(axes[2] != Plane_Count)))
+	{
+		fprintf(stderr,"Native_Read_Check:'%s' has type %d, naxis %d, dimensions %ld x %ld x %ld.\n",
+			filename,image_type,naxis,axes[0],axes[1],axes[2]);
+		fits_close_file(fp,&status);
+		return FALSE;
+	}
+	/* header values */
+	retval = TRUE;
+	fits_read_key(fp,TSTRING,"OBJECT",string_value,NULL,&status);
+	if(strcmp(string_value,"It's a test") != 0)
+	{
+		fprintf(stderr,"Native_Read_Check:OBJECT was '%s'.\n",string_value);
+		retval = FALSE;
+	}
+	fits_read_key(fp,TINT,"EXPNUM",&int_value,NULL,&status);
+	if(int_value != -3)
+	{
+		fprintf(stderr,"Native_Read_Check:EXPNUM was %d.\n",int_value);
+		retval = FALSE;
+	}
+	fits_read_key(fp,TLONGLONG,"PICNUMLL",&long_long_value,NULL,&status);
+	if(long_long_value != 1234567890123LL)
+	{
+		fprintf(stderr,"Native_Read_Check:PICNUMLL was %lld.\n",long_long_value);
+		retval = FALSE;
+	}
+	fits_read_key(fp,TDOUBLE,"EXPTIME",&double_value,NULL,&status);
+	if(double_value != 0.123457)
+	{
+		fprintf(stderr,"Native_Read_Check:EXPTIME was %.9f.\n",double_value);
+		retval = FALSE;
+	}
+	fits_read_key(fp,TLOGICAL,"ROTSKY",&logical_value,NULL,&status);
+	if(logical_value != TRUE)
+	{
+		fprintf(stderr,"Native_Read_Check:ROTSKY was %d.\n",logical_value);
+		retval = FALSE;
+	}
+	/* image data */
+	read_image_data = malloc(Pixel_Count_Get()*Pixel_Size_Get());
+	if(read_image_data == NULL)
+	{
+		fprintf(stderr,"Native_Read_Check:Failed to allocate read image.\n");
+		fits_close_file(fp,&status);
+		return FALSE;
+	}
+	if(Bitpix == 16)
+		fits_read_img(fp,TUSHORT,1,(LONGLONG)Pixel_Count_Get(),NULL,read_image_data,&anynul,&status);
+	else if(Bitpix == 32)
+		fits_read_img(fp,TUINT,1,(LONGLONG)Pixel_Count_Get(),NULL,read_image_data,&anynul,&status);
+	else
+		fits_read_img(fp,TFLOAT,1,(LONGLONG)Pixel_Count_Get(),&nulval,read_image_data,&anynul,&status);
+	fits_close_file(fp,&status);
+	if(status)
+	{
+		fits_report_error(stderr,status);
+		free(read_image_data);
+		return FALSE;
+	}
+	if(!Pixels_Compare(read_image_data,image_data))
+		retval = FALSE;
+	free(read_image_data);
+	if(retval)
+		fprintf(stdout,"Native_Read_Check:'%s' read back correctly using CFITSIO.\n",filename);
+	return retval;
+}
+
+/**
+ * Check the image data read back from the natively written image is the same as the original image data.
+ * NaN float pixels must read back as NaN.
+ * @param read_image_data The image data read back, of Pixel_Count_Get pixels of Bitpix type.
+ * @param image_data The original image data, of Pixel_Count_Get pixels of Bitpix type.
+ * @return The routine returns TRUE if the image data is the same, and FALSE if it is not.
+ * @see #Ncols
+ * @see #Bitpix
+ * @see #Pixel_Count_Get
+ */
+static int Pixels_Compare(void *read_image_data,void *image_data)
+{
+	unsigned short *read_ushort_data = (unsigned short *)read_image_data;
+	unsigned short *ushort_data = (unsigned short *)image_data;
+	float *read_float_data = (float *)read_image_data;
+	float *float_data = (float *)image_data;
+	unsigned int *read_int_data = (unsigned int *)read_image_data;
+	unsigned int *int_data = (unsigned int *)image_data;
+	size_t i,pixel_count;
+
+	pixel_count = Pixel_Count_Get();
+	for(i = 0; i < pixel_count; i++)
+	{
+		if(Bitpix == 16)
+		{
+			if(read_ushort_data[i] != ushort_data[i])
+			{
+				fprintf(stderr,"Pixels_Compare:Pixel %zu was %hu, should be %hu.\n",i,read_ushort_data[i],
+					ushort_data[i]);
+				return FALSE;
+			}
+		}
+		else if(Bitpix == 32)
+		{
+			if(read_int_data[i] != int_data[i])
+			{
+				fprintf(stderr,"Pixels_Compare:Pixel %zu (%zu,%zu) was %u, should be %u.\n",i,i%Ncols,
+					i/Ncols,read_int_data[i],int_data[i]);
+				return FALSE;
+			}
+		}
+		else if(isnan(float_data[i]) ? !isnan(read_float_data[i]) : (read_float_data[i] != float_data[i]))
+		{
+			fprintf(stderr,"Pixels_Compare:Pixel %zu was %g, should be %g.\n",i,read_float_data[i],
+				float_data[i]);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Check two files are byte for byte identical.
+ * @param filename1 The first filename.
+ * @param filename2 The second filename.
+ * @return The routine returns TRUE if the files are identical, and FALSE if they are not (or an error occurs).
+ */
+static int Files_Compare(char *filename1,char *filename2)
+{
+	FILE *fp1 = NULL;
+	FILE *fp2 = NULL;
+	long offset = 0;
+	int c1,c2;
+
+	fp1 = fopen(filename1,"rb");
+	fp2 = fopen(filename2,"rb");
+	if((fp1 == NULL)||(fp2 == NULL))
+	{
+		fprintf(stderr,"Files_Compare:Failed to open '%s' or '%s'.\n",filename1,filename2);
+		if(fp1 != NULL)
+			fclose(fp1);
+		if(fp2 != NULL)
+			fclose(fp2);
+		return FALSE;
+	}
+	do
+	{
+		c1 = fgetc(fp1);
+		c2 = fgetc(fp2);
+		if(c1 != c2)
+		{
+			fprintf(stderr,"Files_Compare:'%s' and '%s' differ at byte %ld (header block %ld).\n",
+				filename1,filename2,offset,offset/CCD_FITS_IMAGE_BLOCK_LENGTH);
+			fclose(fp1);
+			fclose(fp2);
+			return FALSE;
+		}
+		offset++;
+	} while(c1 != EOF);
+	fclose(fp1);
+	fclose(fp2);
+	fprintf(stdout,"Files_Compare:'%s' and '%s' are identical (%ld bytes).\n",filename1,filename2,offset-1);
+	return TRUE;
+}
+
+/**
+ * Routine to parse command line arguments.
+ * @param argc The number of arguments sent to the program.
+ * @param argv An array of argument strings.
+ * @see #Filename_Root
+ * @see #Log_Level
+ * @see #Ncols
+ * @see #Nrows
+ * @see #Bitpix
+ * @see #Plane_Count
+ * @see #Flip_X
+ * @see #Flip_Y
+ * @see #Help
+ */
+static int Parse_Arguments(int argc, char *argv[])
+{
+	int i,retval;
+
+	for(i=1;i<argc;i++)
+	{
+		if((strcmp(argv[i],"-b")==0)||(strcmp(argv[i],"-bitpix")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Bitpix);
+				if((retval != 1)||((Bitpix != 16)&&(Bitpix != -32)&&(Bitpix != 32)))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse bitpix %s (16|-32|32).\n",
+						argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-bitpix requires a bitpix (16|-32|32).\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-f")==0)||(strcmp(argv[i],"-filename_root")==0))
+		{
+			if((i+1)<argc)
+			{
+				strncpy(Filename_Root,argv[i+1],STRING_LENGTH-32);
+				Filename_Root[STRING_LENGTH-32] = '\0';
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-filename_root requires a filename root.\n");
+				return FALSE;
+			}
+		}
+		else if(strcmp(argv[i],"-flip_x")==0)
+		{
+			Flip_X = TRUE;
+		}
+		else if(strcmp(argv[i],"-flip_y")==0)
+		{
+			Flip_Y = TRUE;
+		}
+		else if((strcmp(argv[i],"-help")==0))
+		{
+			Help();
+			return FALSE;
+		}
+		else if((strcmp(argv[i],"-l")==0)||(strcmp(argv[i],"-log_level")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Log_Level);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse log level %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-log_level requires a number 0..5.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-p")==0)||(strcmp(argv[i],"-planes")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Plane_Count);
+				if((retval != 1)||(Plane_Count < 0))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of planes %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-planes requires a number of planes.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-x")==0)||(strcmp(argv[i],"-ncols")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Ncols);
+				if((retval != 1)||(Ncols < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of columns %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-ncols requires a number of columns.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-y")==0)||(strcmp(argv[i],"-nrows")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Nrows);
+				if((retval != 1)||(Nrows < 1))
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse number of rows %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-nrows requires a number of rows.\n");
+				return FALSE;
+			}
+		}
+		else
+		{
+			fprintf(stderr,"Parse_Arguments:argument '%s' not recognized.\n",argv[i]);
+			return FALSE;
+		}
+	}/* end for */
+	if((Plane_Count > 0)&&(Bitpix != -32))
+	{
+		fprintf(stderr,"Parse_Arguments:-planes is only supported with -bitpix -32.\n");
+		return FALSE;
+	}
+	if((Flip_X||Flip_Y)&&(Bitpix == -32))
+	{
+		fprintf(stderr,"Parse_Arguments:-flip_x/-flip_y are not supported with -bitpix -32.\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Help routine.
+ */
+static void Help(void)
+{
+	fprintf(stdout,"Test FITS Image Write:Help.\n");
+	fprintf(stdout,"This program writes the same image using the native FITS writer and CFITSIO, ");
+	fprintf(stdout,"and checks the native image can be read by CFITSIO and the files are identical.\n");
+	fprintf(stdout,"test_fits_image_write [-f[ilename_root] <path>][-b|-bitpix <16|-32|32>][-x|-ncols <n>]"
+		"[-y|-nrows <n>][-p|-planes <n>][-flip_x][-flip_y][-help][-l[og_level <0..5>].\n");
+	fprintf(stdout,"\t-filename_root is the root of the FITS filenames to write - the default is "
+		"/tmp/test_fits_image_write.\n");
+	fprintf(stdout,"\t-bitpix selects the native writer tested: 16 (unsigned short, the default), "
+		"-32 (float) or 32 (integer).\n");
+	fprintf(stdout,"\t-ncols and -nrows set the image dimensions - the default is 2048 x 2048.\n");
+	fprintf(stdout,"\t-planes sets the number of planes (-bitpix -32 only), 0 for a 2D image - "
+		"the default is 0.\n");
+	fprintf(stdout,"\t-flip_x and -flip_y flip the native image as it is written (not -bitpix -32). "
+		"Use an odd -ncols/-nrows to test the centre column/row.\n");
+}
@@ -0,0 +1,49 @@
+/* moptop_calibrate.h */
+#ifndef MOPTOP_CALIBRATE_H
+#define MOPTOP_CALIBRATE_H
+
+/* hash defines */
+/**
+ * The length of the string describing where a master calibration frame came from (a filename).
+ */
+#define MOPTOP_CALIBRATE_SOURCE_LENGTH   (256)
+
+/* data types */
+/**
+ * Enum of the types of master calibration frame held in memory:
+ * <ul>
+ * <li>MOPTOP_CALIBRATE_MASTER_BIAS - The master bias, in counts.
+ * <li>MOPTOP_CALIBRATE_MASTER_DARK - The master (bias subtracted) dark, held as counts per second.
+ * <li>MOPTOP_CALIBRATE_MASTER_FLAT - The master flat field, normalised to a mean of 1.
+ * </ul>
+ */
+enum MOPTOP_CALIBRATE_MASTER
+{
+	MOPTOP_CALIBRATE_MASTER_BIAS=0,MOPTOP_CALIBRATE_MASTER_DARK=1,MOPTOP_CALIBRATE_MASTER_FLAT=2
+};
+
+/**
+ * The number of types of master calibration frame.
+ * @see #MOPTOP_CALIBRATE_MASTER
+ */
+#define MOPTOP_CALIBRATE_MASTER_COUNT    (3)
+
+/**
+ * Macro to check whether the parameter is a valid master calibration frame type.
+ * @see #MOPTOP_CALIBRATE_MASTER
+ */
+#define MOPTOP_CALIBRATE_IS_MASTER(value)	(((value) == MOPTOP_CALIBRATE_MASTER_BIAS)|| \
+						 ((value) == MOPTOP_CALIBRATE_MASTER_DARK)|| \
+						 ((value) == MOPTOP_CALIBRATE_MASTER_FLAT))
+
+/* external functions */
+extern int Moptop_Calibrate_Master_Set(enum MOPTOP_CALIBRATE_MASTER type,float *image_data,int ncols,int nrows,
+				       double exposure_length,char *source);
+extern int Moptop_Calibrate_Master_Load(enum MOPTOP_CALIBRATE_MASTER type,char *filename);
+extern int Moptop_Calibrate_Master_Bias_Subtract(float *image_data,int ncols,int nrows);
+extern int Moptop_Calibrate_Start(int ncols,int nrows,int flip_x,int flip_y,double exposure_length);
+extern int Moptop_Calibrate_Is_Enabled(void);
+extern int Moptop_Calibrate_Frame_Write(int rotation_number,unsigned short *image_data,char *filename,
+				       char *card_image_list,int card_count);
+
+#endif
@@ -1,15 +1,16 @@
 /* moptop_command.h */
 #ifndef MOPTOP_COMMAND_H
 #define MOPTOP_COMMAND_H
+#include "moptop_general.h" /* struct Moptop_General_String_Struct */
 
-extern int Moptop_Command_Abort(char *command_string,char **reply_string);
-extern int Moptop_Command_Config(char *command_string,char **reply_string);
-extern int Moptop_Command_Fits_Header(char *command_string,char **reply_string);
-extern int Moptop_Command_Multrun(char *command_string,char **reply_string);
-extern int Moptop_Command_Multrun_Setup(char *command_string,char **reply_string);
-extern int Moptop_Command_MultBias(char *command_string,char **reply_string);
-extern int Moptop_Command_MultDark(char *command_string,char **reply_string);
-extern int Moptop_Command_Status(char *command_string,char **reply_string);
-extern int Moptop_Command_Temperature(char *command_string,char **reply_string);
+extern int Moptop_Command_Abort(char *command_string,struct Moptop_General_String_Struct *reply_string);
+extern int Moptop_Command_Config(char *command_string,struct Moptop_General_String_Struct *reply_string);
+extern int Moptop_Command_Fits_Header(char *command_string,struct Moptop_General_String_Struct *reply_string);
+extern int Moptop_Command_Multrun(char *command_string,struct Moptop_General_String_Struct *reply_string);
+extern int Moptop_Command_Multrun_Setup(char *command_string,struct Moptop_General_String_Struct *reply_string);
+extern int Moptop_Command_MultBias(char *command_string,struct Moptop_General_String_Struct *reply_string);
+extern int Moptop_Command_MultDark(char *command_string,struct Moptop_General_String_Struct *reply_string);
+extern int Moptop_Command_Status(char *command_string,struct Moptop_General_String_Struct *reply_string);
+extern int Moptop_Command_Temperature(char *command_string,struct Moptop_General_String_Struct *reply_string);
 
 #endif
@@ -6,6 +6,47 @@
 #include "ccd_general.h"
 #include "ccd_fits_header.h"
 
+/* hash defines */
+/**
+ * The maximum number of cards that can be held in a FITS header template (10 FITS header blocks).
+ */
+#define MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX (360)
+/**
+ * The maximum number of per-frame (slot) cards in a FITS header template, that are overwritten for each frame.
+ */
+#define MOPTOP_FITS_HEADER_TEMPLATE_SLOT_COUNT_MAX (32)
+/**
+ * The length of a buffer big enough to hold all the card images in a FITS header template.
+ * @see #MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX
+ * @see ../ccd/cdocs/ccd_fits_header.html#CCD_FITS_HEADER_CARD_IMAGE_LENGTH
+ */
+#define MOPTOP_FITS_HEADER_TEMPLATE_LENGTH (MOPTOP_FITS_HEADER_TEMPLATE_CARD_COUNT_MAX*\
+					    CCD_FITS_HEADER_CARD_IMAGE_LENGTH)
+
+/* data types */
+/**
+ * Data type holding a FITS header template: the FITS header list pre-formatted into 80 column card images,
+ * created once per multrun. Each frame's FITS header is created by copying the card images, and then 
+ * overwriting the card images of the per-frame (slot) keywords in place.
+ * <dl>
+ * <dt>Card_Image_List</dt> <dd>The formatted card images, each CCD_FITS_HEADER_CARD_IMAGE_LENGTH characters long.</dd>
+ * <dt>Card_Count</dt> <dd>The number of card images in Card_Image_List.</dd>
+ * <dt>Slot_Keyword_List</dt> <dd>The keyword of each slot card.</dd>
+ * <dt>Slot_Index_List</dt> <dd>The index in Card_Image_List of each slot card.</dd>
+ * <dt>Slot_Count</dt> <dd>The number of slot cards.</dd>
+ * </dl>
+ * @see #MOPTOP_FITS_HEADER_TEMPLATE_LENGTH
+ * @see #MOPTOP_FITS_HEADER_TEMPLATE_SLOT_COUNT_MAX
+ */
+struct Moptop_Fits_Header_Template_Struct
+{
+	char Card_Image_List[MOPTOP_FITS_HEADER_TEMPLATE_LENGTH];
+	int Card_Count;
+	char Slot_Keyword_List[MOPTOP_FITS_HEADER_TEMPLATE_SLOT_COUNT_MAX][16];
+	int Slot_Index_List[MOPTOP_FITS_HEADER_TEMPLATE_SLOT_COUNT_MAX];
+	int Slot_Count;
+};
+
 /* external functions */
 extern int Moptop_Fits_Header_Initialise(void);
 extern int Moptop_Fits_Header_String_Add(char *keyword,char *value, char *comment);
@@ -15,9 +56,29 @@ extern int Moptop_Fits_Header_Float_Add(char *keyword,double value, char *commen
 extern int Moptop_Fits_Header_Logical_Add(char *keyword,int value, char *comment);
 extern int Moptop_Fits_Header_Delete(char *keyword);
 extern int Moptop_Fits_Header_Clear(void);
+extern int Moptop_Fits_Header_Lock(void);
+extern int Moptop_Fits_Header_Unlock(void);
+extern int Moptop_Fits_Header_Template_Create(struct Moptop_Fits_Header_Template_Struct *header_template,
+					      char **slot_keyword_list,int slot_count);
+extern void Moptop_Fits_Header_Template_Copy(struct Moptop_Fits_Header_Template_Struct *header_template,
+					     char *card_image_list);
+extern int Moptop_Fits_Header_Template_String_Set(struct Moptop_Fits_Header_Template_Struct *header_template,
+						  char *card_image_list,int slot,char *value);
+extern int Moptop_Fits_Header_Template_Integer_Set(struct Moptop_Fits_Header_Template_Struct *header_template,
+						   char *card_image_list,int slot,int value);
+extern int Moptop_Fits_Header_Template_Float_Set(struct Moptop_Fits_Header_Template_Struct *header_template,
+						 char *card_image_list,int slot,double value);
+extern int Moptop_Fits_Header_Template_Float_Scale(struct Moptop_Fits_Header_Template_Struct *header_template,
+					      char *keyword,double scale);
+extern int Moptop_Fits_Header_Template_Keyword_Float_Set(struct Moptop_Fits_Header_Template_Struct *header_template,
+							 char *card_image_list,char *keyword,double value);
+extern int Moptop_Fits_Header_Template_Write_To_Fits(struct Moptop_Fits_Header_Template_Struct *header_template,
+						     char *card_image_list,fitsfile *fits_fp);
 extern void Moptop_Fits_Header_TimeSpec_To_Date_String(struct timespec time,char *time_string);
 extern void Moptop_Fits_Header_TimeSpec_To_Date_Obs_String(struct timespec time,char *time_string);
 extern void Moptop_Fits_Header_TimeSpec_To_UtStart_String(struct timespec time,char *time_string);
+extern void Moptop_Fits_Header_TimeSpec_To_Strings(struct timespec time,char *date_string,char *date_obs_string,
+						   char *utstart_string);
 extern int Moptop_Fits_Header_TimeSpec_To_Mjd(struct timespec time,int leap_second_correction,double *mjd);
 
 #endif
@@ -4,6 +4,7 @@
 #define MOPTOP_GENERAL_H
 
 #include <pthread.h>
+#include <stddef.h>
 
 /* hash defines */
 /**
@@ -74,9 +75,28 @@
 #define fdifftime(t1, t0) (((double)(((t1).tv_sec)-((t0).tv_sec))+(double)(((t1).tv_nsec)-((t0).tv_nsec))/MOPTOP_GENERAL_ONE_SECOND_NS))
 #endif
 
+/* data types */
+/**
+ * Data type holding a string built up by Moptop_General_Add_String, for instance a command's reply string.
+ * The string's length and allocated length are stored with it, so appending does not have to measure the string,
+ * and the buffer is only reallocated (doubling it's length) when it is full.
+ * A new string should be initialised to {NULL,0,0}, and freed with Moptop_General_String_Free.
+ * <dl>
+ * <dt>String</dt> <dd>The allocated string, or NULL if nothing has been added yet.</dd>
+ * <dt>Length</dt> <dd>The length of String, not including the '\0' terminator.</dd>
+ * <dt>Allocated</dt> <dd>The number of characters allocated for String.</dd>
+ * </dl>
+ */
+struct Moptop_General_String_Struct
+{
+	char *String;
+	size_t Length;
+	size_t Allocated;
+};
+
 /* external variabless */
-extern int Moptop_General_Error_Number;
-extern char Moptop_General_Error_String[];
+extern __thread int Moptop_General_Error_Number;
+extern __thread char Moptop_General_Error_String[];
 
 /* external functions */
 extern void Moptop_General_Error(char *sub_system,char *source_filename,char *function,int level,char *category);
@@ -120,10 +140,12 @@ extern int Moptop_General_Log_Filter_Level_Bitwise(char *sub_system,char *source
 						   int level,char *category,char *message);
 
 /* utility routines */
-extern int Moptop_General_Add_String(char **string,char *add);
-extern int Moptop_General_Add_Integer_To_String(char **string,int i);
+extern int Moptop_General_Add_String(struct Moptop_General_String_Struct *string,char *add);
+extern int Moptop_General_Add_Integer_To_String(struct Moptop_General_String_Struct *string,int i);
+extern void Moptop_General_String_Free(struct Moptop_General_String_Struct *string);
 extern int Moptop_General_Int_List_Add(int add,int **list,int *count);
 extern int Moptop_General_Int_List_Sort(const void *f,const void *s);
+extern void Moptop_General_Float_Plane_Flip(float *plane,int ncols,int nrows,int flip_x,int flip_y);
 extern int Moptop_General_Mutex_Lock(pthread_mutex_t *mutex);
 extern int Moptop_General_Mutex_Unlock(pthread_mutex_t *mutex);
 extern int Moptop_General_Thread_Priority_Set_Normal(void);
@@ -0,0 +1,20 @@
+/* moptop_master.h */
+#ifndef MOPTOP_MASTER_H
+#define MOPTOP_MASTER_H
+#include "moptop_calibrate.h" /* enum MOPTOP_CALIBRATE_MASTER */
+
+/* hash defines */
+/**
+ * The maximum number of frames kept in memory for the sigma clipping pass of the master frame combination.
+ * Each pixel's rejection count is held in an unsigned char, so this must be less than 256.
+ */
+#define MOPTOP_MASTER_WINDOW_COUNT_MAX   (255)
+
+/* external functions */
+extern int Moptop_Master_Start(enum MOPTOP_CALIBRATE_MASTER type,int image_count,int ncols,int nrows,
+			       double exposure_length);
+extern int Moptop_Master_Is_Enabled(void);
+extern int Moptop_Master_Frame_Add(int image_index,unsigned short *image_data,int *master_complete);
+extern int Moptop_Master_Write(char *filename,char *card_image_list,int card_count,int flip_x,int flip_y);
+
+#endif
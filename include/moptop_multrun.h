@@ -6,6 +6,7 @@
 extern int Moptop_Multrun_Exposure_Length_Set(double exposure_length_s);
 extern int Moptop_Multrun_Filter_Name_Set(char *filter_name);
 extern int Moptop_Multrun_Flip_Set(int flip_x,int flip_y);
+extern int Moptop_Multrun_Output_Mode_Set(char *output_mode);
 extern int Moptop_Multrun_Setup(int *multrun_number);
 extern int Moptop_Multrun(int exposure_length_ms,int use_exposure_length,int exposure_count,int use_exposure_count,
 			  int do_standard,char ***filename_list,int *filename_count);
@@ -17,6 +18,7 @@ extern int Moptop_Multrun_Count_Get(void);
 extern int Moptop_Multrun_Per_Frame_Exposure_Length_Get(void);
 extern int Moptop_Multrun_Exposure_Start_Time_Get(struct timespec *exposure_start_time);
 extern int Moptop_Multrun_Exposure_Index_Get(void);
+extern int Moptop_Multrun_Dropped_Frame_Count_Get(void);
 extern int Moptop_Multrun_Multrun_Get(void);
 extern int Moptop_Multrun_Run_Get(void);
 extern int Moptop_Multrun_Window_Get(void);
@@ -0,0 +1,30 @@
+/* moptop_reduce.h */
+#ifndef MOPTOP_REDUCE_H
+#define MOPTOP_REDUCE_H
+
+/* hash defines */
+/**
+ * The maximum number of frames in one rotation of the rotator that can be reduced
+ * (the largest images per cycle, for the smallest rotator step angle).
+ */
+#define MOPTOP_REDUCE_SEQUENCE_COUNT_MAX  (64)
+/**
+ * The number of image planes in a reduced product: the mean intensity (Stokes I), and the normalised
+ * Stokes q (Q/I) and u (U/I).
+ */
+#define MOPTOP_REDUCE_PLANE_COUNT         (3)
+
+/* external functions */
+extern int Moptop_Reduce_Start(int images_per_cycle,int image_count,int ncols,int nrows,double step_angle,
+			       double run_velocity,double exposure_length);
+extern int Moptop_Reduce_Is_Enabled(void);
+extern int Moptop_Reduce_Frame_Add(int rotation_number,int sequence_number,unsigned short *image_data,
+				   int *rotation_complete);
+extern int Moptop_Reduce_Frame_Dropped(int rotation_number);
+extern int Moptop_Reduce_Rotation_Write(int rotation_number,char *filename,char *card_image_list,int card_count,
+					int flip_x,int flip_y);
+extern int Moptop_Reduce_Rotation_Discard(int rotation_number);
+extern void Moptop_Reduce_Stop(void);
+extern void Moptop_Reduce_Count_Get(int *reduced_count,int *skipped_count);
+
+#endif
@@ -0,0 +1,28 @@
+/* moptop_stack.h */
+#ifndef MOPTOP_STACK_H
+#define MOPTOP_STACK_H
+#include "moptop_writer.h" /* struct Moptop_Writer_Frame_Struct */
+
+/* hash defines */
+/**
+ * The maximum number of rotator positions (frames in one rotation of the rotator) that can be stacked
+ * (the largest images per cycle, for the smallest rotator step angle).
+ */
+#define MOPTOP_STACK_POSITION_COUNT_MAX  (64)
+/**
+ * The maximum number of rotations that can be stacked in one multrun. Each frame adds at most 65535 counts
+ * to an accumulator pixel, so this many frames can be added without exceeding the range of the (signed) 
+ * 32 bit integer FITS image it is written to.
+ */
+#define MOPTOP_STACK_ROTATION_COUNT_MAX  (32768)
+
+/* external functions */
+extern int Moptop_Stack_Start(int images_per_cycle,int image_count,int ncols,int nrows);
+extern int Moptop_Stack_Frame_Add(struct Moptop_Writer_Frame_Struct *frame);
+extern int Moptop_Stack_Position_Get(int sequence_number,struct Moptop_Writer_Frame_Struct *header_frame,
+				     int *frame_count,int *first_rotation_number,int *last_rotation_number,
+				     double *exposure_length_sum);
+extern int Moptop_Stack_Position_Write(int sequence_number,char *filename,char *card_image_list,int card_count,
+				       int flip_x,int flip_y);
+
+#endif
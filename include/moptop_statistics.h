@@ -0,0 +1,37 @@
+/* moptop_statistics.h */
+#ifndef MOPTOP_STATISTICS_H
+#define MOPTOP_STATISTICS_H
+
+/* data types */
+/**
+ * Data type holding the image statistics of one frame.
+ * <dl>
+ * <dt>Pixel_Count</dt> <dd>The number of pixels in the frame.</dd>
+ * <dt>Mean</dt> <dd>The mean pixel value, in counts.</dd>
+ * <dt>Median</dt> <dd>The median pixel value, in counts (the mean of the two middle values, for an even number
+ *                     of pixels).</dd>
+ * <dt>Standard_Deviation</dt> <dd>The (sample) standard deviation of the pixel values, in counts.</dd>
+ * <dt>Minimum</dt> <dd>The minimum pixel value, in counts.</dd>
+ * <dt>Maximum</dt> <dd>The maximum pixel value, in counts.</dd>
+ * <dt>Saturated_Count</dt> <dd>The number of pixels at or above the saturation level.</dd>
+ * </dl>
+ */
+struct Moptop_Statistics_Struct
+{
+	int Pixel_Count;
+	double Mean;
+	double Median;
+	double Standard_Deviation;
+	int Minimum;
+	int Maximum;
+	int Saturated_Count;
+};
+
+/* external functions */
+extern int Moptop_Statistics_Start(void);
+extern int Moptop_Statistics_Is_Enabled(void);
+extern int Moptop_Statistics_Frame_Compute(unsigned short *image_data,int pixel_count,
+					   struct Moptop_Statistics_Struct *statistics);
+extern int Moptop_Statistics_Latest_Get(struct Moptop_Statistics_Struct *statistics);
+
+#endif
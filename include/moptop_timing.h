@@ -0,0 +1,133 @@
+/* moptop_timing.h */
+#ifndef MOPTOP_TIMING_H
+#define MOPTOP_TIMING_H
+#include <time.h> /* struct timespec */
+
+/* hash defines */
+/**
+ * The number of histogram buckets kept for each timing type. Durations are binned in microseconds,
+ * with 16 linear sub-buckets per power of two, giving a resolution of about 6% from 1 microsecond to 2^30
+ * microseconds (about 18 minutes). Longer durations are put in the last bucket.
+ */
+#define MOPTOP_TIMING_BUCKET_COUNT      (448)
+/**
+ * The number of timing sets (MOPTOP_TIMING_SET enum values).
+ * @see #MOPTOP_TIMING_SET
+ */
+#define MOPTOP_TIMING_SET_COUNT         (2)
+/**
+ * The number of timing types (MOPTOP_TIMING_TYPE enum values).
+ * @see #MOPTOP_TIMING_TYPE
+ */
+#define MOPTOP_TIMING_TYPE_COUNT        (19)
+/**
+ * The length of the string returned by Moptop_Timing_Summary_Get that is guaranteed to hold the summary of
+ * all the timing types in a set.
+ */
+#define MOPTOP_TIMING_SUMMARY_STRING_LENGTH (2048)
+
+/**
+ * Enum of the sets of timing histograms, one per type of acquisition:
+ * <ul>
+ * <li>MOPTOP_TIMING_SET_MULTRUN
+ * <li>MOPTOP_TIMING_SET_BIAS_DARK
+ * </ul>
+ */
+enum MOPTOP_TIMING_SET
+{
+	MOPTOP_TIMING_SET_MULTRUN=0,MOPTOP_TIMING_SET_BIAS_DARK
+};
+
+/**
+ * Macro to check whether the parameter is a valid timing set.
+ * @see #MOPTOP_TIMING_SET
+ */
+#define MOPTOP_TIMING_IS_SET(value)	(((value) == MOPTOP_TIMING_SET_MULTRUN)|| \
+					 ((value) == MOPTOP_TIMING_SET_BIAS_DARK))
+
+/**
+ * Enum of the parts of the per-frame acquire/write path that are timed:
+ * <ul>
+ * <li>MOPTOP_TIMING_TYPE_GRABBER_WAIT - Waiting for the grabber to return a read out image.
+ * <li>MOPTOP_TIMING_TYPE_ROTATOR_QUERY - Querying the rotator position (PIROT_Command_Query_POS).
+ * <li>MOPTOP_TIMING_TYPE_METADATA_DECODE - Decoding the image number and timestamp from the image meta-data.
+ * <li>MOPTOP_TIMING_TYPE_FRAME_GET - Waiting for a free frame from the writer threads.
+ * <li>MOPTOP_TIMING_TYPE_FRAME_INTERVAL - The time between successive frames being read out.
+ * <li>MOPTOP_TIMING_TYPE_FILENAME_LOCK - Creating the FITS filename lock file (CCD_Fits_Filename_Lock).
+ * <li>MOPTOP_TIMING_TYPE_FITS_CREATE - Creating the FITS file and image (fits_create_file / fits_create_img).
+ * <li>MOPTOP_TIMING_TYPE_HEADER - Copying and patching the FITS header template.
+ * <li>MOPTOP_TIMING_TYPE_IMAGE_CONVERT - Flipping the image data, and (for the native FITS writer) converting
+ *     it to FITS format (CCD_Fits_Image_Data_Convert).
+ * <li>MOPTOP_TIMING_TYPE_FITS_WRITE - Writing the FITS headers and image data, or the whole file
+ *     (create, write and close) when the native FITS writer is in use.
+ * <li>MOPTOP_TIMING_TYPE_FITS_CLOSE - Closing the FITS file (fits_close_file).
+ * <li>MOPTOP_TIMING_TYPE_FILENAME_UNLOCK - Removing the FITS filename lock file (CCD_Fits_Filename_UnLock).
+ * <li>MOPTOP_TIMING_TYPE_FILE_SYNC - Flushing written FITS files to disk (fdatasync / syncfs) before they are
+ *     published, as configured by the writer durability policy.
+ * <li>MOPTOP_TIMING_TYPE_STAGE_FLUSH - Writing a FITS image staged in memory to disk, on the writer's staging
+ *     flush thread.
+ * <li>MOPTOP_TIMING_TYPE_REDUCE - Accumulating a frame into it's rotation's real time Stokes reduction
+ *     (Moptop_Reduce_Frame_Add).
+ * <li>MOPTOP_TIMING_TYPE_STACK - Adding a frame into it's rotator position's stack, in stack output mode.
+ * <li>MOPTOP_TIMING_TYPE_CALIBRATE - Applying the master calibration frames to a frame, in the real time 
+ *     calibration (Moptop_Calibrate_Frame_Write).
+ * <li>MOPTOP_TIMING_TYPE_MASTER - Accumulating a bias/dark frame into the streaming master frame combination
+ *     (Moptop_Master_Frame_Add).
+ * <li>MOPTOP_TIMING_TYPE_STATISTICS - Computing a frame's image statistics for it's FITS headers
+ *     (Moptop_Statistics_Frame_Compute).
+ * </ul>
+ */
+enum MOPTOP_TIMING_TYPE
+{
+	MOPTOP_TIMING_TYPE_GRABBER_WAIT=0,MOPTOP_TIMING_TYPE_ROTATOR_QUERY,MOPTOP_TIMING_TYPE_METADATA_DECODE,
+	MOPTOP_TIMING_TYPE_FRAME_GET,MOPTOP_TIMING_TYPE_FRAME_INTERVAL,MOPTOP_TIMING_TYPE_FILENAME_LOCK,
+	MOPTOP_TIMING_TYPE_FITS_CREATE,MOPTOP_TIMING_TYPE_HEADER,MOPTOP_TIMING_TYPE_IMAGE_CONVERT,
+	MOPTOP_TIMING_TYPE_FITS_WRITE,MOPTOP_TIMING_TYPE_FITS_CLOSE,MOPTOP_TIMING_TYPE_FILENAME_UNLOCK,
+	MOPTOP_TIMING_TYPE_FILE_SYNC,MOPTOP_TIMING_TYPE_STAGE_FLUSH,MOPTOP_TIMING_TYPE_REDUCE,
+	MOPTOP_TIMING_TYPE_STACK,MOPTOP_TIMING_TYPE_CALIBRATE,MOPTOP_TIMING_TYPE_MASTER,
+	MOPTOP_TIMING_TYPE_STATISTICS
+};
+
+/**
+ * Macro to check whether the parameter is a valid timing type.
+ * @see #MOPTOP_TIMING_TYPE
+ * @see #MOPTOP_TIMING_TYPE_COUNT
+ */
+#define MOPTOP_TIMING_IS_TYPE(value)	(((value) >= MOPTOP_TIMING_TYPE_GRABBER_WAIT)&& \
+					 ((value) < MOPTOP_TIMING_TYPE_COUNT))
+
+/**
+ * Data type holding the statistics computed from one timing histogram. All times are in seconds.
+ * The percentiles are the upper edge of the histogram bucket the percentile falls in (limited to Max),
+ * so are accurate to about 6%.
+ * <dl>
+ * <dt>Count</dt> <dd>The number of durations recorded.</dd>
+ * <dt>Mean</dt> <dd>The mean duration.</dd>
+ * <dt>P50</dt> <dd>The median duration.</dd>
+ * <dt>P95</dt> <dd>The 95th percentile duration.</dd>
+ * <dt>P99</dt> <dd>The 99th percentile duration.</dd>
+ * <dt>Max</dt> <dd>The longest duration recorded.</dd>
+ * </dl>
+ */
+struct Moptop_Timing_Statistics_Struct
+{
+	int Count;
+	double Mean;
+	double P50;
+	double P95;
+	double P99;
+	double Max;
+};
+
+extern int Moptop_Timing_Reset(enum MOPTOP_TIMING_SET set);
+extern int Moptop_Timing_Add(enum MOPTOP_TIMING_SET set,enum MOPTOP_TIMING_TYPE type,struct timespec start_time,
+			     struct timespec end_time);
+extern int Moptop_Timing_Statistics_Get(enum MOPTOP_TIMING_SET set,enum MOPTOP_TIMING_TYPE type,
+					struct Moptop_Timing_Statistics_Struct *statistics);
+extern int Moptop_Timing_Summary_Get(enum MOPTOP_TIMING_SET set,char *summary_string,int summary_string_length);
+extern int Moptop_Timing_Summary_Write(enum MOPTOP_TIMING_SET set,char *fits_filename);
+extern int Moptop_Timing_Set_From_String(char *set_string,enum MOPTOP_TIMING_SET *set);
+extern int Moptop_Timing_Type_From_String(char *type_string,enum MOPTOP_TIMING_TYPE *type);
+extern char *Moptop_Timing_Type_To_String(enum MOPTOP_TIMING_TYPE type);
+
+#endif
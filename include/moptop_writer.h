@@ -0,0 +1,204 @@
+/* moptop_writer.h */
+#ifndef MOPTOP_WRITER_H
+#define MOPTOP_WRITER_H
+#include <time.h> /* struct timespec */
+#include "moptop_timing.h" /* enum MOPTOP_TIMING_SET */
+#include "moptop_statistics.h" /* struct Moptop_Statistics_Struct */
+
+/* hash defines */
+/**
+ * Length of the FITS filename string held in each frame.
+ */
+#define MOPTOP_WRITER_FILENAME_LENGTH  (256)
+/**
+ * The maximum number of writer threads that can be configured (moptop.multrun.writer.thread.count).
+ */
+#define MOPTOP_WRITER_THREAD_COUNT_MAX  (8)
+
+/* data types */
+/**
+ * Enum of how the writer makes sure written FITS files are on disk before they are published
+ * (moptop.multrun.writer.durability):
+ * <ul>
+ * <li>MOPTOP_WRITER_DURABILITY_NONE - Files are published as soon as they are written, and are never synced.
+ * <li>MOPTOP_WRITER_DURABILITY_FRAME - Each file is flushed to disk (fdatasync) before it is published.
+ * <li>MOPTOP_WRITER_DURABILITY_ROTATION - Files are published in groups, one group per rotation. When all the
+ *     frames in a rotation have been written (or dropped), the file system is synced (syncfs) once, and then
+ *     all the rotation's files are published.
+ * <li>MOPTOP_WRITER_DURABILITY_MULTRUN - As MOPTOP_WRITER_DURABILITY_ROTATION, but all the files in the
+ *     acquisition are one group, synced and published when the writer is stopped.
+ * </ul>
+ * For all the policies except NONE, the directory the files are in is also flushed to disk (fsync) once the
+ * group has been published, so the published filenames are durable as well as the files' data.
+ */
+enum MOPTOP_WRITER_DURABILITY
+{
+	MOPTOP_WRITER_DURABILITY_NONE=0,MOPTOP_WRITER_DURABILITY_FRAME=1,MOPTOP_WRITER_DURABILITY_ROTATION=2,
+	MOPTOP_WRITER_DURABILITY_MULTRUN=3
+};
+
+/**
+ * Macro to check whether the parameter is a valid durability policy.
+ * @see #MOPTOP_WRITER_DURABILITY
+ */
+#define MOPTOP_WRITER_IS_DURABILITY(value)	(((value) == MOPTOP_WRITER_DURABILITY_NONE)|| \
+						 ((value) == MOPTOP_WRITER_DURABILITY_FRAME)|| \
+						 ((value) == MOPTOP_WRITER_DURABILITY_ROTATION)|| \
+						 ((value) == MOPTOP_WRITER_DURABILITY_MULTRUN))
+
+/**
+ * Data type holding a read out frame, and all the per-frame data needed to save it to disk.
+ * <dl>
+ * <dt>Frame_Index</dt> <dd>The index of this frame in the writer's list of frames.</dd>
+ * <dt>Buffer_Index</dt> <dd>The index of the CCD library image buffer acquired for this frame (CCD_Buffer_Acquire).</dd>
+ * <dt>Image_Buffer</dt> <dd>A pointer to the CCD library image buffer holding the read out image data.</dd>
+ * <dt>Image_Buffer_Length</dt> <dd>The length of the read out data in Image_Buffer, in bytes.</dd>
+ * <dt>Filename</dt> <dd>The FITS filename to save the frame to, of length MOPTOP_WRITER_FILENAME_LENGTH.</dd>
+ * <dt>Image_Index</dt> <dd>Which frame in the multrun this is (the index of the rotator trigger that started it).</dd>
+ * <dt>Do_Standard</dt> <dd>A boolean, if TRUE this is an observation of a standard.</dd>
+ * <dt>Exposure_Length</dt> <dd>The exposure length as retrieved from the camera, in seconds.</dd>
+ * <dt>Exposure_Start_Time</dt> <dd>A timestamp taken just before we started waiting for this frame.</dd>
+ * <dt>Exposure_End_Time</dt> <dd>A timestamp taken just after this frame was read out.</dd>
+ * <dt>Camera_Image_Number</dt> <dd>The camera image number extracted from the read out image's meta-data.</dd>
+ * <dt>Camera_Timestamp</dt> <dd>The camera timestamp extracted from the read out image's meta-data.</dd>
+ * <dt>Camera_UTC_Time</dt> <dd>The camera timestamp converted to UTC by the camera clock model
+ *                            (CCD_Clock_Model_Camera_To_UTC), corrected for the camera clock's drift.</dd>
+ * <dt>Camera_UTC_Uncertainty</dt> <dd>The estimated uncertainty of Camera_UTC_Time in seconds,
+ *                                   or negative if the clock model could not yet estimate one.</dd>
+ * <dt>Rotation_Number</dt> <dd>Which rotation of the rotator this frame was taken in.</dd>
+ * <dt>Sequence_Number</dt> <dd>Which image in the rotation this frame is.</dd>
+ * <dt>Requested_Rotator_Angle</dt> <dd>The requested rotator angle at the start of the exposure, in degrees.</dd>
+ * <dt>Rotator_Start_Angle</dt> <dd>The rotator angle _in the current rotation_ at the start of the exposure,
+ *                                  in degrees.</dd>
+ * <dt>Rotator_End_Angle</dt> <dd>The rotator angle _in the current rotation_ at the end of the exposure,
+ *                                in degrees.</dd>
+ * <dt>Rotator_Difference</dt> <dd>The difference between the rotator start and end angles, in degrees.</dd>
+ * <dt>Dropped_Frame_Count</dt> <dd>The number of frames dropped in the multrun before this frame was acquired.</dd>
+ * <dt>Statistics</dt> <dd>The frame's image statistics, computed by the writer thread before the frame is written,
+ *                         and put into the frame's FITS headers.</dd>
+ * </dl>
+ * @see #MOPTOP_WRITER_FILENAME_LENGTH
+ */
+struct Moptop_Writer_Frame_Struct
+{
+	int Frame_Index;
+	int Buffer_Index;
+	unsigned char *Image_Buffer;
+	int Image_Buffer_Length;
+	char Filename[MOPTOP_WRITER_FILENAME_LENGTH];
+	int Image_Index;
+	int Do_Standard;
+	double Exposure_Length;
+	struct timespec Exposure_Start_Time;
+	struct timespec Exposure_End_Time;
+	int Camera_Image_Number;
+	struct timespec Camera_Timestamp;
+	struct timespec Camera_UTC_Time;
+	double Camera_UTC_Uncertainty;
+	int Rotation_Number;
+	int Sequence_Number;
+	double Requested_Rotator_Angle;
+	double Rotator_Start_Angle;
+	double Rotator_End_Angle;
+	double Rotator_Difference;
+	int Dropped_Frame_Count;
+	struct Moptop_Statistics_Struct Statistics;
+};
+
+/**
+ * Data type holding statistics on how well the writer threads are keeping up with acquisition,
+ * collected between Moptop_Writer_Start and Moptop_Writer_Stop.
+ * <dl>
+ * <dt>Thread_Count</dt> <dd>The number of writer threads in use.</dd>
+ * <dt>Queue_Length</dt> <dd>The number of frames that can be queued or being written at once.</dd>
+ * <dt>Frames_Written</dt> <dd>The number of frames successfully written to disk.</dd>
+ * <dt>Queue_High_Water</dt> <dd>The maximum number of frames that were queued or being written at once.
+ *     If this reaches Queue_Length, acquisition has had to wait for the writer threads.</dd>
+ * <dt>Blocked_Count</dt> <dd>The number of times the acquisition thread had to wait for a free frame.</dd>
+ * <dt>Blocked_Time</dt> <dd>The total time the acquisition thread spent waiting for a free frame, in seconds.</dd>
+ * <dt>Blocked_Time_Max</dt> <dd>The longest single wait for a free frame, in seconds.</dd>
+ * <dt>Compressed_Count</dt> <dd>The number of frames written tile compressed.</dd>
+ * <dt>Uncompressed_Bytes</dt> <dd>The total size of the image data of the compressed frames, before compression,
+ *     in bytes.</dd>
+ * <dt>Compressed_Bytes</dt> <dd>The total size of the compressed FITS files, in bytes.</dd>
+ * <dt>Compress_CPU_Time</dt> <dd>The total CPU time the writer threads spent compressing and writing the 
+ *     compressed frames, in seconds.</dd>
+ * <dt>Durability</dt> <dd>The durability policy in use, a MOPTOP_WRITER_DURABILITY.</dd>
+ * <dt>Sync_Count</dt> <dd>The number of times files were flushed to disk (one per file for the FRAME policy,
+ *     one per group otherwise), plus one directory sync per published group.</dd>
+ * <dt>Synced_File_Count</dt> <dd>The number of files made durable by those syncs.</dd>
+ * <dt>Sync_Time</dt> <dd>The total time spent flushing files and directories to disk, in seconds.</dd>
+ * <dt>Sync_Time_Max</dt> <dd>The longest single sync, in seconds.</dd>
+ * <dt>Stage_Enable</dt> <dd>A boolean, TRUE if written frames are staged in memory and flushed to disk by the
+ *     staging flush thread.</dd>
+ * <dt>Stage_Size</dt> <dd>The size of the staging arena, in bytes.</dd>
+ * <dt>Stage_Arena_Locked</dt> <dd>A boolean, TRUE if the staging arena is locked into RAM (mlock).</dd>
+ * <dt>Stage_Used</dt> <dd>The number of bytes of the staging arena currently holding frames waiting to be
+ *     flushed to disk.</dd>
+ * <dt>Stage_Used_High_Water</dt> <dd>The maximum value Stage_Used has reached.</dd>
+ * <dt>Stage_Frame_Count</dt> <dd>The number of frames currently in the staging arena.</dd>
+ * <dt>Stage_Frames_Flushed</dt> <dd>The number of staged frames written to disk.</dd>
+ * <dt>Stage_Blocked_Count</dt> <dd>The number of times a writer thread had to wait for space in the staging 
+ *     arena.</dd>
+ * <dt>Stage_Blocked_Time</dt> <dd>The total time writer threads spent waiting for space in the staging arena,
+ *     in seconds.</dd>
+ * </dl>
+ * @see #MOPTOP_WRITER_DURABILITY
+ */
+struct Moptop_Writer_Statistics_Struct
+{
+	int Thread_Count;
+	int Queue_Length;
+	int Frames_Written;
+	int Queue_High_Water;
+	int Blocked_Count;
+	double Blocked_Time;
+	double Blocked_Time_Max;
+	int Compressed_Count;
+	long long int Uncompressed_Bytes;
+	long long int Compressed_Bytes;
+	double Compress_CPU_Time;
+	enum MOPTOP_WRITER_DURABILITY Durability;
+	int Sync_Count;
+	int Synced_File_Count;
+	double Sync_Time;
+	double Sync_Time_Max;
+	int Stage_Enable;
+	long long int Stage_Size;
+	int Stage_Arena_Locked;
+	long long int Stage_Used;
+	long long int Stage_Used_High_Water;
+	int Stage_Frame_Count;
+	int Stage_Frames_Flushed;
+	int Stage_Blocked_Count;
+	double Stage_Blocked_Time;
+};
+
+/**
+ * Typedef of the function called by the writer threads to save a frame to disk. As several writer threads
+ * can call this function at once (each with a different frame), it must be thread safe.
+ * The function should return TRUE on success, and FALSE (with Moptop_General_Error_Number /
+ * Moptop_General_Error_String set) on failure.
+ * @see #Moptop_Writer_Frame_Struct
+ */
+typedef int (*Moptop_Writer_Write_Function_T)(struct Moptop_Writer_Frame_Struct *frame);
+
+extern int Moptop_Writer_Start(Moptop_Writer_Write_Function_T write_function,enum MOPTOP_TIMING_SET timing_set,
+			       int group_size);
+extern int Moptop_Writer_Frame_Get(struct Moptop_Writer_Frame_Struct **frame);
+extern int Moptop_Writer_Frame_Put(struct Moptop_Writer_Frame_Struct *frame);
+extern int Moptop_Writer_Frame_Queue(struct Moptop_Writer_Frame_Struct *frame);
+extern int Moptop_Writer_Stop(int report_error);
+extern int Moptop_Writer_Has_Failed(void);
+extern int Moptop_Writer_Statistics_Get(struct Moptop_Writer_Statistics_Struct *statistics);
+extern int Moptop_Writer_Compression_Add(long long int uncompressed_bytes,long long int compressed_bytes,
+					 double cpu_time);
+extern int Moptop_Writer_Publish(char *write_filename,int group_number,int frame_count);
+extern int Moptop_Writer_Publish_Hold(void);
+extern int Moptop_Writer_Publish_Release(int report_error);
+extern char *Moptop_Writer_Durability_To_String(enum MOPTOP_WRITER_DURABILITY durability);
+extern int Moptop_Writer_Stage_Is_Enabled(void);
+extern int Moptop_Writer_Stage(char *filename,int group_number,char *card_image_list,int card_count,int ncols,
+			       int nrows,unsigned short *image_data);
+
+#endif
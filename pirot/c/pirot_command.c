@@ -770,6 +770,390 @@ int PIROT_Command_Query_POS(double *position)
 	return TRUE;
 }
 
+/**
+ * Set the data recorder's record table rate. Uses the PI rotator library "PI_RTR" routine / "RTR" command.
+ * The data recorder records a value every record_table_rate servo cycles (PIROT_COMMAND_SERVO_CYCLE_TIME seconds).
+ * @param record_table_rate The record table rate, in servo cycles, of at least 1.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #Command_Error_Number
+ * @see #Command_Error_String
+ * @see #PIROT_Command_Get_PI_Library_Error
+ * @see #PIROT_COMMAND_SERVO_CYCLE_TIME
+ * @see pirot_usb.html#PIROT_USB_Get_ID
+ * @see pirot_general.html#PIROT_Log_Format
+ * @see pirot_general.html#PIROT_Mutex_Lock
+ * @see pirot_general.html#PIROT_Mutex_Unlock
+ */
+int PIROT_Command_RTR(int record_table_rate)
+{
+        int retval,pi_error_num;
+	char pi_error_string[STRING_LENGTH];
+
+	Command_Error_Number = 0;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Command_RTR(record_table_rate=%d): Started.",record_table_rate);
+#endif /* LOGGING */
+	if(record_table_rate < 1)
+	{
+		Command_Error_Number = 45;
+		sprintf(Command_Error_String,"PIROT_Command_RTR: record_table_rate %d out of range.",record_table_rate);
+		return FALSE;
+	}
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Lock())
+	{
+		Command_Error_Number = 46;
+		sprintf(Command_Error_String,"PIROT_Command_RTR: failed to lock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,"PIROT_Command_RTR: PI_RTR(usb_id=%d,record_table_rate=%d).",
+			 PIROT_USB_Get_ID(),record_table_rate);
+#endif /* LOGGING */
+	retval = PI_RTR(PIROT_USB_Get_ID(),record_table_rate);
+	if(retval != TRUE)
+	{
+#ifdef MUTEXED
+		PIROT_Mutex_Unlock();
+#endif /* MUTEXED */
+		PIROT_Command_Get_PI_Library_Error(&pi_error_num,pi_error_string,STRING_LENGTH);
+		Command_Error_Number = 47;
+		sprintf(Command_Error_String,"PIROT_Command_RTR: PI_RTR failed (%d) : %s.",pi_error_num,
+			pi_error_string);
+		return FALSE;
+	}
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Unlock())
+	{
+		Command_Error_Number = 48;
+		sprintf(Command_Error_String,"PIROT_Command_RTR: failed to unlock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Command_RTR: Finished.");
+#endif /* LOGGING */
+	return TRUE;
+}
+
+/**
+ * Configure what a data recorder table records. Uses the PI rotator library "PI_DRC" routine / "DRC" command.
+ * The record source is always the rotator axis (COMMAND_ROTATOR_AXIS).
+ * @param record_table_id The data recorder table to configure, from 1 to PIROT_COMMAND_RECORD_TABLE_COUNT.
+ * @param record_option What to record for the rotator axis, e.g. DRC_OPTION_CURRENT_POSITION.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #COMMAND_ROTATOR_AXIS
+ * @see #Command_Error_Number
+ * @see #Command_Error_String
+ * @see #PIROT_Command_Get_PI_Library_Error
+ * @see #PIROT_COMMAND_RECORD_TABLE_COUNT
+ * @see #PIROT_COMMAND_DRC_OPTION_ENUM
+ * @see pirot_usb.html#PIROT_USB_Get_ID
+ * @see pirot_general.html#PIROT_Log_Format
+ * @see pirot_general.html#PIROT_Mutex_Lock
+ * @see pirot_general.html#PIROT_Mutex_Unlock
+ */
+int PIROT_Command_DRC(int record_table_id,enum PIROT_COMMAND_DRC_OPTION_ENUM record_option)
+{
+        int retval,pi_error_num,option;
+	char pi_error_string[STRING_LENGTH];
+
+	Command_Error_Number = 0;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Command_DRC(record_table_id=%d,record_option=%d): Started.",
+			 record_table_id,record_option);
+#endif /* LOGGING */
+	if((record_table_id < 1)||(record_table_id > PIROT_COMMAND_RECORD_TABLE_COUNT))
+	{
+		Command_Error_Number = 49;
+		sprintf(Command_Error_String,"PIROT_Command_DRC: record_table_id %d out of range (1..%d).",
+			record_table_id,PIROT_COMMAND_RECORD_TABLE_COUNT);
+		return FALSE;
+	}
+	option = record_option;
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Lock())
+	{
+		Command_Error_Number = 50;
+		sprintf(Command_Error_String,"PIROT_Command_DRC: failed to lock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,
+			 "PIROT_Command_DRC: PI_DRC(usb_id=%d,record_table_id=%d,source=%s,option=%d).",
+			 PIROT_USB_Get_ID(),record_table_id,COMMAND_ROTATOR_AXIS,option);
+#endif /* LOGGING */
+	retval = PI_DRC(PIROT_USB_Get_ID(),&record_table_id,COMMAND_ROTATOR_AXIS,&option);
+	if(retval != TRUE)
+	{
+#ifdef MUTEXED
+		PIROT_Mutex_Unlock();
+#endif /* MUTEXED */
+		PIROT_Command_Get_PI_Library_Error(&pi_error_num,pi_error_string,STRING_LENGTH);
+		Command_Error_Number = 51;
+		sprintf(Command_Error_String,"PIROT_Command_DRC: PI_DRC failed (%d) : %s.",pi_error_num,
+			pi_error_string);
+		return FALSE;
+	}
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Unlock())
+	{
+		Command_Error_Number = 52;
+		sprintf(Command_Error_String,"PIROT_Command_DRC: failed to unlock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Command_DRC: Finished.");
+#endif /* LOGGING */
+	return TRUE;
+}
+
+/**
+ * Configure what starts a data recorder table recording. Uses the PI rotator library "PI_DRT" routine / 
+ * "DRT" command. Setting the trigger also clears the table's previously recorded data.
+ * @param record_table_id The data recorder table to configure, from 1 to PIROT_COMMAND_RECORD_TABLE_COUNT.
+ * @param trigger_source What starts the recording, e.g. DRT_TRIGGER_POSITION_COMMAND.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #Command_Error_Number
+ * @see #Command_Error_String
+ * @see #PIROT_Command_Get_PI_Library_Error
+ * @see #PIROT_COMMAND_RECORD_TABLE_COUNT
+ * @see #PIROT_COMMAND_DRT_TRIGGER_ENUM
+ * @see pirot_usb.html#PIROT_USB_Get_ID
+ * @see pirot_general.html#PIROT_Log_Format
+ * @see pirot_general.html#PIROT_Mutex_Lock
+ * @see pirot_general.html#PIROT_Mutex_Unlock
+ */
+int PIROT_Command_DRT(int record_table_id,enum PIROT_COMMAND_DRT_TRIGGER_ENUM trigger_source)
+{
+        int retval,pi_error_num,source;
+	char pi_error_string[STRING_LENGTH];
+
+	Command_Error_Number = 0;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Command_DRT(record_table_id=%d,trigger_source=%d): Started.",
+			 record_table_id,trigger_source);
+#endif /* LOGGING */
+	if((record_table_id < 1)||(record_table_id > PIROT_COMMAND_RECORD_TABLE_COUNT))
+	{
+		Command_Error_Number = 53;
+		sprintf(Command_Error_String,"PIROT_Command_DRT: record_table_id %d out of range (1..%d).",
+			record_table_id,PIROT_COMMAND_RECORD_TABLE_COUNT);
+		return FALSE;
+	}
+	source = trigger_source;
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Lock())
+	{
+		Command_Error_Number = 54;
+		sprintf(Command_Error_String,"PIROT_Command_DRT: failed to lock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,
+			 "PIROT_Command_DRT: PI_DRT(usb_id=%d,record_table_id=%d,trigger_source=%d,value=0).",
+			 PIROT_USB_Get_ID(),record_table_id,source);
+#endif /* LOGGING */
+	retval = PI_DRT(PIROT_USB_Get_ID(),&record_table_id,&source,"0",1);
+	if(retval != TRUE)
+	{
+#ifdef MUTEXED
+		PIROT_Mutex_Unlock();
+#endif /* MUTEXED */
+		PIROT_Command_Get_PI_Library_Error(&pi_error_num,pi_error_string,STRING_LENGTH);
+		Command_Error_Number = 55;
+		sprintf(Command_Error_String,"PIROT_Command_DRT: PI_DRT failed (%d) : %s.",pi_error_num,
+			pi_error_string);
+		return FALSE;
+	}
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Unlock())
+	{
+		Command_Error_Number = 56;
+		sprintf(Command_Error_String,"PIROT_Command_DRT: failed to unlock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Command_DRT: Finished.");
+#endif /* LOGGING */
+	return TRUE;
+}
+
+/**
+ * Query how many values a data recorder table has recorded since it was last triggered. 
+ * Uses the PI rotator library "PI_qDRL" routine, which issues a "DRL?" command to the controller.
+ * @param record_table_id The data recorder table to query, from 1 to PIROT_COMMAND_RECORD_TABLE_COUNT.
+ * @param value_count A pointer to an integer. On a successful call to this routine, the value
+ *        of the integer pointed to, will contain the number of recorded values.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #Command_Error_Number
+ * @see #Command_Error_String
+ * @see #PIROT_Command_Get_PI_Library_Error
+ * @see #PIROT_COMMAND_RECORD_TABLE_COUNT
+ * @see pirot_usb.html#PIROT_USB_Get_ID
+ * @see pirot_general.html#PIROT_Log_Format
+ * @see pirot_general.html#PIROT_Mutex_Lock
+ * @see pirot_general.html#PIROT_Mutex_Unlock
+ */
+int PIROT_Command_Query_DRL(int record_table_id,int *value_count)
+{
+        int retval,pi_error_num;
+	char pi_error_string[STRING_LENGTH];
+
+	Command_Error_Number = 0;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_INTERMEDIATE,"PIROT_Command_Query_DRL(record_table_id=%d): Started.",
+			 record_table_id);
+#endif /* LOGGING */
+	if((record_table_id < 1)||(record_table_id > PIROT_COMMAND_RECORD_TABLE_COUNT))
+	{
+		Command_Error_Number = 57;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRL: record_table_id %d out of range (1..%d).",
+			record_table_id,PIROT_COMMAND_RECORD_TABLE_COUNT);
+		return FALSE;
+	}
+	if(value_count == NULL)
+	{
+		Command_Error_Number = 58;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRL: value_count was NULL.");
+		return FALSE;
+	}
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Lock())
+	{
+		Command_Error_Number = 59;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRL: failed to lock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,
+			 "PIROT_Command_Query_DRL: PI_qDRL(usb_id=%d,record_table_id=%d,value_count=%p).",
+			 PIROT_USB_Get_ID(),record_table_id,value_count);
+#endif /* LOGGING */
+	retval = PI_qDRL(PIROT_USB_Get_ID(),&record_table_id,value_count,1);
+	if(retval != TRUE)
+	{
+#ifdef MUTEXED
+		PIROT_Mutex_Unlock();
+#endif /* MUTEXED */
+		PIROT_Command_Get_PI_Library_Error(&pi_error_num,pi_error_string,STRING_LENGTH);
+		Command_Error_Number = 60;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRL: PI_qDRL failed (%d) : %s.",pi_error_num,
+			pi_error_string);
+		return FALSE;
+	}
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,
+			 "PIROT_Command_Query_DRL: PI_qDRL returned value_count %d,retval %d.",(*value_count),retval);
+#endif /* LOGGING */
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Unlock())
+	{
+		Command_Error_Number = 61;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRL: failed to unlock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_INTERMEDIATE,"PIROT_Command_Query_DRL: Finished.");
+#endif /* LOGGING */
+	return TRUE;
+}
+
+/**
+ * Read back values recorded in a data recorder table, in one bulk transfer. 
+ * Uses the PI rotator library "PI_qDRR_SYNC" routine, which issues a "DRR?" command to the controller
+ * and waits for all the values to be returned.
+ * @param record_table_id The data recorder table to read, from 1 to PIROT_COMMAND_RECORD_TABLE_COUNT.
+ * @param offset The index of the first value to read (the first recorded value has index 1).
+ * @param value_count The number of values to read.
+ * @param value_list The address of an array of at least value_count doubles, to store the read values in.
+ * @return The routine returns TRUE on success and FALSE if an error occurs.
+ * @see #Command_Error_Number
+ * @see #Command_Error_String
+ * @see #PIROT_Command_Get_PI_Library_Error
+ * @see #PIROT_COMMAND_RECORD_TABLE_COUNT
+ * @see pirot_usb.html#PIROT_USB_Get_ID
+ * @see pirot_general.html#PIROT_Log_Format
+ * @see pirot_general.html#PIROT_Mutex_Lock
+ * @see pirot_general.html#PIROT_Mutex_Unlock
+ */
+int PIROT_Command_Query_DRR(int record_table_id,int offset,int value_count,double *value_list)
+{
+        int retval,pi_error_num;
+	char pi_error_string[STRING_LENGTH];
+
+	Command_Error_Number = 0;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_INTERMEDIATE,
+			 "PIROT_Command_Query_DRR(record_table_id=%d,offset=%d,value_count=%d): Started.",
+			 record_table_id,offset,value_count);
+#endif /* LOGGING */
+	if((record_table_id < 1)||(record_table_id > PIROT_COMMAND_RECORD_TABLE_COUNT))
+	{
+		Command_Error_Number = 62;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRR: record_table_id %d out of range (1..%d).",
+			record_table_id,PIROT_COMMAND_RECORD_TABLE_COUNT);
+		return FALSE;
+	}
+	if((offset < 1)||(value_count < 1))
+	{
+		Command_Error_Number = 63;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRR: offset %d or value_count %d out of range.",
+			offset,value_count);
+		return FALSE;
+	}
+	if(value_list == NULL)
+	{
+		Command_Error_Number = 64;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRR: value_list was NULL.");
+		return FALSE;
+	}
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Lock())
+	{
+		Command_Error_Number = 65;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRR: failed to lock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_VERY_VERBOSE,
+			 "PIROT_Command_Query_DRR: PI_qDRR_SYNC(usb_id=%d,record_table_id=%d,offset=%d,value_count=%d).",
+			 PIROT_USB_Get_ID(),record_table_id,offset,value_count);
+#endif /* LOGGING */
+	retval = PI_qDRR_SYNC(PIROT_USB_Get_ID(),record_table_id,offset,value_count,value_list);
+	if(retval != TRUE)
+	{
+#ifdef MUTEXED
+		PIROT_Mutex_Unlock();
+#endif /* MUTEXED */
+		PIROT_Command_Get_PI_Library_Error(&pi_error_num,pi_error_string,STRING_LENGTH);
+		Command_Error_Number = 66;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRR: PI_qDRR_SYNC failed (%d) : %s.",pi_error_num,
+			pi_error_string);
+		return FALSE;
+	}
+#ifdef MUTEXED
+	if(!PIROT_Mutex_Unlock())
+	{
+		Command_Error_Number = 67;
+		sprintf(Command_Error_String,"PIROT_Command_Query_DRR: failed to unlock mutex.");
+		return FALSE;
+	}
+#endif /* MUTEXED */
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_INTERMEDIATE,"PIROT_Command_Query_DRR: Finished.");
+#endif /* LOGGING */
+	return TRUE;
+}
+
 /**
  * Query the PI library for the current error state of the library, and error state of the underly controller.
  * We have turned off automatic error checking in PIROT_USB_Open (using PI_SetErrorCheck), so we should really
@@ -32,6 +32,7 @@
 #include "pirot_command.h"
 #include "pirot_setup.h"
 #include "pirot_move.h"
+#include "pirot_recorder.h"
 
 /* defines */
 /**
@@ -113,6 +114,7 @@ static char General_Error_String[PIROT_ERROR_STRING_LENGTH] = "";
  * @see pirot_command.html#PIROT_Command_Get_Error_Number
  * @see pirot_setup.html#PIROT_Setup_Get_Error_Number
  * @see pirot_move.html#PIROT_Move_Get_Error_Number
+ * @see pirot_recorder.html#PIROT_Recorder_Get_Error_Number
  */
 int PIROT_General_Is_Error(void)
 {
@@ -126,6 +128,8 @@ int PIROT_General_Is_Error(void)
 		found = TRUE;
 	if(PIROT_Move_Get_Error_Number() != 0)
 		found = TRUE;
+	if(PIROT_Recorder_Get_Error_Number() != 0)
+		found = TRUE;
 	if(General_Error_Number != 0)
 		found = TRUE;
 	return found;
@@ -144,6 +148,8 @@ int PIROT_General_Is_Error(void)
  * @see pirot_setup.html#PIROT_Setup_Error
  * @see pirot_move.html#PIROT_Move_Get_Error_Number
  * @see pirot_move.html#PIROT_Move_Error
+ * @see pirot_recorder.html#PIROT_Recorder_Get_Error_Number
+ * @see pirot_recorder.html#PIROT_Recorder_Error
  */
 void PIROT_General_Error(void)
 {
@@ -170,6 +176,11 @@ void PIROT_General_Error(void)
 		found = TRUE;
 		PIROT_Move_Error();
 	}
+	if(PIROT_Recorder_Get_Error_Number() != 0)
+	{
+		found = TRUE;
+		PIROT_Recorder_Error();
+	}
 	if(General_Error_Number != 0)
 	{
 		found = TRUE;
@@ -199,6 +210,8 @@ void PIROT_General_Error(void)
  * @see pirot_setup.html#PIROT_Setup_Error_String
  * @see pirot_move.html#PIROT_Move_Get_Error_Number
  * @see pirot_move.html#PIROT_Move_Error_String
+ * @see pirot_recorder.html#PIROT_Recorder_Get_Error_Number
+ * @see pirot_recorder.html#PIROT_Recorder_Error_String
  */
 void PIROT_General_Error_To_String(char *error_string)
 {
@@ -213,6 +226,10 @@ void PIROT_General_Error_To_String(char *error_string)
 	{
 		PIROT_Move_Error_String(error_string);
 	}
+	if(PIROT_Recorder_Get_Error_Number() != 0)
+	{
+		PIROT_Recorder_Error_String(error_string);
+	}
 	if(PIROT_Command_Get_Error_Number() != 0)
 	{
 		PIROT_Command_Error_String(error_string);
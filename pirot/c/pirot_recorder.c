@@ -0,0 +1,402 @@
+/* pirot_recorder.c
+** PI Rotator data recorder routines
+** $Header$
+*/
+/**
+ * PI Rotator data recorder routines. These use the controller's onboard data recorder to sample the
+ * rotator position at a fixed rate during a run, so the position the rotator was at when each frame finished
+ * exposing can be retrieved in bulk at the end of the run, rather than querying the position 
+ * (PIROT_Command_Query_POS) after every frame.
+ * @author Chris Mottram
+ * @version $Revision$
+ */
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_SOURCE 1
+/**
+ * This hash define is needed before including source files give us POSIX.4/IEEE1003.1b-1993 prototypes.
+ */
+#define _POSIX_C_SOURCE 199309L
+#include <errno.h>   /* Error number definitions */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log_udp.h"
+#include "pirot_general.h"
+#include "pirot_command.h"
+#include "pirot_recorder.h"
+
+/* structures */
+/**
+ * Structure holding local data pertinent to the recorder module. This consists of:
+ * <ul>
+ * <li><b>Sample_Interval</b> The time between recorded position samples, in seconds.
+ * <li><b>Sample_Count</b> The number of position samples read back from the controller into Position_List.
+ * <li><b>Position_List</b> The list of recorded rotator positions, in degrees. The first sample was recorded
+ *     when the recording was triggered (by the run's MOV command).
+ * </ul>
+ * @see pirot_command.html#PIROT_COMMAND_RECORD_TABLE_LENGTH
+ */
+struct Recorder_Struct
+{
+	double Sample_Interval;
+	int Sample_Count;
+	double Position_List[PIROT_COMMAND_RECORD_TABLE_LENGTH];
+};
+
+/* internal variables */
+/**
+ * Revision Control System identifier.
+ */
+static char rcsid[] = "$Id$";
+/**
+ * Variable holding error code of last operation performed.
+ */
+static int Recorder_Error_Number = 0;
+/**
+ * Local variable holding description of the last error that occured.
+ * @see #PIROT_ERROR_STRING_LENGTH
+ */
+static char Recorder_Error_String[PIROT_ERROR_STRING_LENGTH] = "";
+/**
+ * The internal data used by recorder routines.
+ * @see #Recorder_Struct
+ */
+static struct Recorder_Struct Recorder_Data;
+
+/* =======================================
+**  external functions 
+** ======================================= */
+/**
+ * Arm the controller's data recorder, so that it records the rotator's current position at a fixed rate,
+ * starting when the next position command (MOV) is sent. The record table rate is chosen so that a run of
+ * the specified duration fits within one record table (PIROT_COMMAND_RECORD_TABLE_LENGTH samples).
+ * <ul>
+ * <li>We compute the record table rate in servo cycles, as duration divided by the number of servo cycles
+ *     in a full record table, rounded up.
+ * <li>We call PIROT_Command_RTR to set the record table rate.
+ * <li>We call PIROT_Command_DRC to record the rotator's current position in table PIROT_RECORDER_TABLE_ID.
+ * <li>We call PIROT_Command_DRT to start recording on the next position command.
+ * </ul>
+ * @param duration The length of time the recorder should record for, in seconds. This should be the 
+ *        expected length of the run, including the time to move from the start position to the first trigger.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #PIROT_RECORDER_TABLE_ID
+ * @see #Recorder_Error_Number
+ * @see #Recorder_Error_String
+ * @see #Recorder_Data
+ * @see pirot_command.html#PIROT_COMMAND_SERVO_CYCLE_TIME
+ * @see pirot_command.html#PIROT_COMMAND_RECORD_TABLE_LENGTH
+ * @see pirot_command.html#PIROT_Command_RTR
+ * @see pirot_command.html#PIROT_Command_DRC
+ * @see pirot_command.html#PIROT_Command_DRT
+ * @see pirot_general.html#PIROT_Log_Format
+ */
+int PIROT_Recorder_Arm(double duration)
+{
+	int record_table_rate;
+
+	Recorder_Error_Number = 0;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Recorder_Arm(duration=%.2f s): Started.",duration);
+#endif /* LOGGING */
+	if(duration <= 0.0)
+	{
+		Recorder_Error_Number = 1;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Arm: duration %.2f out of range.",duration);
+		return FALSE;
+	}
+	record_table_rate = (int)ceil(duration/(PIROT_COMMAND_SERVO_CYCLE_TIME*PIROT_COMMAND_RECORD_TABLE_LENGTH));
+	if(record_table_rate < 1)
+		record_table_rate = 1;
+	Recorder_Data.Sample_Interval = record_table_rate*PIROT_COMMAND_SERVO_CYCLE_TIME;
+	Recorder_Data.Sample_Count = 0;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_VERBOSE,
+			 "PIROT_Recorder_Arm: Using record table rate %d servo cycles (sample interval %.4f s).",
+			 record_table_rate,Recorder_Data.Sample_Interval);
+#endif /* LOGGING */
+	if(!PIROT_Command_RTR(record_table_rate))
+	{
+		Recorder_Error_Number = 2;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Arm: Failed to set record table rate %d.",
+			record_table_rate);
+		return FALSE;
+	}
+	if(!PIROT_Command_DRC(PIROT_RECORDER_TABLE_ID,DRC_OPTION_CURRENT_POSITION))
+	{
+		Recorder_Error_Number = 3;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Arm: Failed to configure record table %d.",
+			PIROT_RECORDER_TABLE_ID);
+		return FALSE;
+	}
+	if(!PIROT_Command_DRT(PIROT_RECORDER_TABLE_ID,DRT_TRIGGER_POSITION_COMMAND))
+	{
+		Recorder_Error_Number = 4;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Arm: Failed to set trigger of record table %d.",
+			PIROT_RECORDER_TABLE_ID);
+		return FALSE;
+	}
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Recorder_Arm: Finished.");
+#endif /* LOGGING */
+	return TRUE;
+}
+
+/**
+ * Read back the rotator positions recorded since PIROT_Recorder_Arm was called (and the recorder triggered),
+ * into Recorder_Data. This should be called once the run has finished, as it transfers the whole
+ * record table across the USB link.
+ * <ul>
+ * <li>We call PIROT_Command_Query_DRL to find out how many positions have been recorded.
+ * <li>We call PIROT_Command_Query_DRR to read them all back in one transfer.
+ * </ul>
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #PIROT_RECORDER_TABLE_ID
+ * @see #Recorder_Error_Number
+ * @see #Recorder_Error_String
+ * @see #Recorder_Data
+ * @see pirot_command.html#PIROT_COMMAND_RECORD_TABLE_LENGTH
+ * @see pirot_command.html#PIROT_Command_Query_DRL
+ * @see pirot_command.html#PIROT_Command_Query_DRR
+ * @see pirot_general.html#PIROT_Log_Format
+ */
+int PIROT_Recorder_Read(void)
+{
+	int value_count;
+
+	Recorder_Error_Number = 0;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,"PIROT_Recorder_Read: Started.");
+#endif /* LOGGING */
+	Recorder_Data.Sample_Count = 0;
+	if(!PIROT_Command_Query_DRL(PIROT_RECORDER_TABLE_ID,&value_count))
+	{
+		Recorder_Error_Number = 5;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Read: Failed to query record table %d length.",
+			PIROT_RECORDER_TABLE_ID);
+		return FALSE;
+	}
+	if(value_count < 2)
+	{
+		Recorder_Error_Number = 6;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Read: Record table %d only contains %d values.",
+			PIROT_RECORDER_TABLE_ID,value_count);
+		return FALSE;
+	}
+	if(value_count > PIROT_COMMAND_RECORD_TABLE_LENGTH)
+		value_count = PIROT_COMMAND_RECORD_TABLE_LENGTH;
+	if(!PIROT_Command_Query_DRR(PIROT_RECORDER_TABLE_ID,1,value_count,Recorder_Data.Position_List))
+	{
+		Recorder_Error_Number = 7;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Read: Failed to read %d values from record table %d.",
+			value_count,PIROT_RECORDER_TABLE_ID);
+		return FALSE;
+	}
+	Recorder_Data.Sample_Count = value_count;
+#if LOGGING > 0
+	PIROT_Log_Format(LOG_VERBOSITY_TERSE,
+			 "PIROT_Recorder_Read: Finished, read %d positions from %.3f to %.3f degrees.",
+			 Recorder_Data.Sample_Count,Recorder_Data.Position_List[0],
+			 Recorder_Data.Position_List[Recorder_Data.Sample_Count-1]);
+#endif /* LOGGING */
+	return TRUE;
+}
+
+/**
+ * Set the recorded rotator positions directly, rather than reading them back from the controller with
+ * PIROT_Recorder_Read. This allows PIROT_Recorder_Get_End_Position to be used on positions recorded previously,
+ * or on test data.
+ * @param sample_interval The time between recorded positions, in seconds.
+ * @param position_list The list of recorded rotator positions, in degrees.
+ * @param sample_count The number of positions in position_list, between 2 and PIROT_COMMAND_RECORD_TABLE_LENGTH.
+ * @return The routine returns TRUE on success and FALSE on failure.
+ * @see #Recorder_Error_Number
+ * @see #Recorder_Error_String
+ * @see #Recorder_Data
+ * @see pirot_command.html#PIROT_COMMAND_RECORD_TABLE_LENGTH
+ */
+int PIROT_Recorder_Set_Positions(double sample_interval,double *position_list,int sample_count)
+{
+	Recorder_Error_Number = 0;
+	if(position_list == NULL)
+	{
+		Recorder_Error_Number = 12;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Set_Positions: position_list was NULL.");
+		return FALSE;
+	}
+	if(sample_interval <= 0.0)
+	{
+		Recorder_Error_Number = 13;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Set_Positions: sample_interval %.4f out of range.",
+			sample_interval);
+		return FALSE;
+	}
+	if((sample_count < 2)||(sample_count > PIROT_COMMAND_RECORD_TABLE_LENGTH))
+	{
+		Recorder_Error_Number = 14;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Set_Positions: sample_count %d out of range (2..%d).",
+			sample_count,PIROT_COMMAND_RECORD_TABLE_LENGTH);
+		return FALSE;
+	}
+	Recorder_Data.Sample_Interval = sample_interval;
+	memcpy(Recorder_Data.Position_List,position_list,sample_count*sizeof(double));
+	Recorder_Data.Sample_Count = sample_count;
+	return TRUE;
+}
+
+/**
+ * Given the rotator position at which an exposure was triggered, and the exposure length, use the recorded
+ * positions to find the rotator position at the end of the exposure. The rotator is assumed to be moving
+ * at a constant positive velocity between samples, so positions and times are linearly interpolated.
+ * <ul>
+ * <li>We search Recorder_Data.Position_List for the first sample strictly past start_position, and interpolate
+ *     the time at which the rotator crossed start_position between it and the previous sample. Searching
+ *     strictly past start_position means repeated samples (e.g. before the rotator has started moving) are
+ *     skipped, so the interpolation never divides by zero, and the crossing time is the last time the rotator
+ *     was at start_position.
+ * <li>We add exposure_length to get the time the exposure ended.
+ * <li>We interpolate the rotator position at that time.
+ * </ul>
+ * PIROT_Recorder_Read must have been successfully called first.
+ * @param start_position The (absolute) rotator position the exposure was triggered at, in degrees.
+ * @param exposure_length The length of the exposure, in seconds.
+ * @param end_position The address of a double to store the (absolute) rotator position at the end of the 
+ *        exposure, in degrees.
+ * @return The routine returns TRUE on success and FALSE on failure. FALSE is returned if the start
+ *         or end of the exposure lies outside the recorded positions.
+ * @see #Recorder_Error_Number
+ * @see #Recorder_Error_String
+ * @see #Recorder_Data
+ */
+int PIROT_Recorder_Get_End_Position(double start_position,double exposure_length,double *end_position)
+{
+	double start_time,end_time,fraction;
+	int index;
+
+	Recorder_Error_Number = 0;
+	if(end_position == NULL)
+	{
+		Recorder_Error_Number = 8;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Get_End_Position: end_position was NULL.");
+		return FALSE;
+	}
+	if(Recorder_Data.Sample_Count < 2)
+	{
+		Recorder_Error_Number = 9;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Get_End_Position: Only %d recorded positions.",
+			Recorder_Data.Sample_Count);
+		return FALSE;
+	}
+	/* find the first sample strictly past start_position, so Position_List[index-1] < Position_List[index] */
+	index = 1;
+	while((index < Recorder_Data.Sample_Count)&&(Recorder_Data.Position_List[index] <= start_position))
+		index++;
+	if((index >= Recorder_Data.Sample_Count)||(Recorder_Data.Position_List[index-1] > start_position))
+	{
+		Recorder_Error_Number = 10;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Get_End_Position: Start position %.3f not "
+			"within recorded positions %.3f to %.3f.",start_position,Recorder_Data.Position_List[0],
+			Recorder_Data.Position_List[Recorder_Data.Sample_Count-1]);
+		return FALSE;
+	}
+	fraction = (start_position-Recorder_Data.Position_List[index-1])/
+		(Recorder_Data.Position_List[index]-Recorder_Data.Position_List[index-1]);
+	start_time = ((index-1)+fraction)*Recorder_Data.Sample_Interval;
+	end_time = start_time+exposure_length;
+	/* interpolate the position at end_time */
+	index = (int)floor(end_time/Recorder_Data.Sample_Interval);
+	if((index < 0)||((index+1) >= Recorder_Data.Sample_Count))
+	{
+		Recorder_Error_Number = 11;
+		sprintf(Recorder_Error_String,"PIROT_Recorder_Get_End_Position: End time %.3f s not "
+			"within recorded time 0 to %.3f s.",end_time,
+			(Recorder_Data.Sample_Count-1)*Recorder_Data.Sample_Interval);
+		return FALSE;
+	}
+	fraction = (end_time/Recorder_Data.Sample_Interval)-index;
+	(*end_position) = Recorder_Data.Position_List[index]+
+		(fraction*(Recorder_Data.Position_List[index+1]-Recorder_Data.Position_List[index]));
+	return TRUE;
+}
+
+/**
+ * Return the number of rotator positions read back from the data recorder by the last PIROT_Recorder_Read.
+ * @return The number of recorded positions.
+ * @see #Recorder_Data
+ */
+int PIROT_Recorder_Get_Sample_Count(void)
+{
+	return Recorder_Data.Sample_Count;
+}
+
+/**
+ * Return the time between recorded rotator positions, as configured by the last PIROT_Recorder_Arm.
+ * @return The sample interval in seconds.
+ * @see #Recorder_Data
+ */
+double PIROT_Recorder_Get_Sample_Interval(void)
+{
+	return Recorder_Data.Sample_Interval;
+}
+
+/**
+ * Get the current value of the error number.
+ * @return The current value of the error number.
+ * @see #Recorder_Error_Number
+ */
+int PIROT_Recorder_Get_Error_Number(void)
+{
+	return Recorder_Error_Number;
+}
+
+/**
+ * The error routine that reports any errors occuring in a standard way.
+ * @see #Recorder_Error_Number
+ * @see #Recorder_Error_String
+ * @see pirot_general.html#PIROT_General_Get_Current_Time_String
+ */
+void PIROT_Recorder_Error(void)
+{
+	char time_string[32];
+
+	PIROT_General_Get_Current_Time_String(time_string,32);
+	/* if the error number is zero an error message has not been set up
+	** This is in itself an error as we should not be calling this routine
+	** without there being an error to display */
+	if(Recorder_Error_Number == 0)
+		sprintf(Recorder_Error_String,"Logic Error:No Error defined");
+	fprintf(stderr,"%s PIROT_Recorder:Error(%d) : %s\n",time_string,Recorder_Error_Number,
+		Recorder_Error_String);
+}
+
+/**
+ * The error routine that reports any errors occuring in a standard way. This routine places the
+ * generated error string at the end of a passed in string argument.
+ * @param error_string A string to put the generated error in. This string should be initialised before
+ * being passed to this routine. The routine will try to concatenate it's error string onto the end
+ * of any string already in existance.
+ * @see #Recorder_Error_Number
+ * @see #Recorder_Error_String
+ * @see pirot_general.html#PIROT_General_Get_Current_Time_String
+ */
+void PIROT_Recorder_Error_String(char *error_string)
+{
+	char time_string[32];
+
+	PIROT_General_Get_Current_Time_String(time_string,32);
+	/* if the error number is zero an error message has not been set up
+	** This is in itself an error as we should not be calling this routine
+	** without there being an error to display */
+	if(Recorder_Error_Number == 0)
+		sprintf(Recorder_Error_String,"Logic Error:No Error defined");
+	sprintf(error_string+strlen(error_string),"%s PIROT_Recorder:Error(%d) : %s\n",time_string,
+		Recorder_Error_Number,Recorder_Error_String);
+}
+
+/* =======================================
+**  internal functions 
+** ======================================= */
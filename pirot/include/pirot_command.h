@@ -56,6 +56,57 @@ enum PIROT_COMMAND_CTO_TRIGGER_MODE_ENUM
 	CTO_TRIGGER_MODE_HARDWARE_TRIGGER=9
 };
 
+/**
+ * The controller's servo cycle time in seconds. The data recorder's record table rate (RTR) is in units of this.
+ * See the user manual C-867-1U-UserManual-MS223E200.pdf.
+ */
+#define PIROT_COMMAND_SERVO_CYCLE_TIME     (0.00005)
+/**
+ * The number of data recorder tables the controller has.
+ */
+#define PIROT_COMMAND_RECORD_TABLE_COUNT   (2)
+/**
+ * The maximum number of values the controller can record in one data recorder table, when only one
+ * table is configured.
+ */
+#define PIROT_COMMAND_RECORD_TABLE_LENGTH  (1024)
+
+/**
+ * Valid record options for the DRC command (what to record for the record source axis), 
+ * as described in the rotators user manual:
+ * <ul>
+ * <li>DRC_OPTION_NOTHING
+ * <li>DRC_OPTION_TARGET_POSITION
+ * <li>DRC_OPTION_CURRENT_POSITION
+ * <li>DRC_OPTION_POSITION_ERROR
+ * </ul>
+ */
+enum PIROT_COMMAND_DRC_OPTION_ENUM
+{
+	DRC_OPTION_NOTHING=0,
+	DRC_OPTION_TARGET_POSITION=1,
+	DRC_OPTION_CURRENT_POSITION=2,
+	DRC_OPTION_POSITION_ERROR=3
+};
+
+/**
+ * Valid trigger sources for the DRT command (what starts the data recorder recording),
+ * as described in the rotators user manual:
+ * <ul>
+ * <li>DRT_TRIGGER_DEFAULT - recording is started by a step/impulse response command.
+ * <li>DRT_TRIGGER_POSITION_COMMAND - recording is started by any command changing the target position (e.g. MOV).
+ * <li>DRT_TRIGGER_NEXT_COMMAND - recording is started by the next command, then the trigger reverts to the default.
+ * <li>DRT_TRIGGER_EXTERNAL - recording is started by an external trigger input.
+ * </ul>
+ */
+enum PIROT_COMMAND_DRT_TRIGGER_ENUM
+{
+	DRT_TRIGGER_DEFAULT=0,
+	DRT_TRIGGER_POSITION_COMMAND=1,
+	DRT_TRIGGER_NEXT_COMMAND=2,
+	DRT_TRIGGER_EXTERNAL=3
+};
+
 /**
  * Hash define to determine whether the parameter is a valid CTO trigger parameter number.
  * @param p The parameter number to test.
@@ -75,6 +126,11 @@ extern int PIROT_Command_VEL(double velocity);
 extern int PIROT_Command_Query_ERR(int *error_number);
 extern int PIROT_Command_Query_ONT(int *on_target);
 extern int PIROT_Command_Query_POS(double *position);
+extern int PIROT_Command_RTR(int record_table_rate);
+extern int PIROT_Command_DRC(int record_table_id,enum PIROT_COMMAND_DRC_OPTION_ENUM record_option);
+extern int PIROT_Command_DRT(int record_table_id,enum PIROT_COMMAND_DRT_TRIGGER_ENUM trigger_source);
+extern int PIROT_Command_Query_DRL(int record_table_id,int *value_count);
+extern int PIROT_Command_Query_DRR(int record_table_id,int offset,int value_count,double *value_list);
 extern int PIROT_Command_Get_PI_Library_Error(int *pi_error_num,char *pi_error_string,int pi_error_string_length);
 extern int PIROT_Command_Get_Error_Number(void);
 extern int PIROT_Command_STP(void);
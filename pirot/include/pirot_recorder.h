@@ -0,0 +1,28 @@
+/* pirot_recorder.h
+** $Header$
+*/
+
+#ifndef PIROT_RECORDER_H
+#define PIROT_RECORDER_H
+
+/**
+ * The data recorder table used to record the rotator's position.
+ * @see pirot_command.html#PIROT_COMMAND_RECORD_TABLE_COUNT
+ */
+#define PIROT_RECORDER_TABLE_ID          (1)
+
+extern int PIROT_Recorder_Arm(double duration);
+extern int PIROT_Recorder_Read(void);
+extern int PIROT_Recorder_Set_Positions(double sample_interval,double *position_list,int sample_count);
+extern int PIROT_Recorder_Get_End_Position(double start_position,double exposure_length,double *end_position);
+extern int PIROT_Recorder_Get_Sample_Count(void);
+extern double PIROT_Recorder_Get_Sample_Interval(void);
+extern int PIROT_Recorder_Get_Error_Number(void);
+extern void PIROT_Recorder_Error(void);
+extern void PIROT_Recorder_Error_String(char *error_string);
+
+/*
+** $Log$
+*/
+
+#endif
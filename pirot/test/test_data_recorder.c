@@ -0,0 +1,274 @@
+/* test_data_recorder.c
+** $Header$
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "log_udp.h"
+#include "pirot_command.h"
+#include "pirot_general.h"
+#include "pirot_move.h"
+#include "pirot_recorder.h"
+#include "pirot_setup.h"
+#include "pirot_usb.h"
+
+/**
+ * Length of some of the strings used in this program.
+ */
+#define STRING_LENGTH        (256)
+/**
+ * Verbosity log level : initialised to LOG_VERBOSITY_VERY_VERBOSE.
+ */
+static int Log_Level = LOG_VERBOSITY_VERY_VERBOSE;
+/**
+ * The USB device to connect to.
+ * @see #STRING_LENGTH
+ */
+static char Device_Name[STRING_LENGTH];
+/**
+ * The position to move the rotator to.
+ */
+static double Position = 360.0;
+/**
+ * The length of time to record the rotator position for, in seconds.
+ */
+static double Duration = 20.0;
+/**
+ * The exposure length to use when computing end positions from the recorded positions, in seconds.
+ */
+static double Exposure_Length = 0.4;
+
+static int Parse_Arguments(int argc, char *argv[]);
+static void Help(void);
+
+/* ------------------------------------------------------------------
+**          External functions 
+** ------------------------------------------------------------------ */
+
+/**
+ * Main program. Arms the rotator's data recorder, moves the rotator to a position, waits for it to get there,
+ * and reads back the recorded positions. The rotator end position of an exposure of length Exposure_Length
+ * triggered at each PIROT_SETUP_TRIGGER_STEP_ANGLE_16 step from 0 to Position is then printed.
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @see #Parse_Arguments
+ * @see #Device_Name
+ * @see #Log_Level
+ * @see #Position
+ * @see #Duration
+ * @see #Exposure_Length
+ * @see ../cdocs/pirot_general.html#PIROT_General_Set_Log_Filter_Level
+ * @see ../cdocs/pirot_general.html#PIROT_Set_Log_Filter_Function
+ * @see ../cdocs/pirot_general.html#PIROT_Log_Filter_Level_Absolute
+ * @see ../cdocs/pirot_general.html#PIROT_Set_Log_Handler_Function
+ * @see ../cdocs/pirot_general.html#PIROT_Log_Handler_Stdout
+ * @see ../cdocs/pirot_general.html#PIROT_Log
+ * @see ../cdocs/pirot_general.html#PIROT_General_Error
+ * @see ../cdocs/pirot_usb.html#PIROT_USB_Open
+ * @see ../cdocs/pirot_usb.html#PIROT_USB_BAUD_RATE
+ * @see ../cdocs/pirot_usb.html#PIROT_USB_Close
+ * @see ../cdocs/pirot_command.html#PIROT_Command_MOV
+ * @see ../cdocs/pirot_move.html#PIROT_Move_Wait_For_On_Target
+ * @see ../cdocs/pirot_recorder.html#PIROT_Recorder_Arm
+ * @see ../cdocs/pirot_recorder.html#PIROT_Recorder_Read
+ * @see ../cdocs/pirot_recorder.html#PIROT_Recorder_Get_End_Position
+ * @see ../cdocs/pirot_recorder.html#PIROT_Recorder_Get_Sample_Count
+ * @see ../cdocs/pirot_recorder.html#PIROT_Recorder_Get_Sample_Interval
+ * @see ../cdocs/pirot_setup.html#PIROT_SETUP_TRIGGER_STEP_ANGLE_16
+ */
+int main(int argc, char *argv[])
+{
+	double start_position,end_position;
+
+	/* parse arguments */
+	fprintf(stdout,"test_data_recorder : Parsing Arguments.\n");
+	if(!Parse_Arguments(argc,argv))
+		return 1;
+	PIROT_General_Set_Log_Filter_Level(Log_Level);
+	PIROT_Set_Log_Filter_Function(PIROT_Log_Filter_Level_Absolute);
+	PIROT_Set_Log_Handler_Function(PIROT_Log_Handler_Stdout);
+        /* open device */
+	PIROT_Log(LOG_VERBOSITY_TERSE,"test_data_recorder : Connecting to controller.");
+	if(!PIROT_USB_Open(Device_Name,PIROT_USB_BAUD_RATE))
+	{
+		PIROT_General_Error();
+		return 2;
+	}
+	fprintf(stdout,"test_data_recorder:Arming data recorder for %.2f seconds.\n",Duration);
+	if(!PIROT_Recorder_Arm(Duration))
+	{
+		PIROT_General_Error();
+		PIROT_USB_Close();
+		return 3;
+	}
+	fprintf(stdout,"test_data_recorder:Moving to position %.2f.\n",Position);
+	if(!PIROT_Command_MOV(Position))
+	{
+		PIROT_General_Error();
+		PIROT_USB_Close();
+		return 4;
+	}
+	if(!PIROT_Move_Wait_For_On_Target((int)(Duration*1000.0)))
+	{
+		PIROT_General_Error();
+		PIROT_USB_Close();
+		return 5;
+	}
+	fprintf(stdout,"test_data_recorder:Reading data recorder.\n");
+	if(!PIROT_Recorder_Read())
+	{
+		PIROT_General_Error();
+		PIROT_USB_Close();
+		return 6;
+	}
+	fprintf(stdout,"test_data_recorder:Read %d positions at %.4f second intervals.\n",
+		PIROT_Recorder_Get_Sample_Count(),PIROT_Recorder_Get_Sample_Interval());
+	for(start_position = 0.0; start_position < Position; start_position += PIROT_SETUP_TRIGGER_STEP_ANGLE_16)
+	{
+		if(PIROT_Recorder_Get_End_Position(start_position,Exposure_Length,&end_position))
+		{
+			fprintf(stdout,"test_data_recorder:Start position %.3f : end position %.3f (arc %.3f).\n",
+				start_position,end_position,end_position-start_position);
+		}
+		else
+			PIROT_General_Error();
+	}
+	fprintf(stdout,"test_data_recorder:Closing connection.\n");
+	PIROT_USB_Close();
+	return 0;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions 
+** ------------------------------------------------------------------ */
+
+/**
+ * Routine to parse command line arguments.
+ * @param argc The number of arguments sent to the program.
+ * @param argv An array of argument strings.
+ * @see #Device_Name
+ * @see #Log_Level
+ * @see #Position
+ * @see #Duration
+ * @see #Exposure_Length
+ */
+static int Parse_Arguments(int argc, char *argv[])
+{
+	int i,retval;
+
+	for(i=1;i<argc;i++)
+	{
+		if((strcmp(argv[i],"-d")==0)||(strcmp(argv[i],"-device_name")==0))
+		{
+			if((i+1)<argc)
+			{
+				strncpy(Device_Name,argv[i+1],STRING_LENGTH-1);
+				Device_Name[STRING_LENGTH-1] = '\0';
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:device_name requires a USB device.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-duration")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%lf",&Duration);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse duration %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-duration requires a length of time in seconds.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-e")==0)||(strcmp(argv[i],"-exposure_length")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%lf",&Exposure_Length);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse exposure length %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-exposure_length requires a length of time in seconds.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-help")==0))
+		{
+			Help();
+			return FALSE;
+		}
+		else if((strcmp(argv[i],"-l")==0)||(strcmp(argv[i],"-log_level")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%d",&Log_Level);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse log level %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-log_level requires a number 0..5.\n");
+				return FALSE;
+			}
+		}
+		else if((strcmp(argv[i],"-p")==0)||(strcmp(argv[i],"-position")==0))
+		{
+			if((i+1)<argc)
+			{
+				retval = sscanf(argv[i+1],"%lf",&Position);
+				if(retval != 1)
+				{
+					fprintf(stderr,"Parse_Arguments:Failed to parse position %s.\n",argv[i+1]);
+					return FALSE;
+				}
+				i++;
+			}
+			else
+			{
+				fprintf(stderr,"Parse_Arguments:-position requires a target position (0..36000.0).\n");
+				return FALSE;
+			}
+		}
+		else
+		{
+			fprintf(stderr,"Parse_Arguments:argument '%s' not recognized.\n",argv[i]);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Help routine.
+ */
+static void Help(void)
+{
+	fprintf(stdout,"Test Data Recorder:Help.\n");
+	fprintf(stdout,"This program arms the Physik Instrumente rotator's data recorder, moves the rotator,\n");
+	fprintf(stdout,"and reads back the recorded rotator positions.\n");
+	fprintf(stdout,"test_data_recorder -d[evice_name] <USB device> [-p[osition] <n>] [-duration <s>]\n");
+	fprintf(stdout,"\t[-e[xposure_length] <s>] [-l[og_level <0..5>] [-help].\n");
+}
+/*
+** $Log$
+*/
@@ -0,0 +1,122 @@
+/* test_recorder_end_position.c
+** $Header$
+*/
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "log_udp.h"
+#include "pirot_general.h"
+#include "pirot_recorder.h"
+
+/**
+ * The number of recorded positions in the test data.
+ */
+#define SAMPLE_COUNT         (10)
+/**
+ * The time between recorded positions in the test data, in seconds.
+ */
+#define SAMPLE_INTERVAL      (0.1)
+/**
+ * How close a computed end position has to be to the expected one, in degrees.
+ */
+#define TOLERANCE            (1.0e-9)
+
+static int Test_End_Position(char *description,double *position_list,double start_position,double exposure_length,
+			     double expected_end_position);
+
+/* ------------------------------------------------------------------
+**          External functions
+** ------------------------------------------------------------------ */
+
+/**
+ * Main program. Loads some synthetic recorded rotator positions using PIROT_Recorder_Set_Positions, and checks
+ * the end positions PIROT_Recorder_Get_End_Position computes from them. This does not need a rotator.
+ * The test data includes recordings where the rotator has not yet started moving, so the leading samples
+ * are repeated, and a recording where the rotator pauses mid-way.
+ * @param argc The number of arguments to the program.
+ * @param argv An array of argument strings.
+ * @return The program returns 0 if all the tests passed, and 1 otherwise.
+ * @see #Test_End_Position
+ */
+int main(int argc, char *argv[])
+{
+	/* moving at 10 degrees per sample (100 degrees/s) */
+	double moving_list[SAMPLE_COUNT] = {0.0,10.0,20.0,30.0,40.0,50.0,60.0,70.0,80.0,90.0};
+	/* stationary at 0 degrees for 3 samples before starting to move */
+	double repeated_start_list[SAMPLE_COUNT] = {0.0,0.0,0.0,10.0,20.0,30.0,40.0,50.0,60.0,70.0};
+	/* pauses at 30 degrees for 3 samples */
+	double repeated_middle_list[SAMPLE_COUNT] = {0.0,10.0,20.0,30.0,30.0,30.0,40.0,50.0,60.0,70.0};
+	int failed_count = 0;
+
+	fprintf(stdout,"test_recorder_end_position : Started.\n");
+	if(!Test_End_Position("moving, start on a sample",moving_list,20.0,0.2,40.0))
+		failed_count++;
+	if(!Test_End_Position("moving, start between samples",moving_list,25.0,0.2,45.0))
+		failed_count++;
+	if(!Test_End_Position("repeated leading samples, start on them",repeated_start_list,0.0,0.2,20.0))
+		failed_count++;
+	if(!Test_End_Position("repeated leading samples, start after them",repeated_start_list,15.0,0.2,35.0))
+		failed_count++;
+	if(!Test_End_Position("pause mid-way, start on it",repeated_middle_list,30.0,0.2,50.0))
+		failed_count++;
+	if(!Test_End_Position("pause mid-way, end on it",repeated_middle_list,10.0,0.3,30.0))
+		failed_count++;
+	if(failed_count > 0)
+	{
+		fprintf(stdout,"test_recorder_end_position : %d tests FAILED.\n",failed_count);
+		return 1;
+	}
+	fprintf(stdout,"test_recorder_end_position : All tests passed.\n");
+	return 0;
+}
+
+/* ------------------------------------------------------------------
+**          Internal functions
+** ------------------------------------------------------------------ */
+
+/**
+ * Load a list of recorded positions, compute the end position of an exposure, and compare it with the
+ * expected end position.
+ * @param description A description of the test, printed with the result.
+ * @param position_list The recorded positions to load, of length SAMPLE_COUNT.
+ * @param start_position The rotator position the exposure was triggered at, in degrees.
+ * @param exposure_length The length of the exposure, in seconds.
+ * @param expected_end_position The end position the exposure should have, in degrees.
+ * @return The routine returns TRUE if the test passed, and FALSE if it failed.
+ * @see #SAMPLE_COUNT
+ * @see #SAMPLE_INTERVAL
+ * @see #TOLERANCE
+ * @see ../cdocs/pirot_recorder.html#PIROT_Recorder_Set_Positions
+ * @see ../cdocs/pirot_recorder.html#PIROT_Recorder_Get_End_Position
+ * @see ../cdocs/pirot_general.html#PIROT_General_Error
+ */
+static int Test_End_Position(char *description,double *position_list,double start_position,double exposure_length,
+			     double expected_end_position)
+{
+	double end_position;
+
+	if(!PIROT_Recorder_Set_Positions(SAMPLE_INTERVAL,position_list,SAMPLE_COUNT))
+	{
+		PIROT_General_Error();
+		fprintf(stdout,"test_recorder_end_position : %s : FAILED to set positions.\n",description);
+		return FALSE;
+	}
+	if(!PIROT_Recorder_Get_End_Position(start_position,exposure_length,&end_position))
+	{
+		PIROT_General_Error();
+		fprintf(stdout,"test_recorder_end_position : %s : FAILED to get end position.\n",description);
+		return FALSE;
+	}
+	if(isnan(end_position)||(fabs(end_position-expected_end_position) > TOLERANCE))
+	{
+		fprintf(stdout,"test_recorder_end_position : %s : FAILED, start %.3f end %.3f (expected %.3f).\n",
+			description,start_position,end_position,expected_end_position);
+		return FALSE;
+	}
+	fprintf(stdout,"test_recorder_end_position : %s : start %.3f end %.3f : passed.\n",description,
+		start_position,end_position);
+	return TRUE;
+}
+/*
+** $Log$
+*/